@@ -121,16 +121,16 @@ void
 radv_optimize_nir(struct nir_shader *shader, bool optimize_conservatively,
                   bool allow_copies)
 {
-        bool progress;
+        nir_pass_loop loop;
+        UNUSED bool progress;
 
+        nir_pass_loop_init(&loop);
         do {
-                progress = false;
+		NIR_LOOP_PASS(&loop, shader, nir_split_array_vars, nir_var_function_temp);
+		NIR_LOOP_PASS(&loop, shader, nir_shrink_vec_array_vars, nir_var_function_temp);
 
-		NIR_PASS(progress, shader, nir_split_array_vars, nir_var_function_temp);
-		NIR_PASS(progress, shader, nir_shrink_vec_array_vars, nir_var_function_temp);
-
-                NIR_PASS_V(shader, nir_lower_vars_to_ssa);
-		NIR_PASS_V(shader, nir_lower_pack);
+                NIR_LOOP_PASS_V(&loop, shader, nir_lower_vars_to_ssa);
+		NIR_LOOP_PASS_V(&loop, shader, nir_lower_pack);
 
 		if (allow_copies) {
 			/* Only run this pass in the first call to
@@ -138,36 +138,36 @@ radv_optimize_nir(struct nir_shader *shader, bool optimize_conservatively,
 			 * lowered away any copy_deref instructions and we
 			 *  don't want to introduce any more.
 			*/
-			NIR_PASS(progress, shader, nir_opt_find_array_copies);
+			NIR_LOOP_PASS(&loop, shader, nir_opt_find_array_copies);
 		}
 
-		NIR_PASS(progress, shader, nir_opt_copy_prop_vars);
-		NIR_PASS(progress, shader, nir_opt_dead_write_vars);
+		NIR_LOOP_PASS(&loop, shader, nir_opt_copy_prop_vars);
+		NIR_LOOP_PASS(&loop, shader, nir_opt_dead_write_vars);
 
-                NIR_PASS_V(shader, nir_lower_alu_to_scalar);
-                NIR_PASS_V(shader, nir_lower_phis_to_scalar);
+                NIR_LOOP_PASS_V(&loop, shader, nir_lower_alu_to_scalar);
+                NIR_LOOP_PASS_V(&loop, shader, nir_lower_phis_to_scalar);
 
-                NIR_PASS(progress, shader, nir_copy_prop);
-                NIR_PASS(progress, shader, nir_opt_remove_phis);
-                NIR_PASS(progress, shader, nir_opt_dce);
-                if (nir_opt_trivial_continues(shader)) {
-                        progress = true;
-                        NIR_PASS(progress, shader, nir_copy_prop);
-			NIR_PASS(progress, shader, nir_opt_remove_phis);
-                        NIR_PASS(progress, shader, nir_opt_dce);
+                NIR_LOOP_PASS(&loop, shader, nir_copy_prop);
+                NIR_LOOP_PASS(&loop, shader, nir_opt_remove_phis);
+                NIR_LOOP_PASS(&loop, shader, nir_opt_dce);
+                NIR_LOOP_PASS(&loop, shader, nir_opt_trivial_continues);
+                if (loop.pass_progress) {
+                        NIR_LOOP_PASS(&loop, shader, nir_copy_prop);
+			NIR_LOOP_PASS(&loop, shader, nir_opt_remove_phis);
+                        NIR_LOOP_PASS(&loop, shader, nir_opt_dce);
                 }
-                NIR_PASS(progress, shader, nir_opt_if);
-                NIR_PASS(progress, shader, nir_opt_dead_cf);
-                NIR_PASS(progress, shader, nir_opt_cse);
-                NIR_PASS(progress, shader, nir_opt_peephole_select, 8, true, true);
-                NIR_PASS(progress, shader, nir_opt_algebraic);
-                NIR_PASS(progress, shader, nir_opt_constant_folding);
-                NIR_PASS(progress, shader, nir_opt_undef);
-                NIR_PASS(progress, shader, nir_opt_conditional_discard);
+                NIR_LOOP_PASS(&loop, shader, nir_opt_if);
+                NIR_LOOP_PASS(&loop, shader, nir_opt_dead_cf);
+                NIR_LOOP_PASS(&loop, shader, nir_opt_cse);
+                NIR_LOOP_PASS(&loop, shader, nir_opt_peephole_select, 8, true, true);
+                NIR_LOOP_PASS(&loop, shader, nir_opt_algebraic);
+                NIR_LOOP_PASS(&loop, shader, nir_opt_constant_folding);
+                NIR_LOOP_PASS(&loop, shader, nir_opt_undef);
+                NIR_LOOP_PASS(&loop, shader, nir_opt_conditional_discard);
                 if (shader->options->max_unroll_iterations) {
-                        NIR_PASS(progress, shader, nir_opt_loop_unroll, 0);
+                        NIR_LOOP_PASS(&loop, shader, nir_opt_loop_unroll, 0);
                 }
-        } while (progress && !optimize_conservatively);
+        } while (nir_pass_loop_continue(&loop) && !optimize_conservatively);
 
         NIR_PASS(progress, shader, nir_opt_shrink_load);
         NIR_PASS(progress, shader, nir_opt_move_load_ubo);
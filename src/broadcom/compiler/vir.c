@@ -945,6 +945,13 @@ uint64_t *v3d_compile(const struct v3d_compiler *compiler,
 
         v3d_optimize_nir(c->s);
         NIR_PASS_V(c->s, nir_lower_bool_to_int32);
+
+        /* Reorder each block to keep fewer values live, so that more
+         * shaders allocate at 4 threads without spilling.
+         */
+        static const nir_schedule_options schedule_options = { 0 };
+        NIR_PASS_V(c->s, nir_schedule, &schedule_options);
+
         NIR_PASS_V(c->s, nir_convert_from_ssa, true);
 
         v3d_nir_to_vir(c);
@@ -0,0 +1,277 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * Replays a trace of shader cache accesses against the different on-disk
+ * layouts of the cache:
+ *
+ *  - one file per entry, evicting through the LRU index;
+ *  - one file per entry, evicting by walking the cache directories, (the
+ *    LRU index is disabled by putting a directory where its file should be,
+ *    which makes mapping it fail);
+ *  - pack files (MESA_GLSL_CACHE_SINGLE_FILE).
+ *
+ * Usage: cache_benchmark [trace] [max_size]
+ *
+ * Each line of the trace is either "p <key> <size>", storing size bytes for
+ * the key, or "g <key>", looking the key up, where the key is 40 hex digits.
+ * Without a trace, a synthetic one is generated: shaders are looked up with
+ * a skewed distribution, like the shaders of a few often played games among
+ * many others, and stored on a miss. The cache is limited to max_size
+ * (MESA_GLSL_CACHE_MAX_SIZE syntax, 16M by default), so that the trace keeps
+ * evicting.
+ *
+ * The cache is created in a temporary directory under the current one. The
+ * stores are waited for, so that the lookups following them hit, and are
+ * timed with the eviction they trigger.
+ */
+
+#include <errno.h>
+#include <ftw.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "util/disk_cache.h"
+#include "util/macros.h"
+#include "util/mesa-sha1.h"
+#include "util/os_time.h"
+
+#define CACHE_BENCHMARK_TMP "./cache-benchmark-tmp"
+
+#define SYNTHETIC_SHADERS 20000
+#define SYNTHETIC_ACCESSES 100000
+#define MAX_ENTRY_SIZE (64 * 1024)
+
+struct access {
+   uint8_t key[20];
+   /* Size to store, or 0 for a lookup. */
+   uint32_t size;
+};
+
+struct trace {
+   struct access *accesses;
+   unsigned count;
+   unsigned alloc;
+};
+
+static void
+trace_add(struct trace *trace, const uint8_t *key, uint32_t size)
+{
+   if (trace->count == trace->alloc) {
+      trace->alloc = trace->alloc ? trace->alloc * 2 : 1024;
+      trace->accesses = realloc(trace->accesses,
+                                trace->alloc * sizeof(*trace->accesses));
+      if (trace->accesses == NULL) {
+         fprintf(stderr, "Out of memory\n");
+         exit(1);
+      }
+   }
+
+   memcpy(trace->accesses[trace->count].key, key, 20);
+   trace->accesses[trace->count].size = size;
+   trace->count++;
+}
+
+static bool
+parse_key(const char *hex, uint8_t *key)
+{
+   for (unsigned i = 0; i < 20; i++) {
+      unsigned byte;
+
+      if (sscanf(&hex[2 * i], "%2x", &byte) != 1)
+         return false;
+      key[i] = byte;
+   }
+
+   return true;
+}
+
+static bool
+read_trace(struct trace *trace, const char *filename)
+{
+   char line[128], hex[64];
+   uint8_t key[20];
+   unsigned size;
+   FILE *f;
+
+   f = fopen(filename, "r");
+   if (f == NULL) {
+      fprintf(stderr, "Failed to open %s: %s\n", filename, strerror(errno));
+      return false;
+   }
+
+   while (fgets(line, sizeof(line), f)) {
+      if (sscanf(line, "p %63s %u", hex, &size) == 2 && parse_key(hex, key)) {
+         trace_add(trace, key, MIN2(MAX2(size, 1), MAX_ENTRY_SIZE));
+      } else if (sscanf(line, "g %63s", hex) == 1 && parse_key(hex, key)) {
+         trace_add(trace, key, 0);
+      } else {
+         fprintf(stderr, "Invalid trace line: %s", line);
+         fclose(f);
+         return false;
+      }
+   }
+
+   fclose(f);
+   return true;
+}
+
+static void
+generate_trace(struct trace *trace)
+{
+   bool *stored = calloc(SYNTHETIC_SHADERS, sizeof(*stored));
+   uint32_t seed = 1;
+
+   for (unsigned i = 0; i < SYNTHETIC_ACCESSES; i++) {
+      uint8_t key[20];
+      uint32_t shader;
+      double r;
+
+      seed = seed * 1103515245 + 12345;
+      r = (double)(seed >> 8) / (1 << 24);
+
+      /* Most of the lookups hit a small set of shaders. */
+      shader = (uint32_t)(r * r * r * SYNTHETIC_SHADERS);
+      _mesa_sha1_compute(&shader, sizeof(shader), key);
+
+      trace_add(trace, key, 0);
+      if (!stored[shader]) {
+         /* Sizes between 1KB and 16KB, like typical shader binaries. */
+         trace_add(trace, key, 1024 + (key[19] << 8) % (15 * 1024));
+         stored[shader] = true;
+      }
+   }
+
+   free(stored);
+}
+
+static int
+remove_entry(const char *path, const struct stat *sb, int typeflag,
+             struct FTW *ftwbuf)
+{
+   return remove(path);
+}
+
+static void
+run(const char *name, const struct trace *trace, const uint8_t *data,
+    bool lru_index, bool single_file)
+{
+   struct disk_cache *cache;
+   unsigned hits = 0, lookups = 0, puts = 0;
+   int64_t start, get_time = 0, put_time = 0;
+
+   nftw(CACHE_BENCHMARK_TMP, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+   mkdir(CACHE_BENCHMARK_TMP, 0755);
+   mkdir(CACHE_BENCHMARK_TMP "/mesa_shader_cache", 0755);
+   if (!lru_index)
+      mkdir(CACHE_BENCHMARK_TMP "/mesa_shader_cache/lru_index", 0755);
+
+   setenv("MESA_GLSL_CACHE_DIR", CACHE_BENCHMARK_TMP, 1);
+   if (single_file)
+      setenv("MESA_GLSL_CACHE_SINGLE_FILE", "true", 1);
+   else
+      unsetenv("MESA_GLSL_CACHE_SINGLE_FILE");
+
+   start = os_time_get_nano();
+
+   cache = disk_cache_create("benchmark", "cache_benchmark", 0);
+   if (cache == NULL) {
+      fprintf(stderr, "Failed to create the cache in %s\n",
+              CACHE_BENCHMARK_TMP);
+      exit(1);
+   }
+
+   for (unsigned i = 0; i < trace->count; i++) {
+      const struct access *access = &trace->accesses[i];
+
+      if (access->size) {
+         int64_t put_start = os_time_get_nano();
+
+         disk_cache_put(cache, access->key, data, access->size, NULL);
+         disk_cache_wait_for_idle(cache);
+
+         put_time += os_time_get_nano() - put_start;
+         puts++;
+      } else {
+         int64_t get_start = os_time_get_nano();
+         void *result = disk_cache_get(cache, access->key, NULL);
+
+         get_time += os_time_get_nano() - get_start;
+         lookups++;
+         if (result) {
+            hits++;
+            free(result);
+         }
+      }
+   }
+
+   disk_cache_destroy(cache);
+
+   printf("%-16s total %8.1f ms, put %7.2f us/op, get %6.2f us/op, "
+          "hit rate %5.1f%%\n",
+          name, (os_time_get_nano() - start) / 1000000.0,
+          puts ? put_time / 1000.0 / puts : 0.0,
+          lookups ? get_time / 1000.0 / lookups : 0.0,
+          lookups ? 100.0 * hits / lookups : 0.0);
+
+   nftw(CACHE_BENCHMARK_TMP, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+int
+main(int argc, char **argv)
+{
+#ifdef ENABLE_SHADER_CACHE
+   struct trace trace = { 0 };
+   uint8_t *data;
+
+   if (argc > 1 && strcmp(argv[1], "-") != 0) {
+      if (!read_trace(&trace, argv[1]))
+         return 1;
+   } else {
+      generate_trace(&trace);
+   }
+
+   setenv("MESA_GLSL_CACHE_MAX_SIZE", argc > 2 ? argv[2] : "16M", 1);
+
+   /* Somewhat compressible data, so that the stores don't only measure the
+    * compressor.
+    */
+   data = malloc(MAX_ENTRY_SIZE);
+   for (unsigned i = 0; i < MAX_ENTRY_SIZE; i++)
+      data[i] = (i * 2654435761u) >> ((i & 1) ? 28 : 24);
+
+   printf("%u accesses\n", trace.count);
+
+   run("lru index", &trace, data, true, false);
+   run("directory walk", &trace, data, false, false);
+   run("single file", &trace, data, true, true);
+
+   free(data);
+   free(trace.accesses);
+#endif /* ENABLE_SHADER_CACHE */
+
+   return 0;
+}
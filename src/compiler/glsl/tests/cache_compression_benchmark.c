@@ -0,0 +1,250 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * Compares the compressions of the shader cache: for each of them, stores a
+ * set of blobs in a fresh cache, and reports the compression ratio and the
+ * time disk_cache_get() takes to read them back.
+ *
+ * Usage: cache_compression_benchmark [file or directory]...
+ *
+ * The blobs are the files given on the command line, (directories are
+ * walked), such as serialized NIR or shader binaries dumped by a driver.
+ * Without any, synthetic blobs made of small 32-bit words, like serialized
+ * NIR, are used instead.
+ *
+ * The cache is created in a temporary directory under the current one. The
+ * reads hit the page cache, so that the decompression dominates them.
+ */
+
+#include <errno.h>
+#include <ftw.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "util/disk_cache.h"
+#include "util/macros.h"
+#include "util/mesa-sha1.h"
+#include "util/os_time.h"
+
+#define CACHE_BENCHMARK_TMP "./cache-compression-benchmark-tmp"
+
+#define NUM_RUNS 5
+
+#define SYNTHETIC_BLOBS 2000
+#define MAX_BLOB_SIZE (16 * 1024 * 1024)
+
+struct blob_set {
+   void **data;
+   size_t *size;
+   uint8_t (*key)[20];
+   unsigned count;
+   size_t total_size;
+};
+
+static struct blob_set blobs;
+
+static void
+add_blob(void *data, size_t size)
+{
+   if ((blobs.count & (blobs.count - 1)) == 0) {
+      unsigned alloc = blobs.count ? blobs.count * 2 : 1;
+
+      blobs.data = realloc(blobs.data, alloc * sizeof(*blobs.data));
+      blobs.size = realloc(blobs.size, alloc * sizeof(*blobs.size));
+      blobs.key = realloc(blobs.key, alloc * sizeof(*blobs.key));
+      if (!blobs.data || !blobs.size || !blobs.key) {
+         fprintf(stderr, "Out of memory\n");
+         exit(1);
+      }
+   }
+
+   blobs.data[blobs.count] = data;
+   blobs.size[blobs.count] = size;
+   _mesa_sha1_compute(data, size, blobs.key[blobs.count]);
+   blobs.count++;
+   blobs.total_size += size;
+}
+
+static int
+add_file(const char *path, const struct stat *sb, int typeflag,
+         struct FTW *ftwbuf)
+{
+   FILE *f;
+   void *data;
+
+   if (typeflag != FTW_F || sb->st_size == 0 || sb->st_size > MAX_BLOB_SIZE)
+      return 0;
+
+   f = fopen(path, "rb");
+   if (f == NULL)
+      return 0;
+
+   data = malloc(sb->st_size);
+   if (data && fread(data, 1, sb->st_size, f) == (size_t)sb->st_size)
+      add_blob(data, sb->st_size);
+   else
+      free(data);
+
+   fclose(f);
+   return 0;
+}
+
+static void
+add_synthetic_blobs(void)
+{
+   uint32_t seed = 1;
+
+   for (unsigned i = 0; i < SYNTHETIC_BLOBS; i++) {
+      unsigned words;
+      uint32_t *data;
+
+      seed = seed * 1103515245 + 12345;
+      words = 256 + (seed >> 16) % 4096;
+      data = malloc(words * sizeof(*data));
+
+      /* Mostly small indices and opcodes, with a few arbitrary constants. */
+      for (unsigned j = 0; j < words; j++) {
+         seed = seed * 1103515245 + 12345;
+         data[j] = (seed >> 16) % 16 == 0 ? seed : (seed >> 16) % (j + 16);
+      }
+
+      add_blob(data, words * sizeof(*data));
+   }
+}
+
+static int
+remove_entry(const char *path, const struct stat *sb, int typeflag,
+             struct FTW *ftwbuf)
+{
+   return remove(path);
+}
+
+static uint64_t stored_size;
+
+static int
+add_stored_size(const char *path, const struct stat *sb, int typeflag,
+                struct FTW *ftwbuf)
+{
+   /* Skip the index files at the root of the cache. */
+   if (typeflag == FTW_F && ftwbuf->level > 2)
+      stored_size += sb->st_size;
+   return 0;
+}
+
+static void
+run(const char *name, enum disk_cache_compression compression, int level)
+{
+   struct disk_cache *cache;
+   int64_t start, put_time, get_time = INT64_MAX;
+
+   nftw(CACHE_BENCHMARK_TMP, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+   setenv("MESA_GLSL_CACHE_DIR", CACHE_BENCHMARK_TMP, 1);
+
+   cache = disk_cache_create("benchmark", "cache_compression_benchmark", 0);
+   if (cache == NULL) {
+      fprintf(stderr, "Failed to create the cache in %s\n",
+              CACHE_BENCHMARK_TMP);
+      exit(1);
+   }
+
+   if (!disk_cache_set_compression(cache, compression, level)) {
+      printf("%-12s not supported\n", name);
+      disk_cache_destroy(cache);
+      return;
+   }
+
+   start = os_time_get_nano();
+   for (unsigned i = 0; i < blobs.count; i++)
+      disk_cache_put(cache, blobs.key[i], blobs.data[i], blobs.size[i], NULL);
+   disk_cache_wait_for_idle(cache);
+   put_time = os_time_get_nano() - start;
+
+   for (unsigned run = 0; run < NUM_RUNS; run++) {
+      start = os_time_get_nano();
+      for (unsigned i = 0; i < blobs.count; i++) {
+         size_t size;
+         void *data = disk_cache_get(cache, blobs.key[i], &size);
+
+         if (data == NULL || size != blobs.size[i] ||
+             memcmp(data, blobs.data[i], size) != 0) {
+            fprintf(stderr, "%s: blob %u not read back\n", name, i);
+            exit(1);
+         }
+         free(data);
+      }
+      get_time = MIN2(get_time, os_time_get_nano() - start);
+   }
+
+   disk_cache_destroy(cache);
+
+   stored_size = 0;
+   nftw(CACHE_BENCHMARK_TMP, add_stored_size, 64, FTW_PHYS);
+
+   printf("%-12s ratio %5.2f, put %8.2f us/blob, get %7.2f us/blob\n",
+          name, (double) blobs.total_size / stored_size,
+          put_time / 1000.0 / blobs.count,
+          get_time / 1000.0 / blobs.count);
+
+   nftw(CACHE_BENCHMARK_TMP, remove_entry, 64, FTW_DEPTH | FTW_PHYS);
+}
+
+int
+main(int argc, char **argv)
+{
+#ifdef ENABLE_SHADER_CACHE
+   for (int i = 1; i < argc; i++) {
+      if (nftw(argv[i], add_file, 64, FTW_PHYS) == -1) {
+         fprintf(stderr, "Failed to read %s: %s\n", argv[i], strerror(errno));
+         return 1;
+      }
+   }
+
+   if (blobs.count == 0)
+      add_synthetic_blobs();
+
+   printf("%u blobs, %.1f KB on average\n", blobs.count,
+          blobs.total_size / 1024.0 / blobs.count);
+
+   /* Make sure nothing gets evicted. */
+   setenv("MESA_GLSL_CACHE_MAX_SIZE", "4G", 1);
+   unsetenv("MESA_GLSL_CACHE_SINGLE_FILE");
+
+   run("none", DISK_CACHE_COMPRESSION_NONE, -1);
+   run("zlib", DISK_CACHE_COMPRESSION_ZLIB, -1);
+   run("zlib -1", DISK_CACHE_COMPRESSION_ZLIB, 1);
+   run("zstd", DISK_CACHE_COMPRESSION_ZSTD, -1);
+   run("zstd -19", DISK_CACHE_COMPRESSION_ZSTD, 19);
+
+   for (unsigned i = 0; i < blobs.count; i++)
+      free(blobs.data[i]);
+   free(blobs.data);
+   free(blobs.size);
+   free(blobs.key);
+#endif /* ENABLE_SHADER_CACHE */
+
+   return 0;
+}
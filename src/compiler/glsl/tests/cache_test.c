@@ -34,6 +34,8 @@
 #include <limits.h>
 #include <time.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "util/mesa-sha1.h"
 #include "util/disk_cache.h"
@@ -493,6 +495,325 @@ test_put_key_and_get_key(void)
 
    disk_cache_destroy(cache);
 }
+
+static void
+fill_random(uint8_t *data, size_t size, uint32_t seed)
+{
+   /* Use a simple LCG so the data doesn't compress. */
+   for (size_t i = 0; i < size; i++) {
+      seed = seed * 1103515245 + 12345;
+      data[i] = seed >> 16;
+   }
+}
+
+static void
+test_lru_eviction(void)
+{
+   struct disk_cache *cache;
+   const size_t item_size = 256 * 1024, big_item_size = 600 * 1024;
+   uint8_t a_key[20], b_key[20], c_key[20];
+   uint8_t *a, *b, *c;
+   void *result;
+
+   setenv("MESA_GLSL_CACHE_MAX_SIZE", "1M", 1);
+   cache = disk_cache_create("test", "make_check_lru", 0);
+
+   a = malloc(item_size);
+   b = malloc(item_size);
+   c = malloc(big_item_size);
+   fill_random(a, item_size, 1);
+   fill_random(b, item_size, 2);
+   fill_random(c, big_item_size, 3);
+
+   /* Put both items in the same cache subdirectory, so that the victim
+    * doesn't depend on the randomly chosen shard.
+    */
+   disk_cache_compute_key(cache, a, item_size, a_key);
+   disk_cache_compute_key(cache, b, item_size, b_key);
+   disk_cache_compute_key(cache, c, big_item_size, c_key);
+   b_key[0] = a_key[0];
+
+   disk_cache_put(cache, a_key, a, item_size, NULL);
+   disk_cache_put(cache, b_key, b, item_size, NULL);
+   wait_until_file_written(cache, a_key);
+   wait_until_file_written(cache, b_key);
+
+   /* Access the first item again, which makes the second one the least
+    * recently used.
+    */
+   result = disk_cache_get(cache, a_key, NULL);
+   expect_non_null(result, "disk_cache_get of first LRU item");
+   free(result);
+
+   /* Adding the big item needs a single eviction to fit in the cache. */
+   disk_cache_put(cache, c_key, c, big_item_size, NULL);
+   wait_until_file_written(cache, c_key);
+
+   expect_true(does_cache_contain(cache, c_key),
+               "disk_cache_put of item evicting the LRU item");
+   expect_true(does_cache_contain(cache, a_key),
+               "recently used item survives eviction");
+   expect_true(!does_cache_contain(cache, b_key),
+               "least recently used item is evicted");
+
+   free(a);
+   free(b);
+   free(c);
+
+   disk_cache_destroy(cache);
+}
+
+static void
+test_corrupt_lru_index(void)
+{
+   const char *path = CACHE_TEST_TMP "/mesa-glsl-cache-dir/"
+                      CACHE_DIR_NAME "/lru_index";
+   struct disk_cache *cache;
+   char blob[] = "This is a blob of thirty-seven bytes";
+   uint8_t blob_key[20];
+   uint64_t shard_entries;
+   struct stat sb;
+   int fd;
+
+   /* Start from an index sized for a big cache, with more entries per
+    * shard than the minimum.
+    */
+   unlink(path);
+   setenv("MESA_GLSL_CACHE_MAX_SIZE", "1G", 1);
+   cache = disk_cache_create("test", "make_check_lru_index", 0);
+   disk_cache_destroy(cache);
+
+   /* Within the bounds of the entries of a shard and of the file size, but
+    * not a power of two, which would make the slot masks wrong.
+    */
+   shard_entries = 1000;
+   fd = open(path, O_WRONLY);
+   expect_true(fd != -1, "open LRU index");
+   expect_true(pwrite(fd, &shard_entries, sizeof(shard_entries), 8) ==
+               sizeof(shard_entries), "corrupt LRU index");
+   close(fd);
+
+   cache = disk_cache_create("test", "make_check_lru_index", 0);
+
+   disk_cache_compute_key(cache, blob, sizeof(blob), blob_key);
+   disk_cache_put(cache, blob_key, blob, sizeof(blob), NULL);
+   wait_until_file_written(cache, blob_key);
+   expect_true(does_cache_contain(cache, blob_key),
+               "disk_cache_put with a corrupt LRU index");
+
+   disk_cache_destroy(cache);
+
+   fd = open(path, O_RDONLY);
+   expect_true(fd != -1 &&
+               pread(fd, &shard_entries, sizeof(shard_entries), 8) ==
+               sizeof(shard_entries) &&
+               fstat(fd, &sb) == 0,
+               "read LRU index");
+   close(fd);
+
+   expect_true(shard_entries && !(shard_entries & (shard_entries - 1)),
+               "corrupt LRU index is rebuilt");
+   expect_true(sb.st_size > (off_t)(256 * shard_entries),
+               "rebuilt LRU index is sized for its entries");
+
+   setenv("MESA_GLSL_CACHE_MAX_SIZE", "1M", 1);
+}
+
+static void
+test_compression(void)
+{
+   static const char *compressions[] = { "none", "zlib", "zstd" };
+   struct disk_cache *cache;
+   const size_t item_size = 64 * 1024;
+   uint8_t keys[3][20];
+   uint8_t *item;
+   void *result;
+   size_t size;
+
+   /* The cache is shared with the previous tests, make sure none of these
+    * items gets evicted.
+    */
+   setenv("MESA_GLSL_CACHE_MAX_SIZE", "16M", 1);
+
+   item = malloc(item_size);
+   for (unsigned i = 0; i < 3; i++) {
+      /* Fill half of the data with random bytes, so that it is somewhat
+       * compressible.
+       */
+      fill_random(item, item_size / 2, i + 1);
+      memset(item + item_size / 2, i, item_size / 2);
+
+      setenv("MESA_GLSL_CACHE_COMPRESSION", compressions[i], 1);
+      cache = disk_cache_create("test", "make_check_compression", 0);
+
+      disk_cache_compute_key(cache, item, item_size, keys[i]);
+      disk_cache_put(cache, keys[i], item, item_size, NULL);
+      wait_until_file_written(cache, keys[i]);
+
+      disk_cache_destroy(cache);
+   }
+
+   /* Entries must be readable regardless of the current compression. */
+   unsetenv("MESA_GLSL_CACHE_COMPRESSION");
+   cache = disk_cache_create("test", "make_check_compression", 0);
+
+   expect_true(disk_cache_set_compression(cache,
+                                          DISK_CACHE_COMPRESSION_ZLIB, 9),
+               "disk_cache_set_compression with a valid level");
+   expect_true(!disk_cache_set_compression(cache,
+                                           DISK_CACHE_COMPRESSION_ZLIB, 19),
+               "disk_cache_set_compression with an invalid level");
+   expect_true(!disk_cache_set_compression(cache,
+                                           (enum disk_cache_compression) 42,
+                                           -1),
+               "disk_cache_set_compression with an unknown compression");
+
+   for (unsigned i = 0; i < 3; i++) {
+      fill_random(item, item_size / 2, i + 1);
+      memset(item + item_size / 2, i, item_size / 2);
+
+      result = disk_cache_get(cache, keys[i], &size);
+      expect_non_null(result, "disk_cache_get of compressed item");
+      expect_equal(size, item_size, "disk_cache_get of compressed item (size)");
+      expect_true(result && memcmp(result, item, item_size) == 0,
+                  "disk_cache_get of compressed item (data)");
+      free(result);
+   }
+
+   free(item);
+   disk_cache_destroy(cache);
+}
+
+static void
+test_prefetch(void)
+{
+   struct disk_cache *cache;
+   const size_t item_size = 16 * 1024;
+   uint8_t keys[9][20];
+   uint8_t *item;
+   void *result;
+   size_t size;
+
+   /* The cache is shared with the previous tests, make sure none of these
+    * items gets evicted.
+    */
+   setenv("MESA_GLSL_CACHE_MAX_SIZE", "16M", 1);
+   cache = disk_cache_create("test", "make_check_prefetch", 0);
+
+   item = malloc(item_size);
+   for (unsigned i = 0; i < 8; i++) {
+      fill_random(item, item_size, i + 1);
+      disk_cache_compute_key(cache, item, item_size, keys[i]);
+      disk_cache_put(cache, keys[i], item, item_size, NULL);
+      wait_until_file_written(cache, keys[i]);
+   }
+
+   /* A key which was never stored. */
+   memset(keys[8], 0xab, sizeof(keys[8]));
+
+   disk_cache_prefetch(cache, (const cache_key *) keys, 9);
+   /* Prefetching the same keys again must be harmless. */
+   disk_cache_prefetch(cache, (const cache_key *) keys, 4);
+
+   for (unsigned i = 0; i < 8; i++) {
+      fill_random(item, item_size, i + 1);
+
+      result = disk_cache_get(cache, keys[i], &size);
+      expect_non_null(result, "disk_cache_get of prefetched item");
+      expect_equal(size, item_size, "disk_cache_get of prefetched item (size)");
+      expect_true(result && memcmp(result, item, item_size) == 0,
+                  "disk_cache_get of prefetched item (data)");
+      free(result);
+   }
+
+   result = disk_cache_get(cache, keys[8], &size);
+   expect_null(result, "disk_cache_get of prefetched missing item");
+
+   /* The prefetched entry is consumed, the item must still be there. */
+   result = disk_cache_get(cache, keys[0], NULL);
+   expect_non_null(result, "disk_cache_get of item after its prefetch");
+   free(result);
+
+   /* Leave unconsumed prefetches behind for disk_cache_destroy(). */
+   disk_cache_prefetch(cache, (const cache_key *) keys, 8);
+
+   free(item);
+   disk_cache_destroy(cache);
+}
+
+static void
+test_single_file(void)
+{
+   struct disk_cache *cache;
+   char blob[] = "This is a blob of thirty-seven bytes";
+   uint8_t blob_key[20];
+   const size_t item_size = 50 * 1024;
+   uint8_t item_keys[3][20];
+   uint8_t *item;
+   char *result;
+   size_t size;
+
+   setenv("MESA_GLSL_CACHE_SINGLE_FILE", "true", 1);
+   setenv("MESA_GLSL_CACHE_MAX_SIZE", "1M", 1);
+   cache = disk_cache_create("test", "make_check_single_file", 0);
+
+   disk_cache_compute_key(cache, blob, sizeof(blob), blob_key);
+   disk_cache_put(cache, blob_key, blob, sizeof(blob), NULL);
+   wait_until_file_written(cache, blob_key);
+
+   result = disk_cache_get(cache, blob_key, &size);
+   expect_equal_str(blob, result, "disk_cache_get from pack (pointer)");
+   expect_equal(size, sizeof(blob), "disk_cache_get from pack (size)");
+   free(result);
+
+   /* The entry must still be there once the packs are mapped again. */
+   disk_cache_destroy(cache);
+   cache = disk_cache_create("test", "make_check_single_file", 0);
+
+   result = disk_cache_get(cache, blob_key, &size);
+   expect_equal_str(blob, result, "disk_cache_get from reopened pack");
+   free(result);
+
+   /* Another driver using the cache directory shares the packs, but doesn't
+    * get the entries of this one, even for the same key.
+    */
+   disk_cache_destroy(cache);
+   cache = disk_cache_create("test", "make_check_single_file_other", 0);
+
+   result = disk_cache_get(cache, blob_key, &size);
+   expect_null(result, "disk_cache_get of another driver's pack record");
+
+   disk_cache_destroy(cache);
+   cache = disk_cache_create("test", "make_check_single_file", 0);
+
+   /* With 1M split across the packs, the pack of the blob has two segments
+    * of 64K, which only hold one of these items each. Writing the third one
+    * goes back to the first segment, evicting the blob and the first item,
+    * but not the second one.
+    */
+   item = malloc(item_size);
+   for (unsigned i = 0; i < 3; i++) {
+      fill_random(item, item_size, i + 1);
+      disk_cache_compute_key(cache, item, item_size, item_keys[i]);
+      item_keys[i][0] = blob_key[0];
+
+      disk_cache_put(cache, item_keys[i], item, item_size, NULL);
+      wait_until_file_written(cache, item_keys[i]);
+   }
+   free(item);
+
+   expect_true(!does_cache_contain(cache, blob_key),
+               "oldest entry of a full pack is evicted (blob)");
+   expect_true(!does_cache_contain(cache, item_keys[0]),
+               "oldest entry of a full pack is evicted (first item)");
+   expect_true(does_cache_contain(cache, item_keys[1]),
+               "newer entry of a full pack is kept");
+   expect_true(does_cache_contain(cache, item_keys[2]),
+               "entry written after wrapping around the pack");
+
+   disk_cache_destroy(cache);
+   unsetenv("MESA_GLSL_CACHE_SINGLE_FILE");
+}
 #endif /* ENABLE_SHADER_CACHE */
 
 int
@@ -507,6 +828,16 @@ main(void)
 
    test_put_key_and_get_key();
 
+   test_lru_eviction();
+
+   test_corrupt_lru_index();
+
+   test_compression();
+
+   test_single_file();
+
+   test_prefetch();
+
    err = rmrf_local(CACHE_TEST_TMP);
    expect_equal(err, 0, "Removing " CACHE_TEST_TMP " again");
 #endif /* ENABLE_SHADER_CACHE */
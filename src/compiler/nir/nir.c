@@ -104,7 +104,8 @@ nir_global_reg_create(nir_shader *shader)
 nir_register *
 nir_local_reg_create(nir_function_impl *impl)
 {
-   nir_register *reg = reg_create(ralloc_parent(impl), &impl->registers);
+   nir_register *reg = reg_create(nir_shader_alloc_ctx(ralloc_parent(impl)),
+                                  &impl->registers);
    reg->index = impl->reg_alloc++;
    reg->is_global = false;
 
@@ -190,7 +191,8 @@ nir_variable *
 nir_local_variable_create(nir_function_impl *impl,
                           const struct glsl_type *type, const char *name)
 {
-   nir_variable *var = rzalloc(impl->function->shader, nir_variable);
+   nir_variable *var = rzalloc(nir_shader_alloc_ctx(impl->function->shader),
+                              nir_variable);
    var->name = ralloc_strdup(var, name);
    var->type = type;
    var->data.mode = nir_var_function_temp;
@@ -298,6 +300,7 @@ nir_function_impl_create_bare(nir_shader *shader)
    impl->reg_alloc = 0;
    impl->ssa_alloc = 0;
    impl->valid_metadata = nir_metadata_none;
+   impl->cfg_metadata = nir_metadata_none;
 
    /* create start & end blocks */
    nir_block *start_block = nir_block_create(shader);
@@ -329,7 +332,7 @@ nir_function_impl_create(nir_function *function)
 nir_block *
 nir_block_create(nir_shader *shader)
 {
-   nir_block *block = rzalloc(shader, nir_block);
+   nir_block *block = rzalloc(nir_shader_alloc_ctx(shader), nir_block);
 
    cf_init(&block->cf_node, nir_cf_node_block);
 
@@ -363,7 +366,7 @@ src_init(nir_src *src)
 nir_if *
 nir_if_create(nir_shader *shader)
 {
-   nir_if *if_stmt = ralloc(shader, nir_if);
+   nir_if *if_stmt = ralloc(nir_shader_alloc_ctx(shader), nir_if);
 
    cf_init(&if_stmt->cf_node, nir_cf_node_if);
    src_init(&if_stmt->condition);
@@ -384,7 +387,7 @@ nir_if_create(nir_shader *shader)
 nir_loop *
 nir_loop_create(nir_shader *shader)
 {
-   nir_loop *loop = rzalloc(shader, nir_loop);
+   nir_loop *loop = rzalloc(nir_shader_alloc_ctx(shader), nir_loop);
 
    cf_init(&loop->cf_node, nir_cf_node_loop);
 
@@ -439,7 +442,7 @@ nir_alu_instr_create(nir_shader *shader, nir_op op)
    unsigned num_srcs = nir_op_infos[op].num_inputs;
    /* TODO: don't use rzalloc */
    nir_alu_instr *instr =
-      rzalloc_size(shader,
+      rzalloc_size(nir_shader_alloc_ctx(shader),
                    sizeof(nir_alu_instr) + num_srcs * sizeof(nir_alu_src));
 
    instr_init(&instr->instr, nir_instr_type_alu);
@@ -455,7 +458,7 @@ nir_deref_instr *
 nir_deref_instr_create(nir_shader *shader, nir_deref_type deref_type)
 {
    nir_deref_instr *instr =
-      rzalloc_size(shader, sizeof(nir_deref_instr));
+      rzalloc_size(nir_shader_alloc_ctx(shader), sizeof(nir_deref_instr));
 
    instr_init(&instr->instr, nir_instr_type_deref);
 
@@ -475,7 +478,7 @@ nir_deref_instr_create(nir_shader *shader, nir_deref_type deref_type)
 nir_jump_instr *
 nir_jump_instr_create(nir_shader *shader, nir_jump_type type)
 {
-   nir_jump_instr *instr = ralloc(shader, nir_jump_instr);
+   nir_jump_instr *instr = ralloc(nir_shader_alloc_ctx(shader), nir_jump_instr);
    instr_init(&instr->instr, nir_instr_type_jump);
    instr->type = type;
    return instr;
@@ -485,7 +488,8 @@ nir_load_const_instr *
 nir_load_const_instr_create(nir_shader *shader, unsigned num_components,
                             unsigned bit_size)
 {
-   nir_load_const_instr *instr = rzalloc(shader, nir_load_const_instr);
+   nir_load_const_instr *instr =
+      rzalloc(nir_shader_alloc_ctx(shader), nir_load_const_instr);
    instr_init(&instr->instr, nir_instr_type_load_const);
 
    nir_ssa_def_init(&instr->instr, &instr->def, num_components, bit_size, NULL);
@@ -499,8 +503,8 @@ nir_intrinsic_instr_create(nir_shader *shader, nir_intrinsic_op op)
    unsigned num_srcs = nir_intrinsic_infos[op].num_srcs;
    /* TODO: don't use rzalloc */
    nir_intrinsic_instr *instr =
-      rzalloc_size(shader,
-                  sizeof(nir_intrinsic_instr) + num_srcs * sizeof(nir_src));
+      rzalloc_size(nir_shader_alloc_ctx(shader),
+                   sizeof(nir_intrinsic_instr) + num_srcs * sizeof(nir_src));
 
    instr_init(&instr->instr, nir_instr_type_intrinsic);
    instr->intrinsic = op;
@@ -519,7 +523,7 @@ nir_call_instr_create(nir_shader *shader, nir_function *callee)
 {
    const unsigned num_params = callee->num_params;
    nir_call_instr *instr =
-      rzalloc_size(shader, sizeof(*instr) +
+      rzalloc_size(nir_shader_alloc_ctx(shader), sizeof(*instr) +
                    num_params * sizeof(instr->params[0]));
 
    instr_init(&instr->instr, nir_instr_type_call);
@@ -534,7 +538,7 @@ nir_call_instr_create(nir_shader *shader, nir_function *callee)
 nir_tex_instr *
 nir_tex_instr_create(nir_shader *shader, unsigned num_srcs)
 {
-   nir_tex_instr *instr = rzalloc(shader, nir_tex_instr);
+   nir_tex_instr *instr = rzalloc(nir_shader_alloc_ctx(shader), nir_tex_instr);
    instr_init(&instr->instr, nir_instr_type_tex);
 
    dest_init(&instr->dest);
@@ -592,7 +596,7 @@ nir_tex_instr_remove_src(nir_tex_instr *tex, unsigned src_idx)
 nir_phi_instr *
 nir_phi_instr_create(nir_shader *shader)
 {
-   nir_phi_instr *instr = ralloc(shader, nir_phi_instr);
+   nir_phi_instr *instr = ralloc(nir_shader_alloc_ctx(shader), nir_phi_instr);
    instr_init(&instr->instr, nir_instr_type_phi);
 
    dest_init(&instr->dest);
@@ -603,7 +607,8 @@ nir_phi_instr_create(nir_shader *shader)
 nir_parallel_copy_instr *
 nir_parallel_copy_instr_create(nir_shader *shader)
 {
-   nir_parallel_copy_instr *instr = ralloc(shader, nir_parallel_copy_instr);
+   nir_parallel_copy_instr *instr =
+      ralloc(nir_shader_alloc_ctx(shader), nir_parallel_copy_instr);
    instr_init(&instr->instr, nir_instr_type_parallel_copy);
 
    exec_list_make_empty(&instr->entries);
@@ -616,7 +621,8 @@ nir_ssa_undef_instr_create(nir_shader *shader,
                            unsigned num_components,
                            unsigned bit_size)
 {
-   nir_ssa_undef_instr *instr = ralloc(shader, nir_ssa_undef_instr);
+   nir_ssa_undef_instr *instr =
+      ralloc(nir_shader_alloc_ctx(shader), nir_ssa_undef_instr);
    instr_init(&instr->instr, nir_instr_type_ssa_undef);
 
    nir_ssa_def_init(&instr->instr, &instr->def, num_components, bit_size, NULL);
@@ -1741,11 +1747,19 @@ nir_index_blocks(nir_function_impl *impl)
    impl->num_blocks = impl->end_block->index = index;
 }
 
+struct index_ssa_defs_state {
+   unsigned index;
+   bool changed;
+};
+
 static bool
-index_ssa_def_cb(nir_ssa_def *def, void *state)
+index_ssa_def_cb(nir_ssa_def *def, void *void_state)
 {
-   unsigned *index = (unsigned *) state;
-   def->index = (*index)++;
+   struct index_ssa_defs_state *state = void_state;
+
+   if (def->index != state->index)
+      state->changed = true;
+   def->index = state->index++;
 
    return true;
 }
@@ -1753,18 +1767,23 @@ index_ssa_def_cb(nir_ssa_def *def, void *state)
 /**
  * The indices are applied top-to-bottom which has the very nice property
  * that, if A dominates B, then A->index <= B->index.
+ *
+ * The liveness bitsets are indexed the same way, so they go away too if
+ * any index changes.
  */
 void
 nir_index_ssa_defs(nir_function_impl *impl)
 {
-   unsigned index = 0;
+   struct index_ssa_defs_state state = { 0, false };
 
    nir_foreach_block(block, impl) {
       nir_foreach_instr(instr, block)
-         nir_foreach_ssa_def(instr, index_ssa_def_cb, &index);
+         nir_foreach_ssa_def(instr, index_ssa_def_cb, &state);
    }
 
-   impl->ssa_alloc = index;
+   if (state.changed || state.index != impl->ssa_alloc)
+      impl->valid_metadata &= ~nir_metadata_live_ssa_defs;
+   impl->ssa_alloc = state.index;
 }
 
 /**
@@ -41,6 +41,7 @@
 #include "compiler/shader_enums.h"
 #include "compiler/shader_info.h"
 #include <stdio.h>
+#include <string.h>
 
 #ifndef NDEBUG
 #include "util/debug.h"
@@ -544,12 +545,6 @@ typedef struct nir_ssa_def {
    /** for debugging only, can be NULL */
    const char* name;
 
-   /** generic SSA definition index. */
-   unsigned index;
-
-   /** Index into the live_in and live_out bitfields */
-   unsigned live_index;
-
    /** Instruction which produces this SSA value. */
    nir_instr *parent_instr;
 
@@ -559,6 +554,13 @@ typedef struct nir_ssa_def {
    /** set of nir_ifs where this register is used as a condition */
    struct list_head if_uses;
 
+   /** generic SSA definition index.
+    *
+    * Once nir_metadata_live_ssa_defs has been required, this is also the
+    * index into the live_in and live_out bitsets of the blocks.
+    */
+   unsigned index;
+
    uint8_t num_components;
 
    /* The bit-size of each channel; must be one of 8, 16, 32, or 64 */
@@ -1122,8 +1124,6 @@ typedef struct {
 
    nir_intrinsic_op intrinsic;
 
-   nir_dest dest;
-
    /** number of components if this is a vectorized intrinsic
     *
     * Similarly to ALU operations, some intrinsics are vectorized.
@@ -1136,6 +1136,9 @@ typedef struct {
 
    int const_index[NIR_INTRINSIC_MAX_CONST_INDEX];
 
+   /* After the small fields so they share the padding after the opcode. */
+   nir_dest dest;
+
    nir_src src[];
 } nir_intrinsic_instr;
 
@@ -1983,6 +1986,16 @@ typedef struct {
    unsigned num_blocks;
 
    nir_metadata valid_metadata;
+
+   /**
+    * The metadata in valid_metadata that only depends on the CFG (block
+    * indices and dominance), and that the CFG hasn't changed since.
+    *
+    * nir_metadata_preserve() keeps it even if the pass doesn't list it, so
+    * that passes that only touch instructions don't cost a recomputation.
+    * The control flow helpers clear it with nir_metadata_invalidate_cfg().
+    */
+   nir_metadata cfg_metadata;
 } nir_function_impl;
 
 ATTRIBUTE_RETURNS_NONNULL static inline nir_block *
@@ -2282,6 +2295,13 @@ typedef struct nir_shader {
     */
    void *constant_data;
    unsigned constant_data_size;
+
+   /** Identifies the shader in the NIR_PASS_PROFILE statistics.
+    *
+    * It is 0 until a pass runs on the shader while profiling, and isn't
+    * copied to clones, so each of them is profiled as its own shader.
+    */
+   unsigned profile_id;
 } nir_shader;
 
 #define nir_foreach_function(func, shader) \
@@ -2359,6 +2379,8 @@ nir_function_impl *nir_cf_node_get_function(nir_cf_node *node);
 void nir_metadata_require(nir_function_impl *impl, nir_metadata required, ...);
 /** dirties all but the preserved metadata */
 void nir_metadata_preserve(nir_function_impl *impl, nir_metadata preserved);
+/** notes that the CFG changed, which dirties the metadata depending on it */
+void nir_metadata_invalidate_cfg(nir_function_impl *impl);
 
 /** creates an instruction with default swizzle/writemask/etc. with NULL registers */
 nir_alu_instr *nir_alu_instr_create(nir_shader *shader, nir_op op);
@@ -2763,6 +2785,19 @@ void nir_print_shader_annotated(nir_shader *shader, FILE *fp, struct hash_table
 void nir_print_instr(const nir_instr *instr, FILE *fp);
 void nir_print_deref(const nir_deref_instr *deref, FILE *fp);
 
+typedef struct {
+   struct {
+      uint64_t count;
+      uint64_t bytes;
+   } instrs[nir_instr_type_parallel_copy + 1];
+
+   /** Bytes taken by the names of the SSA values */
+   uint64_t name_bytes;
+} nir_memory_stats;
+
+void nir_gather_memory_stats(nir_shader *shader, nir_memory_stats *stats);
+void nir_print_memory_stats(const nir_memory_stats *stats, FILE *fp);
+
 nir_shader *nir_shader_clone(void *mem_ctx, const nir_shader *s);
 nir_function_impl *nir_function_impl_clone(const nir_function_impl *fi);
 nir_constant *nir_constant_clone(const nir_constant *c, nir_variable *var);
@@ -2831,12 +2866,34 @@ static inline bool should_serialize_deserialize_nir(void) { return false; }
 static inline bool should_print_nir(void) { return false; }
 #endif /* NDEBUG */
 
+/** Per-pass statistics gathered when NIR_PASS_PROFILE is set. */
+struct nir_pass_profile {
+   int64_t start;
+   unsigned num_instrs;
+   /** Whether the pass made progress, or -1 for NIR_PASS_V. */
+   int result;
+};
+
+void nir_pass_profile_begin(struct nir_pass_profile *profile,
+                            nir_shader *shader);
+void nir_pass_profile_end(struct nir_pass_profile *profile,
+                          nir_shader *shader, const char *pass_name);
+void nir_pass_profile_write(FILE *fp);
+
+bool should_profile_nir(void);
+
 #define _PASS(pass, nir, do_pass) do {                               \
+   struct nir_pass_profile _pass_profile;                            \
+   const bool _profile_pass = should_profile_nir();                  \
    if (should_skip_nir(#pass)) {                                     \
       printf("skipping %s\n", #pass);                                \
       break;                                                         \
    }                                                                 \
+   if (_profile_pass)                                                \
+      nir_pass_profile_begin(&_pass_profile, nir);                   \
    do_pass                                                           \
+   if (_profile_pass)                                                \
+      nir_pass_profile_end(&_pass_profile, nir, #pass);              \
    nir_validate_shader(nir, "after " #pass);                         \
    if (should_clone_nir()) {                                         \
       nir_shader *clone = nir_shader_clone(ralloc_parent(nir), nir); \
@@ -2853,7 +2910,8 @@ static inline bool should_print_nir(void) { return false; }
    nir_metadata_set_validation_flag(nir);                            \
    if (should_print_nir())                                           \
       printf("%s\n", #pass);                                         \
-   if (pass(nir, ##__VA_ARGS__)) {                                   \
+   _pass_profile.result = pass(nir, ##__VA_ARGS__);                  \
+   if (_pass_profile.result) {                                       \
       progress = true;                                               \
       if (should_print_nir())                                        \
          nir_print_shader(nir, stdout);                              \
@@ -2871,6 +2929,122 @@ static inline bool should_print_nir(void) { return false; }
 
 #define NIR_SKIP(name) should_skip_nir(#name)
 
+/**
+ * State for an optimization loop that runs its passes until none of them
+ * makes progress, like
+ *
+ *    nir_pass_loop loop;
+ *    nir_pass_loop_init(&loop);
+ *    do {
+ *       NIR_LOOP_PASS(&loop, nir, nir_copy_prop);
+ *       NIR_LOOP_PASS(&loop, nir, nir_opt_dce);
+ *       ...
+ *    } while (nir_pass_loop_continue(&loop));
+ *
+ * Passes are deterministic, so a pass that made no progress will make none
+ * again until another pass changes the shader.  The loop counts the changes
+ * and skips such passes, so the passes that ran after the last change of an
+ * iteration aren't run again in the next one, which is most of the last
+ * iteration.  Otherwise it runs the passes and finishes exactly like the
+ * loop around NIR_PASS it replaces, so it gives the same shader.
+ *
+ * The passes are told apart by their name and arguments as written, so the
+ * arguments must not change within the loop, and every pass that can change
+ * the shader within it has to be run through NIR_LOOP_PASS or
+ * NIR_LOOP_PASS_V.
+ */
+typedef struct {
+   /** Number of changes made to the shader so far */
+   unsigned generation;
+
+   /** Whether any pass made progress in this iteration */
+   bool progress;
+
+   /** Whether the last pass run through the loop made progress */
+   bool pass_progress;
+
+   unsigned num_slots;
+   struct {
+      /** The pass and its arguments, as written */
+      const char *call;
+      /** The generation the pass last made no progress at */
+      unsigned clean_generation;
+   } slots[64];
+} nir_pass_loop;
+
+static inline void
+nir_pass_loop_init(nir_pass_loop *loop)
+{
+   loop->generation = 1;
+   loop->progress = false;
+   loop->pass_progress = false;
+   loop->num_slots = 0;
+}
+
+/** Returns whether the loop needs another iteration, and starts it. */
+static inline bool
+nir_pass_loop_continue(nir_pass_loop *loop)
+{
+   bool progress = loop->progress;
+   loop->progress = false;
+   return progress;
+}
+
+/* Returns the slot of a pass, or NULL if it has to run untracked. */
+static inline unsigned *
+_nir_pass_loop_slot(nir_pass_loop *loop, const char *call)
+{
+   for (unsigned i = 0; i < loop->num_slots; i++) {
+      if (loop->slots[i].call == call || !strcmp(loop->slots[i].call, call))
+         return &loop->slots[i].clean_generation;
+   }
+
+   if (loop->num_slots >= ARRAY_SIZE(loop->slots))
+      return NULL;
+
+   loop->slots[loop->num_slots].call = call;
+   loop->slots[loop->num_slots].clean_generation = 0;
+   return &loop->slots[loop->num_slots++].clean_generation;
+}
+
+static inline void
+_nir_pass_loop_ran(nir_pass_loop *loop, unsigned *clean_generation,
+                   bool counts_as_progress)
+{
+   if (loop->pass_progress) {
+      loop->generation++;
+      if (counts_as_progress)
+         loop->progress = true;
+   } else if (clean_generation) {
+      *clean_generation = loop->generation;
+   }
+}
+
+#define _LOOP_PASS(loop, nir, counts_as_progress, pass, ...) do {    \
+   unsigned *_clean_generation =                                     \
+      _nir_pass_loop_slot(loop, #pass "(" #__VA_ARGS__ ")");         \
+   (loop)->pass_progress = false;                                    \
+   if (_clean_generation &&                                          \
+       *_clean_generation == (loop)->generation)                     \
+      break;                                                         \
+   NIR_PASS((loop)->pass_progress, nir, pass, ##__VA_ARGS__);        \
+   _nir_pass_loop_ran(loop, _clean_generation, counts_as_progress);  \
+} while (0)
+
+/**
+ * Runs a pass in a nir_pass_loop, unless it's known to make no progress.
+ * Whether it made progress is left in loop->pass_progress.
+ */
+#define NIR_LOOP_PASS(loop, nir, pass, ...) \
+   _LOOP_PASS(loop, nir, true, pass, ##__VA_ARGS__)
+
+/**
+ * Like NIR_LOOP_PASS, but for the lowering passes that loops run with
+ * NIR_PASS_V, whose progress doesn't keep the loop going.
+ */
+#define NIR_LOOP_PASS_V(loop, nir, pass, ...) \
+   _LOOP_PASS(loop, nir, false, pass, ##__VA_ARGS__)
+
 void nir_calc_dominance_impl(nir_function_impl *impl);
 void nir_calc_dominance(nir_shader *shader);
 
@@ -2974,6 +3148,7 @@ bool nir_is_per_vertex_io(const nir_variable *var, gl_shader_stage stage);
 bool nir_lower_regs_to_ssa_impl(nir_function_impl *impl);
 bool nir_lower_regs_to_ssa(nir_shader *shader);
 bool nir_lower_vars_to_ssa(nir_shader *shader);
+bool nir_lower_vars_to_ssa_impl(nir_function_impl *impl);
 
 bool nir_remove_dead_derefs(nir_shader *shader);
 bool nir_remove_dead_derefs_impl(nir_function_impl *impl);
@@ -3281,16 +3456,20 @@ bool nir_opt_algebraic(nir_shader *shader);
 bool nir_opt_algebraic_before_ffma(nir_shader *shader);
 bool nir_opt_algebraic_late(nir_shader *shader);
 bool nir_opt_constant_folding(nir_shader *shader);
+bool nir_opt_constant_folding_impl(nir_function_impl *impl);
 
 bool nir_opt_global_to_local(nir_shader *shader);
 
 bool nir_copy_prop(nir_shader *shader);
+bool nir_copy_prop_impl(nir_function_impl *impl);
 
 bool nir_opt_copy_prop_vars(nir_shader *shader);
 
 bool nir_opt_cse(nir_shader *shader);
+bool nir_opt_cse_impl(nir_function_impl *impl);
 
 bool nir_opt_dce(nir_shader *shader);
+bool nir_opt_dce_impl(nir_function_impl *impl);
 
 bool nir_opt_dead_cf(nir_shader *shader);
 
@@ -3302,6 +3481,8 @@ bool nir_opt_find_array_copies(nir_shader *shader);
 
 bool nir_opt_gcm(nir_shader *shader, bool value_number);
 
+bool nir_opt_gvn_pre(nir_shader *shader);
+
 bool nir_opt_idiv_const(nir_shader *shader, unsigned min_bit_size);
 
 bool nir_opt_if(nir_shader *shader);
@@ -3312,6 +3493,15 @@ bool nir_opt_large_constants(nir_shader *shader,
                              glsl_type_size_align_func size_align,
                              unsigned threshold);
 
+typedef bool (*nir_should_vectorize_mem_func)(unsigned align,
+                                              unsigned bit_size,
+                                              unsigned num_components,
+                                              nir_intrinsic_instr *low,
+                                              nir_intrinsic_instr *high);
+
+bool nir_opt_load_store_vectorize(nir_shader *shader, nir_variable_mode modes,
+                                  nir_should_vectorize_mem_func callback);
+
 bool nir_opt_loop_unroll(nir_shader *shader, nir_variable_mode indirect_mask);
 
 bool nir_opt_move_comparisons(nir_shader *shader);
@@ -3322,6 +3512,7 @@ bool nir_opt_peephole_select(nir_shader *shader, unsigned limit,
                              bool indirect_load_ok, bool expensive_alu_ok);
 
 bool nir_opt_remove_phis(nir_shader *shader);
+bool nir_opt_remove_phis_impl(nir_function_impl *impl);
 
 bool nir_opt_shrink_load(nir_shader *shader);
 
@@ -3331,8 +3522,39 @@ bool nir_opt_undef(nir_shader *shader);
 
 bool nir_opt_conditional_discard(nir_shader *shader);
 
+typedef struct nir_schedule_options {
+   /**
+    * While fewer 32-bit values than this are live, instructions are
+    * scheduled for latency rather than for register pressure.  Zero, the
+    * default, always schedules for pressure, and only keeps the new order
+    * of a block when it lowers the most values live at once.
+    */
+   unsigned latency_threshold;
+} nir_schedule_options;
+
+bool nir_schedule(nir_shader *shader, const nir_schedule_options *options);
+
 void nir_sweep(nir_shader *shader);
 
+/**
+ * A pass over a single function_impl, for nir_shader_run_impl_pass().
+ *
+ * It may only change the impl it is given, and may only allocate out of
+ * the shader through the nir_*_create() functions, or out of contexts of
+ * its own.
+ */
+typedef bool (*nir_impl_pass)(nir_function_impl *impl, void *data);
+
+struct util_queue;
+
+bool nir_shader_run_impl_pass(nir_shader *shader, struct util_queue *queue,
+                              nir_impl_pass pass, void *data);
+
+/* What nir_*_create() allocate out of, which is the shader itself unless
+ * the calling thread is running one of its impls.
+ */
+void *nir_shader_alloc_ctx(void *shader);
+
 void nir_remap_dual_slot_attributes(nir_shader *shader,
                                     uint64_t *dual_slot_inputs);
 uint64_t nir_get_single_slot_attribs_mask(uint64_t attribs, uint64_t dual_slot);
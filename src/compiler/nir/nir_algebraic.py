@@ -654,6 +654,169 @@ class SearchAndReplace(object):
 
       BitSizeValidator(varset).validate(self.search, self.replace)
 
+def search_op_nir_ops(opcode):
+   """Returns the NIR opcodes a search expression opcode can match, which is
+   all the sized variants of the generic conversion opcodes."""
+   if opcode in conv_opcode_types:
+      sized = (opcode + str(size)
+               for size in type_sizes(conv_opcode_types[opcode]))
+      return [op for op in sized if op in opcodes]
+   else:
+      return [opcode]
+
+class TreeAutomaton(object):
+   """A bottom-up tree automaton that finds which search expressions might
+   match an instruction.
+
+   Instead of trying every search expression of an opcode one after the
+   other, each of them walking the sources of the instruction again, the
+   pass computes a state for every instruction from its opcode and the
+   states of its sources, and only tries the search expressions that the
+   state says might match.  The tables are computed here, so the runtime
+   cost is one table lookup per source (see nir_algebraic_automaton()).
+
+   The automaton only looks at opcodes and at whether values are constant:
+   variables match anything, and constants or constant variables match any
+   load_const.  Everything else (bit sizes, swizzles, constant values,
+   conditions, which sources are the same variable) is still checked by
+   nir_replace_instr().  It never rejects a search expression that could
+   match, and it keeps the order the search expressions were given in, so
+   the pass makes exactly the same replacements as it would trying all of
+   them.
+
+   An item is a sub-expression of some search expression, keeping only what
+   the automaton looks at, and a state is the set of items that might match
+   an instruction.  State 0 has only the wildcard item and is the state of
+   everything that isn't an ALU instruction or load_const, while state 1 is
+   the state of load_const instructions.  The states are built like subsets
+   in the classic NFA to DFA conversion, starting from these two and adding
+   the ones every opcode can reach from the states found so far.
+
+   Indexing the tables directly by source states would make them huge, so
+   they are indexed by "filtered" states: the states of the sources are
+   first narrowed down to the items that are a source of some item with the
+   opcode.  Most states look the same to most opcodes.
+   """
+
+   WILDCARD = ('__wildcard',)
+   CONST = ('__const',)
+
+   def __init__(self, xforms):
+      # Items are tuples of the search opcode and the items of the sources,
+      # interned so that they can be numbered.
+      self.items = [self.WILDCARD, self.CONST]
+      self.item_index = { self.WILDCARD: 0, self.CONST: 1 }
+      self.xform_items = [self._add_item(xform.search) for xform in xforms]
+
+      # The items each NIR opcode can match, in the order they were added.
+      self.op_items = defaultdict(list)
+      for item in self.items[2:]:
+         for op in search_op_nir_ops(item[0]):
+            self.op_items[op].append(item)
+
+      self._build_states()
+
+      # The transforms to try for each state, in the order they were given.
+      self.state_xforms = []
+      for state in self.states:
+         self.state_xforms.append([xform for xform, item
+                                   in zip(xforms, self.xform_items)
+                                   if item in state])
+
+   def _add_item(self, val):
+      if isinstance(val, Expression):
+         item = (val.opcode,) + tuple(self._add_item(src)
+                                      for src in val.sources)
+      elif isinstance(val, Constant) or val.is_constant:
+         item = self.CONST
+      else:
+         item = self.WILDCARD
+
+      if item not in self.item_index:
+         self.item_index[item] = len(self.items)
+         self.items.append(item)
+      return item
+
+   @staticmethod
+   def _is_commutative(op):
+      return 'commutative' in opcodes[op].algebraic_properties
+
+   def _transition(self, op, src_states):
+      """Returns the state of an instruction with the given source states."""
+      state = set([self.WILDCARD])
+      for item in self.op_items[op]:
+         srcs = item[1:]
+         if all(src in src_state for src, src_state in zip(srcs, src_states)):
+            state.add(item)
+         elif self._is_commutative(op) and \
+              srcs[0] in src_states[1] and srcs[1] in src_states[0]:
+            state.add(item)
+      return frozenset(state)
+
+   def _build_states(self):
+      self.states = [frozenset([self.WILDCARD]),
+                     frozenset([self.WILDCARD, self.CONST])]
+      state_index = { s: i for i, s in enumerate(self.states) }
+
+      self.ops = sorted(self.op_items.keys())
+      self.num_srcs = {}
+      self.filter = {}
+      self.filtered_states = {}
+      self.table = {}
+
+      filter_items = {}
+      filtered_index = {}
+      for op in self.ops:
+         self.num_srcs[op] = opcodes[op].num_inputs
+         filter_items[op] = frozenset(src for item in self.op_items[op]
+                                      for src in item[1:])
+         self.filter[op] = []
+         self.filtered_states[op] = []
+         filtered_index[op] = {}
+         self.table[op] = {}
+
+      # Filter every state as it is found, and compute the transitions for
+      # all the combinations of filtered states that haven't been seen yet,
+      # until there are no new states.
+      num_filtered = 0
+      while num_filtered < len(self.states):
+         new_states = self.states[num_filtered:]
+         num_filtered = len(self.states)
+
+         for op in self.ops:
+            filtered_states = self.filtered_states[op]
+            num_old = len(filtered_states)
+
+            for state in new_states:
+               filtered = state & filter_items[op]
+               if filtered not in filtered_index[op]:
+                  filtered_index[op][filtered] = len(filtered_states)
+                  filtered_states.append(filtered)
+               self.filter[op].append(filtered_index[op][filtered])
+
+            if len(filtered_states) == num_old:
+               continue
+
+            for srcs in itertools.product(range(len(filtered_states)),
+                                          repeat=self.num_srcs[op]):
+               if all(src < num_old for src in srcs):
+                  continue
+
+               state = self._transition(op, [filtered_states[src]
+                                             for src in srcs])
+               if state not in state_index:
+                  state_index[state] = len(self.states)
+                  self.states.append(state)
+               self.table[op][srcs] = state_index[state]
+
+      # The tables are flattened in row-major order of the sources.
+      self.flat_table = {}
+      for op in self.ops:
+         n = len(self.filtered_states[op])
+         self.flat_table[op] = [self.table[op][srcs] for srcs in
+                                itertools.product(range(n),
+                                                  repeat=self.num_srcs[op])]
+
 _algebraic_pass_template = mako.template.Template("""
 #include "nir.h"
 #include "nir_builder.h"
@@ -669,6 +832,11 @@ struct transform {
    unsigned condition_offset;
 };
 
+struct transform_list {
+   const struct transform *xforms;
+   unsigned num_xforms;
+};
+
 #endif
 
 % for xform in xforms:
@@ -676,17 +844,53 @@ struct transform {
    ${xform.replace.render()}
 % endfor
 
-% for (opcode, xform_list) in sorted(opcode_xforms.items()):
-static const struct transform ${pass_name}_${opcode}_xforms[] = {
+% for name, filter in filters:
+static const uint16_t ${name}[] = {
+% for i in range(0, len(filter), 16):
+   ${', '.join(str(f) for f in filter[i:i + 16])},
+% endfor
+};
+
+% endfor
+% for name, table in tables:
+static const uint16_t ${name}[] = {
+% for i in range(0, len(table), 16):
+   ${', '.join(str(t) for t in table[i:i + 16])},
+% endfor
+};
+
+% endfor
+static const struct nir_search_op_table ${pass_name}_op_tables[nir_num_opcodes] = {
+% for op in automaton.ops:
+   [nir_op_${op}] = {
+      ${filter_names[op]},
+      ${len(automaton.filtered_states[op])},
+      ${table_names[op]},
+   },
+% endfor
+};
+
+% for name, xform_list in state_xform_lists:
+static const struct transform ${name}[] = {
 % for xform in xform_list:
    { &${xform.search.name}, ${xform.replace.c_ptr}, ${xform.condition_index} },
 % endfor
 };
 % endfor
 
+static const struct transform_list ${pass_name}_state_xforms[] = {
+% for state_xforms in automaton.state_xforms:
+% if state_xforms:
+   { ${state_xform_names[tuple(x.id for x in state_xforms)]}, ${len(state_xforms)} },
+% else:
+   { NULL, 0 },
+% endif
+% endfor
+};
+
 static bool
 ${pass_name}_block(nir_builder *build, nir_block *block,
-                   const bool *condition_flags)
+                   const uint16_t *states, const bool *condition_flags)
 {
    bool progress = false;
 
@@ -698,21 +902,15 @@ ${pass_name}_block(nir_builder *build, nir_block *block,
       if (!alu->dest.dest.is_ssa)
          continue;
 
-      switch (alu->op) {
-      % for opcode in sorted(opcode_xforms.keys()):
-      case nir_op_${opcode}:
-         for (unsigned i = 0; i < ARRAY_SIZE(${pass_name}_${opcode}_xforms); i++) {
-            const struct transform *xform = &${pass_name}_${opcode}_xforms[i];
-            if (condition_flags[xform->condition_offset] &&
-                nir_replace_instr(build, alu, xform->search, xform->replace)) {
-               progress = true;
-               break;
-            }
+      const struct transform_list *list =
+         &${pass_name}_state_xforms[states[alu->dest.dest.ssa.index]];
+      for (unsigned i = 0; i < list->num_xforms; i++) {
+         const struct transform *xform = &list->xforms[i];
+         if (condition_flags[xform->condition_offset] &&
+             nir_replace_instr(build, alu, xform->search, xform->replace)) {
+            progress = true;
+            break;
          }
-         break;
-      % endfor
-      default:
-         break;
       }
    }
 
@@ -727,10 +925,24 @@ ${pass_name}_impl(nir_function_impl *impl, const bool *condition_flags)
    nir_builder build;
    nir_builder_init(&build, impl);
 
+   /* The instructions that the replacements add are only ever used by
+    * instructions that have already been visited, so the states computed
+    * up front are all that's needed.  Everything the automaton doesn't look
+    * at keeps state 0.
+    */
+   uint16_t *states = calloc(impl->ssa_alloc, sizeof(*states));
+
+   nir_foreach_block(block, impl) {
+      nir_foreach_instr(instr, block)
+         nir_algebraic_automaton(instr, states, ${pass_name}_op_tables);
+   }
+
    nir_foreach_block_reverse(block, impl) {
-      progress |= ${pass_name}_block(&build, block, condition_flags);
+      progress |= ${pass_name}_block(&build, block, states, condition_flags);
    }
 
+   free(states);
+
    if (progress) {
       nir_metadata_preserve(impl, nir_metadata_block_index |
                                   nir_metadata_dominance);
@@ -756,6 +968,8 @@ ${pass_name}(nir_shader *shader)
    condition_flags[${index}] = ${condition};
    % endfor
 
+   nir_algebraic_maybe_dump(shader, "${pass_name}");
+
    nir_foreach_function(function, shader) {
       if (function->impl)
          progress |= ${pass_name}_impl(function->impl, condition_flags);
@@ -768,7 +982,6 @@ ${pass_name}(nir_shader *shader)
 class AlgebraicPass(object):
    def __init__(self, pass_name, transforms):
       self.xforms = []
-      self.opcode_xforms = defaultdict(lambda : [])
       self.pass_name = pass_name
 
       error = False
@@ -786,20 +999,50 @@ class AlgebraicPass(object):
                continue
 
          self.xforms.append(xform)
-         if xform.search.opcode in conv_opcode_types:
-            dst_type = conv_opcode_types[xform.search.opcode]
-            for size in type_sizes(dst_type):
-               sized_opcode = xform.search.opcode + str(size)
-               self.opcode_xforms[sized_opcode].append(xform)
-         else:
-            self.opcode_xforms[xform.search.opcode].append(xform)
 
       if error:
          sys.exit(1)
 
+      self.automaton = TreeAutomaton(self.xforms)
+
 
    def render(self):
+      automaton = self.automaton
+
+      # Opcodes whose search expressions have the same kinds of sources
+      # filter states the same way, and the sized variants of conversion
+      # opcodes share the whole table, so only emit each array once.
+      def unique_arrays(arrays, suffix):
+         unique = []
+         op_names = {}
+         names = {}
+         for op in automaton.ops:
+            key = tuple(arrays[op])
+            if key not in names:
+               names[key] = '{0}_{1}_{2}'.format(self.pass_name, op, suffix)
+               unique.append((names[key], key))
+            op_names[op] = names[key]
+         return unique, op_names
+
+      filters, filter_names = unique_arrays(automaton.filter, 'filter')
+      tables, table_names = unique_arrays(automaton.flat_table, 'table')
+
+      state_xform_lists = []
+      state_xform_names = {}
+      for xform_list in automaton.state_xforms:
+         key = tuple(xform.id for xform in xform_list)
+         if xform_list and key not in state_xform_names:
+            state_xform_names[key] = '{0}_xforms_{1}'.format(
+               self.pass_name, len(state_xform_lists))
+            state_xform_lists.append((state_xform_names[key], xform_list))
+
       return _algebraic_pass_template.render(pass_name=self.pass_name,
                                              xforms=self.xforms,
-                                             opcode_xforms=self.opcode_xforms,
+                                             automaton=automaton,
+                                             filters=filters,
+                                             filter_names=filter_names,
+                                             tables=tables,
+                                             table_names=table_names,
+                                             state_xform_lists=state_xform_lists,
+                                             state_xform_names=state_xform_names,
                                              condition_list=condition_list)
@@ -45,6 +45,13 @@ typedef struct {
    /* maps orig ptr -> cloned ptr: */
    struct hash_table *remap_table;
 
+   /* When cloning a whole function_impl, maps the index of each SSA def in
+    * the original to its clone.  The indices are dense and unique within an
+    * impl, so this is a lot cheaper than hashing every def.  NULL when only
+    * part of an impl is cloned, in which case SSA defs go in remap_table.
+    */
+   nir_ssa_def **ssa_remap;
+
    /* List of phi sources. */
    struct list_head phi_srcs;
 
@@ -65,6 +72,7 @@ init_clone_state(clone_state *state, struct hash_table *remap_table,
       state->remap_table = _mesa_pointer_hash_table_create(NULL);
    }
 
+   state->ssa_remap = NULL;
    list_inithead(&state->phi_srcs);
 }
 
@@ -112,6 +120,25 @@ remap_global(clone_state *state, const void *ptr)
    return _lookup_ptr(state, ptr, true);
 }
 
+static nir_ssa_def *
+remap_ssa(clone_state *state, const nir_ssa_def *def)
+{
+   if (!state->ssa_remap)
+      return _lookup_ptr(state, def, false);
+
+   assert(state->ssa_remap[def->index]);
+   return state->ssa_remap[def->index];
+}
+
+static void
+add_ssa_remap(clone_state *state, nir_ssa_def *ndef, const nir_ssa_def *def)
+{
+   if (state->ssa_remap)
+      state->ssa_remap[def->index] = ndef;
+   else
+      add_remap(state, ndef, def);
+}
+
 static nir_register *
 remap_reg(clone_state *state, const nir_register *reg)
 {
@@ -235,7 +262,7 @@ __clone_src(clone_state *state, void *ninstr_or_if,
 {
    nsrc->is_ssa = src->is_ssa;
    if (src->is_ssa) {
-      nsrc->ssa = remap_local(state, src->ssa);
+      nsrc->ssa = remap_ssa(state, src->ssa);
    } else {
       nsrc->reg.reg = remap_reg(state, src->reg.reg);
       if (src->reg.indirect) {
@@ -254,7 +281,7 @@ __clone_dst(clone_state *state, nir_instr *ninstr,
    if (dst->is_ssa) {
       nir_ssa_dest_init(ninstr, ndst, dst->ssa.num_components,
                         dst->ssa.bit_size, dst->ssa.name);
-      add_remap(state, &ndst->ssa, &dst->ssa);
+      add_ssa_remap(state, &ndst->ssa, &dst->ssa);
    } else {
       ndst->reg.reg = remap_reg(state, dst->reg.reg);
       if (dst->reg.indirect) {
@@ -359,7 +386,7 @@ clone_load_const(clone_state *state, const nir_load_const_instr *lc)
 
    memcpy(&nlc->value, &lc->value, sizeof(nlc->value));
 
-   add_remap(state, &nlc->def, &lc->def);
+   add_ssa_remap(state, &nlc->def, &lc->def);
 
    return nlc;
 }
@@ -371,7 +398,7 @@ clone_ssa_undef(clone_state *state, const nir_ssa_undef_instr *sa)
       nir_ssa_undef_instr_create(state->ns, sa->def.num_components,
                                  sa->def.bit_size);
 
-   add_remap(state, &nsa->def, &sa->def);
+   add_ssa_remap(state, &nsa->def, &sa->def);
 
    return nsa;
 }
@@ -596,7 +623,7 @@ fixup_phi_srcs(clone_state *state)
       list_del(&src->src.use_link);
 
       if (src->src.is_ssa) {
-         src->src.ssa = remap_local(state, src->src.ssa);
+         src->src.ssa = remap_ssa(state, src->src.ssa);
          list_addtail(&src->src.use_link, &src->src.ssa->uses);
       } else {
          src->src.reg.reg = remap_reg(state, src->src.reg.reg);
@@ -644,11 +671,17 @@ clone_function_impl(clone_state *state, const nir_function_impl *fi)
    nfi->reg_alloc = fi->reg_alloc;
 
    assert(list_empty(&state->phi_srcs));
+   assert(!state->ssa_remap);
+
+   state->ssa_remap = calloc(fi->ssa_alloc, sizeof(*state->ssa_remap));
 
    clone_cf_list(state, &nfi->body, &fi->body);
 
    fixup_phi_srcs(state);
 
+   free(state->ssa_remap);
+   state->ssa_remap = NULL;
+
    /* All metadata is invalidated in the cloning process */
    nfi->valid_metadata = 0;
 
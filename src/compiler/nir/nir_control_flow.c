@@ -469,6 +469,7 @@ nir_handle_add_jump(nir_block *block)
    unlink_block_successors(block);
 
    nir_function_impl *impl = nir_cf_node_get_function(&block->cf_node);
+   nir_metadata_invalidate_cfg(impl);
    nir_metadata_preserve(impl, nir_metadata_none);
 
    if (jump_instr->type == nir_jump_break ||
@@ -512,6 +513,7 @@ nir_handle_remove_jump(nir_block *block, nir_jump_type type)
    unlink_jump(block, type, true);
 
    nir_function_impl *impl = nir_cf_node_get_function(&block->cf_node);
+   nir_metadata_invalidate_cfg(impl);
    nir_metadata_preserve(impl, nir_metadata_none);
 }
 
@@ -575,6 +577,8 @@ nir_cf_node_insert(nir_cursor cursor, nir_cf_node *node)
 
    split_block_cursor(cursor, &before, &after);
 
+   nir_metadata_invalidate_cfg(nir_cf_node_get_function(&before->cf_node));
+
    if (node->type == nir_cf_node_block) {
       nir_block *block = nir_cf_node_as_block(node);
       exec_node_insert_after(&before->cf_node.node, &block->cf_node.node);
@@ -680,6 +684,7 @@ nir_cf_extract(nir_cf_list *extracted, nir_cursor begin, nir_cursor end)
    exec_list_make_empty(&extracted->list);
 
    /* Dominance and other block-related information is toast. */
+   nir_metadata_invalidate_cfg(extracted->impl);
    nir_metadata_preserve(extracted->impl, nir_metadata_none);
 
    nir_cf_node *cf_node = &block_begin->cf_node;
@@ -710,6 +715,8 @@ nir_cf_reinsert(nir_cf_list *cf_list, nir_cursor cursor)
 
    split_block_cursor(cursor, &before, &after);
 
+   nir_metadata_invalidate_cfg(nir_cf_node_get_function(&before->cf_node));
+
    foreach_list_typed_safe(nir_cf_node, node, node, &cf_list->list) {
       exec_node_remove(&node->node);
       node->parent = before->cf_node.parent;
@@ -125,16 +125,17 @@ calc_dom_frontier(nir_block *block)
 static void
 calc_dom_children(nir_function_impl* impl)
 {
-   void *mem_ctx = ralloc_parent(impl);
-
    nir_foreach_block(block, impl) {
       if (block->imm_dom)
          block->imm_dom->num_dom_children++;
    }
 
+   /* The arrays belong to the block, so recomputing the dominance doesn't
+    * pile up garbage in the shader until the next nir_sweep().
+    */
    nir_foreach_block(block, impl) {
-      block->dom_children = ralloc_array(mem_ctx, nir_block *,
-                                         block->num_dom_children);
+      block->dom_children = reralloc(block, block->dom_children, nir_block *,
+                                     block->num_dom_children);
       block->num_dom_children = 0;
    }
 
@@ -170,14 +171,24 @@ nir_calc_dominance_impl(nir_function_impl *impl)
       init_block(block, impl);
    }
 
-   bool progress = true;
-   while (progress) {
-      progress = false;
-      nir_foreach_block(block, impl) {
-         if (block != nir_start_block(impl))
-            progress |= calc_dominance(block);
+   /* The CFG is structured, so it is reducible and the block indices are a
+    * reverse post-order of it.  That means a single pass gets the final
+    * immediate dominators: the only predecessors it hasn't seen yet are the
+    * ones on a back-edge, which are dominated by the loop header anyway.
+    */
+   nir_foreach_block(block, impl) {
+      if (block != nir_start_block(impl))
+         calc_dominance(block);
+   }
+
+#ifndef NDEBUG
+   nir_foreach_block(block, impl) {
+      if (block != nir_start_block(impl)) {
+         bool progress = calc_dominance(block);
+         assert(!progress);
       }
    }
+#endif
 
    nir_foreach_block(block, impl) {
       calc_dom_frontier(block);
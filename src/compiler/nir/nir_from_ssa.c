@@ -38,23 +38,37 @@
 struct from_ssa_state {
    nir_builder builder;
    void *dead_ctx;
+   void *lin_ctx; /* for the merge sets and nodes */
    bool phi_webs_only;
    struct hash_table *merge_node_table;
    nir_instr *instr;
    bool progress;
 };
 
+/* The order of the SSA defs in a merge set.  SSA undefs are never live, so
+ * they come before everything else, which is ordered by the index
+ * nir_index_ssa_defs() gave it.
+ */
+static unsigned
+ssa_def_order(nir_ssa_def *def)
+{
+   if (def->parent_instr->type == nir_instr_type_ssa_undef)
+      return 0;
+   else
+      return def->index + 1;
+}
+
 /* Returns true if a dominates b */
 static bool
 ssa_def_dominates(nir_ssa_def *a, nir_ssa_def *b)
 {
-   if (a->live_index == 0) {
+   if (ssa_def_order(a) == 0) {
       /* SSA undefs always dominate */
       return true;
-   } else if (b->live_index < a->live_index) {
+   } else if (ssa_def_order(b) < ssa_def_order(a)) {
       return false;
    } else if (a->parent_instr->block == b->parent_instr->block) {
-      return a->live_index <= b->live_index;
+      return a->index <= b->index;
    } else {
       return nir_block_dominates(a->parent_instr->block,
                                  b->parent_instr->block);
@@ -72,8 +86,8 @@ ssa_def_dominates(nir_ssa_def *a, nir_ssa_def *b)
  * Each SSA definition is associated with a merge_node and the association
  * is represented by a combination of a hash table and the "def" parameter
  * in the merge_node structure.  The merge_set stores a linked list of
- * merge_nodes in dominance order of the ssa definitions.  (Since the
- * liveness analysis pass indexes the SSA values in dominance order for us,
+ * merge_nodes in dominance order of the ssa definitions.  (Since
+ * nir_index_ssa_defs() indexes the SSA values in dominance order for us,
  * this is an easy thing to keep up.)  It is assumed that no pair of the
  * nodes in a given set interfere.  Merging two sets or checking for
  * interference can be done in a single linear-time merge-sort walk of the
@@ -125,12 +139,12 @@ get_merge_node(nir_ssa_def *def, struct from_ssa_state *state)
    if (entry)
       return entry->data;
 
-   merge_set *set = ralloc(state->dead_ctx, merge_set);
+   merge_set *set = linear_alloc_child(state->lin_ctx, sizeof(merge_set));
    exec_list_make_empty(&set->nodes);
    set->size = 1;
    set->reg = NULL;
 
-   merge_node *node = ralloc(state->dead_ctx, merge_node);
+   merge_node *node = linear_alloc_child(state->lin_ctx, sizeof(merge_node));
    node->set = set;
    node->def = def;
    exec_list_push_head(&set->nodes, &node->node);
@@ -157,7 +171,7 @@ merge_merge_sets(merge_set *a, merge_set *b)
       merge_node *b_node = exec_node_data(merge_node, bn, node);
 
       if (exec_node_is_tail_sentinel(an) ||
-          a_node->def->live_index > b_node->def->live_index) {
+          ssa_def_order(a_node->def) > ssa_def_order(b_node->def)) {
          struct exec_node *next = bn->next;
          exec_node_remove(bn);
          exec_node_insert_node_before(an, bn);
@@ -202,7 +216,7 @@ merge_sets_interfere(merge_set *a, merge_set *b)
          merge_node *a_node = exec_node_data(merge_node, an, node);
          merge_node *b_node = exec_node_data(merge_node, bn, node);
 
-         if (a_node->def->live_index <= b_node->def->live_index) {
+         if (ssa_def_order(a_node->def) <= ssa_def_order(b_node->def)) {
             current = a_node;
             an = an->next;
          } else {
@@ -767,6 +781,7 @@ nir_convert_from_ssa_impl(nir_function_impl *impl, bool phi_webs_only)
 
    nir_builder_init(&state.builder, impl);
    state.dead_ctx = ralloc_context(NULL);
+   state.lin_ctx = linear_alloc_parent(state.dead_ctx, 0);
    state.phi_webs_only = phi_webs_only;
    state.merge_node_table = _mesa_pointer_hash_table_create(NULL);
    state.progress = false;
@@ -783,6 +798,8 @@ nir_convert_from_ssa_impl(nir_function_impl *impl, bool phi_webs_only)
    nir_metadata_preserve(impl, nir_metadata_block_index |
                                nir_metadata_dominance);
 
+   /* The merge sets are sorted by index, so it has to follow dominance. */
+   nir_index_ssa_defs(impl);
    nir_metadata_require(impl, nir_metadata_live_ssa_defs |
                               nir_metadata_dominance);
 
@@ -0,0 +1,250 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * \file nir_impl_pass.c
+ *
+ * Runs a pass over every function_impl of a shader, on the threads of a
+ * util_queue.  Until functions are inlined, a shader can have a lot of them,
+ * and a pass that only looks at one impl at a time doesn't need to see the
+ * others.
+ *
+ * The impls all allocate out of the shader, and ralloc isn't thread-safe,
+ * so before any of them is handed to a thread, everything hanging off it is
+ * moved to a context of its own.  While the pass runs, nir_shader_alloc_ctx()
+ * sends the nir_*_create() calls for the shader on that thread to the same
+ * context, and once all the impls are done, the shader gets everything back.
+ */
+
+#include <stdlib.h>
+
+#include "nir.h"
+#include "c11/threads.h"
+#include "util/u_atomic.h"
+#include "util/u_queue.h"
+
+struct impl_job {
+   struct util_queue_fence fence;
+
+   nir_shader *shader;
+   nir_function_impl *impl;
+   void *mem_ctx;
+
+   nir_impl_pass pass;
+   void *data;
+   bool progress;
+};
+
+static once_flag job_key_once = ONCE_FLAG_INIT;
+static tss_t job_key;
+
+/* How many nir_shader_run_impl_pass() calls have jobs on threads. */
+static int num_threaded_runs;
+
+static void
+job_key_init(void)
+{
+   tss_create(&job_key, NULL);
+}
+
+void *
+nir_shader_alloc_ctx(void *shader)
+{
+   /* Every instruction comes through here, so don't look at the thread
+    * unless there is a chance it's running an impl.  The key is created
+    * before num_threaded_runs is first incremented.
+    */
+   if (likely(!p_atomic_read(&num_threaded_runs)))
+      return shader;
+
+   struct impl_job *job = tss_get(job_key);
+   if (job && job->shader == shader)
+      return job->mem_ctx;
+
+   return shader;
+}
+
+#define steal_list(mem_ctx, type, list) \
+   foreach_list_typed(type, obj, node, list) { ralloc_steal(mem_ctx, obj); }
+
+static bool
+steal_src_indirect(nir_src *src, void *mem_ctx)
+{
+   if (!src->is_ssa && src->reg.indirect)
+      ralloc_steal(mem_ctx, src->reg.indirect);
+
+   return true;
+}
+
+static bool
+steal_dest_indirect(nir_dest *dest, void *mem_ctx)
+{
+   if (!dest->is_ssa && dest->reg.indirect)
+      ralloc_steal(mem_ctx, dest->reg.indirect);
+
+   return true;
+}
+
+static void
+steal_block(void *mem_ctx, nir_block *block)
+{
+   ralloc_steal(mem_ctx, block);
+
+   nir_foreach_instr(instr, block) {
+      ralloc_steal(mem_ctx, instr);
+
+      nir_foreach_src(instr, steal_src_indirect, mem_ctx);
+      nir_foreach_dest(instr, steal_dest_indirect, mem_ctx);
+   }
+}
+
+static void
+steal_cf_list(void *mem_ctx, struct exec_list *list)
+{
+   foreach_list_typed(nir_cf_node, cf_node, node, list) {
+      switch (cf_node->type) {
+      case nir_cf_node_block:
+         steal_block(mem_ctx, nir_cf_node_as_block(cf_node));
+         break;
+
+      case nir_cf_node_if: {
+         nir_if *nif = nir_cf_node_as_if(cf_node);
+         ralloc_steal(mem_ctx, nif);
+         steal_cf_list(mem_ctx, &nif->then_list);
+         steal_cf_list(mem_ctx, &nif->else_list);
+         break;
+      }
+
+      case nir_cf_node_loop: {
+         nir_loop *loop = nir_cf_node_as_loop(cf_node);
+         ralloc_steal(mem_ctx, loop);
+         steal_cf_list(mem_ctx, &loop->body);
+         break;
+      }
+
+      default:
+         unreachable("Invalid CF node type");
+      }
+   }
+}
+
+/**
+ * Moves everything the impl owns that was allocated out of the shader to
+ * mem_ctx, so that freeing or stealing it doesn't touch the shader's list
+ * of children, which the other threads are using.  The impl itself stays
+ * with the shader, since passes use ralloc_parent(impl) to find it; nothing
+ * is allocated out of the impl but its metadata, and that's only ever
+ * touched by the thread running the impl.
+ */
+static void
+steal_impl(void *mem_ctx, nir_function_impl *impl)
+{
+   steal_list(mem_ctx, nir_variable, &impl->locals);
+   steal_list(mem_ctx, nir_register, &impl->registers);
+
+   steal_cf_list(mem_ctx, &impl->body);
+   steal_block(mem_ctx, impl->end_block);
+}
+
+static void
+run_impl_job(void *data, int thread_index)
+{
+   struct impl_job *job = data;
+
+   tss_set(job_key, job);
+   job->progress = job->pass(job->impl, job->data);
+   tss_set(job_key, NULL);
+}
+
+/**
+ * Runs pass on every function_impl in the shader and returns whether it
+ * made progress on any of them.
+ *
+ * With a queue, the impls are run as jobs on it, and this waits for all of
+ * them.  It must not be called from a job on the same queue.  The result
+ * is the same as running them one after the other, which is what happens
+ * without a queue, with a single impl, or when the shader has global
+ * registers, whose use lists the impls would share.
+ */
+bool
+nir_shader_run_impl_pass(nir_shader *shader, struct util_queue *queue,
+                         nir_impl_pass pass, void *data)
+{
+   unsigned num_impls = 0;
+   bool progress = false;
+
+   nir_foreach_function(function, shader) {
+      if (function->impl)
+         num_impls++;
+   }
+
+   if (!queue || num_impls < 2 || !exec_list_is_empty(&shader->registers)) {
+      nir_foreach_function(function, shader) {
+         if (function->impl)
+            progress |= pass(function->impl, data);
+      }
+      return progress;
+   }
+
+   call_once(&job_key_once, job_key_init);
+
+   struct impl_job *jobs = calloc(num_impls, sizeof(*jobs));
+   unsigned i = 0;
+
+   nir_foreach_function(function, shader) {
+      if (!function->impl)
+         continue;
+
+      struct impl_job *job = &jobs[i++];
+      job->shader = shader;
+      job->impl = function->impl;
+      job->mem_ctx = ralloc_context(NULL);
+      job->pass = pass;
+      job->data = data;
+      util_queue_fence_init(&job->fence);
+
+      steal_impl(job->mem_ctx, job->impl);
+   }
+
+   p_atomic_inc(&num_threaded_runs);
+
+   for (i = 0; i < num_impls; i++)
+      util_queue_add_job(queue, &jobs[i], &jobs[i].fence, run_impl_job, NULL);
+
+   for (i = 0; i < num_impls; i++) {
+      util_queue_fence_wait(&jobs[i].fence);
+      util_queue_fence_destroy(&jobs[i].fence);
+
+      progress |= jobs[i].progress;
+
+      /* Including whatever the pass dropped, which nir_sweep() is for. */
+      ralloc_adopt(shader, jobs[i].mem_ctx);
+      ralloc_free(jobs[i].mem_ctx);
+   }
+
+   p_atomic_dec(&num_threaded_runs);
+
+   free(jobs);
+
+   return progress;
+}
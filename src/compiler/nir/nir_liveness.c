@@ -43,25 +43,11 @@
  */
 
 struct live_ssa_defs_state {
-   unsigned num_ssa_defs;
    unsigned bitset_words;
 
    nir_block_worklist worklist;
 };
 
-static bool
-index_ssa_def(nir_ssa_def *def, void *void_state)
-{
-   struct live_ssa_defs_state *state = void_state;
-
-   if (def->parent_instr->type == nir_instr_type_ssa_undef)
-      def->live_index = 0;
-   else
-      def->live_index = state->num_ssa_defs++;
-
-   return true;
-}
-
 /* Initialize the liveness data to zero and add the given block to the
  * worklist.
  */
@@ -90,10 +76,10 @@ set_src_live(nir_src *src, void *void_live)
    if (!src->is_ssa)
       return true;
 
-   if (src->ssa->live_index == 0)
+   if (src->ssa->parent_instr->type == nir_instr_type_ssa_undef)
       return true;   /* undefined variables are never live */
 
-   BITSET_SET(live, src->ssa->live_index);
+   BITSET_SET(live, src->ssa->index);
 
    return true;
 }
@@ -103,7 +89,7 @@ set_ssa_def_dead(nir_ssa_def *def, void *void_live)
 {
    BITSET_WORD *live = void_live;
 
-   BITSET_CLEAR(live, def->live_index);
+   BITSET_CLEAR(live, def->index);
 
    return true;
 }
@@ -154,33 +140,30 @@ propagate_across_edge(nir_block *pred, nir_block *succ,
    return progress != 0;
 }
 
+/**
+ * Computes the live sets of every block, indexed by nir_ssa_def::index.
+ *
+ * The indices are used as they are, so callers should run
+ * nir_index_ssa_defs() first: the sets are only as small as the indices are
+ * dense, and nir_ssa_defs_interfere() relies on them following instruction
+ * order.  nir_index_ssa_defs() keeps the live sets if nothing was renumbered.
+ */
 void
 nir_live_ssa_defs_impl(nir_function_impl *impl)
 {
    struct live_ssa_defs_state state;
 
-   /* We start at 1 because we reserve the index value of 0 for ssa_undef
-    * instructions.  Those are never live, so their liveness information
-    * can be compacted into a single bit.
-    */
-   state.num_ssa_defs = 1;
-   nir_foreach_block(block, impl) {
-      nir_foreach_instr(instr, block)
-         nir_foreach_ssa_def(instr, index_ssa_def, &state);
-   }
-
    nir_block_worklist_init(&state.worklist, impl->num_blocks, NULL);
 
    /* We now know how many unique ssa definitions we have and we can go
     * ahead and allocate live_in and live_out sets and add all of the
     * blocks to the worklist.
     */
-   state.bitset_words = BITSET_WORDS(state.num_ssa_defs);
+   state.bitset_words = BITSET_WORDS(impl->ssa_alloc);
    nir_foreach_block(block, impl) {
       init_liveness_block(block, &state);
    }
 
-
    /* We're now ready to work through the worklist and update the liveness
     * sets of each of the blocks.  By the time we get to this point, every
     * block in the function implementation has been pushed onto the
@@ -254,13 +237,13 @@ search_for_use_after_instr(nir_instr *start, nir_ssa_def *def)
 static bool
 nir_ssa_def_is_live_at(nir_ssa_def *def, nir_instr *instr)
 {
-   if (BITSET_TEST(instr->block->live_out, def->live_index)) {
+   if (BITSET_TEST(instr->block->live_out, def->index)) {
       /* Since def dominates instr, if def is in the liveout of the block,
        * it's live at instr
        */
       return true;
    } else {
-      if (BITSET_TEST(instr->block->live_in, def->live_index) ||
+      if (BITSET_TEST(instr->block->live_in, def->index) ||
           def->parent_instr->block == instr->block) {
          /* In this case it is either live coming into instr's block or it
           * is defined in the same block.  In this case, we simply need to
@@ -281,10 +264,11 @@ nir_ssa_defs_interfere(nir_ssa_def *a, nir_ssa_def *b)
        * least one isn't dead.
        */
       return true;
-   } else if (a->live_index == 0 || b->live_index == 0) {
+   } else if (a->parent_instr->type == nir_instr_type_ssa_undef ||
+              b->parent_instr->type == nir_instr_type_ssa_undef) {
       /* If either variable is an ssa_undef, then there's no interference */
       return false;
-   } else if (a->live_index < b->live_index) {
+   } else if (a->index < b->index) {
       return nir_ssa_def_is_live_at(a, b->parent_instr);
    } else {
       return nir_ssa_def_is_live_at(b, a->parent_instr);
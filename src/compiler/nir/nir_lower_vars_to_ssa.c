@@ -64,6 +64,8 @@ struct deref_node {
 struct lower_variables_state {
    nir_shader *shader;
    void *dead_ctx;
+   /* Linear allocator for the deref nodes, freed along with dead_ctx */
+   void *lin_ctx;
    nir_function_impl *impl;
 
    /* A hash table mapping variables to deref_node data */
@@ -99,12 +101,12 @@ struct lower_variables_state {
 static struct deref_node *
 deref_node_create(struct deref_node *parent,
                   const struct glsl_type *type,
-                  bool is_direct, void *mem_ctx)
+                  bool is_direct, void *lin_ctx)
 {
    size_t size = sizeof(struct deref_node) +
                  glsl_get_length(type) * sizeof(struct deref_node *);
 
-   struct deref_node *node = rzalloc_size(mem_ctx, size);
+   struct deref_node *node = linear_zalloc_child(lin_ctx, size);
    node->type = type;
    node->parent = parent;
    exec_node_init(&node->direct_derefs_link);
@@ -127,7 +129,7 @@ get_deref_node_for_var(nir_variable *var, struct lower_variables_state *state)
    if (var_entry) {
       return var_entry->data;
    } else {
-      node = deref_node_create(NULL, var->type, true, state->dead_ctx);
+      node = deref_node_create(NULL, var->type, true, state->lin_ctx);
       _mesa_hash_table_insert(state->deref_var_nodes, var, node);
       return node;
    }
@@ -156,7 +158,7 @@ get_deref_node_recur(nir_deref_instr *deref,
       if (parent->children[deref->strct.index] == NULL) {
          parent->children[deref->strct.index] =
             deref_node_create(parent, deref->type, parent->is_direct,
-                              state->dead_ctx);
+                              state->lin_ctx);
       }
 
       return parent->children[deref->strct.index];
@@ -174,14 +176,14 @@ get_deref_node_recur(nir_deref_instr *deref,
          if (parent->children[index] == NULL) {
             parent->children[index] =
                deref_node_create(parent, deref->type, parent->is_direct,
-                                 state->dead_ctx);
+                                 state->lin_ctx);
          }
 
          return parent->children[index];
       } else {
          if (parent->indirect == NULL) {
             parent->indirect =
-               deref_node_create(parent, deref->type, false, state->dead_ctx);
+               deref_node_create(parent, deref->type, false, state->lin_ctx);
          }
 
          return parent->indirect;
@@ -192,7 +194,7 @@ get_deref_node_recur(nir_deref_instr *deref,
    case nir_deref_type_array_wildcard:
       if (parent->wildcard == NULL) {
          parent->wildcard =
-            deref_node_create(parent, deref->type, false, state->dead_ctx);
+            deref_node_create(parent, deref->type, false, state->lin_ctx);
       }
 
       return parent->wildcard;
@@ -649,13 +651,14 @@ rename_variables(struct lower_variables_state *state)
  *  4) Perform "variable renaming" by replacing the load/store instructions
  *     with SSA definitions and SSA uses.
  */
-static bool
+bool
 nir_lower_vars_to_ssa_impl(nir_function_impl *impl)
 {
    struct lower_variables_state state;
 
    state.shader = impl->function->shader;
-   state.dead_ctx = ralloc_context(state.shader);
+   state.dead_ctx = ralloc_context(NULL);
+   state.lin_ctx = linear_zalloc_parent(state.dead_ctx, 0);
    state.impl = impl;
 
    state.deref_var_nodes = _mesa_pointer_hash_table_create(state.dead_ctx);
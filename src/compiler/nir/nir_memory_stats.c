@@ -0,0 +1,190 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * How much memory the instructions of a shader take up.
+ *
+ * For each kind of instruction, this adds up the structure itself, the
+ * sources allocated along with it or next to it (ALU, intrinsic and call
+ * sources, texture sources, phi sources and parallel copy entries) and
+ * any register indirects.  The names of the SSA values are counted
+ * separately.  The allocator's own overhead isn't counted, so the numbers
+ * are a lower bound but they do move with the layout of nir.h.
+ */
+
+#include <inttypes.h>
+
+#include "nir.h"
+
+static const char *instr_type_names[] = {
+   [nir_instr_type_alu]           = "alu",
+   [nir_instr_type_deref]         = "deref",
+   [nir_instr_type_call]          = "call",
+   [nir_instr_type_tex]           = "tex",
+   [nir_instr_type_intrinsic]     = "intrinsic",
+   [nir_instr_type_load_const]    = "load_const",
+   [nir_instr_type_jump]          = "jump",
+   [nir_instr_type_ssa_undef]     = "ssa_undef",
+   [nir_instr_type_phi]           = "phi",
+   [nir_instr_type_parallel_copy] = "parallel_copy",
+};
+
+static size_t
+instr_size(nir_instr *instr)
+{
+   switch (instr->type) {
+   case nir_instr_type_alu: {
+      nir_alu_instr *alu = nir_instr_as_alu(instr);
+      return sizeof(*alu) +
+             nir_op_infos[alu->op].num_inputs * sizeof(nir_alu_src);
+   }
+
+   case nir_instr_type_deref:
+      return sizeof(nir_deref_instr);
+
+   case nir_instr_type_call: {
+      nir_call_instr *call = nir_instr_as_call(instr);
+      return sizeof(*call) + call->num_params * sizeof(call->params[0]);
+   }
+
+   case nir_instr_type_tex: {
+      nir_tex_instr *tex = nir_instr_as_tex(instr);
+      return sizeof(*tex) + tex->num_srcs * sizeof(nir_tex_src);
+   }
+
+   case nir_instr_type_intrinsic: {
+      nir_intrinsic_instr *intrin = nir_instr_as_intrinsic(instr);
+      return sizeof(*intrin) +
+             nir_intrinsic_infos[intrin->intrinsic].num_srcs * sizeof(nir_src);
+   }
+
+   case nir_instr_type_load_const:
+      return sizeof(nir_load_const_instr);
+
+   case nir_instr_type_jump:
+      return sizeof(nir_jump_instr);
+
+   case nir_instr_type_ssa_undef:
+      return sizeof(nir_ssa_undef_instr);
+
+   case nir_instr_type_phi: {
+      size_t size = sizeof(nir_phi_instr);
+      nir_foreach_phi_src(src, nir_instr_as_phi(instr))
+         size += sizeof(*src);
+      return size;
+   }
+
+   case nir_instr_type_parallel_copy: {
+      size_t size = sizeof(nir_parallel_copy_instr);
+      nir_foreach_parallel_copy_entry(entry, nir_instr_as_parallel_copy(instr))
+         size += sizeof(*entry);
+      return size;
+   }
+   }
+
+   unreachable("Invalid instruction type");
+}
+
+static bool
+add_src_indirect(nir_src *src, void *data)
+{
+   size_t *size = data;
+
+   if (!src->is_ssa && src->reg.indirect)
+      *size += sizeof(nir_src);
+
+   return true;
+}
+
+static bool
+add_dest_indirect(nir_dest *dest, void *data)
+{
+   size_t *size = data;
+
+   if (!dest->is_ssa && dest->reg.indirect)
+      *size += sizeof(nir_src);
+
+   return true;
+}
+
+static bool
+add_name(nir_ssa_def *def, void *data)
+{
+   uint64_t *size = data;
+
+   if (def->name)
+      *size += strlen(def->name) + 1;
+
+   return true;
+}
+
+/**
+ * Adds the instructions of the shader to the stats, so they can be summed
+ * over several shaders.
+ */
+void
+nir_gather_memory_stats(nir_shader *shader, nir_memory_stats *stats)
+{
+   nir_foreach_function(function, shader) {
+      if (!function->impl)
+         continue;
+
+      nir_foreach_block(block, function->impl) {
+         nir_foreach_instr(instr, block) {
+            size_t size = instr_size(instr);
+
+            nir_foreach_src(instr, add_src_indirect, &size);
+            nir_foreach_dest(instr, add_dest_indirect, &size);
+            nir_foreach_ssa_def(instr, add_name, &stats->name_bytes);
+
+            stats->instrs[instr->type].count++;
+            stats->instrs[instr->type].bytes += size;
+         }
+      }
+   }
+}
+
+void
+nir_print_memory_stats(const nir_memory_stats *stats, FILE *fp)
+{
+   uint64_t count = 0, bytes = 0;
+
+   fprintf(fp, "%-14s %10s %12s %10s\n",
+           "instruction", "count", "bytes", "bytes/instr");
+   for (unsigned i = 0; i < ARRAY_SIZE(stats->instrs); i++) {
+      if (!stats->instrs[i].count)
+         continue;
+
+      fprintf(fp, "%-14s %10" PRIu64 " %12" PRIu64 " %10.1f\n",
+              instr_type_names[i], stats->instrs[i].count,
+              stats->instrs[i].bytes,
+              (double)stats->instrs[i].bytes / stats->instrs[i].count);
+      count += stats->instrs[i].count;
+      bytes += stats->instrs[i].bytes;
+   }
+
+   fprintf(fp, "%-14s %10" PRIu64 " %12" PRIu64 " %10.1f\n",
+           "total", count, bytes, count ? (double)bytes / count : 0.0);
+   fprintf(fp, "%-14s %10s %12" PRIu64 "\n", "ssa names", "",
+           stats->name_bytes);
+}
@@ -30,11 +30,17 @@
  * Handles management of the metadata.
  */
 
+/* The metadata that only depends on the CFG. */
+#define CFG_METADATA (nir_metadata_block_index | nir_metadata_dominance)
+
 void
 nir_metadata_require(nir_function_impl *impl, nir_metadata required, ...)
 {
 #define NEEDS_UPDATE(X) ((required & ~impl->valid_metadata) & (X))
 
+   /* Only what gets computed here is known to match the current CFG. */
+   nir_metadata cfg_computed = NEEDS_UPDATE(CFG_METADATA);
+
    if (NEEDS_UPDATE(nir_metadata_block_index))
       nir_index_blocks(impl);
    if (NEEDS_UPDATE(nir_metadata_dominance))
@@ -51,12 +57,34 @@ nir_metadata_require(nir_function_impl *impl, nir_metadata required, ...)
 #undef NEEDS_UPDATE
 
    impl->valid_metadata |= required;
+   impl->cfg_metadata |= cfg_computed;
 }
 
+/**
+ * Throws away the metadata that isn't preserved.
+ *
+ * Block indices and dominance only depend on the CFG, so they are kept
+ * as long as the CFG hasn't changed since they were computed, whether the
+ * pass lists them or not.  A pass that changes the CFG and fixes them up
+ * itself can still preserve them explicitly.
+ */
 void
 nir_metadata_preserve(nir_function_impl *impl, nir_metadata preserved)
 {
-   impl->valid_metadata &= preserved;
+   impl->valid_metadata &= preserved | impl->cfg_metadata;
+   impl->cfg_metadata = impl->valid_metadata & CFG_METADATA;
+}
+
+/**
+ * Called whenever the CFG of impl changes.
+ *
+ * After this, the block indices and dominance are only kept by the next
+ * nir_metadata_preserve() if the pass explicitly preserves them.
+ */
+void
+nir_metadata_invalidate_cfg(nir_function_impl *impl)
+{
+   impl->cfg_metadata = nir_metadata_none;
 }
 
 #ifndef NDEBUG
@@ -183,7 +183,7 @@ constant_fold_block(nir_block *block, void *mem_ctx)
    return progress;
 }
 
-static bool
+bool
 nir_opt_constant_folding_impl(nir_function_impl *impl)
 {
    void *mem_ctx = ralloc_parent(impl);
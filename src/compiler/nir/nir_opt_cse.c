@@ -61,7 +61,7 @@ cse_block(nir_block *block, struct set *dominance_set)
    return progress;
 }
 
-static bool
+bool
 nir_opt_cse_impl(nir_function_impl *impl)
 {
    struct set *instr_set = nir_instr_set_create(NULL);
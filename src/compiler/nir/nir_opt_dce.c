@@ -120,7 +120,7 @@ init_block(nir_block *block, nir_instr_worklist *worklist)
    return true;
 }
 
-static bool
+bool
 nir_opt_dce_impl(nir_function_impl *impl)
 {
    nir_instr_worklist *worklist = nir_instr_worklist_create();
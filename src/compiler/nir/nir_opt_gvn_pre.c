@@ -0,0 +1,529 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "nir.h"
+#include "nir_instr_set.h"
+#include "util/u_dynarray.h"
+
+/**
+ * \file nir_opt_gvn_pre.c
+ *
+ * Partial redundancy elimination on top of the value numbering nir_opt_cse
+ * does.
+ *
+ * CSE only removes an instruction when an identical one dominates it, so
+ * it misses values that are computed on every path to a point, but not in
+ * a block that dominates it.  This pass moves instructions up to where
+ * they dominate their copies:
+ *
+ *  - An instruction in one branch of an if that the other branch also
+ *    computes, or that the block right after the if computes and the other
+ *    branch can't jump past, is computed whatever way the if goes.  It's
+ *    moved in front of the if, which doesn't add work to any path.  Only
+ *    looking at the one block after the if keeps the pass linear in the
+ *    size of the shader.
+ *
+ *  - An instruction in a loop whose sources all come from outside the loop
+ *    computes the same value on every iteration.  If it can be computed
+ *    speculatively, it's moved in front of the loop.
+ *
+ * Inner control flow is done first, so values work their way out of nested
+ * ifs and loops.  None of this changes the CFG.
+ *
+ * The copies an instruction was matched against are replaced with it as it
+ * is moved.  The others the move makes redundant, like ones nested deeper
+ * in the branches or two loop invariants that meet in front of the loop,
+ * are left for nir_opt_cse, which should run in the same loop as this.
+ */
+
+static bool
+alu_can_move(nir_alu_instr *alu)
+{
+   switch (alu->op) {
+   case nir_op_fddx:
+   case nir_op_fddy:
+   case nir_op_fddx_fine:
+   case nir_op_fddy_fine:
+   case nir_op_fddx_coarse:
+   case nir_op_fddy_coarse:
+      /* These can only go in uniform control flow */
+      return false;
+
+   default:
+      return true;
+   }
+}
+
+static bool
+src_is_ssa(nir_src *src, void *data)
+{
+   return src->is_ssa;
+}
+
+/**
+ * Returns true if the instruction can be moved to any point its sources
+ * dominate, provided it would be executed there anyway.
+ */
+static bool
+instr_can_move(nir_instr *instr)
+{
+   if (!nir_foreach_src(instr, src_is_ssa, NULL))
+      return false;
+
+   switch (instr->type) {
+   case nir_instr_type_alu: {
+      nir_alu_instr *alu = nir_instr_as_alu(instr);
+      return alu->dest.dest.is_ssa && alu_can_move(alu);
+   }
+
+   case nir_instr_type_load_const:
+      return true;
+
+   case nir_instr_type_intrinsic: {
+      nir_intrinsic_instr *intrin = nir_instr_as_intrinsic(instr);
+      const nir_intrinsic_info *info =
+         &nir_intrinsic_infos[intrin->intrinsic];
+
+      return info->has_dest && intrin->dest.is_ssa &&
+             (info->flags & NIR_INTRINSIC_CAN_ELIMINATE) &&
+             (info->flags & NIR_INTRINSIC_CAN_REORDER);
+   }
+
+   default:
+      return false;
+   }
+}
+
+/**
+ * Returns true if the instruction can also be executed where it wouldn't
+ * have been.  Intrinsics are left alone, since a load might only be valid
+ * on the paths that do it.
+ */
+static bool
+instr_can_speculate(nir_instr *instr)
+{
+   return instr->type != nir_instr_type_intrinsic && instr_can_move(instr);
+}
+
+static void
+move_instr(nir_instr *instr, nir_block *block)
+{
+   nir_instr_remove(instr);
+   nir_instr_insert(nir_after_block(block), instr);
+}
+
+/**
+ * Returns true if control can leave the CF node other than by falling
+ * through to the node after it.
+ */
+static bool
+cf_node_may_jump(nir_cf_node *node, bool in_loop)
+{
+   switch (node->type) {
+   case nir_cf_node_block: {
+      nir_instr *last = nir_block_last_instr(nir_cf_node_as_block(node));
+
+      if (!last || last->type != nir_instr_type_jump)
+         return false;
+
+      /* A break or continue in a loop inside the node stays in it. */
+      return !in_loop || nir_instr_as_jump(last)->type == nir_jump_return;
+   }
+
+   case nir_cf_node_if: {
+      nir_if *nif = nir_cf_node_as_if(node);
+
+      foreach_list_typed(nir_cf_node, child, node, &nif->then_list) {
+         if (cf_node_may_jump(child, in_loop))
+            return true;
+      }
+      foreach_list_typed(nir_cf_node, child, node, &nif->else_list) {
+         if (cf_node_may_jump(child, in_loop))
+            return true;
+      }
+      return false;
+   }
+
+   case nir_cf_node_loop: {
+      nir_loop *loop = nir_cf_node_as_loop(node);
+
+      foreach_list_typed(nir_cf_node, child, node, &loop->body) {
+         if (cf_node_may_jump(child, true))
+            return true;
+      }
+      return false;
+   }
+
+   default:
+      unreachable("Invalid CF node type");
+   }
+}
+
+static bool
+cf_list_may_jump(struct exec_list *list)
+{
+   foreach_list_typed(nir_cf_node, node, node, list) {
+      if (cf_node_may_jump(node, false))
+         return true;
+   }
+   return false;
+}
+
+/**
+ * Calls cb on the instructions that can be moved, from node to the first
+ * point where control might not get to the rest of the list.  Control flow
+ * in between is skipped rather than walked into, since what it computes on
+ * all its paths has already been moved out of it.
+ */
+static void
+foreach_movable_instr(nir_block *block,
+                      void (*cb)(nir_instr *instr, void *data), void *data)
+{
+   nir_foreach_instr_safe(instr, block) {
+      if (instr_can_move(instr))
+         cb(instr, data);
+   }
+}
+
+static void
+foreach_must_run_instr(nir_cf_node *node,
+                       void (*cb)(nir_instr *instr, void *data), void *data)
+{
+   for (; node; node = nir_cf_node_next(node)) {
+      switch (node->type) {
+      case nir_cf_node_block: {
+         nir_block *block = nir_cf_node_as_block(node);
+
+         foreach_movable_instr(block, cb, data);
+
+         if (nir_block_ends_in_jump(block))
+            return;
+         break;
+      }
+
+      case nir_cf_node_if:
+         if (cf_node_may_jump(node, false))
+            return;
+         break;
+
+      case nir_cf_node_loop:
+         /* It might not terminate. */
+         return;
+
+      default:
+         unreachable("Invalid CF node type");
+      }
+   }
+}
+
+static void
+add_to_set(nir_instr *instr, void *set)
+{
+   _mesa_set_add(set, instr);
+}
+
+static nir_ssa_def *
+instr_def(nir_instr *instr)
+{
+   switch (instr->type) {
+   case nir_instr_type_alu:
+      return &nir_instr_as_alu(instr)->dest.dest.ssa;
+   case nir_instr_type_load_const:
+      return &nir_instr_as_load_const(instr)->def;
+   case nir_instr_type_intrinsic:
+      return &nir_instr_as_intrinsic(instr)->dest.ssa;
+   default:
+      unreachable("Instruction can't be moved");
+   }
+}
+
+struct moved_user {
+   struct set *set;
+   nir_instr *instr;
+};
+
+struct hoist_state {
+   nir_block *block;
+
+   /* What the else branch and the block after the if compute. */
+   struct set *else_set;
+   struct set *after_set;
+
+   /* Where an instruction in the branch being walked also has to be for it
+    * to be moved: the other branch, and the block after the if if the other
+    * branch can't jump past it.  The then branch is walked first, so by the
+    * time the else branch is, what both compute has been moved already.
+    */
+   struct set *other;
+   struct set *after;
+
+   /* The set of the branch being walked, if any. */
+   struct set *walked;
+
+   /* Users of a copy being replaced, see replace_copy. */
+   struct util_dynarray users;
+
+   bool progress;
+};
+
+/**
+ * Replaces a copy of an instruction that was moved.
+ *
+ * The sets are keyed on the instructions' sources, so the users of the copy
+ * are taken out of them while their sources change, and put back after.
+ * That way a chain of instructions is moved in one walk.
+ */
+static void
+replace_copy(struct hoist_state *state, struct set *set,
+             struct set_entry *entry, nir_instr *instr)
+{
+   struct set *sets[] = { state->else_set, state->after_set };
+   nir_instr *copy = (nir_instr *)entry->key;
+   nir_ssa_def *def = instr_def(copy);
+
+   _mesa_set_remove(set, entry);
+
+   util_dynarray_clear(&state->users);
+   nir_foreach_use(use, def) {
+      if (!instr_can_move(use->parent_instr))
+         continue;
+
+      for (unsigned i = 0; i < ARRAY_SIZE(sets); i++) {
+         struct set_entry *e = _mesa_set_search(sets[i], use->parent_instr);
+         if (e && e->key == use->parent_instr) {
+            _mesa_set_remove(sets[i], e);
+            util_dynarray_append(&state->users, struct moved_user,
+                                 ((struct moved_user) {
+                                    .set = sets[i],
+                                    .instr = use->parent_instr,
+                                 }));
+            break;
+         }
+      }
+   }
+
+   /* See nir_instr_set_add_or_rewrite. */
+   if (copy->type == nir_instr_type_alu && nir_instr_as_alu(copy)->exact)
+      nir_instr_as_alu(instr)->exact = true;
+
+   nir_ssa_def_rewrite_uses(def, nir_src_for_ssa(instr_def(instr)));
+   nir_instr_remove(copy);
+
+   util_dynarray_foreach(&state->users, struct moved_user, user)
+      _mesa_set_add(user->set, user->instr);
+}
+
+static bool
+src_dominates_block(nir_src *src, void *block)
+{
+   return nir_block_dominates(src->ssa->parent_instr->block, block);
+}
+
+static void
+hoist_branch_instr(nir_instr *instr, void *data)
+{
+   struct hoist_state *state = data;
+   struct set *sets[] = { state->else_set, state->after_set };
+
+   if (!(state->other && _mesa_set_search(state->other, instr)) &&
+       !(state->after && _mesa_set_search(state->after, instr)))
+      return;
+
+   if (!nir_foreach_src(instr, src_dominates_block, state->block))
+      return;
+
+   for (unsigned i = 0; i < ARRAY_SIZE(sets); i++) {
+      struct set_entry *entry = _mesa_set_search(sets[i], instr);
+
+      if (!entry)
+         continue;
+
+      /* Copies in the branch being walked are left to CSE, since removing
+       * them would get in the way of the walk.
+       */
+      if (entry->key == instr)
+         _mesa_set_remove(sets[i], entry);
+      else if (sets[i] != state->walked)
+         replace_copy(state, sets[i], entry, instr);
+   }
+
+   move_instr(instr, state->block);
+   state->progress = true;
+}
+
+static nir_cf_node *
+cf_list_head(struct exec_list *list)
+{
+   return exec_node_data(nir_cf_node, exec_list_get_head(list), node);
+}
+
+/** Moves what is computed on all paths through the if in front of it. */
+static bool
+hoist_if(nir_if *nif, struct hoist_state *state)
+{
+   nir_cf_node *then_node = cf_list_head(&nif->then_list);
+   nir_cf_node *else_node = cf_list_head(&nif->else_list);
+   nir_block *after_block =
+      nir_cf_node_as_block(nir_cf_node_next(&nif->cf_node));
+   bool then_may_jump = cf_list_may_jump(&nif->then_list);
+   bool else_may_jump = cf_list_may_jump(&nif->else_list);
+
+   state->block = nir_cf_node_as_block(nir_cf_node_prev(&nif->cf_node));
+   state->progress = false;
+
+   _mesa_set_clear(state->else_set, NULL);
+   _mesa_set_clear(state->after_set, NULL);
+   foreach_must_run_instr(else_node, add_to_set, state->else_set);
+   if (!then_may_jump || !else_may_jump)
+      foreach_movable_instr(after_block, add_to_set, state->after_set);
+
+   state->other = state->else_set;
+   state->after = else_may_jump ? NULL : state->after_set;
+   state->walked = NULL;
+   if (state->other->entries || state->after)
+      foreach_must_run_instr(then_node, hoist_branch_instr, state);
+
+   state->other = NULL;
+   state->after = then_may_jump ? NULL : state->after_set;
+   state->walked = state->else_set;
+   if (state->after)
+      foreach_must_run_instr(else_node, hoist_branch_instr, state);
+
+   return state->progress;
+}
+
+struct loop_range {
+   unsigned first, last;
+};
+
+static bool
+src_is_outside_loop(nir_src *src, void *data)
+{
+   const struct loop_range *range = data;
+   unsigned index = src->ssa->parent_instr->block->index;
+
+   return index < range->first || index > range->last;
+}
+
+/** Moves what is the same on every iteration in front of the loop. */
+static bool
+hoist_loop_invariants(nir_loop *loop)
+{
+   nir_block *preheader =
+      nir_cf_node_as_block(nir_cf_node_prev(&loop->cf_node));
+   const struct loop_range range = {
+      .first = nir_loop_first_block(loop)->index,
+      .last = nir_loop_last_block(loop)->index,
+   };
+   bool progress = false;
+
+   nir_foreach_block_in_cf_node(block, &loop->cf_node) {
+      nir_foreach_instr_safe(instr, block) {
+         if (!instr_can_speculate(instr) ||
+             !nir_foreach_src(instr, src_is_outside_loop, (void *)&range))
+            continue;
+
+         move_instr(instr, preheader);
+         progress = true;
+      }
+   }
+
+   return progress;
+}
+
+static bool
+gvn_pre_cf_list(struct exec_list *list, struct hoist_state *state)
+{
+   bool progress = false;
+
+   foreach_list_typed(nir_cf_node, node, node, list) {
+      switch (node->type) {
+      case nir_cf_node_block:
+         break;
+
+      case nir_cf_node_if: {
+         nir_if *nif = nir_cf_node_as_if(node);
+         progress |= gvn_pre_cf_list(&nif->then_list, state);
+         progress |= gvn_pre_cf_list(&nif->else_list, state);
+         progress |= hoist_if(nif, state);
+         break;
+      }
+
+      case nir_cf_node_loop: {
+         nir_loop *loop = nir_cf_node_as_loop(node);
+         progress |= gvn_pre_cf_list(&loop->body, state);
+         progress |= hoist_loop_invariants(loop);
+         break;
+      }
+
+      default:
+         unreachable("Invalid CF node type");
+      }
+   }
+
+   return progress;
+}
+
+static bool
+nir_opt_gvn_pre_impl(nir_function_impl *impl)
+{
+   nir_metadata_require(impl, nir_metadata_block_index |
+                              nir_metadata_dominance);
+
+   /* The sets are shared by all the ifs, so they only grow once. */
+   struct hoist_state state = {
+      .else_set = nir_instr_set_create(NULL),
+      .after_set = nir_instr_set_create(NULL),
+   };
+   util_dynarray_init(&state.users, NULL);
+
+   bool progress = gvn_pre_cf_list(&impl->body, &state);
+
+   nir_instr_set_destroy(state.else_set);
+   nir_instr_set_destroy(state.after_set);
+   util_dynarray_fini(&state.users);
+
+   if (progress) {
+      nir_metadata_preserve(impl, nir_metadata_block_index |
+                                  nir_metadata_dominance);
+   } else {
+#ifndef NDEBUG
+      impl->valid_metadata &= ~nir_metadata_not_properly_reset;
+#endif
+   }
+
+   return progress;
+}
+
+bool
+nir_opt_gvn_pre(nir_shader *shader)
+{
+   bool progress = false;
+
+   nir_foreach_function(function, shader) {
+      if (function->impl)
+         progress |= nir_opt_gvn_pre_impl(function->impl);
+   }
+
+   return progress;
+}
@@ -0,0 +1,699 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "nir.h"
+#include "nir_builder.h"
+#include "util/u_dynarray.h"
+#include "util/u_math.h"
+
+/**
+ * \file nir_opt_load_store_vectorize.c
+ *
+ * Combines UBO, SSBO, shared and global memory loads and stores in a block
+ * that access neighbouring bytes into a single vector access.  This undoes
+ * what nir_lower_io_to_scalar and nir_lower_alu_to_scalar leave behind for
+ * scalar backends, which would otherwise issue a message per component.
+ *
+ * The address of each access is split into a buffer index, a base SSA
+ * value and a constant byte offset, by looking through iadds with
+ * constants.  Two accesses with the same index and base are compared the
+ * way nir_compare_derefs() compares deref paths: their byte ranges tell if
+ * they are the same, disjoint or overlapping.  Accesses with different
+ * bases may alias, unless they are to different kinds of memory.
+ *
+ * A later load is combined into an earlier one, which moves it up past the
+ * instructions in between, so no store there may alias it.  An earlier
+ * store is combined into a later one, which moves it down, so nothing in
+ * between may read or write what it writes.  Any other intrinsic that can't
+ * be reordered, and volatile accesses, end the search.
+ */
+
+struct intrinsic_info {
+   nir_intrinsic_op op;
+   nir_variable_mode mode;
+   bool is_store;
+   int index_src;
+   int offset_src;
+};
+
+static const struct intrinsic_info intrinsic_infos[] = {
+   { nir_intrinsic_load_ubo,     nir_var_mem_ubo,    false, 0,  1 },
+   { nir_intrinsic_load_ssbo,    nir_var_mem_ssbo,   false, 0,  1 },
+   { nir_intrinsic_store_ssbo,   nir_var_mem_ssbo,   true,  1,  2 },
+   { nir_intrinsic_load_shared,  nir_var_mem_shared, false, -1, 0 },
+   { nir_intrinsic_store_shared, nir_var_mem_shared, true,  -1, 1 },
+   { nir_intrinsic_load_global,  nir_var_mem_global, false, -1, 0 },
+   { nir_intrinsic_store_global, nir_var_mem_global, true,  -1, 1 },
+};
+
+/* Plenty for any vector, and it keeps align_offset small. */
+#define MAX_ALIGN 4096
+
+struct entry {
+   nir_intrinsic_instr *intrin;
+   const struct intrinsic_info *info;
+
+   /* The address is index, base + offset.  Either may be NULL. */
+   nir_ssa_def *index;
+   nir_ssa_def *base;
+   int64_t offset;
+
+   unsigned align_mul;
+   unsigned align_offset;
+
+   /* Where the access is in the block, counting only the entries. */
+   unsigned position;
+};
+
+struct vectorize_state {
+   nir_variable_mode modes;
+   nir_should_vectorize_mem_func callback;
+
+   /* The entries since the last instruction that ended the search. */
+   struct util_dynarray entries;
+   unsigned position;
+};
+
+static const struct intrinsic_info *
+get_info(nir_intrinsic_op op)
+{
+   for (unsigned i = 0; i < ARRAY_SIZE(intrinsic_infos); i++) {
+      if (intrinsic_infos[i].op == op)
+         return &intrinsic_infos[i];
+   }
+
+   return NULL;
+}
+
+/**
+ * Returns true if the intrinsic may touch the memory of the accesses, or
+ * otherwise keeps them from moving past it.
+ */
+static bool
+intrinsic_ends_search(nir_intrinsic_instr *intrin)
+{
+   const nir_variable_mode memory_modes =
+      nir_var_mem_ssbo | nir_var_mem_shared | nir_var_mem_global;
+
+   switch (intrin->intrinsic) {
+   case nir_intrinsic_load_deref:
+   case nir_intrinsic_store_deref:
+      return nir_src_as_deref(intrin->src[0])->mode & memory_modes;
+
+   case nir_intrinsic_copy_deref:
+      return (nir_src_as_deref(intrin->src[0])->mode |
+              nir_src_as_deref(intrin->src[1])->mode) & memory_modes;
+
+   case nir_intrinsic_store_output:
+   case nir_intrinsic_store_per_vertex_output:
+      return false;
+
+   default:
+      return !(nir_intrinsic_infos[intrin->intrinsic].flags &
+               NIR_INTRINSIC_CAN_REORDER);
+   }
+}
+
+static unsigned
+get_access(nir_intrinsic_instr *intrin)
+{
+   if (!nir_intrinsic_infos[intrin->intrinsic].index_map[NIR_INTRINSIC_ACCESS])
+      return 0;
+
+   return nir_intrinsic_access(intrin);
+}
+
+static unsigned
+lowest_bit(uint64_t x)
+{
+   return x ? MIN2(x & -x, MAX_ALIGN) : MAX_ALIGN;
+}
+
+/**
+ * Returns a power of two that the value is known to be a multiple of.
+ */
+static unsigned
+get_def_align(nir_ssa_def *def)
+{
+   if (def->num_components != 1)
+      return 1;
+
+   if (def->parent_instr->type == nir_instr_type_load_const)
+      return lowest_bit(nir_src_comp_as_uint(nir_src_for_ssa(def), 0));
+
+   if (def->parent_instr->type != nir_instr_type_alu)
+      return 1;
+
+   nir_alu_instr *alu = nir_instr_as_alu(def->parent_instr);
+   for (unsigned i = 0; i < nir_op_infos[alu->op].num_inputs; i++) {
+      if (!alu->src[i].src.is_ssa || alu->src[i].swizzle[0] != 0)
+         return 1;
+   }
+
+   switch (alu->op) {
+   case nir_op_iadd:
+      return MIN2(get_def_align(alu->src[0].src.ssa),
+                  get_def_align(alu->src[1].src.ssa));
+
+   case nir_op_imul:
+      return MIN2(get_def_align(alu->src[0].src.ssa) *
+                  get_def_align(alu->src[1].src.ssa), MAX_ALIGN);
+
+   case nir_op_ishl:
+      if (!nir_src_is_const(alu->src[1].src))
+         return 1;
+      return MIN2((uint64_t)get_def_align(alu->src[0].src.ssa) <<
+                  MIN2(nir_src_as_uint(alu->src[1].src), 31), MAX_ALIGN);
+
+   default:
+      return 1;
+   }
+}
+
+static void
+parse_offset(nir_src *src, nir_ssa_def **base, int64_t *offset)
+{
+   nir_ssa_def *def = src->ssa;
+
+   *offset = 0;
+
+   while (def->num_components == 1) {
+      if (def->parent_instr->type == nir_instr_type_load_const) {
+         *offset += nir_src_comp_as_int(nir_src_for_ssa(def), 0);
+         *base = NULL;
+         return;
+      }
+
+      if (def->parent_instr->type != nir_instr_type_alu)
+         break;
+
+      nir_alu_instr *alu = nir_instr_as_alu(def->parent_instr);
+      if (alu->op != nir_op_iadd || !alu->src[0].src.is_ssa ||
+          !alu->src[1].src.is_ssa)
+         break;
+
+      unsigned c;
+      if (nir_src_is_const(alu->src[1].src))
+         c = 1;
+      else if (nir_src_is_const(alu->src[0].src))
+         c = 0;
+      else
+         break;
+
+      nir_alu_src *other = &alu->src[!c];
+      if (other->swizzle[0] != 0 || other->src.ssa->num_components != 1)
+         break;
+
+      *offset += nir_src_comp_as_int(alu->src[c].src, alu->src[c].swizzle[0]);
+      def = other->src.ssa;
+   }
+
+   *base = def;
+}
+
+static bool
+create_entry(struct entry *entry, nir_intrinsic_instr *intrin,
+             const struct intrinsic_info *info)
+{
+   if (get_access(intrin) & ACCESS_VOLATILE)
+      return false;
+
+   if (info->index_src >= 0) {
+      if (!intrin->src[info->index_src].is_ssa)
+         return false;
+      entry->index = intrin->src[info->index_src].ssa;
+   } else {
+      entry->index = NULL;
+   }
+
+   nir_src *offset_src = &intrin->src[info->offset_src];
+   if (!offset_src->is_ssa || (info->is_store && !intrin->src[0].is_ssa))
+      return false;
+
+   entry->intrin = intrin;
+   entry->info = info;
+   parse_offset(offset_src, &entry->base, &entry->offset);
+
+   if (nir_intrinsic_infos[intrin->intrinsic].index_map[NIR_INTRINSIC_BASE])
+      entry->offset += nir_intrinsic_base(intrin);
+
+   /* Use whichever of what the intrinsic says and what the address says
+    * is stronger.
+    */
+   entry->align_mul = nir_intrinsic_align_mul(intrin);
+   entry->align_offset = nir_intrinsic_align_offset(intrin);
+
+   unsigned base_align = entry->base ? get_def_align(entry->base) : MAX_ALIGN;
+   if (base_align > entry->align_mul) {
+      entry->align_mul = base_align;
+      entry->align_offset = entry->offset & (base_align - 1);
+   }
+
+   return true;
+}
+
+static unsigned
+entry_comp_size(struct entry *entry)
+{
+   nir_intrinsic_instr *intrin = entry->intrin;
+   unsigned bit_size = entry->info->is_store ? intrin->src[0].ssa->bit_size :
+                                               intrin->dest.ssa.bit_size;
+   return bit_size / 8;
+}
+
+/* The number of components the access covers, with holes in the write
+ * mask of a store.
+ */
+static unsigned
+entry_num_components(struct entry *entry)
+{
+   if (entry->info->is_store)
+      return util_last_bit(nir_intrinsic_write_mask(entry->intrin));
+
+   return entry->intrin->num_components;
+}
+
+static int64_t
+entry_end(struct entry *entry)
+{
+   return entry->offset + entry_num_components(entry) * entry_comp_size(entry);
+}
+
+/* Buffer indices are usually constants, which CSE may not have merged. */
+static bool
+same_index(nir_ssa_def *a, nir_ssa_def *b)
+{
+   if (a == b)
+      return true;
+
+   if (!a || !b || a->num_components != 1 || b->num_components != 1 ||
+       a->bit_size != b->bit_size)
+      return false;
+
+   nir_src a_src = nir_src_for_ssa(a), b_src = nir_src_for_ssa(b);
+   return nir_src_is_const(a_src) && nir_src_is_const(b_src) &&
+          nir_src_as_uint(a_src) == nir_src_as_uint(b_src);
+}
+
+static bool
+modes_may_alias(nir_variable_mode a, nir_variable_mode b)
+{
+   /* UBOs don't change while the shader runs. */
+   if (a == nir_var_mem_ubo || b == nir_var_mem_ubo)
+      return false;
+
+   /* An SSBO may be reached through a global address. */
+   if ((a | b) == (nir_var_mem_ssbo | nir_var_mem_global))
+      return true;
+
+   return a == b;
+}
+
+static bool
+entries_may_alias(struct entry *a, struct entry *b)
+{
+   if (!modes_may_alias(a->info->mode, b->info->mode))
+      return false;
+
+   if (a->info->mode != b->info->mode || !same_index(a->index, b->index) ||
+       a->base != b->base)
+      return true;
+
+   return a->offset < entry_end(b) && b->offset < entry_end(a);
+}
+
+/**
+ * Returns true if something between the two entries may access the memory
+ * of moved in a way that moving it past them would change.
+ */
+static bool
+may_conflict(struct vectorize_state *state, struct entry *first,
+             struct entry *second, struct entry *moved)
+{
+   util_dynarray_foreach(&state->entries, struct entry, entry) {
+      if (entry->position <= first->position ||
+          entry->position >= second->position)
+         continue;
+
+      if ((entry->info->is_store || moved->info->is_store) &&
+          entries_may_alias(entry, moved))
+         return true;
+   }
+
+   return false;
+}
+
+static bool
+default_should_vectorize(unsigned align, unsigned bit_size,
+                         unsigned num_components)
+{
+   unsigned size = num_components * bit_size / 8;
+   return align >= MIN2(util_next_power_of_two(size), 16);
+}
+
+static unsigned
+entry_align(struct entry *entry)
+{
+   return entry->align_offset ?
+          1 << (ffs(entry->align_offset) - 1) : entry->align_mul;
+}
+
+static bool
+can_combine(struct vectorize_state *state, struct entry *first,
+            struct entry *second)
+{
+   if (first->info != second->info ||
+       !same_index(first->index, second->index) ||
+       first->base != second->base ||
+       get_access(first->intrin) != get_access(second->intrin))
+      return false;
+
+   unsigned comp_size = entry_comp_size(first);
+   if (comp_size != entry_comp_size(second) ||
+       (second->offset - first->offset) % comp_size != 0)
+      return false;
+
+   struct entry *low = first->offset <= second->offset ? first : second;
+   struct entry *high = low == first ? second : first;
+   int64_t end = MAX2(entry_end(first), entry_end(second));
+
+   /* Loads can't read what nobody asked for, but stores have write masks. */
+   if (!first->info->is_store && high->offset > entry_end(low))
+      return false;
+
+   if ((end - low->offset) / comp_size > NIR_MAX_VEC_COMPONENTS)
+      return false;
+
+   unsigned num_components = (end - low->offset) / comp_size;
+   unsigned align = entry_align(low);
+   if (state->callback) {
+      if (!state->callback(align, comp_size * 8, num_components,
+                           low->intrin, high->intrin))
+         return false;
+   } else if (!default_should_vectorize(align, comp_size * 8,
+                                        num_components)) {
+      return false;
+   }
+
+   /* Loads go up to the first one and stores down to the second one. */
+   if (first->info->is_store)
+      return !may_conflict(state, first, second, first);
+   else
+      return !may_conflict(state, first, second, second);
+}
+
+static nir_ssa_def *
+offset_from(nir_builder *b, struct entry *entry, int64_t offset)
+{
+   nir_ssa_def *def = entry->intrin->src[entry->info->offset_src].ssa;
+
+   if (offset == entry->offset)
+      return def;
+
+   return nir_iadd_imm(b, def, offset - entry->offset);
+}
+
+static nir_intrinsic_instr *
+create_like(nir_builder *b, struct entry *entry, struct entry *low,
+            unsigned num_components)
+{
+   nir_intrinsic_instr *intrin = entry->intrin;
+   nir_intrinsic_instr *new_intrin =
+      nir_intrinsic_instr_create(b->shader, intrin->intrinsic);
+
+   new_intrin->num_components = num_components;
+   memcpy(new_intrin->const_index, intrin->const_index,
+          sizeof(intrin->const_index));
+   nir_intrinsic_set_align(new_intrin, low->align_mul, low->align_offset);
+
+   if (entry->info->index_src >= 0) {
+      new_intrin->src[entry->info->index_src] =
+         nir_src_for_ssa(entry->index);
+   }
+   new_intrin->src[entry->info->offset_src] =
+      nir_src_for_ssa(offset_from(b, entry, low->offset));
+
+   return new_intrin;
+}
+
+static void
+combine_loads(nir_builder *b, struct entry *first, struct entry *second)
+{
+   struct entry *low = first->offset <= second->offset ? first : second;
+   unsigned comp_size = entry_comp_size(first);
+   unsigned bit_size = comp_size * 8;
+   int64_t end = MAX2(entry_end(first), entry_end(second));
+   unsigned num_components = (end - low->offset) / comp_size;
+
+   b->cursor = nir_before_instr(&first->intrin->instr);
+
+   nir_intrinsic_instr *load = create_like(b, first, low, num_components);
+   nir_ssa_dest_init(&load->instr, &load->dest, num_components, bit_size,
+                     NULL);
+   nir_builder_instr_insert(b, &load->instr);
+
+   struct entry *entries[2] = { first, second };
+   for (unsigned i = 0; i < 2; i++) {
+      nir_intrinsic_instr *old = entries[i]->intrin;
+      unsigned shift = (entries[i]->offset - low->offset) / comp_size;
+      nir_component_mask_t mask =
+         BITFIELD_MASK(old->num_components) << shift;
+
+      nir_ssa_def_rewrite_uses(&old->dest.ssa,
+                               nir_src_for_ssa(nir_channels(b, &load->dest.ssa,
+                                                            mask)));
+      nir_instr_remove(&old->instr);
+   }
+
+   first->intrin = load;
+   first->offset = low->offset;
+   first->align_mul = low->align_mul;
+   first->align_offset = low->align_offset;
+}
+
+/* Looks through the vecs that stores are usually fed with, so combining
+ * stores again doesn't pile up movs.
+ */
+static nir_ssa_def *
+get_channel(nir_builder *b, nir_ssa_def *def, unsigned c)
+{
+   if (def->parent_instr->type == nir_instr_type_alu) {
+      nir_alu_instr *alu = nir_instr_as_alu(def->parent_instr);
+
+      if ((alu->op == nir_op_vec2 || alu->op == nir_op_vec3 ||
+           alu->op == nir_op_vec4) &&
+          !alu->dest.saturate && alu->src[c].src.is_ssa &&
+          !alu->src[c].abs && !alu->src[c].negate)
+         return nir_channel(b, alu->src[c].src.ssa, alu->src[c].swizzle[0]);
+   }
+
+   return nir_channel(b, def, c);
+}
+
+static void
+combine_stores(nir_builder *b, struct entry *first, struct entry *second)
+{
+   struct entry *low = first->offset <= second->offset ? first : second;
+   unsigned comp_size = entry_comp_size(first);
+   unsigned bit_size = comp_size * 8;
+   int64_t end = MAX2(entry_end(first), entry_end(second));
+   unsigned num_components = (end - low->offset) / comp_size;
+
+   b->cursor = nir_before_instr(&second->intrin->instr);
+
+   /* The second store wins where they overlap. */
+   nir_ssa_def *comps[NIR_MAX_VEC_COMPONENTS] = { NULL };
+   nir_component_mask_t write_mask = 0;
+   struct entry *entries[2] = { second, first };
+   for (unsigned i = 0; i < 2; i++) {
+      nir_intrinsic_instr *old = entries[i]->intrin;
+      unsigned shift = (entries[i]->offset - low->offset) / comp_size;
+      nir_component_mask_t old_mask = nir_intrinsic_write_mask(old);
+
+      for (unsigned c = 0; c < old->num_components; c++) {
+         if (!(old_mask & (1 << c)) || comps[c + shift])
+            continue;
+
+         comps[c + shift] = get_channel(b, old->src[0].ssa, c);
+         write_mask |= 1 << (c + shift);
+      }
+   }
+
+   nir_ssa_def *undef = NULL;
+   for (unsigned c = 0; c < num_components; c++) {
+      if (!comps[c]) {
+         if (!undef)
+            undef = nir_ssa_undef(b, 1, bit_size);
+         comps[c] = undef;
+      }
+   }
+
+   nir_intrinsic_instr *store = create_like(b, second, low, num_components);
+   store->src[0] = nir_src_for_ssa(nir_vec(b, comps, num_components));
+   nir_intrinsic_set_write_mask(store, write_mask);
+   nir_builder_instr_insert(b, &store->instr);
+
+   nir_instr_remove(&first->intrin->instr);
+   nir_instr_remove(&second->intrin->instr);
+
+   second->intrin = store;
+   second->offset = low->offset;
+   second->align_mul = low->align_mul;
+   second->align_offset = low->align_offset;
+}
+
+static void
+remove_entry(struct vectorize_state *state, struct entry *entry)
+{
+   struct entry *end = util_dynarray_end(&state->entries);
+   memmove(entry, entry + 1, (char *)end - (char *)(entry + 1));
+   state->entries.size -= sizeof(struct entry);
+}
+
+/**
+ * Tries to combine the newest entry with older ones.  A combined store can
+ * combine again with an older store, but a combined load takes the place of
+ * the older load and waits for later ones.
+ */
+static bool
+vectorize_entry(struct vectorize_state *state, nir_builder *b)
+{
+   bool progress = false;
+   struct entry *second = util_dynarray_top_ptr(&state->entries,
+                                                struct entry);
+
+   if (!(second->info->mode & state->modes))
+      return false;
+
+   for (struct entry *first = second - 1;
+        first >= (struct entry *)state->entries.data; first--) {
+      if (!can_combine(state, first, second))
+         continue;
+
+      progress = true;
+
+      if (!second->info->is_store) {
+         combine_loads(b, first, second);
+         remove_entry(state, second);
+         break;
+      }
+
+      combine_stores(b, first, second);
+      remove_entry(state, first);
+      second--;
+   }
+
+   return progress;
+}
+
+static bool
+vectorize_block(struct vectorize_state *state, nir_builder *b,
+                nir_block *block)
+{
+   bool progress = false;
+
+   util_dynarray_clear(&state->entries);
+
+   nir_foreach_instr_safe(instr, block) {
+      if (instr->type == nir_instr_type_call) {
+         util_dynarray_clear(&state->entries);
+         continue;
+      }
+
+      if (instr->type != nir_instr_type_intrinsic)
+         continue;
+
+      nir_intrinsic_instr *intrin = nir_instr_as_intrinsic(instr);
+      const struct intrinsic_info *info = get_info(intrin->intrinsic);
+      struct entry entry;
+
+      if (!info || !create_entry(&entry, intrin, info)) {
+         if (intrinsic_ends_search(intrin))
+            util_dynarray_clear(&state->entries);
+         continue;
+      }
+
+      entry.position = state->position++;
+      util_dynarray_append(&state->entries, struct entry, entry);
+
+      progress |= vectorize_entry(state, b);
+   }
+
+   return progress;
+}
+
+static bool
+nir_opt_load_store_vectorize_impl(nir_function_impl *impl,
+                                  nir_variable_mode modes,
+                                  nir_should_vectorize_mem_func callback)
+{
+   bool progress = false;
+   nir_builder b;
+
+   nir_builder_init(&b, impl);
+
+   struct vectorize_state state = {
+      .modes = modes,
+      .callback = callback,
+   };
+   util_dynarray_init(&state.entries, NULL);
+
+   nir_foreach_block(block, impl)
+      progress |= vectorize_block(&state, &b, block);
+
+   util_dynarray_fini(&state.entries);
+
+   if (progress) {
+      nir_metadata_preserve(impl, nir_metadata_block_index |
+                                  nir_metadata_dominance);
+   } else {
+#ifndef NDEBUG
+      impl->valid_metadata &= ~nir_metadata_not_properly_reset;
+#endif
+   }
+
+   return progress;
+}
+
+/**
+ * Combines the loads and stores of the given modes in each block into
+ * vectors.  The callback says if an access of num_components components of
+ * bit_size bits, whose first byte is a multiple of align, is fine for the
+ * backend.  Without one, accesses have to be aligned to their size, or to
+ * 16 bytes if they are bigger.
+ */
+bool
+nir_opt_load_store_vectorize(nir_shader *shader, nir_variable_mode modes,
+                             nir_should_vectorize_mem_func callback)
+{
+   bool progress = false;
+
+   nir_foreach_function(function, shader) {
+      if (function->impl) {
+         progress |= nir_opt_load_store_vectorize_impl(function->impl, modes,
+                                                       callback);
+      }
+   }
+
+   return progress;
+}
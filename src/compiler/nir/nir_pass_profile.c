@@ -0,0 +1,332 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * Per-pass statistics for NIR_PASS and NIR_PASS_V.
+ *
+ * When NIR_PASS_PROFILE is set to a file name, every pass run through those
+ * macros records its wall time, the number of instructions in the shader
+ * before and after it, and whether it made progress.  The numbers are kept
+ * per shader and pass name for the whole process, and written to the file
+ * as JSON when the process exits, together with their sums per pass name and
+ * shader stage.
+ */
+
+#include <inttypes.h>
+#include <stdlib.h>
+
+#include "nir.h"
+#include "c11/threads.h"
+#include "util/os_time.h"
+#include "util/u_dynarray.h"
+
+struct pass_stats {
+   const char *name;
+   uint64_t calls;
+   /* Calls through NIR_PASS, which is the only one that knows progress. */
+   uint64_t progress_known;
+   uint64_t progress;
+   uint64_t time;
+   uint64_t instrs_before;
+   uint64_t instrs_after;
+};
+
+struct shader_stats {
+   gl_shader_stage stage;
+   const char *name;
+   const char *label;
+   /* struct pass_stats, in the order the passes first ran */
+   struct util_dynarray passes;
+};
+
+static once_flag profile_once_flag = ONCE_FLAG_INIT;
+static mtx_t profile_mutex = _MTX_INITIALIZER_NP;
+static const char *profile_path;
+static void *profile_mem_ctx;
+/* struct shader_stats *, indexed by nir_shader::profile_id - 1 */
+static struct util_dynarray profile_shaders;
+
+static void
+write_string(FILE *fp, const char *str)
+{
+   if (!str) {
+      fprintf(fp, "null");
+      return;
+   }
+
+   fputc('"', fp);
+   for (; *str; str++) {
+      if (*str == '"' || *str == '\\')
+         fprintf(fp, "\\%c", *str);
+      else if ((unsigned char)*str < 0x20)
+         fprintf(fp, "\\u%04x", *str);
+      else
+         fputc(*str, fp);
+   }
+   fputc('"', fp);
+}
+
+static void
+write_pass_stats(FILE *fp, const struct pass_stats *s)
+{
+   fprintf(fp, "\"calls\": %" PRIu64 ", ", s->calls);
+   if (s->progress_known)
+      fprintf(fp, "\"progress\": %" PRIu64 ", ", s->progress);
+   else
+      fprintf(fp, "\"progress\": null, ");
+   fprintf(fp, "\"time_ns\": %" PRIu64 ", "
+           "\"instrs_before\": %" PRIu64 ", "
+           "\"instrs_after\": %" PRIu64 "}",
+           s->time, s->instrs_before, s->instrs_after);
+}
+
+static void
+add_pass_stats(struct pass_stats *dst, const struct pass_stats *src)
+{
+   dst->calls += src->calls;
+   dst->progress_known += src->progress_known;
+   dst->progress += src->progress;
+   dst->time += src->time;
+   dst->instrs_before += src->instrs_before;
+   dst->instrs_after += src->instrs_after;
+}
+
+static int
+compare_pass_time(const void *a, const void *b)
+{
+   const struct pass_stats *pa = a;
+   const struct pass_stats *pb = b;
+
+   if (pa->time != pb->time)
+      return pa->time < pb->time ? 1 : -1;
+   return strcmp(pa->name, pb->name);
+}
+
+/**
+ * Writes the statistics gathered so far as JSON.
+ *
+ * "passes" sums them per pass name and shader stage over all the shaders,
+ * slowest first, which is what anyone reading it wants.  "shaders" lists
+ * the passes that ran on each shader, in the order they first ran.
+ */
+void
+nir_pass_profile_write(FILE *fp)
+{
+   mtx_lock(&profile_mutex);
+
+   void *mem_ctx = ralloc_context(NULL);
+   struct util_dynarray totals[MESA_ALL_SHADER_STAGES];
+   struct hash_table *indices[MESA_ALL_SHADER_STAGES];
+
+   for (unsigned stage = 0; stage < MESA_ALL_SHADER_STAGES; stage++) {
+      util_dynarray_init(&totals[stage], mem_ctx);
+      indices[stage] = _mesa_hash_table_create(mem_ctx, _mesa_key_hash_string,
+                                               _mesa_key_string_equal);
+   }
+
+   util_dynarray_foreach(&profile_shaders, struct shader_stats *, shader) {
+      struct util_dynarray *stage_totals = &totals[(*shader)->stage];
+      struct hash_table *stage_indices = indices[(*shader)->stage];
+
+      util_dynarray_foreach(&(*shader)->passes, struct pass_stats, s) {
+         struct hash_entry *entry =
+            _mesa_hash_table_search(stage_indices, s->name);
+         struct pass_stats *total;
+
+         if (entry) {
+            total = util_dynarray_element(stage_totals, struct pass_stats,
+                                          (uintptr_t)entry->data);
+         } else {
+            unsigned index = util_dynarray_num_elements(stage_totals,
+                                                        struct pass_stats);
+            _mesa_hash_table_insert(stage_indices, s->name,
+                                    (void *)(uintptr_t)index);
+            total = util_dynarray_grow(stage_totals, sizeof(*total));
+            memset(total, 0, sizeof(*total));
+            total->name = s->name;
+         }
+         add_pass_stats(total, s);
+      }
+   }
+
+   fprintf(fp, "{\n  \"passes\": [");
+   bool first = true;
+   for (unsigned stage = 0; stage < MESA_ALL_SHADER_STAGES; stage++) {
+      qsort(totals[stage].data,
+            util_dynarray_num_elements(&totals[stage], struct pass_stats),
+            sizeof(struct pass_stats), compare_pass_time);
+
+      util_dynarray_foreach(&totals[stage], struct pass_stats, s) {
+         fprintf(fp, "%s\n    {\"pass\": \"%s\", \"stage\": \"%s\", ",
+                 first ? "" : ",", s->name,
+                 _mesa_shader_stage_to_string(stage));
+         write_pass_stats(fp, s);
+         first = false;
+      }
+   }
+
+   fprintf(fp, "\n  ],\n  \"shaders\": [");
+   first = true;
+   unsigned id = 1;
+   util_dynarray_foreach(&profile_shaders, struct shader_stats *, shader) {
+      fprintf(fp, "%s\n    {\"id\": %u, \"stage\": \"%s\", \"name\": ",
+              first ? "" : ",", id++,
+              _mesa_shader_stage_to_string((*shader)->stage));
+      write_string(fp, (*shader)->name);
+      fprintf(fp, ", \"label\": ");
+      write_string(fp, (*shader)->label);
+      fprintf(fp, ", \"passes\": [");
+
+      bool first_pass = true;
+      util_dynarray_foreach(&(*shader)->passes, struct pass_stats, s) {
+         fprintf(fp, "%s\n      {\"pass\": \"%s\", ",
+                 first_pass ? "" : ",", s->name);
+         write_pass_stats(fp, s);
+         first_pass = false;
+      }
+      fprintf(fp, "\n    ]}");
+      first = false;
+   }
+   fprintf(fp, "\n  ]\n}\n");
+
+   ralloc_free(mem_ctx);
+
+   mtx_unlock(&profile_mutex);
+}
+
+static void
+write_profile(void)
+{
+   FILE *fp = fopen(profile_path, "w");
+
+   if (!fp) {
+      fprintf(stderr, "NIR_PASS_PROFILE: failed to open %s\n", profile_path);
+      return;
+   }
+
+   nir_pass_profile_write(fp);
+   fclose(fp);
+}
+
+static void
+profile_init(void)
+{
+   profile_path = getenv("NIR_PASS_PROFILE");
+   if (!profile_path)
+      return;
+
+   profile_mem_ctx = ralloc_context(NULL);
+   util_dynarray_init(&profile_shaders, profile_mem_ctx);
+   atexit(write_profile);
+}
+
+/**
+ * Whether NIR_PASS and NIR_PASS_V profile the passes.  The environment is
+ * only looked at once per process.
+ */
+bool
+should_profile_nir(void)
+{
+   call_once(&profile_once_flag, profile_init);
+   return profile_path != NULL;
+}
+
+static unsigned
+count_instrs(nir_shader *shader)
+{
+   unsigned count = 0;
+
+   nir_foreach_function(function, shader) {
+      if (!function->impl)
+         continue;
+
+      nir_foreach_block(block, function->impl) {
+         nir_foreach_instr(instr, block)
+            count++;
+      }
+   }
+
+   return count;
+}
+
+void
+nir_pass_profile_begin(struct nir_pass_profile *profile, nir_shader *shader)
+{
+   profile->result = -1;
+   profile->num_instrs = count_instrs(shader);
+   profile->start = os_time_get_nano();
+}
+
+void
+nir_pass_profile_end(struct nir_pass_profile *profile, nir_shader *shader,
+                     const char *pass_name)
+{
+   int64_t time = os_time_get_nano() - profile->start;
+   unsigned num_instrs = count_instrs(shader);
+   struct shader_stats *shader_stats;
+
+   mtx_lock(&profile_mutex);
+
+   if (shader->profile_id == 0) {
+      shader_stats = rzalloc(profile_mem_ctx, struct shader_stats);
+      shader_stats->stage = shader->info.stage;
+      shader_stats->name = ralloc_strdup(shader_stats, shader->info.name);
+      shader_stats->label = ralloc_strdup(shader_stats, shader->info.label);
+      util_dynarray_init(&shader_stats->passes, shader_stats);
+      util_dynarray_append(&profile_shaders, struct shader_stats *,
+                           shader_stats);
+      shader->profile_id = util_dynarray_num_elements(&profile_shaders,
+                                                      struct shader_stats *);
+   } else {
+      shader_stats = *util_dynarray_element(&profile_shaders,
+                                            struct shader_stats *,
+                                            shader->profile_id - 1);
+   }
+
+   /* The names come from the NIR_PASS macros, so they are literals, and a
+    * shader only goes through a few dozen different passes.
+    */
+   struct pass_stats *s = NULL;
+   util_dynarray_foreach(&shader_stats->passes, struct pass_stats, pass) {
+      if (pass->name == pass_name || strcmp(pass->name, pass_name) == 0) {
+         s = pass;
+         break;
+      }
+   }
+   if (!s) {
+      s = util_dynarray_grow(&shader_stats->passes, sizeof(*s));
+      memset(s, 0, sizeof(*s));
+      s->name = pass_name;
+   }
+
+   s->calls++;
+   if (profile->result >= 0) {
+      s->progress_known++;
+      s->progress += profile->result;
+   }
+   s->time += time;
+   s->instrs_before += profile->num_instrs;
+   s->instrs_after += num_instrs;
+
+   mtx_unlock(&profile_mutex);
+}
@@ -37,6 +37,9 @@ struct nir_phi_builder {
    /* Hold on to the values so we can easily iterate over them. */
    struct exec_list values;
 
+   /* Linear allocator for the values, they are only freed with the builder */
+   void *lin_ctx;
+
    /* Worklist for phi adding */
    unsigned iter_count;
    unsigned *work;
@@ -105,6 +108,7 @@ nir_phi_builder_create(nir_function_impl *impl)
    }
 
    exec_list_make_empty(&pb->values);
+   pb->lin_ctx = linear_alloc_parent(pb, 0);
 
    pb->iter_count = 0;
    pb->work = rzalloc_array(pb, unsigned, pb->num_blocks);
@@ -120,7 +124,7 @@ nir_phi_builder_add_value(struct nir_phi_builder *pb, unsigned num_components,
    struct nir_phi_builder_value *val;
    unsigned i, w_start = 0, w_end = 0;
 
-   val = rzalloc_size(pb, sizeof(*val));
+   val = linear_zalloc_child(pb->lin_ctx, sizeof(*val));
    val->builder = pb;
    val->num_components = num_components;
    val->bit_size = bit_size;
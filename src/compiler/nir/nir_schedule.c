@@ -0,0 +1,525 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include "nir.h"
+#include "util/u_dynarray.h"
+
+/**
+ * \file nir_schedule.c
+ *
+ * A list scheduler for the instructions of each block that watches
+ * register pressure, to run just before a backend translates out of NIR.
+ *
+ * The instructions are scheduled top-down, out of the ones whose sources
+ * have all been scheduled.  By default, the one that adds the fewest live
+ * values goes first, which usually means using up values rather than
+ * loading more, and the new order of a block is only kept if fewer values
+ * are live at its worst point than before.
+ *
+ * With a latency threshold, while fewer 32-bit values are live than the
+ * threshold, the one with the longest chain of latency to the end of the
+ * block goes first instead, so loads and texture fetches get started early.
+ * That spends the registers below the threshold, so the most values live
+ * at once usually goes up.
+ *
+ * What is live comes from nir_live_ssa_defs_impl(), after indexing the SSA
+ * defs.  Constants and undefs are not counted, since backends mostly turn
+ * them into immediates, and they are scheduled as soon as they can be,
+ * which leaves them at the top.  Intrinsics that can't be reordered stay in
+ * the order they were in, and phis and the jump at the end of the block
+ * stay where they are.  Blocks that use registers are left alone.
+ */
+
+struct sched_node {
+   nir_instr *instr;
+
+   /* The nodes that can't be scheduled before this one. */
+   struct util_dynarray children;
+   unsigned unscheduled_parents;
+
+   /* The longest chain of latency from this node to the end of the block. */
+   unsigned height;
+
+   /* What pressure_change() returned, until a source loses another use. */
+   int change;
+   bool change_valid;
+};
+
+struct sched_state {
+   unsigned latency_threshold;
+
+   /* The def of each live index, and the number of uses of each def in the
+    * block that haven't been scheduled yet, indexed by nir_ssa_def::index.
+    */
+   nir_ssa_def **live_defs;
+   unsigned num_live_defs;
+   unsigned *uses_left;
+
+   nir_block *block;
+   nir_ssa_def *condition;
+   struct sched_node *nodes;
+   unsigned num_nodes;
+
+   /* The number of 32-bit values live at the current point, and the most
+    * there have been in the block so far.
+    */
+   unsigned pressure;
+   unsigned max_pressure;
+
+   /* What pressure_change() has counted so far. */
+   int change;
+};
+
+static unsigned
+def_size(nir_ssa_def *def)
+{
+   return def->num_components * DIV_ROUND_UP(def->bit_size, 32);
+}
+
+/** Returns true if the def takes up a register. */
+static bool
+def_is_counted(nir_ssa_def *def)
+{
+   return def->parent_instr->type != nir_instr_type_load_const &&
+          def->parent_instr->type != nir_instr_type_ssa_undef;
+}
+
+static bool
+def_is_live_out(struct sched_state *state, nir_ssa_def *def)
+{
+   return def == state->condition ||
+          BITSET_TEST(state->block->live_out, def->index);
+}
+
+static bool
+src_is_ssa(nir_src *src, void *data)
+{
+   return src->is_ssa;
+}
+
+static bool
+dest_is_ssa(nir_dest *dest, void *data)
+{
+   return dest->is_ssa;
+}
+
+static unsigned
+instr_delay(nir_instr *instr)
+{
+   switch (instr->type) {
+   case nir_instr_type_alu:
+      return 1;
+
+   case nir_instr_type_tex:
+      return 10;
+
+   case nir_instr_type_intrinsic: {
+      nir_intrinsic_instr *intrin = nir_instr_as_intrinsic(instr);
+      return nir_intrinsic_infos[intrin->intrinsic].has_dest ? 10 : 1;
+   }
+
+   default:
+      return 0;
+   }
+}
+
+/** Returns true if the instruction has to stay in order with the others. */
+static bool
+instr_is_ordered(nir_instr *instr)
+{
+   switch (instr->type) {
+   case nir_instr_type_intrinsic: {
+      nir_intrinsic_instr *intrin = nir_instr_as_intrinsic(instr);
+      return !(nir_intrinsic_infos[intrin->intrinsic].flags &
+               NIR_INTRINSIC_CAN_REORDER);
+   }
+
+   case nir_instr_type_call:
+   case nir_instr_type_parallel_copy:
+      return true;
+
+   default:
+      return false;
+   }
+}
+
+static bool
+instr_is_free(nir_instr *instr)
+{
+   return instr->type == nir_instr_type_load_const ||
+          instr->type == nir_instr_type_ssa_undef;
+}
+
+static void
+add_dep(struct sched_node *parent, struct sched_node *child)
+{
+   util_dynarray_append(&parent->children, struct sched_node *, child);
+   child->unscheduled_parents++;
+}
+
+static bool
+add_src_dep(nir_src *src, void *data)
+{
+   struct sched_state *state = data;
+   nir_instr *parent = src->ssa->parent_instr;
+
+   if (parent->block == state->block && parent->type != nir_instr_type_phi) {
+      add_dep(&state->nodes[parent->index],
+              &state->nodes[src->parent_instr->index]);
+   }
+
+   if (def_is_counted(src->ssa))
+      state->uses_left[src->ssa->index]++;
+
+   return true;
+}
+
+static bool
+add_def(nir_ssa_def *def, void *data)
+{
+   struct sched_state *state = data;
+
+   if (def_is_counted(def) &&
+       (state->uses_left[def->index] || def_is_live_out(state, def)))
+      state->change += def_size(def);
+
+   return true;
+}
+
+static bool
+use_src(nir_src *src, void *data)
+{
+   struct sched_state *state = data;
+   nir_ssa_def *def = src->ssa;
+
+   if (def_is_counted(def) && --state->uses_left[def->index] == 0 &&
+       !def_is_live_out(state, def))
+      state->change -= def_size(def);
+
+   return true;
+}
+
+static bool
+unuse_src(nir_src *src, void *data)
+{
+   struct sched_state *state = data;
+
+   if (def_is_counted(src->ssa))
+      state->uses_left[src->ssa->index]++;
+
+   return true;
+}
+
+/**
+ * Returns how many more 32-bit values are live after the instruction than
+ * before it.
+ */
+static int
+pressure_change(struct sched_state *state, nir_instr *instr)
+{
+   state->change = 0;
+   nir_foreach_src(instr, use_src, state);
+   nir_foreach_ssa_def(instr, add_def, state);
+   nir_foreach_src(instr, unuse_src, state);
+
+   return state->change;
+}
+
+static bool
+invalidate_users(nir_src *src, void *data)
+{
+   struct sched_state *state = data;
+
+   nir_foreach_use(use, src->ssa) {
+      nir_instr *user = use->parent_instr;
+
+      if (user->block == state->block && user->type != nir_instr_type_phi &&
+          user->type != nir_instr_type_jump)
+         state->nodes[user->index].change_valid = false;
+   }
+
+   return true;
+}
+
+/** Updates the pressure for the instruction going next. */
+static void
+advance_pressure(struct sched_state *state, nir_instr *instr)
+{
+   state->change = 0;
+   nir_foreach_src(instr, use_src, state);
+   nir_foreach_ssa_def(instr, add_def, state);
+   state->pressure += state->change;
+   state->max_pressure = MAX2(state->max_pressure, state->pressure);
+}
+
+static struct sched_node *
+choose_node(struct sched_state *state, struct util_dynarray *ready)
+{
+   struct sched_node *best = NULL;
+   int best_change = 0;
+
+   util_dynarray_foreach(ready, struct sched_node *, node_p) {
+      struct sched_node *node = *node_p;
+
+      if (instr_is_free(node->instr))
+         return node;
+
+      if (state->pressure < state->latency_threshold) {
+         if (!best || node->height > best->height ||
+             (node->height == best->height && node->instr->index <
+                                              best->instr->index))
+            best = node;
+      } else {
+         if (!node->change_valid) {
+            node->change = pressure_change(state, node->instr);
+            node->change_valid = true;
+         }
+         int change = node->change;
+
+         if (!best || change < best_change ||
+             (change == best_change &&
+              (node->height > best->height ||
+               (node->height == best->height &&
+                node->instr->index < best->instr->index)))) {
+            best = node;
+            best_change = change;
+         }
+      }
+   }
+
+   return best;
+}
+
+static bool
+schedule_block(struct sched_state *state, nir_block *block)
+{
+   nir_instr *jump = NULL;
+   unsigned num_nodes = 0;
+
+   nir_foreach_instr(instr, block) {
+      if (!nir_foreach_src(instr, src_is_ssa, NULL) ||
+          !nir_foreach_dest(instr, dest_is_ssa, NULL))
+         return false;
+
+      if (instr->type == nir_instr_type_jump)
+         jump = instr;
+      else if (instr->type != nir_instr_type_phi)
+         instr->index = num_nodes++;
+   }
+
+   nir_if *following_if = nir_block_get_following_if(block);
+   if (following_if && !following_if->condition.is_ssa)
+      return false;
+
+   if (num_nodes < 2)
+      return false;
+
+   state->block = block;
+   state->condition = following_if ? following_if->condition.ssa : NULL;
+   state->nodes = calloc(num_nodes, sizeof(*state->nodes));
+   state->num_nodes = num_nodes;
+
+   struct sched_node *last_ordered = NULL;
+   nir_foreach_instr(instr, block) {
+      if (instr->type == nir_instr_type_phi || instr == jump)
+         continue;
+
+      struct sched_node *node = &state->nodes[instr->index];
+      node->instr = instr;
+      util_dynarray_init(&node->children, NULL);
+
+      nir_foreach_src(instr, add_src_dep, state);
+
+      if (instr_is_ordered(instr)) {
+         if (last_ordered)
+            add_dep(last_ordered, node);
+         last_ordered = node;
+      }
+   }
+
+   /* The children of a node always come after it. */
+   for (int i = num_nodes - 1; i >= 0; i--) {
+      struct sched_node *node = &state->nodes[i];
+      unsigned height = 0;
+
+      util_dynarray_foreach(&node->children, struct sched_node *, child)
+         height = MAX2(height, (*child)->height);
+      node->height = height + instr_delay(node->instr);
+   }
+
+   unsigned live_in_pressure = 0;
+   unsigned i;
+   BITSET_WORD tmp;
+   BITSET_FOREACH_SET(i, tmp, block->live_in, state->num_live_defs) {
+      if (def_is_counted(state->live_defs[i]))
+         live_in_pressure += def_size(state->live_defs[i]);
+   }
+
+   /* Without a latency threshold, the block only changes if that lowers
+    * its worst point, so see what that is in the current order.
+    */
+   unsigned old_max_pressure = 0;
+   if (!state->latency_threshold) {
+      state->pressure = state->max_pressure = live_in_pressure;
+      for (unsigned n = 0; n < num_nodes; n++)
+         advance_pressure(state, state->nodes[n].instr);
+      for (unsigned n = 0; n < num_nodes; n++)
+         nir_foreach_src(state->nodes[n].instr, unuse_src, state);
+      old_max_pressure = state->max_pressure;
+   }
+
+   state->pressure = state->max_pressure = live_in_pressure;
+
+   struct util_dynarray ready;
+   util_dynarray_init(&ready, NULL);
+   for (unsigned n = 0; n < num_nodes; n++) {
+      if (!state->nodes[n].unscheduled_parents)
+         util_dynarray_append(&ready, struct sched_node *, &state->nodes[n]);
+
+      exec_node_remove(&state->nodes[n].instr->node);
+   }
+
+   bool progress = false;
+   for (unsigned n = 0; n < num_nodes; n++) {
+      struct sched_node *node = choose_node(state, &ready);
+      nir_instr *instr = node->instr;
+
+      /* Take it out of the ready list. */
+      util_dynarray_foreach(&ready, struct sched_node *, node_p) {
+         if (*node_p == node) {
+            *node_p = util_dynarray_pop(&ready, struct sched_node *);
+            break;
+         }
+      }
+
+      if (jump)
+         exec_node_insert_node_before(&jump->node, &instr->node);
+      else
+         exec_list_push_tail(&block->instr_list, &instr->node);
+      progress |= instr->index != n;
+
+      advance_pressure(state, instr);
+
+      /* Other users of the sources may be their last ones now. */
+      nir_foreach_src(instr, invalidate_users, state);
+
+      util_dynarray_foreach(&node->children, struct sched_node *, child) {
+         if (--(*child)->unscheduled_parents == 0)
+            util_dynarray_append(&ready, struct sched_node *, *child);
+      }
+   }
+
+   if (progress && !state->latency_threshold &&
+       state->max_pressure >= old_max_pressure) {
+      for (unsigned n = 0; n < num_nodes; n++) {
+         nir_instr *instr = state->nodes[n].instr;
+
+         exec_node_remove(&instr->node);
+         if (jump)
+            exec_node_insert_node_before(&jump->node, &instr->node);
+         else
+            exec_list_push_tail(&block->instr_list, &instr->node);
+      }
+      progress = false;
+   }
+
+   util_dynarray_fini(&ready);
+   for (unsigned n = 0; n < num_nodes; n++)
+      util_dynarray_fini(&state->nodes[n].children);
+   free(state->nodes);
+
+   return progress;
+}
+
+static bool
+set_live_def(nir_ssa_def *def, void *data)
+{
+   struct sched_state *state = data;
+
+   state->live_defs[def->index] = def;
+   state->num_live_defs = MAX2(state->num_live_defs, def->index + 1);
+   return true;
+}
+
+static bool
+nir_schedule_impl(nir_function_impl *impl,
+                  const nir_schedule_options *options)
+{
+   bool progress = false;
+
+   nir_index_ssa_defs(impl);
+   nir_metadata_require(impl, nir_metadata_live_ssa_defs |
+                              nir_metadata_block_index);
+
+   struct sched_state state = {
+      .latency_threshold = options->latency_threshold,
+      .live_defs = calloc(impl->ssa_alloc, sizeof(nir_ssa_def *)),
+      .uses_left = calloc(impl->ssa_alloc, sizeof(unsigned)),
+   };
+
+   nir_foreach_block(block, impl) {
+      nir_foreach_instr(instr, block)
+         nir_foreach_ssa_def(instr, set_live_def, &state);
+   }
+
+   nir_foreach_block(block, impl)
+      progress |= schedule_block(&state, block);
+
+   free(state.live_defs);
+   free(state.uses_left);
+
+   if (progress) {
+      /* Moving instructions within their blocks leaves the live sets as
+       * they are.  The SSA def indices no longer follow instruction order,
+       * but the passes that need that, like nir_from_ssa, index them first.
+       */
+      nir_metadata_preserve(impl, nir_metadata_block_index |
+                                  nir_metadata_dominance |
+                                  nir_metadata_live_ssa_defs);
+   } else {
+#ifndef NDEBUG
+      impl->valid_metadata &= ~nir_metadata_not_properly_reset;
+#endif
+   }
+
+   return progress;
+}
+
+/**
+ * Schedules the instructions of each block of the shader to keep fewer
+ * values live at once.  Backends that would rather hide latency can pass a
+ * latency threshold of about the number of registers they can allocate
+ * without spilling.
+ */
+bool
+nir_schedule(nir_shader *shader, const nir_schedule_options *options)
+{
+   bool progress = false;
+
+   nir_foreach_function(function, shader) {
+      if (function->impl)
+         progress |= nir_schedule_impl(function->impl, options);
+   }
+
+   return progress;
+}
@@ -26,9 +26,14 @@
  */
 
 #include <inttypes.h>
+#include <stdio.h>
 #include "nir_search.h"
 #include "nir_builder.h"
+#include "nir_serialize.h"
+#include "c11/threads.h"
 #include "util/half_float.h"
+#include "util/os_time.h"
+#include "util/u_atomic.h"
 
 struct match_state {
    bool inexact_match;
@@ -498,6 +503,110 @@ construct_value(nir_builder *build,
    }
 }
 
+static once_flag algebraic_dump_dir_once = ONCE_FLAG_INIT;
+static const char *algebraic_dump_dir;
+
+static void
+algebraic_dump_dir_init(void)
+{
+   algebraic_dump_dir = getenv("NIR_ALGEBRAIC_DUMP_DIR");
+}
+
+/**
+ * Writes the shader an algebraic pass is about to run on to a file in the
+ * directory given by the NIR_ALGEBRAIC_DUMP_DIR environment variable, if it
+ * is set.  tests/algebraic_benchmark.c replays the files as a shader corpus.
+ * The variable is only read once, as the passes run for every shader.
+ *
+ * The file holds the compiler options, which the search conditions look
+ * at, followed by the serialized shader.
+ */
+void
+nir_algebraic_maybe_dump(const nir_shader *shader, const char *pass_name)
+{
+   static unsigned dump_count;
+   const char *dir;
+   struct blob blob;
+   char path[1024];
+   FILE *f;
+
+   call_once(&algebraic_dump_dir_once, algebraic_dump_dir_init);
+   dir = algebraic_dump_dir;
+   if (!dir)
+      return;
+
+   snprintf(path, sizeof(path), "%s/%s-%"PRIx64"-%u.nir", dir, pass_name,
+            (uint64_t)os_time_get_nano(), p_atomic_inc_return(&dump_count));
+
+   f = fopen(path, "wb");
+   if (!f)
+      return;
+
+   blob_init(&blob);
+   blob_write_uint32(&blob, sizeof(*shader->options));
+   blob_write_bytes(&blob, shader->options, sizeof(*shader->options));
+   nir_serialize(&blob, shader);
+
+   if (!blob.out_of_memory)
+      fwrite(blob.data, 1, blob.size, f);
+
+   blob_finish(&blob);
+   fclose(f);
+}
+
+/* The states every instruction the automaton doesn't look at gets, and the
+ * state of load_const instructions.  These match the first two states that
+ * nir_algebraic.py creates.
+ */
+#define WILDCARD_STATE 0
+#define CONST_STATE 1
+
+/**
+ * Computes the state of an instruction from the states of its sources, and
+ * stores it in states, which is indexed by SSA def index.
+ */
+void
+nir_algebraic_automaton(nir_instr *instr, uint16_t *states,
+                        const struct nir_search_op_table *op_tables)
+{
+   switch (instr->type) {
+   case nir_instr_type_alu: {
+      nir_alu_instr *alu = nir_instr_as_alu(instr);
+      const struct nir_search_op_table *tbl = &op_tables[alu->op];
+
+      if (!alu->dest.dest.is_ssa)
+         return;
+
+      if (tbl->num_filtered_states == 0) {
+         states[alu->dest.dest.ssa.index] = WILDCARD_STATE;
+         return;
+      }
+
+      unsigned index = 0;
+      for (unsigned i = 0; i < nir_op_infos[alu->op].num_inputs; i++) {
+         uint16_t src_state = WILDCARD_STATE;
+
+         if (alu->src[i].src.is_ssa)
+            src_state = states[alu->src[i].src.ssa->index];
+
+         index = index * tbl->num_filtered_states + tbl->filter[src_state];
+      }
+
+      states[alu->dest.dest.ssa.index] = tbl->table[index];
+      break;
+   }
+
+   case nir_instr_type_load_const: {
+      nir_load_const_instr *load_const = nir_instr_as_load_const(instr);
+      states[load_const->def.index] = CONST_STATE;
+      break;
+   }
+
+   default:
+      break;
+   }
+}
+
 nir_ssa_def *
 nir_replace_instr(nir_builder *build, nir_alu_instr *instr,
                   const nir_search_expression *search,
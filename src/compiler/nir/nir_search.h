@@ -155,6 +155,31 @@ NIR_DEFINE_CAST(nir_search_value_as_expression, nir_search_value,
                 nir_search_expression, value,
                 type, nir_search_value_expression)
 
+/**
+ * The transition table of one opcode in the tree automaton that
+ * nir_algebraic.py generates to find the search expressions that might
+ * match an instruction.
+ */
+struct nir_search_op_table {
+   /** Maps the state of a source to the index used for it in the table */
+   const uint16_t *filter;
+
+   /** The number of different filtered states, 0 if nothing uses the op */
+   unsigned num_filtered_states;
+
+   /** The state of an instruction, indexed by its filtered source states in
+    * row-major order.
+    */
+   const uint16_t *table;
+};
+
+void
+nir_algebraic_automaton(nir_instr *instr, uint16_t *states,
+                        const struct nir_search_op_table *op_tables);
+
+void
+nir_algebraic_maybe_dump(const nir_shader *shader, const char *pass_name);
+
 nir_ssa_def *
 nir_replace_instr(struct nir_builder *b, nir_alu_instr *instr,
                   const nir_search_expression *search,
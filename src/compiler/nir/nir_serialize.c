@@ -24,6 +24,12 @@
 #include "nir_serialize.h"
 #include "nir_control_flow.h"
 #include "util/u_dynarray.h"
+#include "util/u_math.h"
+
+/* Object indices and SSA distances that don't fit in the 20 bits of a
+ * packed source are written as this value, followed by the full 32 bits.
+ */
+#define PACKED_OBJECT_IDX_ESCAPE ((1 << 20) - 1)
 
 typedef struct {
    size_t blob_offset;
@@ -40,7 +46,7 @@ typedef struct {
    struct hash_table *remap_table;
 
    /* the next index to assign to a NIR in-memory object */
-   uintptr_t next_idx;
+   uint32_t next_idx;
 
    /* Array of write_phi_fixup structs representing phi sources that need to
     * be resolved in the second pass.
@@ -54,10 +60,10 @@ typedef struct {
    struct blob_reader *blob;
 
    /* the next index to assign to a NIR in-memory object */
-   uintptr_t next_idx;
+   uint32_t next_idx;
 
    /* The length of the index -> object table */
-   uintptr_t idx_table_len;
+   uint32_t idx_table_len;
 
    /* map from index to deserialized pointer */
    void **idx_table;
@@ -70,22 +76,22 @@ typedef struct {
 static void
 write_add_object(write_ctx *ctx, const void *obj)
 {
-   uintptr_t index = ctx->next_idx++;
-   _mesa_hash_table_insert(ctx->remap_table, obj, (void *) index);
+   uint32_t index = ctx->next_idx++;
+   _mesa_hash_table_insert(ctx->remap_table, obj, (void *)(uintptr_t) index);
 }
 
-static uintptr_t
+static uint32_t
 write_lookup_object(write_ctx *ctx, const void *obj)
 {
    struct hash_entry *entry = _mesa_hash_table_search(ctx->remap_table, obj);
    assert(entry);
-   return (uintptr_t) entry->data;
+   return (uint32_t)(uintptr_t) entry->data;
 }
 
 static void
 write_object(write_ctx *ctx, const void *obj)
 {
-   blob_write_intptr(ctx->blob, write_lookup_object(ctx, obj));
+   blob_write_uint32(ctx->blob, write_lookup_object(ctx, obj));
 }
 
 static void
@@ -96,7 +102,7 @@ read_add_object(read_ctx *ctx, void *obj)
 }
 
 static void *
-read_lookup_object(read_ctx *ctx, uintptr_t idx)
+read_lookup_object(read_ctx *ctx, uint32_t idx)
 {
    assert(idx < ctx->idx_table_len);
    return ctx->idx_table[idx];
@@ -105,7 +111,7 @@ read_lookup_object(read_ctx *ctx, uintptr_t idx)
 static void *
 read_object(read_ctx *ctx)
 {
-   return read_lookup_object(ctx, blob_read_intptr(ctx->blob));
+   return read_lookup_object(ctx, blob_read_uint32(ctx->blob));
 }
 
 static void
@@ -276,70 +282,227 @@ read_reg_list(read_ctx *ctx, struct exec_list *dst)
    }
 }
 
+/* Every source is written as one 32-bit word, with a few bits left for the
+ * instruction to pack its per-source state into.  SSA sources store how far
+ * back their definition is, since it's almost always close by, and register
+ * sources store the register.  Larger shaders get a second word when that
+ * doesn't fit, see PACKED_OBJECT_IDX_ESCAPE.
+ */
+union packed_src {
+   uint32_t u32;
+   struct {
+      unsigned is_ssa:1;
+      unsigned is_indirect:1;
+      unsigned _footer:10;
+      unsigned object_idx:20;
+   } any;
+   struct {
+      unsigned _header:2;
+      unsigned negate:1;
+      unsigned abs:1;
+      unsigned swizzle_x:2;
+      unsigned swizzle_y:2;
+      unsigned swizzle_z:2;
+      unsigned swizzle_w:2;
+      unsigned _object_idx:20;
+   } alu;
+   struct {
+      unsigned _header:2;
+      unsigned src_type:5;
+      unsigned _pad:5;
+      unsigned _object_idx:20;
+   } tex;
+};
+
 static void
-write_src(write_ctx *ctx, const nir_src *src)
+write_src_header(write_ctx *ctx, union packed_src header, uint32_t object_idx)
 {
-   /* Since sources are very frequent, we try to save some space when storing
-    * them. In particular, we store whether the source is a register and
-    * whether the register has an indirect index in the low two bits. We can
-    * assume that the high two bits of the index are zero, since otherwise our
-    * address space would've been exhausted allocating the remap table!
-    */
+   if (object_idx < PACKED_OBJECT_IDX_ESCAPE) {
+      header.any.object_idx = object_idx;
+      blob_write_uint32(ctx->blob, header.u32);
+   } else {
+      header.any.object_idx = PACKED_OBJECT_IDX_ESCAPE;
+      blob_write_uint32(ctx->blob, header.u32);
+      blob_write_uint32(ctx->blob, object_idx);
+   }
+}
+
+static void
+write_src_full(write_ctx *ctx, const nir_src *src, union packed_src header)
+{
+   header.any.is_ssa = src->is_ssa;
    if (src->is_ssa) {
-      uintptr_t idx = write_lookup_object(ctx, src->ssa) << 2;
-      idx |= 1;
-      blob_write_intptr(ctx->blob, idx);
+      /* Definitions are always written before their uses, except for phi
+       * sources, which have their own encoding.
+       */
+      write_src_header(ctx, header,
+                       ctx->next_idx - write_lookup_object(ctx, src->ssa));
    } else {
-      uintptr_t idx = write_lookup_object(ctx, src->reg.reg) << 2;
-      if (src->reg.indirect)
-         idx |= 2;
-      blob_write_intptr(ctx->blob, idx);
+      header.any.is_indirect = !!src->reg.indirect;
+      write_src_header(ctx, header, write_lookup_object(ctx, src->reg.reg));
       blob_write_uint32(ctx->blob, src->reg.base_offset);
       if (src->reg.indirect) {
-         write_src(ctx, src->reg.indirect);
+         union packed_src indirect_header = {0};
+         write_src_full(ctx, src->reg.indirect, indirect_header);
       }
    }
 }
 
 static void
+write_src(write_ctx *ctx, const nir_src *src)
+{
+   union packed_src header = {0};
+   write_src_full(ctx, src, header);
+}
+
+static union packed_src
 read_src(read_ctx *ctx, nir_src *src, void *mem_ctx)
 {
-   uintptr_t val = blob_read_intptr(ctx->blob);
-   uintptr_t idx = val >> 2;
-   src->is_ssa = val & 0x1;
+   union packed_src header;
+   uint32_t object_idx;
+
+   header.u32 = blob_read_uint32(ctx->blob);
+   object_idx = header.any.object_idx;
+   if (object_idx == PACKED_OBJECT_IDX_ESCAPE)
+      object_idx = blob_read_uint32(ctx->blob);
+
+   src->is_ssa = header.any.is_ssa;
    if (src->is_ssa) {
-      src->ssa = read_lookup_object(ctx, idx);
+      src->ssa = read_lookup_object(ctx, ctx->next_idx - object_idx);
    } else {
-      bool is_indirect = val & 0x2;
-      src->reg.reg = read_lookup_object(ctx, idx);
+      src->reg.reg = read_lookup_object(ctx, object_idx);
       src->reg.base_offset = blob_read_uint32(ctx->blob);
-      if (is_indirect) {
+      if (header.any.is_indirect) {
          src->reg.indirect = ralloc(mem_ctx, nir_src);
          read_src(ctx, src->reg.indirect, mem_ctx);
       } else {
          src->reg.indirect = NULL;
       }
    }
+   return header;
+}
+
+/* Destinations fit in the top byte of the instruction header. */
+union packed_dest {
+   uint8_t u8;
+   struct {
+      uint8_t is_ssa:1;
+      uint8_t has_name:1;
+      uint8_t num_components:3;
+      uint8_t bit_size:3;
+   } ssa;
+   struct {
+      uint8_t is_ssa:1;
+      uint8_t is_indirect:1;
+      uint8_t _pad:6;
+   } reg;
+};
+
+/* The type of each instruction goes in the low bits of its header, and the
+ * rest is whatever fits of the instruction itself.
+ */
+union packed_instr {
+   uint32_t u32;
+   struct {
+      unsigned instr_type:4;
+      unsigned _pad:20;
+      unsigned dest:8;
+   } any;
+   struct {
+      unsigned instr_type:4;
+      unsigned exact:1;
+      unsigned saturate:1;
+      unsigned writemask:4;
+      unsigned op:9;
+      unsigned packed_src_ssa_16bit:1;
+      unsigned _pad:4;
+      unsigned dest:8;
+   } alu;
+   struct {
+      unsigned instr_type:4;
+      unsigned deref_type:3;
+      unsigned mode:10;
+      unsigned mode_follows:1;
+      unsigned _pad:6;
+      unsigned dest:8;
+   } deref;
+   struct {
+      unsigned instr_type:4;
+      unsigned intrinsic:9;
+      unsigned num_components:3;
+      unsigned _pad:8;
+      unsigned dest:8;
+   } intrinsic;
+   struct {
+      unsigned instr_type:4;
+      unsigned num_components:3;
+      unsigned bit_size:3;
+      unsigned packing:2;
+      unsigned packed_value:20;
+   } load_const;
+   struct {
+      unsigned instr_type:4;
+      unsigned num_components:3;
+      unsigned bit_size:3;
+      unsigned _pad:22;
+   } undef;
+   struct {
+      unsigned instr_type:4;
+      unsigned num_srcs:4;
+      unsigned op:4;
+      unsigned _pad:12;
+      unsigned dest:8;
+   } tex;
+   struct {
+      unsigned instr_type:4;
+      unsigned num_srcs:20;
+      unsigned dest:8;
+   } phi;
+   struct {
+      unsigned instr_type:4;
+      unsigned type:2;
+      unsigned _pad:26;
+   } jump;
+};
+
+/* Bit sizes are 1, 8, 16, 32 or 64, which fit in three bits as a log. */
+static unsigned
+encode_bit_size_3bits(uint8_t bit_size)
+{
+   assert(util_is_power_of_two_nonzero(bit_size) && bit_size <= 64);
+   return util_logbase2(bit_size);
+}
+
+static uint8_t
+decode_bit_size_3bits(unsigned bit_size)
+{
+   return 1 << bit_size;
 }
 
 static void
-write_dest(write_ctx *ctx, const nir_dest *dst)
+write_dest(write_ctx *ctx, const nir_dest *dst, union packed_instr header)
 {
-   uint32_t val = dst->is_ssa;
+   union packed_dest dest;
+   dest.u8 = 0;
+
+   dest.ssa.is_ssa = dst->is_ssa;
    if (dst->is_ssa) {
-      val |= !!(dst->ssa.name) << 1;
-      val |= dst->ssa.num_components << 2;
-      val |= dst->ssa.bit_size << 5;
+      dest.ssa.has_name = !!dst->ssa.name;
+      dest.ssa.num_components = dst->ssa.num_components;
+      dest.ssa.bit_size = encode_bit_size_3bits(dst->ssa.bit_size);
    } else {
-      val |= !!(dst->reg.indirect) << 1;
+      dest.reg.is_indirect = !!(dst->reg.indirect);
    }
-   blob_write_uint32(ctx->blob, val);
+
+   header.any.dest = dest.u8;
+   blob_write_uint32(ctx->blob, header.u32);
+
    if (dst->is_ssa) {
       write_add_object(ctx, &dst->ssa);
       if (dst->ssa.name)
          blob_write_string(ctx->blob, dst->ssa.name);
    } else {
-      blob_write_intptr(ctx->blob, write_lookup_object(ctx, dst->reg.reg));
+      blob_write_uint32(ctx->blob, write_lookup_object(ctx, dst->reg.reg));
       blob_write_uint32(ctx->blob, dst->reg.base_offset);
       if (dst->reg.indirect)
          write_src(ctx, dst->reg.indirect);
@@ -347,69 +510,137 @@ write_dest(write_ctx *ctx, const nir_dest *dst)
 }
 
 static void
-read_dest(read_ctx *ctx, nir_dest *dst, nir_instr *instr)
-{
-   uint32_t val = blob_read_uint32(ctx->blob);
-   bool is_ssa = val & 0x1;
-   if (is_ssa) {
-      bool has_name = val & 0x2;
-      unsigned num_components = (val >> 2) & 0x7;
-      unsigned bit_size = val >> 5;
-      char *name = has_name ? blob_read_string(ctx->blob) : NULL;
-      nir_ssa_dest_init(instr, dst, num_components, bit_size, name);
+read_dest(read_ctx *ctx, nir_dest *dst, nir_instr *instr,
+          union packed_instr header)
+{
+   union packed_dest dest;
+   dest.u8 = header.any.dest;
+
+   if (dest.ssa.is_ssa) {
+      unsigned bit_size = decode_bit_size_3bits(dest.ssa.bit_size);
+      char *name = dest.ssa.has_name ? blob_read_string(ctx->blob) : NULL;
+      nir_ssa_dest_init(instr, dst, dest.ssa.num_components, bit_size, name);
       read_add_object(ctx, &dst->ssa);
    } else {
-      bool is_indirect = val & 0x2;
       dst->reg.reg = read_object(ctx);
       dst->reg.base_offset = blob_read_uint32(ctx->blob);
-      if (is_indirect) {
+      if (dest.reg.is_indirect) {
          dst->reg.indirect = ralloc(instr, nir_src);
          read_src(ctx, dst->reg.indirect, instr);
       }
    }
 }
 
-static void
-write_alu(write_ctx *ctx, const nir_alu_instr *alu)
+/**
+ * Whether the sources of an ALU instruction can be written as 16 bits each:
+ * 14 bits of distance to their SSA definition and the swizzle of the first
+ * channel, with the other channels they use not swizzled or modified.
+ */
+static bool
+are_alu_srcs_ssa_16bit(write_ctx *ctx, const nir_alu_instr *alu)
 {
-   blob_write_uint32(ctx->blob, alu->op);
-   uint32_t flags = alu->exact;
-   flags |= alu->dest.saturate << 1;
-   flags |= alu->dest.write_mask << 2;
-   blob_write_uint32(ctx->blob, flags);
+   for (unsigned i = 0; i < nir_op_infos[alu->op].num_inputs; i++) {
+      if (!alu->src[i].src.is_ssa || alu->src[i].abs || alu->src[i].negate)
+         return false;
 
-   write_dest(ctx, &alu->dest.dest);
+      if (ctx->next_idx - write_lookup_object(ctx, alu->src[i].src.ssa) >=
+          (1 << 14))
+         return false;
 
-   for (unsigned i = 0; i < nir_op_infos[alu->op].num_inputs; i++) {
-      write_src(ctx, &alu->src[i].src);
-      flags = alu->src[i].negate;
-      flags |= alu->src[i].abs << 1;
-      for (unsigned j = 0; j < 4; j++)
-         flags |= alu->src[i].swizzle[j] << (2 + 2 * j);
-      blob_write_uint32(ctx->blob, flags);
+      for (unsigned c = 1; c < NIR_MAX_VEC_COMPONENTS; c++) {
+         if (nir_alu_instr_channel_used(alu, i, c) &&
+             alu->src[i].swizzle[c] != c)
+            return false;
+      }
+   }
+
+   return true;
+}
+
+static void
+write_alu(write_ctx *ctx, const nir_alu_instr *alu)
+{
+   STATIC_ASSERT(nir_num_opcodes <= (1 << 9));
+   unsigned num_srcs = nir_op_infos[alu->op].num_inputs;
+   union packed_instr header;
+   header.u32 = 0;
+
+   header.alu.instr_type = alu->instr.type;
+   header.alu.exact = alu->exact;
+   header.alu.saturate = alu->dest.saturate;
+   header.alu.writemask = alu->dest.write_mask;
+   header.alu.op = alu->op;
+   header.alu.packed_src_ssa_16bit = are_alu_srcs_ssa_16bit(ctx, alu);
+
+   write_dest(ctx, &alu->dest.dest, header);
+
+   if (header.alu.packed_src_ssa_16bit) {
+      /* Two sources per word. */
+      for (unsigned i = 0; i < num_srcs; i += 2) {
+         uint32_t packed = 0;
+
+         for (unsigned j = i; j < MIN2(i + 2, num_srcs); j++) {
+            uint32_t idx = ctx->next_idx -
+                           write_lookup_object(ctx, alu->src[j].src.ssa);
+            packed |= (idx << 2 | alu->src[j].swizzle[0]) << (16 * (j - i));
+         }
+         blob_write_uint32(ctx->blob, packed);
+      }
+   } else {
+      for (unsigned i = 0; i < num_srcs; i++) {
+         union packed_src src;
+         src.u32 = 0;
+
+         src.alu.negate = alu->src[i].negate;
+         src.alu.abs = alu->src[i].abs;
+         src.alu.swizzle_x = alu->src[i].swizzle[0];
+         src.alu.swizzle_y = alu->src[i].swizzle[1];
+         src.alu.swizzle_z = alu->src[i].swizzle[2];
+         src.alu.swizzle_w = alu->src[i].swizzle[3];
+
+         write_src_full(ctx, &alu->src[i].src, src);
+      }
    }
 }
 
 static nir_alu_instr *
-read_alu(read_ctx *ctx)
+read_alu(read_ctx *ctx, union packed_instr header)
 {
-   nir_op op = blob_read_uint32(ctx->blob);
-   nir_alu_instr *alu = nir_alu_instr_create(ctx->nir, op);
+   unsigned num_srcs = nir_op_infos[header.alu.op].num_inputs;
+   nir_alu_instr *alu = nir_alu_instr_create(ctx->nir, header.alu.op);
+
+   alu->exact = header.alu.exact;
+   alu->dest.saturate = header.alu.saturate;
+   alu->dest.write_mask = header.alu.writemask;
+
+   read_dest(ctx, &alu->dest.dest, &alu->instr, header);
 
-   uint32_t flags = blob_read_uint32(ctx->blob);
-   alu->exact = flags & 1;
-   alu->dest.saturate = flags & 2;
-   alu->dest.write_mask = flags >> 2;
+   if (header.alu.packed_src_ssa_16bit) {
+      for (unsigned i = 0; i < num_srcs; i += 2) {
+         uint32_t packed = blob_read_uint32(ctx->blob);
 
-   read_dest(ctx, &alu->dest.dest, &alu->instr);
+         for (unsigned j = i; j < MIN2(i + 2, num_srcs); j++) {
+            unsigned src = (packed >> (16 * (j - i))) & 0xffff;
+            nir_alu_src *alu_src = &alu->src[j];
 
-   for (unsigned i = 0; i < nir_op_infos[op].num_inputs; i++) {
-      read_src(ctx, &alu->src[i].src, &alu->instr);
-      flags = blob_read_uint32(ctx->blob);
-      alu->src[i].negate = flags & 1;
-      alu->src[i].abs = flags & 2;
-      for (unsigned j = 0; j < 4; j++)
-         alu->src[i].swizzle[j] = (flags >> (2 * j + 2)) & 3;
+            alu_src->src.is_ssa = true;
+            alu_src->src.ssa =
+               read_lookup_object(ctx, ctx->next_idx - (src >> 2));
+            /* nir_alu_instr_create leaves the other channels unswizzled. */
+            alu_src->swizzle[0] = src & 0x3;
+         }
+      }
+   } else {
+      for (unsigned i = 0; i < num_srcs; i++) {
+         union packed_src src = read_src(ctx, &alu->src[i].src, &alu->instr);
+
+         alu->src[i].negate = src.alu.negate;
+         alu->src[i].abs = src.alu.abs;
+         alu->src[i].swizzle[0] = src.alu.swizzle_x;
+         alu->src[i].swizzle[1] = src.alu.swizzle_y;
+         alu->src[i].swizzle[2] = src.alu.swizzle_z;
+         alu->src[i].swizzle[3] = src.alu.swizzle_w;
+      }
    }
 
    return alu;
@@ -418,12 +649,20 @@ read_alu(read_ctx *ctx)
 static void
 write_deref(write_ctx *ctx, const nir_deref_instr *deref)
 {
-   blob_write_uint32(ctx->blob, deref->deref_type);
+   union packed_instr header;
+   header.u32 = 0;
 
-   blob_write_uint32(ctx->blob, deref->mode);
-   encode_type_to_blob(ctx->blob, deref->type);
+   header.deref.instr_type = deref->instr.type;
+   header.deref.deref_type = deref->deref_type;
+   if (deref->mode < (1 << 10))
+      header.deref.mode = deref->mode;
+   else
+      header.deref.mode_follows = 1;
 
-   write_dest(ctx, &deref->dest);
+   write_dest(ctx, &deref->dest, header);
+   if (header.deref.mode_follows)
+      blob_write_uint32(ctx->blob, deref->mode);
+   encode_type_to_blob(ctx->blob, deref->type);
 
    if (deref->deref_type == nir_deref_type_var) {
       write_object(ctx, deref->var);
@@ -456,16 +695,18 @@ write_deref(write_ctx *ctx, const nir_deref_instr *deref)
 }
 
 static nir_deref_instr *
-read_deref(read_ctx *ctx)
+read_deref(read_ctx *ctx, union packed_instr header)
 {
-   nir_deref_type deref_type = blob_read_uint32(ctx->blob);
+   nir_deref_type deref_type = header.deref.deref_type;
    nir_deref_instr *deref = nir_deref_instr_create(ctx->nir, deref_type);
 
-   deref->mode = blob_read_uint32(ctx->blob);
+   read_dest(ctx, &deref->dest, &deref->instr, header);
+   if (header.deref.mode_follows)
+      deref->mode = blob_read_uint32(ctx->blob);
+   else
+      deref->mode = header.deref.mode;
    deref->type = decode_type_from_blob(ctx->blob);
 
-   read_dest(ctx, &deref->dest, &deref->instr);
-
    if (deref_type == nir_deref_type_var) {
       deref->var = read_object(ctx);
       return deref;
@@ -501,15 +742,20 @@ read_deref(read_ctx *ctx)
 static void
 write_intrinsic(write_ctx *ctx, const nir_intrinsic_instr *intrin)
 {
-   blob_write_uint32(ctx->blob, intrin->intrinsic);
-
+   STATIC_ASSERT(nir_num_intrinsics <= (1 << 9));
    unsigned num_srcs = nir_intrinsic_infos[intrin->intrinsic].num_srcs;
    unsigned num_indices = nir_intrinsic_infos[intrin->intrinsic].num_indices;
+   union packed_instr header;
+   header.u32 = 0;
 
-   blob_write_uint32(ctx->blob, intrin->num_components);
+   header.intrinsic.instr_type = intrin->instr.type;
+   header.intrinsic.intrinsic = intrin->intrinsic;
+   header.intrinsic.num_components = intrin->num_components;
 
    if (nir_intrinsic_infos[intrin->intrinsic].has_dest)
-      write_dest(ctx, &intrin->dest);
+      write_dest(ctx, &intrin->dest, header);
+   else
+      blob_write_uint32(ctx->blob, header.u32);
 
    for (unsigned i = 0; i < num_srcs; i++)
       write_src(ctx, &intrin->src[i]);
@@ -519,19 +765,18 @@ write_intrinsic(write_ctx *ctx, const nir_intrinsic_instr *intrin)
 }
 
 static nir_intrinsic_instr *
-read_intrinsic(read_ctx *ctx)
+read_intrinsic(read_ctx *ctx, union packed_instr header)
 {
-   nir_intrinsic_op op = blob_read_uint32(ctx->blob);
-
+   nir_intrinsic_op op = header.intrinsic.intrinsic;
    nir_intrinsic_instr *intrin = nir_intrinsic_instr_create(ctx->nir, op);
 
    unsigned num_srcs = nir_intrinsic_infos[op].num_srcs;
    unsigned num_indices = nir_intrinsic_infos[op].num_indices;
 
-   intrin->num_components = blob_read_uint32(ctx->blob);
+   intrin->num_components = header.intrinsic.num_components;
 
    if (nir_intrinsic_infos[op].has_dest)
-      read_dest(ctx, &intrin->dest, &intrin->instr);
+      read_dest(ctx, &intrin->dest, &intrin->instr, header);
 
    for (unsigned i = 0; i < num_srcs; i++)
       read_src(ctx, &intrin->src[i], &intrin->instr);
@@ -542,25 +787,80 @@ read_intrinsic(read_ctx *ctx)
    return intrin;
 }
 
+/* How the value of a load_const is written. */
+enum load_const_packing {
+   /* All the components are written after the header. */
+   load_const_full,
+
+   /* A 32-bit scalar that is a small signed integer, which is in the
+    * header.
+    */
+   load_const_scalar_int_20bit,
+
+   /* A 32-bit scalar whose low 12 bits are zero, like most float constants,
+    * with the high bits in the header.
+    */
+   load_const_scalar_hi_20bits,
+};
+
 static void
 write_load_const(write_ctx *ctx, const nir_load_const_instr *lc)
 {
-   uint32_t val = lc->def.num_components;
-   val |= lc->def.bit_size << 3;
-   blob_write_uint32(ctx->blob, val);
-   blob_write_bytes(ctx->blob, (uint8_t *) &lc->value, sizeof(lc->value));
+   union packed_instr header;
+   header.u32 = 0;
+
+   header.load_const.instr_type = lc->instr.type;
+   header.load_const.num_components = lc->def.num_components;
+   header.load_const.bit_size = encode_bit_size_3bits(lc->def.bit_size);
+
+   if (lc->def.num_components == 1 && lc->def.bit_size == 32) {
+      int32_t i = lc->value.i32[0];
+      uint32_t u = lc->value.u32[0];
+
+      if (i >= -(1 << 19) && i < (1 << 19)) {
+         header.load_const.packing = load_const_scalar_int_20bit;
+         header.load_const.packed_value = i;
+      } else if ((u & 0xfff) == 0) {
+         header.load_const.packing = load_const_scalar_hi_20bits;
+         header.load_const.packed_value = u >> 12;
+      }
+   }
+
+   blob_write_uint32(ctx->blob, header.u32);
+
+   if (header.load_const.packing == load_const_full) {
+      /* Only the components the constant has are worth writing. */
+      blob_write_bytes(ctx->blob, &lc->value,
+                       lc->def.num_components *
+                       DIV_ROUND_UP(lc->def.bit_size, 8));
+   }
+
    write_add_object(ctx, &lc->def);
 }
 
 static nir_load_const_instr *
-read_load_const(read_ctx *ctx)
+read_load_const(read_ctx *ctx, union packed_instr header)
 {
-   uint32_t val = blob_read_uint32(ctx->blob);
-
    nir_load_const_instr *lc =
-      nir_load_const_instr_create(ctx->nir, val & 0x7, val >> 3);
+      nir_load_const_instr_create(ctx->nir, header.load_const.num_components,
+                                  decode_bit_size_3bits(header.load_const.bit_size));
+
+   switch (header.load_const.packing) {
+   case load_const_scalar_int_20bit:
+      /* Sign-extend it. */
+      lc->value.i32[0] =
+         (int32_t)((uint32_t)header.load_const.packed_value << 12) >> 12;
+      break;
+   case load_const_scalar_hi_20bits:
+      lc->value.u32[0] = (uint32_t)header.load_const.packed_value << 12;
+      break;
+   default:
+      blob_copy_bytes(ctx->blob, &lc->value,
+                      lc->def.num_components *
+                      DIV_ROUND_UP(lc->def.bit_size, 8));
+      break;
+   }
 
-   blob_copy_bytes(ctx->blob, (uint8_t *) &lc->value, sizeof(lc->value));
    read_add_object(ctx, &lc->def);
    return lc;
 }
@@ -568,19 +868,23 @@ read_load_const(read_ctx *ctx)
 static void
 write_ssa_undef(write_ctx *ctx, const nir_ssa_undef_instr *undef)
 {
-   uint32_t val = undef->def.num_components;
-   val |= undef->def.bit_size << 3;
-   blob_write_uint32(ctx->blob, val);
+   union packed_instr header;
+   header.u32 = 0;
+
+   header.undef.instr_type = undef->instr.type;
+   header.undef.num_components = undef->def.num_components;
+   header.undef.bit_size = encode_bit_size_3bits(undef->def.bit_size);
+
+   blob_write_uint32(ctx->blob, header.u32);
    write_add_object(ctx, &undef->def);
 }
 
 static nir_ssa_undef_instr *
-read_ssa_undef(read_ctx *ctx)
+read_ssa_undef(read_ctx *ctx, union packed_instr header)
 {
-   uint32_t val = blob_read_uint32(ctx->blob);
-
    nir_ssa_undef_instr *undef =
-      nir_ssa_undef_instr_create(ctx->nir, val & 0x7, val >> 3);
+      nir_ssa_undef_instr_create(ctx->nir, header.undef.num_components,
+                                 decode_bit_size_3bits(header.undef.bit_size));
 
    read_add_object(ctx, &undef->def);
    return undef;
@@ -603,8 +907,18 @@ union packed_tex_data {
 static void
 write_tex(write_ctx *ctx, const nir_tex_instr *tex)
 {
-   blob_write_uint32(ctx->blob, tex->num_srcs);
-   blob_write_uint32(ctx->blob, tex->op);
+   union packed_instr header;
+   header.u32 = 0;
+
+   assert(tex->num_srcs < 16);
+   assert(tex->op < 16);
+
+   header.tex.instr_type = tex->instr.type;
+   header.tex.num_srcs = tex->num_srcs;
+   header.tex.op = tex->op;
+
+   write_dest(ctx, &tex->dest, header);
+
    blob_write_uint32(ctx->blob, tex->texture_index);
    blob_write_uint32(ctx->blob, tex->texture_array_size);
    blob_write_uint32(ctx->blob, tex->sampler_index);
@@ -621,20 +935,22 @@ write_tex(write_ctx *ctx, const nir_tex_instr *tex)
    };
    blob_write_uint32(ctx->blob, packed.u32);
 
-   write_dest(ctx, &tex->dest);
    for (unsigned i = 0; i < tex->num_srcs; i++) {
-      blob_write_uint32(ctx->blob, tex->src[i].src_type);
-      write_src(ctx, &tex->src[i].src);
+      union packed_src src;
+      src.u32 = 0;
+      src.tex.src_type = tex->src[i].src_type;
+      write_src_full(ctx, &tex->src[i].src, src);
    }
 }
 
 static nir_tex_instr *
-read_tex(read_ctx *ctx)
+read_tex(read_ctx *ctx, union packed_instr header)
 {
-   unsigned num_srcs = blob_read_uint32(ctx->blob);
-   nir_tex_instr *tex = nir_tex_instr_create(ctx->nir, num_srcs);
+   nir_tex_instr *tex = nir_tex_instr_create(ctx->nir, header.tex.num_srcs);
+
+   read_dest(ctx, &tex->dest, &tex->instr, header);
 
-   tex->op = blob_read_uint32(ctx->blob);
+   tex->op = header.tex.op;
    tex->texture_index = blob_read_uint32(ctx->blob);
    tex->texture_array_size = blob_read_uint32(ctx->blob);
    tex->sampler_index = blob_read_uint32(ctx->blob);
@@ -649,10 +965,9 @@ read_tex(read_ctx *ctx)
    tex->is_new_style_shadow = packed.u.is_new_style_shadow;
    tex->component = packed.u.component;
 
-   read_dest(ctx, &tex->dest, &tex->instr);
    for (unsigned i = 0; i < tex->num_srcs; i++) {
-      tex->src[i].src_type = blob_read_uint32(ctx->blob);
-      read_src(ctx, &tex->src[i].src, &tex->instr);
+      union packed_src src = read_src(ctx, &tex->src[i].src, &tex->instr);
+      tex->src[i].src_type = src.tex.src_type;
    }
 
    return tex;
@@ -661,20 +976,24 @@ read_tex(read_ctx *ctx)
 static void
 write_phi(write_ctx *ctx, const nir_phi_instr *phi)
 {
+   union packed_instr header;
+   header.u32 = 0;
+
+   header.phi.instr_type = phi->instr.type;
+   header.phi.num_srcs = exec_list_length(&phi->srcs);
+
    /* Phi nodes are special, since they may reference SSA definitions and
-    * basic blocks that don't exist yet. We leave two empty uintptr_t's here,
+    * basic blocks that don't exist yet. We leave two empty uint32_t's here,
     * and then store enough information so that a later fixup pass can fill
     * them in correctly.
     */
-   write_dest(ctx, &phi->dest);
-
-   blob_write_uint32(ctx->blob, exec_list_length(&phi->srcs));
+   write_dest(ctx, &phi->dest, header);
 
    nir_foreach_phi_src(src, phi) {
       assert(src->src.is_ssa);
-      size_t blob_offset = blob_reserve_intptr(ctx->blob);
-      MAYBE_UNUSED size_t blob_offset2 = blob_reserve_intptr(ctx->blob);
-      assert(blob_offset + sizeof(uintptr_t) == blob_offset2);
+      size_t blob_offset = blob_reserve_uint32(ctx->blob);
+      MAYBE_UNUSED size_t blob_offset2 = blob_reserve_uint32(ctx->blob);
+      assert(blob_offset + sizeof(uint32_t) == blob_offset2);
       write_phi_fixup fixup = {
          .blob_offset = blob_offset,
          .src = src->src.ssa,
@@ -688,22 +1007,21 @@ static void
 write_fixup_phis(write_ctx *ctx)
 {
    util_dynarray_foreach(&ctx->phi_fixups, write_phi_fixup, fixup) {
-      uintptr_t *blob_ptr = (uintptr_t *)(ctx->blob->data + fixup->blob_offset);
-      blob_ptr[0] = write_lookup_object(ctx, fixup->src);
-      blob_ptr[1] = write_lookup_object(ctx, fixup->block);
+      blob_overwrite_uint32(ctx->blob, fixup->blob_offset,
+                            write_lookup_object(ctx, fixup->src));
+      blob_overwrite_uint32(ctx->blob, fixup->blob_offset + sizeof(uint32_t),
+                            write_lookup_object(ctx, fixup->block));
    }
 
    util_dynarray_clear(&ctx->phi_fixups);
 }
 
 static nir_phi_instr *
-read_phi(read_ctx *ctx, nir_block *blk)
+read_phi(read_ctx *ctx, nir_block *blk, union packed_instr header)
 {
    nir_phi_instr *phi = nir_phi_instr_create(ctx->nir);
 
-   read_dest(ctx, &phi->dest, &phi->instr);
-
-   unsigned num_srcs = blob_read_uint32(ctx->blob);
+   read_dest(ctx, &phi->dest, &phi->instr, header);
 
    /* For similar reasons as before, we just store the index directly into the
     * pointer, and let a later pass resolve the phi sources.
@@ -715,12 +1033,12 @@ read_phi(read_ctx *ctx, nir_block *blk)
     */
    nir_instr_insert_after_block(blk, &phi->instr);
 
-   for (unsigned i = 0; i < num_srcs; i++) {
+   for (unsigned i = 0; i < header.phi.num_srcs; i++) {
       nir_phi_src *src = ralloc(phi, nir_phi_src);
 
       src->src.is_ssa = true;
-      src->src.ssa = (nir_ssa_def *) blob_read_intptr(ctx->blob);
-      src->pred = (nir_block *) blob_read_intptr(ctx->blob);
+      src->src.ssa = (nir_ssa_def *)(uintptr_t) blob_read_uint32(ctx->blob);
+      src->pred = (nir_block *)(uintptr_t) blob_read_uint32(ctx->blob);
 
       /* Since we're not letting nir_insert_instr handle use/def stuff for us,
        * we have to set the parent_instr manually.  It doesn't really matter
@@ -757,21 +1075,27 @@ read_fixup_phis(read_ctx *ctx)
 static void
 write_jump(write_ctx *ctx, const nir_jump_instr *jmp)
 {
-   blob_write_uint32(ctx->blob, jmp->type);
+   union packed_instr header;
+   header.u32 = 0;
+
+   header.jump.instr_type = jmp->instr.type;
+   header.jump.type = jmp->type;
+
+   blob_write_uint32(ctx->blob, header.u32);
 }
 
 static nir_jump_instr *
-read_jump(read_ctx *ctx)
+read_jump(read_ctx *ctx, union packed_instr header)
 {
-   nir_jump_type type = blob_read_uint32(ctx->blob);
-   nir_jump_instr *jmp = nir_jump_instr_create(ctx->nir, type);
+   nir_jump_instr *jmp = nir_jump_instr_create(ctx->nir, header.jump.type);
    return jmp;
 }
 
 static void
 write_call(write_ctx *ctx, const nir_call_instr *call)
 {
-   blob_write_intptr(ctx->blob, write_lookup_object(ctx, call->callee));
+   blob_write_uint32(ctx->blob, call->instr.type);
+   write_object(ctx, call->callee);
 
    for (unsigned i = 0; i < call->num_params; i++)
       write_src(ctx, &call->params[i]);
@@ -792,7 +1116,7 @@ read_call(read_ctx *ctx)
 static void
 write_instr(write_ctx *ctx, const nir_instr *instr)
 {
-   blob_write_uint32(ctx->blob, instr->type);
+   /* Every instruction starts with a header that has its type. */
    switch (instr->type) {
    case nir_instr_type_alu:
       write_alu(ctx, nir_instr_as_alu(instr));
@@ -831,26 +1155,29 @@ write_instr(write_ctx *ctx, const nir_instr *instr)
 static void
 read_instr(read_ctx *ctx, nir_block *block)
 {
-   nir_instr_type type = blob_read_uint32(ctx->blob);
+   STATIC_ASSERT(sizeof(union packed_instr) == 4);
+   union packed_instr header;
+   header.u32 = blob_read_uint32(ctx->blob);
    nir_instr *instr;
-   switch (type) {
+
+   switch (header.any.instr_type) {
    case nir_instr_type_alu:
-      instr = &read_alu(ctx)->instr;
+      instr = &read_alu(ctx, header)->instr;
       break;
    case nir_instr_type_deref:
-      instr = &read_deref(ctx)->instr;
+      instr = &read_deref(ctx, header)->instr;
       break;
    case nir_instr_type_intrinsic:
-      instr = &read_intrinsic(ctx)->instr;
+      instr = &read_intrinsic(ctx, header)->instr;
       break;
    case nir_instr_type_load_const:
-      instr = &read_load_const(ctx)->instr;
+      instr = &read_load_const(ctx, header)->instr;
       break;
    case nir_instr_type_ssa_undef:
-      instr = &read_ssa_undef(ctx)->instr;
+      instr = &read_ssa_undef(ctx, header)->instr;
       break;
    case nir_instr_type_tex:
-      instr = &read_tex(ctx)->instr;
+      instr = &read_tex(ctx, header)->instr;
       break;
    case nir_instr_type_phi:
       /* Phi instructions are a bit of a special case when reading because we
@@ -858,10 +1185,10 @@ read_instr(read_ctx *ctx, nir_block *block)
        * for us.  Instead, we need to wait until all the blocks/instructions
        * are read so that we can set their sources up.
        */
-      read_phi(ctx, block);
+      read_phi(ctx, block, header);
       return;
    case nir_instr_type_jump:
-      instr = &read_jump(ctx)->instr;
+      instr = &read_jump(ctx, header)->instr;
       break;
    case nir_instr_type_call:
       instr = &read_call(ctx)->instr;
@@ -1088,7 +1415,7 @@ nir_serialize(struct blob *blob, const nir_shader *nir)
    ctx.nir = nir;
    util_dynarray_init(&ctx.phi_fixups, NULL);
 
-   size_t idx_size_offset = blob_reserve_intptr(blob);
+   size_t idx_size_offset = blob_reserve_uint32(blob);
 
    struct shader_info info = nir->info;
    uint32_t strings = 0;
@@ -1131,7 +1458,7 @@ nir_serialize(struct blob *blob, const nir_shader *nir)
    if (nir->constant_data_size > 0)
       blob_write_bytes(blob, nir->constant_data, nir->constant_data_size);
 
-   *(uintptr_t *)(blob->data + idx_size_offset) = ctx.next_idx;
+   blob_overwrite_uint32(blob, idx_size_offset, ctx.next_idx);
 
    _mesa_hash_table_destroy(ctx.remap_table, NULL);
    util_dynarray_fini(&ctx.phi_fixups);
@@ -1145,7 +1472,7 @@ nir_deserialize(void *mem_ctx,
    read_ctx ctx;
    ctx.blob = blob;
    list_inithead(&ctx.phi_srcs);
-   ctx.idx_table_len = blob_read_intptr(blob);
+   ctx.idx_table_len = blob_read_uint32(blob);
    ctx.idx_table = calloc(ctx.idx_table_len, sizeof(uintptr_t));
    ctx.next_idx = 0;
 
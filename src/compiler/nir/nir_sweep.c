@@ -72,6 +72,9 @@ sweep_block(nir_shader *nir, nir_block *block)
    ralloc_free(block->live_out);
    block->live_out = NULL;
 
+   ralloc_free(block->dom_children);
+   block->dom_children = NULL;
+
    nir_foreach_instr(instr, block) {
       ralloc_steal(nir, instr);
 
@@ -136,7 +139,11 @@ sweep_impl(nir_shader *nir, nir_function_impl *impl)
 
    sweep_block(nir, impl->end_block);
 
-   /* Wipe out all the metadata, if any. */
+   /* Wipe out all the metadata, if any.  The dominance tree was allocated
+    * out of the old context, so it has to go even though the CFG didn't
+    * change.
+    */
+   nir_metadata_invalidate_cfg(impl);
    nir_metadata_preserve(impl, nir_metadata_none);
 }
 
@@ -1074,6 +1074,84 @@ postvalidate_ssa_def(nir_ssa_def *def, void *void_state)
    return true;
 }
 
+/* Returns the nearest common dominator of two blocks, both of which have to
+ * be reachable, the same way nir_calc_dominance_impl() does.
+ */
+static nir_block *
+dominance_intersect(nir_block *b1, nir_block *b2)
+{
+   while (b1 != b2) {
+      while (b1->index > b2->index)
+         b1 = b1->imm_dom;
+      while (b2->index > b1->index)
+         b2 = b2->imm_dom;
+   }
+
+   return b1;
+}
+
+/* nir_metadata_preserve() keeps the block indices and dominance of passes
+ * that don't touch the CFG, so make sure they still match it.
+ */
+static void
+validate_cfg_metadata(nir_function_impl *impl, validate_state *state)
+{
+   if (!(impl->valid_metadata & nir_metadata_block_index))
+      return;
+
+   struct set *blocks = _mesa_pointer_set_create(NULL);
+   unsigned index = 0;
+   bool indices_ok = true;
+
+   nir_foreach_block(block, impl) {
+      indices_ok &= block->index == index++;
+      _mesa_set_add(blocks, block);
+   }
+   validate_assert(state, indices_ok && impl->num_blocks == index);
+
+   if (!indices_ok || !(impl->valid_metadata & nir_metadata_dominance)) {
+      _mesa_set_destroy(blocks, NULL);
+      return;
+   }
+
+   /* Every immediate dominator has to be a block of the function that comes
+    * before the block, or following them below might not terminate.
+    */
+   nir_block *start = nir_start_block(impl);
+   bool tree_ok = start->imm_dom == NULL;
+   nir_foreach_block(block, impl) {
+      if (block != start && block->imm_dom) {
+         tree_ok &= _mesa_set_search(blocks, block->imm_dom) &&
+                    block->imm_dom->index < block->index;
+      }
+   }
+   validate_assert(state, tree_ok);
+
+   /* The immediate dominator of a block is the nearest common dominator of
+    * its reachable predecessors, which is what nir_calc_dominance_impl()
+    * iterates to.
+    */
+   if (tree_ok) {
+      nir_foreach_block(block, impl) {
+         if (block == start)
+            continue;
+
+         nir_block *idom = NULL;
+         set_foreach(block->predecessors, entry) {
+            nir_block *pred = (nir_block *) entry->key;
+
+            if (pred != start && pred->imm_dom == NULL)
+               continue;
+
+            idom = idom ? dominance_intersect(pred, idom) : pred;
+         }
+         validate_assert(state, block->imm_dom == idom);
+      }
+   }
+
+   _mesa_set_destroy(blocks, NULL);
+}
+
 static void
 validate_function_impl(nir_function_impl *impl, validate_state *state)
 {
@@ -1120,6 +1198,8 @@ validate_function_impl(nir_function_impl *impl, validate_state *state)
       nir_foreach_instr(instr, block)
          nir_foreach_ssa_def(instr, postvalidate_ssa_def, state);
    }
+
+   validate_cfg_metadata(impl, state);
 }
 
 static void
@@ -0,0 +1,218 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * Times the algebraic passes over a corpus of shaders.
+ *
+ * Usage: nir_algebraic_benchmark [dump...]
+ *
+ * The dumps are the files the algebraic passes write for every shader they
+ * run on when NIR_ALGEBRAIC_DUMP_DIR is set.  Each one is run through the
+ * pass that wrote it.  Without any, the benchmark makes up shaders full of
+ * scalar arithmetic and runs them through nir_opt_algebraic.
+ *
+ * Every shader is run through its pass a few times, each time on a fresh
+ * clone, and the best time of each pass over the whole corpus is printed,
+ * along with the time per ALU instruction.
+ */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nir_benchmark_util.h"
+#include "util/os_time.h"
+
+#define NUM_RUNS 5
+
+static const struct {
+   const char *name;
+   bool (*pass)(nir_shader *shader);
+} passes[] = {
+   { "nir_opt_algebraic", nir_opt_algebraic },
+   { "nir_opt_algebraic_before_ffma", nir_opt_algebraic_before_ffma },
+   { "nir_opt_algebraic_late", nir_opt_algebraic_late },
+};
+
+struct pass_stats {
+   unsigned num_shaders;
+   unsigned num_alu;
+   unsigned num_progress;
+   int64_t time[NUM_RUNS];
+};
+
+static struct pass_stats stats[ARRAY_SIZE(passes)];
+
+static bool
+is_alu(const nir_instr *instr)
+{
+   return instr->type == nir_instr_type_alu;
+}
+
+static bool
+run_shader(nir_shader *shader, const char *path)
+{
+   unsigned pass = 0;
+
+   /* A dump is named after the pass that wrote it. */
+   if (path) {
+      const char *name = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+
+      for (pass = 0; pass < ARRAY_SIZE(passes); pass++) {
+         size_t len = strlen(passes[pass].name);
+         if (!strncmp(name, passes[pass].name, len) && name[len] == '-')
+            break;
+      }
+      if (pass >= ARRAY_SIZE(passes)) {
+         fprintf(stderr, "%s: not written by an algebraic pass\n", path);
+         return false;
+      }
+   }
+
+   struct pass_stats *s = &stats[pass];
+
+   s->num_shaders++;
+   s->num_alu += nir_benchmark_count_instrs(shader, is_alu);
+
+   for (unsigned run = 0; run < NUM_RUNS; run++) {
+      nir_shader *clone = nir_shader_clone(NULL, shader);
+      int64_t start = os_time_get_nano();
+      bool progress = passes[pass].pass(clone);
+
+      s->time[run] += os_time_get_nano() - start;
+      if (run == 0)
+         s->num_progress += progress;
+
+      ralloc_free(clone);
+   }
+
+   return true;
+}
+
+/* Picks one of the last few values, like real code mostly does. */
+static nir_ssa_def *
+pick(nir_ssa_def **values, unsigned count)
+{
+   unsigned window = MIN2(count, 16);
+   return values[count - 1 - rand() % window];
+}
+
+/**
+ * Makes up a fragment shader that computes its output from its inputs and
+ * some constants with the kind of scalar float, integer and boolean math
+ * that nir_opt_algebraic has the most patterns for.
+ */
+static nir_shader *
+make_shader(void *mem_ctx, const nir_shader_compiler_options *options)
+{
+   unsigned num_alu = 50 + rand() % 2000;
+   static const float float_consts[] = { 0.0, 1.0, -1.0, 0.5, 2.0, 4.0 };
+   static const int int_consts[] = { 0, 1, -1, 2, 31, 0xff, 0xffff };
+   nir_ssa_def **floats = ralloc_array(mem_ctx, nir_ssa_def *, num_alu + 8);
+   nir_ssa_def **ints = ralloc_array(mem_ctx, nir_ssa_def *, num_alu + 8);
+   nir_ssa_def **bools = ralloc_array(mem_ctx, nir_ssa_def *, num_alu + 8);
+   unsigned num_floats = 0, num_ints = 0, num_bools = 0;
+   nir_builder b;
+
+   nir_builder_init_simple_shader(&b, mem_ctx, MESA_SHADER_FRAGMENT, options);
+
+   for (unsigned i = 0; i < 4; i++)
+      floats[num_floats++] = nir_benchmark_load_input(&b, glsl_float_type(), i);
+   ints[num_ints++] = nir_f2i32(&b, floats[0]);
+   ints[num_ints++] = nir_f2u32(&b, floats[1]);
+   bools[num_bools++] = nir_flt(&b, floats[2], floats[3]);
+
+   for (unsigned i = 0; i < num_alu; i++) {
+      nir_ssa_def *f0 = rand() % 4 ? pick(floats, num_floats) :
+         nir_imm_float(&b, float_consts[rand() % ARRAY_SIZE(float_consts)]);
+      nir_ssa_def *f1 = rand() % 4 ? pick(floats, num_floats) :
+         nir_imm_float(&b, float_consts[rand() % ARRAY_SIZE(float_consts)]);
+      nir_ssa_def *i0 = rand() % 4 ? pick(ints, num_ints) :
+         nir_imm_int(&b, int_consts[rand() % ARRAY_SIZE(int_consts)]);
+      nir_ssa_def *i1 = rand() % 4 ? pick(ints, num_ints) :
+         nir_imm_int(&b, int_consts[rand() % ARRAY_SIZE(int_consts)]);
+      nir_ssa_def *f2 = pick(floats, num_floats);
+      nir_ssa_def *c = pick(bools, num_bools);
+
+      switch (rand() % 24) {
+      case 0: floats[num_floats++] = nir_fadd(&b, f0, f1); break;
+      case 1: floats[num_floats++] = nir_fmul(&b, f0, f1); break;
+      case 2: floats[num_floats++] = nir_fneg(&b, f0); break;
+      case 3: floats[num_floats++] = nir_fabs(&b, f0); break;
+      case 4: floats[num_floats++] = nir_fsat(&b, f0); break;
+      case 5: floats[num_floats++] = nir_fmin(&b, f0, f1); break;
+      case 6: floats[num_floats++] = nir_fmax(&b, f0, f1); break;
+      case 7: floats[num_floats++] = nir_bcsel(&b, c, f0, f1); break;
+      case 8: floats[num_floats++] = nir_b2f32(&b, c); break;
+      case 9: floats[num_floats++] = nir_frcp(&b, f0); break;
+      case 10: floats[num_floats++] = nir_fsqrt(&b, f0); break;
+      case 11: floats[num_floats++] = nir_i2f32(&b, i0); break;
+      case 12: floats[num_floats++] = nir_ffma(&b, f0, f1, f2); break;
+      case 13: ints[num_ints++] = nir_iadd(&b, i0, i1); break;
+      case 14: ints[num_ints++] = nir_iand(&b, i0, i1); break;
+      case 15: ints[num_ints++] = nir_ior(&b, i0, i1); break;
+      case 16: ints[num_ints++] = nir_ishl(&b, i0, i1); break;
+      case 17: ints[num_ints++] = nir_ushr(&b, i0, i1); break;
+      case 18: ints[num_ints++] = nir_imul(&b, i0, i1); break;
+      case 19: ints[num_ints++] = nir_bcsel(&b, c, i0, i1); break;
+      case 20: bools[num_bools++] = nir_flt(&b, f0, f1); break;
+      case 21: bools[num_bools++] = nir_fge(&b, f0, f1); break;
+      case 22: bools[num_bools++] = nir_ieq(&b, i0, i1); break;
+      case 23: bools[num_bools++] = nir_inot(&b, c); break;
+      }
+   }
+
+   nir_benchmark_store_output(&b, nir_vec4(&b, pick(floats, num_floats),
+                                           nir_i2f32(&b, pick(ints, num_ints)),
+                                           nir_b2f32(&b, pick(bools, num_bools)),
+                                           floats[num_floats / 2]));
+
+   return b.shader;
+}
+
+int
+main(int argc, char **argv)
+{
+   if (!nir_benchmark_run_corpus((const char *const *)argv + 1, argc - 1,
+                                 run_shader, make_shader, NULL, 200))
+      return 1;
+
+   for (unsigned pass = 0; pass < ARRAY_SIZE(passes); pass++) {
+      const struct pass_stats *s = &stats[pass];
+
+      if (!s->num_shaders)
+         continue;
+
+      int64_t best = nir_benchmark_best_time(s->time, NUM_RUNS);
+
+      printf("%s: %u shaders, %u ALU instructions, progress on %u\n"
+             "  %.3f ms, %.1f ns per ALU instruction\n",
+             passes[pass].name, s->num_shaders, s->num_alu, s->num_progress,
+             best / 1e6, (double)best / s->num_alu);
+   }
+
+   return 0;
+}
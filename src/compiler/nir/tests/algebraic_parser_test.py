@@ -26,7 +26,7 @@ import sys
 import os
 sys.path.insert(1, os.path.join(sys.path[0], '..'))
 
-from nir_algebraic import SearchAndReplace
+from nir_algebraic import SearchAndReplace, TreeAutomaton
 
 # These tests check that the bitsize validator correctly rejects various
 # different kinds of malformed expressions, and documents what the error
@@ -113,4 +113,70 @@ class ValidatorTests(unittest.TestCase):
             "The search expression bit size ('b2i', ('i2b', 'a')) and " \
             "replace expression bit size a may not be the same")
 
+# These tests check that the automaton picks the right search expressions to
+# try for an instruction.  Instructions are given as trees, where 'x' is a
+# value that isn't constant and 'const' is a load_const.
+
+class AutomatonTests(unittest.TestCase):
+    def state(self, automaton, instr):
+        if instr == 'x':
+            return 0
+        elif instr == 'const':
+            return 1
+
+        op = instr[0]
+        if op not in automaton.filter:
+            return 0
+
+        index = 0
+        for src in instr[1:]:
+            index = index * len(automaton.filtered_states[op]) + \
+                    automaton.filter[op][self.state(automaton, src)]
+        return automaton.flat_table[op][index]
+
+    def matches(self, xforms, instr):
+        automaton = TreeAutomaton(xforms)
+        state = self.state(automaton, instr)
+        return [xforms.index(xform) for xform in automaton.state_xforms[state]]
+
+    def test_wildcard(self):
+        xforms = [SearchAndReplace((('fneg', ('fneg', a)), a))]
+        self.assertEqual(self.matches(xforms, ('fneg', ('fneg', 'x'))), [0])
+        self.assertEqual(self.matches(xforms, ('fneg', ('fneg', 'const'))), [0])
+        self.assertEqual(self.matches(xforms, ('fneg', 'x')), [])
+        self.assertEqual(self.matches(xforms, ('fneg', ('fabs', 'x'))), [])
+
+    def test_constant(self):
+        xforms = [SearchAndReplace((('iadd', a, 0), a)),
+                  SearchAndReplace((('ishl', a, '#b'), ('ishl', a, b)))]
+        self.assertEqual(self.matches(xforms, ('iadd', 'x', 'const')), [0])
+        self.assertEqual(self.matches(xforms, ('iadd', 'x', 'x')), [])
+        self.assertEqual(self.matches(xforms, ('ishl', 'x', 'const')), [1])
+        self.assertEqual(self.matches(xforms, ('ishl', 'const', 'x')), [])
+
+    def test_commutative(self):
+        xforms = [SearchAndReplace((('fmul', ('fadd', a, b), 0.0), 0.0))]
+        self.assertEqual(
+            self.matches(xforms, ('fmul', 'const', ('fadd', 'x', 'x'))), [0])
+        self.assertEqual(
+            self.matches(xforms, ('fmul', ('fadd', 'x', 'x'), 'const')), [0])
+        self.assertEqual(
+            self.matches(xforms, ('fmul', ('fadd', 'x', 'x'), 'x')), [])
+
+    def test_conversion(self):
+        xforms = [SearchAndReplace((('f2i', ('ffloor', a)), ('f2i', a)))]
+        self.assertEqual(self.matches(xforms, ('f2i32', ('ffloor', 'x'))), [0])
+        self.assertEqual(self.matches(xforms, ('f2i64', ('ffloor', 'x'))), [0])
+        self.assertEqual(self.matches(xforms, ('f2u32', ('ffloor', 'x'))), [])
+
+    def test_order(self):
+        xforms = [SearchAndReplace((('iand', a, a), a)),
+                  SearchAndReplace((('iand', a, 0), 0)),
+                  SearchAndReplace((('iand', a, ('inot', a)), 0)),
+                  SearchAndReplace((('iand', a, ~0), a))]
+        self.assertEqual(self.matches(xforms, ('iand', 'const', 'x')),
+                         [0, 1, 3])
+        self.assertEqual(self.matches(xforms, ('iand', ('inot', 'x'), 'x')),
+                         [0, 2])
+
 unittest.main()
@@ -146,3 +146,53 @@ TEST_F(nir_cf_test, delete_break_in_loop)
 
    nir_metadata_require(b.impl, nir_metadata_dominance);
 }
+
+TEST_F(nir_cf_test, preserve_cfg_metadata)
+{
+   nir_ssa_def *x = nir_imm_float(&b, 1.0);
+   nir_ssa_def *y = nir_fadd(&b, x, x);
+   nir_ssa_def *unused = nir_fsub(&b, x, y);
+   nir_push_if(&b, nir_flt(&b, x, y));
+   nir_fmul(&b, x, y);
+   nir_pop_if(&b, NULL);
+
+   const nir_metadata cfg_metadata = (nir_metadata)
+      (nir_metadata_block_index | nir_metadata_dominance);
+   nir_metadata_require(b.impl, cfg_metadata);
+
+   /* A pass that only touches instructions keeps the dominance even if it
+    * doesn't say so.
+    */
+   nir_instr_remove(unused->parent_instr);
+   nir_metadata_preserve(b.impl, nir_metadata_none);
+   EXPECT_EQ(cfg_metadata, b.impl->valid_metadata);
+
+   /* Changing the CFG throws it away. */
+   nir_push_if(&b, nir_imm_true(&b));
+   nir_pop_if(&b, NULL);
+   nir_metadata_preserve(b.impl, nir_metadata_none);
+   EXPECT_EQ(nir_metadata_none, b.impl->valid_metadata);
+
+   nir_metadata_require(b.impl, nir_metadata_dominance);
+   nir_validate_shader(b.shader, "after recomputing the dominance");
+}
+
+TEST_F(nir_cf_test, index_ssa_defs_keeps_unchanged_liveness)
+{
+   nir_ssa_def *a = nir_imm_float(&b, 1.0);
+   nir_ssa_def *c = nir_fadd(&b, a, a);
+   nir_fmul(&b, c, c);
+
+   nir_index_ssa_defs(b.impl);
+   nir_metadata_require(b.impl, nir_metadata_live_ssa_defs);
+
+   /* Nothing moved, so the live sets still apply. */
+   nir_index_ssa_defs(b.impl);
+   EXPECT_TRUE(b.impl->valid_metadata & nir_metadata_live_ssa_defs);
+
+   /* A def that goes before the others renumbers them. */
+   b.cursor = nir_before_instr(a->parent_instr);
+   nir_imm_float(&b, 2.0);
+   nir_index_ssa_defs(b.impl);
+   EXPECT_FALSE(b.impl->valid_metadata & nir_metadata_live_ssa_defs);
+}
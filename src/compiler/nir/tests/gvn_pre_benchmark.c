@@ -0,0 +1,347 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * Measures what nir_opt_gvn_pre does to a corpus of shaders.
+ *
+ * Usage: nir_gvn_pre_benchmark [dump...]
+ *
+ * The dumps are the files written by the algebraic passes when
+ * NIR_ALGEBRAIC_DUMP_DIR is set.  Without any, the benchmark makes up
+ * shaders that compute texture coordinates and uniform addresses in both
+ * branches of ifs, after ifs and inside loops, the way shaders do after
+ * inlining.
+ *
+ * Every shader is optimized with the st_nir_opts pass list, once as it is
+ * and once with nir_opt_gvn_pre added to it.  The instruction counts are
+ * printed the way shader-db's report.py prints them, for the whole shader
+ * and for the instructions inside loops, along with the best time of each
+ * over a few runs.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nir_benchmark_util.h"
+#include "util/os_time.h"
+
+#define NUM_RUNS 3
+
+struct instr_stats {
+   unsigned total;
+   unsigned in_loops;
+};
+
+static unsigned num_shaders;
+static struct nir_benchmark_report total_report, loop_report;
+static int64_t base_time[NUM_RUNS], gvn_pre_time[NUM_RUNS];
+
+/* Without loop unrolling, which would take the loops away. */
+static nir_shader *
+optimize_base(nir_shader *nir)
+{
+   nir_benchmark_optimize(nir);
+
+   return nir;
+}
+
+static nir_shader *
+optimize_gvn_pre(nir_shader *nir)
+{
+   bool progress;
+
+   do {
+      progress = false;
+      NIR_BENCHMARK_OPT_LOOP_BODY(NIR_BENCHMARK_OPT, NIR_BENCHMARK_OPT_V)
+      NIR_BENCHMARK_OPT(nir_opt_gvn_pre);
+   } while (progress);
+
+   return nir;
+}
+
+static void
+count_cf_list(struct exec_list *list, bool in_loop, struct instr_stats *stats)
+{
+   foreach_list_typed(nir_cf_node, node, node, list) {
+      switch (node->type) {
+      case nir_cf_node_block:
+         nir_foreach_instr(instr, nir_cf_node_as_block(node)) {
+            stats->total++;
+            stats->in_loops += in_loop;
+         }
+         break;
+
+      case nir_cf_node_if: {
+         nir_if *nif = nir_cf_node_as_if(node);
+         count_cf_list(&nif->then_list, in_loop, stats);
+         count_cf_list(&nif->else_list, in_loop, stats);
+         break;
+      }
+
+      case nir_cf_node_loop:
+         count_cf_list(&nir_cf_node_as_loop(node)->body, true, stats);
+         break;
+
+      default:
+         unreachable("Invalid CF node type");
+      }
+   }
+}
+
+static struct instr_stats
+count_instrs(nir_shader *shader)
+{
+   struct instr_stats stats = { 0 };
+
+   nir_foreach_function(function, shader) {
+      if (function->impl)
+         count_cf_list(&function->impl->body, false, &stats);
+   }
+
+   return stats;
+}
+
+static int64_t
+time_optimize(nir_shader *shader, nir_shader *(*optimize)(nir_shader *),
+              struct instr_stats *stats)
+{
+   nir_shader *clone = nir_shader_clone(NULL, shader);
+   int64_t start = os_time_get_nano();
+
+   clone = optimize(clone);
+
+   int64_t time = os_time_get_nano() - start;
+   if (stats)
+      *stats = count_instrs(clone);
+   ralloc_free(clone);
+
+   return time;
+}
+
+static bool
+run_shader(nir_shader *shader, const char *path)
+{
+   struct instr_stats base, gvn_pre;
+
+   num_shaders++;
+
+   for (unsigned run = 0; run < NUM_RUNS; run++) {
+      base_time[run] +=
+         time_optimize(shader, optimize_base, run ? NULL : &base);
+      gvn_pre_time[run] +=
+         time_optimize(shader, optimize_gvn_pre, run ? NULL : &gvn_pre);
+   }
+
+   nir_benchmark_report_add(&total_report, base.total, gvn_pre.total);
+   nir_benchmark_report_add(&loop_report, base.in_loops, gvn_pre.in_loops);
+
+   return true;
+}
+
+struct shader_gen {
+   nir_builder b;
+   nir_ssa_def *inputs[4];
+   nir_variable *acc[4];
+};
+
+/**
+ * Emits one of a few pieces of math that shaders repeat on different
+ * paths: a texture coordinate scaled and biased by uniforms, an element of
+ * a uniform array, and a falloff factor.  The same kind and arguments give
+ * the same instructions.
+ */
+static nir_ssa_def *
+make_value(struct shader_gen *gen, unsigned kind, unsigned arg)
+{
+   nir_builder *b = &gen->b;
+   nir_ssa_def *in = gen->inputs[arg % 4];
+
+   switch (kind % 3) {
+   case 0: {
+      nir_ssa_def *scale =
+         nir_benchmark_load_uniform(b, nir_imm_int(b, 16 * arg));
+      nir_ssa_def *bias =
+         nir_benchmark_load_uniform(b, nir_imm_int(b, 16 * arg + 4));
+      return nir_fadd(b, nir_fmul(b, in, scale), bias);
+   }
+
+   case 1: {
+      nir_ssa_def *index = nir_f2i32(b, in);
+      nir_ssa_def *offset =
+         nir_iadd(b, nir_imul(b, index, nir_imm_int(b, 64)),
+                  nir_imm_int(b, 4 * arg));
+      return nir_benchmark_load_uniform(b, offset);
+   }
+
+   case 2: {
+      nir_ssa_def *d = nir_fsub(b, in, gen->inputs[(arg + 1) % 4]);
+      nir_ssa_def *att = nir_frcp(b, nir_fadd(b, nir_fmul(b, d, d),
+                                              nir_imm_float(b, 1.0)));
+      return nir_fmul(b, att, nir_fsat(b, in));
+   }
+
+   default:
+      unreachable("Invalid value kind");
+   }
+}
+
+/* Math nobody else computes, so branches are too big to flatten. */
+static nir_ssa_def *
+make_filler(struct shader_gen *gen, nir_ssa_def *x, unsigned count)
+{
+   nir_builder *b = &gen->b;
+
+   for (unsigned i = 0; i < count; i++) {
+      nir_ssa_def *y = gen->inputs[rand() % 4];
+      switch (rand() % 4) {
+      case 0: x = nir_fadd(b, x, y); break;
+      case 1: x = nir_fmul(b, x, y); break;
+      case 2: x = nir_fmax(b, x, nir_fneg(b, y)); break;
+      case 3: x = nir_fsqrt(b, nir_fabs(b, x)); break;
+      }
+   }
+
+   return x;
+}
+
+static void
+accumulate(struct shader_gen *gen, nir_ssa_def *value)
+{
+   nir_variable *acc = gen->acc[rand() % 4];
+   nir_store_var(&gen->b, acc, nir_fadd(&gen->b, nir_load_var(&gen->b, acc),
+                                        value), 0x1);
+}
+
+static void
+make_code(struct shader_gen *gen, unsigned depth, unsigned count)
+{
+   nir_builder *b = &gen->b;
+
+   for (unsigned i = 0; i < count; i++) {
+      unsigned kind = rand(), arg = rand() % 8;
+
+      switch (depth > 0 ? rand() % 5 : 0) {
+      case 0:
+         accumulate(gen, make_value(gen, kind, arg));
+         break;
+
+      case 1:
+      case 2: {
+         /* Sometimes the branches agree, sometimes only the code after
+          * the if shares with one of them, and sometimes nothing does.
+          */
+         unsigned shape = rand() % 4;
+
+         nir_push_if(b, nir_flt(b, gen->inputs[rand() % 4],
+                                nir_imm_float(b, 0.5)));
+         accumulate(gen, make_filler(gen, make_value(gen, kind, arg),
+                                     4 + rand() % 8));
+         if (rand() % 2)
+            make_code(gen, depth - 1, 1 + rand() % 2);
+         nir_push_else(b, NULL);
+         if (shape == 0 || shape == 1) {
+            accumulate(gen, make_filler(gen, make_value(gen, kind, arg),
+                                        4 + rand() % 8));
+         } else {
+            accumulate(gen, make_filler(gen, make_value(gen, kind + 1, arg),
+                                        4 + rand() % 8));
+         }
+         nir_pop_if(b, NULL);
+
+         if (shape == 1 || shape == 2)
+            accumulate(gen, make_value(gen, kind, arg));
+         break;
+      }
+
+      case 3:
+      case 4: {
+         nir_variable *counter =
+            nir_local_variable_create(b->impl, glsl_float_type(), "i");
+         nir_store_var(b, counter, nir_imm_float(b, 0.0), 0x1);
+
+         nir_loop *loop = nir_push_loop(b);
+         nir_ssa_def *i = nir_load_var(b, counter);
+         nir_push_if(b, nir_fge(b, i, gen->inputs[rand() % 4]));
+         nir_jump(b, nir_jump_break);
+         nir_pop_if(b, NULL);
+
+         /* Something the same on every iteration, and something not. */
+         nir_ssa_def *value = make_value(gen, kind, arg);
+         accumulate(gen, nir_fmul(b, value, i));
+         make_code(gen, depth - 1, 1 + rand() % 3);
+
+         nir_store_var(b, counter, nir_fadd(b, i, nir_imm_float(b, 1.0)),
+                       0x1);
+         nir_pop_loop(b, loop);
+         break;
+      }
+      }
+   }
+}
+
+static nir_shader *
+make_shader(void *mem_ctx, const nir_shader_compiler_options *options)
+{
+   unsigned count = 4 + rand() % 12;
+   struct shader_gen gen;
+   nir_builder *b = &gen.b;
+
+   nir_builder_init_simple_shader(b, mem_ctx, MESA_SHADER_FRAGMENT, options);
+
+   for (unsigned i = 0; i < 4; i++) {
+      gen.inputs[i] = nir_benchmark_load_input(b, glsl_float_type(), i);
+
+      gen.acc[i] = nir_local_variable_create(b->impl, glsl_float_type(),
+                                             "acc");
+      nir_store_var(b, gen.acc[i], nir_imm_float(b, 0.0), 0x1);
+   }
+
+   make_code(&gen, 3, count);
+
+   nir_benchmark_store_output(b, nir_vec4(b, nir_load_var(b, gen.acc[0]),
+                                          nir_load_var(b, gen.acc[1]),
+                                          nir_load_var(b, gen.acc[2]),
+                                          nir_load_var(b, gen.acc[3])));
+
+   return b->shader;
+}
+
+int
+main(int argc, char **argv)
+{
+   if (!nir_benchmark_run_corpus((const char *const *)argv + 1, argc - 1,
+                                 run_shader, make_shader, NULL, 200))
+      return 1;
+
+   int64_t base = nir_benchmark_best_time(base_time, NUM_RUNS);
+   int64_t gvn_pre = nir_benchmark_best_time(gvn_pre_time, NUM_RUNS);
+
+   printf("%u shaders\n\n", num_shaders);
+   nir_benchmark_report_print("instructions", &total_report);
+   nir_benchmark_report_print("loop instructions", &loop_report);
+   printf("optimization time: %.3f ms -> %.3f ms (%.1f%%)\n",
+          base / 1e6, gvn_pre / 1e6, 100.0 * (gvn_pre - base) / base);
+
+   return 0;
+}
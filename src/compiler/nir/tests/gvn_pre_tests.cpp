@@ -0,0 +1,266 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include <gtest/gtest.h>
+#include "nir.h"
+#include "nir_builder.h"
+
+namespace {
+
+class nir_gvn_pre_test : public ::testing::Test {
+protected:
+   nir_gvn_pre_test();
+   ~nir_gvn_pre_test();
+
+   nir_ssa_def *load_input(unsigned index);
+   void store_output(nir_ssa_def *value);
+   nir_ssa_def *load_uniform(unsigned offset);
+
+   unsigned count_instrs(nir_instr_type type);
+   nir_alu_instr *get_alu(nir_op op, unsigned index);
+
+   nir_builder b;
+   nir_ssa_def *x, *y;
+   unsigned num_outputs;
+};
+
+nir_gvn_pre_test::nir_gvn_pre_test()
+{
+   static const nir_shader_compiler_options options = { };
+   nir_builder_init_simple_shader(&b, NULL, MESA_SHADER_FRAGMENT, &options);
+
+   num_outputs = 0;
+   x = load_input(0);
+   y = load_input(1);
+}
+
+nir_gvn_pre_test::~nir_gvn_pre_test()
+{
+   if (HasFailure()) {
+      printf("\nShader from the failed test:\n\n");
+      nir_print_shader(b.shader, stdout);
+   }
+
+   ralloc_free(b.shader);
+}
+
+nir_ssa_def *
+nir_gvn_pre_test::load_input(unsigned index)
+{
+   nir_variable *in = nir_variable_create(b.shader, nir_var_shader_in,
+                                          glsl_float_type(), "in");
+   in->data.location = VARYING_SLOT_VAR0 + index;
+   return nir_load_var(&b, in);
+}
+
+void
+nir_gvn_pre_test::store_output(nir_ssa_def *value)
+{
+   nir_variable *out = nir_variable_create(b.shader, nir_var_shader_out,
+                                           glsl_float_type(), "out");
+   out->data.location = FRAG_RESULT_DATA0 + num_outputs++;
+   nir_store_var(&b, out, value, 0x1);
+}
+
+nir_ssa_def *
+nir_gvn_pre_test::load_uniform(unsigned offset)
+{
+   nir_intrinsic_instr *load =
+      nir_intrinsic_instr_create(b.shader, nir_intrinsic_load_uniform);
+   load->num_components = 1;
+   load->src[0] = nir_src_for_ssa(nir_imm_int(&b, offset));
+   nir_ssa_dest_init(&load->instr, &load->dest, 1, 32, NULL);
+   nir_builder_instr_insert(&b, &load->instr);
+   return &load->dest.ssa;
+}
+
+unsigned
+nir_gvn_pre_test::count_instrs(nir_instr_type type)
+{
+   unsigned count = 0;
+   nir_foreach_block(block, b.impl) {
+      nir_foreach_instr(instr, block)
+         count += instr->type == type;
+   }
+   return count;
+}
+
+nir_alu_instr *
+nir_gvn_pre_test::get_alu(nir_op op, unsigned index)
+{
+   nir_foreach_block(block, b.impl) {
+      nir_foreach_instr(instr, block) {
+         if (instr->type != nir_instr_type_alu ||
+             nir_instr_as_alu(instr)->op != op)
+            continue;
+         if (index == 0)
+            return nir_instr_as_alu(instr);
+         index--;
+      }
+   }
+   return NULL;
+}
+
+} // namespace
+
+TEST_F(nir_gvn_pre_test, hoist_from_both_branches)
+{
+   nir_push_if(&b, nir_flt(&b, x, y));
+   store_output(nir_fmul(&b, nir_fadd(&b, x, y), x));
+   nir_push_else(&b, NULL);
+   store_output(nir_fneg(&b, nir_fmul(&b, nir_fadd(&b, x, y), x)));
+   nir_pop_if(&b, NULL);
+
+   ASSERT_TRUE(nir_opt_gvn_pre(b.shader));
+   nir_validate_shader(b.shader, NULL);
+
+   /* The chain is moved a link at a time. */
+   ASSERT_EQ(count_instrs(nir_instr_type_alu), 4);
+   EXPECT_EQ(get_alu(nir_op_fadd, 0)->instr.block, nir_start_block(b.impl));
+   EXPECT_EQ(get_alu(nir_op_fmul, 0)->instr.block, nir_start_block(b.impl));
+   EXPECT_NE(get_alu(nir_op_fneg, 0)->instr.block, nir_start_block(b.impl));
+}
+
+TEST_F(nir_gvn_pre_test, different_values_stay)
+{
+   nir_push_if(&b, nir_flt(&b, x, y));
+   store_output(nir_fadd(&b, x, y));
+   nir_push_else(&b, NULL);
+   store_output(nir_fmul(&b, x, y));
+   nir_pop_if(&b, NULL);
+
+   ASSERT_FALSE(nir_opt_gvn_pre(b.shader));
+   EXPECT_NE(get_alu(nir_op_fadd, 0)->instr.block, nir_start_block(b.impl));
+   EXPECT_NE(get_alu(nir_op_fmul, 0)->instr.block, nir_start_block(b.impl));
+}
+
+TEST_F(nir_gvn_pre_test, partial_redundancy_with_code_after_if)
+{
+   nir_push_if(&b, nir_flt(&b, x, y));
+   store_output(nir_fadd(&b, x, y));
+   nir_push_else(&b, NULL);
+   store_output(nir_fmul(&b, x, y));
+   nir_pop_if(&b, NULL);
+   store_output(nir_fadd(&b, x, y));
+
+   ASSERT_TRUE(nir_opt_gvn_pre(b.shader));
+   nir_validate_shader(b.shader, NULL);
+
+   ASSERT_EQ(get_alu(nir_op_fadd, 1), nullptr);
+   EXPECT_EQ(get_alu(nir_op_fadd, 0)->instr.block, nir_start_block(b.impl));
+   EXPECT_NE(get_alu(nir_op_fmul, 0)->instr.block, nir_start_block(b.impl));
+}
+
+TEST_F(nir_gvn_pre_test, partial_redundancy_from_else)
+{
+   nir_push_if(&b, nir_flt(&b, x, y));
+   store_output(nir_fmul(&b, x, y));
+   nir_push_else(&b, NULL);
+   store_output(nir_fsqrt(&b, nir_fadd(&b, x, y)));
+   nir_pop_if(&b, NULL);
+   store_output(nir_fsqrt(&b, nir_fadd(&b, x, y)));
+
+   ASSERT_TRUE(nir_opt_gvn_pre(b.shader));
+   nir_validate_shader(b.shader, NULL);
+
+   ASSERT_EQ(get_alu(nir_op_fadd, 1), nullptr);
+   ASSERT_EQ(get_alu(nir_op_fsqrt, 1), nullptr);
+   EXPECT_EQ(get_alu(nir_op_fsqrt, 0)->instr.block, nir_start_block(b.impl));
+}
+
+TEST_F(nir_gvn_pre_test, no_hoist_past_break)
+{
+   nir_loop *loop = nir_push_loop(&b);
+   nir_ssa_def *z = load_input(2);
+
+   nir_ssa_def *cond = nir_flt(&b, z, y);
+   nir_push_if(&b, cond);
+   store_output(nir_fadd(&b, z, y));
+   nir_push_else(&b, NULL);
+   nir_jump(&b, nir_jump_break);
+   nir_pop_if(&b, NULL);
+   store_output(nir_fadd(&b, z, y));
+
+   nir_pop_loop(&b, loop);
+
+   /* The else branch leaves the loop, so only the then path reaches the
+    * fadd after the if.  CSE can still drop that one.
+    */
+   nir_opt_gvn_pre(b.shader);
+   nir_validate_shader(b.shader, NULL);
+
+   EXPECT_NE(get_alu(nir_op_fadd, 0)->instr.block,
+             cond->parent_instr->block);
+}
+
+TEST_F(nir_gvn_pre_test, loop_invariant)
+{
+   nir_loop *loop = nir_push_loop(&b);
+   nir_ssa_def *z = load_input(2);
+
+   nir_push_if(&b, nir_fge(&b, z, y));
+   nir_jump(&b, nir_jump_break);
+   nir_pop_if(&b, NULL);
+   store_output(nir_fadd(&b, nir_fmul(&b, x, y), z));
+
+   nir_pop_loop(&b, loop);
+
+   ASSERT_TRUE(nir_opt_gvn_pre(b.shader));
+   nir_validate_shader(b.shader, NULL);
+
+   nir_block *preheader =
+      nir_cf_node_as_block(nir_cf_node_prev(&loop->cf_node));
+   EXPECT_EQ(get_alu(nir_op_fmul, 0)->instr.block, preheader);
+   EXPECT_NE(get_alu(nir_op_fadd, 0)->instr.block, preheader);
+}
+
+TEST_F(nir_gvn_pre_test, loop_load_not_speculated)
+{
+   nir_loop *loop = nir_push_loop(&b);
+
+   nir_push_if(&b, nir_fge(&b, load_input(2), y));
+   nir_jump(&b, nir_jump_break);
+   nir_pop_if(&b, NULL);
+   nir_ssa_def *u = load_uniform(16);
+   store_output(u);
+
+   nir_pop_loop(&b, loop);
+
+   nir_opt_gvn_pre(b.shader);
+
+   nir_block *preheader =
+      nir_cf_node_as_block(nir_cf_node_prev(&loop->cf_node));
+   EXPECT_NE(u->parent_instr->block, preheader);
+}
+
+TEST_F(nir_gvn_pre_test, derivatives_stay)
+{
+   nir_push_if(&b, nir_flt(&b, x, y));
+   store_output(nir_fddx(&b, x));
+   nir_push_else(&b, NULL);
+   store_output(nir_fneg(&b, nir_fddx(&b, x)));
+   nir_pop_if(&b, NULL);
+
+   ASSERT_FALSE(nir_opt_gvn_pre(b.shader));
+   EXPECT_NE(get_alu(nir_op_fddx, 0)->instr.block, nir_start_block(b.impl));
+   EXPECT_NE(get_alu(nir_op_fddx, 1), nullptr);
+}
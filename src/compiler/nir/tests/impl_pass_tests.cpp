@@ -0,0 +1,215 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include <gtest/gtest.h>
+#include "nir.h"
+#include "nir_builder.h"
+#include "nir_serialize.h"
+#include "util/u_queue.h"
+
+namespace {
+
+class nir_impl_pass_test : public ::testing::Test {
+protected:
+   nir_impl_pass_test();
+   ~nir_impl_pass_test();
+
+   void make_code(nir_builder *b, nir_variable **vars, unsigned depth,
+                  unsigned count);
+   void make_function(unsigned index);
+   void serialize(struct blob *blob, unsigned num_threads, bool *progress);
+
+   nir_shader *shader;
+};
+
+nir_impl_pass_test::nir_impl_pass_test()
+{
+   static const nir_shader_compiler_options options = {
+      .lower_sub = true,
+      .native_integers = true,
+   };
+
+   shader = nir_shader_create(NULL, MESA_SHADER_COMPUTE, &options, NULL);
+
+   srand(1);
+   for (unsigned i = 0; i < 24; i++)
+      make_function(i);
+}
+
+nir_impl_pass_test::~nir_impl_pass_test()
+{
+   ralloc_free(shader);
+}
+
+void
+nir_impl_pass_test::make_code(nir_builder *b, nir_variable **vars,
+                              unsigned depth, unsigned count)
+{
+   for (unsigned i = 0; i < count; i++) {
+      nir_variable *dst = vars[rand() % 4];
+      nir_ssa_def *x = nir_load_var(b, vars[rand() % 4]);
+      nir_ssa_def *y = nir_load_var(b, vars[rand() % 4]);
+
+      switch (depth > 0 ? rand() % 6 : rand() % 4) {
+      case 0:
+         nir_store_var(b, dst, nir_iadd(b, x, y), 0x1);
+         break;
+      case 1:
+         nir_store_var(b, dst, nir_imul(b, x, nir_imm_int(b, rand() % 4)),
+                       0x1);
+         break;
+      case 2:
+         nir_store_var(b, dst, nir_iadd(b, nir_imm_int(b, 2),
+                                        nir_imm_int(b, 3)), 0x1);
+         break;
+      case 3:
+         nir_store_var(b, dst, nir_imax(b, x, y), 0x1);
+         break;
+      case 4:
+         nir_push_if(b, nir_ilt(b, x, y));
+         make_code(b, vars, depth - 1, 1 + rand() % 6);
+         nir_push_else(b, NULL);
+         make_code(b, vars, depth - 1, rand() % 4);
+         nir_pop_if(b, NULL);
+         break;
+      case 5: {
+         nir_loop *loop = nir_push_loop(b);
+         nir_push_if(b, nir_ige(b, x, nir_imm_int(b, 10)));
+         nir_jump(b, nir_jump_break);
+         nir_pop_if(b, NULL);
+         make_code(b, vars, depth - 1, 1 + rand() % 5);
+         nir_pop_loop(b, loop);
+         break;
+      }
+      }
+   }
+}
+
+/* Makes a function computing a global from some locals. */
+void
+nir_impl_pass_test::make_function(unsigned index)
+{
+   nir_function *function = nir_function_create(shader, "func");
+   nir_function_impl *impl = nir_function_impl_create(function);
+   nir_variable *vars[4];
+   nir_builder b;
+
+   nir_builder_init(&b, impl);
+   b.cursor = nir_after_cf_list(&impl->body);
+
+   for (unsigned i = 0; i < 4; i++) {
+      vars[i] = nir_local_variable_create(impl, glsl_int_type(), "v");
+      nir_store_var(&b, vars[i], nir_imm_int(&b, index + i), 0x1);
+   }
+
+   make_code(&b, vars, 3, 20 + rand() % 20);
+
+   nir_variable *out =
+      nir_variable_create(shader, nir_var_shader_temp, glsl_int_type(),
+                          "out");
+   nir_store_var(&b, out, nir_load_var(&b, vars[rand() % 4]), 0x1);
+}
+
+static bool
+opt_impl(nir_function_impl *impl, void *data)
+{
+   bool progress, any_progress = false;
+
+   do {
+      progress = false;
+      progress |= nir_lower_vars_to_ssa_impl(impl);
+      progress |= nir_copy_prop_impl(impl);
+      progress |= nir_opt_remove_phis_impl(impl);
+      progress |= nir_opt_dce_impl(impl);
+      progress |= nir_opt_cse_impl(impl);
+      progress |= nir_opt_constant_folding_impl(impl);
+      any_progress |= progress;
+   } while (progress);
+
+   return any_progress;
+}
+
+/* Optimizes a copy of the shader and serializes it. */
+void
+nir_impl_pass_test::serialize(struct blob *blob, unsigned num_threads,
+                              bool *progress)
+{
+   nir_shader *clone = nir_shader_clone(NULL, shader);
+   struct util_queue queue;
+
+   if (num_threads) {
+      ASSERT_TRUE(util_queue_init(&queue, "nir_impl_pass", 8, num_threads,
+                                  0));
+      *progress = nir_shader_run_impl_pass(clone, &queue, opt_impl, NULL);
+      util_queue_destroy(&queue);
+   } else {
+      *progress = nir_shader_run_impl_pass(clone, NULL, opt_impl, NULL);
+   }
+
+   nir_validate_shader(clone, "after nir_shader_run_impl_pass");
+
+   /* Everything the threads allocated has to be back with the shader, or
+    * nir_sweep would free it.
+    */
+   nir_foreach_function(function, clone) {
+      nir_foreach_block(block, function->impl) {
+         EXPECT_EQ(clone, ralloc_parent(block));
+         nir_foreach_instr(instr, block)
+            EXPECT_EQ(clone, ralloc_parent(instr));
+      }
+   }
+
+   nir_sweep(clone);
+
+   blob_init(blob);
+   nir_serialize(blob, clone);
+   ralloc_free(clone);
+}
+
+} /* namespace */
+
+TEST_F(nir_impl_pass_test, same_for_any_thread_count)
+{
+   struct blob expected;
+   bool expected_progress;
+
+   serialize(&expected, 0, &expected_progress);
+   EXPECT_TRUE(expected_progress);
+
+   for (unsigned run = 0; run < 4; run++) {
+      for (unsigned num_threads = 1; num_threads <= 8; num_threads *= 2) {
+         struct blob blob;
+         bool progress;
+
+         serialize(&blob, num_threads, &progress);
+
+         EXPECT_EQ(expected_progress, progress);
+         ASSERT_EQ(expected.size, blob.size);
+         EXPECT_EQ(0, memcmp(expected.data, blob.data, blob.size))
+            << "with " << num_threads << " threads";
+
+         blob_finish(&blob);
+      }
+   }
+
+   blob_finish(&expected);
+}
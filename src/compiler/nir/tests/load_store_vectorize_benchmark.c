@@ -0,0 +1,268 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * Measures how many memory messages nir_opt_load_store_vectorize saves.
+ *
+ * Usage: nir_load_store_vectorize_benchmark [dump...]
+ *
+ * The dumps are the files written by the algebraic passes when
+ * NIR_ALGEBRAIC_DUMP_DIR is set.  Without any, the benchmark makes up
+ * compute shaders the way they look after nir_lower_explicit_io and
+ * nir_lower_io_to_scalar: structs and vectors read from UBOs and SSBOs a
+ * component at a time at a computed base plus constant offsets, results
+ * written back the same way, and a few barriers and stores to other
+ * buffers in between.
+ *
+ * Every shader is scalarized and optimized with the st_nir_opts pass list,
+ * then vectorized once requiring accesses to be aligned to their size,
+ * which is the default, and once accepting any dword alignment, as most
+ * backends can.  The number of memory intrinsics is printed the way
+ * shader-db's report.py prints instruction counts, along with the time the
+ * pass takes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nir_benchmark_util.h"
+#include "util/os_time.h"
+
+#define NUM_RUNS 3
+
+static unsigned num_shaders;
+static struct nir_benchmark_report natural_report, dword_report;
+static int64_t natural_time[NUM_RUNS], dword_time[NUM_RUNS];
+
+static const nir_variable_mode vectorize_modes =
+   nir_var_mem_ubo | nir_var_mem_ssbo | nir_var_mem_shared |
+   nir_var_mem_global;
+
+static bool
+dword_aligned(unsigned align, unsigned bit_size, unsigned num_components,
+              nir_intrinsic_instr *low, nir_intrinsic_instr *high)
+{
+   return align >= 4;
+}
+
+static bool
+is_memory_intrinsic(const nir_instr *instr)
+{
+   if (instr->type != nir_instr_type_intrinsic)
+      return false;
+
+   switch (nir_instr_as_intrinsic(instr)->intrinsic) {
+   case nir_intrinsic_load_ubo:
+   case nir_intrinsic_load_ssbo:
+   case nir_intrinsic_store_ssbo:
+   case nir_intrinsic_load_shared:
+   case nir_intrinsic_store_shared:
+   case nir_intrinsic_load_global:
+   case nir_intrinsic_store_global:
+      return true;
+   default:
+      return false;
+   }
+}
+
+static unsigned
+time_vectorize(nir_shader *shader, nir_should_vectorize_mem_func callback,
+               int64_t *time)
+{
+   unsigned count = 0;
+
+   for (unsigned run = 0; run < NUM_RUNS; run++) {
+      nir_shader *clone = nir_shader_clone(NULL, shader);
+      int64_t start = os_time_get_nano();
+
+      nir_opt_load_store_vectorize(clone, vectorize_modes, callback);
+
+      time[run] += os_time_get_nano() - start;
+      if (run == 0) {
+         nir_validate_shader(clone, "after nir_opt_load_store_vectorize");
+         count = nir_benchmark_count_instrs(clone, is_memory_intrinsic);
+      }
+      ralloc_free(clone);
+   }
+
+   return count;
+}
+
+static bool
+run_shader(nir_shader *shader, const char *path)
+{
+   nir_benchmark_optimize(shader);
+
+   num_shaders++;
+
+   unsigned before = nir_benchmark_count_instrs(shader, is_memory_intrinsic);
+   nir_benchmark_report_add(&natural_report, before,
+                            time_vectorize(shader, NULL, natural_time));
+   nir_benchmark_report_add(&dword_report, before,
+                            time_vectorize(shader, dword_aligned,
+                                           dword_time));
+
+   return true;
+}
+
+static nir_ssa_def *
+load_scalar(nir_builder *b, nir_intrinsic_op op, unsigned index,
+            nir_ssa_def *offset)
+{
+   nir_intrinsic_instr *load = nir_intrinsic_instr_create(b->shader, op);
+   load->num_components = 1;
+   load->src[0] = nir_src_for_ssa(nir_imm_int(b, index));
+   load->src[1] = nir_src_for_ssa(offset);
+   nir_intrinsic_set_align(load, 4, 0);
+   nir_ssa_dest_init(&load->instr, &load->dest, 1, 32, NULL);
+   nir_builder_instr_insert(b, &load->instr);
+
+   return &load->dest.ssa;
+}
+
+static void
+store_scalar(nir_builder *b, nir_ssa_def *value, unsigned index,
+             nir_ssa_def *offset)
+{
+   nir_intrinsic_instr *store =
+      nir_intrinsic_instr_create(b->shader, nir_intrinsic_store_ssbo);
+   store->num_components = 1;
+   store->src[0] = nir_src_for_ssa(value);
+   store->src[1] = nir_src_for_ssa(nir_imm_int(b, index));
+   store->src[2] = nir_src_for_ssa(offset);
+   nir_intrinsic_set_write_mask(store, 0x1);
+   nir_intrinsic_set_align(store, 4, 0);
+   nir_builder_instr_insert(b, &store->instr);
+}
+
+/**
+ * Reads a struct of a few vectors from a buffer, as an array element at
+ * the given index, and returns the components summed up with some math.
+ */
+static nir_ssa_def *
+read_struct(nir_builder *b, nir_intrinsic_op op, unsigned index,
+            nir_ssa_def *element, unsigned stride, nir_ssa_def *x)
+{
+   nir_ssa_def *base = nir_imul(b, element, nir_imm_int(b, stride));
+   unsigned offset = 4 * (rand() % 4);
+   nir_ssa_def *sum = x;
+
+   while (offset < stride) {
+      unsigned num_components = 1 + rand() % 4;
+
+      for (unsigned c = 0; c < num_components && offset < stride; c++) {
+         nir_ssa_def *value =
+            load_scalar(b, op, index, nir_iadd(b, base,
+                                               nir_imm_int(b, offset)));
+         sum = nir_ffma(b, sum, x, value);
+         offset += 4;
+      }
+
+      /* Skip the members nobody reads. */
+      offset += 4 * (rand() % 3);
+   }
+
+   return sum;
+}
+
+static void
+write_struct(nir_builder *b, unsigned index, nir_ssa_def *element,
+             unsigned stride, nir_ssa_def *value)
+{
+   nir_ssa_def *base = nir_imul(b, element, nir_imm_int(b, stride));
+
+   for (unsigned offset = 0; offset < stride; offset += 4) {
+      value = nir_fmul(b, value, value);
+      store_scalar(b, value, index, nir_iadd(b, base,
+                                             nir_imm_int(b, offset)));
+   }
+}
+
+static nir_shader *
+make_shader(void *mem_ctx, const nir_shader_compiler_options *options)
+{
+   unsigned count = 4 + rand() % 16;
+   nir_builder builder, *b = &builder;
+
+   nir_builder_init_simple_shader(b, mem_ctx, MESA_SHADER_COMPUTE, options);
+
+   nir_ssa_def *id = nir_channel(b, nir_load_local_invocation_id(b), 0);
+   nir_ssa_def *x = nir_u2f32(b, id);
+
+   for (unsigned i = 0; i < count; i++) {
+      static const unsigned strides[] = { 16, 32, 48, 64 };
+      unsigned stride = strides[rand() % ARRAY_SIZE(strides)];
+      nir_ssa_def *element = nir_iadd(b, id, nir_imm_int(b, rand() % 8));
+
+      switch (rand() % 6) {
+      case 0:
+      case 1:
+         x = read_struct(b, nir_intrinsic_load_ubo, rand() % 2, element,
+                         stride, x);
+         break;
+
+      case 2:
+      case 3:
+         x = read_struct(b, nir_intrinsic_load_ssbo, 2 + rand() % 2,
+                         element, stride, x);
+         break;
+
+      case 4:
+         write_struct(b, 4, element, stride, x);
+         break;
+
+      case 5: {
+         nir_intrinsic_instr *barrier =
+            nir_intrinsic_instr_create(b->shader,
+                                       nir_intrinsic_memory_barrier);
+         nir_builder_instr_insert(b, &barrier->instr);
+         break;
+      }
+      }
+   }
+
+   write_struct(b, 5, id, 16, x);
+
+   return b->shader;
+}
+
+int
+main(int argc, char **argv)
+{
+   if (!nir_benchmark_run_corpus((const char *const *)argv + 1, argc - 1,
+                                 run_shader, make_shader, NULL, 200))
+      return 1;
+
+   printf("%u shaders\n\n", num_shaders);
+   printf("Aligned to their size:\n");
+   nir_benchmark_report_print("memory messages", &natural_report);
+   printf("Aligned to a dword:\n");
+   nir_benchmark_report_print("memory messages", &dword_report);
+   printf("vectorize time: %.3f ms aligned to their size, "
+          "%.3f ms aligned to a dword\n",
+          nir_benchmark_best_time(natural_time, NUM_RUNS) / 1e6,
+          nir_benchmark_best_time(dword_time, NUM_RUNS) / 1e6);
+
+   return 0;
+}
@@ -0,0 +1,277 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include <gtest/gtest.h>
+#include "nir.h"
+#include "nir_builder.h"
+
+namespace {
+
+class nir_load_store_vectorize_test : public ::testing::Test {
+protected:
+   nir_load_store_vectorize_test();
+   ~nir_load_store_vectorize_test();
+
+   nir_ssa_def *load_indirect(nir_intrinsic_op op, unsigned index,
+                              nir_ssa_def *offset,
+                              unsigned num_components = 1);
+   nir_ssa_def *load(nir_intrinsic_op op, unsigned index, unsigned offset,
+                     unsigned num_components = 1);
+   void store_ssbo(nir_ssa_def *value, unsigned index, unsigned offset,
+                   unsigned write_mask = 0x1);
+   void use(nir_ssa_def *value);
+
+   bool run(nir_should_vectorize_mem_func callback = NULL);
+
+   unsigned count_intrinsics(nir_intrinsic_op op);
+   nir_intrinsic_instr *get_intrinsic(nir_intrinsic_op op, unsigned index);
+
+   nir_builder b;
+   nir_ssa_def *x;
+   nir_variable *out;
+};
+
+nir_load_store_vectorize_test::nir_load_store_vectorize_test()
+{
+   static const nir_shader_compiler_options options = { };
+   nir_builder_init_simple_shader(&b, NULL, MESA_SHADER_COMPUTE, &options);
+
+   nir_variable *in = nir_variable_create(b.shader, nir_var_shader_in,
+                                          glsl_uint_type(), "in");
+   x = nir_load_var(&b, in);
+
+   out = nir_variable_create(b.shader, nir_var_shader_out,
+                             glsl_uint_type(), "out");
+}
+
+nir_load_store_vectorize_test::~nir_load_store_vectorize_test()
+{
+   if (HasFailure()) {
+      printf("\nShader from the failed test:\n\n");
+      nir_print_shader(b.shader, stdout);
+   }
+
+   ralloc_free(b.shader);
+}
+
+nir_ssa_def *
+nir_load_store_vectorize_test::load_indirect(nir_intrinsic_op op,
+                                             unsigned index,
+                                             nir_ssa_def *offset,
+                                             unsigned num_components)
+{
+   nir_intrinsic_instr *load = nir_intrinsic_instr_create(b.shader, op);
+   load->num_components = num_components;
+   load->src[0] = nir_src_for_ssa(nir_imm_int(&b, index));
+   load->src[1] = nir_src_for_ssa(offset);
+   nir_intrinsic_set_align(load, 4, 0);
+   nir_ssa_dest_init(&load->instr, &load->dest, num_components, 32, NULL);
+   nir_builder_instr_insert(&b, &load->instr);
+   return &load->dest.ssa;
+}
+
+nir_ssa_def *
+nir_load_store_vectorize_test::load(nir_intrinsic_op op, unsigned index,
+                                    unsigned offset, unsigned num_components)
+{
+   return load_indirect(op, index, nir_imm_int(&b, offset), num_components);
+}
+
+void
+nir_load_store_vectorize_test::store_ssbo(nir_ssa_def *value, unsigned index,
+                                          unsigned offset,
+                                          unsigned write_mask)
+{
+   nir_intrinsic_instr *store =
+      nir_intrinsic_instr_create(b.shader, nir_intrinsic_store_ssbo);
+   store->num_components = value->num_components;
+   store->src[0] = nir_src_for_ssa(value);
+   store->src[1] = nir_src_for_ssa(nir_imm_int(&b, index));
+   store->src[2] = nir_src_for_ssa(nir_imm_int(&b, offset));
+   nir_intrinsic_set_write_mask(store, write_mask);
+   nir_intrinsic_set_align(store, 4, 0);
+   nir_builder_instr_insert(&b, &store->instr);
+}
+
+void
+nir_load_store_vectorize_test::use(nir_ssa_def *value)
+{
+   nir_store_var(&b, out, value, 0x1);
+}
+
+bool
+nir_load_store_vectorize_test::run(nir_should_vectorize_mem_func callback)
+{
+   nir_variable_mode modes =
+      (nir_variable_mode)(nir_var_mem_ubo | nir_var_mem_ssbo);
+   bool progress = nir_opt_load_store_vectorize(b.shader, modes, callback);
+   nir_validate_shader(b.shader, NULL);
+   return progress;
+}
+
+unsigned
+nir_load_store_vectorize_test::count_intrinsics(nir_intrinsic_op op)
+{
+   unsigned count = 0;
+   nir_foreach_block(block, b.impl) {
+      nir_foreach_instr(instr, block) {
+         count += instr->type == nir_instr_type_intrinsic &&
+                  nir_instr_as_intrinsic(instr)->intrinsic == op;
+      }
+   }
+   return count;
+}
+
+nir_intrinsic_instr *
+nir_load_store_vectorize_test::get_intrinsic(nir_intrinsic_op op,
+                                             unsigned index)
+{
+   nir_foreach_block(block, b.impl) {
+      nir_foreach_instr(instr, block) {
+         if (instr->type != nir_instr_type_intrinsic ||
+             nir_instr_as_intrinsic(instr)->intrinsic != op)
+            continue;
+         if (index == 0)
+            return nir_instr_as_intrinsic(instr);
+         index--;
+      }
+   }
+   return NULL;
+}
+
+static bool
+any_align(unsigned align, unsigned bit_size, unsigned num_components,
+          nir_intrinsic_instr *low, nir_intrinsic_instr *high)
+{
+   return true;
+}
+
+} // namespace
+
+TEST_F(nir_load_store_vectorize_test, ubo_const_offsets)
+{
+   for (unsigned i = 0; i < 4; i++)
+      use(load(nir_intrinsic_load_ubo, 0, 4 * i));
+
+   ASSERT_TRUE(run());
+
+   ASSERT_EQ(count_intrinsics(nir_intrinsic_load_ubo), 1);
+   nir_intrinsic_instr *load = get_intrinsic(nir_intrinsic_load_ubo, 0);
+   EXPECT_EQ(load->num_components, 4);
+   EXPECT_EQ(nir_src_as_uint(load->src[1]), 0);
+}
+
+TEST_F(nir_load_store_vectorize_test, ubo_indirect_offsets)
+{
+   nir_ssa_def *base = nir_ishl(&b, x, nir_imm_int(&b, 4));
+   use(load_indirect(nir_intrinsic_load_ubo, 0,
+                     nir_iadd(&b, base, nir_imm_int(&b, 4))));
+   use(load_indirect(nir_intrinsic_load_ubo, 0, base));
+
+   ASSERT_TRUE(run());
+
+   ASSERT_EQ(count_intrinsics(nir_intrinsic_load_ubo), 1);
+   nir_intrinsic_instr *load = get_intrinsic(nir_intrinsic_load_ubo, 0);
+   EXPECT_EQ(load->num_components, 2);
+   EXPECT_EQ(nir_intrinsic_align(load), 16);
+}
+
+TEST_F(nir_load_store_vectorize_test, alignment)
+{
+   use(load(nir_intrinsic_load_ubo, 0, 4));
+   use(load(nir_intrinsic_load_ubo, 0, 8));
+
+   /* A vec2 at 4 isn't aligned to its size. */
+   ASSERT_FALSE(run());
+   ASSERT_TRUE(run(any_align));
+   EXPECT_EQ(count_intrinsics(nir_intrinsic_load_ubo), 1);
+}
+
+TEST_F(nir_load_store_vectorize_test, different_buffers)
+{
+   use(load(nir_intrinsic_load_ubo, 0, 0));
+   use(load(nir_intrinsic_load_ubo, 1, 4));
+
+   ASSERT_FALSE(run());
+   EXPECT_EQ(count_intrinsics(nir_intrinsic_load_ubo), 2);
+}
+
+TEST_F(nir_load_store_vectorize_test, ssbo_load_past_aliasing_store)
+{
+   use(load(nir_intrinsic_load_ssbo, 0, 0));
+   store_ssbo(x, 0, 4);
+   use(load(nir_intrinsic_load_ssbo, 0, 4));
+
+   ASSERT_FALSE(run());
+   EXPECT_EQ(count_intrinsics(nir_intrinsic_load_ssbo), 2);
+}
+
+TEST_F(nir_load_store_vectorize_test, ssbo_load_past_disjoint_store)
+{
+   use(load(nir_intrinsic_load_ssbo, 0, 0));
+   store_ssbo(x, 0, 32);
+   use(load(nir_intrinsic_load_ssbo, 0, 4));
+
+   ASSERT_TRUE(run());
+   EXPECT_EQ(count_intrinsics(nir_intrinsic_load_ssbo), 1);
+   EXPECT_EQ(count_intrinsics(nir_intrinsic_store_ssbo), 1);
+}
+
+TEST_F(nir_load_store_vectorize_test, ssbo_load_past_barrier)
+{
+   use(load(nir_intrinsic_load_ssbo, 0, 0));
+   nir_intrinsic_instr *barrier =
+      nir_intrinsic_instr_create(b.shader, nir_intrinsic_memory_barrier);
+   nir_builder_instr_insert(&b, &barrier->instr);
+   use(load(nir_intrinsic_load_ssbo, 0, 4));
+
+   ASSERT_FALSE(run());
+}
+
+TEST_F(nir_load_store_vectorize_test, ssbo_stores)
+{
+   nir_ssa_def *y = nir_iadd(&b, x, nir_imm_int(&b, 1));
+   store_ssbo(nir_vec2(&b, x, x), 0, 0, 0x3);
+   store_ssbo(y, 0, 4);
+   store_ssbo(x, 0, 12);
+
+   ASSERT_TRUE(run());
+
+   ASSERT_EQ(count_intrinsics(nir_intrinsic_store_ssbo), 1);
+   nir_intrinsic_instr *store = get_intrinsic(nir_intrinsic_store_ssbo, 0);
+   EXPECT_EQ(store->num_components, 4);
+   EXPECT_EQ(nir_intrinsic_write_mask(store), 0xb);
+
+   /* The later store wins where they overlap. */
+   nir_alu_instr *vec = nir_instr_as_alu(store->src[0].ssa->parent_instr);
+   EXPECT_EQ(vec->src[1].src.ssa->parent_instr, y->parent_instr);
+}
+
+TEST_F(nir_load_store_vectorize_test, ssbo_store_past_aliasing_load)
+{
+   store_ssbo(x, 0, 0);
+   use(load(nir_intrinsic_load_ssbo, 0, 0));
+   store_ssbo(x, 0, 4);
+
+   ASSERT_FALSE(run());
+   EXPECT_EQ(count_intrinsics(nir_intrinsic_store_ssbo), 2);
+}
@@ -0,0 +1,218 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "nir_benchmark_util.h"
+#include "nir_serialize.h"
+
+const nir_shader_compiler_options nir_benchmark_options = {
+   .lower_sub = true,
+   .lower_fpow = true,
+   .lower_fdiv = true,
+   .lower_flrp32 = true,
+   .lower_flrp64 = true,
+   .native_integers = true,
+};
+
+void
+nir_benchmark_optimize(nir_shader *nir)
+{
+   bool progress;
+
+   do {
+      progress = false;
+      NIR_BENCHMARK_OPT_LOOP_BODY(NIR_BENCHMARK_OPT, NIR_BENCHMARK_OPT_V)
+   } while (progress);
+}
+
+static bool
+run_dump(const char *path,
+         bool (*run_shader)(nir_shader *shader, const char *path))
+{
+   FILE *f = fopen(path, "rb");
+   if (!f) {
+      fprintf(stderr, "Failed to open %s\n", path);
+      return false;
+   }
+
+   fseek(f, 0, SEEK_END);
+   long size = ftell(f);
+   fseek(f, 0, SEEK_SET);
+
+   void *mem_ctx = ralloc_context(NULL);
+   void *data = ralloc_size(mem_ctx, size);
+   bool ok = fread(data, 1, size, f) == size;
+   fclose(f);
+
+   struct blob_reader reader;
+   blob_reader_init(&reader, data, size);
+
+   /* The options are only good for the build that wrote them. */
+   if (!ok || blob_read_uint32(&reader) != sizeof(nir_shader_compiler_options)) {
+      fprintf(stderr, "%s: bad dump\n", path);
+      ralloc_free(mem_ctx);
+      return false;
+   }
+
+   nir_shader_compiler_options *options =
+      ralloc(mem_ctx, nir_shader_compiler_options);
+   blob_copy_bytes(&reader, options, sizeof(*options));
+
+   ok = run_shader(nir_deserialize(mem_ctx, options, &reader), path);
+
+   ralloc_free(mem_ctx);
+   return ok;
+}
+
+bool
+nir_benchmark_run_corpus(const char *const *dumps, unsigned num_dumps,
+                         bool (*run_shader)(nir_shader *shader,
+                                            const char *path),
+                         nir_shader *(*make_shader)(void *mem_ctx,
+                                                    const nir_shader_compiler_options *options),
+                         const nir_shader_compiler_options *options,
+                         unsigned num_shaders)
+{
+   for (unsigned i = 0; i < num_dumps; i++) {
+      if (!run_dump(dumps[i], run_shader))
+         return false;
+   }
+
+   if (num_dumps)
+      return true;
+
+   srand(1);
+   for (unsigned i = 0; i < num_shaders; i++) {
+      void *mem_ctx = ralloc_context(NULL);
+      bool ok = run_shader(make_shader(mem_ctx, options ? options :
+                                                &nir_benchmark_options),
+                           NULL);
+      ralloc_free(mem_ctx);
+      if (!ok)
+         return false;
+   }
+
+   return true;
+}
+
+unsigned
+nir_benchmark_count_instrs(nir_shader *shader,
+                           bool (*filter)(const nir_instr *instr))
+{
+   unsigned count = 0;
+
+   nir_foreach_function(function, shader) {
+      if (!function->impl)
+         continue;
+
+      nir_foreach_block(block, function->impl) {
+         nir_foreach_instr(instr, block)
+            count += !filter || filter(instr);
+      }
+   }
+
+   return count;
+}
+
+int64_t
+nir_benchmark_best_time(const int64_t *time, unsigned num_runs)
+{
+   int64_t best = time[0];
+
+   for (unsigned run = 1; run < num_runs; run++)
+      best = MIN2(best, time[run]);
+
+   return best;
+}
+
+void
+nir_benchmark_report_add(struct nir_benchmark_report *report,
+                         unsigned before, unsigned after)
+{
+   report->before += before;
+   report->after += after;
+
+   if (before != after) {
+      report->affected_before += before;
+      report->affected_after += after;
+      if (after < before)
+         report->helped++;
+      else
+         report->hurt++;
+   }
+}
+
+void
+nir_benchmark_report_print(const char *name,
+                           const struct nir_benchmark_report *report)
+{
+   printf("total %s in shared programs: %" PRIu64 " -> %" PRIu64
+          " (%.2f%%)\n", name, report->before, report->after,
+          report->before ?
+          100.0 * ((double)report->after - report->before) / report->before :
+          0.0);
+   printf("%s in affected programs: %" PRIu64 " -> %" PRIu64 " (%.2f%%)\n",
+          name, report->affected_before, report->affected_after,
+          report->affected_before ?
+          100.0 * ((double)report->affected_after - report->affected_before) /
+          report->affected_before : 0.0);
+   printf("helped: %u\n", report->helped);
+   printf("HURT: %u\n\n", report->hurt);
+}
+
+nir_ssa_def *
+nir_benchmark_load_input(nir_builder *b, const struct glsl_type *type,
+                         unsigned index)
+{
+   nir_variable *in =
+      nir_variable_create(b->shader, nir_var_shader_in, type, "in");
+   in->data.location = VARYING_SLOT_VAR0 + index;
+
+   return nir_load_var(b, in);
+}
+
+void
+nir_benchmark_store_output(nir_builder *b, nir_ssa_def *value)
+{
+   nir_variable *out =
+      nir_variable_create(b->shader, nir_var_shader_out, glsl_vec4_type(),
+                          "out");
+   out->data.location = FRAG_RESULT_DATA0;
+   nir_store_var(b, out, value, 0xf);
+}
+
+nir_ssa_def *
+nir_benchmark_load_uniform(nir_builder *b, nir_ssa_def *offset)
+{
+   nir_intrinsic_instr *load =
+      nir_intrinsic_instr_create(b->shader, nir_intrinsic_load_uniform);
+   load->num_components = 1;
+   load->src[0] = nir_src_for_ssa(offset);
+   nir_ssa_dest_init(&load->instr, &load->dest, 1, 32, NULL);
+   nir_builder_instr_insert(b, &load->instr);
+
+   return &load->dest.ssa;
+}
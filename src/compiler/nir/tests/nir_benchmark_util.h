@@ -0,0 +1,138 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * What the NIR benchmarks have in common: reading the corpus, making up
+ * shaders when there is none, timing and reporting.
+ *
+ * The corpus is the files written by the algebraic passes when
+ * NIR_ALGEBRAIC_DUMP_DIR is set, so running a shader-db through a driver
+ * with it set gives one.
+ */
+
+#ifndef _NIR_BENCHMARK_UTIL_H
+#define _NIR_BENCHMARK_UTIL_H
+
+#include "nir.h"
+#include "nir_builder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* The pass list of st_nir_opts, which is also most of everyone else's,
+ * without loop unrolling.  OPT(pass, ...) runs a pass and gives whether it
+ * made progress, OPT_V(pass, ...) runs one that doesn't say.
+ */
+#define NIR_BENCHMARK_OPT_LOOP_BODY(OPT, OPT_V)                      \
+   OPT_V(nir_lower_vars_to_ssa);                                     \
+   OPT_V(nir_lower_alu_to_scalar);                                   \
+   OPT_V(nir_lower_phis_to_scalar);                                  \
+   OPT(nir_copy_prop);                                               \
+   OPT(nir_opt_remove_phis);                                         \
+   OPT(nir_opt_dce);                                                 \
+   if (OPT(nir_opt_trivial_continues)) {                             \
+      OPT(nir_copy_prop);                                            \
+      OPT(nir_opt_dce);                                              \
+   }                                                                 \
+   OPT(nir_opt_if);                                                  \
+   OPT(nir_opt_dead_cf);                                             \
+   OPT(nir_opt_cse);                                                 \
+   OPT(nir_opt_peephole_select, 8, true, true);                      \
+   OPT(nir_opt_algebraic);                                           \
+   OPT(nir_opt_constant_folding);                                    \
+   OPT(nir_opt_undef);
+
+/* The usual OPT for a fixed-point loop on a bool progress. */
+#define NIR_BENCHMARK_OPT(pass, ...) ({                              \
+   bool this_progress = false;                                       \
+   NIR_PASS(this_progress, nir, pass, ##__VA_ARGS__);                \
+   if (this_progress)                                                \
+      progress = true;                                               \
+   this_progress;                                                    \
+})
+#define NIR_BENCHMARK_OPT_V(pass, ...) NIR_PASS_V(nir, pass, ##__VA_ARGS__)
+
+/** Runs NIR_BENCHMARK_OPT_LOOP_BODY until nothing makes progress. */
+void nir_benchmark_optimize(nir_shader *nir);
+
+/** The options the made-up shaders are compiled with. */
+extern const nir_shader_compiler_options nir_benchmark_options;
+
+/**
+ * Runs run_shader on every dump, or on num_shaders shaders from
+ * make_shader, with nir_benchmark_options unless options is given, if
+ * there are no dumps.  make_shader is called with srand(1) done, so the
+ * made-up corpus is always the same.  The path given to run_shader is
+ * NULL for made-up shaders.
+ *
+ * Returns false if a dump couldn't be read or run_shader failed.
+ */
+bool
+nir_benchmark_run_corpus(const char *const *dumps, unsigned num_dumps,
+                         bool (*run_shader)(nir_shader *shader,
+                                            const char *path),
+                         nir_shader *(*make_shader)(void *mem_ctx,
+                                                    const nir_shader_compiler_options *options),
+                         const nir_shader_compiler_options *options,
+                         unsigned num_shaders);
+
+/** The instructions filter accepts, or all of them if it is NULL. */
+unsigned
+nir_benchmark_count_instrs(nir_shader *shader,
+                           bool (*filter)(const nir_instr *instr));
+
+/** The best of the times of num_runs runs. */
+int64_t nir_benchmark_best_time(const int64_t *time, unsigned num_runs);
+
+/** A count summed over the corpus, as shader-db's report.py sums it. */
+struct nir_benchmark_report {
+   uint64_t before, after;
+   uint64_t affected_before, affected_after;
+   unsigned helped, hurt;
+};
+
+void nir_benchmark_report_add(struct nir_benchmark_report *report,
+                              unsigned before, unsigned after);
+void nir_benchmark_report_print(const char *name,
+                                const struct nir_benchmark_report *report);
+
+/**
+ * Adds a fragment shader input of the given type at VARYING_SLOT_VAR0 +
+ * index and loads it.
+ */
+nir_ssa_def *nir_benchmark_load_input(nir_builder *b,
+                                      const struct glsl_type *type,
+                                      unsigned index);
+
+/** Adds the vec4 FRAG_RESULT_DATA0 output and stores value to it. */
+void nir_benchmark_store_output(nir_builder *b, nir_ssa_def *value);
+
+/** A scalar 32-bit load_uniform from offset. */
+nir_ssa_def *nir_benchmark_load_uniform(nir_builder *b, nir_ssa_def *offset);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* _NIR_BENCHMARK_UTIL_H */
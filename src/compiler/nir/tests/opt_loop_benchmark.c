@@ -0,0 +1,235 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * Compares nir_pass_loop with the fixed-point loop it replaces.
+ *
+ * Usage: nir_opt_loop_benchmark [dump...]
+ *
+ * The dumps are the files written by the algebraic passes when
+ * NIR_ALGEBRAIC_DUMP_DIR is set.  Without any, the benchmark makes up
+ * shaders with nested ifs and loops around local variables.
+ *
+ * Every shader is optimized with the same pass list both ways, a few times
+ * each on fresh clones.  The results have to be the same, and the best
+ * total time of each loop over the whole corpus is printed.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nir_benchmark_util.h"
+#include "nir_serialize.h"
+#include "util/os_time.h"
+
+#define NUM_RUNS 5
+
+static unsigned num_shaders, num_instrs;
+static int64_t fixed_point_time[NUM_RUNS], pass_loop_time[NUM_RUNS];
+
+/* The pass list of st_nir_opts, with its loop unrolling. */
+#define OPT_LOOP_BODY(OPT, OPT_V)                                    \
+   NIR_BENCHMARK_OPT_LOOP_BODY(OPT, OPT_V)                           \
+   if (nir->options->max_unroll_iterations)                          \
+      OPT(nir_opt_loop_unroll, 0);
+
+static nir_shader *
+optimize_fixed_point(nir_shader *nir)
+{
+   bool progress;
+
+   do {
+      progress = false;
+      OPT_LOOP_BODY(NIR_BENCHMARK_OPT, NIR_BENCHMARK_OPT_V)
+   } while (progress);
+
+   return nir;
+}
+
+static nir_shader *
+optimize_pass_loop(nir_shader *nir)
+{
+   nir_pass_loop loop;
+
+#define OPT(pass, ...) ({                                            \
+   NIR_LOOP_PASS(&loop, nir, pass, ##__VA_ARGS__);                   \
+   loop.pass_progress;                                               \
+})
+#define OPT_V(pass, ...) NIR_LOOP_PASS_V(&loop, nir, pass, ##__VA_ARGS__)
+
+   nir_pass_loop_init(&loop);
+   do {
+      OPT_LOOP_BODY(OPT, OPT_V)
+   } while (nir_pass_loop_continue(&loop));
+
+#undef OPT
+#undef OPT_V
+
+   return nir;
+}
+
+static int64_t
+time_loop(nir_shader *shader, nir_shader *(*optimize)(nir_shader *),
+          struct blob *result)
+{
+   nir_shader *clone = nir_shader_clone(NULL, shader);
+   int64_t start = os_time_get_nano();
+
+   clone = optimize(clone);
+
+   int64_t time = os_time_get_nano() - start;
+   if (result)
+      nir_serialize(result, clone);
+   ralloc_free(clone);
+
+   return time;
+}
+
+static bool
+run_shader(nir_shader *shader, const char *path)
+{
+   num_shaders++;
+   num_instrs += nir_benchmark_count_instrs(shader, NULL);
+
+   for (unsigned run = 0; run < NUM_RUNS; run++) {
+      struct blob fixed_point, pass_loop;
+
+      blob_init(&fixed_point);
+      blob_init(&pass_loop);
+
+      fixed_point_time[run] +=
+         time_loop(shader, optimize_fixed_point, run ? NULL : &fixed_point);
+      pass_loop_time[run] +=
+         time_loop(shader, optimize_pass_loop, run ? NULL : &pass_loop);
+
+      /* Skipping a pass must never change what comes out. */
+      if (fixed_point.size != pass_loop.size ||
+          memcmp(fixed_point.data, pass_loop.data, fixed_point.size)) {
+         fprintf(stderr, "nir_pass_loop gave a different shader\n");
+         exit(1);
+      }
+
+      blob_finish(&fixed_point);
+      blob_finish(&pass_loop);
+   }
+
+   return true;
+}
+
+static void
+make_code(nir_builder *b, nir_variable **vars, unsigned depth, unsigned count)
+{
+   for (unsigned i = 0; i < count; i++) {
+      nir_variable *dst = vars[rand() % 4];
+      nir_ssa_def *x = nir_load_var(b, vars[rand() % 4]);
+      nir_ssa_def *y = nir_load_var(b, vars[rand() % 4]);
+
+      switch (depth > 0 ? rand() % 6 : rand() % 4) {
+      case 0:
+         nir_store_var(b, dst, nir_fadd(b, x, y), 0x1);
+         break;
+      case 1:
+         nir_store_var(b, dst, nir_fmul(b, x, nir_imm_float(b, 1.0)), 0x1);
+         break;
+      case 2:
+         nir_store_var(b, dst,
+                       nir_fmax(b, x, nir_fadd(b, y, nir_imm_float(b, 0.0))),
+                       0x1);
+         break;
+      case 3:
+         nir_store_var(b, dst, nir_fsub(b, x, y), 0x1);
+         break;
+      case 4:
+         nir_push_if(b, nir_flt(b, x, y));
+         make_code(b, vars, depth - 1, 3 + rand() % 6);
+         nir_push_else(b, NULL);
+         make_code(b, vars, depth - 1, rand() % 4);
+         nir_pop_if(b, NULL);
+         break;
+      case 5: {
+         nir_loop *loop = nir_push_loop(b);
+         nir_push_if(b, nir_fge(b, nir_load_var(b, vars[0]), x));
+         nir_jump(b, nir_jump_break);
+         nir_pop_if(b, NULL);
+         make_code(b, vars, depth - 1, 3 + rand() % 5);
+         nir_store_var(b, vars[0],
+                       nir_fadd(b, nir_load_var(b, vars[0]),
+                                nir_imm_float(b, 1.0)), 0x1);
+         nir_pop_loop(b, loop);
+         break;
+      }
+      }
+   }
+}
+
+/**
+ * Makes up a fragment shader that computes its output in a few local
+ * variables, with redundant math nested in ifs and loops, so that the loop
+ * needs a few iterations of most of its passes.
+ */
+static nir_shader *
+make_shader(void *mem_ctx, const nir_shader_compiler_options *options)
+{
+   unsigned count = 10 + rand() % 30;
+   nir_variable *vars[4];
+   nir_builder b;
+
+   nir_builder_init_simple_shader(&b, mem_ctx, MESA_SHADER_FRAGMENT, options);
+
+   for (unsigned i = 0; i < 4; i++) {
+      vars[i] = nir_local_variable_create(b.impl, glsl_float_type(), "v");
+      nir_store_var(&b, vars[i], nir_imm_float(&b, i), 0x1);
+   }
+
+   make_code(&b, vars, 3, count);
+
+   nir_benchmark_store_output(&b, nir_vec4(&b, nir_load_var(&b, vars[0]),
+                                           nir_load_var(&b, vars[1]),
+                                           nir_load_var(&b, vars[2]),
+                                           nir_load_var(&b, vars[3])));
+
+   return b.shader;
+}
+
+int
+main(int argc, char **argv)
+{
+   nir_shader_compiler_options options = nir_benchmark_options;
+   options.max_unroll_iterations = 16;
+
+   if (!nir_benchmark_run_corpus((const char *const *)argv + 1, argc - 1,
+                                 run_shader, make_shader, &options, 100))
+      return 1;
+
+   int64_t fixed_point = nir_benchmark_best_time(fixed_point_time, NUM_RUNS);
+   int64_t pass_loop = nir_benchmark_best_time(pass_loop_time, NUM_RUNS);
+
+   printf("%u shaders, %u instructions\n"
+          "  fixed-point loop: %.3f ms\n"
+          "  nir_pass_loop:    %.3f ms (%.1f%%)\n",
+          num_shaders, num_instrs, fixed_point / 1e6, pass_loop / 1e6,
+          100.0 * (pass_loop - fixed_point) / fixed_point);
+
+   return 0;
+}
@@ -0,0 +1,144 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include <gtest/gtest.h>
+#include <string>
+#include "nir.h"
+#include "nir_builder.h"
+
+namespace {
+
+class nir_pass_profile_test : public ::testing::Test {
+protected:
+   nir_pass_profile_test();
+   ~nir_pass_profile_test();
+
+   nir_shader *create_shader(gl_shader_stage stage, const char *name);
+   std::string write_profile();
+
+   void *mem_ctx;
+};
+
+nir_pass_profile_test::nir_pass_profile_test()
+{
+   /* The environment is only looked at by the first pass of the process,
+    * and the profile is written at exit, which nothing reads here.
+    */
+   setenv("NIR_PASS_PROFILE", "/dev/null", 1);
+   mem_ctx = ralloc_context(NULL);
+}
+
+nir_pass_profile_test::~nir_pass_profile_test()
+{
+   ralloc_free(mem_ctx);
+}
+
+/* A shader with an x + 0 for nir_opt_algebraic to clean up. */
+nir_shader *
+nir_pass_profile_test::create_shader(gl_shader_stage stage, const char *name)
+{
+   static const nir_shader_compiler_options options = { };
+   nir_builder b;
+
+   nir_builder_init_simple_shader(&b, mem_ctx, stage, &options);
+   b.shader->info.name = ralloc_strdup(b.shader, name);
+
+   nir_variable *in = nir_variable_create(b.shader, nir_var_shader_in,
+                                          glsl_int_type(), "in");
+   nir_variable *out = nir_variable_create(b.shader, nir_var_shader_out,
+                                           glsl_int_type(), "out");
+   nir_ssa_def *x = nir_load_var(&b, in);
+   nir_store_var(&b, out, nir_iadd(&b, x, nir_imm_int(&b, 0)), 0x1);
+
+   return b.shader;
+}
+
+std::string
+nir_pass_profile_test::write_profile()
+{
+   FILE *fp = tmpfile();
+   std::string json;
+   char buf[4096];
+   size_t size;
+
+   nir_pass_profile_write(fp);
+   rewind(fp);
+   while ((size = fread(buf, 1, sizeof(buf), fp)) > 0)
+      json.append(buf, size);
+   fclose(fp);
+
+   return json;
+}
+
+} // namespace
+
+TEST_F(nir_pass_profile_test, per_shader_and_totals)
+{
+   nir_shader *fs = create_shader(MESA_SHADER_FRAGMENT, "first");
+   nir_shader *vs = create_shader(MESA_SHADER_VERTEX, "second \"quoted\"");
+   bool progress = false;
+
+   ASSERT_TRUE(should_profile_nir());
+
+   NIR_PASS(progress, fs, nir_opt_algebraic);
+   NIR_PASS_V(fs, nir_opt_dce);
+   NIR_PASS(progress, vs, nir_opt_algebraic);
+   NIR_PASS(progress, vs, nir_opt_algebraic);
+   EXPECT_TRUE(progress);
+
+   EXPECT_NE(0u, fs->profile_id);
+   EXPECT_NE(0u, vs->profile_id);
+   EXPECT_NE(fs->profile_id, vs->profile_id);
+
+   /* A clone is profiled as a shader of its own. */
+   nir_shader *clone = nir_shader_clone(mem_ctx, fs);
+   EXPECT_EQ(0u, clone->profile_id);
+
+   std::string json = write_profile();
+
+   /* Sums per pass name and stage. */
+   EXPECT_NE(std::string::npos,
+             json.find("{\"pass\": \"nir_opt_algebraic\", "
+                       "\"stage\": \"fragment\", "
+                       "\"calls\": 1, \"progress\": 1, "));
+   EXPECT_NE(std::string::npos,
+             json.find("{\"pass\": \"nir_opt_algebraic\", "
+                       "\"stage\": \"vertex\", "
+                       "\"calls\": 2, \"progress\": 1, "));
+   EXPECT_NE(std::string::npos,
+             json.find("{\"pass\": \"nir_opt_dce\", "
+                       "\"stage\": \"fragment\", "
+                       "\"calls\": 1, \"progress\": null, "));
+
+   /* Each shader with the passes that ran on it. */
+   size_t first = json.find("\"name\": \"first\", \"label\": null, "
+                            "\"passes\": [\n"
+                            "      {\"pass\": \"nir_opt_algebraic\", "
+                            "\"calls\": 1, \"progress\": 1, ");
+   size_t second = json.find("\"name\": \"second \\\"quoted\\\"\", "
+                             "\"label\": null, \"passes\": [\n"
+                             "      {\"pass\": \"nir_opt_algebraic\", "
+                             "\"calls\": 2, \"progress\": 1, ");
+   EXPECT_NE(std::string::npos, first);
+   EXPECT_NE(std::string::npos, second);
+   EXPECT_LT(first, second);
+}
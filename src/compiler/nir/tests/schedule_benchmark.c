@@ -0,0 +1,438 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * Measures what nir_schedule does to register pressure and to register
+ * allocation afterwards.
+ *
+ * Usage: nir_schedule_benchmark [--latency] [dump...]
+ *
+ * The dumps are the files written by the algebraic passes when
+ * NIR_ALGEBRAIC_DUMP_DIR is set.  Without any, the benchmark makes up
+ * shaders that fetch everything they need at the top and do the math
+ * afterwards, the way shaders look after inlining helper functions.
+ *
+ * Every shader is optimized with the st_nir_opts pass list and lowered to
+ * scalars.  Then, with and without nir_schedule, the most 32-bit values
+ * live at once is counted, and an interference graph with a node per
+ * component is colored with util/register_allocate using NUM_REGS
+ * registers, the way a scalar backend would.  The numbers are printed the
+ * way shader-db's report.py prints them, along with how many shaders
+ * didn't fit and the time taken by the scheduler and the allocator.
+ *
+ * nir_schedule schedules for register pressure, unless --latency is given,
+ * which passes it a latency threshold of NUM_REGS.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nir_benchmark_util.h"
+#include "util/os_time.h"
+#include "util/register_allocate.h"
+
+#define NUM_REGS 64
+
+struct alloc_stats {
+   unsigned max_pressure;
+   bool colored;
+   int64_t time;
+};
+
+static unsigned num_shaders;
+static struct nir_benchmark_report pressure_report, excess_report;
+static unsigned spilled_before, spilled_after;
+static int64_t ra_time_before, ra_time_after, schedule_time;
+static struct ra_regs *regs;
+static unsigned latency_threshold;
+
+struct graph_state {
+   struct ra_graph *g;
+   BITSET_WORD *live;
+   nir_ssa_def **live_defs;
+   unsigned *first_node;
+   unsigned num_live_defs;
+   unsigned pressure;
+   unsigned max_pressure;
+};
+
+static unsigned
+def_size(nir_ssa_def *def)
+{
+   return def->num_components * DIV_ROUND_UP(def->bit_size, 32);
+}
+
+/* Constants and undefs become immediates, as nir_schedule assumes. */
+static bool
+def_is_counted(nir_ssa_def *def)
+{
+   return def->parent_instr->type != nir_instr_type_load_const &&
+          def->parent_instr->type != nir_instr_type_ssa_undef;
+}
+
+static bool
+number_def(nir_ssa_def *def, void *data)
+{
+   struct graph_state *state = data;
+
+   state->live_defs[def->index] = def;
+   state->num_live_defs = MAX2(state->num_live_defs, def->index + 1);
+   return true;
+}
+
+static void
+interfere_with_live(struct graph_state *state, nir_ssa_def *def)
+{
+   unsigned first = state->first_node[def->index];
+   unsigned i;
+   BITSET_WORD tmp;
+
+   for (unsigned c = 0; c < def_size(def); c++) {
+      for (unsigned d = 0; d < c; d++)
+         ra_add_node_interference(state->g, first + c, first + d);
+
+      BITSET_FOREACH_SET(i, tmp, state->live, state->num_live_defs) {
+         nir_ssa_def *other = state->live_defs[i];
+         if (other == def)
+            continue;
+
+         for (unsigned d = 0; d < def_size(other); d++) {
+            ra_add_node_interference(state->g, first + c,
+                                     state->first_node[i] + d);
+         }
+      }
+   }
+}
+
+static bool
+kill_def(nir_ssa_def *def, void *data)
+{
+   struct graph_state *state = data;
+
+   if (!def_is_counted(def))
+      return true;
+
+   /* Defs nobody reads still get written. */
+   interfere_with_live(state, def);
+
+   if (BITSET_TEST(state->live, def->index)) {
+      BITSET_CLEAR(state->live, def->index);
+      state->pressure -= def_size(def);
+   }
+
+   return true;
+}
+
+static bool
+gen_src(nir_src *src, void *data)
+{
+   struct graph_state *state = data;
+
+   if (!src->is_ssa || !def_is_counted(src->ssa))
+      return true;
+
+   nir_ssa_def *def = src->ssa;
+   if (!BITSET_TEST(state->live, def->index)) {
+      BITSET_SET(state->live, def->index);
+      state->pressure += def_size(def);
+   }
+
+   return true;
+}
+
+/**
+ * Walks the block backwards from what is live out of it, adding an edge
+ * between every def and everything live where it is written.
+ */
+static void
+add_block_interference(struct graph_state *state, nir_block *block)
+{
+   unsigned words = BITSET_WORDS(state->num_live_defs);
+   unsigned i;
+   BITSET_WORD tmp;
+
+   memcpy(state->live, block->live_out, words * sizeof(BITSET_WORD));
+   state->pressure = 0;
+   BITSET_FOREACH_SET(i, tmp, state->live, state->num_live_defs) {
+      if (def_is_counted(state->live_defs[i]))
+         state->pressure += def_size(state->live_defs[i]);
+      else
+         BITSET_CLEAR(state->live, i);
+   }
+
+   nir_if *following_if = nir_block_get_following_if(block);
+   if (following_if)
+      gen_src(&following_if->condition, state);
+
+   state->max_pressure = MAX2(state->max_pressure, state->pressure);
+
+   nir_foreach_instr_reverse(instr, block) {
+      if (instr->type == nir_instr_type_phi)
+         break;
+
+      nir_foreach_ssa_def(instr, kill_def, state);
+      nir_foreach_src(instr, gen_src, state);
+      state->max_pressure = MAX2(state->max_pressure, state->pressure);
+   }
+
+   /* The phis are all written at the top of the block. */
+   nir_foreach_instr(instr, block) {
+      if (instr->type != nir_instr_type_phi)
+         break;
+
+      nir_ssa_def *def = &nir_instr_as_phi(instr)->dest.ssa;
+      if (def_is_counted(def))
+         interfere_with_live(state, def);
+   }
+}
+
+static struct alloc_stats
+allocate(nir_shader *shader)
+{
+   struct alloc_stats stats = { 0 };
+   nir_function_impl *impl = nir_shader_get_entrypoint(shader);
+
+   nir_metadata_require(impl, nir_metadata_live_ssa_defs |
+                              nir_metadata_block_index);
+
+   struct graph_state state = {
+      .live_defs = calloc(impl->ssa_alloc, sizeof(nir_ssa_def *)),
+      .first_node = calloc(impl->ssa_alloc, sizeof(unsigned)),
+   };
+
+   nir_foreach_block(block, impl) {
+      nir_foreach_instr(instr, block)
+         nir_foreach_ssa_def(instr, number_def, &state);
+   }
+
+   unsigned num_nodes = 0;
+   for (unsigned i = 0; i < state.num_live_defs; i++) {
+      state.first_node[i] = num_nodes;
+      if (state.live_defs[i])
+         num_nodes += def_size(state.live_defs[i]);
+   }
+
+   state.g = ra_alloc_interference_graph(regs, num_nodes);
+   state.live = calloc(BITSET_WORDS(state.num_live_defs),
+                       sizeof(BITSET_WORD));
+
+   nir_foreach_block(block, impl)
+      add_block_interference(&state, block);
+
+   stats.max_pressure = state.max_pressure;
+
+   int64_t start = os_time_get_nano();
+   stats.colored = ra_allocate(state.g);
+   stats.time = os_time_get_nano() - start;
+
+   ralloc_free(state.g);
+   free(state.live);
+   free(state.live_defs);
+   free(state.first_node);
+
+   return stats;
+}
+
+static bool
+run_shader(nir_shader *shader, const char *path)
+{
+   nir_benchmark_optimize(shader);
+
+   num_shaders++;
+
+   struct alloc_stats before = allocate(shader);
+
+   const nir_schedule_options options = {
+      .latency_threshold = latency_threshold,
+   };
+   int64_t start = os_time_get_nano();
+   nir_schedule(shader, &options);
+   schedule_time += os_time_get_nano() - start;
+   nir_validate_shader(shader, "after nir_schedule");
+
+   struct alloc_stats after = allocate(shader);
+
+   nir_benchmark_report_add(&pressure_report,
+                            before.max_pressure, after.max_pressure);
+   nir_benchmark_report_add(&excess_report,
+                            MAX2(before.max_pressure, NUM_REGS) - NUM_REGS,
+                            MAX2(after.max_pressure, NUM_REGS) - NUM_REGS);
+   spilled_before += !before.colored;
+   spilled_after += !after.colored;
+   ra_time_before += before.time;
+   ra_time_after += after.time;
+
+   return true;
+}
+
+#define MAX_FETCHES 8
+
+/* What one inlined helper fetched, and what it does with it. */
+struct helper {
+   nir_ssa_def *fetches[MAX_FETCHES];
+   unsigned num_fetches;
+   unsigned in;
+};
+
+struct shader_gen {
+   nir_builder b;
+   nir_ssa_def *inputs[4];
+   nir_variable *acc[4];
+};
+
+static void
+make_fetches(struct shader_gen *gen, struct helper *helper, unsigned arg)
+{
+   nir_builder *b = &gen->b;
+   nir_ssa_def *index = nir_f2i32(b, gen->inputs[helper->in]);
+   nir_ssa_def *base = nir_imul(b, index, nir_imm_int(b, 256));
+
+   for (unsigned i = 0; i < helper->num_fetches; i++) {
+      nir_ssa_def *offset = nir_iadd(b, base, nir_imm_int(b, 64 * arg + 4 * i));
+      helper->fetches[i] = nir_benchmark_load_uniform(b, offset);
+   }
+}
+
+static void
+make_math(struct shader_gen *gen, struct helper *helper)
+{
+   nir_builder *b = &gen->b;
+   nir_ssa_def *in = gen->inputs[helper->in];
+
+   nir_ssa_def *x = nir_fmul(b, helper->fetches[0], in);
+   for (unsigned i = 1; i < helper->num_fetches; i++) {
+      switch (rand() % 3) {
+      case 0: x = nir_ffma(b, x, in, helper->fetches[i]); break;
+      case 1: x = nir_fmax(b, x, helper->fetches[i]); break;
+      case 2: x = nir_fmul(b, x, nir_fsat(b, helper->fetches[i])); break;
+      }
+   }
+
+   nir_variable *acc = gen->acc[rand() % 4];
+   nir_store_var(b, acc, nir_fadd(b, nir_load_var(b, acc), x), 0x1);
+}
+
+static void
+make_helper(struct shader_gen *gen, struct helper *helper, unsigned arg)
+{
+   helper->num_fetches = 2 + rand() % (MAX_FETCHES - 1);
+   helper->in = rand() % 4;
+   make_fetches(gen, helper, arg);
+}
+
+/**
+ * Makes a shader out of helpers that fetch a few values and combine them.
+ * In most shaders all of the fetches of a block come first, which is what
+ * inlining and the loads being hoisted out of the math give, and in the
+ * others each helper's math follows its own fetches.  Some helpers are
+ * called under an if, and those are whole inside it.
+ */
+static nir_shader *
+make_shader(void *mem_ctx, const nir_shader_compiler_options *options)
+{
+   unsigned count = 2 + rand() % 40;
+   struct shader_gen gen;
+   nir_builder *b = &gen.b;
+
+   nir_builder_init_simple_shader(b, mem_ctx, MESA_SHADER_FRAGMENT, options);
+
+   for (unsigned i = 0; i < 4; i++) {
+      gen.inputs[i] = nir_benchmark_load_input(b, glsl_float_type(), i);
+
+      gen.acc[i] = nir_local_variable_create(b->impl, glsl_float_type(),
+                                             "acc");
+      nir_store_var(b, gen.acc[i], nir_imm_float(b, 0.0), 0x1);
+   }
+
+   struct helper *pending = ralloc_array(mem_ctx, struct helper, count);
+   bool fetches_first = rand() % 4 != 0;
+   unsigned num_pending = 0;
+
+   for (unsigned i = 0; i < count; i++) {
+      struct helper helper;
+
+      if (rand() % 4 == 0) {
+         for (unsigned p = 0; p < num_pending; p++)
+            make_math(&gen, &pending[p]);
+         num_pending = 0;
+
+         nir_push_if(b, nir_flt(b, gen.inputs[rand() % 4],
+                                nir_imm_float(b, 0.5)));
+         make_helper(&gen, &helper, i);
+         make_math(&gen, &helper);
+         nir_pop_if(b, NULL);
+      } else if (fetches_first) {
+         make_helper(&gen, &pending[num_pending++], i);
+      } else {
+         make_helper(&gen, &helper, i);
+         make_math(&gen, &helper);
+      }
+   }
+
+   for (unsigned p = 0; p < num_pending; p++)
+      make_math(&gen, &pending[p]);
+
+   nir_benchmark_store_output(b, nir_vec4(b, nir_load_var(b, gen.acc[0]),
+                                          nir_load_var(b, gen.acc[1]),
+                                          nir_load_var(b, gen.acc[2]),
+                                          nir_load_var(b, gen.acc[3])));
+
+   return b->shader;
+}
+
+int
+main(int argc, char **argv)
+{
+   void *regs_ctx = ralloc_context(NULL);
+
+   regs = ra_alloc_reg_set(regs_ctx, NUM_REGS, true);
+   unsigned reg_class = ra_alloc_reg_class(regs);
+   for (unsigned r = 0; r < NUM_REGS; r++)
+      ra_class_add_reg(regs, reg_class, r);
+   ra_set_finalize(regs, NULL);
+
+   int first_dump = 1;
+   if (argc > 1 && strcmp(argv[1], "--latency") == 0) {
+      latency_threshold = NUM_REGS;
+      first_dump++;
+   }
+
+   if (!nir_benchmark_run_corpus((const char *const *)argv + first_dump,
+                                 argc - first_dump, run_shader, make_shader,
+                                 NULL, 200))
+      return 1;
+
+   printf("%u shaders, %u registers\n\n", num_shaders, NUM_REGS);
+   nir_benchmark_report_print("max live values", &pressure_report);
+   nir_benchmark_report_print("live values over the registers",
+                              &excess_report);
+   printf("shaders that don't fit: %u -> %u\n", spilled_before, spilled_after);
+   printf("allocation time: %.3f ms -> %.3f ms\n",
+          ra_time_before / 1e6, ra_time_after / 1e6);
+   printf("scheduling time: %.3f ms\n", schedule_time / 1e6);
+
+   ralloc_free(regs_ctx);
+
+   return 0;
+}
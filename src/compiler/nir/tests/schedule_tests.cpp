@@ -0,0 +1,218 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+#include <gtest/gtest.h>
+#include "nir.h"
+#include "nir_builder.h"
+
+namespace {
+
+class nir_schedule_test : public ::testing::Test {
+protected:
+   nir_schedule_test();
+   ~nir_schedule_test();
+
+   nir_ssa_def *load_input(unsigned index);
+   nir_intrinsic_instr *store_output(nir_ssa_def *value);
+   nir_ssa_def *load_uniform(unsigned offset);
+
+   unsigned position(nir_instr *instr);
+   void make_loads_then_sums();
+   void expect_sum_before_last_load();
+
+   nir_builder b;
+   nir_schedule_options schedule_options;
+   nir_ssa_def *x, *y;
+   nir_ssa_def *u[8], *sum[4];
+   unsigned num_outputs;
+};
+
+nir_schedule_test::nir_schedule_test()
+{
+   static const nir_shader_compiler_options options = { };
+   nir_builder_init_simple_shader(&b, NULL, MESA_SHADER_FRAGMENT, &options);
+
+   memset(&schedule_options, 0, sizeof(schedule_options));
+
+   num_outputs = 0;
+   x = load_input(0);
+   y = load_input(1);
+}
+
+nir_schedule_test::~nir_schedule_test()
+{
+   if (HasFailure()) {
+      printf("\nShader from the failed test:\n\n");
+      nir_print_shader(b.shader, stdout);
+   }
+
+   ralloc_free(b.shader);
+}
+
+nir_ssa_def *
+nir_schedule_test::load_input(unsigned index)
+{
+   nir_variable *in = nir_variable_create(b.shader, nir_var_shader_in,
+                                          glsl_float_type(), "in");
+   in->data.location = VARYING_SLOT_VAR0 + index;
+   return nir_load_var(&b, in);
+}
+
+nir_intrinsic_instr *
+nir_schedule_test::store_output(nir_ssa_def *value)
+{
+   nir_variable *out = nir_variable_create(b.shader, nir_var_shader_out,
+                                           glsl_float_type(), "out");
+   out->data.location = FRAG_RESULT_DATA0 + num_outputs++;
+   nir_store_var(&b, out, value, 0x1);
+
+   nir_block *block = nir_cursor_current_block(b.cursor);
+   return nir_instr_as_intrinsic(nir_block_last_instr(block));
+}
+
+nir_ssa_def *
+nir_schedule_test::load_uniform(unsigned offset)
+{
+   nir_intrinsic_instr *load =
+      nir_intrinsic_instr_create(b.shader, nir_intrinsic_load_uniform);
+   load->num_components = 1;
+   load->src[0] = nir_src_for_ssa(nir_imm_int(&b, offset));
+   nir_ssa_dest_init(&load->instr, &load->dest, 1, 32, NULL);
+   nir_builder_instr_insert(&b, &load->instr);
+   return &load->dest.ssa;
+}
+
+unsigned
+nir_schedule_test::position(nir_instr *instr)
+{
+   unsigned pos = 0;
+   nir_foreach_instr(other, instr->block) {
+      if (other == instr)
+         return pos;
+      pos++;
+   }
+   return ~0u;
+}
+
+/* Loads eight values up front, then adds them up pairwise. */
+void
+nir_schedule_test::make_loads_then_sums()
+{
+   for (unsigned i = 0; i < 8; i++)
+      u[i] = load_uniform(4 * i);
+
+   for (unsigned i = 0; i < 4; i++)
+      sum[i] = nir_fadd(&b, u[2 * i], u[2 * i + 1]);
+   store_output(nir_fadd(&b, nir_fadd(&b, sum[0], sum[1]),
+                         nir_fadd(&b, sum[2], sum[3])));
+}
+
+void
+nir_schedule_test::expect_sum_before_last_load()
+{
+   unsigned first_sum = position(sum[0]->parent_instr);
+   for (unsigned i = 1; i < 4; i++)
+      first_sum = MIN2(first_sum, position(sum[i]->parent_instr));
+   unsigned last_load = 0;
+   for (unsigned i = 0; i < 8; i++)
+      last_load = MAX2(last_load, position(u[i]->parent_instr));
+
+   EXPECT_LT(first_sum, last_load);
+}
+
+} // namespace
+
+TEST_F(nir_schedule_test, loads_used_up_by_default)
+{
+   make_loads_then_sums();
+
+   ASSERT_TRUE(nir_schedule(b.shader, &schedule_options));
+   nir_validate_shader(b.shader, NULL);
+
+   /* The first sum goes before the loads it doesn't need. */
+   expect_sum_before_last_load();
+}
+
+TEST_F(nir_schedule_test, order_kept_without_lower_pressure)
+{
+   nir_ssa_def *sum = nir_fadd(&b, x, y);
+   nir_ssa_def *u = load_uniform(0);
+   store_output(nir_fmul(&b, sum, u));
+
+   EXPECT_FALSE(nir_schedule(b.shader, &schedule_options));
+   nir_validate_shader(b.shader, NULL);
+
+   EXPECT_LT(position(sum->parent_instr), position(u->parent_instr));
+}
+
+TEST_F(nir_schedule_test, loads_first_below_threshold)
+{
+   nir_ssa_def *sum = nir_fadd(&b, x, y);
+   nir_ssa_def *u = load_uniform(0);
+   store_output(nir_fmul(&b, sum, u));
+
+   schedule_options.latency_threshold = 64;
+   ASSERT_TRUE(nir_schedule(b.shader, &schedule_options));
+   nir_validate_shader(b.shader, NULL);
+
+   EXPECT_LT(position(u->parent_instr), position(sum->parent_instr));
+}
+
+TEST_F(nir_schedule_test, loads_used_up_above_threshold)
+{
+   make_loads_then_sums();
+
+   schedule_options.latency_threshold = 4;
+   ASSERT_TRUE(nir_schedule(b.shader, &schedule_options));
+   nir_validate_shader(b.shader, NULL);
+
+   expect_sum_before_last_load();
+}
+
+TEST_F(nir_schedule_test, stores_stay_in_order)
+{
+   nir_ssa_def *slow = nir_fsqrt(&b, nir_fmul(&b, x, y));
+   nir_intrinsic_instr *first = store_output(slow);
+   nir_intrinsic_instr *second = store_output(load_uniform(0));
+
+   schedule_options.latency_threshold = 64;
+   nir_schedule(b.shader, &schedule_options);
+   nir_validate_shader(b.shader, NULL);
+
+   EXPECT_LT(position(&first->instr), position(&second->instr));
+}
+
+TEST_F(nir_schedule_test, jump_stays_last)
+{
+   nir_loop *loop = nir_push_loop(&b);
+   nir_ssa_def *sum = nir_fadd(&b, x, y);
+   store_output(nir_fmul(&b, sum, load_uniform(0)));
+   nir_jump(&b, nir_jump_break);
+   nir_pop_loop(&b, loop);
+
+   schedule_options.latency_threshold = 64;
+   nir_schedule(b.shader, &schedule_options);
+   nir_validate_shader(b.shader, NULL);
+
+   nir_instr *last = nir_block_last_instr(sum->parent_instr->block);
+   EXPECT_EQ(last->type, nir_instr_type_jump);
+}
@@ -0,0 +1,222 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * Times serializing, deserializing and cloning shaders.
+ *
+ * Usage: nir_serialize_benchmark [dump...]
+ *
+ * The dumps are the files written by the algebraic passes when
+ * NIR_ALGEBRAIC_DUMP_DIR is set.  Without any, the benchmark makes up
+ * shaders with nested ifs and loops and takes them out of SSA.
+ *
+ * Every shader is serialized, deserialized and cloned a few times, and the
+ * best total time of each over the whole corpus is printed, along with the
+ * size of the serialized shaders.  Serializing a deserialized shader has to
+ * give the same blob back.
+ *
+ * The memory the instructions of the corpus take up is printed too, per
+ * kind of instruction, as nir_print_memory_stats() reports it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "nir_benchmark_util.h"
+#include "nir_serialize.h"
+#include "util/os_time.h"
+
+#define NUM_RUNS 5
+
+static unsigned num_shaders, num_instrs;
+static size_t blob_size;
+static nir_memory_stats memory_stats;
+static int64_t serialize_time[NUM_RUNS];
+static int64_t deserialize_time[NUM_RUNS];
+static int64_t clone_time[NUM_RUNS];
+
+static bool
+run_shader(nir_shader *shader, const char *path)
+{
+   num_shaders++;
+   num_instrs += nir_benchmark_count_instrs(shader, NULL);
+   nir_gather_memory_stats(shader, &memory_stats);
+
+   for (unsigned run = 0; run < NUM_RUNS; run++) {
+      struct blob blob, check;
+      struct blob_reader reader;
+      int64_t start;
+
+      blob_init(&blob);
+      start = os_time_get_nano();
+      nir_serialize(&blob, shader);
+      serialize_time[run] += os_time_get_nano() - start;
+
+      blob_reader_init(&reader, blob.data, blob.size);
+      start = os_time_get_nano();
+      nir_shader *copy = nir_deserialize(NULL, shader->options, &reader);
+      deserialize_time[run] += os_time_get_nano() - start;
+
+      start = os_time_get_nano();
+      nir_shader *clone = nir_shader_clone(NULL, shader);
+      clone_time[run] += os_time_get_nano() - start;
+
+      if (run == 0) {
+         blob_size += blob.size;
+
+         /* What comes back has to be the same shader. */
+         blob_init(&check);
+         nir_serialize(&check, copy);
+         if (reader.overrun || reader.current != reader.end ||
+             check.size != blob.size ||
+             memcmp(check.data, blob.data, blob.size)) {
+            fprintf(stderr, "Deserializing gave a different shader\n");
+            exit(1);
+         }
+         blob_finish(&check);
+
+         nir_validate_shader(copy, "after deserializing");
+         nir_validate_shader(clone, "after cloning");
+      }
+
+      ralloc_free(copy);
+      ralloc_free(clone);
+      blob_finish(&blob);
+   }
+
+   return true;
+}
+
+static void
+make_code(nir_builder *b, nir_variable **vars, unsigned depth, unsigned count)
+{
+   static const float consts[] = { 0.0, 1.0, -1.0, 0.5, 2.0, 0.3 };
+
+   for (unsigned i = 0; i < count; i++) {
+      nir_variable *dst = vars[rand() % 4];
+      nir_ssa_def *x = nir_load_var(b, vars[rand() % 4]);
+      nir_ssa_def *y = nir_load_var(b, vars[rand() % 4]);
+      nir_ssa_def *c = nir_imm_float(b, consts[rand() % ARRAY_SIZE(consts)]);
+
+      switch (depth > 0 ? rand() % 8 : rand() % 6) {
+      case 0:
+         nir_store_var(b, dst, nir_fadd(b, x, y), 0xf);
+         break;
+      case 1:
+         nir_store_var(b, dst, nir_ffma(b, x, c, y), 0xf);
+         break;
+      case 2:
+         nir_store_var(b, dst, nir_fmax(b, x, nir_fneg(b, y)), 0xf);
+         break;
+      case 3:
+         nir_store_var(b, dst, nir_vec4(b, nir_channel(b, x, 1),
+                                        nir_channel(b, y, 0),
+                                        nir_fdot4(b, x, y), c), 0xf);
+         break;
+      case 4:
+         nir_store_var(b, dst, nir_fmul(b, nir_fabs(b, x), c), 0x3);
+         break;
+      case 5:
+         nir_store_var(b, dst,
+                       nir_bcsel(b, nir_flt(b, x, y), x, nir_fsat(b, y)),
+                       0xf);
+         break;
+      case 6:
+         nir_push_if(b, nir_flt(b, nir_channel(b, x, 0),
+                                nir_channel(b, y, 1)));
+         make_code(b, vars, depth - 1, 3 + rand() % 6);
+         nir_push_else(b, NULL);
+         make_code(b, vars, depth - 1, rand() % 4);
+         nir_pop_if(b, NULL);
+         break;
+      case 7: {
+         nir_loop *loop = nir_push_loop(b);
+         nir_push_if(b, nir_fge(b, nir_channel(b, x, 2), c));
+         nir_jump(b, nir_jump_break);
+         nir_pop_if(b, NULL);
+         make_code(b, vars, depth - 1, 3 + rand() % 5);
+         nir_pop_loop(b, loop);
+         break;
+      }
+      }
+   }
+}
+
+/**
+ * Makes up a fragment shader that computes its output in a few local vec4
+ * variables, with vector and scalar math nested in ifs and loops, and
+ * lowers it to SSA, which gives it phis.
+ */
+static nir_shader *
+make_shader(void *mem_ctx, const nir_shader_compiler_options *options)
+{
+   unsigned count = 10 + rand() % 40;
+   nir_variable *vars[4];
+   nir_builder b;
+
+   nir_builder_init_simple_shader(&b, mem_ctx, MESA_SHADER_FRAGMENT, options);
+
+   for (unsigned i = 0; i < 4; i++) {
+      vars[i] = nir_local_variable_create(b.impl, glsl_vec4_type(), "v");
+      nir_store_var(&b, vars[i],
+                    nir_benchmark_load_input(&b, glsl_vec4_type(), i), 0xf);
+   }
+
+   make_code(&b, vars, 3, count);
+
+   nir_benchmark_store_output(&b, nir_load_var(&b, vars[rand() % 4]));
+
+   NIR_PASS_V(b.shader, nir_lower_vars_to_ssa);
+   NIR_PASS_V(b.shader, nir_copy_prop);
+   NIR_PASS_V(b.shader, nir_opt_dce);
+
+   return b.shader;
+}
+
+int
+main(int argc, char **argv)
+{
+   static const nir_shader_compiler_options options = {
+      .lower_sub = true,
+      .native_integers = true,
+   };
+
+   if (!nir_benchmark_run_corpus((const char *const *)argv + 1, argc - 1,
+                                 run_shader, make_shader, &options, 100))
+      return 1;
+
+   printf("%u shaders, %u instructions, %zu bytes serialized\n"
+          "  serialize:   %.3f ms\n"
+          "  deserialize: %.3f ms\n"
+          "  clone:       %.3f ms\n",
+          num_shaders, num_instrs, blob_size,
+          nir_benchmark_best_time(serialize_time, NUM_RUNS) / 1e6,
+          nir_benchmark_best_time(deserialize_time, NUM_RUNS) / 1e6,
+          nir_benchmark_best_time(clone_time, NUM_RUNS) / 1e6);
+
+   printf("\n");
+   nir_print_memory_stats(&memory_stats, stdout);
+
+   return 0;
+}
@@ -30,6 +30,7 @@
 #include "draw_context.h"
 #include "draw_vs.h"
 #include "draw_gs.h"
+#include "pipe/p_screen.h"
 
 #include "gallivm/lp_bld_arit.h"
 #include "gallivm/lp_bld_arit_overflow.h"
@@ -52,11 +53,14 @@
 
 #include "tgsi/tgsi_exec.h"
 #include "tgsi/tgsi_dump.h"
+#include "tgsi/tgsi_parse.h"
 
 #include "util/u_math.h"
 #include "util/u_pointer.h"
 #include "util/u_string.h"
 #include "util/simple_list.h"
+#include "util/disk_cache.h"
+#include "util/mesa-sha1.h"
 
 
 #define DEBUG_STORE 0
@@ -539,6 +543,22 @@ draw_llvm_destroy(struct draw_llvm *llvm)
 }
 
 
+/**
+ * The disk cache of the driver's screen, if any, in which the machine
+ * code of the variants is kept across runs.
+ */
+static struct disk_cache *
+draw_llvm_disk_cache(const struct draw_llvm *llvm)
+{
+   struct pipe_context *pipe = llvm->draw->pipe;
+
+   if (!pipe || !pipe->screen->get_disk_shader_cache)
+      return NULL;
+
+   return pipe->screen->get_disk_shader_cache(pipe->screen);
+}
+
+
 /**
  * Create LLVM-generated code for a vertex shader.
  */
@@ -552,6 +572,10 @@ draw_llvm_create_variant(struct draw_llvm *llvm,
       llvm_vertex_shader(llvm->draw->vs.vertex_shader);
    LLVMTypeRef vertex_header;
    char module_name[64];
+   struct disk_cache *disk_cache = draw_llvm_disk_cache(llvm);
+   struct lp_cached_code cached = { 0 };
+   unsigned char ir_sha1[20];
+   boolean needs_caching = FALSE;
 
    variant = MALLOC(sizeof *variant +
                     shader->variant_key_size -
@@ -565,7 +589,32 @@ draw_llvm_create_variant(struct draw_llvm *llvm,
    util_snprintf(module_name, sizeof(module_name), "draw_llvm_vs_variant%u",
                  variant->shader->variants_cached);
 
-   variant->gallivm = gallivm_create(module_name, llvm->context);
+   if (disk_cache) {
+      const struct draw_context *draw = llvm->draw;
+      const struct tgsi_token *tokens = draw->vs.vertex_shader->state.tokens;
+      struct mesa_sha1 ctx;
+
+      /* Besides the key, the code depends on the output slots */
+      _mesa_sha1_init(&ctx);
+      _mesa_sha1_update(&ctx, tokens,
+                        tgsi_num_tokens(tokens) * sizeof(struct tgsi_token));
+      _mesa_sha1_update(&ctx, key, shader->variant_key_size);
+      _mesa_sha1_update(&ctx, &num_inputs, sizeof num_inputs);
+      _mesa_sha1_update(&ctx, &draw->vs.position_output,
+                        sizeof draw->vs.position_output);
+      _mesa_sha1_update(&ctx, &draw->vs.clipvertex_output,
+                        sizeof draw->vs.clipvertex_output);
+      _mesa_sha1_update(&ctx, draw->vs.ccdistance_output,
+                        sizeof draw->vs.ccdistance_output);
+      _mesa_sha1_update(&ctx, &draw->vs.edgeflag_output,
+                        sizeof draw->vs.edgeflag_output);
+      _mesa_sha1_final(&ctx, ir_sha1);
+
+      gallivm_disk_cache_find(disk_cache, ir_sha1, &cached);
+      needs_caching = !cached.data_size;
+   }
+
+   variant->gallivm = gallivm_create(module_name, llvm->context, &cached);
 
    create_jit_types(variant);
 
@@ -589,6 +638,10 @@ draw_llvm_create_variant(struct draw_llvm *llvm,
 
    gallivm_free_ir(variant->gallivm);
 
+   if (needs_caching)
+      gallivm_disk_cache_insert(disk_cache, ir_sha1, &cached);
+   free(cached.data);
+
    variant->list_item_global.base = variant;
    variant->list_item_local.base = variant;
    /*variant->no = */shader->variants_created++;
@@ -615,21 +668,20 @@ generate_vs(struct draw_llvm_variant *variant,
       draw_jit_context_vs_constants(variant->gallivm, context_ptr);
    LLVMValueRef num_consts_ptr =
       draw_jit_context_num_vs_constants(variant->gallivm, context_ptr);
+   struct lp_build_tgsi_params params;
 
-   lp_build_tgsi_soa(variant->gallivm,
-                     tokens,
-                     vs_type,
-                     NULL /*struct lp_build_mask_context *mask*/,
-                     consts_ptr,
-                     num_consts_ptr,
-                     system_values,
-                     inputs,
-                     outputs,
-                     context_ptr,
-                     NULL,
-                     draw_sampler,
-                     &llvm->draw->vs.vertex_shader->info,
-                     NULL);
+   memset(&params, 0, sizeof(params));
+   params.type = vs_type;
+   params.mask = NULL; /* struct lp_build_mask_context *mask */
+   params.consts_ptr = consts_ptr;
+   params.const_sizes_ptr = num_consts_ptr;
+   params.system_values = system_values;
+   params.inputs = inputs;
+   params.context_ptr = context_ptr;
+   params.sampler = draw_sampler;
+   params.info = &llvm->draw->vs.vertex_shader->info;
+
+   lp_build_tgsi_soa(variant->gallivm, tokens, &params, outputs);
 
    {
       LLVMValueRef out;
@@ -1574,8 +1626,8 @@ draw_llvm_generate(struct draw_llvm *llvm, struct draw_llvm_variant *variant)
 
    memset(&system_values, 0, sizeof(system_values));
 
-   util_snprintf(func_name, sizeof(func_name), "draw_llvm_vs_variant%u",
-                 variant->shader->variants_cached);
+   /* Must not depend on the variant number, for the disk cache */
+   util_snprintf(func_name, sizeof(func_name), "draw_llvm_vs_variant");
 
    i = 0;
    arg_types[i++] = get_context_ptr_type(variant);       /* context */
@@ -1636,6 +1688,10 @@ draw_llvm_generate(struct draw_llvm *llvm, struct draw_llvm_variant *variant)
    lp_build_name(start_instance, "start_instance");
    lp_build_name(fetch_elts, "fetch_elts");
 
+   /* The body comes with the cached code */
+   if (gallivm_is_cached(gallivm))
+      return;
+
    /*
     * Function body
     */
@@ -2249,13 +2305,14 @@ draw_gs_llvm_generate(struct draw_llvm *llvm,
    LLVMValueRef consts_ptr, num_consts_ptr;
    LLVMValueRef outputs[PIPE_MAX_SHADER_OUTPUTS][TGSI_NUM_CHANNELS];
    struct lp_build_mask_context mask;
+   struct lp_build_tgsi_params params;
    const struct tgsi_shader_info *gs_info = &variant->shader->base.info;
    unsigned vector_length = variant->shader->base.vector_length;
 
    memset(&system_values, 0, sizeof(system_values));
 
-   util_snprintf(func_name, sizeof(func_name), "draw_llvm_gs_variant%u",
-                 variant->shader->variants_cached);
+   /* Must not depend on the variant number, for the disk cache */
+   util_snprintf(func_name, sizeof(func_name), "draw_llvm_gs_variant");
 
    assert(variant->vertex_header_ptr_type);
 
@@ -2307,6 +2364,10 @@ draw_gs_llvm_generate(struct draw_llvm *llvm,
    gs_iface.input = input_array;
    gs_iface.variant = variant;
 
+   /* The body comes with the cached code */
+   if (gallivm_is_cached(gallivm))
+      return;
+
    /*
     * Function body
     */
@@ -2343,20 +2404,18 @@ draw_gs_llvm_generate(struct draw_llvm *llvm,
       draw_gs_llvm_dump_variant_key(&variant->key);
    }
 
-   lp_build_tgsi_soa(variant->gallivm,
-                     tokens,
-                     gs_type,
-                     &mask,
-                     consts_ptr,
-                     num_consts_ptr,
-                     &system_values,
-                     NULL,
-                     outputs,
-                     context_ptr,
-                     NULL,
-                     sampler,
-                     &llvm->draw->gs.geometry_shader->info,
-                     (const struct lp_build_tgsi_gs_iface *)&gs_iface);
+   memset(&params, 0, sizeof(params));
+   params.type = gs_type;
+   params.mask = &mask;
+   params.consts_ptr = consts_ptr;
+   params.const_sizes_ptr = num_consts_ptr;
+   params.system_values = &system_values;
+   params.context_ptr = context_ptr;
+   params.sampler = sampler;
+   params.info = &llvm->draw->gs.geometry_shader->info;
+   params.gs_iface = (const struct lp_build_tgsi_gs_iface *)&gs_iface;
+
+   lp_build_tgsi_soa(variant->gallivm, tokens, &params, outputs);
 
    sampler->destroy(sampler);
 
@@ -2378,6 +2437,10 @@ draw_gs_llvm_create_variant(struct draw_llvm *llvm,
       llvm_geometry_shader(llvm->draw->gs.geometry_shader);
    LLVMTypeRef vertex_header;
    char module_name[64];
+   struct disk_cache *disk_cache = draw_llvm_disk_cache(llvm);
+   struct lp_cached_code cached = { 0 };
+   unsigned char ir_sha1[20];
+   boolean needs_caching = FALSE;
 
    variant = MALLOC(sizeof *variant +
                     shader->variant_key_size -
@@ -2391,7 +2454,25 @@ draw_gs_llvm_create_variant(struct draw_llvm *llvm,
    util_snprintf(module_name, sizeof(module_name), "draw_llvm_gs_variant%u",
                  variant->shader->variants_cached);
 
-   variant->gallivm = gallivm_create(module_name, llvm->context);
+   if (disk_cache) {
+      const struct tgsi_token *tokens =
+         llvm->draw->gs.geometry_shader->state.tokens;
+      struct mesa_sha1 ctx;
+
+      _mesa_sha1_init(&ctx);
+      _mesa_sha1_update(&ctx, tokens,
+                        tgsi_num_tokens(tokens) * sizeof(struct tgsi_token));
+      _mesa_sha1_update(&ctx, key, shader->variant_key_size);
+      _mesa_sha1_update(&ctx, &num_outputs, sizeof num_outputs);
+      _mesa_sha1_update(&ctx, &shader->base.vector_length,
+                        sizeof shader->base.vector_length);
+      _mesa_sha1_final(&ctx, ir_sha1);
+
+      gallivm_disk_cache_find(disk_cache, ir_sha1, &cached);
+      needs_caching = !cached.data_size;
+   }
+
+   variant->gallivm = gallivm_create(module_name, llvm->context, &cached);
 
    create_gs_jit_types(variant);
 
@@ -2410,6 +2491,10 @@ draw_gs_llvm_create_variant(struct draw_llvm *llvm,
 
    gallivm_free_ir(variant->gallivm);
 
+   if (needs_caching)
+      gallivm_disk_cache_insert(disk_cache, ir_sha1, &cached);
+   free(cached.data);
+
    variant->list_item_global.base = variant;
    variant->list_item_local.base = variant;
    /*variant->no = */shader->variants_created++;
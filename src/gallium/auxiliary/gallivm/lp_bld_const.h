@@ -147,6 +147,11 @@ lp_build_const_int_pointer(struct gallivm_state *gallivm, const void *ptr)
    v = LLVMBuildIntToPtr(gallivm->builder, v,
                          LLVMPointerType(int_type, 0),
                          "cast int to ptr");
+
+   /* The address is only valid in this process */
+   if (gallivm->cache)
+      gallivm->cache->dont_cache = TRUE;
+
    return v;
 }
 
@@ -0,0 +1,257 @@
+/**************************************************************************
+ *
+ * Copyright 2019 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+#include "util/u_debug.h"
+#include "util/u_memory.h"
+#include "lp_bld_coro.h"
+#include "lp_bld_const.h"
+#include "lp_bld_intr.h"
+#include "lp_bld_misc.h"
+
+
+#if LP_HAVE_CORO
+
+static LLVMTypeRef
+i8ptr_type(struct gallivm_state *gallivm)
+{
+   return LLVMPointerType(LLVMInt8TypeInContext(gallivm->context), 0);
+}
+
+
+/**
+ * Coroutine frames hold the spilled SIMD registers, so they need the
+ * alignment of the widest vector type.
+ */
+static void *
+lp_coro_malloc(int size)
+{
+   return align_malloc(size, 64);
+}
+
+
+static void
+lp_coro_free(void *ptr)
+{
+   align_free(ptr);
+}
+
+
+LLVMValueRef
+lp_build_coro_id(struct gallivm_state *gallivm)
+{
+   LLVMValueRef coro_id_args[4];
+
+   coro_id_args[0] = lp_build_const_int32(gallivm, 0);
+   coro_id_args[1] = LLVMConstPointerNull(i8ptr_type(gallivm));
+   coro_id_args[2] = coro_id_args[1];
+   coro_id_args[3] = coro_id_args[1];
+
+   return lp_build_intrinsic(gallivm->builder, "llvm.coro.id",
+                             lp_token_type(gallivm->context),
+                             coro_id_args, 4, 0);
+}
+
+
+LLVMValueRef
+lp_build_coro_size(struct gallivm_state *gallivm)
+{
+   return lp_build_intrinsic(gallivm->builder, "llvm.coro.size.i32",
+                             LLVMInt32TypeInContext(gallivm->context),
+                             NULL, 0, 0);
+}
+
+
+LLVMValueRef
+lp_build_coro_begin(struct gallivm_state *gallivm,
+                    LLVMValueRef coro_id,
+                    LLVMValueRef mem_ptr)
+{
+   LLVMValueRef coro_begin_args[2];
+
+   coro_begin_args[0] = coro_id;
+   coro_begin_args[1] = mem_ptr;
+
+   return lp_build_intrinsic(gallivm->builder, "llvm.coro.begin",
+                             i8ptr_type(gallivm),
+                             coro_begin_args, 2, 0);
+}
+
+
+LLVMValueRef
+lp_build_coro_free(struct gallivm_state *gallivm,
+                   LLVMValueRef coro_id,
+                   LLVMValueRef coro_hdl)
+{
+   LLVMValueRef coro_free_args[2];
+
+   coro_free_args[0] = coro_id;
+   coro_free_args[1] = coro_hdl;
+
+   return lp_build_intrinsic(gallivm->builder, "llvm.coro.free",
+                             i8ptr_type(gallivm),
+                             coro_free_args, 2, 0);
+}
+
+
+void
+lp_build_coro_end(struct gallivm_state *gallivm,
+                  LLVMValueRef coro_hdl)
+{
+   LLVMValueRef coro_end_args[2];
+
+   coro_end_args[0] = coro_hdl;
+   coro_end_args[1] = LLVMConstInt(LLVMInt1TypeInContext(gallivm->context),
+                                   0, 0);
+
+   lp_build_intrinsic(gallivm->builder, "llvm.coro.end",
+                      LLVMInt1TypeInContext(gallivm->context),
+                      coro_end_args, 2, 0);
+}
+
+
+void
+lp_build_coro_resume(struct gallivm_state *gallivm,
+                     LLVMValueRef coro_hdl)
+{
+   lp_build_intrinsic(gallivm->builder, "llvm.coro.resume",
+                      LLVMVoidTypeInContext(gallivm->context),
+                      &coro_hdl, 1, 0);
+}
+
+
+void
+lp_build_coro_destroy(struct gallivm_state *gallivm,
+                      LLVMValueRef coro_hdl)
+{
+   lp_build_intrinsic(gallivm->builder, "llvm.coro.destroy",
+                      LLVMVoidTypeInContext(gallivm->context),
+                      &coro_hdl, 1, 0);
+}
+
+
+/**
+ * Returns an i1 that is set once the coroutine reached its final suspend
+ * point.
+ */
+LLVMValueRef
+lp_build_coro_done(struct gallivm_state *gallivm,
+                   LLVMValueRef coro_hdl)
+{
+   return lp_build_intrinsic(gallivm->builder, "llvm.coro.done",
+                             LLVMInt1TypeInContext(gallivm->context),
+                             &coro_hdl, 1, 0);
+}
+
+
+/**
+ * Returns an i8 that is -1 when the coroutine suspends, 0 when it is
+ * resumed and 1 when it is destroyed.
+ */
+LLVMValueRef
+lp_build_coro_suspend(struct gallivm_state *gallivm,
+                      boolean final_suspend)
+{
+   LLVMValueRef coro_susp_args[2];
+
+   coro_susp_args[0] = LLVMConstNull(lp_token_type(gallivm->context));
+   coro_susp_args[1] = LLVMConstInt(LLVMInt1TypeInContext(gallivm->context),
+                                    final_suspend, 0);
+
+   return lp_build_intrinsic(gallivm->builder, "llvm.coro.suspend",
+                             LLVMInt8TypeInContext(gallivm->context),
+                             coro_susp_args, 2, 0);
+}
+
+
+/**
+ * Allocate the coroutine frame and begin the coroutine.
+ */
+LLVMValueRef
+lp_build_coro_begin_alloc_mem(struct gallivm_state *gallivm,
+                              LLVMValueRef coro_id)
+{
+   LLVMTypeRef arg_type = LLVMInt32TypeInContext(gallivm->context);
+   LLVMValueRef function, coro_size, mem_ptr;
+
+   coro_size = lp_build_coro_size(gallivm);
+
+   function = lp_build_const_func_pointer(gallivm,
+                                          func_to_pointer((func_pointer)lp_coro_malloc),
+                                          i8ptr_type(gallivm), &arg_type, 1,
+                                          "coro_malloc");
+   mem_ptr = LLVMBuildCall(gallivm->builder, function, &coro_size, 1, "");
+
+   return lp_build_coro_begin(gallivm, coro_id, mem_ptr);
+}
+
+
+/**
+ * Free the coroutine frame, if it was not elided.
+ */
+void
+lp_build_coro_free_mem(struct gallivm_state *gallivm,
+                       LLVMValueRef coro_id,
+                       LLVMValueRef coro_hdl)
+{
+   LLVMTypeRef arg_type = i8ptr_type(gallivm);
+   LLVMValueRef function, mem_ptr;
+
+   mem_ptr = lp_build_coro_free(gallivm, coro_id, coro_hdl);
+
+   function = lp_build_const_func_pointer(gallivm,
+                                          func_to_pointer((func_pointer)lp_coro_free),
+                                          LLVMVoidTypeInContext(gallivm->context),
+                                          &arg_type, 1, "coro_free");
+   LLVMBuildCall(gallivm->builder, function, &mem_ptr, 1, "");
+}
+
+
+/**
+ * Build a suspend point and branch on its result: to the suspend block of
+ * the coroutine when suspending, to the cleanup block when destroyed and
+ * to resume_block when resumed.  The final suspend point has no
+ * resume_block.
+ */
+void
+lp_build_coro_suspend_switch(struct gallivm_state *gallivm,
+                             const struct lp_build_coro_suspend_info *sus_info,
+                             LLVMBasicBlockRef resume_block,
+                             boolean final_suspend)
+{
+   LLVMTypeRef i8_type = LLVMInt8TypeInContext(gallivm->context);
+   LLVMValueRef coro_suspend, coro_switch;
+
+   coro_suspend = lp_build_coro_suspend(gallivm, final_suspend);
+   coro_switch = LLVMBuildSwitch(gallivm->builder, coro_suspend,
+                                 sus_info->suspend, resume_block ? 2 : 1);
+   LLVMAddCase(coro_switch, LLVMConstInt(i8_type, 1, 0), sus_info->cleanup);
+   if (resume_block)
+      LLVMAddCase(coro_switch, LLVMConstInt(i8_type, 0, 0), resume_block);
+}
+
+#endif /* LP_HAVE_CORO */
@@ -0,0 +1,118 @@
+/**************************************************************************
+ *
+ * Copyright 2019 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/**
+ * @file
+ * Helpers for building LLVM coroutines.
+ *
+ * Compute shaders with barriers are run as coroutines: every SIMD vector
+ * of a work group suspends at each barrier, and the caller resumes them in
+ * turn until they are all done.  This needs the coroutine passes, which
+ * exist since LLVM 4.
+ */
+
+#ifndef LP_BLD_CORO_H
+#define LP_BLD_CORO_H
+
+#include "lp_bld.h"
+#include "lp_bld_init.h"
+
+
+#if HAVE_LLVM >= 0x0400
+#define LP_HAVE_CORO 1
+#else
+#define LP_HAVE_CORO 0
+#endif
+
+
+/**
+ * Blocks a suspend point branches to.
+ *
+ * The suspend block ends the coroutine's ramp or resume function and the
+ * cleanup block frees the coroutine frame.
+ */
+struct lp_build_coro_suspend_info
+{
+   LLVMBasicBlockRef suspend;
+   LLVMBasicBlockRef cleanup;
+};
+
+
+LLVMValueRef
+lp_build_coro_id(struct gallivm_state *gallivm);
+
+LLVMValueRef
+lp_build_coro_size(struct gallivm_state *gallivm);
+
+LLVMValueRef
+lp_build_coro_begin(struct gallivm_state *gallivm,
+                    LLVMValueRef coro_id,
+                    LLVMValueRef mem_ptr);
+
+LLVMValueRef
+lp_build_coro_free(struct gallivm_state *gallivm,
+                   LLVMValueRef coro_id,
+                   LLVMValueRef coro_hdl);
+
+void
+lp_build_coro_end(struct gallivm_state *gallivm,
+                  LLVMValueRef coro_hdl);
+
+void
+lp_build_coro_resume(struct gallivm_state *gallivm,
+                     LLVMValueRef coro_hdl);
+
+void
+lp_build_coro_destroy(struct gallivm_state *gallivm,
+                      LLVMValueRef coro_hdl);
+
+LLVMValueRef
+lp_build_coro_done(struct gallivm_state *gallivm,
+                   LLVMValueRef coro_hdl);
+
+LLVMValueRef
+lp_build_coro_suspend(struct gallivm_state *gallivm,
+                      boolean final_suspend);
+
+LLVMValueRef
+lp_build_coro_begin_alloc_mem(struct gallivm_state *gallivm,
+                              LLVMValueRef coro_id);
+
+void
+lp_build_coro_free_mem(struct gallivm_state *gallivm,
+                       LLVMValueRef coro_id,
+                       LLVMValueRef coro_hdl);
+
+void
+lp_build_coro_suspend_switch(struct gallivm_state *gallivm,
+                             const struct lp_build_coro_suspend_info *sus_info,
+                             LLVMBasicBlockRef resume_block,
+                             boolean final_suspend);
+
+
+#endif /* LP_BLD_CORO_H */
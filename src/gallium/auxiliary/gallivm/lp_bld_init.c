@@ -33,7 +33,10 @@
 #include "util/u_memory.h"
 #include "util/simple_list.h"
 #include "util/os_time.h"
+#include "util/disk_cache.h"
+#include "util/mesa-sha1.h"
 #include "lp_bld.h"
+#include "lp_bld_coro.h"
 #include "lp_bld_debug.h"
 #include "lp_bld_misc.h"
 #include "lp_bld_init.h"
@@ -92,6 +95,14 @@ static boolean gallivm_initialized = FALSE;
 
 unsigned lp_native_vector_width;
 
+/**
+ * Identifies the generated machine code beyond the modules' contents:
+ * the LLVM and gallivm builds, the target CPU and the code generation
+ * options.  Mixed into all the disk cache keys.
+ */
+static unsigned char gallivm_cache_id[20];
+static boolean gallivm_cache_id_valid = FALSE;
+
 
 /*
  * Optimization values are:
@@ -110,6 +121,16 @@ enum LLVM_CodeGenOpt_Level {
 };
 
 
+/**
+ * Whether to skip the IR optimization passes and generate code at -O0.
+ */
+static inline boolean
+gallivm_no_opt(const struct gallivm_state *gallivm)
+{
+   return gallivm->no_opt || (gallivm_perf & GALLIVM_PERF_NO_OPT);
+}
+
+
 /**
  * Create the LLVM (optimization) pass manager and install
  * relevant optimization passes.
@@ -124,6 +145,7 @@ create_pass_manager(struct gallivm_state *gallivm)
    gallivm->passmgr = LLVMCreateFunctionPassManagerForModule(gallivm->module);
    if (!gallivm->passmgr)
       return FALSE;
+
    /*
     * TODO: some per module pass manager with IPO passes might be helpful -
     * the generated texture functions may benefit from inlining if they are
@@ -143,7 +165,7 @@ create_pass_manager(struct gallivm_state *gallivm)
       free(td_str);
    }
 
-   if ((gallivm_perf & GALLIVM_PERF_NO_OPT) == 0) {
+   if (!gallivm_no_opt(gallivm)) {
       /*
        * TODO: Evaluate passes some more - keeping in mind
        * both quality of generated code and compile times.
@@ -199,6 +221,11 @@ gallivm_free_ir(struct gallivm_state *gallivm)
       LLVMDisposeModule(gallivm->module);
    }
 
+   if (gallivm->cache) {
+      lp_free_objcache(gallivm->cache->jit_obj);
+      gallivm->cache->jit_obj = NULL;
+   }
+
    FREE(gallivm->module_name);
 
    if (!use_mcjit) {
@@ -221,6 +248,7 @@ gallivm_free_ir(struct gallivm_state *gallivm)
    gallivm->passmgr = NULL;
    gallivm->context = NULL;
    gallivm->builder = NULL;
+   gallivm->cache = NULL;
 }
 
 
@@ -247,7 +275,7 @@ init_gallivm_engine(struct gallivm_state *gallivm)
       char *error = NULL;
       int ret;
 
-      if (gallivm_perf & GALLIVM_PERF_NO_OPT) {
+      if (gallivm_no_opt(gallivm)) {
          optlevel = None;
       }
       else {
@@ -260,6 +288,7 @@ init_gallivm_engine(struct gallivm_state *gallivm)
                                                     gallivm->memorymgr,
                                                     (unsigned) optlevel,
                                                     use_mcjit,
+                                                    gallivm->cache,
                                                     &error);
       if (ret) {
          _debug_printf("%s\n", error);
@@ -308,7 +337,7 @@ fail:
  */
 static boolean
 init_gallivm_state(struct gallivm_state *gallivm, const char *name,
-                   LLVMContextRef context)
+                   LLVMContextRef context, struct lp_cached_code *cache)
 {
    assert(!gallivm->context);
    assert(!gallivm->module);
@@ -317,6 +346,7 @@ init_gallivm_state(struct gallivm_state *gallivm, const char *name,
       return FALSE;
 
    gallivm->context = context;
+   gallivm->cache = cache;
 
    if (!gallivm->context)
       goto fail;
@@ -400,6 +430,32 @@ fail:
 }
 
 
+static void
+init_cache_id(void)
+{
+#ifdef HAVE_DLFCN_H
+   struct mesa_sha1 ctx;
+   unsigned llvm_version = HAVE_LLVM;
+
+   _mesa_sha1_init(&ctx);
+
+   if (!disk_cache_get_function_identifier(init_cache_id, &ctx) ||
+       !disk_cache_get_function_identifier(LLVMCreateMessage, &ctx))
+      return;
+
+   _mesa_sha1_update(&ctx, &llvm_version, sizeof llvm_version);
+   lp_build_hash_jit_target(&ctx);
+   _mesa_sha1_update(&ctx, &util_cpu_caps, sizeof util_cpu_caps);
+   _mesa_sha1_update(&ctx, &lp_native_vector_width,
+                     sizeof lp_native_vector_width);
+   _mesa_sha1_update(&ctx, &gallivm_perf, sizeof gallivm_perf);
+   _mesa_sha1_final(&ctx, gallivm_cache_id);
+
+   gallivm_cache_id_valid = TRUE;
+#endif
+}
+
+
 boolean
 lp_build_init(void)
 {
@@ -509,6 +565,8 @@ lp_build_init(void)
    }
 #endif
 
+   init_cache_id();
+
    gallivm_initialized = TRUE;
 
    return TRUE;
@@ -518,15 +576,42 @@ lp_build_init(void)
 
 /**
  * Create a new gallivm_state object.
+ * If cache is not NULL and holds code, the module is loaded from it when
+ * compiled; otherwise the generated code is put there.  It must stay valid
+ * until gallivm_free_ir().
+ */
+struct gallivm_state *
+gallivm_create(const char *name, LLVMContextRef context,
+               struct lp_cached_code *cache)
+{
+   struct gallivm_state *gallivm;
+
+   gallivm = CALLOC_STRUCT(gallivm_state);
+   if (gallivm) {
+      if (!init_gallivm_state(gallivm, name, context, cache)) {
+         FREE(gallivm);
+         gallivm = NULL;
+      }
+   }
+
+   return gallivm;
+}
+
+
+/**
+ * Create a new gallivm_state object whose module is compiled without
+ * optimizations.  The code is slower but compiles several times faster,
+ * which suits code that is only used until an optimized version is ready.
  */
 struct gallivm_state *
-gallivm_create(const char *name, LLVMContextRef context)
+gallivm_create_unoptimized(const char *name, LLVMContextRef context)
 {
    struct gallivm_state *gallivm;
 
    gallivm = CALLOC_STRUCT(gallivm_state);
    if (gallivm) {
-      if (!init_gallivm_state(gallivm, name, context)) {
+      gallivm->no_opt = TRUE;
+      if (!init_gallivm_state(gallivm, name, context, NULL)) {
          FREE(gallivm);
          gallivm = NULL;
       }
@@ -573,6 +658,50 @@ gallivm_verify_function(struct gallivm_state *gallivm,
 }
 
 
+/**
+ * Split the coroutines (used by compute shaders with barriers) before the
+ * function passes run.  This needs module pass managers, so they're only
+ * created for the modules which use coroutines.
+ */
+static void
+run_coro_passes(struct gallivm_state *gallivm)
+{
+#if LP_HAVE_CORO
+   LLVMPassManagerRef passmgr;
+
+   if (!LLVMGetNamedFunction(gallivm->module, "llvm.coro.id"))
+      return;
+
+   passmgr = LLVMCreatePassManager();
+   lp_add_coro_passes(passmgr);
+   LLVMRunPassManager(passmgr, gallivm->module);
+   LLVMDisposePassManager(passmgr);
+
+   /*
+    * The leftover coroutine intrinsics are lowered by a function pass, which
+    * would be run within the splitting pass above, before the coroutines are
+    * split, if it was in the same pass manager.
+    */
+   passmgr = LLVMCreatePassManager();
+   lp_add_coro_cleanup_pass(passmgr);
+   LLVMRunPassManager(passmgr, gallivm->module);
+   LLVMDisposePassManager(passmgr);
+#endif
+}
+
+
+/**
+ * Whether the module's code comes from the cache given to gallivm_create().
+ * Then only the prototypes of the functions passed to gallivm_jit_function()
+ * need to be built: they are resolved by name in the cached object.
+ */
+boolean
+gallivm_is_cached(const struct gallivm_state *gallivm)
+{
+   return gallivm->cache && gallivm->cache->data_size;
+}
+
+
 /**
  * Compile a module.
  * This does IR optimization on all functions in the module.
@@ -606,10 +735,21 @@ gallivm_compile_module(struct gallivm_state *gallivm)
                    "[-mattr=<-mattr option(s)>]");
    }
 
+   /* Cached code was generated from the optimized module */
+   if (gallivm_is_cached(gallivm)) {
+      if (gallivm_debug & GALLIVM_DEBUG_PERF) {
+         assert(gallivm->module_name);
+         debug_printf("module %s found in the disk cache\n",
+                      gallivm->module_name);
+      }
+      goto skip_cached;
+   }
+
    if (gallivm_debug & GALLIVM_DEBUG_PERF)
       time_begin = os_time_get();
 
    /* Run optimization passes */
+   run_coro_passes(gallivm);
    LLVMInitializeFunctionPassManager(gallivm->passmgr);
    func = LLVMGetFirstFunction(gallivm->module);
    while (func) {
@@ -639,6 +779,7 @@ gallivm_compile_module(struct gallivm_state *gallivm)
                    gallivm->module_name, time_msec);
    }
 
+skip_cached:
    if (use_mcjit) {
       /* Setting the module's DataLayout to an empty string will cause the
        * ExecutionEngine to copy to the DataLayout string from its target
@@ -728,3 +869,86 @@ gallivm_jit_function(struct gallivm_state *gallivm,
 
    return jit_func;
 }
+
+
+/**
+ * Compute the disk cache key of a module from the caller's key, which
+ * must cover everything the module's IR depends on.
+ */
+static boolean
+disk_cache_key(struct disk_cache *cache, const unsigned char key[20],
+               cache_key result)
+{
+   unsigned char data[40];
+
+   if (!cache || !lp_build_init() || !gallivm_cache_id_valid)
+      return FALSE;
+
+   memcpy(data, gallivm_cache_id, 20);
+   memcpy(data + 20, key, 20);
+   disk_cache_compute_key(cache, data, sizeof data, result);
+   return TRUE;
+}
+
+
+/**
+ * Look up the machine code of a module in the disk cache.
+ * On a hit code->data is set, to be freed by the caller with free().
+ */
+void
+gallivm_disk_cache_find(struct disk_cache *cache,
+                        const unsigned char key[20],
+                        struct lp_cached_code *code)
+{
+   cache_key sha1;
+   uint32_t nr_instrs;
+
+   code->data = NULL;
+   code->data_size = 0;
+
+   if (!disk_cache_key(cache, key, sha1))
+      return;
+
+   code->data = disk_cache_get(cache, sha1, &code->data_size);
+   if (!code->data || code->data_size < sizeof(uint32_t)) {
+      free(code->data);
+      code->data = NULL;
+      code->data_size = 0;
+      return;
+   }
+
+   /* The instruction count is stored after the object */
+   code->data_size -= sizeof(uint32_t);
+   memcpy(&nr_instrs, (const char *)code->data + code->data_size,
+          sizeof nr_instrs);
+   code->nr_instrs = nr_instrs;
+}
+
+
+/**
+ * Store the machine code generated for a module in the disk cache.
+ */
+void
+gallivm_disk_cache_insert(struct disk_cache *cache,
+                          const unsigned char key[20],
+                          const struct lp_cached_code *code)
+{
+   cache_key sha1;
+   uint32_t nr_instrs = code->nr_instrs;
+   char *data;
+
+   if (!code->data_size || code->dont_cache)
+      return;
+
+   if (!disk_cache_key(cache, key, sha1))
+      return;
+
+   data = malloc(code->data_size + sizeof nr_instrs);
+   if (!data)
+      return;
+
+   memcpy(data, code->data, code->data_size);
+   memcpy(data + code->data_size, &nr_instrs, sizeof nr_instrs);
+   disk_cache_put(cache, sha1, data, code->data_size + sizeof nr_instrs, NULL);
+   free(data);
+}
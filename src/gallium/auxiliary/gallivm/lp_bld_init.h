@@ -39,6 +39,20 @@
 extern "C" {
 #endif
 
+struct disk_cache;
+
+/**
+ * Machine code of a module, as stored in a disk cache.
+ */
+struct lp_cached_code
+{
+   void *data;          /**< object code, malloc'ed */
+   size_t data_size;
+   boolean dont_cache;  /**< the code references process specific data */
+   unsigned nr_instrs;  /**< IR instructions of the module, set by the caller */
+   void *jit_obj;
+};
+
 struct gallivm_state
 {
    char *module_name;
@@ -50,7 +64,9 @@ struct gallivm_state
    LLVMBuilderRef builder;
    LLVMMCJITMemoryManagerRef memorymgr;
    struct lp_generated_code *code;
+   struct lp_cached_code *cache;
    unsigned compiled;
+   boolean no_opt;
 };
 
 
@@ -59,7 +75,11 @@ lp_build_init(void);
 
 
 struct gallivm_state *
-gallivm_create(const char *name, LLVMContextRef context);
+gallivm_create(const char *name, LLVMContextRef context,
+               struct lp_cached_code *cache);
+
+struct gallivm_state *
+gallivm_create_unoptimized(const char *name, LLVMContextRef context);
 
 void
 gallivm_destroy(struct gallivm_state *gallivm);
@@ -71,6 +91,9 @@ void
 gallivm_verify_function(struct gallivm_state *gallivm,
                         LLVMValueRef func);
 
+boolean
+gallivm_is_cached(const struct gallivm_state *gallivm);
+
 void
 gallivm_compile_module(struct gallivm_state *gallivm);
 
@@ -78,6 +101,16 @@ func_pointer
 gallivm_jit_function(struct gallivm_state *gallivm,
                      LLVMValueRef func);
 
+void
+gallivm_disk_cache_find(struct disk_cache *cache,
+                        const unsigned char key[20],
+                        struct lp_cached_code *code);
+
+void
+gallivm_disk_cache_insert(struct disk_cache *cache,
+                          const unsigned char key[20],
+                          const struct lp_cached_code *code);
+
 #ifdef __cplusplus
 }
 #endif
@@ -55,6 +55,9 @@
 #include <llvm-c/ExecutionEngine.h>
 #include <llvm/Target/TargetOptions.h>
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
+#if HAVE_LLVM >= 0x0306
+#include <llvm/ExecutionEngine/ObjectCache.h>
+#endif
 #include <llvm/ADT/Triple.h>
 #if HAVE_LLVM >= 0x0307
 #include <llvm/Analysis/TargetLibraryInfo.h>
@@ -71,6 +74,7 @@
 #include <llvm/Support/PrettyStackTrace.h>
 
 #include <llvm/Support/TargetSelect.h>
+#include <llvm/Support/MemoryBuffer.h>
 
 #if HAVE_LLVM >= 0x0305
 #include <llvm/IR/CallSite.h>
@@ -80,6 +84,12 @@
 #include <llvm/Support/CBindingWrapping.h>
 
 #include <llvm/Config/llvm-config.h>
+#if HAVE_LLVM >= 0x0800
+#include <llvm-c/Transforms/Coroutines.h>
+#elif HAVE_LLVM >= 0x0400
+#include <llvm/IR/LegacyPassManager.h>
+#include <llvm/Transforms/Coroutines.h>
+#endif
 #if LLVM_USE_INTEL_JITEVENTS
 #include <llvm/ExecutionEngine/JITEventListener.h>
 #endif
@@ -94,9 +104,13 @@
 #include "pipe/p_config.h"
 #include "util/u_debug.h"
 #include "util/u_cpu_detect.h"
+#include "util/mesa-sha1.h"
 
 #include "lp_bld_misc.h"
 #include "lp_bld_debug.h"
+#include "lp_bld_init.h"
+
+#include <algorithm>
 
 namespace {
 
@@ -473,6 +487,44 @@ class ShaderMemoryManager : public DelegatingJITMemoryManager {
 };
 
 
+#if HAVE_LLVM >= 0x0306
+/**
+ * Object cache backed by a lp_cached_code struct: the module is loaded from
+ * its data if there is any, otherwise the compiled object is copied there so
+ * the caller can store it.
+ */
+class LPObjectCache : public llvm::ObjectCache {
+   struct lp_cached_code *cache_out;
+
+   public:
+      LPObjectCache(struct lp_cached_code *cache) {
+         cache_out = cache;
+      }
+
+      virtual void notifyObjectCompiled(const llvm::Module *M,
+                                        llvm::MemoryBufferRef Obj) {
+         assert(!cache_out->data);
+         cache_out->data_size = Obj.getBufferSize();
+         cache_out->data = malloc(cache_out->data_size);
+         if (!cache_out->data) {
+            cache_out->data_size = 0;
+            return;
+         }
+         memcpy(cache_out->data, Obj.getBufferStart(), cache_out->data_size);
+      }
+
+      virtual std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module *M) {
+         if (!cache_out->data_size)
+            return NULL;
+         // MCJIT keeps the buffer around, so don't tie it to our data
+         return llvm::MemoryBuffer::getMemBufferCopy(
+                   llvm::StringRef((const char *)cache_out->data,
+                                   cache_out->data_size));
+      }
+};
+#endif
+
+
 /**
  * Same as LLVMCreateJITCompilerForModule, but:
  * - allows using MCJIT and enabling AVX feature where available.
@@ -491,6 +543,7 @@ lp_build_create_jit_compiler_for_module(LLVMExecutionEngineRef *OutJIT,
                                         LLVMMCJITMemoryManagerRef CMM,
                                         unsigned OptLevel,
                                         int useMCJIT,
+                                        struct lp_cached_code *cache_out,
                                         char **OutError)
 {
    using namespace llvm;
@@ -739,6 +792,13 @@ lp_build_create_jit_compiler_for_module(LLVMExecutionEngineRef *OutJIT,
    JIT->RegisterJITEventListener(JEL);
 #endif
    if (JIT) {
+#if HAVE_LLVM >= 0x0306
+      if (cache_out && useMCJIT) {
+         LPObjectCache *objcache = new LPObjectCache(cache_out);
+         JIT->setObjectCache(objcache);
+         cache_out->jit_obj = objcache;
+      }
+#endif
       *OutJIT = wrap(JIT);
       return 0;
    }
@@ -750,6 +810,48 @@ lp_build_create_jit_compiler_for_module(LLVMExecutionEngineRef *OutJIT,
 }
 
 
+extern "C"
+void
+lp_free_objcache(void *objcache)
+{
+#if HAVE_LLVM >= 0x0306
+   delete reinterpret_cast<LPObjectCache *>(objcache);
+#endif
+}
+
+
+/**
+ * Hash the CPU name and features the code is generated for, as
+ * lp_build_create_jit_compiler_for_module() queries them from the host.
+ */
+extern "C"
+void
+lp_build_hash_jit_target(struct mesa_sha1 *ctx)
+{
+#if HAVE_LLVM >= 0x0305
+   std::string MCPU = llvm::sys::getHostCPUName().str();
+   _mesa_sha1_update(ctx, MCPU.data(), MCPU.size());
+#endif
+
+#if (defined(PIPE_ARCH_X86) || defined(PIPE_ARCH_X86_64)) && HAVE_LLVM >= 0x0400
+   llvm::StringMap<bool> features;
+   std::vector<std::string> MAttrs;
+   llvm::sys::getHostCPUFeatures(features);
+
+   for (llvm::StringMapIterator<bool> f = features.begin();
+        f != features.end();
+        ++f) {
+      MAttrs.push_back(((*f).second ? "+" : "-") + (*f).first().str());
+   }
+
+   // StringMap iteration order is unspecified
+   std::sort(MAttrs.begin(), MAttrs.end());
+   for (size_t i = 0; i < MAttrs.size(); i++)
+      _mesa_sha1_update(ctx, MAttrs[i].c_str(), MAttrs[i].size() + 1);
+#endif
+}
+
+
 extern "C"
 void
 lp_free_generated_code(struct lp_generated_code *code)
@@ -798,3 +900,50 @@ lp_is_function(LLVMValueRef v)
 	return llvm::isa<llvm::Function>(llvm::unwrap(v));
 #endif
 }
+
+extern "C" LLVMTypeRef
+lp_token_type(LLVMContextRef context)
+{
+#if HAVE_LLVM >= 0x0800
+	return LLVMTokenTypeInContext(context);
+#elif HAVE_LLVM >= 0x0308
+	return llvm::wrap(llvm::Type::getTokenTy(*llvm::unwrap(context)));
+#else
+	assert(0);
+	return NULL;
+#endif
+}
+
+/*
+ * The coroutine passes are only exposed through the C API since LLVM 8, but
+ * exist since LLVM 4.
+ */
+extern "C" void
+lp_add_coro_passes(LLVMPassManagerRef passmgr)
+{
+#if HAVE_LLVM >= 0x0800
+	LLVMAddCoroEarlyPass(passmgr);
+	LLVMAddCoroSplitPass(passmgr);
+	LLVMAddCoroElidePass(passmgr);
+#elif HAVE_LLVM >= 0x0400
+	llvm::legacy::PassManagerBase *pm = llvm::unwrap(passmgr);
+
+	pm->add(llvm::createCoroEarlyPass());
+	pm->add(llvm::createCoroSplitPass());
+	pm->add(llvm::createCoroElidePass());
+#else
+	assert(0);
+#endif
+}
+
+extern "C" void
+lp_add_coro_cleanup_pass(LLVMPassManagerRef passmgr)
+{
+#if HAVE_LLVM >= 0x0800
+	LLVMAddCoroCleanupPass(passmgr);
+#elif HAVE_LLVM >= 0x0400
+	llvm::unwrap(passmgr)->add(llvm::createCoroCleanupPass());
+#else
+	assert(0);
+#endif
+}
@@ -41,6 +41,8 @@ extern "C" {
 
 
 struct lp_generated_code;
+struct lp_cached_code;
+struct mesa_sha1;
 
 extern LLVMTargetLibraryInfoRef
 gallivm_create_target_library_info(const char *triple);
@@ -59,8 +61,15 @@ lp_build_create_jit_compiler_for_module(LLVMExecutionEngineRef *OutJIT,
                                         LLVMMCJITMemoryManagerRef MM,
                                         unsigned OptLevel,
                                         int useMCJIT,
+                                        struct lp_cached_code *cache_out,
                                         char **OutError);
 
+extern void
+lp_free_objcache(void *objcache);
+
+extern void
+lp_build_hash_jit_target(struct mesa_sha1 *ctx);
+
 extern void
 lp_free_generated_code(struct lp_generated_code *code);
 
@@ -76,6 +85,15 @@ lp_get_called_value(LLVMValueRef call);
 extern bool
 lp_is_function(LLVMValueRef v);
 
+extern LLVMTypeRef
+lp_token_type(LLVMContextRef context);
+
+extern void
+lp_add_coro_passes(LLVMPassManagerRef passmgr);
+
+extern void
+lp_add_coro_cleanup_pass(LLVMPassManagerRef passmgr);
+
 #ifdef __cplusplus
 }
 #endif
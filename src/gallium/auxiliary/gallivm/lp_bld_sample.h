@@ -49,6 +49,7 @@ extern "C" {
 struct pipe_resource;
 struct pipe_sampler_view;
 struct pipe_sampler_state;
+struct pipe_image_view;
 struct util_format_description;
 struct lp_type;
 struct lp_build_context;
@@ -122,6 +123,35 @@ struct lp_sampler_size_query_params
    LLVMValueRef explicit_lod;
    LLVMValueRef *sizes_out;
 };
+
+enum lp_img_op {
+   LP_IMG_LOAD,
+   LP_IMG_STORE,
+   LP_IMG_ATOMIC,
+   LP_IMG_ATOMIC_CAS,
+};
+
+/**
+ * Image load/store/atomic parameters.
+ *
+ * The coords are integer vectors, the data is float vectors holding the
+ * bits of integer formats, like texel values do.
+ */
+struct lp_img_params
+{
+   struct lp_type type;
+   unsigned image_index;
+   enum lp_img_op img_op;
+   unsigned target;          /**< PIPE_TEXTURE_* */
+   LLVMAtomicRMWBinOp op;    /**< for LP_IMG_ATOMIC */
+   LLVMValueRef exec_mask;
+   LLVMValueRef context_ptr;
+   LLVMValueRef thread_data_ptr;
+   const LLVMValueRef *coords;
+   LLVMValueRef indata[4];
+   LLVMValueRef indata2[4];  /**< compare values for LP_IMG_ATOMIC_CAS */
+   LLVMValueRef *outdata;
+};
 /**
  * Texture static state.
  *
@@ -490,6 +520,11 @@ lp_sampler_static_texture_state(struct lp_static_texture_state *state,
                                 const struct pipe_sampler_view *view);
 
 
+void
+lp_sampler_static_texture_state_image(struct lp_static_texture_state *state,
+                                      const struct pipe_image_view *view);
+
+
 void
 lp_build_lod_selector(struct lp_build_sample_context *bld,
                       boolean is_lodq,
@@ -626,6 +661,12 @@ lp_build_size_query_soa(struct gallivm_state *gallivm,
                         struct lp_sampler_dynamic_state *dynamic_state,
                         const struct lp_sampler_size_query_params *params);
 
+void
+lp_build_img_op_soa(const struct lp_static_texture_state *static_texture_state,
+                    struct lp_sampler_dynamic_state *dynamic_state,
+                    struct gallivm_state *gallivm,
+                    const struct lp_img_params *params);
+
 void
 lp_build_sample_nop(struct gallivm_state *gallivm, 
                     struct lp_type type,
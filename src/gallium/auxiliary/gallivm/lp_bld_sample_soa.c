@@ -3942,3 +3942,334 @@ lp_build_size_query_soa(struct gallivm_state *gallivm,
                                         num_levels);
    }
 }
+
+
+/**
+ * Convert one channel of store data to the integer bits the format holds,
+ * not yet masked to the channel size nor shifted into place.
+ * The data are float vectors, holding the integer bits for pure integer
+ * formats.
+ */
+static LLVMValueRef
+lp_build_img_pack_channel(struct gallivm_state *gallivm,
+                          struct lp_type type,
+                          const struct util_format_channel_description *chan_desc,
+                          LLVMValueRef val)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   struct lp_build_context bld, int_bld, uint_bld;
+   unsigned width = chan_desc->size;
+
+   lp_build_context_init(&bld, gallivm, type);
+   lp_build_context_init(&int_bld, gallivm, lp_int_type(type));
+   lp_build_context_init(&uint_bld, gallivm, lp_uint_type(type));
+
+   switch (chan_desc->type) {
+   case UTIL_FORMAT_TYPE_FLOAT:
+      if (width == 32)
+         return LLVMBuildBitCast(builder, val, int_bld.vec_type, "");
+      assert(width == 16);
+      val = lp_build_float_to_half(gallivm, val);
+      return LLVMBuildZExt(builder, val, int_bld.vec_type, "");
+   case UTIL_FORMAT_TYPE_UNSIGNED:
+      if (chan_desc->pure_integer) {
+         val = LLVMBuildBitCast(builder, val, uint_bld.vec_type, "");
+         if (width < 32) {
+            val = lp_build_min(&uint_bld, val,
+                               lp_build_const_int_vec(gallivm, uint_bld.type,
+                                                      (1u << width) - 1));
+         }
+         return val;
+      }
+      assert(chan_desc->normalized);
+      val = lp_build_clamp_zero_one_nanzero(&bld, val);
+      return lp_build_clamped_float_to_unsigned_norm(gallivm, type, width, val);
+   case UTIL_FORMAT_TYPE_SIGNED:
+      if (chan_desc->pure_integer) {
+         val = LLVMBuildBitCast(builder, val, int_bld.vec_type, "");
+         if (width < 32) {
+            val = lp_build_clamp(&int_bld, val,
+                                 lp_build_const_int_vec(gallivm, int_bld.type,
+                                                        -(1 << (width - 1))),
+                                 lp_build_const_int_vec(gallivm, int_bld.type,
+                                                        (1 << (width - 1)) - 1));
+         }
+         return val;
+      }
+      assert(chan_desc->normalized);
+      val = lp_build_clamp(&bld, val, lp_build_const_vec(gallivm, type, -1.0),
+                           bld.one);
+      val = lp_build_mul(&bld, val,
+                         lp_build_const_vec(gallivm, type,
+                                            (double)((1 << (width - 1)) - 1)));
+      return lp_build_iround(&bld, val);
+   default:
+      assert(0);
+      return int_bld.zero;
+   }
+}
+
+
+/**
+ * Shader image load/store/atomics.
+ *
+ * Images are a single mip level, which the base pointer of the dynamic
+ * state already points to.  Out of bounds loads and atomics return zero,
+ * out of bounds stores are dropped.
+ */
+void
+lp_build_img_op_soa(const struct lp_static_texture_state *static_texture_state,
+                    struct lp_sampler_dynamic_state *dynamic_state,
+                    struct gallivm_state *gallivm,
+                    const struct lp_img_params *params)
+{
+   LLVMBuilderRef builder = gallivm->builder;
+   const struct util_format_description *format_desc =
+      util_format_description(static_texture_state->format);
+   unsigned image_unit = params->image_index;
+   unsigned target = params->target;
+   LLVMValueRef context_ptr = params->context_ptr;
+   struct lp_build_context int_bld, uint_bld;
+   LLVMValueRef x, y = NULL, z = NULL;
+   LLVMValueRef size, row_stride, img_stride, base_ptr;
+   LLVMValueRef mask, offset, i, j;
+   unsigned chan;
+
+   lp_build_context_init(&int_bld, gallivm, lp_int_type(params->type));
+   lp_build_context_init(&uint_bld, gallivm, lp_uint_type(params->type));
+
+   if (static_texture_state->format == PIPE_FORMAT_NONE) {
+      if (params->outdata) {
+         for (chan = 0; chan < 4; chan++)
+            params->outdata[chan] = lp_build_zero(gallivm, params->type);
+      }
+      return;
+   }
+
+   base_ptr = dynamic_state->base_ptr(dynamic_state, gallivm,
+                                      context_ptr, image_unit);
+   row_stride = dynamic_state->row_stride(dynamic_state, gallivm,
+                                          context_ptr, image_unit);
+   row_stride = lp_build_broadcast_scalar(&int_bld, row_stride);
+   img_stride = dynamic_state->img_stride(dynamic_state, gallivm,
+                                          context_ptr, image_unit);
+   img_stride = lp_build_broadcast_scalar(&int_bld, img_stride);
+
+   /*
+    * Coords are unsigned, so negative ones are out of bounds too.
+    * The layer of arrays and cubes goes through the image stride.
+    */
+   x = params->coords[0];
+   size = dynamic_state->width(dynamic_state, gallivm,
+                               context_ptr, image_unit);
+   mask = lp_build_cmp(&uint_bld, PIPE_FUNC_LESS, x,
+                       lp_build_broadcast_scalar(&uint_bld, size));
+   if (texture_dims(target) >= 2) {
+      y = params->coords[1];
+      size = dynamic_state->height(dynamic_state, gallivm,
+                                   context_ptr, image_unit);
+      mask = LLVMBuildAnd(builder, mask,
+                          lp_build_cmp(&uint_bld, PIPE_FUNC_LESS, y,
+                                       lp_build_broadcast_scalar(&uint_bld, size)),
+                          "");
+   }
+   if (target == PIPE_TEXTURE_1D_ARRAY)
+      z = params->coords[1];
+   else if (texture_dims(target) == 3 || has_layer_coord(target))
+      z = params->coords[2];
+   if (z) {
+      size = dynamic_state->depth(dynamic_state, gallivm,
+                                  context_ptr, image_unit);
+      mask = LLVMBuildAnd(builder, mask,
+                          lp_build_cmp(&uint_bld, PIPE_FUNC_LESS, z,
+                                       lp_build_broadcast_scalar(&uint_bld, size)),
+                          "");
+   }
+   mask = LLVMBuildAnd(builder, mask, params->exec_mask, "");
+
+   lp_build_sample_offset(&int_bld, format_desc, x, y, z,
+                          row_stride, img_stride, &offset, &i, &j);
+
+   if (params->img_op == LP_IMG_LOAD) {
+      struct lp_type texel_type = params->type;
+      LLVMValueRef texel[4];
+
+      if (format_desc->colorspace == UTIL_FORMAT_COLORSPACE_RGB &&
+          format_desc->channel[0].pure_integer) {
+         if (format_desc->channel[0].type == UTIL_FORMAT_TYPE_SIGNED)
+            texel_type = lp_int_type(params->type);
+         else
+            texel_type = lp_uint_type(params->type);
+      }
+
+      /* Inactive and out of bounds lanes fetch the first texel instead. */
+      offset = LLVMBuildAnd(builder, offset, mask, "");
+      lp_build_fetch_rgba_soa(gallivm, format_desc, texel_type, TRUE,
+                              base_ptr, offset, i, j, NULL, texel);
+
+      for (chan = 0; chan < 4; chan++) {
+         LLVMValueRef res = LLVMBuildBitCast(builder, texel[chan],
+                                             int_bld.vec_type, "");
+         res = LLVMBuildAnd(builder, res, mask, "");
+         params->outdata[chan] = LLVMBuildBitCast(builder, res,
+                                                  lp_build_vec_type(gallivm, params->type),
+                                                  "");
+      }
+   }
+   else if (params->img_op == LP_IMG_STORE) {
+      struct lp_build_loop_state loop_state;
+      struct lp_build_if_state ifthen;
+      LLVMValueRef values[4], lane, cond, lane_offset;
+      unsigned value_offsets[4], value_bits[4];
+      unsigned num_values, k;
+
+      /*
+       * Formats of up to 32 bits are packed into a single value, wider
+       * ones (which are all arrays of 16 or 32 bit channels) are stored
+       * channel by channel.
+       */
+      if (static_texture_state->format == PIPE_FORMAT_R11G11B10_FLOAT) {
+         LLVMValueRef rgb[3];
+
+         for (chan = 0; chan < 3; chan++)
+            rgb[chan] = params->indata[chan];
+         values[0] = lp_build_float_to_r11g11b10(gallivm, rgb);
+         value_offsets[0] = 0;
+         value_bits[0] = 32;
+         num_values = 1;
+      }
+      else {
+         LLVMValueRef packed = int_bld.zero;
+
+         num_values = 0;
+         for (chan = 0; chan < format_desc->nr_channels; chan++) {
+            const struct util_format_channel_description *chan_desc =
+               &format_desc->channel[chan];
+            LLVMValueRef val = int_bld.zero;
+
+            if (chan_desc->type == UTIL_FORMAT_TYPE_VOID)
+               continue;
+
+            /* Invert the format swizzle to find the source component. */
+            for (k = 0; k < 4; k++) {
+               if (format_desc->swizzle[k] == chan) {
+                  val = lp_build_img_pack_channel(gallivm, params->type,
+                                                  chan_desc, params->indata[k]);
+                  break;
+               }
+            }
+
+            if (format_desc->block.bits <= 32) {
+               if (chan_desc->size < 32) {
+                  val = LLVMBuildAnd(builder, val,
+                                     lp_build_const_int_vec(gallivm, int_bld.type,
+                                                            (1u << chan_desc->size) - 1),
+                                     "");
+               }
+               val = lp_build_shl_imm(&int_bld, val, chan_desc->shift);
+               packed = LLVMBuildOr(builder, packed, val, "");
+            }
+            else {
+               assert(chan_desc->size == 16 || chan_desc->size == 32);
+               values[num_values] = val;
+               value_offsets[num_values] = chan_desc->shift / 8;
+               value_bits[num_values] = chan_desc->size;
+               num_values++;
+            }
+         }
+
+         if (format_desc->block.bits <= 32) {
+            values[0] = packed;
+            value_offsets[0] = 0;
+            value_bits[0] = format_desc->block.bits;
+            num_values = 1;
+         }
+      }
+
+      lp_build_loop_begin(&loop_state, gallivm, lp_build_const_int32(gallivm, 0));
+      lane = loop_state.counter;
+      cond = LLVMBuildICmp(builder, LLVMIntNE,
+                           LLVMBuildExtractElement(builder, mask, lane, ""),
+                           lp_build_const_int32(gallivm, 0), "");
+      lp_build_if(&ifthen, gallivm, cond);
+      lane_offset = LLVMBuildExtractElement(builder, offset, lane, "");
+      for (k = 0; k < num_values; k++) {
+         LLVMTypeRef elem_type = LLVMIntTypeInContext(gallivm->context,
+                                                      value_bits[k]);
+         LLVMValueRef elem_offset, ptr, val;
+
+         elem_offset = LLVMBuildAdd(builder, lane_offset,
+                                    lp_build_const_int32(gallivm, value_offsets[k]),
+                                    "");
+         ptr = LLVMBuildGEP(builder, base_ptr, &elem_offset, 1, "");
+         ptr = LLVMBuildBitCast(builder, ptr,
+                                LLVMPointerType(elem_type, 0), "");
+         val = LLVMBuildExtractElement(builder, values[k], lane, "");
+         if (value_bits[k] < 32)
+            val = LLVMBuildTrunc(builder, val, elem_type, "");
+         LLVMBuildStore(builder, val, ptr);
+      }
+      lp_build_endif(&ifthen);
+      lp_build_loop_end_cond(&loop_state,
+                             lp_build_const_int32(gallivm, int_bld.type.length),
+                             NULL, LLVMIntUGE);
+   }
+   else {
+      struct lp_build_loop_state loop_state;
+      struct lp_build_if_state ifthen;
+      LLVMValueRef lane, cond, lane_offset, ptr, val, res, res_ptr;
+      LLVMValueRef data, cmp_data = NULL;
+
+      /* Only single channel 32 bit formats support atomics. */
+      assert(format_desc->block.bits == 32 && format_desc->nr_channels == 1);
+
+      data = LLVMBuildBitCast(builder, params->indata[0], int_bld.vec_type, "");
+      if (params->img_op == LP_IMG_ATOMIC_CAS)
+         cmp_data = LLVMBuildBitCast(builder, params->indata2[0],
+                                     int_bld.vec_type, "");
+
+      res_ptr = lp_build_alloca(gallivm, int_bld.vec_type, "");
+
+      lp_build_loop_begin(&loop_state, gallivm, lp_build_const_int32(gallivm, 0));
+      lane = loop_state.counter;
+      cond = LLVMBuildICmp(builder, LLVMIntNE,
+                           LLVMBuildExtractElement(builder, mask, lane, ""),
+                           lp_build_const_int32(gallivm, 0), "");
+      lp_build_if(&ifthen, gallivm, cond);
+      lane_offset = LLVMBuildExtractElement(builder, offset, lane, "");
+      ptr = LLVMBuildGEP(builder, base_ptr, &lane_offset, 1, "");
+      ptr = LLVMBuildBitCast(builder, ptr,
+                             LLVMPointerType(LLVMInt32TypeInContext(gallivm->context), 0),
+                             "");
+      val = LLVMBuildExtractElement(builder, data, lane, "");
+      if (params->img_op == LP_IMG_ATOMIC_CAS) {
+#if HAVE_LLVM >= 0x0309
+         LLVMValueRef cmp = LLVMBuildExtractElement(builder, cmp_data, lane, "");
+         val = LLVMBuildAtomicCmpXchg(builder, ptr, cmp, val,
+                                      LLVMAtomicOrderingSequentiallyConsistent,
+                                      LLVMAtomicOrderingSequentiallyConsistent,
+                                      false);
+         val = LLVMBuildExtractValue(builder, val, 0, "");
+#else
+         assert(0);
+#endif
+      }
+      else {
+         val = LLVMBuildAtomicRMW(builder, params->op, ptr, val,
+                                  LLVMAtomicOrderingSequentiallyConsistent,
+                                  false);
+      }
+      res = LLVMBuildLoad(builder, res_ptr, "");
+      res = LLVMBuildInsertElement(builder, res, val, lane, "");
+      LLVMBuildStore(builder, res, res_ptr);
+      lp_build_endif(&ifthen);
+      lp_build_loop_end_cond(&loop_state,
+                             lp_build_const_int32(gallivm, int_bld.type.length),
+                             NULL, LLVMIntUGE);
+
+      params->outdata[0] = LLVMBuildBitCast(builder,
+                                            LLVMBuildLoad(builder, res_ptr, ""),
+                                            lp_build_vec_type(gallivm, params->type),
+                                            "");
+   }
+}
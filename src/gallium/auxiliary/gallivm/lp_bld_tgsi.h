@@ -67,6 +67,7 @@ struct lp_build_mask_context;
 struct gallivm_state;
 struct lp_derivatives;
 struct lp_build_tgsi_gs_iface;
+struct lp_build_coro_suspend_info;
 
 
 enum lp_build_tex_modifier {
@@ -170,6 +171,12 @@ struct lp_bld_tgsi_system_values {
    LLVMValueRef prim_id;
    LLVMValueRef basevertex;
    LLVMValueRef invocation_id;
+
+   /* compute shaders, the thread ids are vectors, the rest is scalar */
+   LLVMValueRef thread_id[3];
+   LLVMValueRef block_id[3];
+   LLVMValueRef grid_size[3];
+   LLVMValueRef block_size[3];
 };
 
 
@@ -198,6 +205,29 @@ struct lp_build_sampler_soa
 };
 
 
+/**
+ * Image code generation interface.
+ *
+ * Like the sampler interface above, this keeps the layout of the bound
+ * images out of the TGSI translation.
+ */
+struct lp_build_image_soa
+{
+   void
+   (*destroy)(struct lp_build_image_soa *image);
+
+   void
+   (*emit_op)(const struct lp_build_image_soa *image,
+              struct gallivm_state *gallivm,
+              const struct lp_img_params *params);
+
+   void
+   (*emit_size_query)(const struct lp_build_image_soa *image,
+                      struct gallivm_state *gallivm,
+                      const struct lp_sampler_size_query_params *params);
+};
+
+
 struct lp_build_sampler_aos
 {
    LLVMValueRef
@@ -216,21 +246,37 @@ lp_build_tgsi_info(const struct tgsi_token *tokens,
                    struct lp_tgsi_info *info);
 
 
+/**
+ * Everything the SoA TGSI translation gets from the shader stage.
+ *
+ * The shader storage buffers, shared memory, images and the coroutine
+ * suspend info are only used by compute shaders for now.
+ */
+struct lp_build_tgsi_params {
+   struct lp_type type;
+   struct lp_build_mask_context *mask;
+   LLVMValueRef consts_ptr;
+   LLVMValueRef const_sizes_ptr;
+   const struct lp_bld_tgsi_system_values *system_values;
+   const LLVMValueRef (*inputs)[4];
+   LLVMValueRef context_ptr;
+   LLVMValueRef thread_data_ptr;
+   const struct lp_build_sampler_soa *sampler;
+   const struct tgsi_shader_info *info;
+   const struct lp_build_tgsi_gs_iface *gs_iface;
+   LLVMValueRef ssbo_ptr;
+   LLVMValueRef ssbo_sizes_ptr;
+   const struct lp_build_image_soa *image;
+   LLVMValueRef shared_ptr;
+   const struct lp_build_coro_suspend_info *coro;
+};
+
+
 void
 lp_build_tgsi_soa(struct gallivm_state *gallivm,
                   const struct tgsi_token *tokens,
-                  struct lp_type type,
-                  struct lp_build_mask_context *mask,
-                  LLVMValueRef consts_ptr,
-                  LLVMValueRef const_sizes_ptr,
-                  const struct lp_bld_tgsi_system_values *system_values,
-                  const LLVMValueRef (*inputs)[4],
-                  LLVMValueRef (*outputs)[4],
-                  LLVMValueRef context_ptr,
-                  LLVMValueRef thread_data_ptr,
-                  const struct lp_build_sampler_soa *sampler,
-                  const struct tgsi_shader_info *info,
-                  const struct lp_build_tgsi_gs_iface *gs_iface);
+                  const struct lp_build_tgsi_params *params,
+                  LLVMValueRef (*outputs)[4]);
 
 
 void
@@ -453,8 +499,19 @@ struct lp_build_tgsi_soa_context
    LLVMValueRef thread_data_ptr;
 
    const struct lp_build_sampler_soa *sampler;
+   const struct lp_build_image_soa *image;
+
+   LLVMValueRef ssbo_ptr;
+   LLVMValueRef ssbo_sizes_ptr;
+   LLVMValueRef ssbos[LP_MAX_TGSI_SHADER_BUFFERS];
+   LLVMValueRef ssbo_sizes[LP_MAX_TGSI_SHADER_BUFFERS];
+
+   LLVMValueRef shared_ptr;
+
+   const struct lp_build_coro_suspend_info *coro;
 
    struct tgsi_declaration_sampler_view sv[PIPE_MAX_SHADER_SAMPLER_VIEWS];
+   struct tgsi_declaration_image images[LP_MAX_TGSI_SHADER_IMAGES];
 
    LLVMValueRef immediates[LP_MAX_INLINED_IMMEDIATES][TGSI_NUM_CHANNELS];
    LLVMValueRef temps[LP_MAX_INLINED_TEMPS][TGSI_NUM_CHANNELS];
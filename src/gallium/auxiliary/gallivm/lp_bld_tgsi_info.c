@@ -307,6 +307,12 @@ analyse_instruction(struct analysis_context *ctx,
          max_regs = ARRAY_SIZE(info->output);
       } else if (dst->File == TGSI_FILE_ADDRESS) {
          continue;
+      } else if (dst->File == TGSI_FILE_BUFFER) {
+         continue;
+      } else if (dst->File == TGSI_FILE_IMAGE) {
+         continue;
+      } else if (dst->File == TGSI_FILE_MEMORY) {
+         continue;
       } else {
          assert(0);
          continue;
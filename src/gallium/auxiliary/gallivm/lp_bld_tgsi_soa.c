@@ -66,6 +66,7 @@
 #include "lp_bld_printf.h"
 #include "lp_bld_sample.h"
 #include "lp_bld_struct.h"
+#include "lp_bld_coro.h"
 
 /* SM 4.0 says that subroutines can nest 32 deep and 
  * we need one more for our main function */
@@ -1704,6 +1705,29 @@ emit_fetch_system_value(
       atype = TGSI_TYPE_UNSIGNED;
       break;
 
+   case TGSI_SEMANTIC_THREAD_ID:
+      res = bld->system_values.thread_id[swizzle_in & 0xffff];
+      atype = TGSI_TYPE_UNSIGNED;
+      break;
+
+   case TGSI_SEMANTIC_BLOCK_ID:
+      res = lp_build_broadcast_scalar(&bld_base->uint_bld,
+                                      bld->system_values.block_id[swizzle_in & 0xffff]);
+      atype = TGSI_TYPE_UNSIGNED;
+      break;
+
+   case TGSI_SEMANTIC_GRID_SIZE:
+      res = lp_build_broadcast_scalar(&bld_base->uint_bld,
+                                      bld->system_values.grid_size[swizzle_in & 0xffff]);
+      atype = TGSI_TYPE_UNSIGNED;
+      break;
+
+   case TGSI_SEMANTIC_BLOCK_SIZE:
+      res = lp_build_broadcast_scalar(&bld_base->uint_bld,
+                                      bld->system_values.block_size[swizzle_in & 0xffff]);
+      atype = TGSI_TYPE_UNSIGNED;
+      break;
+
    default:
       assert(!"unexpected semantic in emit_fetch_system_value");
       res = bld_base->base.zero;
@@ -2962,6 +2986,24 @@ lp_emit_declaration_soa(
    }
       break;
 
+   case TGSI_FILE_BUFFER:
+      assert(last < LP_MAX_TGSI_SHADER_BUFFERS);
+      for (idx = first; idx <= last; ++idx) {
+         LLVMValueRef index = lp_build_const_int32(gallivm, idx);
+         bld->ssbos[idx] =
+            lp_build_array_get(gallivm, bld->ssbo_ptr, index);
+         bld->ssbo_sizes[idx] =
+            lp_build_array_get(gallivm, bld->ssbo_sizes_ptr, index);
+      }
+      break;
+
+   case TGSI_FILE_IMAGE:
+      assert(last < LP_MAX_TGSI_SHADER_IMAGES);
+      for (idx = first; idx <= last; ++idx) {
+         bld->images[idx] = decl->Image;
+      }
+      break;
+
    default:
       /* don't need to declare other vars */
       break;
@@ -3699,6 +3741,540 @@ cont_emit(
    lp_exec_continue(&bld->exec_mask);
 }
 
+/**
+ * Number of coordinates of an image access, not counting the sample index.
+ */
+static unsigned
+image_coord_dims(unsigned tgsi_target)
+{
+   switch (tgsi_target) {
+   case TGSI_TEXTURE_BUFFER:
+   case TGSI_TEXTURE_1D:
+      return 1;
+   case TGSI_TEXTURE_2D:
+   case TGSI_TEXTURE_RECT:
+   case TGSI_TEXTURE_1D_ARRAY:
+   case TGSI_TEXTURE_2D_MSAA:
+      return 2;
+   case TGSI_TEXTURE_3D:
+   case TGSI_TEXTURE_CUBE:
+   case TGSI_TEXTURE_2D_ARRAY:
+   case TGSI_TEXTURE_2D_ARRAY_MSAA:
+   case TGSI_TEXTURE_CUBE_ARRAY:
+      return 3;
+   default:
+      assert(0);
+      return 0;
+   }
+}
+
+/**
+ * Return the dword pointer and the size in dwords of a buffer or shared
+ * memory operand.  Shared memory is not bounds checked, so its size is
+ * returned as NULL.
+ */
+static LLVMValueRef
+get_mem_ptr(struct lp_build_tgsi_soa_context *bld,
+            const struct tgsi_full_src_register *reg,
+            LLVMValueRef *limit)
+{
+   struct gallivm_state *gallivm = bld->bld_base.base.gallivm;
+   struct lp_build_context *uint_bld = &bld->bld_base.uint_bld;
+
+   assert(!reg->Register.Indirect);
+
+   if (reg->Register.File == TGSI_FILE_MEMORY) {
+      *limit = NULL;
+      return bld->shared_ptr;
+   }
+
+   assert(reg->Register.File == TGSI_FILE_BUFFER);
+   assert(reg->Register.Index < LP_MAX_TGSI_SHADER_BUFFERS);
+   *limit = lp_build_broadcast_scalar(uint_bld,
+               LLVMBuildLShr(gallivm->builder,
+                             bld->ssbo_sizes[reg->Register.Index],
+                             lp_build_const_int32(gallivm, 2), ""));
+   return bld->ssbos[reg->Register.Index];
+}
+
+/**
+ * Load a dword per lane for the lanes in mask, zero for the others.
+ * The other lanes read the first dword, so ptr only has to be valid when
+ * any lane is set.
+ */
+static LLVMValueRef
+emit_masked_load(struct lp_build_tgsi_soa_context *bld,
+                 LLVMValueRef ptr,
+                 LLVMValueRef index,
+                 LLVMValueRef mask)
+{
+   struct gallivm_state *gallivm = bld->bld_base.base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   struct lp_build_context *uint_bld = &bld->bld_base.uint_bld;
+   struct lp_build_if_state ifthen;
+   LLVMValueRef res_ptr, any, res;
+   unsigned i;
+
+   res_ptr = lp_build_alloca(gallivm, uint_bld->vec_type, "");
+   LLVMBuildStore(builder, uint_bld->zero, res_ptr);
+
+   any = lp_build_any_true_range(uint_bld, uint_bld->type.length, mask);
+   lp_build_if(&ifthen, gallivm, any);
+   {
+      index = lp_build_select(uint_bld, mask, index, uint_bld->zero);
+      res = uint_bld->undef;
+      for (i = 0; i < uint_bld->type.length; i++) {
+         LLVMValueRef ii = lp_build_const_int32(gallivm, i);
+         LLVMValueRef elem_index = LLVMBuildExtractElement(builder, index, ii, "");
+         LLVMValueRef scalar_ptr = LLVMBuildGEP(builder, ptr, &elem_index, 1, "");
+         LLVMValueRef scalar = LLVMBuildLoad(builder, scalar_ptr, "");
+         res = LLVMBuildInsertElement(builder, res, scalar, ii, "");
+      }
+      res = lp_build_select(uint_bld, mask, res, uint_bld->zero);
+      LLVMBuildStore(builder, res, res_ptr);
+   }
+   lp_build_endif(&ifthen);
+
+   return LLVMBuildLoad(builder, res_ptr, "");
+}
+
+/**
+ * Emit a loop over the lanes, running the body for the lanes in mask.
+ * Returns the lane index, the caller emits the body and then calls
+ * end_lane_loop().
+ */
+static LLVMValueRef
+begin_lane_loop(struct lp_build_tgsi_soa_context *bld,
+                struct lp_build_loop_state *loop_state,
+                struct lp_build_if_state *ifthen,
+                LLVMValueRef mask)
+{
+   struct gallivm_state *gallivm = bld->bld_base.base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   LLVMValueRef lane_mask, cond;
+
+   lp_build_loop_begin(loop_state, gallivm, lp_build_const_int32(gallivm, 0));
+   lane_mask = LLVMBuildExtractElement(builder, mask, loop_state->counter, "");
+   cond = LLVMBuildICmp(builder, LLVMIntNE, lane_mask,
+                        lp_build_const_int32(gallivm, 0), "");
+   lp_build_if(ifthen, gallivm, cond);
+
+   return loop_state->counter;
+}
+
+static void
+end_lane_loop(struct lp_build_tgsi_soa_context *bld,
+              struct lp_build_loop_state *loop_state,
+              struct lp_build_if_state *ifthen)
+{
+   struct gallivm_state *gallivm = bld->bld_base.base.gallivm;
+
+   lp_build_endif(ifthen);
+   lp_build_loop_end_cond(loop_state,
+                          lp_build_const_int32(gallivm,
+                                               bld->bld_base.uint_bld.type.length),
+                          NULL, LLVMIntUGE);
+}
+
+static void
+load_emit_image(struct lp_build_tgsi_soa_context *bld,
+                struct lp_build_emit_data *emit_data)
+{
+   struct lp_build_tgsi_context *bld_base = &bld->bld_base;
+   const struct tgsi_full_instruction *inst = emit_data->inst;
+   unsigned unit = inst->Src[0].Register.Index;
+   unsigned target = inst->Memory.Texture;
+   LLVMValueRef coords[3];
+   struct lp_img_params params;
+   unsigned dims, i;
+
+   dims = image_coord_dims(target);
+   for (i = 0; i < dims; i++)
+      coords[i] = lp_build_emit_fetch_src(bld_base, &inst->Src[1],
+                                          TGSI_TYPE_UNSIGNED, i);
+
+   memset(&params, 0, sizeof(params));
+   params.type = bld_base->base.type;
+   params.image_index = unit;
+   params.img_op = LP_IMG_LOAD;
+   params.target = tgsi_to_pipe_tex_target(target);
+   params.exec_mask = mask_vec(bld_base);
+   params.context_ptr = bld->context_ptr;
+   params.thread_data_ptr = bld->thread_data_ptr;
+   params.coords = coords;
+   params.outdata = emit_data->output;
+
+   bld->image->emit_op(bld->image, bld_base->base.gallivm, &params);
+}
+
+static void
+load_emit(
+   const struct lp_build_tgsi_action * action,
+   struct lp_build_tgsi_context * bld_base,
+   struct lp_build_emit_data * emit_data)
+{
+   struct lp_build_tgsi_soa_context * bld = lp_soa_context(bld_base);
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   struct lp_build_context *uint_bld = &bld_base->uint_bld;
+   const struct tgsi_full_instruction *inst = emit_data->inst;
+   LLVMValueRef ptr, limit, index;
+   unsigned chan;
+
+   if (inst->Src[0].Register.File == TGSI_FILE_IMAGE) {
+      load_emit_image(bld, emit_data);
+      return;
+   }
+
+   ptr = get_mem_ptr(bld, &inst->Src[0], &limit);
+   index = lp_build_emit_fetch_src(bld_base, &inst->Src[1],
+                                   TGSI_TYPE_UNSIGNED, TGSI_CHAN_X);
+   index = lp_build_shr_imm(uint_bld, index, 2);
+
+   TGSI_FOR_EACH_DST0_ENABLED_CHANNEL(inst, chan) {
+      LLVMValueRef chan_index, mask, res;
+
+      chan_index = lp_build_add(uint_bld, index,
+                                lp_build_const_int_vec(gallivm, uint_bld->type, chan));
+      mask = mask_vec(bld_base);
+      if (limit) {
+         mask = LLVMBuildAnd(builder, mask,
+                             lp_build_cmp(uint_bld, PIPE_FUNC_LESS,
+                                          chan_index, limit), "");
+      }
+      res = emit_masked_load(bld, ptr, chan_index, mask);
+      emit_data->output[chan] = LLVMBuildBitCast(builder, res,
+                                                 bld_base->base.vec_type, "");
+   }
+}
+
+static void
+store_emit_image(struct lp_build_tgsi_soa_context *bld,
+                 struct lp_build_emit_data *emit_data)
+{
+   struct lp_build_tgsi_context *bld_base = &bld->bld_base;
+   const struct tgsi_full_instruction *inst = emit_data->inst;
+   unsigned unit = inst->Dst[0].Register.Index;
+   unsigned target = inst->Memory.Texture;
+   LLVMValueRef coords[3];
+   struct lp_img_params params;
+   unsigned dims, i;
+
+   dims = image_coord_dims(target);
+   for (i = 0; i < dims; i++)
+      coords[i] = lp_build_emit_fetch_src(bld_base, &inst->Src[0],
+                                          TGSI_TYPE_UNSIGNED, i);
+
+   memset(&params, 0, sizeof(params));
+   params.type = bld_base->base.type;
+   params.image_index = unit;
+   params.img_op = LP_IMG_STORE;
+   params.target = tgsi_to_pipe_tex_target(target);
+   params.exec_mask = mask_vec(bld_base);
+   params.context_ptr = bld->context_ptr;
+   params.thread_data_ptr = bld->thread_data_ptr;
+   params.coords = coords;
+   for (i = 0; i < 4; i++)
+      params.indata[i] = lp_build_emit_fetch_src(bld_base, &inst->Src[1],
+                                                 TGSI_TYPE_FLOAT, i);
+
+   bld->image->emit_op(bld->image, bld_base->base.gallivm, &params);
+}
+
+static void
+store_emit(
+   const struct lp_build_tgsi_action * action,
+   struct lp_build_tgsi_context * bld_base,
+   struct lp_build_emit_data * emit_data)
+{
+   struct lp_build_tgsi_soa_context * bld = lp_soa_context(bld_base);
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   struct lp_build_context *uint_bld = &bld_base->uint_bld;
+   const struct tgsi_full_instruction *inst = emit_data->inst;
+   const struct tgsi_full_dst_register *dst = &inst->Dst[0];
+   struct tgsi_full_src_register mem_reg;
+   struct lp_build_loop_state loop_state;
+   struct lp_build_if_state ifthen;
+   LLVMValueRef ptr, limit, index, lane;
+   LLVMValueRef chan_index[4], chan_mask[4], value[4];
+   unsigned chan;
+
+   if (dst->Register.File == TGSI_FILE_IMAGE) {
+      store_emit_image(bld, emit_data);
+      return;
+   }
+
+   memset(&mem_reg, 0, sizeof(mem_reg));
+   mem_reg.Register.File = dst->Register.File;
+   mem_reg.Register.Index = dst->Register.Index;
+   ptr = get_mem_ptr(bld, &mem_reg, &limit);
+
+   index = lp_build_emit_fetch_src(bld_base, &inst->Src[0],
+                                   TGSI_TYPE_UNSIGNED, TGSI_CHAN_X);
+   index = lp_build_shr_imm(uint_bld, index, 2);
+
+   TGSI_FOR_EACH_DST0_ENABLED_CHANNEL(inst, chan) {
+      chan_index[chan] = lp_build_add(uint_bld, index,
+                                      lp_build_const_int_vec(gallivm, uint_bld->type, chan));
+      chan_mask[chan] = limit ? lp_build_cmp(uint_bld, PIPE_FUNC_LESS,
+                                             chan_index[chan], limit) : NULL;
+      value[chan] = lp_build_emit_fetch_src(bld_base, &inst->Src[1],
+                                            TGSI_TYPE_UNSIGNED, chan);
+   }
+
+   /*
+    * Store lane by lane, behind a branch: other threads may write to the
+    * lanes we don't, so they can't be read and written back.
+    */
+   lane = begin_lane_loop(bld, &loop_state, &ifthen, mask_vec(bld_base));
+   TGSI_FOR_EACH_DST0_ENABLED_CHANNEL(inst, chan) {
+      struct lp_build_if_state chan_ifthen;
+      LLVMValueRef elem_index, scalar_ptr, scalar;
+
+      if (chan_mask[chan]) {
+         LLVMValueRef cond = LLVMBuildExtractElement(builder, chan_mask[chan],
+                                                     lane, "");
+         cond = LLVMBuildICmp(builder, LLVMIntNE, cond,
+                              lp_build_const_int32(gallivm, 0), "");
+         lp_build_if(&chan_ifthen, gallivm, cond);
+      }
+
+      elem_index = LLVMBuildExtractElement(builder, chan_index[chan], lane, "");
+      scalar = LLVMBuildExtractElement(builder, value[chan], lane, "");
+      scalar_ptr = LLVMBuildGEP(builder, ptr, &elem_index, 1, "");
+      LLVMBuildStore(builder, scalar, scalar_ptr);
+
+      if (chan_mask[chan])
+         lp_build_endif(&chan_ifthen);
+   }
+   end_lane_loop(bld, &loop_state, &ifthen);
+}
+
+static LLVMAtomicRMWBinOp
+tgsi_to_atomic_op(enum tgsi_opcode opcode)
+{
+   switch (opcode) {
+   case TGSI_OPCODE_ATOMUADD:
+      return LLVMAtomicRMWBinOpAdd;
+   case TGSI_OPCODE_ATOMXCHG:
+      return LLVMAtomicRMWBinOpXchg;
+   case TGSI_OPCODE_ATOMAND:
+      return LLVMAtomicRMWBinOpAnd;
+   case TGSI_OPCODE_ATOMOR:
+      return LLVMAtomicRMWBinOpOr;
+   case TGSI_OPCODE_ATOMXOR:
+      return LLVMAtomicRMWBinOpXor;
+   case TGSI_OPCODE_ATOMUMIN:
+      return LLVMAtomicRMWBinOpUMin;
+   case TGSI_OPCODE_ATOMUMAX:
+      return LLVMAtomicRMWBinOpUMax;
+   case TGSI_OPCODE_ATOMIMIN:
+      return LLVMAtomicRMWBinOpMin;
+   case TGSI_OPCODE_ATOMIMAX:
+      return LLVMAtomicRMWBinOpMax;
+   default:
+      assert(0);
+      return LLVMAtomicRMWBinOpAdd;
+   }
+}
+
+static void
+atomic_emit_image(struct lp_build_tgsi_soa_context *bld,
+                  struct lp_build_emit_data *emit_data)
+{
+   struct lp_build_tgsi_context *bld_base = &bld->bld_base;
+   const struct tgsi_full_instruction *inst = emit_data->inst;
+   enum tgsi_opcode opcode = inst->Instruction.Opcode;
+   unsigned unit = inst->Src[0].Register.Index;
+   unsigned target = inst->Memory.Texture;
+   LLVMValueRef coords[3];
+   struct lp_img_params params;
+   unsigned dims, i;
+
+   dims = image_coord_dims(target);
+   for (i = 0; i < dims; i++)
+      coords[i] = lp_build_emit_fetch_src(bld_base, &inst->Src[1],
+                                          TGSI_TYPE_UNSIGNED, i);
+
+   memset(&params, 0, sizeof(params));
+   params.type = bld_base->base.type;
+   params.image_index = unit;
+   params.target = tgsi_to_pipe_tex_target(target);
+   params.exec_mask = mask_vec(bld_base);
+   params.context_ptr = bld->context_ptr;
+   params.thread_data_ptr = bld->thread_data_ptr;
+   params.coords = coords;
+   params.outdata = emit_data->output;
+   params.indata[0] = lp_build_emit_fetch_src(bld_base, &inst->Src[2],
+                                              TGSI_TYPE_FLOAT, TGSI_CHAN_X);
+   if (opcode == TGSI_OPCODE_ATOMCAS) {
+      params.img_op = LP_IMG_ATOMIC_CAS;
+      params.indata2[0] = lp_build_emit_fetch_src(bld_base, &inst->Src[3],
+                                                  TGSI_TYPE_FLOAT, TGSI_CHAN_X);
+   } else {
+      params.img_op = LP_IMG_ATOMIC;
+      params.op = tgsi_to_atomic_op(opcode);
+   }
+
+   bld->image->emit_op(bld->image, bld_base->base.gallivm, &params);
+}
+
+static void
+atomic_emit_mem(struct lp_build_tgsi_soa_context *bld,
+                struct lp_build_emit_data *emit_data)
+{
+   struct lp_build_tgsi_context *bld_base = &bld->bld_base;
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   struct lp_build_context *uint_bld = &bld_base->uint_bld;
+   const struct tgsi_full_instruction *inst = emit_data->inst;
+   enum tgsi_opcode opcode = inst->Instruction.Opcode;
+   struct lp_build_loop_state loop_state;
+   struct lp_build_if_state ifthen;
+   LLVMValueRef ptr, limit, index, value, cmp_value = NULL;
+   LLVMValueRef mask, lane, res_ptr, res, scalar_ptr, scalar, elem_index;
+
+   ptr = get_mem_ptr(bld, &inst->Src[0], &limit);
+   index = lp_build_emit_fetch_src(bld_base, &inst->Src[1],
+                                   TGSI_TYPE_UNSIGNED, TGSI_CHAN_X);
+   index = lp_build_shr_imm(uint_bld, index, 2);
+   value = lp_build_emit_fetch_src(bld_base, &inst->Src[2],
+                                   TGSI_TYPE_UNSIGNED, TGSI_CHAN_X);
+   if (opcode == TGSI_OPCODE_ATOMCAS)
+      cmp_value = lp_build_emit_fetch_src(bld_base, &inst->Src[3],
+                                          TGSI_TYPE_UNSIGNED, TGSI_CHAN_X);
+
+   mask = mask_vec(bld_base);
+   if (limit)
+      mask = LLVMBuildAnd(builder, mask,
+                          lp_build_cmp(uint_bld, PIPE_FUNC_LESS, index, limit), "");
+
+   /* Lanes that don't do the atomic return zero. */
+   res_ptr = lp_build_alloca(gallivm, uint_bld->vec_type, "");
+   LLVMBuildStore(builder, uint_bld->zero, res_ptr);
+
+   lane = begin_lane_loop(bld, &loop_state, &ifthen, mask);
+   elem_index = LLVMBuildExtractElement(builder, index, lane, "");
+   scalar_ptr = LLVMBuildGEP(builder, ptr, &elem_index, 1, "");
+   scalar = LLVMBuildExtractElement(builder, value, lane, "");
+   if (opcode == TGSI_OPCODE_ATOMCAS) {
+#if HAVE_LLVM >= 0x0309
+      LLVMValueRef cmp = LLVMBuildExtractElement(builder, cmp_value, lane, "");
+      scalar = LLVMBuildAtomicCmpXchg(builder, scalar_ptr, cmp, scalar,
+                                      LLVMAtomicOrderingSequentiallyConsistent,
+                                      LLVMAtomicOrderingSequentiallyConsistent,
+                                      false);
+      scalar = LLVMBuildExtractValue(builder, scalar, 0, "");
+#else
+      assert(0);
+#endif
+   } else {
+      scalar = LLVMBuildAtomicRMW(builder, tgsi_to_atomic_op(opcode),
+                                  scalar_ptr, scalar,
+                                  LLVMAtomicOrderingSequentiallyConsistent,
+                                  false);
+   }
+   res = LLVMBuildLoad(builder, res_ptr, "");
+   res = LLVMBuildInsertElement(builder, res, scalar, lane, "");
+   LLVMBuildStore(builder, res, res_ptr);
+   end_lane_loop(bld, &loop_state, &ifthen);
+
+   emit_data->output[0] = LLVMBuildBitCast(builder,
+                                           LLVMBuildLoad(builder, res_ptr, ""),
+                                           bld_base->base.vec_type, "");
+}
+
+static void
+atomic_emit(
+   const struct lp_build_tgsi_action * action,
+   struct lp_build_tgsi_context * bld_base,
+   struct lp_build_emit_data * emit_data)
+{
+   struct lp_build_tgsi_soa_context * bld = lp_soa_context(bld_base);
+   const struct tgsi_full_instruction *inst = emit_data->inst;
+   unsigned chan;
+
+   if (inst->Src[0].Register.File == TGSI_FILE_IMAGE)
+      atomic_emit_image(bld, emit_data);
+   else
+      atomic_emit_mem(bld, emit_data);
+
+   /* The old value is returned in all channels. */
+   TGSI_FOR_EACH_DST0_ENABLED_CHANNEL(inst, chan)
+      emit_data->output[chan] = emit_data->output[0];
+}
+
+static void
+resq_emit(
+   const struct lp_build_tgsi_action * action,
+   struct lp_build_tgsi_context * bld_base,
+   struct lp_build_emit_data * emit_data)
+{
+   struct lp_build_tgsi_soa_context * bld = lp_soa_context(bld_base);
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBuilderRef builder = gallivm->builder;
+   const struct tgsi_full_instruction *inst = emit_data->inst;
+   unsigned unit = inst->Src[0].Register.Index;
+   LLVMValueRef sizes[4];
+   unsigned chan;
+
+   if (inst->Src[0].Register.File == TGSI_FILE_IMAGE) {
+      struct lp_sampler_size_query_params params;
+
+      memset(&params, 0, sizeof(params));
+      params.int_type = bld_base->int_bld.type;
+      params.texture_unit = unit;
+      params.target = tgsi_to_pipe_tex_target(bld->images[unit].Resource);
+      params.context_ptr = bld->context_ptr;
+      params.is_sviewinfo = TRUE;
+      params.lod_property = LP_SAMPLER_LOD_SCALAR;
+      params.sizes_out = sizes;
+
+      bld->image->emit_size_query(bld->image, gallivm, &params);
+   } else {
+      assert(inst->Src[0].Register.File == TGSI_FILE_BUFFER);
+      sizes[0] = lp_build_broadcast_scalar(&bld_base->uint_bld,
+                                           bld->ssbo_sizes[unit]);
+      sizes[1] = sizes[2] = sizes[3] = bld_base->uint_bld.zero;
+   }
+
+   TGSI_FOR_EACH_DST0_ENABLED_CHANNEL(inst, chan) {
+      emit_data->output[chan] = LLVMBuildBitCast(builder, sizes[chan],
+                                                 bld_base->base.vec_type, "");
+   }
+}
+
+/**
+ * All the SIMD vectors of a work group have to get here before any goes
+ * on: the vector suspends and is resumed once the others got here too.
+ */
+static void
+barrier_emit(
+   const struct lp_build_tgsi_action * action,
+   struct lp_build_tgsi_context * bld_base,
+   struct lp_build_emit_data * emit_data)
+{
+   struct lp_build_tgsi_soa_context * bld = lp_soa_context(bld_base);
+   struct gallivm_state *gallivm = bld_base->base.gallivm;
+   LLVMBasicBlockRef resume = lp_build_insert_new_block(gallivm, "resume");
+
+   lp_build_coro_suspend_switch(gallivm, bld->coro, resume, FALSE);
+   LLVMPositionBuilderAtEnd(gallivm->builder, resume);
+}
+
+static void
+membar_emit(
+   const struct lp_build_tgsi_action * action,
+   struct lp_build_tgsi_context * bld_base,
+   struct lp_build_emit_data * emit_data)
+{
+#if HAVE_LLVM >= 0x0309
+   LLVMBuildFence(bld_base->base.gallivm->builder,
+                  LLVMAtomicOrderingSequentiallyConsistent, false, "");
+#endif
+}
+
 static void emit_prologue(struct lp_build_tgsi_context * bld_base)
 {
    struct lp_build_tgsi_soa_context * bld = lp_soa_context(bld_base);
@@ -3827,20 +4403,12 @@ static void emit_epilogue(struct lp_build_tgsi_context * bld_base)
 void
 lp_build_tgsi_soa(struct gallivm_state *gallivm,
                   const struct tgsi_token *tokens,
-                  struct lp_type type,
-                  struct lp_build_mask_context *mask,
-                  LLVMValueRef consts_ptr,
-                  LLVMValueRef const_sizes_ptr,
-                  const struct lp_bld_tgsi_system_values *system_values,
-                  const LLVMValueRef (*inputs)[TGSI_NUM_CHANNELS],
-                  LLVMValueRef (*outputs)[TGSI_NUM_CHANNELS],
-                  LLVMValueRef context_ptr,
-                  LLVMValueRef thread_data_ptr,
-                  const struct lp_build_sampler_soa *sampler,
-                  const struct tgsi_shader_info *info,
-                  const struct lp_build_tgsi_gs_iface *gs_iface)
+                  const struct lp_build_tgsi_params *params,
+                  LLVMValueRef (*outputs)[TGSI_NUM_CHANNELS])
 {
    struct lp_build_tgsi_soa_context bld;
+   struct lp_type type = params->type;
+   const struct tgsi_shader_info *info = params->info;
 
    struct lp_type res_type;
 
@@ -3874,16 +4442,21 @@ lp_build_tgsi_soa(struct gallivm_state *gallivm,
       int64_type.width *= 2;
       lp_build_context_init(&bld.bld_base.int64_bld, gallivm, int64_type);
    }
-   bld.mask = mask;
-   bld.inputs = inputs;
+   bld.mask = params->mask;
+   bld.inputs = params->inputs;
    bld.outputs = outputs;
-   bld.consts_ptr = consts_ptr;
-   bld.const_sizes_ptr = const_sizes_ptr;
-   bld.sampler = sampler;
+   bld.consts_ptr = params->consts_ptr;
+   bld.const_sizes_ptr = params->const_sizes_ptr;
+   bld.ssbo_ptr = params->ssbo_ptr;
+   bld.ssbo_sizes_ptr = params->ssbo_sizes_ptr;
+   bld.shared_ptr = params->shared_ptr;
+   bld.sampler = params->sampler;
+   bld.image = params->image;
+   bld.coro = params->coro;
    bld.bld_base.info = info;
    bld.indirect_files = info->indirect_files;
-   bld.context_ptr = context_ptr;
-   bld.thread_data_ptr = thread_data_ptr;
+   bld.context_ptr = params->context_ptr;
+   bld.thread_data_ptr = params->thread_data_ptr;
 
    /*
     * If the number of temporaries is rather large then we just
@@ -3968,8 +4541,27 @@ lp_build_tgsi_soa(struct gallivm_state *gallivm,
    bld.bld_base.op_actions[TGSI_OPCODE_SVIEWINFO].emit = sviewinfo_emit;
    bld.bld_base.op_actions[TGSI_OPCODE_LOD].emit = lod_emit;
 
-
-   if (gs_iface) {
+   /* shader storage buffers, shared memory and images */
+   bld.bld_base.op_actions[TGSI_OPCODE_LOAD].emit = load_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_STORE].emit = store_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_RESQ].emit = resq_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMUADD].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMXCHG].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMCAS].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMAND].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMOR].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMXOR].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMUMIN].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMUMAX].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMIMIN].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_ATOMIMAX].emit = atomic_emit;
+   bld.bld_base.op_actions[TGSI_OPCODE_MEMBAR].emit = membar_emit;
+
+   if (params->coro)
+      bld.bld_base.op_actions[TGSI_OPCODE_BARRIER].emit = barrier_emit;
+
+
+   if (params->gs_iface) {
       /* There's no specific value for this because it should always
        * be set, but apps using ext_geometry_shader4 quite often
        * were forgetting so we're using MAX_VERTEX_VARYING from
@@ -3979,7 +4571,7 @@ lp_build_tgsi_soa(struct gallivm_state *gallivm,
 
       /* inputs are always indirect with gs */
       bld.indirect_files |= (1 << TGSI_FILE_INPUT);
-      bld.gs_iface = gs_iface;
+      bld.gs_iface = params->gs_iface;
       bld.bld_base.emit_fetch_funcs[TGSI_FILE_INPUT] = emit_fetch_gs_input;
       bld.bld_base.op_actions[TGSI_OPCODE_EMIT].emit = emit_vertex;
       bld.bld_base.op_actions[TGSI_OPCODE_ENDPRIM].emit = end_primitive;
@@ -3996,7 +4588,7 @@ lp_build_tgsi_soa(struct gallivm_state *gallivm,
 
    lp_exec_mask_init(&bld.exec_mask, &bld.bld_base.int_bld);
 
-   bld.system_values = *system_values;
+   bld.system_values = *params->system_values;
 
    lp_build_tgsi_llvm(&bld.bld_base, tokens);
 
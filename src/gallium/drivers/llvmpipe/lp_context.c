@@ -89,6 +89,12 @@ static void llvmpipe_destroy( struct pipe_context *pipe )
       pipe_sampler_view_reference(&llvmpipe->sampler_views[PIPE_SHADER_GEOMETRY][i], NULL);
    }
 
+   for (i = 0; i < ARRAY_SIZE(llvmpipe->sampler_views[0]); i++) {
+      pipe_sampler_view_reference(&llvmpipe->sampler_views[PIPE_SHADER_COMPUTE][i], NULL);
+   }
+
+   llvmpipe_cleanup_compute(llvmpipe);
+
    for (i = 0; i < ARRAY_SIZE(llvmpipe->constants); i++) {
       for (j = 0; j < ARRAY_SIZE(llvmpipe->constants[i]); j++) {
          pipe_resource_reference(&llvmpipe->constants[i][j].buffer, NULL);
@@ -118,6 +124,17 @@ do_flush( struct pipe_context *pipe,
 }
 
 
+/**
+ * Shader stores and atomics are done once the scenes doing them ran.
+ */
+static void
+llvmpipe_memory_barrier(struct pipe_context *pipe,
+                        unsigned flags)
+{
+   llvmpipe_finish(pipe, __FUNCTION__);
+}
+
+
 static void
 llvmpipe_render_condition(struct pipe_context *pipe,
                           struct pipe_query *query,
@@ -147,6 +164,8 @@ llvmpipe_create_context(struct pipe_screen *screen, void *priv,
 
    make_empty_list(&llvmpipe->fs_variants_list);
 
+   make_empty_list(&llvmpipe->cs_variants_list);
+
    make_empty_list(&llvmpipe->setup_variants_list);
 
 
@@ -158,6 +177,7 @@ llvmpipe_create_context(struct pipe_screen *screen, void *priv,
    llvmpipe->pipe.set_framebuffer_state = llvmpipe_set_framebuffer_state;
    llvmpipe->pipe.clear = llvmpipe_clear;
    llvmpipe->pipe.flush = do_flush;
+   llvmpipe->pipe.memory_barrier = llvmpipe_memory_barrier;
 
    llvmpipe->pipe.render_condition = llvmpipe_render_condition;
 
@@ -169,6 +189,7 @@ llvmpipe_create_context(struct pipe_screen *screen, void *priv,
    llvmpipe_init_vertex_funcs(llvmpipe);
    llvmpipe_init_so_funcs(llvmpipe);
    llvmpipe_init_fs_funcs(llvmpipe);
+   llvmpipe_init_compute_funcs(llvmpipe);
    llvmpipe_init_vs_funcs(llvmpipe);
    llvmpipe_init_gs_funcs(llvmpipe);
    llvmpipe_init_rasterizer_funcs(llvmpipe);
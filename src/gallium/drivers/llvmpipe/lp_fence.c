@@ -35,9 +35,8 @@
 /**
  * Create a new fence object.
  *
- * The rank will be the number of bins in the scene.  Whenever a rendering
- * thread hits a fence command, it'll increment the fence counter.  When
- * the counter == the rank, the fence is finished.
+ * Each lp_fence_signal() call increments the fence counter.  When the
+ * counter == the rank, the fence is finished.
  *
  * \param rank  the expected finished value of the fence counter.
  */
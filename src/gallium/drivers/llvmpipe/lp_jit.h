@@ -44,7 +44,8 @@
 
 
 struct lp_build_format_cache;
-struct lp_fragment_shader_variant;
+struct lp_fs_variant_build;
+struct lp_compute_shader_variant;
 struct llvmpipe_screen;
 
 
@@ -71,6 +72,17 @@ struct lp_jit_sampler
 };
 
 
+struct lp_jit_image
+{
+   uint32_t width;        /* same as number of elements */
+   uint32_t height;
+   uint32_t depth;        /* doubles as array size */
+   const void *base;
+   uint32_t row_stride;
+   uint32_t img_stride;
+};
+
+
 struct lp_jit_viewport
 {
    float min_depth;
@@ -101,6 +113,17 @@ enum {
 };
 
 
+enum {
+   LP_JIT_IMAGE_WIDTH = 0,
+   LP_JIT_IMAGE_HEIGHT,
+   LP_JIT_IMAGE_DEPTH,
+   LP_JIT_IMAGE_BASE,
+   LP_JIT_IMAGE_ROW_STRIDE,
+   LP_JIT_IMAGE_IMG_STRIDE,
+   LP_JIT_IMAGE_NUM_FIELDS  /* number of fields above */
+};
+
+
 enum {
    LP_JIT_VIEWPORT_MIN_DEPTH,
    LP_JIT_VIEWPORT_MAX_DEPTH,
@@ -118,12 +141,20 @@ enum {
  *
  * Only use types with a clear size and padding here, in particular prefer the
  * stdint.h types to the basic integer types.
+ *
+ * The textures, samplers and images must stay right after the constants,
+ * at the same position as in lp_jit_cs_context, so the same texture sampling
+ * and image code works for both.
  */
 struct lp_jit_context
 {
    const float *constants[LP_MAX_TGSI_CONST_BUFFERS];
    int num_constants[LP_MAX_TGSI_CONST_BUFFERS];
 
+   struct lp_jit_texture textures[PIPE_MAX_SHADER_SAMPLER_VIEWS];
+   struct lp_jit_sampler samplers[PIPE_MAX_SAMPLERS];
+   struct lp_jit_image images[LP_MAX_TGSI_SHADER_IMAGES];
+
    float alpha_ref_value;
 
    uint32_t stencil_ref_front, stencil_ref_back;
@@ -133,8 +164,8 @@ struct lp_jit_context
 
    struct lp_jit_viewport *viewports;
 
-   struct lp_jit_texture textures[PIPE_MAX_SHADER_SAMPLER_VIEWS];
-   struct lp_jit_sampler samplers[PIPE_MAX_SAMPLERS];
+   const uint32_t *ssbos[LP_MAX_TGSI_SHADER_BUFFERS];
+   int num_ssbos[LP_MAX_TGSI_SHADER_BUFFERS];   /**< size in bytes */
 };
 
 
@@ -145,14 +176,17 @@ struct lp_jit_context
 enum {
    LP_JIT_CTX_CONSTANTS = 0,
    LP_JIT_CTX_NUM_CONSTANTS,
+   LP_JIT_CTX_TEXTURES,
+   LP_JIT_CTX_SAMPLERS,
+   LP_JIT_CTX_IMAGES,
    LP_JIT_CTX_ALPHA_REF,
    LP_JIT_CTX_STENCIL_REF_FRONT,
    LP_JIT_CTX_STENCIL_REF_BACK,
    LP_JIT_CTX_U8_BLEND_COLOR,
    LP_JIT_CTX_F_BLEND_COLOR,
    LP_JIT_CTX_VIEWPORTS,
-   LP_JIT_CTX_TEXTURES,
-   LP_JIT_CTX_SAMPLERS,
+   LP_JIT_CTX_SSBOS,
+   LP_JIT_CTX_NUM_SSBOS,
    LP_JIT_CTX_COUNT
 };
 
@@ -187,6 +221,15 @@ enum {
 #define lp_jit_context_samplers(_gallivm, _ptr) \
    lp_build_struct_get_ptr(_gallivm, _ptr, LP_JIT_CTX_SAMPLERS, "samplers")
 
+#define lp_jit_context_images(_gallivm, _ptr) \
+   lp_build_struct_get_ptr(_gallivm, _ptr, LP_JIT_CTX_IMAGES, "images")
+
+#define lp_jit_context_ssbos(_gallivm, _ptr) \
+   lp_build_struct_get_ptr(_gallivm, _ptr, LP_JIT_CTX_SSBOS, "ssbos")
+
+#define lp_jit_context_num_ssbos(_gallivm, _ptr) \
+   lp_build_struct_get_ptr(_gallivm, _ptr, LP_JIT_CTX_NUM_SSBOS, "num_ssbos")
+
 
 struct lp_jit_thread_data
 {
@@ -259,6 +302,103 @@ typedef void
                     unsigned depth_stride);
 
 
+/**
+ * This structure is passed directly to the generated compute shader.
+ *
+ * The constants, textures, samplers and images are at the same position as
+ * in lp_jit_context, see there.
+ */
+struct lp_jit_cs_context
+{
+   const float *constants[LP_MAX_TGSI_CONST_BUFFERS];
+   int num_constants[LP_MAX_TGSI_CONST_BUFFERS];
+
+   struct lp_jit_texture textures[PIPE_MAX_SHADER_SAMPLER_VIEWS];
+   struct lp_jit_sampler samplers[PIPE_MAX_SAMPLERS];
+
+   struct lp_jit_image images[LP_MAX_TGSI_SHADER_IMAGES];
+
+   const uint32_t *ssbos[LP_MAX_TGSI_SHADER_BUFFERS];
+   int num_ssbos[LP_MAX_TGSI_SHADER_BUFFERS];   /**< size in bytes */
+};
+
+
+/**
+ * These enum values must match the position of the fields in the
+ * lp_jit_cs_context struct above.
+ */
+enum {
+   LP_JIT_CS_CTX_CONSTANTS = LP_JIT_CTX_CONSTANTS,
+   LP_JIT_CS_CTX_NUM_CONSTANTS = LP_JIT_CTX_NUM_CONSTANTS,
+   LP_JIT_CS_CTX_TEXTURES = LP_JIT_CTX_TEXTURES,
+   LP_JIT_CS_CTX_SAMPLERS = LP_JIT_CTX_SAMPLERS,
+   LP_JIT_CS_CTX_IMAGES = LP_JIT_CTX_IMAGES,
+   LP_JIT_CS_CTX_SSBOS,
+   LP_JIT_CS_CTX_NUM_SSBOS,
+   LP_JIT_CS_CTX_COUNT
+};
+
+
+#define lp_jit_cs_context_constants(_gallivm, _ptr) \
+   lp_build_struct_get_ptr(_gallivm, _ptr, LP_JIT_CS_CTX_CONSTANTS, "constants")
+
+#define lp_jit_cs_context_num_constants(_gallivm, _ptr) \
+   lp_build_struct_get_ptr(_gallivm, _ptr, LP_JIT_CS_CTX_NUM_CONSTANTS, "num_constants")
+
+#define lp_jit_cs_context_images(_gallivm, _ptr) \
+   lp_build_struct_get_ptr(_gallivm, _ptr, LP_JIT_CS_CTX_IMAGES, "images")
+
+#define lp_jit_cs_context_ssbos(_gallivm, _ptr) \
+   lp_build_struct_get_ptr(_gallivm, _ptr, LP_JIT_CS_CTX_SSBOS, "ssbos")
+
+#define lp_jit_cs_context_num_ssbos(_gallivm, _ptr) \
+   lp_build_struct_get_ptr(_gallivm, _ptr, LP_JIT_CS_CTX_NUM_SSBOS, "num_ssbos")
+
+
+struct lp_jit_cs_thread_data
+{
+   struct lp_build_format_cache *cache;
+   void *shared;
+};
+
+
+enum {
+   LP_JIT_CS_THREAD_DATA_CACHE = 0,
+   LP_JIT_CS_THREAD_DATA_SHARED,
+   LP_JIT_CS_THREAD_DATA_COUNT
+};
+
+
+#define lp_jit_cs_thread_data_cache(_gallivm, _ptr) \
+   lp_build_struct_get(_gallivm, _ptr, LP_JIT_CS_THREAD_DATA_CACHE, "cache")
+
+#define lp_jit_cs_thread_data_shared(_gallivm, _ptr) \
+   lp_build_struct_get(_gallivm, _ptr, LP_JIT_CS_THREAD_DATA_SHARED, "shared")
+
+
+/**
+ * typedef for compute shader function, which runs one work group
+ *
+ * @param context       jit context
+ * @param x, y, z       work group id
+ * @param grid_x, grid_y, grid_z        number of work groups
+ * @param block_x, block_y, block_z     work group size
+ * @param thread_data   worker thread data
+ */
+typedef void
+(*lp_jit_cs_func)(const struct lp_jit_cs_context *context,
+                  uint32_t x,
+                  uint32_t y,
+                  uint32_t z,
+                  uint32_t grid_x,
+                  uint32_t grid_y,
+                  uint32_t grid_z,
+                  uint32_t block_x,
+                  uint32_t block_y,
+                  uint32_t block_z,
+                  struct lp_jit_cs_thread_data *thread_data);
+
+
 void
 lp_jit_screen_cleanup(struct llvmpipe_screen *screen);
 
@@ -268,7 +408,16 @@ lp_jit_screen_init(struct llvmpipe_screen *screen);
 
 
 void
-lp_jit_init_types(struct lp_fragment_shader_variant *lp);
+lp_jit_init_types(struct lp_fs_variant_build *lp);
+
+
+void
+lp_jit_init_cs_types(struct lp_compute_shader_variant *lp);
+
+
+void
+lp_jit_image_from_view(struct lp_jit_image *jit_image,
+                       const struct pipe_image_view *view);
 
 
 #endif /* LP_JIT_H */
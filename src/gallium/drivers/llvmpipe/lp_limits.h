@@ -61,7 +61,11 @@
 #define LP_MAX_WIDTH  (1 << (LP_MAX_TEXTURE_LEVELS - 1))
 
 
-#define LP_MAX_THREADS 16
+/**
+ * Max number of rasterization threads.  Only sizes some per-thread arrays,
+ * LP_NUM_THREADS defaults to the number of CPUs.
+ */
+#define LP_MAX_THREADS 128
 
 
 /**
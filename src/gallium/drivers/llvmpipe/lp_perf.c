@@ -105,6 +105,9 @@ lp_print_counters(void)
       debug_printf("llvmpipe: nr_llvm_compiles:             %u\n", lp_count.nr_llvm_compiles);
       debug_printf("llvmpipe: total LLVM compile time:      %.2f sec\n", lp_count.llvm_compile_time / 1000000.0);
       debug_printf("llvmpipe: average LLVM compile time:    %.2f sec\n", lp_count.llvm_compile_time / 1000000.0 / lp_count.nr_llvm_compiles);
+      debug_printf("llvmpipe: nr_fs_compile_stalls:         %u\n", lp_count.nr_fs_compile_stalls);
+      debug_printf("llvmpipe: total FS compile stall time:  %.2f sec\n", lp_count.fs_compile_stall_time / 1000000.0);
+      debug_printf("llvmpipe: nr_fs_interim_variants:       %u\n", lp_count.nr_fs_interim_variants);
 
    }
 }
@@ -34,6 +34,7 @@
 #define LP_PERF_H
 
 #include "pipe/p_compiler.h"
+#include "util/u_atomic.h"
 
 /**
  * Various counters
@@ -58,6 +59,9 @@ struct lp_counters
    unsigned nr_non_empty_4;
    unsigned nr_llvm_compiles;
    int64_t llvm_compile_time;  /**< total, in microseconds */
+   unsigned nr_fs_compile_stalls;   /**< draws waiting for FS variant code */
+   int64_t fs_compile_stall_time;   /**< total, in microseconds */
+   unsigned nr_fs_interim_variants; /**< FS variants optimized in background */
 
    unsigned nr_color_tile_clear;
    unsigned nr_color_tile_load;
@@ -68,10 +72,13 @@ struct lp_counters
 extern struct lp_counters lp_count;
 
 
-/** Increment the named counter (only for debug builds) */
+/**
+ * Increment the named counter (only for debug builds).  Atomic, as the
+ * rasterizer and compile queue threads count too.
+ */
 #ifdef DEBUG
-#define LP_COUNT(counter) lp_count.counter++
-#define LP_COUNT_ADD(counter, incr)  lp_count.counter += (incr)
+#define LP_COUNT(counter) p_atomic_inc(&lp_count.counter)
+#define LP_COUNT_ADD(counter, incr)  p_atomic_add(&lp_count.counter, (incr))
 #define LP_COUNT_GET(counter) (lp_count.counter)
 #else
 #define LP_COUNT(counter)
@@ -26,6 +26,7 @@
  **************************************************************************/
 
 #include <limits.h>
+#include <stdlib.h>
 #include "util/u_memory.h"
 #include "util/u_math.h"
 #include "util/u_rect.h"
@@ -33,6 +34,7 @@
 #include "util/u_pack_color.h"
 #include "util/u_string.h"
 #include "util/u_thread.h"
+#include "util/u_atomic.h"
 
 #include "util/os_time.h"
 
@@ -49,6 +51,12 @@
 #include "lp_scene.h"
 #include "lp_tex_sample.h"
 
+#if defined(HAVE_PTHREAD_SETAFFINITY) && defined(PIPE_OS_LINUX)
+#include <ctype.h>
+#include <dirent.h>
+#include <sched.h>
+#endif
+
 
 #ifdef DEBUG
 int jit_line = 0;
@@ -70,16 +78,44 @@ lp_rast_begin( struct lp_rasterizer *rast,
    LP_DBG(DEBUG_RAST, "%s\n", __FUNCTION__);
 
    lp_scene_begin_rasterization( scene );
-   lp_scene_bin_iter_begin( scene );
+
+   /* Split the bins in as many contiguous ranges as there are threads,
+    * so each thread mostly works on the same part of the framebuffer
+    * from scene to scene.
+    */
+   {
+      unsigned num_tasks = MAX2(1, rast->num_threads);
+      unsigned num_bins = lp_scene_get_num_bins(scene);
+      unsigned i;
+
+      for (i = 0; i < num_tasks; i++) {
+         uint64_t head = (uint64_t)num_bins * i / num_tasks;
+         uint64_t tail = (uint64_t)num_bins * (i + 1) / num_tasks;
+
+         rast->tasks[i].bins = tail << 32 | head;
+      }
+   }
 }
 
 
+/**
+ * End rasterizing a scene.
+ * Called once per scene by one thread, after all threads are done with
+ * the bins.  Signalling the fence hands the scene back to setup, which
+ * may start binning into it again, so it must be the last access.
+ */
 static void
 lp_rast_end( struct lp_rasterizer *rast )
 {
-   lp_scene_end_rasterization( rast->curr_scene );
+   struct lp_scene *scene = rast->curr_scene;
+
+   lp_scene_end_rasterization( scene );
 
    rast->curr_scene = NULL;
+
+   if (scene->fence) {
+      lp_fence_signal(scene->fence);
+   }
 }
 
 
@@ -299,6 +335,7 @@ lp_rast_shade_tile(struct lp_rasterizer_task *task,
    const struct lp_rast_shader_inputs *inputs = arg.shade_tile;
    const struct lp_rast_state *state;
    struct lp_fragment_shader_variant *variant;
+   lp_jit_frag_func jit_function;
    const unsigned tile_x = task->x, tile_y = task->y;
    unsigned x, y;
 
@@ -316,6 +353,9 @@ lp_rast_shade_tile(struct lp_rasterizer_task *task,
    }
    variant = state->variant;
 
+   /* A compile job may swap in optimized code concurrently */
+   jit_function = p_atomic_read(&variant->jit_function[RAST_WHOLE]);
+
    /* render the whole 64x64 tile in 4x4 chunks */
    for (y = 0; y < task->height; y += 4){
       for (x = 0; x < task->width; x += 4) {
@@ -350,18 +390,18 @@ lp_rast_shade_tile(struct lp_rasterizer_task *task,
 
          /* run shader on 4x4 block */
          BEGIN_JIT_CALL(state, task);
-         variant->jit_function[RAST_WHOLE]( &state->jit_context,
-                                            tile_x + x, tile_y + y,
-                                            inputs->frontfacing,
-                                            GET_A0(inputs),
-                                            GET_DADX(inputs),
-                                            GET_DADY(inputs),
-                                            color,
-                                            depth,
-                                            0xffff,
-                                            &task->thread_data,
-                                            stride,
-                                            depth_stride);
+         jit_function( &state->jit_context,
+                       tile_x + x, tile_y + y,
+                       inputs->frontfacing,
+                       GET_A0(inputs),
+                       GET_DADX(inputs),
+                       GET_DADY(inputs),
+                       color,
+                       depth,
+                       0xffff,
+                       &task->thread_data,
+                       stride,
+                       depth_stride);
          END_JIT_CALL();
       }
    }
@@ -402,6 +442,7 @@ lp_rast_shade_quads_mask(struct lp_rasterizer_task *task,
 {
    const struct lp_rast_state *state = task->state;
    struct lp_fragment_shader_variant *variant = state->variant;
+   lp_jit_frag_func jit_function;
    const struct lp_scene *scene = task->scene;
    uint8_t *color[PIPE_MAX_COLOR_BUFS];
    unsigned stride[PIPE_MAX_COLOR_BUFS];
@@ -451,18 +492,19 @@ lp_rast_shade_quads_mask(struct lp_rasterizer_task *task,
 
       /* run shader on 4x4 block */
       BEGIN_JIT_CALL(state, task);
-      variant->jit_function[RAST_EDGE_TEST](&state->jit_context,
-                                            x, y,
-                                            inputs->frontfacing,
-                                            GET_A0(inputs),
-                                            GET_DADX(inputs),
-                                            GET_DADY(inputs),
-                                            color,
-                                            depth,
-                                            mask,
-                                            &task->thread_data,
-                                            stride,
-                                            depth_stride);
+      jit_function = p_atomic_read(&variant->jit_function[RAST_EDGE_TEST]);
+      jit_function(&state->jit_context,
+                   x, y,
+                   inputs->frontfacing,
+                   GET_A0(inputs),
+                   GET_DADX(inputs),
+                   GET_DADY(inputs),
+                   color,
+                   depth,
+                   mask,
+                   &task->thread_data,
+                   stride,
+                   depth_stride);
       END_JIT_CALL();
    }
 }
@@ -654,6 +696,70 @@ is_empty_bin( const struct cmd_bin *bin )
 }
 
 
+/**
+ * Take a bin off a thread's range, from the head or the tail.
+ * \return FALSE if the range is empty
+ */
+static boolean
+take_bin(uint64_t *bins, boolean from_tail, unsigned *index)
+{
+   uint64_t old = p_atomic_read(bins);
+
+   for (;;) {
+      uint64_t head = old & 0xffffffff;
+      uint64_t tail = old >> 32;
+      uint64_t new, prev;
+
+      if (head >= tail)
+         return FALSE;
+
+      if (from_tail)
+         new = (tail - 1) << 32 | head;
+      else
+         new = tail << 32 | (head + 1);
+
+      prev = p_atomic_cmpxchg(bins, old, new);
+      if (prev == old) {
+         *index = from_tail ? tail - 1 : head;
+         return TRUE;
+      }
+      old = prev;
+   }
+}
+
+
+/**
+ * Get the next bin for a thread to rasterize: from its own range while
+ * there are any left, then stolen from the other threads.
+ * \param victim  position in the thread's steal order, starts at zero
+ */
+static struct cmd_bin *
+next_bin(struct lp_rasterizer_task *task, unsigned *victim, int *x, int *y)
+{
+   struct lp_rasterizer *rast = task->rast;
+   struct lp_scene *scene = task->scene;
+   unsigned num_tasks = MAX2(1, rast->num_threads);
+   unsigned index;
+
+   if (!take_bin(&task->bins, FALSE, &index)) {
+      /* Ranges never grow, skip the ones found empty once */
+      for (; *victim < num_tasks - 1; (*victim)++) {
+         struct lp_rasterizer_task *other =
+            &rast->tasks[task->steal_order[*victim]];
+
+         if (take_bin(&other->bins, TRUE, &index))
+            break;
+      }
+      if (*victim == num_tasks - 1)
+         return NULL;
+   }
+
+   *x = index % scene->tiles_x;
+   *y = index / scene->tiles_x;
+   return lp_scene_get_bin(scene, *x, *y);
+}
+
+
 /**
  * Rasterize/execute all bins within a scene.
  * Called per thread.
@@ -679,10 +785,11 @@ rasterize_scene(struct lp_rasterizer_task *task,
       /* loop over scene bins, rasterize each */
       {
          struct cmd_bin *bin;
+         unsigned victim = 0;
          int i, j;
 
          assert(scene);
-         while ((bin = lp_scene_bin_iter_next(scene, &i, &j))) {
+         while ((bin = next_bin(task, &victim, &i, &j))) {
             if (!is_empty_bin( bin ))
                rasterize_bin(task, bin, i, j);
          }
@@ -704,10 +811,6 @@ rasterize_scene(struct lp_rasterizer_task *task,
    }
 #endif
 
-   if (scene->fence) {
-      lp_fence_signal(scene->fence);
-   }
-
    task->scene = NULL;
 }
 
@@ -737,8 +840,6 @@ lp_rast_queue_scene( struct lp_rasterizer *rast,
       lp_rast_end( rast );
 
       util_fpstate_set(fpstate);
-
-      rast->curr_scene = NULL;
    }
    else {
       /* threaded rendering! */
@@ -756,23 +857,6 @@ lp_rast_queue_scene( struct lp_rasterizer *rast,
 }
 
 
-void
-lp_rast_finish( struct lp_rasterizer *rast )
-{
-   if (rast->num_threads == 0) {
-      /* nothing to do */
-   }
-   else {
-      int i;
-
-      /* wait for work to complete */
-      for (i = 0; i < rast->num_threads; i++) {
-         pipe_semaphore_wait(&rast->tasks[i].work_done);
-      }
-   }
-}
-
-
 /**
  * This is the thread's main entrypoint.
  * It's a simple loop:
@@ -831,17 +915,16 @@ thread_function(void *init_data)
       /* wait for all threads to finish with this scene */
       util_barrier_wait( &rast->barrier );
 
-      /* XXX: shouldn't be necessary:
+      /* thread[0]:
+       *  - unmap the framebuffer surfaces
+       *  - signal the scene's fence
        */
       if (task->thread_index == 0) {
          lp_rast_end( rast );
       }
 
-      /* signal done with work */
       if (debug)
          debug_printf("thread %d done working\n", task->thread_index);
-
-      pipe_semaphore_signal(&task->work_done);
    }
 
 #ifdef _WIN32
@@ -852,6 +935,147 @@ thread_function(void *init_data)
 }
 
 
+#if defined(HAVE_PTHREAD_SETAFFINITY) && defined(PIPE_OS_LINUX)
+
+/**
+ * Return the NUMA node of a CPU, or -1 if unknown.
+ */
+static int
+cpu_numa_node(unsigned cpu)
+{
+   char path[64];
+   DIR *dir;
+   struct dirent *entry;
+   int node = -1;
+
+   util_snprintf(path, sizeof path, "/sys/devices/system/cpu/cpu%u", cpu);
+   dir = opendir(path);
+   if (!dir)
+      return -1;
+
+   while ((entry = readdir(dir))) {
+      if (strncmp(entry->d_name, "node", 4) == 0 &&
+          isdigit(entry->d_name[4])) {
+         node = atoi(entry->d_name + 4);
+         break;
+      }
+   }
+
+   closedir(dir);
+   return node;
+}
+
+
+struct lp_cpu
+{
+   unsigned cpu;
+   int node;
+};
+
+
+static int
+compare_cpus(const void *a, const void *b)
+{
+   const struct lp_cpu *ca = (const struct lp_cpu *) a;
+   const struct lp_cpu *cb = (const struct lp_cpu *) b;
+
+   if (ca->node != cb->node)
+      return ca->node - cb->node;
+   return (int)ca->cpu - (int)cb->cpu;
+}
+
+
+/**
+ * Pin each thread to one of the CPUs we may run on, so that threads with
+ * consecutive indices, and hence neighbouring bin ranges, share a NUMA
+ * node.  As the framebuffer is mostly written by the thread rasterizing
+ * the tiles, this tends to keep each range's memory local to its node.
+ */
+static void
+pin_rast_threads(struct lp_rasterizer *rast)
+{
+   struct lp_cpu *cpus;
+   unsigned num_cpus = 0;
+   cpu_set_t allowed;
+   unsigned i;
+
+   if (sched_getaffinity(0, sizeof allowed, &allowed) != 0)
+      return;
+
+   cpus = MALLOC(CPU_COUNT(&allowed) * sizeof *cpus);
+   if (!cpus)
+      return;
+
+   for (i = 0; i < CPU_SETSIZE && num_cpus < CPU_COUNT(&allowed); i++) {
+      if (CPU_ISSET(i, &allowed)) {
+         cpus[num_cpus].cpu = i;
+         cpus[num_cpus].node = cpu_numa_node(i);
+         num_cpus++;
+      }
+   }
+
+   qsort(cpus, num_cpus, sizeof *cpus, compare_cpus);
+
+   for (i = 0; i < rast->num_threads; i++) {
+      const struct lp_cpu *cpu = &cpus[i % num_cpus];
+      cpu_set_t cpuset;
+
+      CPU_ZERO(&cpuset);
+      CPU_SET(cpu->cpu, &cpuset);
+      if (pthread_setaffinity_np(rast->threads[i], sizeof cpuset,
+                                 &cpuset) == 0)
+         rast->tasks[i].numa_node = cpu->node;
+   }
+
+   FREE(cpus);
+}
+
+#else
+
+static void
+pin_rast_threads(struct lp_rasterizer *rast)
+{
+}
+
+#endif
+
+
+/**
+ * Compute the order in which each thread steals bins from the others:
+ * threads on the same NUMA node first, then the rest, each time starting
+ * from the thread with the next index.
+ */
+static void
+init_steal_order(struct lp_rasterizer *rast)
+{
+   unsigned num_tasks = MAX2(1, rast->num_threads);
+   unsigned i, j;
+
+   for (i = 0; i < num_tasks; i++) {
+      struct lp_rasterizer_task *task = &rast->tasks[i];
+      unsigned n = 0;
+
+      for (j = 1; j < num_tasks; j++) {
+         const struct lp_rasterizer_task *other =
+            &rast->tasks[(i + j) % num_tasks];
+
+         if (task->numa_node >= 0 && other->numa_node == task->numa_node)
+            task->steal_order[n++] = other->thread_index;
+      }
+
+      for (j = 1; j < num_tasks; j++) {
+         const struct lp_rasterizer_task *other =
+            &rast->tasks[(i + j) % num_tasks];
+
+         if (task->numa_node < 0 || other->numa_node != task->numa_node)
+            task->steal_order[n++] = other->thread_index;
+      }
+
+      assert(n == num_tasks - 1);
+   }
+}
+
+
 /**
  * Initialize semaphores and spawn the threads.
  */
@@ -867,6 +1091,11 @@ create_rast_threads(struct lp_rasterizer *rast)
       rast->threads[i] = u_thread_create(thread_function,
                                             (void *) &rast->tasks[i]);
    }
+
+   if (rast->pin_threads && rast->num_threads > 0)
+      pin_rast_threads(rast);
+
+   init_steal_order(rast);
 }
 
 
@@ -896,6 +1125,7 @@ lp_rast_create( unsigned num_threads )
       struct lp_rasterizer_task *task = &rast->tasks[i];
       task->rast = rast;
       task->thread_index = i;
+      task->numa_node = -1;
       task->thread_data.cache = align_malloc(sizeof(struct lp_build_format_cache),
                                              16);
       if (!task->thread_data.cache) {
@@ -906,6 +1136,7 @@ lp_rast_create( unsigned num_threads )
    rast->num_threads = num_threads;
 
    rast->no_rast = debug_get_bool_option("LP_NO_RAST", FALSE);
+   rast->pin_threads = debug_get_bool_option("LP_PIN_THREADS", FALSE);
 
    create_rast_threads(rast);
 
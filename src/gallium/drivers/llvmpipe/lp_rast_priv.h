@@ -28,6 +28,7 @@
 #ifndef LP_RAST_PRIV_H
 #define LP_RAST_PRIV_H
 
+#include "util/u_atomic.h"
 #include "util/u_format.h"
 #include "util/u_thread.h"
 #include "gallivm/lp_bld_debug.h"
@@ -102,6 +103,19 @@ struct lp_rasterizer_task
 
    pipe_semaphore work_ready;
    pipe_semaphore work_done;
+
+   /**
+    * The bins of the current scene left to this thread, indices [head, tail)
+    * packed as tail << 32 | head.  The thread takes bins from the head,
+    * other threads out of work steal them from the tail.
+    */
+   uint64_t bins;
+
+   /** Other threads to steal bins from, closest (same NUMA node) first */
+   unsigned steal_order[LP_MAX_THREADS];
+
+   /** NUMA node of the CPU the thread is pinned to, or -1 */
+   int numa_node;
 };
 
 
@@ -129,6 +143,9 @@ struct lp_rasterizer
 
    /** For synchronizing the rasterization threads */
    util_barrier barrier;
+
+   /** Pin the threads to CPUs, grouped by NUMA node (LP_PIN_THREADS) */
+   boolean pin_threads;
 };
 
 
@@ -228,6 +245,7 @@ lp_rast_shade_quads_all( struct lp_rasterizer_task *task,
    const struct lp_scene *scene = task->scene;
    const struct lp_rast_state *state = task->state;
    struct lp_fragment_shader_variant *variant = state->variant;
+   lp_jit_frag_func jit_function;
    uint8_t *color[PIPE_MAX_COLOR_BUFS];
    unsigned stride[PIPE_MAX_COLOR_BUFS];
    uint8_t *depth = NULL;
@@ -262,18 +280,19 @@ lp_rast_shade_quads_all( struct lp_rasterizer_task *task,
 
       /* run shader on 4x4 block */
       BEGIN_JIT_CALL(state, task);
-      variant->jit_function[RAST_WHOLE]( &state->jit_context,
-                                         x, y,
-                                         inputs->frontfacing,
-                                         GET_A0(inputs),
-                                         GET_DADX(inputs),
-                                         GET_DADY(inputs),
-                                         color,
-                                         depth,
-                                         0xffff,
-                                         &task->thread_data,
-                                         stride,
-                                         depth_stride);
+      jit_function = p_atomic_read(&variant->jit_function[RAST_WHOLE]);
+      jit_function( &state->jit_context,
+                    x, y,
+                    inputs->frontfacing,
+                    GET_A0(inputs),
+                    GET_DADX(inputs),
+                    GET_DADY(inputs),
+                    color,
+                    depth,
+                    0xffff,
+                    &task->thread_data,
+                    stride,
+                    depth_stride);
       END_JIT_CALL();
    }
 }
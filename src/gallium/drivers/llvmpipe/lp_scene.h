@@ -129,11 +129,16 @@ struct lp_scene {
    struct pipe_context *pipe;
    struct lp_fence *fence;
 
+   /** next scene in the rasterizer's queue */
+   struct lp_scene *next_queued;
+
    /* The queries still active at end of scene */
    struct llvmpipe_query *active_queries[LP_MAX_ACTIVE_BINNED_QUERIES];
    unsigned num_active_queries;
    /* If queries were either active or there were begin/end query commands */
    boolean had_queries;
+   /* If fragment shaders with stores or atomics were bound */
+   boolean had_side_effects;
 
    /* Framebuffer mappings - valid only between begin_rasterization()
     * and end_rasterization().
@@ -154,6 +159,9 @@ struct lp_scene {
    /** list of resources referenced by the scene commands */
    struct resource_ref *resources;
 
+   /** list of resources written by the scene's shaders */
+   struct resource_ref *writeable_resources;
+
    /** Total memory used by the scene (in bytes).  This sums all the
     * data blocks and counts all bins, state, resource references and
     * other random allocations within the scene.
@@ -172,9 +180,6 @@ struct lp_scene {
     */
    unsigned tiles_x, tiles_y;
 
-   int curr_x, curr_y;  /**< for iterating over bins */
-   mtx_t mutex;
-
    struct cmd_bin tile[TILES_X][TILES_Y];
    struct data_block_list data;
 };
@@ -196,10 +201,11 @@ struct cmd_block *lp_scene_new_cmd_block( struct lp_scene *scene,
 
 boolean lp_scene_add_resource_reference(struct lp_scene *scene,
                                         struct pipe_resource *resource,
-                                        boolean initializing_scene);
+                                        boolean initializing_scene,
+                                        boolean writeable);
 
-boolean lp_scene_is_resource_referenced(const struct lp_scene *scene,
-                                        const struct pipe_resource *resource );
+unsigned lp_scene_is_resource_referenced(const struct lp_scene *scene,
+                                         const struct pipe_resource *resource );
 
 
 /**
@@ -377,14 +383,6 @@ lp_scene_get_num_bins( const struct lp_scene *scene )
 }
 
 
-void
-lp_scene_bin_iter_begin( struct lp_scene *scene );
-
-struct cmd_bin *
-lp_scene_bin_iter_next( struct lp_scene *scene, int *x, int *y );
-
-
-
 /* Begin/end binning of a scene
  */
 void
@@ -403,6 +401,9 @@ lp_scene_begin_rasterization(struct lp_scene *scene);
 void
 lp_scene_end_rasterization(struct lp_scene *scene);
 
+void
+lp_scene_reset(struct lp_scene *scene);
+
 
 
 
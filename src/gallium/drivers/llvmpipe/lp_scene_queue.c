@@ -27,30 +27,30 @@
 
 
 /**
- * Scene queue.  We'll use two queues.  One contains "full" scenes which
- * are produced by the "setup" code.  The other contains "empty" scenes
- * which are produced by the "rast" code when it finishes rendering a scene.
+ * Scene queue.  Contains the "full" scenes which are produced by the
+ * "setup" code, in the order they're to be rasterized.
+ *
+ * The scenes are linked through lp_scene::next_queued, so that queueing
+ * never blocks: setup does it with the screen's rast_mutex held, and any
+ * number of contexts may have scenes in flight.
  */
 
-#include "util/u_ringbuffer.h"
+#include "os/os_thread.h"
 #include "util/u_memory.h"
+#include "lp_scene.h"
 #include "lp_scene_queue.h"
 
 
 
-#define MAX_SCENE_QUEUE 4
-
-struct scene_packet {
-   struct util_packet header;
-   struct lp_scene *scene;
-};
-
 /**
  * A queue of scenes
  */
 struct lp_scene_queue
 {
-   struct util_ringbuffer *ring;
+   mtx_t mutex;
+   cnd_t change;
+   struct lp_scene *head;
+   struct lp_scene *tail;
 };
 
 
@@ -63,16 +63,10 @@ lp_scene_queue_create(void)
    if (!queue)
       return NULL;
 
-   queue->ring = util_ringbuffer_create( MAX_SCENE_QUEUE * 
-                                         sizeof( struct scene_packet ) / 4);
-   if (queue->ring == NULL)
-      goto fail;
+   (void) mtx_init(&queue->mutex, mtx_plain);
+   cnd_init(&queue->change);
 
    return queue;
-
-fail:
-   FREE(queue);
-   return NULL;
 }
 
 
@@ -80,7 +74,8 @@ fail:
 void
 lp_scene_queue_destroy(struct lp_scene_queue *queue)
 {
-   util_ringbuffer_destroy(queue->ring);
+   cnd_destroy(&queue->change);
+   mtx_destroy(&queue->mutex);
    FREE(queue);
 }
 
@@ -89,19 +84,26 @@ lp_scene_queue_destroy(struct lp_scene_queue *queue)
 struct lp_scene *
 lp_scene_dequeue(struct lp_scene_queue *queue, boolean wait)
 {
-   struct scene_packet packet;
-   enum pipe_error ret;
+   struct lp_scene *scene;
 
-   packet.scene = NULL;
+   mtx_lock(&queue->mutex);
 
-   ret = util_ringbuffer_dequeue(queue->ring,
-                                 &packet.header,
-                                 sizeof packet / 4,
-                                 wait );
-   if (ret != PIPE_OK)
-      return NULL;
+   if (wait) {
+      while (!queue->head)
+         cnd_wait(&queue->change, &queue->mutex);
+   }
 
-   return packet.scene;
+   scene = queue->head;
+   if (scene) {
+      queue->head = scene->next_queued;
+      if (!queue->head)
+         queue->tail = NULL;
+      scene->next_queued = NULL;
+   }
+
+   mtx_unlock(&queue->mutex);
+
+   return scene;
 }
 
 
@@ -109,16 +111,16 @@ lp_scene_dequeue(struct lp_scene_queue *queue, boolean wait)
 void
 lp_scene_enqueue(struct lp_scene_queue *queue, struct lp_scene *scene)
 {
-   struct scene_packet packet;
-
-   packet.header.dwords = sizeof packet / 4;
-   packet.header.data24 = 0;
-   packet.scene = scene;
-
-   util_ringbuffer_enqueue(queue->ring, &packet.header);
-}
-
-
+   assert(!scene->next_queued);
 
+   mtx_lock(&queue->mutex);
 
+   if (queue->tail)
+      queue->tail->next_queued = scene;
+   else
+      queue->head = scene;
+   queue->tail = scene;
 
+   cnd_signal(&queue->change);
+   mtx_unlock(&queue->mutex);
+}
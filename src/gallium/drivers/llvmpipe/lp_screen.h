@@ -37,10 +37,12 @@
 #include "pipe/p_screen.h"
 #include "pipe/p_defines.h"
 #include "os/os_thread.h"
+#include "util/u_queue.h"
 #include "gallivm/lp_bld.h"
 
 
 struct sw_winsys;
+struct disk_cache;
 
 
 struct llvmpipe_screen
@@ -57,6 +59,16 @@ struct llvmpipe_screen
 
    struct lp_rasterizer *rast;
    mtx_t rast_mutex;
+
+   /** Worker threads running compute shader work groups */
+   struct util_queue cs_queue;
+
+   /** Threads compiling the optimized code of fragment shader variants */
+   unsigned num_compile_threads;
+   struct util_queue compile_queue;
+
+   /** Disk cache, also holding the machine code of JIT'd shader variants */
+   struct disk_cache *disk_shader_cache;
 };
 
 
@@ -64,26 +64,66 @@ static boolean set_scene_state( struct lp_setup_context *, enum setup_state,
 static boolean try_update_scene_state( struct lp_setup_context *setup );
 
 
+/**
+ * Pick a scene to bin into: an idle one if there is any, otherwise a newly
+ * allocated one as long as we're below max_scenes, otherwise the oldest
+ * scene still being rasterized, once it's done.
+ *
+ * A scene keeps its fence, data and resource references from the time it's
+ * queued for rasterization until it's picked again here.
+ */
 static void
 lp_setup_get_empty_scene(struct lp_setup_context *setup)
 {
+   struct lp_scene *scene = NULL;
+   unsigned i;
+
    assert(setup->scene == NULL);
 
-   setup->scene_idx++;
-   setup->scene_idx %= ARRAY_SIZE(setup->scenes);
+   for (i = 0; i < setup->num_scenes; i++) {
+      struct lp_fence *fence = setup->scenes[i]->fence;
+
+      if (!fence || lp_fence_signalled(fence)) {
+         scene = setup->scenes[i];
+         break;
+      }
+   }
 
-   setup->scene = setup->scenes[setup->scene_idx];
+   if (!scene && setup->num_scenes < setup->max_scenes) {
+      scene = lp_scene_create(setup->pipe);
+      if (scene) {
+         LP_DBG(DEBUG_SETUP, "%s: new scene %u\n",
+                __FUNCTION__, setup->num_scenes);
+         setup->scenes[setup->num_scenes++] = scene;
+      }
+   }
+
+   if (!scene) {
+      /* All the scenes are in flight.  They're rasterized in the order
+       * they were queued, so the one with the oldest fence finishes first.
+       */
+      scene = setup->scenes[0];
+      for (i = 1; i < setup->num_scenes; i++) {
+         if (setup->scenes[i]->fence->id < scene->fence->id)
+            scene = setup->scenes[i];
+      }
 
-   if (setup->scene->fence) {
       if (LP_DEBUG & DEBUG_SETUP)
          debug_printf("%s: wait for scene %d\n",
-                      __FUNCTION__, setup->scene->fence->id);
+                      __FUNCTION__, scene->fence->id);
+   }
 
-      lp_fence_wait(setup->scene->fence);
+   if (scene->fence) {
+      /* Also orders the rasterizer's last accesses to the scene before
+       * the reset, when the fence was seen signalled above.
+       */
+      lp_fence_wait(scene->fence);
+      lp_scene_reset(scene);
    }
 
-   lp_scene_begin_binning(setup->scene, &setup->fb);
+   setup->scene = scene;
 
+   lp_scene_begin_binning(setup->scene, &setup->fb);
 }
 
 
@@ -165,23 +205,14 @@ lp_setup_rasterize_scene( struct lp_setup_context *setup )
    if (setup->last_fence)
       setup->last_fence->issued = TRUE;
 
-   mtx_lock(&screen->rast_mutex);
-
-   /* FIXME: We enqueue the scene then wait on the rasterizer to finish.
-    * This means we never actually run any vertex stuff in parallel to
-    * rasterization (not in the same context at least) which is what the
-    * multiple scenes per setup is about - when we get a new empty scene
-    * any old one is already empty again because we waited here for
-    * raster tasks to be finished. Ideally, we shouldn't need to wait here
-    * and rely on fences elsewhere when waiting is necessary.
-    * Certainly, lp_scene_end_rasterization() would need to be deferred too
-    * and there's probably other bits why this doesn't actually work.
+   /* Don't wait for the rasterizer: binning of the next scene proceeds
+    * while this one is rasterized, anything which needs the results waits
+    * on the scene's fence.
     */
+   mtx_lock(&screen->rast_mutex);
    lp_rast_queue_scene(screen->rast, scene);
-   lp_rast_finish(screen->rast);
    mtx_unlock(&screen->rast_mutex);
 
-   lp_scene_end_rasterization(setup->scene);
    lp_setup_reset( setup );
 
    LP_DBG(DEBUG_SETUP, "%s done \n", __FUNCTION__);
@@ -199,9 +230,10 @@ begin_binning( struct lp_setup_context *setup )
    assert(scene);
    assert(scene->fence == NULL);
 
-   /* Always create a fence:
+   /* Always create a fence, the rasterizer signals it once done with the
+    * scene:
     */
-   scene->fence = lp_fence_create(MAX2(1, setup->num_threads));
+   scene->fence = lp_fence_create(1);
    if (!scene->fence)
       return FALSE;
 
@@ -342,7 +374,7 @@ set_scene_state( struct lp_setup_context *setup,
 
 fail:
    if (setup->scene) {
-      lp_scene_end_rasterization(setup->scene);
+      lp_scene_reset(setup->scene);
       setup->scene = NULL;
    }
 
@@ -663,6 +695,74 @@ lp_setup_set_fs_constants(struct lp_setup_context *setup,
 }
 
 
+/**
+ * Called during state validation when LP_NEW_FS_SSBOS is set.
+ *
+ * Unlike constants, shader buffers aren't copied into the scene, as the
+ * shaders may write to them.
+ */
+void
+lp_setup_set_fs_ssbos(struct lp_setup_context *setup,
+                      unsigned num,
+                      struct pipe_shader_buffer *buffers)
+{
+   unsigned i;
+
+   LP_DBG(DEBUG_SETUP, "%s %p\n", __FUNCTION__, (void *) buffers);
+
+   assert(num <= ARRAY_SIZE(setup->fs.current_ssbos));
+
+   for (i = 0; i < ARRAY_SIZE(setup->fs.current_ssbos); ++i) {
+      struct pipe_resource *buffer = i < num ? buffers[i].buffer : NULL;
+
+      pipe_resource_reference(&setup->fs.current_ssbos[i], buffer);
+
+      if (buffer) {
+         setup->fs.current.jit_context.ssbos[i] = (const uint32_t *)
+            ((const ubyte *) llvmpipe_resource_data(buffer) +
+             buffers[i].buffer_offset);
+         setup->fs.current.jit_context.num_ssbos[i] = buffers[i].buffer_size;
+      }
+      else {
+         setup->fs.current.jit_context.ssbos[i] = NULL;
+         setup->fs.current.jit_context.num_ssbos[i] = 0;
+      }
+   }
+   setup->dirty |= LP_SETUP_NEW_FS;
+}
+
+
+/**
+ * Called during state validation when LP_NEW_FS_IMAGES is set.
+ */
+void
+lp_setup_set_fs_images(struct lp_setup_context *setup,
+                       unsigned num,
+                       struct pipe_image_view *images)
+{
+   unsigned i;
+
+   LP_DBG(DEBUG_SETUP, "%s %p\n", __FUNCTION__, (void *) images);
+
+   assert(num <= ARRAY_SIZE(setup->fs.current_images));
+
+   for (i = 0; i < ARRAY_SIZE(setup->fs.current_images); ++i) {
+      struct pipe_image_view *image = i < num ? &images[i] : NULL;
+      struct lp_jit_image *jit_image = &setup->fs.current.jit_context.images[i];
+
+      if (image && image->resource) {
+         pipe_resource_reference(&setup->fs.current_images[i], image->resource);
+         lp_jit_image_from_view(jit_image, image);
+      }
+      else {
+         pipe_resource_reference(&setup->fs.current_images[i], NULL);
+         memset(jit_image, 0, sizeof *jit_image);
+      }
+   }
+   setup->dirty |= LP_SETUP_NEW_FS;
+}
+
+
 void
 lp_setup_set_alpha_ref_value( struct lp_setup_context *setup,
                               float alpha_ref_value )
@@ -983,11 +1083,21 @@ lp_setup_is_resource_referenced( const struct lp_setup_context *setup,
       return LP_REFERENCED_FOR_READ | LP_REFERENCED_FOR_WRITE;
    }
 
-   /* check textures referenced by the scene */
-   for (i = 0; i < ARRAY_SIZE(setup->scenes); i++) {
-      if (lp_scene_is_resource_referenced(setup->scenes[i], texture)) {
-         return LP_REFERENCED_FOR_READ;
-      }
+   /* check the scenes, including those queued for rasterization */
+   for (i = 0; i < setup->num_scenes; i++) {
+      struct lp_scene *scene = setup->scenes[i];
+      unsigned referenced;
+
+      /* Idle scenes only drop their references once they're reused, but
+       * the rasterizer is done with them when their fence has signalled.
+       */
+      if (scene != setup->scene &&
+          (!scene->fence || lp_fence_signalled(scene->fence)))
+         continue;
+
+      referenced = lp_scene_is_resource_referenced(scene, texture);
+      if (referenced)
+         return referenced;
    }
 
    return LP_UNREFERENCED;
@@ -1164,12 +1274,41 @@ try_update_scene_state( struct lp_setup_context *setup )
             if (setup->fs.current_tex[i]) {
                if (!lp_scene_add_resource_reference(scene,
                                                     setup->fs.current_tex[i],
-                                                    new_scene)) {
+                                                    new_scene, FALSE)) {
                   assert(!new_scene);
                   return FALSE;
                }
             }
          }
+
+         /* Shader buffers and images may be written by the shader, so
+          * mapping them must wait for the scene.
+          */
+         for (i = 0; i < ARRAY_SIZE(setup->fs.current_ssbos); i++) {
+            if (setup->fs.current_ssbos[i]) {
+               if (!lp_scene_add_resource_reference(scene,
+                                                    setup->fs.current_ssbos[i],
+                                                    new_scene, TRUE)) {
+                  assert(!new_scene);
+                  return FALSE;
+               }
+            }
+         }
+
+         for (i = 0; i < ARRAY_SIZE(setup->fs.current_images); i++) {
+            if (setup->fs.current_images[i]) {
+               if (!lp_scene_add_resource_reference(scene,
+                                                    setup->fs.current_images[i],
+                                                    new_scene, TRUE)) {
+                  assert(!new_scene);
+                  return FALSE;
+               }
+            }
+         }
+
+         if (setup->fs.current.variant &&
+             setup->fs.current.variant->shader->info.base.writes_memory)
+            scene->had_side_effects = TRUE;
       }
    }
 
@@ -1281,16 +1420,26 @@ lp_setup_destroy( struct lp_setup_context *setup )
       pipe_resource_reference(&setup->fs.current_tex[i], NULL);
    }
 
+   for (i = 0; i < ARRAY_SIZE(setup->fs.current_ssbos); i++) {
+      pipe_resource_reference(&setup->fs.current_ssbos[i], NULL);
+   }
+
+   for (i = 0; i < ARRAY_SIZE(setup->fs.current_images); i++) {
+      pipe_resource_reference(&setup->fs.current_images[i], NULL);
+   }
+
    for (i = 0; i < ARRAY_SIZE(setup->constants); i++) {
       pipe_resource_reference(&setup->constants[i].current.buffer, NULL);
    }
 
-   /* free the scenes in the 'empty' queue */
-   for (i = 0; i < ARRAY_SIZE(setup->scenes); i++) {
+   /* wait for the scenes still being rasterized and free them all */
+   for (i = 0; i < setup->num_scenes; i++) {
       struct lp_scene *scene = setup->scenes[i];
 
-      if (scene->fence)
+      if (scene->fence) {
          lp_fence_wait(scene->fence);
+         lp_scene_reset(scene);
+      }
 
       lp_scene_destroy(scene);
    }
@@ -1310,9 +1459,7 @@ struct lp_setup_context *
 lp_setup_create( struct pipe_context *pipe,
                  struct draw_context *draw )
 {
-   struct llvmpipe_screen *screen = llvmpipe_screen(pipe->screen);
    struct lp_setup_context *setup;
-   unsigned i;
 
    setup = CALLOC_STRUCT(lp_setup_context);
    if (!setup) {
@@ -1326,7 +1473,10 @@ lp_setup_create( struct pipe_context *pipe,
    setup->pipe = pipe;
 
 
-   setup->num_threads = screen->num_threads;
+   /* LP_MAX_SCENES=1 serializes binning and rasterization */
+   setup->max_scenes = debug_get_num_option("LP_MAX_SCENES", MAX_SCENES);
+   setup->max_scenes = CLAMP(setup->max_scenes, 1, MAX_SCENES);
+
    setup->vbuf = draw_vbuf_stage(draw, &setup->base);
    if (!setup->vbuf) {
       goto no_vbuf;
@@ -1335,13 +1485,12 @@ lp_setup_create( struct pipe_context *pipe,
    draw_set_rasterize_stage(draw, setup->vbuf);
    draw_set_render(draw, &setup->base);
 
-   /* create some empty scenes */
-   for (i = 0; i < MAX_SCENES; i++) {
-      setup->scenes[i] = lp_scene_create( pipe );
-      if (!setup->scenes[i]) {
-         goto no_scenes;
-      }
+   /* create an empty scene, more are allocated as needed */
+   setup->scenes[0] = lp_scene_create( pipe );
+   if (!setup->scenes[0]) {
+      goto no_scenes;
    }
+   setup->num_scenes = 1;
 
    setup->triangle = first_triangle;
    setup->line     = first_line;
@@ -1356,12 +1505,6 @@ lp_setup_create( struct pipe_context *pipe,
    return setup;
 
 no_scenes:
-   for (i = 0; i < MAX_SCENES; i++) {
-      if (setup->scenes[i]) {
-         lp_scene_destroy(setup->scenes[i]);
-      }
-   }
-
    setup->vbuf->destroy(setup->vbuf);
 no_vbuf:
    FREE(setup);
@@ -54,9 +54,8 @@
 struct lp_setup_variant;
 
 
-/** Max number of scenes */
-/* XXX: make multiple scenes per context work, see lp_setup_rasterize_scene */
-#define MAX_SCENES 1
+/** Max number of scenes per context, binned or being rasterized */
+#define MAX_SCENES 4
 
 
 
@@ -86,8 +85,8 @@ struct lp_setup_context
     * create/install this itself now.
     */
    struct draw_stage *vbuf;
-   unsigned num_threads;
-   unsigned scene_idx;
+   unsigned num_scenes;                  /**< scenes allocated so far */
+   unsigned max_scenes;                  /**< at most MAX_SCENES */
    struct lp_scene *scenes[MAX_SCENES];  /**< all the scenes */
    struct lp_scene *scene;               /**< current scene being built */
 
@@ -134,6 +133,8 @@ struct lp_setup_context
       struct lp_rast_state current;  /**< currently set state */
       struct pipe_resource *current_tex[PIPE_MAX_SHADER_SAMPLER_VIEWS];
       unsigned current_tex_num;
+      struct pipe_resource *current_ssbos[LP_MAX_TGSI_SHADER_BUFFERS];
+      struct pipe_resource *current_images[LP_MAX_TGSI_SHADER_IMAGES];
    } fs;
 
    /** fragment shader constants */
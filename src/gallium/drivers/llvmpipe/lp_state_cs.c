@@ -0,0 +1,997 @@
+/**************************************************************************
+ *
+ * Copyright 2019 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/**
+ * @file
+ * Compute shaders.
+ *
+ * A compute shader variant is a function running one work group.  The
+ * work group is split in SIMD vectors of invocations, each run by a
+ * separate function.  When the shader has barriers, that function is a
+ * coroutine, which suspends at each barrier: all the vectors are started
+ * and then resumed in turn until they are done.
+ *
+ * Work groups are spread over the screen's compute thread queue.
+ */
+
+#include "pipe/p_defines.h"
+#include "util/u_inlines.h"
+#include "util/u_memory.h"
+#include "util/u_math.h"
+#include "util/u_format.h"
+#include "util/u_string.h"
+#include "util/u_atomic.h"
+#include "util/simple_list.h"
+#include "util/os_time.h"
+#include "pipe/p_shader_tokens.h"
+#include "tgsi/tgsi_dump.h"
+#include "tgsi/tgsi_parse.h"
+#include "gallivm/lp_bld_const.h"
+#include "gallivm/lp_bld_coro.h"
+#include "gallivm/lp_bld_debug.h"
+#include "gallivm/lp_bld_flow.h"
+#include "gallivm/lp_bld_init.h"
+#include "gallivm/lp_bld_intr.h"
+#include "gallivm/lp_bld_logic.h"
+#include "gallivm/lp_bld_arit.h"
+#include "gallivm/lp_bld_tgsi.h"
+#include "lp_context.h"
+#include "lp_debug.h"
+#include "lp_flush.h"
+#include "lp_limits.h"
+#include "lp_perf.h"
+#include "lp_screen.h"
+#include "lp_state.h"
+#include "lp_state_cs.h"
+#include "lp_tex_sample.h"
+#include "lp_texture.h"
+
+
+/** shader counter (for debugging) */
+static unsigned cs_no = 0;
+
+
+/**
+ * Generate the compute shader function for the given variant.
+ */
+static void
+generate_compute(struct llvmpipe_context *lp,
+                 struct lp_compute_shader *shader,
+                 struct lp_compute_shader_variant *variant)
+{
+   struct gallivm_state *gallivm = variant->gallivm;
+   const struct lp_compute_shader_variant_key *key = &variant->key;
+   char func_name[64], func_name_coro[64];
+   LLVMTypeRef arg_types[11];
+   LLVMTypeRef coro_arg_types[12];
+   LLVMTypeRef func_type, coro_func_type;
+   LLVMTypeRef int32_type = LLVMInt32TypeInContext(gallivm->context);
+   LLVMTypeRef hdl_type = LLVMPointerType(LLVMInt8TypeInContext(gallivm->context), 0);
+   LLVMValueRef context_ptr;
+   LLVMValueRef x, y, z;
+   LLVMValueRef grid_x, grid_y, grid_z;
+   LLVMValueRef block_x, block_y, block_z;
+   LLVMValueRef thread_data_ptr;
+   LLVMValueRef num_threads, num_vecs;
+   LLVMValueRef coro_args[12];
+   LLVMValueRef function, coro;
+   LLVMBasicBlockRef block;
+   LLVMBuilderRef builder;
+   struct lp_type cs_type;
+   struct lp_build_loop_state loop_state;
+   boolean use_coro;
+   unsigned i;
+
+   use_coro = shader->info.base.opcode_count[TGSI_OPCODE_BARRIER] > 0;
+   assert(!use_coro || LP_HAVE_CORO);
+
+   memset(&cs_type, 0, sizeof cs_type);
+   cs_type.floating = TRUE;      /* floating point values */
+   cs_type.sign = TRUE;          /* values are signed */
+   cs_type.norm = FALSE;         /* values are not limited to [0,1] or [-1,1] */
+   cs_type.width = 32;           /* 32-bit float */
+   cs_type.length = MIN2(lp_native_vector_width / 32, 16); /* n*4 elements per vector */
+
+   util_snprintf(func_name, sizeof(func_name), "cs%u_variant%u",
+                 shader->no, variant->no);
+   util_snprintf(func_name_coro, sizeof(func_name_coro), "cs%u_variant%u_coro",
+                 shader->no, variant->no);
+
+   /*
+    * Generate the function prototypes. Any change here must be reflected in
+    * lp_jit.h's lp_jit_cs_func function pointer type, and vice-versa.
+    */
+   arg_types[0] = variant->jit_cs_context_ptr_type;       /* context */
+   arg_types[1] = int32_type;                             /* block_x */
+   arg_types[2] = int32_type;                             /* block_y */
+   arg_types[3] = int32_type;                             /* block_z */
+   arg_types[4] = int32_type;                             /* grid_x */
+   arg_types[5] = int32_type;                             /* grid_y */
+   arg_types[6] = int32_type;                             /* grid_z */
+   arg_types[7] = int32_type;                             /* block_size_x */
+   arg_types[8] = int32_type;                             /* block_size_y */
+   arg_types[9] = int32_type;                             /* block_size_z */
+   arg_types[10] = variant->jit_cs_thread_data_ptr_type;  /* per thread data */
+
+   /* The per vector function also gets the index of the vector. */
+   for (i = 0; i < 10; i++)
+      coro_arg_types[i] = arg_types[i];
+   coro_arg_types[10] = int32_type;                       /* vec index */
+   coro_arg_types[11] = arg_types[10];
+
+   func_type = LLVMFunctionType(LLVMVoidTypeInContext(gallivm->context),
+                                arg_types, ARRAY_SIZE(arg_types), 0);
+
+   coro_func_type = LLVMFunctionType(use_coro ? hdl_type :
+                                     LLVMVoidTypeInContext(gallivm->context),
+                                     coro_arg_types, ARRAY_SIZE(coro_arg_types), 0);
+
+   function = LLVMAddFunction(gallivm->module, func_name, func_type);
+   LLVMSetFunctionCallConv(function, LLVMCCallConv);
+
+   coro = LLVMAddFunction(gallivm->module, func_name_coro, coro_func_type);
+   LLVMSetFunctionCallConv(coro, LLVMCCallConv);
+#if LP_HAVE_CORO
+   if (use_coro)
+      LLVMAddTargetDependentFunctionAttr(coro, "coroutine.presplit", "0");
+#endif
+
+   variant->function = function;
+
+   for (i = 0; i < ARRAY_SIZE(arg_types); ++i) {
+      if (LLVMGetTypeKind(arg_types[i]) == LLVMPointerTypeKind) {
+         lp_add_function_attr(function, i + 1, LP_FUNC_ATTR_NOALIAS);
+         lp_add_function_attr(coro, i + 1 + (i == 10), LP_FUNC_ATTR_NOALIAS);
+      }
+   }
+
+   context_ptr  = LLVMGetParam(function, 0);
+   x            = LLVMGetParam(function, 1);
+   y            = LLVMGetParam(function, 2);
+   z            = LLVMGetParam(function, 3);
+   grid_x       = LLVMGetParam(function, 4);
+   grid_y       = LLVMGetParam(function, 5);
+   grid_z       = LLVMGetParam(function, 6);
+   block_x      = LLVMGetParam(function, 7);
+   block_y      = LLVMGetParam(function, 8);
+   block_z      = LLVMGetParam(function, 9);
+   thread_data_ptr  = LLVMGetParam(function, 10);
+
+   lp_build_name(context_ptr, "context");
+   lp_build_name(x, "x");
+   lp_build_name(y, "y");
+   lp_build_name(z, "z");
+   lp_build_name(grid_x, "grid_x");
+   lp_build_name(grid_y, "grid_y");
+   lp_build_name(grid_z, "grid_z");
+   lp_build_name(block_x, "block_x");
+   lp_build_name(block_y, "block_y");
+   lp_build_name(block_z, "block_z");
+   lp_build_name(thread_data_ptr, "thread_data");
+
+   /*
+    * Function body: run each vector of the work group.
+    */
+
+   block = LLVMAppendBasicBlockInContext(gallivm->context, function, "entry");
+   builder = gallivm->builder;
+   assert(builder);
+   LLVMPositionBuilderAtEnd(builder, block);
+
+   num_threads = LLVMBuildMul(builder, block_x, block_y, "");
+   num_threads = LLVMBuildMul(builder, num_threads, block_z, "");
+   num_vecs = LLVMBuildAdd(builder, num_threads,
+                           lp_build_const_int32(gallivm, cs_type.length - 1), "");
+   num_vecs = LLVMBuildUDiv(builder, num_vecs,
+                            lp_build_const_int32(gallivm, cs_type.length), "");
+
+   for (i = 0; i < 10; i++)
+      coro_args[i] = LLVMGetParam(function, i);
+   coro_args[11] = thread_data_ptr;
+
+   if (!use_coro) {
+      lp_build_loop_begin(&loop_state, gallivm, lp_build_const_int32(gallivm, 0));
+      coro_args[10] = loop_state.counter;
+      LLVMBuildCall(builder, coro, coro_args, ARRAY_SIZE(coro_args), "");
+      lp_build_loop_end_cond(&loop_state, num_vecs, NULL, LLVMIntUGE);
+   }
+#if LP_HAVE_CORO
+   else {
+      LLVMBasicBlockRef check_block, resume_block, done_block;
+      LLVMValueRef hdls, hdl_ptr, hdl, done;
+
+      hdls = LLVMBuildArrayAlloca(builder, hdl_type, num_vecs, "coro_hdls");
+
+      /* Start all the vectors, they run up to the first barrier. */
+      lp_build_loop_begin(&loop_state, gallivm, lp_build_const_int32(gallivm, 0));
+      coro_args[10] = loop_state.counter;
+      hdl = LLVMBuildCall(builder, coro, coro_args, ARRAY_SIZE(coro_args), "");
+      hdl_ptr = LLVMBuildGEP(builder, hdls, &loop_state.counter, 1, "");
+      LLVMBuildStore(builder, hdl, hdl_ptr);
+      lp_build_loop_end_cond(&loop_state, num_vecs, NULL, LLVMIntUGE);
+
+      /*
+       * Barriers are in uniform control flow, so all the vectors suspend
+       * at the same barriers and are done at the same time.
+       */
+      check_block = lp_build_insert_new_block(gallivm, "coro_check");
+      resume_block = lp_build_insert_new_block(gallivm, "coro_resume");
+      done_block = lp_build_insert_new_block(gallivm, "coro_done");
+      LLVMBuildBr(builder, check_block);
+
+      LLVMPositionBuilderAtEnd(builder, check_block);
+      hdl = LLVMBuildLoad(builder, hdls, "");
+      done = lp_build_coro_done(gallivm, hdl);
+      LLVMBuildCondBr(builder, done, done_block, resume_block);
+
+      LLVMPositionBuilderAtEnd(builder, resume_block);
+      lp_build_loop_begin(&loop_state, gallivm, lp_build_const_int32(gallivm, 0));
+      hdl_ptr = LLVMBuildGEP(builder, hdls, &loop_state.counter, 1, "");
+      lp_build_coro_resume(gallivm, LLVMBuildLoad(builder, hdl_ptr, ""));
+      lp_build_loop_end_cond(&loop_state, num_vecs, NULL, LLVMIntUGE);
+      LLVMBuildBr(builder, check_block);
+
+      LLVMPositionBuilderAtEnd(builder, done_block);
+      lp_build_loop_begin(&loop_state, gallivm, lp_build_const_int32(gallivm, 0));
+      hdl_ptr = LLVMBuildGEP(builder, hdls, &loop_state.counter, 1, "");
+      lp_build_coro_destroy(gallivm, LLVMBuildLoad(builder, hdl_ptr, ""));
+      lp_build_loop_end_cond(&loop_state, num_vecs, NULL, LLVMIntUGE);
+   }
+#endif
+
+   LLVMBuildRetVoid(builder);
+
+   gallivm_verify_function(gallivm, function);
+
+   /*
+    * Per vector function body.
+    */
+
+   block = LLVMAppendBasicBlockInContext(gallivm->context, coro, "entry");
+   LLVMPositionBuilderAtEnd(builder, block);
+   {
+      const struct tgsi_token *tokens = shader->base.tokens;
+      LLVMValueRef outputs[PIPE_MAX_SHADER_OUTPUTS][TGSI_NUM_CHANNELS];
+      LLVMValueRef lane_ids[LP_MAX_VECTOR_LENGTH];
+      LLVMValueRef vec_index, linear, tmp, mask_val;
+      LLVMValueRef block_size[3];
+      LLVMValueRef coro_id = NULL, coro_hdl = NULL;
+      struct lp_build_coro_suspend_info coro_info;
+      struct lp_build_tgsi_params params;
+      struct lp_bld_tgsi_system_values system_values;
+      struct lp_build_sampler_soa *sampler;
+      struct lp_build_image_soa *image;
+      struct lp_build_context uint_bld;
+      struct lp_build_mask_context mask;
+
+      context_ptr = LLVMGetParam(coro, 0);
+      vec_index = LLVMGetParam(coro, 10);
+      thread_data_ptr = LLVMGetParam(coro, 11);
+      for (i = 0; i < 3; i++)
+         block_size[i] = LLVMGetParam(coro, 7 + i);
+
+      if (use_coro) {
+         coro_id = lp_build_coro_id(gallivm);
+         coro_hdl = lp_build_coro_begin_alloc_mem(gallivm, coro_id);
+         coro_info.suspend = LLVMAppendBasicBlockInContext(gallivm->context,
+                                                           coro, "suspend");
+         coro_info.cleanup = LLVMAppendBasicBlockInContext(gallivm->context,
+                                                           coro, "cleanup");
+      }
+
+      lp_build_context_init(&uint_bld, gallivm, lp_uint_type(cs_type));
+
+      /*
+       * The invocations of the vector, from the linear index within the
+       * work group: the ones past the end of the work group are masked out.
+       */
+      for (i = 0; i < cs_type.length; i++)
+         lane_ids[i] = lp_build_const_int32(gallivm, i);
+      linear = LLVMBuildMul(builder, vec_index,
+                            lp_build_const_int32(gallivm, cs_type.length), "");
+      linear = lp_build_broadcast_scalar(&uint_bld, linear);
+      linear = LLVMBuildAdd(builder, linear,
+                            LLVMConstVector(lane_ids, cs_type.length), "");
+
+      memset(&system_values, 0, sizeof(system_values));
+      tmp = lp_build_broadcast_scalar(&uint_bld, block_size[0]);
+      system_values.thread_id[0] = LLVMBuildURem(builder, linear, tmp, "");
+      tmp = LLVMBuildUDiv(builder, linear, tmp, "");
+      system_values.thread_id[1] =
+         LLVMBuildURem(builder, tmp,
+                       lp_build_broadcast_scalar(&uint_bld, block_size[1]), "");
+      system_values.thread_id[2] =
+         LLVMBuildUDiv(builder, tmp,
+                       lp_build_broadcast_scalar(&uint_bld, block_size[1]), "");
+      for (i = 0; i < 3; i++) {
+         system_values.block_id[i] = LLVMGetParam(coro, 1 + i);
+         system_values.grid_size[i] = LLVMGetParam(coro, 4 + i);
+         system_values.block_size[i] = block_size[i];
+      }
+
+      num_threads = LLVMBuildMul(builder, block_size[0], block_size[1], "");
+      num_threads = LLVMBuildMul(builder, num_threads, block_size[2], "");
+      mask_val = lp_build_cmp(&uint_bld, PIPE_FUNC_LESS, linear,
+                              lp_build_broadcast_scalar(&uint_bld, num_threads));
+      lp_build_mask_begin(&mask, gallivm, cs_type, mask_val);
+
+      sampler = lp_llvm_sampler_soa_create(key->state);
+      image = lp_llvm_image_soa_create(key->image_state);
+
+      memset(&params, 0, sizeof(params));
+      params.type = cs_type;
+      params.mask = &mask;
+      params.consts_ptr = lp_jit_cs_context_constants(gallivm, context_ptr);
+      params.const_sizes_ptr = lp_jit_cs_context_num_constants(gallivm, context_ptr);
+      params.system_values = &system_values;
+      params.context_ptr = context_ptr;
+      params.thread_data_ptr = thread_data_ptr;
+      params.sampler = sampler;
+      params.info = &shader->info.base;
+      params.ssbo_ptr = lp_jit_cs_context_ssbos(gallivm, context_ptr);
+      params.ssbo_sizes_ptr = lp_jit_cs_context_num_ssbos(gallivm, context_ptr);
+      params.image = image;
+      params.shared_ptr = lp_jit_cs_thread_data_shared(gallivm, thread_data_ptr);
+      params.coro = use_coro ? &coro_info : NULL;
+
+      lp_build_tgsi_soa(gallivm, tokens, &params, outputs);
+
+      sampler->destroy(sampler);
+      image->destroy(image);
+
+      lp_build_mask_end(&mask);
+
+      if (use_coro) {
+         /* Final suspend point, the caller destroys the coroutine. */
+         lp_build_coro_suspend_switch(gallivm, &coro_info, NULL, TRUE);
+
+         LLVMPositionBuilderAtEnd(builder, coro_info.cleanup);
+         lp_build_coro_free_mem(gallivm, coro_id, coro_hdl);
+         LLVMBuildBr(builder, coro_info.suspend);
+
+         LLVMPositionBuilderAtEnd(builder, coro_info.suspend);
+         lp_build_coro_end(gallivm, coro_hdl);
+         LLVMBuildRet(builder, coro_hdl);
+      }
+      else {
+         LLVMBuildRetVoid(builder);
+      }
+   }
+
+   gallivm_verify_function(gallivm, coro);
+}
+
+
+static struct lp_compute_shader_variant *
+generate_variant(struct llvmpipe_context *lp,
+                 struct lp_compute_shader *shader,
+                 const struct lp_compute_shader_variant_key *key)
+{
+   struct lp_compute_shader_variant *variant;
+   char module_name[64];
+
+   variant = CALLOC_STRUCT(lp_compute_shader_variant);
+   if (!variant)
+      return NULL;
+
+   util_snprintf(module_name, sizeof(module_name), "cs%u_variant%u",
+                 shader->no, shader->variants_created);
+
+   variant->gallivm = gallivm_create(module_name, lp->context, NULL);
+   if (!variant->gallivm) {
+      FREE(variant);
+      return NULL;
+   }
+
+   variant->shader = shader;
+   variant->list_item_global.base = variant;
+   variant->list_item_local.base = variant;
+   variant->no = shader->variants_created++;
+
+   memcpy(&variant->key, key, sizeof(*key));
+
+   lp_jit_init_cs_types(variant);
+
+   generate_compute(lp, shader, variant);
+
+   gallivm_compile_module(variant->gallivm);
+
+   variant->nr_instrs += lp_build_count_ir_module(variant->gallivm->module);
+
+   variant->jit_function = (lp_jit_cs_func)
+         gallivm_jit_function(variant->gallivm, variant->function);
+
+   gallivm_free_ir(variant->gallivm);
+
+   return variant;
+}
+
+
+static void *
+llvmpipe_create_compute_state(struct pipe_context *pipe,
+                              const struct pipe_compute_state *templ)
+{
+   struct lp_compute_shader *shader;
+
+   /* Only TGSI is advertised. */
+   if (templ->ir_type != PIPE_SHADER_IR_TGSI)
+      return NULL;
+
+   shader = CALLOC_STRUCT(lp_compute_shader);
+   if (!shader)
+      return NULL;
+
+   shader->no = cs_no++;
+   make_empty_list(&shader->variants);
+
+   /* we need to keep a local copy of the tokens */
+   shader->base.tokens = tgsi_dup_tokens(templ->prog);
+   shader->req_local_mem = templ->req_local_mem;
+
+   /* get/save the summary info for this shader */
+   lp_build_tgsi_info(shader->base.tokens, &shader->info);
+
+   if (LP_DEBUG & DEBUG_TGSI) {
+      debug_printf("llvmpipe: Create compute shader #%u %p:\n",
+                   shader->no, (void *) shader);
+      tgsi_dump(shader->base.tokens, 0);
+   }
+
+   return shader;
+}
+
+
+static void
+llvmpipe_bind_compute_state(struct pipe_context *pipe, void *cs)
+{
+   struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
+
+   llvmpipe->cs = (struct lp_compute_shader *) cs;
+}
+
+
+/**
+ * Remove shader variant from two lists: the shader's variant list
+ * and the context's variant list.
+ */
+static void
+llvmpipe_remove_cs_shader_variant(struct llvmpipe_context *lp,
+                                  struct lp_compute_shader_variant *variant)
+{
+   if (gallivm_debug & GALLIVM_DEBUG_IR) {
+      debug_printf("llvmpipe: del cs #%u var %u v created %u v cached %u "
+                   "v total cached %u inst %u total inst %u\n",
+                   variant->shader->no, variant->no,
+                   variant->shader->variants_created,
+                   variant->shader->variants_cached,
+                   lp->nr_cs_variants, variant->nr_instrs, lp->nr_cs_instrs);
+   }
+
+   gallivm_destroy(variant->gallivm);
+
+   /* remove from shader's list */
+   remove_from_list(&variant->list_item_local);
+   variant->shader->variants_cached--;
+
+   /* remove from context's list */
+   remove_from_list(&variant->list_item_global);
+   lp->nr_cs_variants--;
+   lp->nr_cs_instrs -= variant->nr_instrs;
+
+   FREE(variant);
+}
+
+
+static void
+llvmpipe_delete_compute_state(struct pipe_context *pipe, void *cs)
+{
+   struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
+   struct lp_compute_shader *shader = cs;
+   struct lp_cs_variant_list_item *li;
+
+   assert(cs != llvmpipe->cs);
+
+   /* Grids are run synchronously, so no variant can still be in use. */
+   li = first_elem(&shader->variants);
+   while (!at_end(&shader->variants, li)) {
+      struct lp_cs_variant_list_item *next = next_elem(li);
+      llvmpipe_remove_cs_shader_variant(llvmpipe, li->base);
+      li = next;
+   }
+
+   assert(shader->variants_cached == 0);
+   FREE((void *) shader->base.tokens);
+   FREE(shader);
+}
+
+
+static void
+make_variant_key(struct llvmpipe_context *lp,
+                 struct lp_compute_shader *shader,
+                 struct lp_compute_shader_variant_key *key)
+{
+   const struct tgsi_shader_info *info = &shader->info.base;
+   unsigned i;
+
+   memset(key, 0, sizeof *key);
+
+   key->nr_samplers = info->file_max[TGSI_FILE_SAMPLER] + 1;
+
+   for (i = 0; i < key->nr_samplers; ++i) {
+      if (info->file_mask[TGSI_FILE_SAMPLER] & (1 << i)) {
+         lp_sampler_static_sampler_state(&key->state[i].sampler_state,
+                                         lp->samplers[PIPE_SHADER_COMPUTE][i]);
+      }
+   }
+
+   /*
+    * Same as for fragment shaders, see there.
+    */
+   if (info->file_max[TGSI_FILE_SAMPLER_VIEW] != -1) {
+      key->nr_sampler_views = info->file_max[TGSI_FILE_SAMPLER_VIEW] + 1;
+      for (i = 0; i < key->nr_sampler_views; ++i) {
+         if (info->file_mask[TGSI_FILE_SAMPLER_VIEW] & (1u << (i & 31))) {
+            lp_sampler_static_texture_state(&key->state[i].texture_state,
+                                            lp->sampler_views[PIPE_SHADER_COMPUTE][i]);
+         }
+      }
+   }
+   else {
+      key->nr_sampler_views = key->nr_samplers;
+      for (i = 0; i < key->nr_sampler_views; ++i) {
+         if (info->file_mask[TGSI_FILE_SAMPLER] & (1 << i)) {
+            lp_sampler_static_texture_state(&key->state[i].texture_state,
+                                            lp->sampler_views[PIPE_SHADER_COMPUTE][i]);
+         }
+      }
+   }
+
+   key->nr_images = info->file_max[TGSI_FILE_IMAGE] + 1;
+   for (i = 0; i < key->nr_images; ++i) {
+      if (info->file_mask[TGSI_FILE_IMAGE] & (1 << i)) {
+         lp_sampler_static_texture_state_image(&key->image_state[i].image_state,
+                                               &lp->images[PIPE_SHADER_COMPUTE][i]);
+      }
+   }
+}
+
+
+/**
+ * Find or create the variant of the bound compute shader for the current
+ * state.
+ */
+static struct lp_compute_shader_variant *
+llvmpipe_update_cs(struct llvmpipe_context *lp)
+{
+   struct lp_compute_shader *shader = lp->cs;
+   struct lp_compute_shader_variant_key key;
+   struct lp_compute_shader_variant *variant = NULL;
+   struct lp_cs_variant_list_item *li;
+
+   make_variant_key(lp, shader, &key);
+
+   /* Search the variants for one which matches the key */
+   li = first_elem(&shader->variants);
+   while (!at_end(&shader->variants, li)) {
+      if (memcmp(&li->base->key, &key, sizeof(key)) == 0) {
+         variant = li->base;
+         break;
+      }
+      li = next_elem(li);
+   }
+
+   if (variant) {
+      /* Move this variant to the head of the list to implement LRU
+       * deletion of shader's when we have too many.
+       */
+      move_to_head(&lp->cs_variants_list, &variant->list_item_global);
+   }
+   else {
+      int64_t t0, t1, dt;
+      unsigned i;
+      unsigned variants_to_cull;
+
+      /* First, check if we've exceeded the max number of shader variants.
+       * If so, free 6.25% of them (the least recently used ones).
+       */
+      variants_to_cull = lp->nr_cs_variants >= LP_MAX_SHADER_VARIANTS ? LP_MAX_SHADER_VARIANTS / 16 : 0;
+
+      if (variants_to_cull ||
+          lp->nr_cs_instrs >= LP_MAX_SHADER_INSTRUCTIONS) {
+         for (i = 0; i < variants_to_cull || lp->nr_cs_instrs >= LP_MAX_SHADER_INSTRUCTIONS; i++) {
+            struct lp_cs_variant_list_item *item;
+            if (is_empty_list(&lp->cs_variants_list)) {
+               break;
+            }
+            item = last_elem(&lp->cs_variants_list);
+            assert(item);
+            assert(item->base);
+            llvmpipe_remove_cs_shader_variant(lp, item->base);
+         }
+      }
+
+      /*
+       * Generate the new variant.
+       */
+      t0 = os_time_get();
+      variant = generate_variant(lp, shader, &key);
+      t1 = os_time_get();
+      dt = t1 - t0;
+      LP_COUNT_ADD(llvm_compile_time, dt);
+      LP_COUNT_ADD(nr_llvm_compiles, 1);
+
+      /* Put the new variant into the list */
+      if (variant) {
+         insert_at_head(&shader->variants, &variant->list_item_local);
+         insert_at_head(&lp->cs_variants_list, &variant->list_item_global);
+         lp->nr_cs_variants++;
+         lp->nr_cs_instrs += variant->nr_instrs;
+         shader->variants_cached++;
+      }
+   }
+
+   return variant;
+}
+
+
+/**
+ * Set up the jit texture of a compute shader sampler view.
+ * Display targets can't be bound to compute shaders.
+ */
+static void
+cs_jit_texture(struct lp_jit_texture *jit_tex,
+               const struct pipe_sampler_view *view)
+{
+   struct pipe_resource *res = view->texture;
+   struct llvmpipe_resource *lp_tex = llvmpipe_resource(res);
+   unsigned j;
+
+   assert(!lp_tex->dt);
+
+   jit_tex->width = res->width0;
+   jit_tex->height = res->height0;
+   jit_tex->depth = res->depth0;
+
+   if (llvmpipe_resource_is_texture(res)) {
+      jit_tex->base = lp_tex->tex_data;
+      jit_tex->first_level = view->u.tex.first_level;
+      jit_tex->last_level = view->u.tex.last_level;
+      for (j = jit_tex->first_level; j <= jit_tex->last_level; j++) {
+         jit_tex->mip_offsets[j] = lp_tex->mip_offsets[j];
+         jit_tex->row_stride[j] = lp_tex->row_stride[j];
+         jit_tex->img_stride[j] = lp_tex->img_stride[j];
+      }
+
+      /* See lp_setup_set_fragment_sampler_views(). */
+      if (res->target == PIPE_TEXTURE_1D_ARRAY ||
+          res->target == PIPE_TEXTURE_2D_ARRAY ||
+          res->target == PIPE_TEXTURE_CUBE ||
+          res->target == PIPE_TEXTURE_CUBE_ARRAY) {
+         jit_tex->depth = view->u.tex.last_layer - view->u.tex.first_layer + 1;
+         for (j = jit_tex->first_level; j <= jit_tex->last_level; j++) {
+            jit_tex->mip_offsets[j] += view->u.tex.first_layer *
+                                       lp_tex->img_stride[j];
+         }
+      }
+   }
+   else {
+      unsigned view_blocksize = util_format_get_blocksize(view->format);
+
+      jit_tex->base = (uint8_t *)lp_tex->data + view->u.buf.offset;
+      jit_tex->width = view->u.buf.size / view_blocksize;
+      jit_tex->first_level = jit_tex->last_level = 0;
+      jit_tex->mip_offsets[0] = 0;
+      jit_tex->row_stride[0] = 0;
+      jit_tex->img_stride[0] = 0;
+   }
+}
+
+
+static void
+update_cs_jit_context(struct llvmpipe_context *lp,
+                      struct lp_jit_cs_context *jit_context)
+{
+   unsigned i;
+
+   memset(jit_context, 0, sizeof(*jit_context));
+
+   for (i = 0; i < LP_MAX_TGSI_CONST_BUFFERS; i++) {
+      const struct pipe_constant_buffer *cb = &lp->constants[PIPE_SHADER_COMPUTE][i];
+      const ubyte *data = NULL;
+
+      if (cb->buffer)
+         data = (const ubyte *) llvmpipe_resource_data(cb->buffer);
+      else if (cb->user_buffer)
+         data = (const ubyte *) cb->user_buffer;
+
+      if (data) {
+         jit_context->constants[i] = (const float *)(data + cb->buffer_offset);
+         jit_context->num_constants[i] = cb->buffer_size / (sizeof(float) * 4);
+      }
+   }
+
+   for (i = 0; i < lp->num_sampler_views[PIPE_SHADER_COMPUTE]; i++) {
+      const struct pipe_sampler_view *view = lp->sampler_views[PIPE_SHADER_COMPUTE][i];
+
+      if (view)
+         cs_jit_texture(&jit_context->textures[i], view);
+   }
+
+   for (i = 0; i < lp->num_samplers[PIPE_SHADER_COMPUTE]; i++) {
+      const struct pipe_sampler_state *sampler = lp->samplers[PIPE_SHADER_COMPUTE][i];
+
+      if (sampler) {
+         struct lp_jit_sampler *jit_sam = &jit_context->samplers[i];
+
+         jit_sam->min_lod = sampler->min_lod;
+         jit_sam->max_lod = sampler->max_lod;
+         jit_sam->lod_bias = sampler->lod_bias;
+         COPY_4V(jit_sam->border_color, sampler->border_color.f);
+      }
+   }
+
+   for (i = 0; i < LP_MAX_TGSI_SHADER_IMAGES; i++) {
+      if (lp->images[PIPE_SHADER_COMPUTE][i].resource)
+         lp_jit_image_from_view(&jit_context->images[i], &lp->images[PIPE_SHADER_COMPUTE][i]);
+   }
+
+   for (i = 0; i < LP_MAX_TGSI_SHADER_BUFFERS; i++) {
+      const struct pipe_shader_buffer *buffer = &lp->ssbos[PIPE_SHADER_COMPUTE][i];
+
+      if (buffer->buffer) {
+         jit_context->ssbos[i] = (const uint32_t *)
+            ((const ubyte *) llvmpipe_resource_data(buffer->buffer) +
+             buffer->buffer_offset);
+         jit_context->num_ssbos[i] = buffer->buffer_size;
+      }
+   }
+}
+
+
+/**
+ * A grid launch, shared by all the workers.
+ */
+struct lp_cs_launch
+{
+   const struct lp_compute_shader_variant *variant;
+   const struct lp_jit_cs_context *jit_context;
+   unsigned grid[3];
+   unsigned block[3];
+   unsigned req_local_mem;
+   unsigned num_groups;
+   int next_group;
+};
+
+
+struct lp_cs_job
+{
+   struct lp_cs_launch *launch;
+   struct util_queue_fence fence;
+};
+
+
+/**
+ * Run work groups until there are none left.
+ */
+static void
+cs_run_groups(struct lp_cs_launch *launch)
+{
+   struct lp_jit_cs_thread_data thread_data;
+   unsigned group;
+
+   /* The texture cache is only used for s3tc, see LP_USE_TEXTURE_CACHE. */
+   thread_data.cache = NULL;
+   thread_data.shared = NULL;
+   if (launch->req_local_mem)
+      thread_data.shared = align_malloc(launch->req_local_mem, 16);
+
+   while ((group = p_atomic_inc_return(&launch->next_group) - 1) <
+          launch->num_groups) {
+      unsigned x = group % launch->grid[0];
+      unsigned y = (group / launch->grid[0]) % launch->grid[1];
+      unsigned z = group / (launch->grid[0] * launch->grid[1]);
+
+      launch->variant->jit_function(launch->jit_context, x, y, z,
+                                    launch->grid[0], launch->grid[1],
+                                    launch->grid[2],
+                                    launch->block[0], launch->block[1],
+                                    launch->block[2], &thread_data);
+   }
+
+   align_free(thread_data.shared);
+}
+
+
+static void
+cs_job_execute(void *data, int thread_index)
+{
+   struct lp_cs_job *job = (struct lp_cs_job *) data;
+
+   cs_run_groups(job->launch);
+}
+
+
+static void
+llvmpipe_launch_grid(struct pipe_context *pipe,
+                     const struct pipe_grid_info *info)
+{
+   struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
+   struct llvmpipe_screen *screen = llvmpipe_screen(pipe->screen);
+   struct lp_jit_cs_context jit_context;
+   struct lp_cs_launch launch;
+   struct lp_cs_job jobs[LP_MAX_THREADS];
+   unsigned num_jobs, i;
+
+   if (!llvmpipe->cs)
+      return;
+
+   /* Rendering may write resources the shader reads. */
+   llvmpipe_finish(pipe, __FUNCTION__);
+
+   memset(&launch, 0, sizeof(launch));
+   if (info->indirect) {
+      const uint32_t *grid = (const uint32_t *)
+         ((const ubyte *) llvmpipe_resource_data(info->indirect) +
+          info->indirect_offset);
+      for (i = 0; i < 3; i++)
+         launch.grid[i] = grid[i];
+   }
+   else {
+      for (i = 0; i < 3; i++)
+         launch.grid[i] = info->grid[i];
+   }
+   for (i = 0; i < 3; i++)
+      launch.block[i] = info->block[i];
+
+   launch.num_groups = launch.grid[0] * launch.grid[1] * launch.grid[2];
+   if (!launch.num_groups)
+      return;
+
+   launch.variant = llvmpipe_update_cs(llvmpipe);
+   if (!launch.variant)
+      return;
+
+   update_cs_jit_context(llvmpipe, &jit_context);
+   launch.jit_context = &jit_context;
+   launch.req_local_mem = llvmpipe->cs->req_local_mem;
+
+   num_jobs = MIN2(screen->num_threads, launch.num_groups);
+   if (num_jobs <= 1) {
+      cs_run_groups(&launch);
+   }
+   else {
+      for (i = 0; i < num_jobs; i++) {
+         jobs[i].launch = &launch;
+         util_queue_fence_init(&jobs[i].fence);
+         util_queue_add_job(&screen->cs_queue, &jobs[i], &jobs[i].fence,
+                            cs_job_execute, NULL);
+      }
+      for (i = 0; i < num_jobs; i++) {
+         util_queue_fence_wait(&jobs[i].fence);
+         util_queue_fence_destroy(&jobs[i].fence);
+      }
+   }
+
+   if (llvmpipe->active_statistics_queries) {
+      llvmpipe->pipeline_statistics.cs_invocations +=
+         (uint64_t)launch.num_groups *
+         launch.block[0] * launch.block[1] * launch.block[2];
+   }
+}
+
+
+static void
+llvmpipe_set_shader_buffers(struct pipe_context *pipe,
+                            enum pipe_shader_type shader,
+                            unsigned start_slot, unsigned count,
+                            const struct pipe_shader_buffer *buffers)
+{
+   struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
+   unsigned i;
+
+   /* Only fragment and compute shaders support shader buffers. */
+   if (shader != PIPE_SHADER_FRAGMENT && shader != PIPE_SHADER_COMPUTE)
+      return;
+
+   assert(start_slot + count <= LP_MAX_TGSI_SHADER_BUFFERS);
+
+   for (i = 0; i < count; i++) {
+      struct pipe_shader_buffer *dst = &llvmpipe->ssbos[shader][start_slot + i];
+
+      if (buffers && buffers[i].buffer) {
+         pipe_resource_reference(&dst->buffer, buffers[i].buffer);
+         dst->buffer_offset = buffers[i].buffer_offset;
+         dst->buffer_size = buffers[i].buffer_size;
+      }
+      else {
+         pipe_resource_reference(&dst->buffer, NULL);
+         dst->buffer_offset = 0;
+         dst->buffer_size = 0;
+      }
+   }
+
+   if (shader == PIPE_SHADER_FRAGMENT)
+      llvmpipe->dirty |= LP_NEW_FS_SSBOS;
+}
+
+
+static void
+llvmpipe_set_shader_images(struct pipe_context *pipe,
+                           enum pipe_shader_type shader,
+                           unsigned start_slot, unsigned count,
+                           const struct pipe_image_view *images)
+{
+   struct llvmpipe_context *llvmpipe = llvmpipe_context(pipe);
+   unsigned i;
+
+   /* Only fragment and compute shaders support shader images. */
+   if (shader != PIPE_SHADER_FRAGMENT && shader != PIPE_SHADER_COMPUTE)
+      return;
+
+   assert(start_slot + count <= LP_MAX_TGSI_SHADER_IMAGES);
+
+   for (i = 0; i < count; i++) {
+      util_copy_image_view(&llvmpipe->images[shader][start_slot + i],
+                           images ? &images[i] : NULL);
+   }
+
+   if (shader == PIPE_SHADER_FRAGMENT)
+      llvmpipe->dirty |= LP_NEW_FS_IMAGES;
+}
+
+
+void
+llvmpipe_init_compute_funcs(struct llvmpipe_context *llvmpipe)
+{
+   llvmpipe->pipe.create_compute_state = llvmpipe_create_compute_state;
+   llvmpipe->pipe.bind_compute_state = llvmpipe_bind_compute_state;
+   llvmpipe->pipe.delete_compute_state = llvmpipe_delete_compute_state;
+   llvmpipe->pipe.set_shader_buffers = llvmpipe_set_shader_buffers;
+   llvmpipe->pipe.set_shader_images = llvmpipe_set_shader_images;
+   llvmpipe->pipe.launch_grid = llvmpipe_launch_grid;
+}
+
+
+/**
+ * Drop the references to the bound shader buffers and images.
+ */
+void
+llvmpipe_cleanup_compute(struct llvmpipe_context *llvmpipe)
+{
+   unsigned i, j;
+
+   for (i = 0; i < ARRAY_SIZE(llvmpipe->ssbos); i++) {
+      for (j = 0; j < ARRAY_SIZE(llvmpipe->ssbos[i]); j++)
+         pipe_resource_reference(&llvmpipe->ssbos[i][j].buffer, NULL);
+   }
+
+   for (i = 0; i < ARRAY_SIZE(llvmpipe->images); i++) {
+      for (j = 0; j < ARRAY_SIZE(llvmpipe->images[i]); j++)
+         pipe_resource_reference(&llvmpipe->images[i][j].resource, NULL);
+   }
+}
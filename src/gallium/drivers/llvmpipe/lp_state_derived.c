@@ -206,6 +206,7 @@ void llvmpipe_update_derived( struct llvmpipe_context *llvmpipe )
                           LP_NEW_RASTERIZER |
                           LP_NEW_SAMPLER |
                           LP_NEW_SAMPLER_VIEW |
+                          LP_NEW_FS_IMAGES |
                           LP_NEW_OCCLUSION_QUERY))
       llvmpipe_update_fs(llvmpipe);
 
@@ -265,6 +266,16 @@ void llvmpipe_update_derived( struct llvmpipe_context *llvmpipe )
                                           llvmpipe->num_samplers[PIPE_SHADER_FRAGMENT],
                                           llvmpipe->samplers[PIPE_SHADER_FRAGMENT]);
 
+   if (llvmpipe->dirty & LP_NEW_FS_SSBOS)
+      lp_setup_set_fs_ssbos(llvmpipe->setup,
+                            ARRAY_SIZE(llvmpipe->ssbos[PIPE_SHADER_FRAGMENT]),
+                            llvmpipe->ssbos[PIPE_SHADER_FRAGMENT]);
+
+   if (llvmpipe->dirty & LP_NEW_FS_IMAGES)
+      lp_setup_set_fs_images(llvmpipe->setup,
+                             ARRAY_SIZE(llvmpipe->images[PIPE_SHADER_FRAGMENT]),
+                             llvmpipe->images[PIPE_SHADER_FRAGMENT]);
+
    if (llvmpipe->dirty & LP_NEW_VIEWPORT) {
       /*
        * Update setup and fragment's view of the active viewport state.
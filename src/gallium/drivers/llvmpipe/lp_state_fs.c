@@ -60,6 +60,7 @@
 #include <limits.h>
 #include "pipe/p_defines.h"
 #include "util/u_inlines.h"
+#include "util/u_atomic.h"
 #include "util/u_memory.h"
 #include "util/u_pointer.h"
 #include "util/u_format.h"
@@ -68,6 +69,7 @@
 #include "util/simple_list.h"
 #include "util/u_dual_blend.h"
 #include "util/os_time.h"
+#include "util/mesa-sha1.h"
 #include "pipe/p_shader_tokens.h"
 #include "draw/draw_context.h"
 #include "tgsi/tgsi_dump.h"
@@ -102,6 +104,7 @@
 #include "lp_flush.h"
 #include "lp_state_fs.h"
 #include "lp_rast.h"
+#include "lp_screen.h"
 
 
 /** Fragment shader number (for debugging) */
@@ -300,6 +303,7 @@ generate_fs_loop(struct gallivm_state *gallivm,
                  LLVMValueRef num_loop,
                  struct lp_build_interp_soa_context *interp,
                  const struct lp_build_sampler_soa *sampler,
+                 const struct lp_build_image_soa *image,
                  LLVMValueRef mask_store,
                  LLVMValueRef (*out_color)[4],
                  LLVMValueRef depth_ptr,
@@ -320,6 +324,7 @@ generate_fs_loop(struct gallivm_state *gallivm,
    LLVMValueRef outputs[PIPE_MAX_SHADER_OUTPUTS][TGSI_NUM_CHANNELS];
    struct lp_build_for_loop_state loop_state;
    struct lp_build_mask_context mask;
+   struct lp_build_tgsi_params params;
    /*
     * TODO: figure out if simple_shader optimization is really worthwile to
     * keep. Disabled because it may hide some real bugs in the (depth/stencil)
@@ -370,6 +375,16 @@ generate_fs_loop(struct gallivm_state *gallivm,
          depth_mode = LATE_DEPTH_TEST | LATE_DEPTH_WRITE;
       }
 
+      /*
+       * Stores and atomics must only be skipped for fragments failing the
+       * tests if the shader asks for early tests, and then the depth and
+       * stencil writes happen early as well.
+       */
+      if (shader->info.base.properties[TGSI_PROPERTY_FS_EARLY_DEPTH_STENCIL])
+         depth_mode = EARLY_DEPTH_TEST | EARLY_DEPTH_WRITE;
+      else if (shader->info.base.writes_memory)
+         depth_mode = LATE_DEPTH_TEST | LATE_DEPTH_WRITE;
+
       if (!(key->depth.enabled && key->depth.writemask) &&
           !(key->stencil[0].enabled && (key->stencil[0].writemask ||
                                         (key->stencil[1].enabled &&
@@ -475,11 +490,22 @@ generate_fs_loop(struct gallivm_state *gallivm,
    lp_build_interp_soa_update_inputs_dyn(interp, gallivm, loop_state.counter);
 
    /* Build the actual shader */
-   lp_build_tgsi_soa(gallivm, tokens, type, &mask,
-                     consts_ptr, num_consts_ptr, &system_values,
-                     interp->inputs,
-                     outputs, context_ptr, thread_data_ptr,
-                     sampler, &shader->info.base, NULL);
+   memset(&params, 0, sizeof(params));
+   params.type = type;
+   params.mask = &mask;
+   params.consts_ptr = consts_ptr;
+   params.const_sizes_ptr = num_consts_ptr;
+   params.system_values = &system_values;
+   params.inputs = interp->inputs;
+   params.context_ptr = context_ptr;
+   params.thread_data_ptr = thread_data_ptr;
+   params.sampler = sampler;
+   params.info = &shader->info.base;
+   params.ssbo_ptr = lp_jit_context_ssbos(gallivm, context_ptr);
+   params.ssbo_sizes_ptr = lp_jit_context_num_ssbos(gallivm, context_ptr);
+   params.image = image;
+
+   lp_build_tgsi_soa(gallivm, tokens, &params, outputs);
 
    /* Alpha test */
    if (key->alpha.enabled) {
@@ -2397,12 +2423,12 @@ generate_unswizzled_blend(struct gallivm_state *gallivm,
  * 2x2 pixels.
  */
 static void
-generate_fragment(struct llvmpipe_context *lp,
-                  struct lp_fragment_shader *shader,
+generate_fragment(struct lp_fragment_shader *shader,
                   struct lp_fragment_shader_variant *variant,
+                  struct lp_fs_variant_build *build,
                   unsigned partial_mask)
 {
-   struct gallivm_state *gallivm = variant->gallivm;
+   struct gallivm_state *gallivm = build->gallivm;
    const struct lp_fragment_shader_variant_key *key = &variant->key;
    struct lp_shader_input inputs[PIPE_MAX_SHADER_INPUTS];
    char func_name[64];
@@ -2429,6 +2455,7 @@ generate_fragment(struct llvmpipe_context *lp,
    LLVMBasicBlockRef block;
    LLVMBuilderRef builder;
    struct lp_build_sampler_soa *sampler;
+   struct lp_build_image_soa *image;
    struct lp_build_interp_soa_context interp;
    LLVMValueRef fs_mask[16 / 4];
    LLVMValueRef fs_out_color[PIPE_MAX_COLOR_BUFS][TGSI_NUM_CHANNELS][16 / 4];
@@ -2486,10 +2513,11 @@ generate_fragment(struct llvmpipe_context *lp,
 
    blend_vec_type = lp_build_vec_type(gallivm, blend_type);
 
-   util_snprintf(func_name, sizeof(func_name), "fs%u_variant%u_%s",
-                 shader->no, variant->no, partial_mask ? "partial" : "whole");
+   /* Must not depend on the shader or variant numbers, for the disk cache */
+   util_snprintf(func_name, sizeof(func_name), "fs_variant_%s",
+                 partial_mask ? "partial" : "whole");
 
-   arg_types[0] = variant->jit_context_ptr_type;       /* context */
+   arg_types[0] = build->jit_context_ptr_type;         /* context */
    arg_types[1] = int32_type;                          /* x */
    arg_types[2] = int32_type;                          /* y */
    arg_types[3] = int32_type;                          /* facing */
@@ -2499,7 +2527,7 @@ generate_fragment(struct llvmpipe_context *lp,
    arg_types[7] = LLVMPointerType(LLVMPointerType(blend_vec_type, 0), 0);  /* color */
    arg_types[8] = LLVMPointerType(int8_type, 0);       /* depth */
    arg_types[9] = int32_type;                          /* mask_input */
-   arg_types[10] = variant->jit_thread_data_ptr_type;  /* per thread data */
+   arg_types[10] = build->jit_thread_data_ptr_type;    /* per thread data */
    arg_types[11] = LLVMPointerType(int32_type, 0);     /* stride */
    arg_types[12] = int32_type;                         /* depth_stride */
 
@@ -2509,7 +2537,7 @@ generate_fragment(struct llvmpipe_context *lp,
    function = LLVMAddFunction(gallivm->module, func_name, func_type);
    LLVMSetFunctionCallConv(function, LLVMCCallConv);
 
-   variant->function[partial_mask] = function;
+   build->function[partial_mask] = function;
 
    /* XXX: need to propagate noalias down into color param now we are
     * passing a pointer-to-pointer?
@@ -2545,6 +2573,10 @@ generate_fragment(struct llvmpipe_context *lp,
    lp_build_name(stride_ptr, "stride_ptr");
    lp_build_name(depth_stride, "depth_stride");
 
+   /* The body comes with the cached code */
+   if (gallivm_is_cached(gallivm))
+      return;
+
    /*
     * Function body
     */
@@ -2575,6 +2607,7 @@ generate_fragment(struct llvmpipe_context *lp,
 
    /* code generated texture sampling */
    sampler = lp_llvm_sampler_soa_create(key->state);
+   image = lp_llvm_image_soa_create(key->image_state);
 
    num_fs = 16 / fs_type.length; /* number of loops per 4x4 stamp */
    /* for 1d resources only run "upper half" of stamp */
@@ -2629,6 +2662,7 @@ generate_fragment(struct llvmpipe_context *lp,
                        num_loop,
                        &interp,
                        sampler,
+                       image,
                        mask_store, /* output */
                        color_store,
                        depth_ptr,
@@ -2663,6 +2697,7 @@ generate_fragment(struct llvmpipe_context *lp,
    }
 
    sampler->destroy(sampler);
+   image->destroy(image);
 
    /* Loop over color outputs / color buffers to do blending.
     */
@@ -2792,6 +2827,14 @@ dump_fs_variant_key(const struct lp_fragment_shader_variant_key *key)
                    texture->pot_height,
                    texture->pot_depth);
    }
+   for (i = 0; i < key->nr_images; ++i) {
+      const struct lp_static_texture_state *image = &key->image_state[i].image_state;
+      debug_printf("image[%u] = \n", i);
+      debug_printf("  .format = %s\n",
+                   util_format_name(image->format));
+      debug_printf("  .target = %s\n",
+                   util_str_tex_target(image->target, TRUE));
+   }
 }
 
 
@@ -2808,36 +2851,26 @@ lp_debug_fs_variant(const struct lp_fragment_shader_variant *variant)
 
 
 /**
- * Generate a new fragment shader variant from the shader code and
- * other state indicated by the key.
+ * Create a new fragment shader variant from the shader code and
+ * other state indicated by the key.  No code is generated yet.
  */
 static struct lp_fragment_shader_variant *
-generate_variant(struct llvmpipe_context *lp,
-                 struct lp_fragment_shader *shader,
-                 const struct lp_fragment_shader_variant_key *key)
+create_variant(struct lp_fragment_shader *shader,
+               const struct lp_fragment_shader_variant_key *key)
 {
    struct lp_fragment_shader_variant *variant;
    const struct util_format_description *cbuf0_format_desc = NULL;
    boolean fullcolormask;
-   char module_name[64];
 
    variant = CALLOC_STRUCT(lp_fragment_shader_variant);
    if (!variant)
       return NULL;
 
-   util_snprintf(module_name, sizeof(module_name), "fs%u_variant%u",
-                 shader->no, shader->variants_created);
-
-   variant->gallivm = gallivm_create(module_name, lp->context);
-   if (!variant->gallivm) {
-      FREE(variant);
-      return NULL;
-   }
-
    variant->shader = shader;
    variant->list_item_global.base = variant;
    variant->list_item_local.base = variant;
    variant->no = shader->variants_created++;
+   util_queue_fence_init(&variant->ready);
 
    memcpy(&variant->key, key, shader->variant_key_size);
 
@@ -2866,43 +2899,204 @@ generate_variant(struct llvmpipe_context *lp,
       lp_debug_fs_variant(variant);
    }
 
-   lp_jit_init_types(variant);
-   
-   if (variant->jit_function[RAST_EDGE_TEST] == NULL)
-      generate_fragment(lp, shader, variant, RAST_EDGE_TEST);
+   return variant;
+}
 
-   if (variant->jit_function[RAST_WHOLE] == NULL) {
-      if (variant->opaque) {
-         /* Specialized shader, which doesn't need to read the color buffer. */
-         generate_fragment(lp, shader, variant, RAST_WHOLE);
-      }
+
+/**
+ * Look up the optimized code of a variant in the disk cache.
+ * Also computes the variant's disk cache key.
+ */
+static void
+find_cached_variant(struct lp_fragment_shader_variant *variant,
+                    struct disk_cache *disk_cache,
+                    struct lp_cached_code *cached)
+{
+   const struct lp_fragment_shader *shader = variant->shader;
+   struct mesa_sha1 ctx;
+
+   _mesa_sha1_init(&ctx);
+   _mesa_sha1_update(&ctx, shader->base.tokens,
+                     tgsi_num_tokens(shader->base.tokens) *
+                     sizeof(struct tgsi_token));
+   _mesa_sha1_update(&ctx, &variant->key, shader->variant_key_size);
+   _mesa_sha1_final(&ctx, variant->ir_sha1);
+
+   gallivm_disk_cache_find(disk_cache, variant->ir_sha1, cached);
+}
+
+
+/**
+ * Generate and compile the code of a fragment shader variant in the given
+ * LLVM context, returning the entry points in jit_function[] and the LLVM
+ * state owning them in *gallivm_out.
+ *
+ * The code is optimized when cached is not NULL, and then loaded from it
+ * if it holds code, or put there otherwise.  The variant is only read, so
+ * that this can run on a compile queue thread while the variant is drawn.
+ */
+static boolean
+compile_variant(struct lp_fragment_shader_variant *variant,
+                LLVMContextRef context,
+                struct lp_cached_code *cached,
+                struct gallivm_state **gallivm_out,
+                lp_jit_frag_func jit_function[2],
+                unsigned *nr_instrs)
+{
+   struct lp_fragment_shader *shader = variant->shader;
+   struct lp_fs_variant_build build = { 0 };
+   struct gallivm_state *gallivm;
+   char module_name[64];
+
+   util_snprintf(module_name, sizeof(module_name), "fs%u_variant%u%s",
+                 shader->no, variant->no, cached ? "" : "_interim");
+
+   if (cached)
+      gallivm = gallivm_create(module_name, context, cached);
+   else
+      gallivm = gallivm_create_unoptimized(module_name, context);
+   if (!gallivm)
+      return FALSE;
+
+   build.gallivm = gallivm;
+   lp_jit_init_types(&build);
+
+   generate_fragment(shader, variant, &build, RAST_EDGE_TEST);
+
+   if (variant->opaque) {
+      /* Specialized shader, which doesn't need to read the color buffer. */
+      generate_fragment(shader, variant, &build, RAST_WHOLE);
    }
 
    /*
     * Compile everything
     */
 
-   gallivm_compile_module(variant->gallivm);
+   gallivm_compile_module(gallivm);
 
-   variant->nr_instrs += lp_build_count_ir_module(variant->gallivm->module);
+   if (gallivm_is_cached(gallivm)) {
+      if (nr_instrs)
+         *nr_instrs = cached->nr_instrs;
+   } else if (nr_instrs || cached) {
+      unsigned count = lp_build_count_ir_module(gallivm->module);
 
-   if (variant->function[RAST_EDGE_TEST]) {
-      variant->jit_function[RAST_EDGE_TEST] = (lp_jit_frag_func)
-            gallivm_jit_function(variant->gallivm,
-                                 variant->function[RAST_EDGE_TEST]);
+      if (nr_instrs)
+         *nr_instrs = count;
+      if (cached)
+         cached->nr_instrs = count;
    }
 
-   if (variant->function[RAST_WHOLE]) {
-         variant->jit_function[RAST_WHOLE] = (lp_jit_frag_func)
-               gallivm_jit_function(variant->gallivm,
-                                    variant->function[RAST_WHOLE]);
-   } else if (!variant->jit_function[RAST_WHOLE]) {
-      variant->jit_function[RAST_WHOLE] = variant->jit_function[RAST_EDGE_TEST];
+   jit_function[RAST_EDGE_TEST] = (lp_jit_frag_func)
+         gallivm_jit_function(gallivm, build.function[RAST_EDGE_TEST]);
+
+   if (build.function[RAST_WHOLE]) {
+      jit_function[RAST_WHOLE] = (lp_jit_frag_func)
+            gallivm_jit_function(gallivm, build.function[RAST_WHOLE]);
+   } else {
+      jit_function[RAST_WHOLE] = jit_function[RAST_EDGE_TEST];
    }
 
-   gallivm_free_ir(variant->gallivm);
+   gallivm_free_ir(gallivm);
 
-   return variant;
+   *gallivm_out = gallivm;
+   return TRUE;
+}
+
+
+/**
+ * Compile queue job generating the optimized code of a variant, which is
+ * drawn with its interim code meanwhile.
+ */
+static void
+compile_variant_job(void *data, int thread_index)
+{
+   struct lp_fragment_shader_variant *variant = data;
+   struct lp_cached_code cached = { 0 };
+   lp_jit_frag_func jit_function[2];
+   int64_t t0, t1;
+
+   t0 = os_time_get();
+
+   if (!compile_variant(variant, variant->context, &cached,
+                        &variant->job_gallivm, jit_function, NULL)) {
+      /* Keep drawing with the interim code */
+      return;
+   }
+
+   if (variant->disk_cache)
+      gallivm_disk_cache_insert(variant->disk_cache, variant->ir_sha1, &cached);
+   free(cached.data);
+
+   t1 = os_time_get();
+   LP_COUNT_ADD(llvm_compile_time, t1 - t0);
+   LP_COUNT_ADD(nr_llvm_compiles, 2);  /* emit vs. omit in/out test */
+
+   if (gallivm_debug & GALLIVM_DEBUG_PERF) {
+      debug_printf("optimized fs #%u variant #%u in the background in %d msec\n",
+                   variant->shader->no, variant->no, (int)((t1 - t0) / 1000));
+   }
+
+   /*
+    * Scenes being rasterized may still call the interim code, so it is
+    * only freed with the variant.  The rasterizer loads jit_function[] with
+    * p_atomic_read, pairing with these release stores.
+    */
+   p_atomic_set(&variant->jit_function[RAST_EDGE_TEST],
+                jit_function[RAST_EDGE_TEST]);
+   p_atomic_set(&variant->jit_function[RAST_WHOLE],
+                jit_function[RAST_WHOLE]);
+}
+
+
+/**
+ * Generate the code of a new fragment shader variant.
+ *
+ * With compile threads, only unoptimized code is generated here so that
+ * the draw can proceed quickly, and a job generates the optimized code in
+ * the background.  Code found in the disk cache is loaded right away.
+ * \return  TRUE for success, FALSE for failure
+ */
+static boolean
+generate_variant(struct llvmpipe_context *lp,
+                 struct lp_fragment_shader_variant *variant)
+{
+   struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+   struct disk_cache *disk_cache = screen->disk_shader_cache;
+   struct lp_cached_code cached = { 0 };
+   boolean needs_caching;
+   boolean ret;
+
+   if (disk_cache)
+      find_cached_variant(variant, disk_cache, &cached);
+   needs_caching = disk_cache && !cached.data_size;
+
+   if (screen->num_compile_threads && !cached.data_size) {
+      variant->context = LLVMContextCreate();
+      if (!variant->context)
+         return FALSE;
+
+      if (!compile_variant(variant, lp->context, NULL, &variant->gallivm,
+                           variant->jit_function, &variant->nr_instrs)) {
+         LLVMContextDispose(variant->context);
+         variant->context = NULL;
+         return FALSE;
+      }
+
+      variant->disk_cache = disk_cache;
+
+      util_queue_add_job(&screen->compile_queue, variant, &variant->ready,
+                         compile_variant_job, NULL);
+      return TRUE;
+   }
+
+   ret = compile_variant(variant, lp->context, &cached, &variant->gallivm,
+                         variant->jit_function, &variant->nr_instrs);
+
+   if (ret && needs_caching)
+      gallivm_disk_cache_insert(disk_cache, variant->ir_sha1, &cached);
+   free(cached.data);
+
+   return ret;
 }
 
 
@@ -3036,7 +3230,20 @@ llvmpipe_remove_shader_variant(struct llvmpipe_context *lp,
                    lp->nr_fs_variants, variant->nr_instrs, lp->nr_fs_instrs);
    }
 
-   gallivm_destroy(variant->gallivm);
+   if (variant->context) {
+      struct llvmpipe_screen *screen = llvmpipe_screen(lp->pipe.screen);
+
+      /* Cancel the background compilation, or wait for it to finish */
+      util_queue_drop_job(&screen->compile_queue, &variant->ready);
+   }
+
+   if (variant->gallivm)
+      gallivm_destroy(variant->gallivm);
+   if (variant->job_gallivm)
+      gallivm_destroy(variant->job_gallivm);
+   if (variant->context)
+      LLVMContextDispose(variant->context);
+   util_queue_fence_destroy(&variant->ready);
 
    /* remove from shader's list */
    remove_from_list(&variant->list_item_local);
@@ -3355,6 +3562,14 @@ make_variant_key(struct llvmpipe_context *lp,
          }
       }
    }
+
+   key->nr_images = shader->info.base.file_max[TGSI_FILE_IMAGE] + 1;
+   for (i = 0; i < key->nr_images; ++i) {
+      if (shader->info.base.file_mask[TGSI_FILE_IMAGE] & (1 << i)) {
+         lp_sampler_static_texture_state_image(&key->image_state[i].image_state,
+                                               &lp->images[PIPE_SHADER_FRAGMENT][i]);
+      }
+   }
 }
 
 
@@ -3445,14 +3660,33 @@ llvmpipe_update_fs(struct llvmpipe_context *lp)
       }
 
       /*
-       * Generate the new variant.
+       * Generate the new variant.  The draw waits for this.
        */
       t0 = os_time_get();
-      variant = generate_variant(lp, shader, &key);
+      variant = create_variant(shader, &key);
+      if (variant && !generate_variant(lp, variant)) {
+         util_queue_fence_destroy(&variant->ready);
+         FREE(variant);
+         variant = NULL;
+      }
       t1 = os_time_get();
       dt = t1 - t0;
       LP_COUNT_ADD(llvm_compile_time, dt);
       LP_COUNT_ADD(nr_llvm_compiles, 2);  /* emit vs. omit in/out test */
+      LP_COUNT(nr_fs_compile_stalls);
+      LP_COUNT_ADD(fs_compile_stall_time, dt);
+
+      if (variant && variant->context) {
+         LP_COUNT(nr_fs_interim_variants);
+      }
+
+      if (gallivm_debug & GALLIVM_DEBUG_PERF) {
+         debug_printf("fs #%u variant #%u stalled the draw for %d msec%s\n",
+                      shader->no, shader->variants_created - 1,
+                      (int)(dt / 1000),
+                      variant && variant->context ?
+                      " (unoptimized)" : "");
+      }
 
       /* Put the new variant into the list */
       if (variant) {
@@ -32,6 +32,7 @@
 
 #include "pipe/p_compiler.h"
 #include "pipe/p_state.h"
+#include "util/u_queue.h"
 #include "tgsi/tgsi_scan.h" /* for tgsi_shader_info */
 #include "gallivm/lp_bld_sample.h" /* for struct lp_sampler_static_state */
 #include "gallivm/lp_bld_tgsi.h" /* for lp_tgsi_info */
@@ -39,6 +40,7 @@
 
 
 struct tgsi_token;
+struct disk_cache;
 struct lp_fragment_shader;
 
 
@@ -59,6 +61,12 @@ struct lp_sampler_static_state
 };
 
 
+struct lp_image_static_state
+{
+   struct lp_static_texture_state image_state;
+};
+
+
 struct lp_fragment_shader_variant_key
 {
    struct pipe_depth_state depth;
@@ -73,6 +81,7 @@ struct lp_fragment_shader_variant_key
    unsigned nr_cbufs:8;
    unsigned nr_samplers:8;      /* actually derivable from just the shader */
    unsigned nr_sampler_views:8; /* actually derivable from just the shader */
+   unsigned nr_images:8;        /* actually derivable from just the shader */
    unsigned flatshade:1;
    unsigned occlusion_count:1;
    unsigned resource_1d:1;
@@ -81,6 +90,9 @@ struct lp_fragment_shader_variant_key
    enum pipe_format zsbuf_format;
    enum pipe_format cbuf_format[PIPE_MAX_COLOR_BUFS];
 
+   struct lp_image_static_state image_state[LP_MAX_TGSI_SHADER_IMAGES];
+
+   /* Must be last, only the used entries are part of the key */
    struct lp_sampler_static_state state[PIPE_MAX_SHADER_SAMPLER_VIEWS];
 };
 
@@ -93,6 +105,21 @@ struct lp_fs_variant_list_item
 };
 
 
+/**
+ * LLVM module, types and functions the code of a fragment shader variant
+ * is generated with.  Only needed until the code is compiled.
+ */
+struct lp_fs_variant_build
+{
+   struct gallivm_state *gallivm;
+
+   LLVMTypeRef jit_context_ptr_type;
+   LLVMTypeRef jit_thread_data_ptr_type;
+
+   LLVMValueRef function[2];
+};
+
+
 struct lp_fragment_shader_variant
 {
    struct lp_fragment_shader_variant_key key;
@@ -101,14 +128,23 @@ struct lp_fragment_shader_variant
 
    struct gallivm_state *gallivm;
 
-   LLVMTypeRef jit_context_ptr_type;
-   LLVMTypeRef jit_thread_data_ptr_type;
    LLVMTypeRef jit_linear_context_ptr_type;
 
-   LLVMValueRef function[2];
-
    lp_jit_frag_func jit_function[2];
 
+   /*
+    * When compiled in the background, jit_function[] first points to
+    * unoptimized code from gallivm, and a job on the screen's compile queue
+    * replaces it once the optimized code is ready.  The job builds in its
+    * own LLVM context, as lp->context is not thread safe, and only hands
+    * over job_gallivm through the ready fence.
+    */
+   struct gallivm_state *job_gallivm;
+   LLVMContextRef context;
+   struct disk_cache *disk_cache;
+   unsigned char ir_sha1[20];  /**< disk cache key */
+   struct util_queue_fence ready;
+
    /* Total number of LLVM instructions generated */
    unsigned nr_instrs;
 
@@ -0,0 +1,549 @@
+/**************************************************************************
+ *
+ * Copyright 2019 VMware, Inc.
+ * All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the
+ * "Software"), to deal in the Software without restriction, including
+ * without limitation the rights to use, copy, modify, merge, publish,
+ * distribute, sub license, and/or sell copies of the Software, and to
+ * permit persons to whom the Software is furnished to do so, subject to
+ * the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the
+ * next paragraph) shall be included in all copies or substantial portions
+ * of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NON-INFRINGEMENT.
+ * IN NO EVENT SHALL VMWARE AND/OR ITS SUPPLIERS BE LIABLE FOR
+ * ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT,
+ * TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION WITH THE
+ * SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ **************************************************************************/
+
+
+/**
+ * @file
+ * Unit tests for compute shaders and fragment shader side effects.
+ *
+ * Runs small TGSI compute shaders writing to a shader buffer through a
+ * llvmpipe context, and checks what they wrote.  The work groups are larger
+ * than a SIMD vector, so the barrier test runs the shader as coroutines.
+ *
+ * Then draws a quad with a fragment shader counting its invocations per
+ * pixel in a shader buffer, behind a depth buffer which fails the depth
+ * test everywhere.
+ */
+
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "pipe/p_context.h"
+#include "pipe/p_screen.h"
+#include "pipe/p_state.h"
+#include "tgsi/tgsi_text.h"
+#include "util/u_inlines.h"
+#include "util/u_memory.h"
+#include "util/u_format.h"
+#include "sw/null/null_sw_winsys.h"
+
+#include "lp_public.h"
+#include "lp_test.h"
+
+
+#define MAX_INVOCATIONS 1024
+
+
+struct compute_test_case
+{
+   const char *name;
+   const char *text;
+   unsigned block[3];
+   unsigned grid[3];
+   unsigned shared_size;
+
+   /** Expected value of the n-th dword of the buffer */
+   uint32_t (*expected)(const struct compute_test_case *test, unsigned n);
+};
+
+
+static unsigned
+num_invocations(const struct compute_test_case *test)
+{
+   return test->block[0] * test->block[1] * test->block[2] *
+          test->grid[0] * test->grid[1] * test->grid[2];
+}
+
+
+/* Each invocation stores its flattened global id at that index. */
+static const char global_id_text[] =
+   "COMP\n"
+   "DCL SV[0], THREAD_ID\n"
+   "DCL SV[1], BLOCK_ID\n"
+   "DCL SV[2], BLOCK_SIZE\n"
+   "DCL SV[3], GRID_SIZE\n"
+   "DCL BUFFER[0]\n"
+   "DCL TEMP[0..1]\n"
+   "IMM[0] UINT32 {4, 0, 0, 0}\n"
+   "  0: UMAD TEMP[0].xyz, SV[1].xyzz, SV[2].xyzz, SV[0].xyzz\n"
+   "  1: UMUL TEMP[1].xy, SV[2].xyyy, SV[3].xyyy\n"
+   "  2: UMAD TEMP[0].y, TEMP[0].zzzz, TEMP[1].yyyy, TEMP[0].yyyy\n"
+   "  3: UMAD TEMP[0].x, TEMP[0].yyyy, TEMP[1].xxxx, TEMP[0].xxxx\n"
+   "  4: UMUL TEMP[1].x, TEMP[0].xxxx, IMM[0].xxxx\n"
+   "  5: STORE BUFFER[0].x, TEMP[1].xxxx, TEMP[0].xxxx\n"
+   "  6: END\n";
+
+static uint32_t
+global_id_expected(const struct compute_test_case *test, unsigned n)
+{
+   return n < num_invocations(test) ? n : 0;
+}
+
+
+/*
+ * Each invocation of a 1D grid stores its global id in shared memory, and
+ * after a barrier the id of the next invocation in the work group.
+ */
+static const char barrier_text[] =
+   "COMP\n"
+   "DCL SV[0], THREAD_ID\n"
+   "DCL SV[1], BLOCK_ID\n"
+   "DCL SV[2], BLOCK_SIZE\n"
+   "DCL BUFFER[0]\n"
+   "DCL MEMORY[0], SHARED\n"
+   "DCL TEMP[0..2]\n"
+   "IMM[0] UINT32 {4, 1, 0, 0}\n"
+   "  0: UMAD TEMP[0].x, SV[1].xxxx, SV[2].xxxx, SV[0].xxxx\n"
+   "  1: UMUL TEMP[1].x, SV[0].xxxx, IMM[0].xxxx\n"
+   "  2: STORE MEMORY[0].x, TEMP[1].xxxx, TEMP[0].xxxx\n"
+   "  3: BARRIER\n"
+   "  4: UADD TEMP[2].x, SV[0].xxxx, IMM[0].yyyy\n"
+   "  5: UMOD TEMP[2].x, TEMP[2].xxxx, SV[2].xxxx\n"
+   "  6: UMUL TEMP[2].x, TEMP[2].xxxx, IMM[0].xxxx\n"
+   "  7: LOAD TEMP[2].x, MEMORY[0], TEMP[2].xxxx\n"
+   "  8: UMUL TEMP[1].x, TEMP[0].xxxx, IMM[0].xxxx\n"
+   "  9: STORE BUFFER[0].x, TEMP[1].xxxx, TEMP[2].xxxx\n"
+   " 10: END\n";
+
+static uint32_t
+barrier_expected(const struct compute_test_case *test, unsigned n)
+{
+   unsigned size = test->block[0];
+
+   if (n >= num_invocations(test))
+      return 0;
+   return n - n % size + (n + 1) % size;
+}
+
+
+/*
+ * Each invocation increments the first dword, and sets the dword after the
+ * value it got back, so that these are all different.
+ */
+static const char atomic_text[] =
+   "COMP\n"
+   "DCL BUFFER[0]\n"
+   "DCL TEMP[0]\n"
+   "IMM[0] UINT32 {0, 1, 4, 0}\n"
+   "  0: ATOMUADD TEMP[0].x, BUFFER[0], IMM[0].xxxx, IMM[0].yyyy\n"
+   "  1: UMAD TEMP[0].x, TEMP[0].xxxx, IMM[0].zzzz, IMM[0].zzzz\n"
+   "  2: STORE BUFFER[0].x, TEMP[0].xxxx, IMM[0].yyyy\n"
+   "  3: END\n";
+
+static uint32_t
+atomic_expected(const struct compute_test_case *test, unsigned n)
+{
+   if (n == 0)
+      return num_invocations(test);
+   return n <= num_invocations(test) ? 1 : 0;
+}
+
+
+static const struct compute_test_case
+test_cases[] = {
+   { "global_id", global_id_text, {8, 4, 2}, {3, 2, 2}, 0,
+     global_id_expected },
+   { "barrier", barrier_text, {64, 1, 1}, {5, 1, 1}, 64 * 4,
+     barrier_expected },
+   { "atomic", atomic_text, {32, 2, 1}, {3, 2, 1}, 0,
+     atomic_expected },
+};
+
+
+void
+write_tsv_header(FILE *fp)
+{
+   fprintf(fp,
+           "result\t"
+           "test\n");
+
+   fflush(fp);
+}
+
+
+static void
+write_tsv_row(FILE *fp,
+              const char *name,
+              boolean success)
+{
+   fprintf(fp, "%s\t%s\n", success ? "pass" : "fail", name);
+
+   fflush(fp);
+}
+
+
+static boolean
+test_one(unsigned verbose, FILE *fp,
+         struct pipe_context *pipe,
+         const struct compute_test_case *test)
+{
+   struct tgsi_token tokens[1024];
+   struct pipe_compute_state state;
+   struct pipe_shader_buffer ssbo;
+   struct pipe_grid_info info;
+   unsigned size = (1 + MAX_INVOCATIONS) * 4;
+   uint32_t *data;
+   void *cs;
+   boolean success = TRUE;
+   unsigned i;
+
+   assert(num_invocations(test) <= MAX_INVOCATIONS);
+
+   if (!tgsi_text_translate(test->text, tokens, ARRAY_SIZE(tokens))) {
+      fprintf(stderr, "%s: failed to translate the shader\n", test->name);
+      return FALSE;
+   }
+
+   memset(&state, 0, sizeof state);
+   state.ir_type = PIPE_SHADER_IR_TGSI;
+   state.prog = tokens;
+   state.req_local_mem = test->shared_size;
+   cs = pipe->create_compute_state(pipe, &state);
+   pipe->bind_compute_state(pipe, cs);
+
+   data = CALLOC(size, 1);
+   memset(&ssbo, 0, sizeof ssbo);
+   ssbo.buffer = pipe_buffer_create(pipe->screen, PIPE_BIND_SHADER_BUFFER,
+                                    PIPE_USAGE_DEFAULT, size);
+   ssbo.buffer_size = size;
+   pipe_buffer_write(pipe, ssbo.buffer, 0, size, data);
+   pipe->set_shader_buffers(pipe, PIPE_SHADER_COMPUTE, 0, 1, &ssbo);
+
+   memset(&info, 0, sizeof info);
+   for (i = 0; i < 3; i++) {
+      info.block[i] = test->block[i];
+      info.grid[i] = test->grid[i];
+   }
+   pipe->launch_grid(pipe, &info);
+
+   pipe_buffer_read(pipe, ssbo.buffer, 0, size, data);
+
+   for (i = 0; i < size / 4; i++) {
+      uint32_t expected = test->expected(test, i);
+
+      if (data[i] != expected) {
+         if (verbose || success)
+            fprintf(stderr, "%s: dword %u is %u, expected %u\n",
+                    test->name, i, data[i], expected);
+         success = FALSE;
+      }
+   }
+
+   if (verbose)
+      printf("%s: %s\n", test->name, success ? "pass" : "fail");
+
+   if (fp)
+      write_tsv_row(fp, test->name, success);
+
+   pipe->set_shader_buffers(pipe, PIPE_SHADER_COMPUTE, 0, 1, NULL);
+   pipe_resource_reference(&ssbo.buffer, NULL);
+   pipe->bind_compute_state(pipe, NULL);
+   pipe->delete_compute_state(pipe, cs);
+   FREE(data);
+
+   return success;
+}
+
+
+#define FB_WIDTH 37
+#define FB_HEIGHT 21
+
+
+static const char fragment_vs_text[] =
+   "VERT\n"
+   "DCL IN[0]\n"
+   "DCL OUT[0], POSITION\n"
+   "  0: MOV OUT[0], IN[0]\n"
+   "  1: END\n";
+
+/* Increments the dword of the pixel. */
+static const char fragment_fs_text[] =
+   "FRAG\n"
+   "%s"
+   "DCL IN[0], POSITION, LINEAR\n"
+   "DCL BUFFER[0]\n"
+   "DCL TEMP[0]\n"
+   "IMM[0] UINT32 {%u, 4, 1, 0}\n"
+   "  0: F2U TEMP[0].xy, IN[0].xyyy\n"
+   "  1: UMAD TEMP[0].x, TEMP[0].yyyy, IMM[0].xxxx, TEMP[0].xxxx\n"
+   "  2: UMUL TEMP[0].x, TEMP[0].xxxx, IMM[0].yyyy\n"
+   "  3: ATOMUADD TEMP[0].x, BUFFER[0], TEMP[0].xxxx, IMM[0].zzzz\n"
+   "  4: END\n";
+
+
+/**
+ * Draw a quad over the whole framebuffer behind the cleared depth buffer.
+ * The fragment shader must run once for each pixel, unless it asks for
+ * early depth tests.
+ */
+static boolean
+test_fragment(unsigned verbose, FILE *fp,
+              struct pipe_context *pipe,
+              boolean early_tests)
+{
+   static const float vertices[4][4] = {
+      { -1.0f, -1.0f, 0.5f, 1.0f },
+      {  1.0f, -1.0f, 0.5f, 1.0f },
+      { -1.0f,  1.0f, 0.5f, 1.0f },
+      {  1.0f,  1.0f, 0.5f, 1.0f },
+   };
+   const char *name = early_tests ? "fragment_early_tests" : "fragment";
+   struct pipe_screen *screen = pipe->screen;
+   struct tgsi_token vs_tokens[256], fs_tokens[256];
+   char fs_text[1024];
+   struct pipe_shader_state shader;
+   struct pipe_resource templ;
+   struct pipe_resource *cbuf, *zsbuf;
+   struct pipe_surface surf_templ, *cbuf_surf, *zsbuf_surf;
+   struct pipe_framebuffer_state fb;
+   struct pipe_rasterizer_state rast;
+   struct pipe_blend_state blend;
+   struct pipe_depth_stencil_alpha_state dsa;
+   struct pipe_vertex_element velem;
+   struct pipe_vertex_buffer vbuf;
+   struct pipe_viewport_state viewport;
+   struct pipe_shader_buffer ssbo;
+   struct pipe_draw_info info;
+   void *vs, *fs, *rast_handle, *blend_handle, *dsa_handle, *velem_handle;
+   unsigned size = FB_WIDTH * FB_HEIGHT * 4;
+   uint32_t *data;
+   boolean success = TRUE;
+   unsigned i;
+
+   snprintf(fs_text, sizeof fs_text, fragment_fs_text,
+            early_tests ? "PROPERTY FS_EARLY_DEPTH_STENCIL 1\n" : "",
+            FB_WIDTH);
+   if (!tgsi_text_translate(fragment_vs_text, vs_tokens, ARRAY_SIZE(vs_tokens)) ||
+       !tgsi_text_translate(fs_text, fs_tokens, ARRAY_SIZE(fs_tokens))) {
+      fprintf(stderr, "%s: failed to translate the shaders\n", name);
+      return FALSE;
+   }
+
+   memset(&templ, 0, sizeof templ);
+   templ.target = PIPE_TEXTURE_2D;
+   templ.format = PIPE_FORMAT_B8G8R8A8_UNORM;
+   templ.width0 = FB_WIDTH;
+   templ.height0 = FB_HEIGHT;
+   templ.depth0 = 1;
+   templ.array_size = 1;
+   templ.bind = PIPE_BIND_RENDER_TARGET;
+   cbuf = screen->resource_create(screen, &templ);
+   templ.format = PIPE_FORMAT_Z32_FLOAT;
+   templ.bind = PIPE_BIND_DEPTH_STENCIL;
+   zsbuf = screen->resource_create(screen, &templ);
+
+   memset(&surf_templ, 0, sizeof surf_templ);
+   surf_templ.format = cbuf->format;
+   cbuf_surf = pipe->create_surface(pipe, cbuf, &surf_templ);
+   surf_templ.format = zsbuf->format;
+   zsbuf_surf = pipe->create_surface(pipe, zsbuf, &surf_templ);
+
+   memset(&fb, 0, sizeof fb);
+   fb.width = FB_WIDTH;
+   fb.height = FB_HEIGHT;
+   fb.nr_cbufs = 1;
+   fb.cbufs[0] = cbuf_surf;
+   fb.zsbuf = zsbuf_surf;
+   pipe->set_framebuffer_state(pipe, &fb);
+   pipe->clear(pipe, PIPE_CLEAR_DEPTH, NULL, 0.0, 0);
+
+   memset(&rast, 0, sizeof rast);
+   rast.half_pixel_center = 1;
+   rast.depth_clip_near = 1;
+   rast.depth_clip_far = 1;
+   rast_handle = pipe->create_rasterizer_state(pipe, &rast);
+   pipe->bind_rasterizer_state(pipe, rast_handle);
+
+   memset(&blend, 0, sizeof blend);
+   blend_handle = pipe->create_blend_state(pipe, &blend);
+   pipe->bind_blend_state(pipe, blend_handle);
+
+   memset(&dsa, 0, sizeof dsa);
+   dsa.depth.enabled = 1;
+   dsa.depth.writemask = 1;
+   dsa.depth.func = PIPE_FUNC_LESS;
+   dsa_handle = pipe->create_depth_stencil_alpha_state(pipe, &dsa);
+   pipe->bind_depth_stencil_alpha_state(pipe, dsa_handle);
+
+   pipe->set_sample_mask(pipe, ~0);
+
+   memset(&viewport, 0, sizeof viewport);
+   viewport.scale[0] = FB_WIDTH / 2.0f;
+   viewport.scale[1] = FB_HEIGHT / 2.0f;
+   viewport.scale[2] = 1.0f;
+   viewport.translate[0] = FB_WIDTH / 2.0f;
+   viewport.translate[1] = FB_HEIGHT / 2.0f;
+   pipe->set_viewport_states(pipe, 0, 1, &viewport);
+
+   memset(&velem, 0, sizeof velem);
+   velem.src_format = PIPE_FORMAT_R32G32B32A32_FLOAT;
+   velem_handle = pipe->create_vertex_elements_state(pipe, 1, &velem);
+   pipe->bind_vertex_elements_state(pipe, velem_handle);
+
+   memset(&vbuf, 0, sizeof vbuf);
+   vbuf.stride = sizeof vertices[0];
+   vbuf.is_user_buffer = true;
+   vbuf.buffer.user = vertices;
+   pipe->set_vertex_buffers(pipe, 0, 1, &vbuf);
+
+   memset(&shader, 0, sizeof shader);
+   shader.type = PIPE_SHADER_IR_TGSI;
+   shader.tokens = vs_tokens;
+   vs = pipe->create_vs_state(pipe, &shader);
+   pipe->bind_vs_state(pipe, vs);
+   shader.tokens = fs_tokens;
+   fs = pipe->create_fs_state(pipe, &shader);
+   pipe->bind_fs_state(pipe, fs);
+
+   data = CALLOC(size, 1);
+   memset(&ssbo, 0, sizeof ssbo);
+   ssbo.buffer = pipe_buffer_create(screen, PIPE_BIND_SHADER_BUFFER,
+                                    PIPE_USAGE_DEFAULT, size);
+   ssbo.buffer_size = size;
+   pipe_buffer_write(pipe, ssbo.buffer, 0, size, data);
+   pipe->set_shader_buffers(pipe, PIPE_SHADER_FRAGMENT, 0, 1, &ssbo);
+
+   memset(&info, 0, sizeof info);
+   info.mode = PIPE_PRIM_TRIANGLE_STRIP;
+   info.count = 4;
+   info.instance_count = 1;
+   info.max_index = 3;
+   pipe->draw_vbo(pipe, &info);
+
+   /* Mapping the buffer must wait for the shader writes. */
+   pipe_buffer_read(pipe, ssbo.buffer, 0, size, data);
+
+   for (i = 0; i < size / 4; i++) {
+      uint32_t expected = early_tests ? 0 : 1;
+
+      if (data[i] != expected) {
+         if (verbose || success)
+            fprintf(stderr, "%s: pixel %u, %u is %u, expected %u\n",
+                    name, i % FB_WIDTH, i / FB_WIDTH, data[i], expected);
+         success = FALSE;
+      }
+   }
+
+   if (verbose)
+      printf("%s: %s\n", name, success ? "pass" : "fail");
+
+   if (fp)
+      write_tsv_row(fp, name, success);
+
+   pipe->set_shader_buffers(pipe, PIPE_SHADER_FRAGMENT, 0, 1, NULL);
+   pipe_resource_reference(&ssbo.buffer, NULL);
+   FREE(data);
+
+   pipe->bind_fs_state(pipe, NULL);
+   pipe->delete_fs_state(pipe, fs);
+   pipe->bind_vs_state(pipe, NULL);
+   pipe->delete_vs_state(pipe, vs);
+   pipe->set_vertex_buffers(pipe, 0, 1, NULL);
+   pipe->bind_vertex_elements_state(pipe, NULL);
+   pipe->delete_vertex_elements_state(pipe, velem_handle);
+   pipe->bind_depth_stencil_alpha_state(pipe, NULL);
+   pipe->delete_depth_stencil_alpha_state(pipe, dsa_handle);
+   pipe->bind_blend_state(pipe, NULL);
+   pipe->delete_blend_state(pipe, blend_handle);
+   pipe->bind_rasterizer_state(pipe, NULL);
+   pipe->delete_rasterizer_state(pipe, rast_handle);
+
+   memset(&fb, 0, sizeof fb);
+   pipe->set_framebuffer_state(pipe, &fb);
+   pipe_surface_reference(&cbuf_surf, NULL);
+   pipe_surface_reference(&zsbuf_surf, NULL);
+   pipe_resource_reference(&cbuf, NULL);
+   pipe_resource_reference(&zsbuf, NULL);
+
+   return success;
+}
+
+
+static boolean
+test_cases_range(unsigned verbose, FILE *fp,
+                 unsigned first, unsigned count,
+                 boolean fragment)
+{
+   struct pipe_screen *screen;
+   struct pipe_context *pipe;
+   boolean success = TRUE;
+   unsigned i;
+
+   screen = llvmpipe_create_screen(null_sw_create());
+   if (!screen)
+      return FALSE;
+
+   if (!screen->get_param(screen, PIPE_CAP_COMPUTE)) {
+      printf("compute shaders aren't supported, skipping\n");
+      screen->destroy(screen);
+      return TRUE;
+   }
+
+   pipe = screen->context_create(screen, NULL, 0);
+
+   for (i = first; i < first + count; i++) {
+      if (!test_one(verbose, fp, pipe, &test_cases[i]))
+         success = FALSE;
+   }
+
+   if (fragment &&
+       screen->get_shader_param(screen, PIPE_SHADER_FRAGMENT,
+                                PIPE_SHADER_CAP_MAX_SHADER_BUFFERS)) {
+      if (!test_fragment(verbose, fp, pipe, FALSE))
+         success = FALSE;
+      if (!test_fragment(verbose, fp, pipe, TRUE))
+         success = FALSE;
+   }
+
+   pipe->destroy(pipe);
+   screen->destroy(screen);
+
+   return success;
+}
+
+
+boolean
+test_all(unsigned verbose, FILE *fp)
+{
+   return test_cases_range(verbose, fp, 0, ARRAY_SIZE(test_cases), TRUE);
+}
+
+
+boolean
+test_some(unsigned verbose, FILE *fp,
+          unsigned long n)
+{
+   return test_all(verbose, fp);
+}
+
+
+boolean
+test_single(unsigned verbose, FILE *fp)
+{
+   return test_cases_range(verbose, fp, 1, 1, FALSE);
+}
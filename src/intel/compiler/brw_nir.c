@@ -516,6 +516,11 @@ brw_nir_lower_fs_outputs(nir_shader *nir)
    this_progress;                                          \
 })
 
+#define LOOP_OPT(pass, ...) ({                             \
+   NIR_LOOP_PASS(&loop, nir, pass, ##__VA_ARGS__);         \
+   loop.pass_progress;                                     \
+})
+
 static nir_variable_mode
 brw_nir_no_indirect_mask(const struct brw_compiler *compiler,
                          gl_shader_stage stage)
@@ -539,36 +544,37 @@ brw_nir_optimize(nir_shader *nir, const struct brw_compiler *compiler,
    nir_variable_mode indirect_mask =
       brw_nir_no_indirect_mask(compiler, nir->info.stage);
 
-   bool progress;
+   nir_pass_loop loop;
+   nir_pass_loop_init(&loop);
    do {
-      progress = false;
-      OPT(nir_split_array_vars, nir_var_function_temp);
-      OPT(nir_shrink_vec_array_vars, nir_var_function_temp);
-      OPT(nir_opt_deref);
-      OPT(nir_lower_vars_to_ssa);
+      LOOP_OPT(nir_split_array_vars, nir_var_function_temp);
+      LOOP_OPT(nir_shrink_vec_array_vars, nir_var_function_temp);
+      LOOP_OPT(nir_opt_deref);
+      LOOP_OPT(nir_lower_vars_to_ssa);
       if (allow_copies) {
          /* Only run this pass in the first call to brw_nir_optimize.  Later
           * calls assume that we've lowered away any copy_deref instructions
           * and we don't want to introduce any more.
           */
-         OPT(nir_opt_find_array_copies);
+         LOOP_OPT(nir_opt_find_array_copies);
       }
-      OPT(nir_opt_copy_prop_vars);
-      OPT(nir_opt_dead_write_vars);
+      LOOP_OPT(nir_opt_copy_prop_vars);
+      LOOP_OPT(nir_opt_dead_write_vars);
 
       if (is_scalar) {
-         OPT(nir_lower_alu_to_scalar);
+         LOOP_OPT(nir_lower_alu_to_scalar);
       }
 
-      OPT(nir_copy_prop);
+      LOOP_OPT(nir_copy_prop);
 
       if (is_scalar) {
-         OPT(nir_lower_phis_to_scalar);
+         LOOP_OPT(nir_lower_phis_to_scalar);
       }
 
-      OPT(nir_copy_prop);
-      OPT(nir_opt_dce);
-      OPT(nir_opt_cse);
+      LOOP_OPT(nir_copy_prop);
+      LOOP_OPT(nir_opt_dce);
+      LOOP_OPT(nir_opt_cse);
+      LOOP_OPT(nir_opt_gvn_pre);
 
       /* Passing 0 to the peephole select pass causes it to convert
        * if-statements that contain only move instructions in the branches
@@ -590,31 +596,33 @@ brw_nir_optimize(nir_shader *nir, const struct brw_compiler *compiler,
       const bool is_vec4_tessellation = !is_scalar &&
          (nir->info.stage == MESA_SHADER_TESS_CTRL ||
           nir->info.stage == MESA_SHADER_TESS_EVAL);
-      OPT(nir_opt_peephole_select, 0, !is_vec4_tessellation, false);
-      OPT(nir_opt_peephole_select, 1, !is_vec4_tessellation,
-          compiler->devinfo->gen >= 6);
-
-      OPT(nir_opt_intrinsics);
-      OPT(nir_opt_idiv_const, 32);
-      OPT(nir_opt_algebraic);
-      OPT(nir_opt_constant_folding);
-      OPT(nir_opt_dead_cf);
-      if (OPT(nir_opt_trivial_continues)) {
+      LOOP_OPT(nir_opt_peephole_select, 0, !is_vec4_tessellation, false);
+      LOOP_OPT(nir_opt_peephole_select, 1, !is_vec4_tessellation,
+               compiler->devinfo->gen >= 6);
+
+      LOOP_OPT(nir_opt_intrinsics);
+      LOOP_OPT(nir_opt_idiv_const, 32);
+      LOOP_OPT(nir_opt_algebraic);
+      LOOP_OPT(nir_opt_constant_folding);
+      LOOP_OPT(nir_opt_dead_cf);
+      if (LOOP_OPT(nir_opt_trivial_continues)) {
          /* If nir_opt_trivial_continues makes progress, then we need to clean
           * things up if we want any hope of nir_opt_if or nir_opt_loop_unroll
           * to make progress.
           */
-         OPT(nir_copy_prop);
-         OPT(nir_opt_dce);
+         LOOP_OPT(nir_copy_prop);
+         LOOP_OPT(nir_opt_dce);
       }
-      OPT(nir_opt_if);
+      LOOP_OPT(nir_opt_if);
       if (nir->options->max_unroll_iterations != 0) {
-         OPT(nir_opt_loop_unroll, indirect_mask);
+         LOOP_OPT(nir_opt_loop_unroll, indirect_mask);
       }
-      OPT(nir_opt_remove_phis);
-      OPT(nir_opt_undef);
-      OPT(nir_lower_pack);
-   } while (progress);
+      LOOP_OPT(nir_opt_remove_phis);
+      LOOP_OPT(nir_opt_undef);
+      LOOP_OPT(nir_lower_pack);
+   } while (nir_pass_loop_continue(&loop));
+
+   UNUSED bool progress; /* Written by OPT */
 
    /* Workaround Gfxbench unused local sampler variable which will trigger an
     * assert in the opt_large_constants pass.
@@ -643,6 +651,21 @@ lower_bit_size_callback(const nir_alu_instr *alu, UNUSED void *data)
    }
 }
 
+/* Untyped surface and A64 messages read or write up to four dwords at a
+ * dword-aligned address.
+ */
+static bool
+brw_nir_should_vectorize_mem(unsigned align, unsigned bit_size,
+                             unsigned num_components,
+                             nir_intrinsic_instr *low,
+                             nir_intrinsic_instr *high)
+{
+   if (bit_size != 32 || num_components > 4)
+      return false;
+
+   return align >= 4;
+}
+
 /* Does some simple lowering and runs the standard suite of optimizations
  *
  * This is intended to be called more-or-less directly after you get the
@@ -792,6 +815,11 @@ brw_preprocess_nir(const struct brw_compiler *compiler, nir_shader *nir)
       brw_nir_no_indirect_mask(compiler, nir->info.stage);
    OPT(nir_lower_indirect_derefs, indirect_mask);
 
+   OPT(nir_opt_load_store_vectorize,
+       nir_var_mem_ubo | nir_var_mem_ssbo |
+       nir_var_mem_shared | nir_var_mem_global,
+       brw_nir_should_vectorize_mem);
+
    OPT(brw_nir_lower_mem_access_bit_sizes);
 
    /* Get rid of split copies */
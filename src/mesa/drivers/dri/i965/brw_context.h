@@ -331,6 +331,12 @@ struct brw_program {
    GLuint id;
 
    bool compiled_once;
+
+   /**
+    * Whether brw_disk_cache_prefetch_render_programs() already looked for
+    * the binary of this program in the disk cache.
+    */
+   bool disk_cache_prefetched;
 };
 
 
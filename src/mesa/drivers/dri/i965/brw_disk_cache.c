@@ -83,36 +83,42 @@ read_blob_program_data(struct blob_reader *binary, struct gl_program *prog,
       (binary->current == binary->end);
 }
 
-static bool
-read_and_upload(struct brw_context *brw, struct disk_cache *cache,
-                struct gl_program *prog, gl_shader_stage stage)
+static void
+populate_key(struct brw_context *brw, gl_shader_stage stage,
+             union brw_any_prog_key *prog_key)
 {
-   unsigned char binary_sha1[20];
-
-   union brw_any_prog_key prog_key;
-
    switch (stage) {
    case MESA_SHADER_VERTEX:
-      brw_vs_populate_key(brw, &prog_key.vs);
+      brw_vs_populate_key(brw, &prog_key->vs);
       break;
    case MESA_SHADER_TESS_CTRL:
-      brw_tcs_populate_key(brw, &prog_key.tcs);
+      brw_tcs_populate_key(brw, &prog_key->tcs);
       break;
    case MESA_SHADER_TESS_EVAL:
-      brw_tes_populate_key(brw, &prog_key.tes);
+      brw_tes_populate_key(brw, &prog_key->tes);
       break;
    case MESA_SHADER_GEOMETRY:
-      brw_gs_populate_key(brw, &prog_key.gs);
+      brw_gs_populate_key(brw, &prog_key->gs);
       break;
    case MESA_SHADER_FRAGMENT:
-      brw_wm_populate_key(brw, &prog_key.wm);
+      brw_wm_populate_key(brw, &prog_key->wm);
       break;
    case MESA_SHADER_COMPUTE:
-      brw_cs_populate_key(brw, &prog_key.cs);
+      brw_cs_populate_key(brw, &prog_key->cs);
       break;
    default:
       unreachable("Unsupported stage!");
    }
+}
+
+static bool
+read_and_upload(struct brw_context *brw, struct disk_cache *cache,
+                struct gl_program *prog, gl_shader_stage stage)
+{
+   unsigned char binary_sha1[20];
+
+   union brw_any_prog_key prog_key;
+   populate_key(brw, stage, &prog_key);
 
    /* We don't care what instance of the program it is for the disk cache hash
     * lookup, so set the id to 0 for the sha1 hashing. program_string_id will
@@ -259,6 +265,73 @@ fail:
    return false;
 }
 
+/**
+ * Start reading the binaries of all the render stages which will need one
+ * from the disk cache, so that brw_disk_cache_upload_program() doesn't have
+ * to wait for the disk once per stage.
+ *
+ * The keys computed here may be out of date for the later stages (the FS key
+ * depends on the VUE map of the previous stage, for example), in which case
+ * the prefetch is simply wasted.
+ *
+ * Each program is only considered the first time it is bound, which is when
+ * its binary is read from the disk cache, so that later draws don't pay for
+ * computing its key and looking it up in the program cache.
+ */
+void
+brw_disk_cache_prefetch_render_programs(struct brw_context *brw)
+{
+   static const enum brw_cache_id cache_ids[] = {
+      BRW_CACHE_VS_PROG, BRW_CACHE_TCS_PROG, BRW_CACHE_TES_PROG,
+      BRW_CACHE_GS_PROG, BRW_CACHE_FS_PROG,
+   };
+   struct disk_cache *cache = brw->ctx.Cache;
+   if (cache == NULL)
+      return;
+
+   if (brw->ctx._Shader->Flags & GLSL_CACHE_FALLBACK)
+      return;
+
+   /* Nothing to do unless a program changed. */
+   if (!brw_state_dirty(brw, 0,
+                        BRW_NEW_VERTEX_PROGRAM |
+                        BRW_NEW_TESS_PROGRAMS |
+                        BRW_NEW_GEOMETRY_PROGRAM |
+                        BRW_NEW_FRAGMENT_PROGRAM))
+      return;
+
+   cache_key keys[ARRAY_SIZE(cache_ids)];
+   unsigned num_keys = 0;
+
+   for (gl_shader_stage stage = MESA_SHADER_VERTEX;
+        stage <= MESA_SHADER_FRAGMENT; stage++) {
+      struct gl_program *prog = brw->ctx._Shader->CurrentProgram[stage];
+      if (prog == NULL || brw->programs[stage] == NULL ||
+          brw_program(prog)->disk_cache_prefetched)
+         continue;
+
+      brw_program(prog)->disk_cache_prefetched = true;
+
+      union brw_any_prog_key prog_key;
+      populate_key(brw, stage, &prog_key);
+
+      /* Skip the stages which won't go to the disk cache. */
+      uint32_t offset = 0;
+      void *prog_data = NULL;
+      if (brw_search_cache(&brw->cache, cache_ids[stage], &prog_key,
+                           brw_prog_key_size(stage), &offset, &prog_data,
+                           false))
+         continue;
+
+      brw_prog_key_set_id(&prog_key, stage, 0);
+      gen_shader_sha1(prog, stage, &prog_key, keys[num_keys++]);
+   }
+
+   /* A single stage is read just as fast by disk_cache_get(). */
+   if (num_keys > 1)
+      disk_cache_prefetch(cache, keys, num_keys);
+}
+
 static void
 write_program_data(struct brw_context *brw, struct gl_program *prog,
                    void *key, struct brw_stage_prog_data *prog_data,
@@ -38,6 +38,47 @@
 #include "glheader.h"
 #include "hash.h"
 #include "util/hash_table.h"
+#include "util/u_atomic.h"
+
+
+/**
+ * Bounds of the direct array.  It starts at DIRECT_MIN_SIZE names and
+ * doubles as needed, but only while at least a quarter of it would be in
+ * use, so that a few large names don't blow it up.
+ */
+#define DIRECT_MIN_SIZE 256
+#define DIRECT_MAX_SIZE (1 << 20)
+
+/**
+ * Whether _mesa_HashLookup() reads the direct array without the mutex.
+ * That needs the array and entry stores to be ordered before the pointers
+ * to them are published, and the loads to be ordered after the pointers
+ * are loaded, which p_atomic_set() and p_atomic_read() only guarantee with
+ * the builtins that have an explicit memory model.  With the other atomic
+ * implementations the lookups take the mutex.
+ */
+#if defined(PIPE_ATOMIC_GCC_INTRINSIC) && defined(USE_GCC_ATOMIC_BUILTINS)
+#define DIRECT_LOCKLESS_LOOKUP 1
+#else
+#define DIRECT_LOCKLESS_LOOKUP 0
+#endif
+
+/**
+ * Array of the entries with names below Size, indexed by name.  NULL means
+ * there is no entry.
+ *
+ * _mesa_HashLookup() may read the array without locking (see
+ * DIRECT_LOCKLESS_LOOKUP), so once an array is
+ * published in _mesa_HashTable::Direct it is never resized or freed while
+ * the table exists.  Growing it publishes a copy instead, and keeps the old
+ * one around in Prev.  The arrays only double, so all of them together
+ * take less than twice the memory of the last one.
+ */
+struct _mesa_HashDirect {
+   GLuint Size;
+   struct _mesa_HashDirect *Prev;
+   void *Data[];
+};
 
 
 /**
@@ -51,15 +92,13 @@ _mesa_NewHashTable(void)
    struct _mesa_HashTable *table = CALLOC_STRUCT(_mesa_HashTable);
 
    if (table) {
-      table->ht = _mesa_hash_table_create(NULL, uint_key_hash,
-                                          uint_key_compare);
+      table->ht = _mesa_hash_table_u64_create(NULL);
       if (table->ht == NULL) {
          free(table);
          _mesa_error_no_memory(__func__);
          return NULL;
       }
 
-      _mesa_hash_table_set_deleted_key(table->ht, uint_key(DELETED_KEY_VALUE));
       /*
        * Needs to be recursive, since the callback in _mesa_HashWalk()
        * is allowed to call _mesa_HashRemove().
@@ -86,13 +125,22 @@ _mesa_NewHashTable(void)
 void
 _mesa_DeleteHashTable(struct _mesa_HashTable *table)
 {
+   struct _mesa_HashDirect *direct;
+
    assert(table);
 
-   if (_mesa_hash_table_next_entry(table->ht, NULL) != NULL) {
+   if (_mesa_HashNumEntries(table) != 0) {
       _mesa_problem(NULL, "In _mesa_DeleteHashTable, found non-freed data");
    }
 
-   _mesa_hash_table_destroy(table->ht, NULL);
+   _mesa_hash_table_u64_destroy(table->ht, NULL);
+
+   direct = table->Direct;
+   while (direct) {
+      struct _mesa_HashDirect *prev = direct->Prev;
+      free(direct);
+      direct = prev;
+   }
 
    mtx_destroy(&table->Mutex);
    free(table);
@@ -107,27 +155,30 @@ _mesa_DeleteHashTable(struct _mesa_HashTable *table)
 static inline void *
 _mesa_HashLookup_unlocked(struct _mesa_HashTable *table, GLuint key)
 {
-   const struct hash_entry *entry;
+   const struct _mesa_HashDirect *direct = table->Direct;
 
    assert(table);
    assert(key);
 
-   if (key == DELETED_KEY_VALUE)
-      return table->deleted_key_data;
+   if (direct && key < direct->Size)
+      return direct->Data[key];
 
-   entry = _mesa_hash_table_search_pre_hashed(table->ht,
-                                              uint_hash(key),
-                                              uint_key(key));
-   if (!entry)
-      return NULL;
-
-   return entry->data;
+   return _mesa_hash_table_u64_search(table->ht, key);
 }
 
 
 /**
  * Lookup an entry in the hash table.
- * 
+ *
+ * Names covered by the direct array are looked up without taking the
+ * mutex.  The array pointer and the entry are each read once, so the result
+ * is what the table held at some point during the call, as if the lookup had
+ * been ordered before or after a concurrent insert or remove.
+ *
+ * A name past the end of the array we loaded may have been moved into a
+ * newer array by the time we get to the hash table, so the locked path
+ * looks at the current array again.
+ *
  * \param table the hash table.
  * \param key the key.
  * 
@@ -137,6 +188,16 @@ void *
 _mesa_HashLookup(struct _mesa_HashTable *table, GLuint key)
 {
    void *res;
+
+   assert(key);
+
+   if (DIRECT_LOCKLESS_LOOKUP) {
+      const struct _mesa_HashDirect *direct = p_atomic_read(&table->Direct);
+
+      if (likely(direct && key < direct->Size))
+         return p_atomic_read(&direct->Data[key]);
+   }
+
    _mesa_HashLockMutex(table);
    res = _mesa_HashLookup_unlocked(table, key);
    _mesa_HashUnlockMutex(table);
@@ -162,11 +223,66 @@ _mesa_HashLookupLocked(struct _mesa_HashTable *table, GLuint key)
 }
 
 
+/**
+ * Replaces the direct array with one that covers the given key, and moves
+ * the entries it now covers out of the hash table.
+ *
+ * \return false if the array would be too large or sparse, in which case
+ *         the key stays in the hash table.
+ */
+static bool
+direct_grow(struct _mesa_HashTable *table, GLuint key)
+{
+   struct _mesa_HashDirect *old = table->Direct;
+   struct _mesa_HashDirect *direct;
+   GLuint old_size = old ? old->Size : 0;
+   GLuint size = MAX2(old_size, DIRECT_MIN_SIZE);
+
+   /* Walks index the array they started with, and would miss the entries
+    * moved out of the hash table.
+    */
+   if (key >= DIRECT_MAX_SIZE || table->WalkDepth)
+      return false;
+
+   while (size <= key)
+      size *= 2;
+
+   if (size > DIRECT_MIN_SIZE && size / 4 > _mesa_HashNumEntries(table) + 1)
+      return false;
+
+   direct = malloc(sizeof(*direct) + size * sizeof(direct->Data[0]));
+   if (!direct)
+      return false;
+
+   direct->Size = size;
+   direct->Prev = old;
+   if (old)
+      memcpy(direct->Data, old->Data, old_size * sizeof(direct->Data[0]));
+   memset(direct->Data + old_size, 0,
+          (size - old_size) * sizeof(direct->Data[0]));
+
+   hash_table_u64_foreach(table->ht, entry) {
+      if (entry->key < size) {
+         direct->Data[entry->key] = entry->data;
+         table->NumDirect++;
+         _mesa_hash_table_u64_remove_entry(table->ht, entry);
+      }
+   }
+
+   /* Readers that still have the old array keep seeing valid entries, and
+    * the ones that missed in it will find the moved names in the new one
+    * once they get the mutex.
+    */
+   p_atomic_set(&table->Direct, direct);
+
+   return true;
+}
+
+
 static inline void
 _mesa_HashInsert_unlocked(struct _mesa_HashTable *table, GLuint key, void *data)
 {
-   uint32_t hash = uint_hash(key);
-   struct hash_entry *entry;
+   struct _mesa_HashDirect *direct = table->Direct;
 
    assert(table);
    assert(key);
@@ -174,15 +290,13 @@ _mesa_HashInsert_unlocked(struct _mesa_HashTable *table, GLuint key, void *data)
    if (key > table->MaxKey)
       table->MaxKey = key;
 
-   if (key == DELETED_KEY_VALUE) {
-      table->deleted_key_data = data;
+   if ((direct && key < direct->Size) || direct_grow(table, key)) {
+      direct = table->Direct;
+      table->NumDirect += !direct->Data[key];
+      table->NumDirect -= !data;
+      p_atomic_set(&direct->Data[key], data);
    } else {
-      entry = _mesa_hash_table_search_pre_hashed(table->ht, hash, uint_key(key));
-      if (entry) {
-         entry->data = data;
-      } else {
-         _mesa_hash_table_insert_pre_hashed(table->ht, hash, uint_key(key), data);
-      }
+      _mesa_hash_table_u64_insert(table->ht, key, data);
    }
 }
 
@@ -234,7 +348,7 @@ _mesa_HashInsert(struct _mesa_HashTable *table, GLuint key, void *data)
 static inline void
 _mesa_HashRemove_unlocked(struct _mesa_HashTable *table, GLuint key)
 {
-   struct hash_entry *entry;
+   struct _mesa_HashDirect *direct = table->Direct;
 
    assert(table);
    assert(key);
@@ -244,13 +358,13 @@ _mesa_HashRemove_unlocked(struct _mesa_HashTable *table, GLuint key)
     */
    assert(!table->InDeleteAll);
 
-   if (key == DELETED_KEY_VALUE) {
-      table->deleted_key_data = NULL;
+   if (direct && key < direct->Size) {
+      if (direct->Data[key]) {
+         table->NumDirect--;
+         p_atomic_set(&direct->Data[key], NULL);
+      }
    } else {
-      entry = _mesa_hash_table_search_pre_hashed(table->ht,
-                                                 uint_hash(key),
-                                                 uint_key(key));
-      _mesa_hash_table_remove(table->ht, entry);
+      _mesa_hash_table_u64_remove(table->ht, key);
    }
 }
 
@@ -286,13 +400,22 @@ _mesa_HashDeleteAll(struct _mesa_HashTable *table,
    assert(callback);
    _mesa_HashLockMutex(table);
    table->InDeleteAll = GL_TRUE;
-   hash_table_foreach(table->ht, entry) {
-      callback((uintptr_t)entry->key, entry->data, userData);
-      _mesa_hash_table_remove(table->ht, entry);
+   if (table->Direct) {
+      struct _mesa_HashDirect *direct = table->Direct;
+
+      for (GLuint key = 1; key < direct->Size; key++) {
+         void *data = direct->Data[key];
+
+         if (data) {
+            callback(key, data, userData);
+            p_atomic_set(&direct->Data[key], NULL);
+         }
+      }
+      table->NumDirect = 0;
    }
-   if (table->deleted_key_data) {
-      callback(DELETED_KEY_VALUE, table->deleted_key_data, userData);
-      table->deleted_key_data = NULL;
+   hash_table_u64_foreach(table->ht, entry) {
+      callback(entry->key, entry->data, userData);
+      _mesa_hash_table_u64_remove_entry(table->ht, entry);
    }
    table->InDeleteAll = GL_FALSE;
    _mesa_HashUnlockMutex(table);
@@ -311,14 +434,31 @@ hash_walk_unlocked(const struct _mesa_HashTable *table,
                    void (*callback)(GLuint key, void *data, void *userData),
                    void *userData)
 {
+   /* cast-away const */
+   struct _mesa_HashTable *table2 = (struct _mesa_HashTable *) table;
+   const struct _mesa_HashDirect *direct = table->Direct;
+
    assert(table);
    assert(callback);
 
-   hash_table_foreach(table->ht, entry) {
-      callback((uintptr_t)entry->key, entry->data, userData);
+   /* The callback may insert names.  Keep the direct array from growing
+    * meanwhile, which would move entries of the hash table below the names
+    * already walked.
+    */
+   table2->WalkDepth++;
+
+   for (GLuint key = 1; direct && key < direct->Size; key++) {
+      void *data = direct->Data[key];
+
+      if (data)
+         callback(key, data, userData);
+   }
+
+   hash_table_u64_foreach(table->ht, entry) {
+      callback(entry->key, entry->data, userData);
    }
-   if (table->deleted_key_data)
-      callback(DELETED_KEY_VALUE, table->deleted_key_data, userData);
+
+   table2->WalkDepth--;
 }
 
 
@@ -357,8 +497,6 @@ debug_print_entry(GLuint key, void *data, void *userData)
 void
 _mesa_HashPrint(const struct _mesa_HashTable *table)
 {
-   if (table->deleted_key_data)
-      debug_print_entry(DELETED_KEY_VALUE, table->deleted_key_data, NULL);
    _mesa_HashWalk(table, debug_print_entry, NULL);
 }
 
@@ -415,12 +553,5 @@ _mesa_HashFindFreeKeyBlock(struct _mesa_HashTable *table, GLuint numKeys)
 GLuint
 _mesa_HashNumEntries(const struct _mesa_HashTable *table)
 {
-   GLuint count = 0;
-
-   if (table->deleted_key_data)
-      count++;
-
-   count += _mesa_hash_table_num_entries(table->ht);
-
-   return count;
+   return table->NumDirect + _mesa_hash_table_u64_num_entries(table->ht);
 }
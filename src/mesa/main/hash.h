@@ -36,73 +36,28 @@
 #include "imports.h"
 #include "c11/threads.h"
 
-/**
- * Magic GLuint object name that gets stored outside of the struct hash_table.
- *
- * The hash table needs a particular pointer to be the marker for a key that
- * was deleted from the table, along with NULL for the "never allocated in the
- * table" marker.  Legacy GL allows any GLuint to be used as a GL object name,
- * and we use a 1:1 mapping from GLuints to key pointers, so we need to be
- * able to track a GLuint that happens to match the deleted key outside of
- * struct hash_table.  We tell the hash table to use "1" as the deleted key
- * value, so that we test the deleted-key-in-the-table path as best we can.
- */
-#define DELETED_KEY_VALUE 1
-
-/** @{
- * Mapping from our use of GLuint as both the key and the hash value to the
- * hash_table.h API
- *
- * There exist many integer hash functions, designed to avoid collisions when
- * the integers are spread across key space with some patterns.  In GL, the
- * pattern (in the case of glGen*()ed object IDs) is that the keys are unique
- * contiguous integers starting from 1.  Because of that, we just use the key
- * as the hash value, to minimize the cost of the hash function.  If objects
- * are never deleted, we will never see a collision in the table, because the
- * table resizes itself when it approaches full, and thus key % table_size ==
- * key.
- *
- * The case where we could have collisions for genned objects would be
- * something like: glGenBuffers(&a, 100); glDeleteBuffers(&a + 50, 50);
- * glGenBuffers(&b, 100), because objects 1-50 and 101-200 are allocated at
- * the end of that sequence, instead of 1-150.  So far it doesn't appear to be
- * a problem.
- */
-static inline bool
-uint_key_compare(const void *a, const void *b)
-{
-   return a == b;
-}
-
-static inline uint32_t
-uint_hash(GLuint id)
-{
-   return id;
-}
+#ifdef __cplusplus
+extern "C" {
+#endif
 
-static inline uint32_t
-uint_key_hash(const void *key)
-{
-   return uint_hash((uintptr_t)key);
-}
-
-static inline void *
-uint_key(GLuint id)
-{
-   return (void *)(uintptr_t) id;
-}
-/** @} */
+struct _mesa_HashDirect;
 
 /**
  * The hash table data structure.
+ *
+ * Small names, which is what glGen* hands out, live in the Direct array
+ * indexed by name, which _mesa_HashLookup() reads without taking the mutex.
+ * Names past the end of the array go to the hash table.  Changes to either
+ * are serialised by the mutex.
  */
 struct _mesa_HashTable {
-   struct hash_table *ht;
+   struct _mesa_HashDirect *Direct;      /**< names below Direct->Size */
+   GLuint NumDirect;                     /**< entries in Direct */
+   struct hash_table_u64 *ht;            /**< all other names */
    GLuint MaxKey;                        /**< highest key inserted so far */
    mtx_t Mutex;                          /**< mutual exclusion lock */
    GLboolean InDeleteAll;                /**< Debug check */
-   /** Value that would be in the table for DELETED_KEY_VALUE. */
-   void *deleted_key_data;
+   GLuint WalkDepth;                     /**< Direct can't grow while > 0 */
 };
 
 extern struct _mesa_HashTable *_mesa_NewHashTable(void);
@@ -175,5 +130,9 @@ _mesa_HashNumEntries(const struct _mesa_HashTable *table);
 
 extern void _mesa_test_hash_functions(void);
 
+#ifdef __cplusplus
+}
+#endif
+
 
 #endif
@@ -0,0 +1,204 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * Measures GL name lookups the way contexts sharing objects do them: every
+ * thread binds objects from one shared table, while one thread optionally
+ * keeps generating and deleting names in it.
+ *
+ * Usage: hash_benchmark [lookups]
+ *
+ * Each thread does the given number of lookups (1M by default), and the
+ * result is the wall time divided by the lookups of all threads.  "locked"
+ * takes the table mutex around every lookup, which is what
+ * _mesa_HashLookup() used to do, and "lookup" calls _mesa_HashLookup().
+ */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "c11/threads.h"
+#include "main/hash.h"
+#include "util/os_time.h"
+#include "util/u_atomic.h"
+
+#define MAX_THREADS 8
+
+struct bench {
+   struct _mesa_HashTable *table;
+   GLuint *names;
+   unsigned num_names;
+   unsigned num_lookups;
+   bool locked;
+   int stop_writer;
+};
+
+struct object {
+   GLuint name;
+};
+
+static volatile uintptr_t sink;
+
+static int
+lookup_thread(void *data)
+{
+   struct bench *bench = data;
+   uint32_t seed = (uint32_t)(uintptr_t)&seed;
+   uintptr_t found = 0;
+
+   for (unsigned i = 0; i < bench->num_lookups; i++) {
+      GLuint name;
+      void *obj;
+
+      seed = seed * 1103515245 + 12345;
+      name = bench->names[(seed >> 8) % bench->num_names];
+
+      if (bench->locked) {
+         _mesa_HashLockMutex(bench->table);
+         obj = _mesa_HashLookupLocked(bench->table, name);
+         _mesa_HashUnlockMutex(bench->table);
+      } else {
+         obj = _mesa_HashLookup(bench->table, name);
+      }
+
+      found += (uintptr_t)obj;
+   }
+
+   sink = found;
+   return 0;
+}
+
+/* Generates and deletes names until told to stop, like a thread streaming
+ * buffers into the shared table.
+ */
+static int
+writer_thread(void *data)
+{
+   struct bench *bench = data;
+   struct object obj;
+
+   while (!p_atomic_read(&bench->stop_writer)) {
+      GLuint name = _mesa_HashFindFreeKeyBlock(bench->table, 1);
+
+      _mesa_HashInsert(bench->table, name, &obj);
+      _mesa_HashRemove(bench->table, name);
+   }
+
+   return 0;
+}
+
+static double
+run(struct bench *bench, unsigned num_threads, bool with_writer)
+{
+   thrd_t threads[MAX_THREADS];
+   thrd_t writer;
+   int64_t start, time;
+
+   p_atomic_set(&bench->stop_writer, 0);
+   if (with_writer)
+      thrd_create(&writer, writer_thread, bench);
+
+   start = os_time_get_nano();
+   for (unsigned i = 0; i < num_threads; i++)
+      thrd_create(&threads[i], lookup_thread, bench);
+   for (unsigned i = 0; i < num_threads; i++)
+      thrd_join(threads[i], NULL);
+   time = os_time_get_nano() - start;
+
+   if (with_writer) {
+      p_atomic_set(&bench->stop_writer, 1);
+      thrd_join(writer, NULL);
+   }
+
+   return (double)time / ((double)num_threads * bench->num_lookups);
+}
+
+static void
+run_names(const char *desc, GLuint *names, unsigned num_names,
+          unsigned num_lookups)
+{
+   static const unsigned threads[] = { 1, 2, 4, MAX_THREADS };
+   struct object *objects = calloc(num_names, sizeof(*objects));
+   struct bench bench = {
+      .table = _mesa_NewHashTable(),
+      .names = names,
+      .num_names = num_names,
+      .num_lookups = num_lookups,
+   };
+
+   for (unsigned i = 0; i < num_names; i++) {
+      objects[i].name = names[i];
+      _mesa_HashInsert(bench.table, names[i], &objects[i]);
+   }
+
+   for (unsigned w = 0; w < 2; w++) {
+      for (unsigned t = 0; t < ARRAY_SIZE(threads); t++) {
+         double locked, lookup;
+
+         bench.locked = true;
+         locked = run(&bench, threads[t], w);
+         bench.locked = false;
+         lookup = run(&bench, threads[t], w);
+
+         printf("%-8s %7u names %u threads%s: locked %8.2f, "
+                "lookup %8.2f ns/lookup\n", desc, num_names, threads[t],
+                w ? " + writer" : "         ", locked, lookup);
+      }
+   }
+
+   for (unsigned i = 0; i < num_names; i++)
+      _mesa_HashRemove(bench.table, names[i]);
+   _mesa_DeleteHashTable(bench.table);
+   free(objects);
+}
+
+int
+main(int argc, char **argv)
+{
+   static const unsigned sizes[] = { 64, 4096, 65536 };
+   unsigned num_lookups = 1 << 20;
+
+   if (argc > 1)
+      num_lookups = strtoul(argv[1], NULL, 0);
+
+   for (unsigned i = 0; i < ARRAY_SIZE(sizes); i++) {
+      GLuint *names = malloc(sizes[i] * sizeof(*names));
+
+      /* What glGen* hands out. */
+      for (unsigned j = 0; j < sizes[i]; j++)
+         names[j] = j + 1;
+      run_names("dense", names, sizes[i], num_lookups);
+
+      /* Application chosen names, as legacy GL allows. */
+      for (unsigned j = 0; j < sizes[i]; j++)
+         names[j] = (1u << 31) + j * 7919;
+      run_names("sparse", names, sizes[i], num_lookups);
+
+      free(names);
+   }
+
+   return 0;
+}
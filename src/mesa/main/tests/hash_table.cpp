@@ -0,0 +1,228 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#include <gtest/gtest.h>
+
+#include "c11/threads.h"
+#include "main/hash.h"
+#include "util/u_atomic.h"
+
+class HashTable : public ::testing::Test {
+public:
+   virtual void SetUp();
+   virtual void TearDown();
+
+   struct _mesa_HashTable *table;
+   int objects[4096];
+};
+
+void
+HashTable::SetUp()
+{
+   table = _mesa_NewHashTable();
+}
+
+void
+HashTable::TearDown()
+{
+   _mesa_DeleteHashTable(table);
+}
+
+static void
+count_entry(GLuint key, void *data, void *userData)
+{
+   (*(unsigned *) userData)++;
+}
+
+static void
+remove_entry(GLuint key, void *data, void *userData)
+{
+   _mesa_HashRemove((struct _mesa_HashTable *) userData, key);
+}
+
+TEST_F(HashTable, DenseAndSparseNames)
+{
+   static const GLuint names[] = { 1, 2, 255, 256, 4095, 1u << 20, ~0u - 1 };
+   unsigned count = 0;
+
+   for (unsigned i = 0; i < ARRAY_SIZE(names); i++)
+      _mesa_HashInsert(table, names[i], &objects[i]);
+
+   EXPECT_EQ(ARRAY_SIZE(names), _mesa_HashNumEntries(table));
+   for (unsigned i = 0; i < ARRAY_SIZE(names); i++)
+      EXPECT_EQ(&objects[i], _mesa_HashLookup(table, names[i]));
+   EXPECT_EQ(NULL, _mesa_HashLookup(table, 3));
+   EXPECT_EQ(NULL, _mesa_HashLookup(table, 1u << 21));
+
+   _mesa_HashWalk(table, count_entry, &count);
+   EXPECT_EQ(ARRAY_SIZE(names), count);
+
+   /* Replacing an entry doesn't add one. */
+   _mesa_HashInsert(table, 2, &objects[100]);
+   EXPECT_EQ(&objects[100], _mesa_HashLookup(table, 2));
+   EXPECT_EQ(ARRAY_SIZE(names), _mesa_HashNumEntries(table));
+
+   _mesa_HashWalk(table, remove_entry, table);
+   EXPECT_EQ(0u, _mesa_HashNumEntries(table));
+   for (unsigned i = 0; i < ARRAY_SIZE(names); i++)
+      EXPECT_EQ(NULL, _mesa_HashLookup(table, names[i]));
+}
+
+/* A name that first went to the hash table must still be found after the
+ * direct array grows over it.
+ */
+TEST_F(HashTable, GrowOverSparseName)
+{
+   _mesa_HashInsert(table, 3000, &objects[0]);
+
+   for (GLuint name = 1; name <= 2048; name++)
+      _mesa_HashInsert(table, name, &objects[name]);
+
+   EXPECT_EQ(&objects[0], _mesa_HashLookup(table, 3000));
+   EXPECT_EQ(2049u, _mesa_HashNumEntries(table));
+
+   for (GLuint name = 1; name <= 2048; name++)
+      _mesa_HashRemove(table, name);
+   _mesa_HashRemove(table, 3000);
+   EXPECT_EQ(0u, _mesa_HashNumEntries(table));
+}
+
+struct walk_insert {
+   struct _mesa_HashTable *table;
+   int *objects;
+   bool seen[512];
+};
+
+/* Inserts enough names on the first visit of a sparse name to make the
+ * direct array grow over the sparse names.
+ */
+static void
+walk_insert_entry(GLuint key, void *data, void *userData)
+{
+   struct walk_insert *walk = (struct walk_insert *) userData;
+
+   if (key >= 256 && !walk->seen[300] && !walk->seen[400]) {
+      for (GLuint name = 4; name <= 256; name++)
+         _mesa_HashInsertLocked(walk->table, name, &walk->objects[name]);
+   }
+
+   if (key < ARRAY_SIZE(walk->seen))
+      walk->seen[key] = true;
+}
+
+/* Names inserted by the callback must not make the walk miss the others. */
+TEST_F(HashTable, WalkWhileInserting)
+{
+   struct walk_insert walk = { table, objects };
+
+   for (GLuint name = 1; name <= 3; name++)
+      _mesa_HashInsert(table, name, &objects[name]);
+   _mesa_HashInsert(table, 300, &objects[300]);
+   _mesa_HashInsert(table, 400, &objects[400]);
+
+   _mesa_HashWalk(table, walk_insert_entry, &walk);
+
+   for (GLuint name = 1; name <= 3; name++)
+      EXPECT_TRUE(walk.seen[name]);
+   EXPECT_TRUE(walk.seen[300]);
+   EXPECT_TRUE(walk.seen[400]);
+
+   for (GLuint name = 4; name <= 256; name++)
+      EXPECT_EQ(&objects[name], _mesa_HashLookup(table, name));
+   EXPECT_EQ(&objects[300], _mesa_HashLookup(table, 300));
+   EXPECT_EQ(258u, _mesa_HashNumEntries(table));
+}
+
+TEST_F(HashTable, DeleteAll)
+{
+   unsigned count = 0;
+
+   for (GLuint name = 1; name < 100; name++)
+      _mesa_HashInsert(table, name, &objects[name]);
+   _mesa_HashInsert(table, 1u << 30, &objects[0]);
+
+   _mesa_HashDeleteAll(table, count_entry, &count);
+   EXPECT_EQ(100u, count);
+   EXPECT_EQ(0u, _mesa_HashNumEntries(table));
+   EXPECT_EQ(NULL, _mesa_HashLookup(table, 50));
+   EXPECT_EQ(NULL, _mesa_HashLookup(table, 1u << 30));
+}
+
+struct concurrent_state {
+   struct _mesa_HashTable *table;
+   int *objects;
+   int stop;
+   int failed;
+};
+
+#define NUM_STABLE_NAMES 16
+
+/* The stable names are never changed, so every lookup must find them. */
+static int
+concurrent_reader(void *data)
+{
+   struct concurrent_state *state = (struct concurrent_state *) data;
+
+   while (!p_atomic_read(&state->stop)) {
+      for (GLuint name = 1; name <= NUM_STABLE_NAMES; name++) {
+         if (_mesa_HashLookup(state->table, name * 1000) !=
+             &state->objects[name])
+            p_atomic_set(&state->failed, 1);
+      }
+   }
+
+   return 0;
+}
+
+TEST_F(HashTable, ConcurrentLookup)
+{
+   struct concurrent_state state = { table, objects, 0, 0 };
+   thrd_t readers[4];
+
+   for (GLuint name = 1; name <= NUM_STABLE_NAMES; name++)
+      _mesa_HashInsert(table, name * 1000, &objects[name]);
+
+   for (unsigned i = 0; i < ARRAY_SIZE(readers); i++)
+      thrd_create(&readers[i], concurrent_reader, &state);
+
+   /* Grow the direct array over the stable names, and churn the rest. */
+   for (unsigned round = 0; round < 8; round++) {
+      for (GLuint name = 1; name < 4096; name++) {
+         if (name % 1000)
+            _mesa_HashInsert(table, name, &objects[name]);
+      }
+      for (GLuint name = 1; name < 4096; name++) {
+         if (name % 1000)
+            _mesa_HashRemove(table, name);
+      }
+   }
+
+   p_atomic_set(&state.stop, 1);
+   for (unsigned i = 0; i < ARRAY_SIZE(readers); i++)
+      thrd_join(readers[i], NULL);
+
+   EXPECT_EQ(0, state.failed);
+
+   for (GLuint name = 1; name <= NUM_STABLE_NAMES; name++)
+      _mesa_HashRemove(table, name * 1000);
+}
@@ -303,41 +303,40 @@ st_nir_assign_uniform_locations(struct gl_context *ctx,
 void
 st_nir_opts(nir_shader *nir, bool scalar)
 {
-   bool progress;
+   nir_pass_loop loop;
+   nir_pass_loop_init(&loop);
    do {
-      progress = false;
-
-      NIR_PASS_V(nir, nir_lower_vars_to_ssa);
+      NIR_LOOP_PASS_V(&loop, nir, nir_lower_vars_to_ssa);
 
       if (scalar) {
-         NIR_PASS_V(nir, nir_lower_alu_to_scalar);
-         NIR_PASS_V(nir, nir_lower_phis_to_scalar);
+         NIR_LOOP_PASS_V(&loop, nir, nir_lower_alu_to_scalar);
+         NIR_LOOP_PASS_V(&loop, nir, nir_lower_phis_to_scalar);
       }
 
-      NIR_PASS_V(nir, nir_lower_alu);
-      NIR_PASS_V(nir, nir_lower_pack);
-      NIR_PASS(progress, nir, nir_copy_prop);
-      NIR_PASS(progress, nir, nir_opt_remove_phis);
-      NIR_PASS(progress, nir, nir_opt_dce);
-      if (nir_opt_trivial_continues(nir)) {
-         progress = true;
-         NIR_PASS(progress, nir, nir_copy_prop);
-         NIR_PASS(progress, nir, nir_opt_dce);
+      NIR_LOOP_PASS_V(&loop, nir, nir_lower_alu);
+      NIR_LOOP_PASS_V(&loop, nir, nir_lower_pack);
+      NIR_LOOP_PASS(&loop, nir, nir_copy_prop);
+      NIR_LOOP_PASS(&loop, nir, nir_opt_remove_phis);
+      NIR_LOOP_PASS(&loop, nir, nir_opt_dce);
+      NIR_LOOP_PASS(&loop, nir, nir_opt_trivial_continues);
+      if (loop.pass_progress) {
+         NIR_LOOP_PASS(&loop, nir, nir_copy_prop);
+         NIR_LOOP_PASS(&loop, nir, nir_opt_dce);
       }
-      NIR_PASS(progress, nir, nir_opt_if);
-      NIR_PASS(progress, nir, nir_opt_dead_cf);
-      NIR_PASS(progress, nir, nir_opt_cse);
-      NIR_PASS(progress, nir, nir_opt_peephole_select, 8, true, true);
+      NIR_LOOP_PASS(&loop, nir, nir_opt_if);
+      NIR_LOOP_PASS(&loop, nir, nir_opt_dead_cf);
+      NIR_LOOP_PASS(&loop, nir, nir_opt_cse);
+      NIR_LOOP_PASS(&loop, nir, nir_opt_peephole_select, 8, true, true);
 
-      NIR_PASS(progress, nir, nir_opt_algebraic);
-      NIR_PASS(progress, nir, nir_opt_constant_folding);
+      NIR_LOOP_PASS(&loop, nir, nir_opt_algebraic);
+      NIR_LOOP_PASS(&loop, nir, nir_opt_constant_folding);
 
-      NIR_PASS(progress, nir, nir_opt_undef);
-      NIR_PASS(progress, nir, nir_opt_conditional_discard);
+      NIR_LOOP_PASS(&loop, nir, nir_opt_undef);
+      NIR_LOOP_PASS(&loop, nir, nir_opt_conditional_discard);
       if (nir->options->max_unroll_iterations) {
-         NIR_PASS(progress, nir, nir_opt_loop_unroll, (nir_variable_mode)0);
+         NIR_LOOP_PASS(&loop, nir, nir_opt_loop_unroll, (nir_variable_mode)0);
       }
-   } while (progress);
+   } while (nir_pass_loop_continue(&loop));
 }
 
 /* First third of converting glsl_to_nir.. this leaves things in a pre-
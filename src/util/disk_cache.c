@@ -25,6 +25,7 @@
 
 #include <ctype.h>
 #include <ftw.h>
+#include <stddef.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -39,10 +40,17 @@
 #include <dirent.h>
 #include "zlib.h"
 
+#ifdef HAVE_ZSTD
+#include "zstd.h"
+#endif
+
 #include "util/crc32.h"
 #include "util/debug.h"
+#include "util/hash_table.h"
+#include "util/list.h"
 #include "util/rand_xor.h"
 #include "util/u_atomic.h"
+#include "util/u_math.h"
 #include "util/u_queue.h"
 #include "util/mesa-sha1.h"
 #include "util/ralloc.h"
@@ -72,7 +80,150 @@
  * - There is no strict requirement that cache versions be backwards
  *   compatible but effort should be taken to limit disruption where possible.
  */
-#define CACHE_VERSION 1
+#define CACHE_VERSION 2
+
+/* Number of shards in the LRU index, one for each two-character
+ * subdirectory of the cache.
+ */
+#define CACHE_LRU_INDEX_SHARDS 256
+
+/* Bounds of the number of entries of each shard of the LRU index. Within
+ * them, the index is sized so that it is at most half full when the cache
+ * is filled with files of CACHE_LRU_INDEX_FILE_SIZE bytes.
+ */
+#define CACHE_LRU_INDEX_MIN_SHARD_ENTRIES 512
+#define CACHE_LRU_INDEX_MAX_SHARD_ENTRIES 8192
+#define CACHE_LRU_INDEX_FILE_SIZE 4096
+
+/* Number of consecutive slots probed when looking up a key in a shard. */
+#define CACHE_LRU_INDEX_PROBE 16
+
+#define CACHE_LRU_INDEX_MAGIC 0x554c524d /* "MRLU" */
+#define CACHE_LRU_INDEX_VERSION 2
+
+/* An entry of the LRU index, describing one file in the cache. */
+struct cache_lru_entry {
+   uint8_t key[CACHE_KEY_SIZE];
+
+   /* Size of the file on disk (in bytes). */
+   uint32_t size;
+
+   /* Value of the index clock at the last access, 0 for an empty slot. */
+   uint64_t stamp;
+};
+
+/* The LRU index is kept in its own file next to the key index and is
+ * mapped shared, so that all processes using the cache agree on the
+ * access order of its entries. This lets us pick an eviction victim
+ * without walking the cache directories.
+ *
+ * Files written before the index was created, or for which there was no
+ * free slot, are not tracked. They are found by walking the directories
+ * as long as the cache holds more than the size tracked by the index.
+ */
+struct cache_lru_index {
+   uint32_t magic;
+   uint32_t version;
+
+   /* Number of entries of each shard, chosen when the index is created. */
+   uint64_t shard_entries;
+
+   /* Logical clock, incremented on every access to a cache entry. */
+   uint64_t clock;
+
+   /* Total size of the files tracked by the index (in bytes). */
+   uint64_t size;
+
+   /* Number of non-empty entries in each shard. */
+   uint64_t shard_count[CACHE_LRU_INDEX_SHARDS];
+
+   /* The entries of each shard, one shard after the other. */
+   struct cache_lru_entry entries[];
+};
+
+/* Maximum number of prefetched entries waiting for disk_cache_get(). */
+#define CACHE_PREFETCH_MAX_ENTRIES 256
+
+/* Number of pack files used when the cache is stored in single files. */
+#define CACHE_PACK_COUNT 8
+
+/* Number of entries in the hash index of each pack file. */
+#define CACHE_PACK_INDEX_ENTRIES (1 << 14)
+
+/* Number of consecutive slots probed when looking up a key in a pack. */
+#define CACHE_PACK_INDEX_PROBE 8
+
+/* Bounds of the size of the segments the records of a pack are mapped in.
+ * Within them, each pack is split in about four segments.
+ */
+#define CACHE_PACK_MIN_SEGMENT_SIZE (64 * 1024)
+#define CACHE_PACK_MAX_SEGMENT_SIZE (16 * 1024 * 1024)
+#define CACHE_PACK_MAX_SEGMENTS 1024
+
+#define CACHE_PACK_MAGIC 0x4b504d43 /* "CMPK" */
+#define CACHE_PACK_VERSION 4
+
+/* An entry of the hash index of a pack file. */
+struct cache_pack_index_entry {
+   uint8_t key[CACHE_KEY_SIZE];
+
+   /* Size of the record (header included). */
+   uint32_t size;
+
+   /* Offset of the record within the pack file, 0 for an empty slot. */
+   uint64_t offset;
+};
+
+/* The pack files start with a header embedding the hash index, followed by
+ * the records appended by disk_cache_put(), in segments of a fixed size.
+ * A record never spans two segments, the end of a segment which can't hold
+ * the next record is filled with a padding record.
+ *
+ * The segments are used as a ring: once the last one is full, the records
+ * are written from the first one again, evicting the oldest records in
+ * their way. The records are never moved, and the file size stays bounded
+ * without any per-entry bookkeeping.
+ */
+struct cache_pack_header {
+   uint32_t magic;
+   uint32_t version;
+
+   /* Size and number of the segments, chosen when the pack is created. */
+   uint64_t segment_size;
+   uint64_t segment_count;
+
+   /* Offset at which the next record is written. */
+   uint64_t head;
+
+   /* Offset of the next record to evict, which is the oldest record of the
+    * previous lap around the ring, or 0 during the first lap.
+    */
+   uint64_t tail;
+
+   struct cache_pack_index_entry index[CACHE_PACK_INDEX_ENTRIES];
+};
+
+/* Offset of the first segment in the pack files. */
+#define CACHE_PACK_DATA_START \
+   ALIGN_POT(sizeof(struct cache_pack_header), CACHE_PACK_MIN_SEGMENT_SIZE)
+
+struct cache_pack {
+   /* The pack file, which stays open to take locks on it. */
+   int fd;
+
+   /* A pointer to the mmapped header of the pack file. */
+   struct cache_pack_header *header;
+
+   /* Copies of the immutable fields of the header. */
+   uint64_t segment_size;
+   uint64_t segment_count;
+
+   /* The segments are mapped as they are needed, and stay mapped until the
+    * cache is destroyed. This keeps the address space used by the cache
+    * proportional to its contents, and readers never need to take a lock.
+    */
+   uint8_t **segments;
+};
 
 struct disk_cache {
    /* The path to the cache directory. */
@@ -95,15 +246,58 @@ struct disk_cache {
    /* Pointer to stored keys, (within index_mmap). */
    uint8_t *stored_keys;
 
+   /* A pointer to the mmapped LRU index file within the cache directory,
+    * or NULL if it couldn't be mapped.
+    */
+   struct cache_lru_index *lru_index;
+   size_t lru_index_size;
+
+   /* Pack files, only used if the cache is stored in single files. */
+   bool single_file;
+   struct cache_pack packs[CACHE_PACK_COUNT];
+
    /* Maximum size of all cached objects (in bytes). */
    uint64_t max_size;
 
+   /* Compression used for new cache entries, and its codec-specific level. */
+   enum disk_cache_compression compression;
+   int compression_level;
+
    /* Driver cache keys. */
    uint8_t *driver_keys_blob;
    size_t driver_keys_blob_size;
 
    disk_cache_put_cb blob_put_cb;
    disk_cache_get_cb blob_get_cb;
+
+   /* Thread queue for reading prefetched cache entries, initialized on the
+    * first call to disk_cache_prefetch().
+    */
+   struct util_queue prefetch_queue;
+
+   /* Protects all of the prefetch state below. */
+   mtx_t prefetch_mtx;
+
+   /* Prefetch jobs not consumed by disk_cache_get() yet, indexed by key, and
+    * in the order they were created.
+    */
+   struct hash_table *prefetch_jobs;
+   struct list_head prefetch_list;
+   unsigned num_prefetch_jobs;
+};
+
+struct disk_cache_prefetch_job {
+   struct util_queue_fence fence;
+
+   struct disk_cache *cache;
+
+   cache_key key;
+
+   /* The entry read from the disk (or NULL), and its size. */
+   void *data;
+   size_t size;
+
+   struct list_head link;
 };
 
 struct disk_cache_put_job {
@@ -119,6 +313,10 @@ struct disk_cache_put_job {
    /* Size of data to be compressed and written. */
    size_t size;
 
+   /* Compression to use for the data. */
+   enum disk_cache_compression compression;
+   int compression_level;
+
    struct cache_item_metadata cache_item_metadata;
 };
 
@@ -182,12 +380,249 @@ concatenate_and_mkdir(void *ctx, const char *path, const char *name)
       return NULL;
 }
 
+/* Map the LRU index of the cache, creating it if needed.
+ *
+ * Returns false on any error.
+ */
+static bool
+map_lru_index(struct disk_cache *cache, void *mem_ctx)
+{
+   struct cache_lru_index header;
+   size_t header_size = offsetof(struct cache_lru_index, entries);
+   struct stat sb;
+   size_t size;
+   char *path;
+   int fd;
+
+   path = ralloc_asprintf(mem_ctx, "%s/lru_index", cache->path);
+   if (path == NULL)
+      return false;
+
+   fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+   if (fd == -1)
+      return false;
+
+   if (flock(fd, LOCK_EX) == -1) {
+      close(fd);
+      return false;
+   }
+
+   /* An existing index keeps its number of entries, so that processes using
+    * different maximum cache sizes agree on its layout. Otherwise, size it
+    * for the maximum cache size and start from an empty index. The file is
+    * sparse, so only the pages holding entries take up disk space.
+    *
+    * Slots are found by masking with shard_entries - 1, so an index whose
+    * header doesn't hold a power of two, or whose size doesn't match it, is
+    * rebuilt rather than probed.
+    */
+   if (pread(fd, &header, header_size, 0) != (ssize_t)header_size ||
+       header.magic != CACHE_LRU_INDEX_MAGIC ||
+       header.version != CACHE_LRU_INDEX_VERSION ||
+       header.shard_entries < CACHE_LRU_INDEX_MIN_SHARD_ENTRIES ||
+       header.shard_entries > CACHE_LRU_INDEX_MAX_SHARD_ENTRIES ||
+       !util_is_power_of_two_or_zero64(header.shard_entries) ||
+       fstat(fd, &sb) == -1 ||
+       sb.st_size != header_size + CACHE_LRU_INDEX_SHARDS *
+                     header.shard_entries * sizeof(struct cache_lru_entry)) {
+      uint64_t files = cache->max_size / CACHE_LRU_INDEX_FILE_SIZE;
+      uint64_t shard_entries =
+         util_next_power_of_two64(2 * files / CACHE_LRU_INDEX_SHARDS);
+
+      memset(&header, 0, header_size);
+      header.magic = CACHE_LRU_INDEX_MAGIC;
+      header.version = CACHE_LRU_INDEX_VERSION;
+      header.shard_entries = CLAMP(shard_entries,
+                                   CACHE_LRU_INDEX_MIN_SHARD_ENTRIES,
+                                   CACHE_LRU_INDEX_MAX_SHARD_ENTRIES);
+
+      size = header_size + CACHE_LRU_INDEX_SHARDS * header.shard_entries *
+                           sizeof(struct cache_lru_entry);
+
+      if (ftruncate(fd, 0) == -1 || ftruncate(fd, size) == -1 ||
+          pwrite(fd, &header, header_size, 0) != (ssize_t)header_size) {
+         flock(fd, LOCK_UN);
+         close(fd);
+         return false;
+      }
+   }
+
+   flock(fd, LOCK_UN);
+
+   size = header_size + CACHE_LRU_INDEX_SHARDS * header.shard_entries *
+                        sizeof(struct cache_lru_entry);
+
+   /* As for the key index, the entries are updated without any locking. A
+    * torn entry only ever results in a file being evicted earlier or later
+    * than it should have been.
+    */
+   cache->lru_index = mmap(NULL, size, PROT_READ | PROT_WRITE,
+                           MAP_SHARED, fd, 0);
+   close(fd);
+
+   if (cache->lru_index == MAP_FAILED) {
+      cache->lru_index = NULL;
+      return false;
+   }
+
+   cache->lru_index_size = size;
+
+   return true;
+}
+
+static void
+unmap_packs(struct disk_cache *cache)
+{
+   for (unsigned i = 0; i < CACHE_PACK_COUNT; i++) {
+      struct cache_pack *pack = &cache->packs[i];
+
+      if (pack->segments) {
+         for (unsigned j = 0; j < pack->segment_count; j++) {
+            if (pack->segments[j])
+               munmap(pack->segments[j], pack->segment_size);
+         }
+         free(pack->segments);
+      }
+      if (pack->header)
+         munmap(pack->header, sizeof(*pack->header));
+      if (pack->fd != -1)
+         close(pack->fd);
+   }
+}
+
+/* Open and map the pack files of the cache, creating them if needed.
+ *
+ * Returns false on any error.
+ */
+static bool
+map_packs(struct disk_cache *cache, void *mem_ctx)
+{
+   uint64_t capacity = cache->max_size / CACHE_PACK_COUNT;
+   uint64_t segment_size = CLAMP(util_next_power_of_two64(capacity / 4),
+                                 CACHE_PACK_MIN_SEGMENT_SIZE,
+                                 CACHE_PACK_MAX_SEGMENT_SIZE);
+   uint64_t segment_count = MAX2(capacity / segment_size, 1);
+
+   for (unsigned i = 0; i < CACHE_PACK_COUNT; i++) {
+      cache->packs[i].fd = -1;
+      cache->packs[i].header = NULL;
+      cache->packs[i].segments = NULL;
+   }
+
+   for (unsigned i = 0; i < CACHE_PACK_COUNT; i++) {
+      struct cache_pack *pack = &cache->packs[i];
+      struct cache_pack_header header;
+      size_t header_size = offsetof(struct cache_pack_header, index);
+      struct stat sb;
+      char *path;
+
+      path = ralloc_asprintf(mem_ctx, "%s/pack_%u", cache->path, i);
+      if (path == NULL)
+         goto fail;
+
+      pack->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+      if (pack->fd == -1)
+         goto fail;
+
+      if (flock(pack->fd, LOCK_EX) == -1)
+         goto fail;
+
+      /* An existing pack keeps its layout, so that processes using
+       * different maximum cache sizes agree on it. Otherwise, write a fresh
+       * header with an empty index. We never shrink the file, as other
+       * processes might have it mapped, but make it large enough for all
+       * the segments, so that no access to the mappings is beyond its end.
+       * The file is sparse, so only the written records take up disk space.
+       */
+      if (pread(pack->fd, &header, header_size, 0) != (ssize_t)header_size ||
+          header.magic != CACHE_PACK_MAGIC ||
+          header.version != CACHE_PACK_VERSION ||
+          !util_is_power_of_two_or_zero64(header.segment_size) ||
+          header.segment_size < CACHE_PACK_MIN_SEGMENT_SIZE ||
+          header.segment_size > CACHE_PACK_MAX_SEGMENT_SIZE ||
+          header.segment_count == 0 ||
+          header.segment_count > CACHE_PACK_MAX_SEGMENTS ||
+          fstat(pack->fd, &sb) == -1 ||
+          sb.st_size < CACHE_PACK_DATA_START +
+                       header.segment_count * header.segment_size) {
+         struct cache_pack_header *empty = calloc(1, sizeof(*empty));
+         if (empty == NULL) {
+            flock(pack->fd, LOCK_UN);
+            goto fail;
+         }
+
+         empty->magic = CACHE_PACK_MAGIC;
+         empty->version = CACHE_PACK_VERSION;
+         empty->segment_size = segment_size;
+         empty->segment_count = segment_count;
+         empty->head = CACHE_PACK_DATA_START;
+         memcpy(&header, empty, header_size);
+
+         ssize_t written = pwrite(pack->fd, empty, sizeof(*empty), 0);
+         free(empty);
+
+         if (written != (ssize_t)sizeof(*empty) ||
+             fstat(pack->fd, &sb) == -1 ||
+             (sb.st_size < CACHE_PACK_DATA_START +
+                           segment_count * segment_size &&
+              ftruncate(pack->fd, CACHE_PACK_DATA_START +
+                                  segment_count * segment_size) == -1)) {
+            flock(pack->fd, LOCK_UN);
+            goto fail;
+         }
+      }
+
+      flock(pack->fd, LOCK_UN);
+
+      pack->segment_size = header.segment_size;
+      pack->segment_count = header.segment_count;
+      pack->segments = calloc(pack->segment_count, sizeof(*pack->segments));
+      if (pack->segments == NULL)
+         goto fail;
+
+      pack->header = mmap(NULL, sizeof(*pack->header), PROT_READ | PROT_WRITE,
+                          MAP_SHARED, pack->fd, 0);
+      if (pack->header == MAP_FAILED) {
+         pack->header = NULL;
+         goto fail;
+      }
+   }
+
+   return true;
+
+ fail:
+   unmap_packs(cache);
+   return false;
+}
+
 #define DRV_KEY_CPY(_dst, _src, _src_size) \
 do {                                       \
    memcpy(_dst, _src, _src_size);          \
    _dst += _src_size;                      \
 } while (0);
 
+/* Return whether 'compression' is supported by this build of Mesa, and
+ * 'level' is either negative, (selecting the default level), or a level of
+ * the compression.
+ */
+static bool
+compression_level_is_valid(enum disk_cache_compression compression,
+                           long level)
+{
+   switch (compression) {
+   case DISK_CACHE_COMPRESSION_NONE:
+      return level <= 0;
+   case DISK_CACHE_COMPRESSION_ZLIB:
+      return level <= Z_BEST_COMPRESSION;
+#ifdef HAVE_ZSTD
+   case DISK_CACHE_COMPRESSION_ZSTD:
+      return level <= ZSTD_maxCLevel();
+#endif
+   default:
+      return false;
+   }
+}
+
 struct disk_cache *
 disk_cache_create(const char *gpu_name, const char *driver_id,
                   uint64_t driver_flags)
@@ -331,6 +766,7 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
    cache->index_mmap_size = size;
 
    close(fd);
+   fd = -1;
 
    cache->size = (uint64_t *) cache->index_mmap;
    cache->stored_keys = cache->index_mmap + sizeof(uint64_t);
@@ -370,6 +806,59 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
 
    cache->max_size = max_size;
 
+   /* Without the LRU index, we can still evict files by walking the cache
+    * directories.
+    */
+   map_lru_index(cache, local);
+
+   cache->compression = DISK_CACHE_COMPRESSION_DEFAULT;
+   cache->compression_level = -1;
+
+   const char *compression_str = getenv("MESA_GLSL_CACHE_COMPRESSION");
+   if (compression_str) {
+      if (strcmp(compression_str, "none") == 0) {
+         cache->compression = DISK_CACHE_COMPRESSION_NONE;
+      } else if (strcmp(compression_str, "zlib") == 0) {
+         cache->compression = DISK_CACHE_COMPRESSION_ZLIB;
+      } else if (strcmp(compression_str, "zstd") == 0) {
+#ifdef HAVE_ZSTD
+         cache->compression = DISK_CACHE_COMPRESSION_ZSTD;
+#else
+         fprintf(stderr, "Mesa was built without zstd support, using the "
+                         "default shader cache compression.\n");
+#endif
+      } else {
+         fprintf(stderr, "Unknown shader cache compression '%s', using the "
+                         "default.\n", compression_str);
+      }
+   }
+
+   const char *level_str = getenv("MESA_GLSL_CACHE_COMPRESSION_LEVEL");
+   if (level_str) {
+      char *end;
+      long level = strtol(level_str, &end, 10);
+      if (end != level_str && *end == '\0' &&
+          compression_level_is_valid(cache->compression, level)) {
+         cache->compression_level = level;
+      } else {
+         fprintf(stderr, "Invalid shader cache compression level '%s', "
+                         "using the default.\n", level_str);
+      }
+   }
+
+   /* At user request, store the cache entries in a few pack files rather
+    * than in one file per entry.
+    */
+   if (env_var_as_boolean("MESA_GLSL_CACHE_SINGLE_FILE", false)) {
+      if (!map_packs(cache, local)) {
+         munmap(cache->index_mmap, cache->index_mmap_size);
+         if (cache->lru_index)
+            munmap(cache->lru_index, cache->lru_index_size);
+         goto path_fail;
+      }
+      cache->single_file = true;
+   }
+
    /* 1 thread was chosen because we don't really care about getting things
     * to disk quickly just that it's not blocking other tasks.
     *
@@ -381,6 +870,8 @@ disk_cache_create(const char *gpu_name, const char *driver_id,
                    UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY |
                    UTIL_QUEUE_INIT_SET_FULL_THREAD_AFFINITY);
 
+   (void) mtx_init(&cache->prefetch_mtx, mtx_plain);
+
    cache->path_init_failed = false;
 
  path_fail:
@@ -436,8 +927,31 @@ void
 disk_cache_destroy(struct disk_cache *cache)
 {
    if (cache && !cache->path_init_failed) {
+      if (util_queue_is_initialized(&cache->prefetch_queue)) {
+         /* Cancel the jobs which didn't start yet, (which signals their
+          * fence), and wait for the others.
+          */
+         list_for_each_entry(struct disk_cache_prefetch_job, job,
+                             &cache->prefetch_list, link)
+            util_queue_drop_job(&cache->prefetch_queue, &job->fence);
+
+         util_queue_destroy(&cache->prefetch_queue);
+
+         list_for_each_entry_safe(struct disk_cache_prefetch_job, job,
+                                  &cache->prefetch_list, link) {
+            util_queue_fence_destroy(&job->fence);
+            free(job->data);
+            free(job);
+         }
+      }
+      mtx_destroy(&cache->prefetch_mtx);
+
       util_queue_destroy(&cache->cache_queue);
       munmap(cache->index_mmap, cache->index_mmap_size);
+      if (cache->lru_index)
+         munmap(cache->lru_index, cache->lru_index_size);
+      if (cache->single_file)
+         unmap_packs(cache);
    }
 
    ralloc_free(cache);
@@ -484,6 +998,134 @@ make_cache_file_directory(struct disk_cache *cache, const cache_key key)
    free(dir);
 }
 
+static struct cache_pack *
+get_pack(struct disk_cache *cache, const cache_key key)
+{
+   return &cache->packs[key[0] % CACHE_PACK_COUNT];
+}
+
+/* Return the index entry of 'pack' holding 'key', or NULL if the key is
+ * not in the pack.
+ */
+static struct cache_pack_index_entry *
+pack_index_lookup(struct cache_pack *pack, const cache_key key)
+{
+   uint32_t hash;
+
+   /* The first byte of the key selects the pack, so use the following
+    * bytes to spread the keys within it.
+    */
+   memcpy(&hash, &key[1], sizeof(hash));
+
+   for (unsigned i = 0; i < CACHE_PACK_INDEX_PROBE; i++) {
+      struct cache_pack_index_entry *entry =
+         &pack->header->index[(hash + i) % CACHE_PACK_INDEX_ENTRIES];
+
+      if (p_atomic_read(&entry->offset) != 0 &&
+          memcmp(entry->key, key, CACHE_KEY_SIZE) == 0)
+         return entry;
+   }
+
+   return NULL;
+}
+
+/* Clear 'entry' of the index of a pack, unless it was already cleared or
+ * reused since 'offset' was read from it.
+ */
+static void
+pack_index_clear(struct disk_cache *cache,
+                 struct cache_pack_index_entry *entry, uint64_t offset)
+{
+   uint32_t size = entry->size;
+
+   if (p_atomic_cmpxchg(&entry->offset, offset, 0) == offset)
+      p_atomic_add(cache->size, - (uint64_t)size);
+}
+
+/* Return a free index entry of 'pack' for 'key', reusing the entry of the
+ * oldest record the key can occupy if they are all taken. The pack must be
+ * locked.
+ */
+static struct cache_pack_index_entry *
+pack_index_alloc(struct disk_cache *cache, struct cache_pack *pack,
+                 const cache_key key)
+{
+   uint64_t span = pack->segment_count * pack->segment_size;
+   uint64_t head = pack->header->head;
+   struct cache_pack_index_entry *oldest = NULL;
+   uint64_t oldest_age = 0;
+   uint32_t hash;
+
+   memcpy(&hash, &key[1], sizeof(hash));
+
+   for (unsigned i = 0; i < CACHE_PACK_INDEX_PROBE; i++) {
+      struct cache_pack_index_entry *entry =
+         &pack->header->index[(hash + i) % CACHE_PACK_INDEX_ENTRIES];
+      uint64_t offset = p_atomic_read(&entry->offset);
+
+      if (offset == 0)
+         return entry;
+
+      /* The records following the head are the oldest ones. */
+      uint64_t age = offset >= head ? span - (offset - head) : head - offset;
+      if (!oldest || age > oldest_age) {
+         oldest = entry;
+         oldest_age = age;
+      }
+   }
+
+   pack_index_clear(cache, oldest, p_atomic_read(&oldest->offset));
+
+   return oldest;
+}
+
+/* Return the end of the segment of a pack holding 'offset'. */
+static uint64_t
+pack_segment_end(struct cache_pack *pack, uint64_t offset)
+{
+   uint64_t segment = (offset - CACHE_PACK_DATA_START) / pack->segment_size;
+
+   return CACHE_PACK_DATA_START + (segment + 1) * pack->segment_size;
+}
+
+/* Return a pointer to 'offset' within the mapping of its segment, mapping
+ * the segment if needed.
+ *
+ * Returns NULL if the offset is out of the segments, or on any error.
+ */
+static uint8_t *
+pack_map(struct cache_pack *pack, uint64_t offset)
+{
+   uint64_t segment, segment_offset;
+   uint8_t *map;
+
+   if (offset < CACHE_PACK_DATA_START)
+      return NULL;
+
+   segment = (offset - CACHE_PACK_DATA_START) / pack->segment_size;
+   segment_offset = (offset - CACHE_PACK_DATA_START) % pack->segment_size;
+   if (segment >= pack->segment_count)
+      return NULL;
+
+   map = p_atomic_read(&pack->segments[segment]);
+   if (map == NULL) {
+      map = mmap(NULL, pack->segment_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                 pack->fd,
+                 CACHE_PACK_DATA_START + segment * pack->segment_size);
+      if (map == MAP_FAILED)
+         return NULL;
+
+      /* Another thread might have mapped the segment in the meantime. */
+      uint8_t *other = p_atomic_cmpxchg(&pack->segments[segment], NULL, map);
+      if (other != NULL) {
+         munmap(map, pack->segment_size);
+         map = other;
+      }
+   }
+
+   return map + segment_offset;
+}
+
 /* Given a directory path and predicate function, find the entry with
  * the oldest access time in that directory for which the predicate
  * returns true.
@@ -561,28 +1203,6 @@ is_regular_non_tmp_file(const char *path, const struct stat *sb,
    return true;
 }
 
-/* Returns the size of the deleted file, (or 0 on any error). */
-static size_t
-unlink_lru_file_from_directory(const char *path)
-{
-   struct stat sb;
-   char *filename;
-
-   filename = choose_lru_file_matching(path, is_regular_non_tmp_file);
-   if (filename == NULL)
-      return 0;
-
-   if (stat(filename, &sb) == -1) {
-      free (filename);
-      return 0;
-   }
-
-   unlink(filename);
-   free (filename);
-
-   return sb.st_blocks * 512;
-}
-
 /* Is entry a directory with a two-character name, (and not the
  * special name of ".."). We also return false if the dir is empty.
  */
@@ -623,23 +1243,399 @@ is_two_character_sub_directory(const char *path, const struct stat *sb,
    return true;
 }
 
-static void
-evict_lru_item(struct disk_cache *cache)
+/* Return the entries of the shard of the LRU index for 'key'. */
+static struct cache_lru_entry *
+lru_index_shard(struct disk_cache *cache, const cache_key key)
 {
-   char *dir_path;
+   /* The shard matches the subdirectory the file for key lives in. */
+   return &cache->lru_index->entries[key[0] *
+                                     cache->lru_index->shard_entries];
+}
 
-   /* With a reasonably-sized, full cache, (and with keys generated
-    * from a cryptographic hash), we can choose two random hex digits
-    * and reasonably expect the directory to exist with a file in it.
-    * Provides pseudo-LRU eviction to reduce checking all cache files.
-    */
-   uint64_t rand64 = rand_xorshift128plus(cache->seed_xorshift128plus);
-   if (asprintf(&dir_path, "%s/%02" PRIx64 , cache->path, rand64 & 0xff) < 0)
-      return;
+static unsigned
+lru_index_first_slot(struct disk_cache *cache, const cache_key key)
+{
+   uint32_t hash;
 
-   size_t size = unlink_lru_file_from_directory(dir_path);
+   /* The first byte of the key selects the shard, so use the following
+    * bytes to spread the keys within it.
+    */
+   memcpy(&hash, &key[1], sizeof(hash));
+   return hash & (cache->lru_index->shard_entries - 1);
+}
 
-   free(dir_path);
+static struct cache_lru_entry *
+lru_index_probe(struct disk_cache *cache, struct cache_lru_entry *shard,
+                unsigned slot, unsigned i)
+{
+   return &shard[(slot + i) & (cache->lru_index->shard_entries - 1)];
+}
+
+/* Return the entry of the LRU index holding 'key', or NULL if the key is
+ * not tracked by the index.
+ */
+static struct cache_lru_entry *
+lru_index_lookup(struct disk_cache *cache, const cache_key key)
+{
+   if (!cache->lru_index)
+      return NULL;
+
+   struct cache_lru_entry *shard = lru_index_shard(cache, key);
+   unsigned slot = lru_index_first_slot(cache, key);
+
+   for (unsigned i = 0; i < CACHE_LRU_INDEX_PROBE; i++) {
+      struct cache_lru_entry *entry = lru_index_probe(cache, shard, slot, i);
+
+      if (p_atomic_read(&entry->stamp) != 0 &&
+          memcmp(entry->key, key, CACHE_KEY_SIZE) == 0)
+         return entry;
+   }
+
+   return NULL;
+}
+
+/* Mark the entry for 'key' as the most recently used one. */
+static void
+lru_index_touch(struct disk_cache *cache, const cache_key key)
+{
+   struct cache_lru_entry *entry = lru_index_lookup(cache, key);
+
+   if (entry)
+      p_atomic_set(&entry->stamp, p_atomic_inc_return(&cache->lru_index->clock));
+}
+
+/* Clear 'entry' of the LRU index, unless another process (or thread)
+ * modified it since 'stamp' was read from it.
+ *
+ * Returns false if the entry was modified.
+ */
+static bool
+lru_index_clear_entry(struct disk_cache *cache, unsigned shard,
+                      struct cache_lru_entry *entry, uint64_t stamp)
+{
+   uint32_t size = entry->size;
+
+   if (p_atomic_cmpxchg(&entry->stamp, stamp, 0) != stamp)
+      return false;
+
+   p_atomic_dec(&cache->lru_index->shard_count[shard]);
+   p_atomic_add(&cache->lru_index->size, - (uint64_t)size);
+
+   return true;
+}
+
+/* Remove 'entry' from the LRU index and unlink the corresponding file.
+ *
+ * Returns the size of the deleted file, (or 0 on any error).
+ */
+static size_t
+lru_index_evict_entry(struct disk_cache *cache, unsigned shard,
+                      struct cache_lru_entry *entry, uint64_t stamp)
+{
+   cache_key key;
+   size_t size;
+   char *filename;
+
+   memcpy(key, entry->key, CACHE_KEY_SIZE);
+   size = entry->size;
+
+   if (!lru_index_clear_entry(cache, shard, entry, stamp))
+      return 0;
+
+   filename = get_cache_file(cache, key);
+   if (filename == NULL)
+      return 0;
+
+   /* Only account for the size of the file if we are the ones who removed
+    * it, so that racing evictions don't decrement the cache size twice.
+    */
+   if (unlink(filename) == -1)
+      size = 0;
+
+   free(filename);
+
+   return size;
+}
+
+/* Record a new file of 'size' bytes for 'key' in the LRU index.
+ *
+ * If all the slots the key can occupy are in use, the file is left
+ * untracked. Evicting is only up to cache_put(), once the maximum size of
+ * the cache is reached.
+ */
+static void
+lru_index_insert(struct disk_cache *cache, const cache_key key, size_t size)
+{
+   if (!cache->lru_index)
+      return;
+
+   struct cache_lru_entry *shard = lru_index_shard(cache, key);
+   unsigned slot = lru_index_first_slot(cache, key);
+   uint64_t stamp = p_atomic_inc_return(&cache->lru_index->clock);
+
+   for (unsigned i = 0; i < CACHE_LRU_INDEX_PROBE; i++) {
+      struct cache_lru_entry *entry = lru_index_probe(cache, shard, slot, i);
+      uint64_t entry_stamp = p_atomic_read(&entry->stamp);
+
+      if (entry_stamp == 0) {
+         if (p_atomic_cmpxchg(&entry->stamp, 0, stamp) != 0)
+            continue;
+
+         memcpy(entry->key, key, CACHE_KEY_SIZE);
+         entry->size = size;
+         p_atomic_inc(&cache->lru_index->shard_count[key[0]]);
+         p_atomic_add(&cache->lru_index->size, (uint64_t)size);
+         return;
+      }
+
+      if (memcmp(entry->key, key, CACHE_KEY_SIZE) == 0) {
+         /* The file was rewritten after having been removed behind our
+          * back. Just refresh the entry.
+          */
+         p_atomic_add(&cache->lru_index->size,
+                      (uint64_t)size - (uint64_t)entry->size);
+         entry->size = size;
+         p_atomic_set(&entry->stamp, stamp);
+         return;
+      }
+   }
+}
+
+/* Remove the entry for 'key' from the LRU index, if any. The file itself
+ * is left alone.
+ */
+static void
+lru_index_remove(struct disk_cache *cache, const cache_key key)
+{
+   struct cache_lru_entry *entry = lru_index_lookup(cache, key);
+
+   if (entry) {
+      uint64_t stamp = p_atomic_read(&entry->stamp);
+
+      if (stamp)
+         lru_index_clear_entry(cache, key[0], entry, stamp);
+   }
+}
+
+/* Evict the least recently used file of a random non-empty shard of the
+ * LRU index. This only touches the mapped index and the one file being
+ * removed, regardless of the number of files in the cache.
+ *
+ * Returns false if the index is empty. Otherwise, 'size' is set to the size
+ * of the deleted file, (which is 0 if the file was already gone).
+ */
+static bool
+lru_index_evict_item(struct disk_cache *cache, size_t *size)
+{
+   uint64_t shard_entries = cache->lru_index->shard_entries;
+   uint64_t rand64 = rand_xorshift128plus(cache->seed_xorshift128plus);
+   unsigned first_shard = rand64 % CACHE_LRU_INDEX_SHARDS;
+
+   for (unsigned i = 0; i < CACHE_LRU_INDEX_SHARDS; i++) {
+      unsigned shard = (first_shard + i) % CACHE_LRU_INDEX_SHARDS;
+      struct cache_lru_entry *entries =
+         &cache->lru_index->entries[shard * shard_entries];
+      struct cache_lru_entry *lru_entry = NULL;
+      uint64_t lru_stamp = 0;
+
+      if (p_atomic_read(&cache->lru_index->shard_count[shard]) == 0)
+         continue;
+
+      for (unsigned j = 0; j < shard_entries; j++) {
+         uint64_t stamp = p_atomic_read(&entries[j].stamp);
+
+         if (stamp && (!lru_entry || stamp < lru_stamp)) {
+            lru_entry = &entries[j];
+            lru_stamp = stamp;
+         }
+      }
+
+      if (lru_entry) {
+         *size = lru_index_evict_entry(cache, shard, lru_entry, lru_stamp);
+         return true;
+      }
+   }
+
+   return false;
+}
+
+/* Parse the key of a cache file from its path, which ends with the two
+ * characters of its subdirectory, a slash and the rest of the key.
+ *
+ * Returns false if the path isn't the one of a cache file.
+ */
+static bool
+parse_cache_file_key(const char *filename, cache_key key)
+{
+   size_t len = strlen(filename);
+   char hex[CACHE_KEY_SIZE * 2];
+
+   if (len < sizeof(hex) + 1 || filename[len - sizeof(hex) + 1] != '/')
+      return false;
+
+   memcpy(hex, &filename[len - sizeof(hex) - 1], 2);
+   memcpy(hex + 2, &filename[len - sizeof(hex) + 2], sizeof(hex) - 2);
+
+   for (unsigned i = 0; i < CACHE_KEY_SIZE; i++) {
+      char byte[3] = { hex[2 * i], hex[2 * i + 1], 0 };
+      char *end;
+
+      if (!isxdigit(byte[0]) || !isxdigit(byte[1]))
+         return false;
+      key[i] = strtoul(byte, &end, 16);
+   }
+
+   return true;
+}
+
+/* Unlink 'filename', keeping the LRU index in sync.
+ *
+ * Returns the size of the deleted file, (or 0 on any error).
+ */
+static size_t
+unlink_cache_file(struct disk_cache *cache, const char *filename)
+{
+   struct stat sb;
+   cache_key key;
+
+   if (stat(filename, &sb) == -1)
+      return 0;
+
+   if (unlink(filename) == -1)
+      return 0;
+
+   if (parse_cache_file_key(filename, key))
+      lru_index_remove(cache, key);
+
+   return sb.st_blocks * 512;
+}
+
+/* Returns the size of the deleted file, (or 0 on any error). */
+static size_t
+unlink_lru_file_from_directory(struct disk_cache *cache, const char *path)
+{
+   char *filename;
+   size_t size;
+
+   filename = choose_lru_file_matching(path, is_regular_non_tmp_file);
+   if (filename == NULL)
+      return 0;
+
+   size = unlink_cache_file(cache, filename);
+   free(filename);
+
+   return size;
+}
+
+/* Unlink the least recently accessed file of the directory 'path' which
+ * isn't tracked by the LRU index.
+ *
+ * Returns the size of the deleted file, (or 0 if there was none).
+ */
+static size_t
+unlink_untracked_file_from_directory(struct disk_cache *cache,
+                                     const char *path)
+{
+   DIR *dir;
+   struct dirent *entry;
+   char *filename = NULL;
+   time_t lru_atime = 0;
+   size_t size = 0;
+
+   dir = opendir(path);
+   if (dir == NULL)
+      return 0;
+
+   while ((entry = readdir(dir)) != NULL) {
+      size_t len = strlen(entry->d_name);
+      struct stat sb;
+      char *name;
+      cache_key key;
+
+      if (fstatat(dirfd(dir), entry->d_name, &sb, 0) == -1 ||
+          !is_regular_non_tmp_file(path, &sb, entry->d_name, len) ||
+          (lru_atime && sb.st_atime >= lru_atime))
+         continue;
+
+      if (asprintf(&name, "%s/%s", path, entry->d_name) == -1)
+         continue;
+
+      if (parse_cache_file_key(name, key) && lru_index_lookup(cache, key)) {
+         free(name);
+         continue;
+      }
+
+      free(filename);
+      filename = name;
+      lru_atime = sb.st_atime;
+   }
+
+   closedir(dir);
+
+   if (filename) {
+      size = unlink_cache_file(cache, filename);
+      free(filename);
+   }
+
+   return size;
+}
+
+static void
+evict_lru_item(struct disk_cache *cache)
+{
+   char *dir_path;
+   uint64_t rand64;
+   size_t size;
+
+   if (cache->lru_index) {
+      /* If the cache holds files the LRU index doesn't know about, they are
+       * older than anything the index tracks, or they didn't fit in it.
+       * Evict them first, looking for one in the directories from a random
+       * one on.
+       */
+      if (p_atomic_read(cache->size) >
+          p_atomic_read(&cache->lru_index->size)) {
+         rand64 = rand_xorshift128plus(cache->seed_xorshift128plus);
+
+         for (unsigned i = 0; i < CACHE_LRU_INDEX_SHARDS; i++) {
+            if (asprintf(&dir_path, "%s/%02" PRIx64 , cache->path,
+                         (rand64 + i) & 0xff) < 0)
+               return;
+
+            size = unlink_untracked_file_from_directory(cache, dir_path);
+            free(dir_path);
+
+            if (size) {
+               p_atomic_add(cache->size, - (uint64_t)size);
+               return;
+            }
+         }
+
+         /* There is no untracked file left, the size of the cache drifted
+          * from the size of the files in it. Start over from the index.
+          */
+         p_atomic_set(cache->size, p_atomic_read(&cache->lru_index->size));
+      }
+
+      if (lru_index_evict_item(cache, &size)) {
+         if (size)
+            p_atomic_add(cache->size, - (uint64_t)size);
+         return;
+      }
+   }
+
+   /* With a reasonably-sized, full cache, (and with keys generated
+    * from a cryptographic hash), we can choose two random hex digits
+    * and reasonably expect the directory to exist with a file in it.
+    * Provides pseudo-LRU eviction to reduce checking all cache files.
+    */
+   rand64 = rand_xorshift128plus(cache->seed_xorshift128plus);
+   if (asprintf(&dir_path, "%s/%02" PRIx64 , cache->path, rand64 & 0xff) < 0)
+      return;
+
+   size = unlink_lru_file_from_directory(cache, dir_path);
+
+   free(dir_path);
 
    if (size) {
       p_atomic_add(cache->size, - (uint64_t)size);
@@ -659,7 +1655,7 @@ evict_lru_item(struct disk_cache *cache)
    if (dir_path == NULL)
       return;
 
-   size = unlink_lru_file_from_directory(dir_path);
+   size = unlink_lru_file_from_directory(cache, dir_path);
 
    free(dir_path);
 
@@ -672,6 +1668,18 @@ disk_cache_remove(struct disk_cache *cache, const cache_key key)
 {
    struct stat sb;
 
+   /* The space used by entries of pack files is only reclaimed when the
+    * ring of the pack comes back to them, so just drop the entry from the
+    * index.
+    */
+   if (cache->single_file) {
+      struct cache_pack_index_entry *entry =
+         pack_index_lookup(get_pack(cache, key), key);
+      if (entry)
+         pack_index_clear(cache, entry, p_atomic_read(&entry->offset));
+      return;
+   }
+
    char *filename = get_cache_file(cache, key);
    if (filename == NULL) {
       return;
@@ -685,6 +1693,8 @@ disk_cache_remove(struct disk_cache *cache, const cache_key key)
    unlink(filename);
    free(filename);
 
+   lru_index_remove(cache, key);
+
    if (sb.st_blocks)
       p_atomic_add(cache->size, - (uint64_t)sb.st_blocks * 512);
 }
@@ -731,7 +1741,7 @@ write_all(int fd, const void *buf, size_t count)
  */
 static size_t
 deflate_and_write_to_disk(const void *in_data, size_t in_data_size, int dest,
-                          const char *filename)
+                          int level)
 {
    unsigned char out[BUFSIZE];
 
@@ -743,7 +1753,7 @@ deflate_and_write_to_disk(const void *in_data, size_t in_data_size, int dest,
    strm.next_in = (uint8_t *) in_data;
    strm.avail_in = in_data_size;
 
-   int ret = deflateInit(&strm, Z_BEST_COMPRESSION);
+   int ret = deflateInit(&strm, level < 0 ? Z_BEST_COMPRESSION : level);
    if (ret != Z_OK)
        return 0;
 
@@ -788,6 +1798,74 @@ deflate_and_write_to_disk(const void *in_data, size_t in_data_size, int dest,
    return compressed_size;
 }
 
+#ifdef HAVE_ZSTD
+/* zstd is much faster than zlib to decompress, at a similar ratio for
+ * level 1 and a better one at higher levels.
+ */
+#define ZSTD_DEFAULT_LEVEL 1
+
+static size_t
+zstd_compress_and_write_to_disk(const void *in_data, size_t in_data_size,
+                                int dest, int level)
+{
+   size_t out_size = ZSTD_compressBound(in_data_size);
+   void *out = malloc(out_size);
+   if (out == NULL)
+      return 0;
+
+   size_t compressed_size =
+      ZSTD_compress(out, out_size, in_data, in_data_size,
+                    level < 0 ? ZSTD_DEFAULT_LEVEL : level);
+   if (ZSTD_isError(compressed_size) ||
+       write_all(dest, out, compressed_size) == -1)
+      compressed_size = 0;
+
+   free(out);
+   return compressed_size;
+}
+#endif
+
+/**
+ * Compresses cache entry with the given compression and writes it to disk.
+ * Returns the size of the data written to disk, (or 0 on any error).
+ */
+static size_t
+compress_and_write_to_disk(enum disk_cache_compression compression, int level,
+                           const void *in_data, size_t in_data_size, int dest)
+{
+   switch (compression) {
+   case DISK_CACHE_COMPRESSION_NONE:
+      if (write_all(dest, in_data, in_data_size) == -1)
+         return 0;
+      return in_data_size;
+   case DISK_CACHE_COMPRESSION_ZLIB:
+      return deflate_and_write_to_disk(in_data, in_data_size, dest, level);
+#ifdef HAVE_ZSTD
+   case DISK_CACHE_COMPRESSION_ZSTD:
+      return zstd_compress_and_write_to_disk(in_data, in_data_size, dest,
+                                             level);
+#endif
+   default:
+      return 0;
+   }
+}
+
+/* Returns the maximum size of in_data_size bytes once compressed. */
+static size_t
+compress_bound(enum disk_cache_compression compression, size_t in_data_size)
+{
+   switch (compression) {
+#ifdef HAVE_ZSTD
+   case DISK_CACHE_COMPRESSION_ZSTD:
+      return ZSTD_compressBound(in_data_size);
+#endif
+   case DISK_CACHE_COMPRESSION_ZLIB:
+      return compressBound(in_data_size);
+   default:
+      return in_data_size;
+   }
+}
+
 static struct disk_cache_put_job *
 create_put_job(struct disk_cache *cache, const cache_key key,
                const void *data, size_t size,
@@ -802,6 +1880,8 @@ create_put_job(struct disk_cache *cache, const cache_key key,
       dc_job->data = dc_job + 1;
       memcpy(dc_job->data, data, size);
       dc_job->size = size;
+      dc_job->compression = cache->compression;
+      dc_job->compression_level = cache->compression_level;
 
       /* Copy the cache item metadata */
       if (cache_item_metadata) {
@@ -825,29 +1905,230 @@ create_put_job(struct disk_cache *cache, const cache_key key,
       }
    }
 
-   return dc_job;
+   return dc_job;
+
+fail:
+   free(dc_job);
+
+   return NULL;
+}
+
+static void
+destroy_put_job(void *job, int thread_index)
+{
+   if (job) {
+      struct disk_cache_put_job *dc_job = (struct disk_cache_put_job *) job;
+      free(dc_job->cache_item_metadata.keys);
+
+      free(job);
+   }
+}
+
+struct cache_entry_file_data {
+   uint32_t crc32;
+   uint32_t uncompressed_size;
+
+   /* One of enum disk_cache_compression. */
+   uint32_t compression;
+};
+
+/* Header of a record in a pack file. It is followed by the same driver keys
+ * blob and cache item metadata as the file of an entry, and then by the
+ * compressed data.
+ */
+struct cache_pack_record {
+   uint8_t key[CACHE_KEY_SIZE];
+   uint32_t metadata_size;
+   uint32_t compressed_size;
+   struct cache_entry_file_data cf_data;
+};
+
+/* Size of the driver keys blob and the cache item metadata of an entry. */
+static size_t
+entry_metadata_size(struct disk_cache_put_job *dc_job)
+{
+   size_t size = dc_job->cache->driver_keys_blob_size + sizeof(uint32_t);
+
+   if (dc_job->cache_item_metadata.type == CACHE_ITEM_TYPE_GLSL) {
+      size += sizeof(uint32_t) +
+              dc_job->cache_item_metadata.num_keys * sizeof(cache_key);
+   }
+
+   return size;
+}
+
+/* Write the driver keys blob and the cache item metadata of an entry.
+ *
+ * The driver_keys_blob can be used find information about the mesa version
+ * that produced the entry or deal with hash collisions, should that ever
+ * become a real problem. The cache item metadata can be used to deal with
+ * hash collisions, as well as providing useful information to 3rd party
+ * tools reading the cache files.
+ *
+ * Returns -1 on any error.
+ */
+static int
+write_entry_metadata(struct disk_cache_put_job *dc_job, int fd)
+{
+   int ret;
+
+   ret = write_all(fd, dc_job->cache->driver_keys_blob,
+                   dc_job->cache->driver_keys_blob_size);
+   if (ret == -1)
+      return -1;
+
+   ret = write_all(fd, &dc_job->cache_item_metadata.type,
+                   sizeof(uint32_t));
+   if (ret == -1)
+      return -1;
+
+   if (dc_job->cache_item_metadata.type == CACHE_ITEM_TYPE_GLSL) {
+      ret = write_all(fd, &dc_job->cache_item_metadata.num_keys,
+                      sizeof(uint32_t));
+      if (ret == -1)
+         return -1;
+
+      ret = write_all(fd, dc_job->cache_item_metadata.keys[0],
+                      dc_job->cache_item_metadata.num_keys *
+                      sizeof(cache_key));
+      if (ret == -1)
+         return -1;
+   }
+
+   return 0;
+}
+
+/* Evict the records of the previous lap around the ring of 'pack', up to
+ * 'end'. The pack must be locked.
+ */
+static void
+pack_evict_until(struct disk_cache *cache, struct cache_pack *pack,
+                 uint64_t end)
+{
+   struct cache_pack_header *header = pack->header;
+
+   while (header->tail && header->tail < end) {
+      uint64_t tail = header->tail;
+      uint64_t segment_end = pack_segment_end(pack, tail);
+      uint8_t *map = pack_map(pack, tail);
+      struct cache_pack_record record;
+
+      /* Padding, (or anything which doesn't look like a record), runs to
+       * the end of the segment.
+       */
+      header->tail = segment_end;
+
+      if (map == NULL || segment_end - tail < sizeof(record))
+         continue;
+
+      memcpy(&record, map, sizeof(record));
+      if ((uint64_t)record.metadata_size + record.compressed_size >
+          segment_end - tail - sizeof(record))
+         continue;
+
+      struct cache_pack_index_entry *entry =
+         pack_index_lookup(pack, record.key);
+      if (entry)
+         pack_index_clear(cache, entry, tail);
+
+      header->tail = tail + sizeof(record) + record.metadata_size +
+                     record.compressed_size;
+   }
+}
+
+/* Append an entry to its pack file. The pack is locked for the whole
+ * operation, while readers only ever go through the mapping and validate
+ * what they find there, so they never need the lock.
+ */
+static void
+cache_put_pack(struct disk_cache_put_job *dc_job)
+{
+   struct disk_cache *cache = dc_job->cache;
+   struct cache_pack *pack = get_pack(cache, dc_job->key);
+   struct cache_pack_header *header = pack->header;
+   struct cache_pack_index_entry *entry;
+   struct cache_pack_record record;
+   uint64_t offset, segment_end;
+   size_t metadata_size = entry_metadata_size(dc_job);
+
+   /* Give up if the entry can't fit in a segment, even when empty. */
+   uint64_t max_record_size = sizeof(record) + metadata_size +
+      compress_bound(dc_job->compression, dc_job->size);
+   if (max_record_size > pack->segment_size)
+      return;
+
+   if (flock(pack->fd, LOCK_EX) == -1)
+      return;
+
+   /* Another process might have written the same entry already. */
+   if (pack_index_lookup(pack, dc_job->key))
+      goto done;
+
+   /* If the record might not fit in the current segment, pad it and move on
+    * to the next one, going back to the first one after the last.
+    */
+   offset = header->head;
+   segment_end = pack_segment_end(pack, offset);
+   if (segment_end - offset < max_record_size) {
+      pack_evict_until(cache, pack, segment_end);
+
+      if (segment_end - offset >= sizeof(record)) {
+         memset(&record, 0, sizeof(record));
+         record.compressed_size = segment_end - offset - sizeof(record);
+         if (pwrite(pack->fd, &record, sizeof(record), offset) !=
+             sizeof(record))
+            goto done;
+      }
+
+      offset = segment_end;
+      if (offset == CACHE_PACK_DATA_START +
+                    pack->segment_count * pack->segment_size) {
+         offset = CACHE_PACK_DATA_START;
+         header->tail = CACHE_PACK_DATA_START;
+      }
+      header->head = offset;
+   }
+
+   /* Only evict the oldest records the new one might overwrite. */
+   pack_evict_until(cache, pack, offset + max_record_size);
+
+   if (lseek(pack->fd, offset + sizeof(record), SEEK_SET) == -1 ||
+       write_entry_metadata(dc_job, pack->fd) == -1)
+      goto done;
+
+   size_t compressed_size =
+      compress_and_write_to_disk(dc_job->compression,
+                                 dc_job->compression_level,
+                                 dc_job->data, dc_job->size, pack->fd);
+   if (compressed_size == 0)
+      goto done;
 
-fail:
-   free(dc_job);
+   memcpy(record.key, dc_job->key, CACHE_KEY_SIZE);
+   record.metadata_size = metadata_size;
+   record.compressed_size = compressed_size;
+   record.cf_data.crc32 = util_hash_crc32(dc_job->data, dc_job->size);
+   record.cf_data.uncompressed_size = dc_job->size;
+   record.cf_data.compression = dc_job->compression;
 
-   return NULL;
-}
+   if (pwrite(pack->fd, &record, sizeof(record), offset) != sizeof(record))
+      goto done;
 
-static void
-destroy_put_job(void *job, int thread_index)
-{
-   if (job) {
-      struct disk_cache_put_job *dc_job = (struct disk_cache_put_job *) job;
-      free(dc_job->cache_item_metadata.keys);
+   /* Now that the record is fully written, publish it in the index. The
+    * offset is cleared first, so that readers never pair the new key with
+    * the record of the entry we replace.
+    */
+   entry = pack_index_alloc(cache, pack, dc_job->key);
+   p_atomic_set(&entry->offset, 0);
+   memcpy(entry->key, dc_job->key, CACHE_KEY_SIZE);
+   entry->size = sizeof(record) + metadata_size + compressed_size;
+   p_atomic_set(&entry->offset, offset);
 
-      free(job);
-   }
-}
+   header->head = offset + entry->size;
+   p_atomic_add(cache->size, entry->size);
 
-struct cache_entry_file_data {
-   uint32_t crc32;
-   uint32_t uncompressed_size;
-};
+ done:
+   flock(pack->fd, LOCK_UN);
+}
 
 static void
 cache_put(void *job, int thread_index)
@@ -859,6 +2140,11 @@ cache_put(void *job, int thread_index)
    char *filename = NULL, *filename_tmp = NULL;
    struct disk_cache_put_job *dc_job = (struct disk_cache_put_job *) job;
 
+   if (dc_job->cache->single_file) {
+      cache_put_pack(dc_job);
+      return;
+   }
+
    filename = get_cache_file(dc_job->cache, dc_job->key);
    if (filename == NULL)
       goto done;
@@ -917,51 +2203,19 @@ cache_put(void *job, int thread_index)
     * by some other process.
     */
 
-   /* Write the driver_keys_blob, this can be used find information about the
-    * mesa version that produced the entry or deal with hash collisions,
-    * should that ever become a real problem.
-    */
-   ret = write_all(fd, dc_job->cache->driver_keys_blob,
-                   dc_job->cache->driver_keys_blob_size);
-   if (ret == -1) {
-      unlink(filename_tmp);
-      goto done;
-   }
-
-   /* Write the cache item metadata. This data can be used to deal with
-    * hash collisions, as well as providing useful information to 3rd party
-    * tools reading the cache files.
-    */
-   ret = write_all(fd, &dc_job->cache_item_metadata.type,
-                   sizeof(uint32_t));
+   ret = write_entry_metadata(dc_job, fd);
    if (ret == -1) {
       unlink(filename_tmp);
       goto done;
    }
 
-   if (dc_job->cache_item_metadata.type == CACHE_ITEM_TYPE_GLSL) {
-      ret = write_all(fd, &dc_job->cache_item_metadata.num_keys,
-                      sizeof(uint32_t));
-      if (ret == -1) {
-         unlink(filename_tmp);
-         goto done;
-      }
-
-      ret = write_all(fd, dc_job->cache_item_metadata.keys[0],
-                      dc_job->cache_item_metadata.num_keys *
-                      sizeof(cache_key));
-      if (ret == -1) {
-         unlink(filename_tmp);
-         goto done;
-      }
-   }
-
    /* Create CRC of the data. We will read this when restoring the cache and
     * use it to check for corruption.
     */
    struct cache_entry_file_data cf_data;
    cf_data.crc32 = util_hash_crc32(dc_job->data, dc_job->size);
    cf_data.uncompressed_size = dc_job->size;
+   cf_data.compression = dc_job->compression;
 
    size_t cf_data_size = sizeof(cf_data);
    ret = write_all(fd, &cf_data, cf_data_size);
@@ -974,8 +2228,10 @@ cache_put(void *job, int thread_index)
     * rename them atomically to the destination filename, and also
     * perform an atomic increment of the total cache size.
     */
-   size_t file_size = deflate_and_write_to_disk(dc_job->data, dc_job->size,
-                                                fd, filename_tmp);
+   size_t file_size = compress_and_write_to_disk(dc_job->compression,
+                                                 dc_job->compression_level,
+                                                 dc_job->data, dc_job->size,
+                                                 fd);
    if (file_size == 0) {
       unlink(filename_tmp);
       goto done;
@@ -994,6 +2250,7 @@ cache_put(void *job, int thread_index)
    }
 
    p_atomic_add(dc_job->cache->size, sb.st_blocks * 512);
+   lru_index_insert(dc_job->cache, dc_job->key, sb.st_blocks * 512);
 
  done:
    if (fd_final != -1)
@@ -1030,6 +2287,15 @@ disk_cache_put(struct disk_cache *cache, const cache_key key,
    }
 }
 
+void
+disk_cache_wait_for_idle(struct disk_cache *cache)
+{
+   if (cache->path_init_failed)
+      return;
+
+   util_queue_finish(&cache->cache_queue);
+}
+
 /**
  * Decompresses cache entry, returns true if successful.
  */
@@ -1069,8 +2335,162 @@ inflate_cache_data(uint8_t *in_data, size_t in_data_size,
    return true;
 }
 
-void *
-disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
+/**
+ * Decompresses cache entry stored with the given compression, returns true
+ * if successful.
+ */
+static bool
+decompress_cache_data(enum disk_cache_compression compression,
+                      uint8_t *in_data, size_t in_data_size,
+                      uint8_t *out_data, size_t out_data_size)
+{
+   switch (compression) {
+   case DISK_CACHE_COMPRESSION_NONE:
+      if (in_data_size != out_data_size)
+         return false;
+      memcpy(out_data, in_data, out_data_size);
+      return true;
+   case DISK_CACHE_COMPRESSION_ZLIB:
+      return inflate_cache_data(in_data, in_data_size, out_data,
+                                out_data_size);
+#ifdef HAVE_ZSTD
+   case DISK_CACHE_COMPRESSION_ZSTD: {
+      size_t ret = ZSTD_decompress(out_data, out_data_size,
+                                   in_data, in_data_size);
+      return !ZSTD_isError(ret) && ret == out_data_size;
+   }
+#endif
+   default:
+      /* Written by a build of Mesa with more codecs than us. */
+      return false;
+   }
+}
+
+/* Return whether 'in_data' can be decompressed to 'out_data_size' bytes with
+ * the given compression, so that corrupted entries don't make us allocate
+ * an arbitrary amount of memory.
+ */
+static bool
+uncompressed_size_is_valid(enum disk_cache_compression compression,
+                           const uint8_t *in_data, size_t in_data_size,
+                           size_t out_data_size)
+{
+   switch (compression) {
+   case DISK_CACHE_COMPRESSION_NONE:
+      return out_data_size == in_data_size;
+   case DISK_CACHE_COMPRESSION_ZLIB:
+      /* The maximum compression ratio of deflate is 1032:1. */
+      return out_data_size / 1032 <= in_data_size;
+#ifdef HAVE_ZSTD
+   case DISK_CACHE_COMPRESSION_ZSTD:
+      /* Our frames always record the size of their content. */
+      return ZSTD_getFrameContentSize(in_data, in_data_size) == out_data_size;
+#endif
+   default:
+      return false;
+   }
+}
+
+/* Check the driver keys blob and cache item metadata of a pack record, as
+ * cache_get() does for the file of an entry.
+ */
+static bool
+pack_record_metadata_is_valid(struct disk_cache *cache,
+                              const uint8_t *metadata, size_t metadata_size)
+{
+   size_t ck_size = cache->driver_keys_blob_size;
+   uint64_t cache_item_md_size = sizeof(uint32_t);
+   uint32_t md_type;
+
+   if (metadata_size < ck_size + cache_item_md_size)
+      return false;
+
+   /* The packs are shared by all the drivers and builds using the cache
+    * directory, so a record of another one is only a miss.
+    */
+   if (memcmp(cache->driver_keys_blob, metadata, ck_size) != 0)
+      return false;
+
+   memcpy(&md_type, metadata + ck_size, sizeof(uint32_t));
+   if (md_type == CACHE_ITEM_TYPE_GLSL) {
+      uint32_t num_keys;
+
+      cache_item_md_size += sizeof(uint32_t);
+      if (metadata_size < ck_size + cache_item_md_size)
+         return false;
+
+      memcpy(&num_keys, metadata + ck_size + sizeof(uint32_t),
+             sizeof(uint32_t));
+      cache_item_md_size += (uint64_t)num_keys * sizeof(cache_key);
+   }
+
+   return metadata_size == ck_size + cache_item_md_size;
+}
+
+/* Read an entry from its pack file. The compressed data is decompressed
+ * straight from the mapping, without any file I/O or intermediate copy.
+ */
+static void *
+cache_get_pack(struct disk_cache *cache, const cache_key key, size_t *size)
+{
+   struct cache_pack *pack = get_pack(cache, key);
+   struct cache_pack_index_entry *entry;
+   struct cache_pack_record record;
+   uint8_t *uncompressed_data;
+   const uint8_t *data;
+   uint64_t offset;
+   uint8_t *map;
+
+   entry = pack_index_lookup(pack, key);
+   if (entry == NULL)
+      return NULL;
+
+   /* The entry might be rewritten at any time by another process, so
+    * validate everything we read against the bounds of the segment, the
+    * key and the CRC of the data.
+    */
+   offset = p_atomic_read(&entry->offset);
+   map = pack_map(pack, offset);
+   if (map == NULL ||
+       pack_segment_end(pack, offset) - offset < sizeof(record))
+      return NULL;
+
+   memcpy(&record, map, sizeof(record));
+   if (memcmp(record.key, key, CACHE_KEY_SIZE) != 0 ||
+       pack_segment_end(pack, offset) - offset - sizeof(record) <
+          (uint64_t)record.metadata_size + record.compressed_size ||
+       !pack_record_metadata_is_valid(cache, map + sizeof(record),
+                                      record.metadata_size))
+      return NULL;
+
+   data = map + sizeof(record) + record.metadata_size;
+   if (!uncompressed_size_is_valid(record.cf_data.compression, data,
+                                   record.compressed_size,
+                                   record.cf_data.uncompressed_size))
+      return NULL;
+
+   uncompressed_data = malloc(record.cf_data.uncompressed_size);
+   if (uncompressed_data == NULL)
+      return NULL;
+
+   if (!decompress_cache_data(record.cf_data.compression, data,
+                              record.compressed_size, uncompressed_data,
+                              record.cf_data.uncompressed_size) ||
+       record.cf_data.crc32 != util_hash_crc32(uncompressed_data,
+                                               record.cf_data.uncompressed_size)) {
+      free(uncompressed_data);
+      return NULL;
+   }
+
+   if (size)
+      *size = record.cf_data.uncompressed_size;
+
+   return uncompressed_data;
+}
+
+/* Read the entry for 'key' from the disk, returns NULL if not found. */
+static void *
+cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
 {
    int fd = -1, ret;
    struct stat sb;
@@ -1079,30 +2499,8 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
    uint8_t *uncompressed_data = NULL;
    uint8_t *file_header = NULL;
 
-   if (size)
-      *size = 0;
-
-   if (cache->blob_get_cb) {
-      /* This is what Android EGL defines as the maxValueSize in egl_cache_t
-       * class implementation.
-       */
-      const signed long max_blob_size = 64 * 1024;
-      void *blob = malloc(max_blob_size);
-      if (!blob)
-         return NULL;
-
-      signed long bytes =
-         cache->blob_get_cb(key, CACHE_KEY_SIZE, blob, max_blob_size);
-
-      if (!bytes) {
-         free(blob);
-         return NULL;
-      }
-
-      if (size)
-         *size = bytes;
-      return blob;
-   }
+   if (cache->single_file)
+      return cache_get_pack(cache, key, size);
 
    filename = get_cache_file(cache, key);
    if (filename == NULL)
@@ -1115,10 +2513,6 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
    if (fstat(fd, &sb) == -1)
       goto fail;
 
-   data = malloc(sb.st_size);
-   if (data == NULL)
-      goto fail;
-
    size_t ck_size = cache->driver_keys_blob_size;
    file_header = malloc(ck_size);
    if (!file_header)
@@ -1169,18 +2563,46 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
    if (ret == -1)
       goto fail;
 
-   /* Load the actual cache data. */
+   if (sb.st_size < cf_data_size + ck_size + cache_item_md_size)
+      goto fail;
+
+   /* Load the actual cache data. Uncompressed data can be read in place. */
    size_t cache_data_size =
       sb.st_size - cf_data_size - ck_size - cache_item_md_size;
-   ret = read_all(fd, data, cache_data_size);
-   if (ret == -1)
-      goto fail;
+   if (cf_data.compression == DISK_CACHE_COMPRESSION_NONE) {
+      if (cache_data_size != cf_data.uncompressed_size)
+         goto fail;
 
-   /* Uncompress the cache data */
-   uncompressed_data = malloc(cf_data.uncompressed_size);
-   if (!inflate_cache_data(data, cache_data_size, uncompressed_data,
-                           cf_data.uncompressed_size))
-      goto fail;
+      uncompressed_data = malloc(cf_data.uncompressed_size);
+      if (!uncompressed_data)
+         goto fail;
+
+      ret = read_all(fd, uncompressed_data, cache_data_size);
+      if (ret == -1)
+         goto fail;
+   } else {
+      data = malloc(cache_data_size);
+      if (data == NULL)
+         goto fail;
+
+      ret = read_all(fd, data, cache_data_size);
+      if (ret == -1)
+         goto fail;
+
+      if (!uncompressed_size_is_valid(cf_data.compression, data,
+                                      cache_data_size,
+                                      cf_data.uncompressed_size))
+         goto fail;
+
+      uncompressed_data = malloc(cf_data.uncompressed_size);
+      if (!uncompressed_data)
+         goto fail;
+
+      /* Uncompress the cache data */
+      if (!decompress_cache_data(cf_data.compression, data, cache_data_size,
+                                 uncompressed_data, cf_data.uncompressed_size))
+         goto fail;
+   }
 
    /* Check the data for corruption */
    if (cf_data.crc32 != util_hash_crc32(uncompressed_data,
@@ -1192,6 +2614,8 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
    free(file_header);
    close(fd);
 
+   lru_index_touch(cache, key);
+
    if (size)
       *size = cf_data.uncompressed_size;
 
@@ -1212,6 +2636,172 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
    return NULL;
 }
 
+static void
+prefetch_job_execute(void *job, int thread_index)
+{
+   struct disk_cache_prefetch_job *pf_job =
+      (struct disk_cache_prefetch_job *) job;
+
+   pf_job->data = cache_get(pf_job->cache, pf_job->key, &pf_job->size);
+}
+
+/* Remove the prefetch job for 'key' from the cache, if any. The caller
+ * owns the job afterwards.
+ */
+static struct disk_cache_prefetch_job *
+take_prefetch_job(struct disk_cache *cache, const cache_key key)
+{
+   struct disk_cache_prefetch_job *job = NULL;
+
+   mtx_lock(&cache->prefetch_mtx);
+   if (cache->prefetch_jobs) {
+      struct hash_entry *entry =
+         _mesa_hash_table_search(cache->prefetch_jobs, key);
+      if (entry) {
+         job = entry->data;
+         _mesa_hash_table_remove(cache->prefetch_jobs, entry);
+         list_del(&job->link);
+         cache->num_prefetch_jobs--;
+      }
+   }
+   mtx_unlock(&cache->prefetch_mtx);
+
+   return job;
+}
+
+void *
+disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
+{
+   if (size)
+      *size = 0;
+
+   if (cache->blob_get_cb) {
+      /* This is what Android EGL defines as the maxValueSize in egl_cache_t
+       * class implementation.
+       */
+      const signed long max_blob_size = 64 * 1024;
+      void *blob = malloc(max_blob_size);
+      if (!blob)
+         return NULL;
+
+      signed long bytes =
+         cache->blob_get_cb(key, CACHE_KEY_SIZE, blob, max_blob_size);
+
+      if (!bytes) {
+         free(blob);
+         return NULL;
+      }
+
+      if (size)
+         *size = bytes;
+      return blob;
+   }
+
+   if (cache->path_init_failed)
+      return NULL;
+
+   /* If the entry was prefetched, just wait for the read to complete. */
+   struct disk_cache_prefetch_job *job = take_prefetch_job(cache, key);
+   if (job) {
+      util_queue_fence_wait(&job->fence);
+
+      void *data = job->data;
+      if (data && size)
+         *size = job->size;
+
+      util_queue_fence_destroy(&job->fence);
+      free(job);
+
+      return data;
+   }
+
+   return cache_get(cache, key, size);
+}
+
+static uint32_t
+prefetch_key_hash(const void *key)
+{
+   /* Cache keys are SHA-1 hashes already. */
+   uint32_t hash;
+   memcpy(&hash, key, sizeof(hash));
+   return hash;
+}
+
+static bool
+prefetch_key_equals(const void *a, const void *b)
+{
+   return memcmp(a, b, CACHE_KEY_SIZE) == 0;
+}
+
+void
+disk_cache_prefetch(struct disk_cache *cache, const cache_key *keys,
+                    unsigned num_keys)
+{
+   if (cache->blob_get_cb || cache->path_init_failed)
+      return;
+
+   mtx_lock(&cache->prefetch_mtx);
+
+   if (!util_queue_is_initialized(&cache->prefetch_queue)) {
+      cache->prefetch_jobs = _mesa_hash_table_create(cache, prefetch_key_hash,
+                                                     prefetch_key_equals);
+      list_inithead(&cache->prefetch_list);
+
+      /* Reads are mostly waiting on the disk, so a few threads help even on
+       * machines with less cores. They are only created when the reads
+       * actually pile up.
+       */
+      if (!cache->prefetch_jobs ||
+          !util_queue_init(&cache->prefetch_queue, "disk_cache_get", 32, 4,
+                           UTIL_QUEUE_INIT_RESIZE_IF_FULL |
+                           UTIL_QUEUE_INIT_SCALE_THREADS)) {
+         ralloc_free(cache->prefetch_jobs);
+         cache->prefetch_jobs = NULL;
+         mtx_unlock(&cache->prefetch_mtx);
+         return;
+      }
+   }
+
+   for (unsigned i = 0; i < num_keys; i++) {
+      if (_mesa_hash_table_search(cache->prefetch_jobs, keys[i]))
+         continue;
+
+      /* Drop the oldest job if nobody asked for the prefetched entries. */
+      if (cache->num_prefetch_jobs >= CACHE_PREFETCH_MAX_ENTRIES) {
+         struct disk_cache_prefetch_job *old =
+            LIST_ENTRY(struct disk_cache_prefetch_job,
+                       cache->prefetch_list.next, link);
+
+         util_queue_drop_job(&cache->prefetch_queue, &old->fence);
+         _mesa_hash_table_remove_key(cache->prefetch_jobs, old->key);
+         list_del(&old->link);
+         cache->num_prefetch_jobs--;
+
+         util_queue_fence_destroy(&old->fence);
+         free(old->data);
+         free(old);
+      }
+
+      struct disk_cache_prefetch_job *job = calloc(1, sizeof(*job));
+      if (!job)
+         break;
+
+      job->cache = cache;
+      memcpy(job->key, keys[i], CACHE_KEY_SIZE);
+      util_queue_fence_init(&job->fence);
+
+      _mesa_hash_table_insert(cache->prefetch_jobs, job->key, job);
+      list_addtail(&job->link, &cache->prefetch_list);
+      cache->num_prefetch_jobs++;
+
+      util_queue_add_job(&cache->prefetch_queue, job, &job->fence,
+                         prefetch_job_execute, NULL);
+   }
+
+   mtx_unlock(&cache->prefetch_mtx);
+}
+
+
 void
 disk_cache_put_key(struct disk_cache *cache, const cache_key key)
 {
@@ -1280,4 +2870,17 @@ disk_cache_set_callbacks(struct disk_cache *cache, disk_cache_put_cb put,
    cache->blob_get_cb = get;
 }
 
+bool
+disk_cache_set_compression(struct disk_cache *cache,
+                           enum disk_cache_compression compression,
+                           int level)
+{
+   if (!compression_level_is_valid(compression, level))
+      return false;
+
+   cache->compression = compression;
+   cache->compression_level = level;
+   return true;
+}
+
 #endif /* ENABLE_SHADER_CACHE */
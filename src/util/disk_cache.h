@@ -46,6 +46,21 @@ extern "C" {
 
 typedef uint8_t cache_key[CACHE_KEY_SIZE];
 
+/* Compression of the cache entries. These values are stored within the
+ * entries, so do not renumber them.
+ */
+enum disk_cache_compression {
+   DISK_CACHE_COMPRESSION_NONE = 0,
+   DISK_CACHE_COMPRESSION_ZLIB = 1,
+   DISK_CACHE_COMPRESSION_ZSTD = 2,
+};
+
+#ifdef HAVE_ZSTD
+#define DISK_CACHE_COMPRESSION_DEFAULT DISK_CACHE_COMPRESSION_ZSTD
+#else
+#define DISK_CACHE_COMPRESSION_DEFAULT DISK_CACHE_COMPRESSION_ZLIB
+#endif
+
 /* WARNING: 3rd party applications might be reading the cache item metadata.
  * Do not change these values without making the change widely known.
  * Please contact Valve developers and make them aware of this change.
@@ -194,6 +209,15 @@ disk_cache_put(struct disk_cache *cache, const cache_key key,
                const void *data, size_t size,
                struct cache_item_metadata *cache_item_metadata);
 
+/**
+ * Wait for the items passed to disk_cache_put() so far to be written.
+ *
+ * Pending writes are dropped by disk_cache_destroy(), so this is mostly
+ * useful to tests and benchmarks.
+ */
+void
+disk_cache_wait_for_idle(struct disk_cache *cache);
+
 /**
  * Retrieve an item previously stored in the cache with the name <key>.
  *
@@ -210,6 +234,18 @@ disk_cache_put(struct disk_cache *cache, const cache_key key,
 void *
 disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size);
 
+/**
+ * Start reading the items stored with the names in \keys in the background.
+ *
+ * A later disk_cache_get() call for one of the keys waits for the read to
+ * complete instead of accessing the disk itself. Prefetched items which are
+ * never retrieved are eventually dropped. This is only a hint, and it is a
+ * no-op if the cache isn't backed by the disk.
+ */
+void
+disk_cache_prefetch(struct disk_cache *cache, const cache_key *keys,
+                    unsigned num_keys);
+
 /**
  * Store the name \key within the cache, (without any associated data).
  *
@@ -246,6 +282,25 @@ void
 disk_cache_set_callbacks(struct disk_cache *cache, disk_cache_put_cb put,
                          disk_cache_get_cb get);
 
+/**
+ * Select the compression of the entries stored from now on, (the default
+ * can be overridden with MESA_GLSL_CACHE_COMPRESSION). \level is specific
+ * to the compression: 0 to 9 for zlib, and 0 to ZSTD_maxCLevel() for zstd.
+ * A negative value selects the default level of the compression, which is
+ * the best compression for zlib and a fast level for zstd. Uncompressed
+ * entries only accept 0 or a negative value.
+ *
+ * Entries written with any compression can always be read back.
+ *
+ * \return false, (leaving the compression unchanged), if Mesa was built
+ * without support for \compression, or if \compression or \level isn't
+ * valid.
+ */
+bool
+disk_cache_set_compression(struct disk_cache *cache,
+                           enum disk_cache_compression compression,
+                           int level);
+
 #else
 
 static inline struct disk_cache *
@@ -268,6 +323,12 @@ disk_cache_put(struct disk_cache *cache, const cache_key key,
    return;
 }
 
+static inline void
+disk_cache_wait_for_idle(struct disk_cache *cache)
+{
+   return;
+}
+
 static inline void
 disk_cache_remove(struct disk_cache *cache, const cache_key key)
 {
@@ -280,6 +341,13 @@ disk_cache_get(struct disk_cache *cache, const cache_key key, size_t *size)
    return NULL;
 }
 
+static inline void
+disk_cache_prefetch(struct disk_cache *cache, const cache_key *keys,
+                    unsigned num_keys)
+{
+   return;
+}
+
 static inline void
 disk_cache_put_key(struct disk_cache *cache, const cache_key key)
 {
@@ -306,6 +374,14 @@ disk_cache_set_callbacks(struct disk_cache *cache, disk_cache_put_cb put,
    return;
 }
 
+static inline bool
+disk_cache_set_compression(struct disk_cache *cache,
+                           enum disk_cache_compression compression,
+                           int level)
+{
+   return false;
+}
+
 #endif /* ENABLE_SHADER_CACHE */
 
 #ifdef __cplusplus
@@ -0,0 +1,223 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * Metadata probing shared by the hash table and the set.
+ *
+ * Next to its array of entries, each table keeps one metadata byte per
+ * entry.  A present entry stores a 7-bit tag taken from its hash, which
+ * leaves the high bit for the empty and deleted markers.  The bytes are
+ * probed a group of HASH_GROUP_SIZE at a time, so a lookup only touches
+ * the entries whose tag matches instead of every entry on the probe
+ * sequence.
+ *
+ * Tables are a power of two in size.  Tables smaller than a group still get
+ * a full group of metadata, padded with HASH_META_SENTINEL, which never
+ * matches anything.
+ */
+
+#ifndef HASH_PROBE_H
+#define HASH_PROBE_H
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "bitscan.h"
+#include "macros.h"
+
+#define HASH_GROUP_SIZE 16
+
+#define HASH_META_EMPTY    0x80
+#define HASH_META_DELETED  0xfe
+#define HASH_META_SENTINEL 0xff
+
+#define HASH_MIN_SIZE_INDEX 2
+#define HASH_MAX_SIZE_INDEX 31
+
+static inline bool
+hash_meta_is_present(uint8_t meta)
+{
+   return !(meta & 0x80);
+}
+
+/**
+ * Scrambles a user provided hash.
+ *
+ * Group selection uses the low bits and the tag the high bits of the hash,
+ * and many of our hash functions (_mesa_hash_pointer for one) only spread
+ * their input over a few of the bits.  This is the MurmurHash3 finalizer.
+ */
+static inline uint32_t
+hash_probe_mix(uint32_t hash)
+{
+   hash ^= hash >> 16;
+   hash *= 0x85ebca6b;
+   hash ^= hash >> 13;
+   hash *= 0xc2b2ae35;
+   hash ^= hash >> 16;
+   return hash;
+}
+
+static inline uint8_t
+hash_probe_tag(uint32_t mixed)
+{
+   return mixed >> 25;
+}
+
+static inline uint32_t
+hash_num_groups(uint32_t size)
+{
+   return MAX2(size / HASH_GROUP_SIZE, 1);
+}
+
+/** Number of metadata bytes allocated for a table of the given size. */
+static inline uint32_t
+hash_meta_size(uint32_t size)
+{
+   return MAX2(size, HASH_GROUP_SIZE);
+}
+
+/** A table may hold up to 7/8 of its size in entries plus tombstones. */
+static inline uint32_t
+hash_max_entries(uint32_t size)
+{
+   return size - size / 8;
+}
+
+/**
+ * Returns a mask of the lanes in the group whose metadata equals the value.
+ */
+static inline unsigned
+hash_group_match(const uint8_t *meta, uint8_t value)
+{
+#ifdef __SSE2__
+   __m128i group = _mm_loadu_si128((const __m128i *)meta);
+   __m128i cmp = _mm_cmpeq_epi8(group, _mm_set1_epi8((char)value));
+   return _mm_movemask_epi8(cmp);
+#else
+   unsigned mask = 0;
+
+   for (unsigned i = 0; i < HASH_GROUP_SIZE; i++)
+      mask |= (unsigned)(meta[i] == value) << i;
+
+   return mask;
+#endif
+}
+
+static inline unsigned
+hash_group_match_empty(const uint8_t *meta)
+{
+   return hash_group_match(meta, HASH_META_EMPTY);
+}
+
+/** Returns a mask of the empty or deleted lanes in the group. */
+static inline unsigned
+hash_group_match_available(const uint8_t *meta)
+{
+#ifdef __SSE2__
+   __m128i group = _mm_loadu_si128((const __m128i *)meta);
+   __m128i empty = _mm_cmpeq_epi8(group, _mm_set1_epi8((char)HASH_META_EMPTY));
+   __m128i deleted = _mm_cmpeq_epi8(group,
+                                    _mm_set1_epi8((char)HASH_META_DELETED));
+   return _mm_movemask_epi8(_mm_or_si128(empty, deleted));
+#else
+   return hash_group_match(meta, HASH_META_EMPTY) |
+          hash_group_match(meta, HASH_META_DELETED);
+#endif
+}
+
+/** Returns a mask of the present lanes in the group. */
+static inline unsigned
+hash_group_match_present(const uint8_t *meta)
+{
+#ifdef __SSE2__
+   __m128i group = _mm_loadu_si128((const __m128i *)meta);
+   return ~_mm_movemask_epi8(group) & 0xffff;
+#else
+   unsigned mask = 0;
+
+   for (unsigned i = 0; i < HASH_GROUP_SIZE; i++)
+      mask |= (unsigned)hash_meta_is_present(meta[i]) << i;
+
+   return mask;
+#endif
+}
+
+/**
+ * Returns the index of the first present entry at or after the given one,
+ * or size if there is none.
+ */
+static inline uint32_t
+hash_meta_next_present(const uint8_t *meta, uint32_t size, uint32_t index)
+{
+   while (index < size) {
+      uint32_t group = index & ~(HASH_GROUP_SIZE - 1);
+      unsigned present = hash_group_match_present(meta + group) >>
+                         (index - group);
+
+      if (present)
+         return index + ffs(present) - 1;
+
+      index = group + HASH_GROUP_SIZE;
+   }
+
+   return size;
+}
+
+/**
+ * Initializes the metadata of a freshly allocated table.
+ */
+static inline void
+hash_meta_init(uint8_t *meta, uint32_t size)
+{
+   memset(meta, HASH_META_EMPTY, size);
+   memset(meta + size, HASH_META_SENTINEL, hash_meta_size(size) - size);
+}
+
+/**
+ * Marks the given slot as no longer present, and returns whether it had to
+ * leave a tombstone behind.
+ *
+ * If the slot's group still has an empty lane, no probe sequence ever
+ * continued past this group, so the slot can simply become empty again.
+ */
+static inline bool
+hash_meta_remove(uint8_t *meta, uint32_t index)
+{
+   const uint8_t *group = meta + (index & ~(HASH_GROUP_SIZE - 1));
+
+   if (hash_group_match_empty(group)) {
+      meta[index] = HASH_META_EMPTY;
+      return false;
+   }
+
+   meta[index] = HASH_META_DELETED;
+   return true;
+}
+
+#endif /* HASH_PROBE_H */
@@ -33,7 +33,12 @@
  */
 
 /**
- * Implements an open-addressing, linear-reprobing hash table.
+ * Implements an open-addressing hash table.
+ *
+ * Each entry has a metadata byte in a separate array, holding either a tag
+ * from the entry's hash or an empty/deleted marker, and probing walks that
+ * array a group of entries at a time (see hash_probe.h), only looking at the
+ * entries whose tag matches the key's.
  *
  * For more information, see:
  *
@@ -45,69 +50,61 @@
 #include <assert.h>
 
 #include "hash_table.h"
+#include "hash_probe.h"
 #include "ralloc.h"
 #include "macros.h"
-#include "main/hash.h"
 
 static const uint32_t deleted_key_value;
 
+static int
+entry_is_present(const struct hash_table *ht, struct hash_entry *entry)
+{
+   return hash_meta_is_present(ht->meta[entry - ht->table]);
+}
+
 /**
- * From Knuth -- a good choice for hash/rehash values is p, p-2 where
- * p and p-2 are both prime.  These tables are sized to have an extra 10%
- * free to avoid exponential performance degradation as the hash table fills
+ * Compares two keys, without the indirect call for tables of pointers.
  */
-static const struct {
-   uint32_t max_entries, size, rehash;
-} hash_sizes[] = {
-   { 2,			5,		3	  },
-   { 4,			7,		5	  },
-   { 8,			13,		11	  },
-   { 16,		19,		17	  },
-   { 32,		43,		41        },
-   { 64,		73,		71        },
-   { 128,		151,		149       },
-   { 256,		283,		281       },
-   { 512,		571,		569       },
-   { 1024,		1153,		1151      },
-   { 2048,		2269,		2267      },
-   { 4096,		4519,		4517      },
-   { 8192,		9013,		9011      },
-   { 16384,		18043,		18041     },
-   { 32768,		36109,		36107     },
-   { 65536,		72091,		72089     },
-   { 131072,		144409,		144407    },
-   { 262144,		288361,		288359    },
-   { 524288,		576883,		576881    },
-   { 1048576,		1153459,	1153457   },
-   { 2097152,		2307163,	2307161   },
-   { 4194304,		4613893,	4613891   },
-   { 8388608,		9227641,	9227639   },
-   { 16777216,		18455029,	18455027  },
-   { 33554432,		36911011,	36911009  },
-   { 67108864,		73819861,	73819859  },
-   { 134217728,		147639589,	147639587 },
-   { 268435456,		295279081,	295279079 },
-   { 536870912,		590559793,	590559791 },
-   { 1073741824,	1181116273,	1181116271},
-   { 2147483648ul,	2362232233ul,	2362232231ul}
-};
-
-static int
-entry_is_free(const struct hash_entry *entry)
+static inline bool
+hash_table_key_equals(const struct hash_table *ht, const void *a,
+                      const void *b)
 {
-   return entry->key == NULL;
+   if (ht->key_equals_function == _mesa_key_pointer_equal)
+      return a == b;
+
+   return ht->key_equals_function(a, b);
 }
 
-static int
-entry_is_deleted(const struct hash_table *ht, struct hash_entry *entry)
+/**
+ * Allocates the entries of a table of the given size together with their
+ * metadata, which lives right after the entries.
+ */
+static struct hash_entry *
+hash_table_alloc_table(void *mem_ctx, unsigned size_index)
 {
-   return entry->key == ht->deleted_key;
+   uint32_t size;
+
+   if (size_index > HASH_MAX_SIZE_INDEX)
+      return NULL;
+
+   size = 1u << size_index;
+   return ralloc_size(mem_ctx, size * sizeof(struct hash_entry) +
+                               hash_meta_size(size));
 }
 
-static int
-entry_is_present(const struct hash_table *ht, struct hash_entry *entry)
+static void
+hash_table_set_table(struct hash_table *ht, struct hash_entry *table,
+                     unsigned size_index)
 {
-   return entry->key != NULL && entry->key != ht->deleted_key;
+   ht->table = table;
+   ht->size_index = size_index;
+   ht->size = 1u << size_index;
+   ht->meta = (uint8_t *)(table + ht->size);
+   ht->max_entries = hash_max_entries(ht->size);
+   ht->entries = 0;
+   ht->deleted_entries = 0;
+
+   hash_meta_init(ht->meta, ht->size);
 }
 
 bool
@@ -117,18 +114,21 @@ _mesa_hash_table_init(struct hash_table *ht,
                       bool (*key_equals_function)(const void *a,
                                                   const void *b))
 {
-   ht->size_index = 0;
-   ht->size = hash_sizes[ht->size_index].size;
-   ht->rehash = hash_sizes[ht->size_index].rehash;
-   ht->max_entries = hash_sizes[ht->size_index].max_entries;
+   struct hash_entry *table = hash_table_alloc_table(mem_ctx,
+                                                     HASH_MIN_SIZE_INDEX);
+
    ht->key_hash_function = key_hash_function;
    ht->key_equals_function = key_equals_function;
-   ht->table = rzalloc_array(mem_ctx, struct hash_entry, ht->size);
-   ht->entries = 0;
-   ht->deleted_entries = 0;
    ht->deleted_key = &deleted_key_value;
 
-   return ht->table != NULL;
+   if (table == NULL) {
+      ht->table = NULL;
+      return false;
+   }
+
+   hash_table_set_table(ht, table, HASH_MIN_SIZE_INDEX);
+
+   return true;
 }
 
 struct hash_table *
@@ -165,13 +165,15 @@ _mesa_hash_table_clone(struct hash_table *src, void *dst_mem_ctx)
 
    memcpy(ht, src, sizeof(struct hash_table));
 
-   ht->table = ralloc_array(ht, struct hash_entry, ht->size);
+   ht->table = hash_table_alloc_table(ht, ht->size_index);
    if (ht->table == NULL) {
       ralloc_free(ht);
       return NULL;
    }
+   ht->meta = (uint8_t *)(ht->table + ht->size);
 
-   memcpy(ht->table, src->table, ht->size * sizeof(struct hash_entry));
+   memcpy(ht->table, src->table, ht->size * sizeof(struct hash_entry) +
+                                 hash_meta_size(ht->size));
 
    return ht;
 }
@@ -207,31 +209,22 @@ void
 _mesa_hash_table_clear(struct hash_table *ht,
                        void (*delete_function)(struct hash_entry *entry))
 {
-   struct hash_entry *entry;
-
-   for (entry = ht->table; entry != ht->table + ht->size; entry++) {
-      if (entry->key == NULL)
-         continue;
-
-      if (delete_function != NULL && entry->key != ht->deleted_key)
+   if (delete_function) {
+      hash_table_foreach(ht, entry) {
          delete_function(entry);
-
-      entry->key = NULL;
+      }
    }
 
+   hash_meta_init(ht->meta, ht->size);
    ht->entries = 0;
    ht->deleted_entries = 0;
 }
 
 /** Sets the value of the key pointer used for deleted entries in the table.
  *
- * The assumption is that usually keys are actual pointers, so we use a
- * default value of a pointer to an arbitrary piece of storage in the library.
- * But in some cases a consumer wants to store some other sort of value in the
- * table, like a uint32_t, in which case that pointer may conflict with one of
- * their valid keys.  This lets that user select a safe value.
- *
- * This must be called before any keys are actually deleted from the table.
+ * Deleted entries are tracked in the metadata, so the table itself no longer
+ * uses this value and any non-NULL key can be stored.  It is only kept for
+ * existing callers.
  */
 void
 _mesa_hash_table_set_deleted_key(struct hash_table *ht, const void *deleted_key)
@@ -242,26 +235,29 @@ _mesa_hash_table_set_deleted_key(struct hash_table *ht, const void *deleted_key)
 static struct hash_entry *
 hash_table_search(struct hash_table *ht, uint32_t hash, const void *key)
 {
-   uint32_t start_hash_address = hash % ht->size;
-   uint32_t hash_address = start_hash_address;
+   uint32_t mixed = hash_probe_mix(hash);
+   uint8_t tag = hash_probe_tag(mixed);
+   uint32_t group_mask = hash_num_groups(ht->size) - 1;
+   uint32_t group = mixed & group_mask;
 
-   do {
-      uint32_t double_hash;
+   for (uint32_t i = 1; i <= group_mask + 1; i++) {
+      struct hash_entry *entries = ht->table + group * HASH_GROUP_SIZE;
+      const uint8_t *meta = ht->meta + group * HASH_GROUP_SIZE;
+      unsigned match = hash_group_match(meta, tag);
 
-      struct hash_entry *entry = ht->table + hash_address;
+      while (match) {
+         struct hash_entry *entry = entries + u_bit_scan(&match);
 
-      if (entry_is_free(entry)) {
-         return NULL;
-      } else if (entry_is_present(ht, entry) && entry->hash == hash) {
-         if (ht->key_equals_function(key, entry->key)) {
+         if (entry->hash == hash &&
+             hash_table_key_equals(ht, key, entry->key))
             return entry;
-         }
       }
 
-      double_hash = 1 + hash % ht->rehash;
+      if (hash_group_match_empty(meta))
+         return NULL;
 
-      hash_address = (hash_address + double_hash) % ht->size;
-   } while (hash_address != start_hash_address);
+      group = (group + i) & group_mask;
+   }
 
    return NULL;
 }
@@ -287,9 +283,37 @@ _mesa_hash_table_search_pre_hashed(struct hash_table *ht, uint32_t hash,
    return hash_table_search(ht, hash, key);
 }
 
-static struct hash_entry *
-hash_table_insert(struct hash_table *ht, uint32_t hash,
-                  const void *key, void *data);
+/**
+ * Inserts an entry into a table being rehashed, where all the keys are known
+ * to be different and there are no deleted entries.
+ */
+static void
+hash_table_insert_rehash(struct hash_table *ht, uint32_t hash,
+                         const void *key, void *data)
+{
+   uint32_t mixed = hash_probe_mix(hash);
+   uint32_t group_mask = hash_num_groups(ht->size) - 1;
+   uint32_t group = mixed & group_mask;
+
+   for (uint32_t i = 1; ; i++) {
+      unsigned empty = hash_group_match_empty(ht->meta +
+                                              group * HASH_GROUP_SIZE);
+
+      if (empty) {
+         uint32_t index = group * HASH_GROUP_SIZE + ffs(empty) - 1;
+         struct hash_entry *entry = ht->table + index;
+
+         ht->meta[index] = hash_probe_tag(mixed);
+         entry->hash = hash;
+         entry->key = key;
+         entry->data = data;
+         ht->entries++;
+         return;
+      }
+
+      group = (group + i) & group_mask;
+   }
+}
 
 static void
 _mesa_hash_table_rehash(struct hash_table *ht, unsigned new_size_index)
@@ -297,26 +321,16 @@ _mesa_hash_table_rehash(struct hash_table *ht, unsigned new_size_index)
    struct hash_table old_ht;
    struct hash_entry *table;
 
-   if (new_size_index >= ARRAY_SIZE(hash_sizes))
-      return;
-
-   table = rzalloc_array(ralloc_parent(ht->table), struct hash_entry,
-                         hash_sizes[new_size_index].size);
+   table = hash_table_alloc_table(ralloc_parent(ht->table), new_size_index);
    if (table == NULL)
       return;
 
    old_ht = *ht;
 
-   ht->table = table;
-   ht->size_index = new_size_index;
-   ht->size = hash_sizes[ht->size_index].size;
-   ht->rehash = hash_sizes[ht->size_index].rehash;
-   ht->max_entries = hash_sizes[ht->size_index].max_entries;
-   ht->entries = 0;
-   ht->deleted_entries = 0;
+   hash_table_set_table(ht, table, new_size_index);
 
    hash_table_foreach(&old_ht, entry) {
-      hash_table_insert(ht, entry->hash, entry->key, entry->data);
+      hash_table_insert_rehash(ht, entry->hash, entry->key, entry->data);
    }
 
    ralloc_free(old_ht.table);
@@ -326,7 +340,9 @@ static struct hash_entry *
 hash_table_insert(struct hash_table *ht, uint32_t hash,
                   const void *key, void *data)
 {
-   uint32_t start_hash_address, hash_address;
+   uint32_t mixed = hash_probe_mix(hash);
+   uint8_t tag = hash_probe_tag(mixed);
+   uint32_t group_mask, group;
    struct hash_entry *available_entry = NULL;
 
    assert(key != NULL);
@@ -337,19 +353,12 @@ hash_table_insert(struct hash_table *ht, uint32_t hash,
       _mesa_hash_table_rehash(ht, ht->size_index);
    }
 
-   start_hash_address = hash % ht->size;
-   hash_address = start_hash_address;
-   do {
-      struct hash_entry *entry = ht->table + hash_address;
-      uint32_t double_hash;
-
-      if (!entry_is_present(ht, entry)) {
-         /* Stash the first available entry we find */
-         if (available_entry == NULL)
-            available_entry = entry;
-         if (entry_is_free(entry))
-            break;
-      }
+   group_mask = hash_num_groups(ht->size) - 1;
+   group = mixed & group_mask;
+   for (uint32_t i = 1; i <= group_mask + 1; i++) {
+      struct hash_entry *entries = ht->table + group * HASH_GROUP_SIZE;
+      const uint8_t *meta = ht->meta + group * HASH_GROUP_SIZE;
+      unsigned match = hash_group_match(meta, tag);
 
       /* Implement replacement when another insert happens
        * with a matching key.  This is a relatively common
@@ -362,23 +371,36 @@ hash_table_insert(struct hash_table *ht, uint32_t hash,
        * required to avoid memory leaks, perform a search
        * before inserting.
        */
-      if (!entry_is_deleted(ht, entry) &&
-          entry->hash == hash &&
-          ht->key_equals_function(key, entry->key)) {
-         entry->key = key;
-         entry->data = data;
-         return entry;
+      while (match) {
+         struct hash_entry *entry = entries + u_bit_scan(&match);
+
+         if (entry->hash == hash &&
+             hash_table_key_equals(ht, key, entry->key)) {
+            entry->key = key;
+            entry->data = data;
+            return entry;
+         }
       }
 
+      /* Stash the first available entry we find */
+      if (available_entry == NULL) {
+         unsigned available = hash_group_match_available(meta);
+         if (available)
+            available_entry = entries + ffs(available) - 1;
+      }
 
-      double_hash = 1 + hash % ht->rehash;
+      if (hash_group_match_empty(meta))
+         break;
 
-      hash_address = (hash_address + double_hash) % ht->size;
-   } while (hash_address != start_hash_address);
+      group = (group + i) & group_mask;
+   }
 
    if (available_entry) {
-      if (entry_is_deleted(ht, available_entry))
+      uint32_t index = available_entry - ht->table;
+
+      if (ht->meta[index] == HASH_META_DELETED)
          ht->deleted_entries--;
+      ht->meta[index] = tag;
       available_entry->hash = hash;
       available_entry->key = key;
       available_entry->data = data;
@@ -426,9 +448,9 @@ _mesa_hash_table_remove(struct hash_table *ht,
    if (!entry)
       return;
 
-   entry->key = ht->deleted_key;
+   if (hash_meta_remove(ht->meta, entry - ht->table))
+      ht->deleted_entries++;
    ht->entries--;
-   ht->deleted_entries++;
 }
 
 /**
@@ -450,18 +472,11 @@ struct hash_entry *
 _mesa_hash_table_next_entry(struct hash_table *ht,
                             struct hash_entry *entry)
 {
-   if (entry == NULL)
-      entry = ht->table;
-   else
-      entry = entry + 1;
+   uint32_t i = entry == NULL ? 0 : entry - ht->table + 1;
 
-   for (; entry != ht->table + ht->size; entry++) {
-      if (entry_is_present(ht, entry)) {
-         return entry;
-      }
-   }
+   i = hash_meta_next_present(ht->meta, ht->size, i);
 
-   return NULL;
+   return i < ht->size ? ht->table + i : NULL;
 }
 
 /**
@@ -558,147 +573,272 @@ _mesa_pointer_hash_table_create(void *mem_ctx)
 }
 
 /**
- * Hash table wrapper which supports 64-bit keys.
+ * Hash table with 64-bit keys.
  *
- * TODO: unify all hash table implementations.
+ * The keys are stored in the entries themselves and hashed and compared
+ * directly, so unlike a struct hash_table with boxed integer keys, probing
+ * never calls through a function pointer.  Any key value can be stored.
  */
 
-struct hash_key_u64 {
-   uint64_t value;
-};
+/**
+ * Fibonacci hashing.  The top bits of the product depend on all the bits of
+ * the key, which keeps the cost to a single multiplication.
+ */
+static inline uint32_t
+key_u64_hash(uint64_t key)
+{
+   return (key * 0x9e3779b97f4a7c15ull) >> 32;
+}
 
-static uint32_t
-key_u64_hash(const void *key)
+static struct hash_entry_u64 *
+hash_table_u64_alloc_table(void *mem_ctx, unsigned size_index)
 {
-   return _mesa_hash_data(key, sizeof(struct hash_key_u64));
+   uint32_t size;
+
+   if (size_index > HASH_MAX_SIZE_INDEX)
+      return NULL;
+
+   size = 1u << size_index;
+   return ralloc_size(mem_ctx, size * sizeof(struct hash_entry_u64) +
+                               hash_meta_size(size));
 }
 
-static bool
-key_u64_equals(const void *a, const void *b)
+static void
+hash_table_u64_set_table(struct hash_table_u64 *ht,
+                         struct hash_entry_u64 *table, unsigned size_index)
 {
-   const struct hash_key_u64 *aa = a;
-   const struct hash_key_u64 *bb = b;
+   ht->table = table;
+   ht->size_index = size_index;
+   ht->size = 1u << size_index;
+   ht->meta = (uint8_t *)(table + ht->size);
+   ht->max_entries = hash_max_entries(ht->size);
+   ht->entries = 0;
+   ht->deleted_entries = 0;
 
-   return aa->value == bb->value;
+   hash_meta_init(ht->meta, ht->size);
 }
 
 struct hash_table_u64 *
 _mesa_hash_table_u64_create(void *mem_ctx)
 {
    struct hash_table_u64 *ht;
+   struct hash_entry_u64 *table;
 
-   ht = CALLOC_STRUCT(hash_table_u64);
+   ht = ralloc(mem_ctx, struct hash_table_u64);
    if (!ht)
       return NULL;
 
-   if (sizeof(void *) == 8) {
-      ht->table = _mesa_hash_table_create(mem_ctx, _mesa_hash_pointer,
-                                          _mesa_key_pointer_equal);
-   } else {
-      ht->table = _mesa_hash_table_create(mem_ctx, key_u64_hash,
-                                          key_u64_equals);
+   table = hash_table_u64_alloc_table(ht, HASH_MIN_SIZE_INDEX);
+   if (!table) {
+      ralloc_free(ht);
+      return NULL;
    }
 
-   if (ht->table)
-      _mesa_hash_table_set_deleted_key(ht->table, uint_key(DELETED_KEY_VALUE));
+   hash_table_u64_set_table(ht, table, HASH_MIN_SIZE_INDEX);
 
    return ht;
 }
 
 void
 _mesa_hash_table_u64_destroy(struct hash_table_u64 *ht,
-                             void (*delete_function)(struct hash_entry *entry))
+                             void (*delete_function)(struct hash_entry_u64 *entry))
 {
    if (!ht)
       return;
 
-   if (ht->deleted_key_data) {
-      if (delete_function) {
-         struct hash_table *table = ht->table;
-         struct hash_entry deleted_entry;
-
-         /* Create a fake entry for the delete function. */
-         deleted_entry.hash = table->key_hash_function(table->deleted_key);
-         deleted_entry.key = table->deleted_key;
-         deleted_entry.data = ht->deleted_key_data;
-
-         delete_function(&deleted_entry);
+   if (delete_function) {
+      hash_table_u64_foreach(ht, entry) {
+         delete_function(entry);
       }
-      ht->deleted_key_data = NULL;
    }
-
-   _mesa_hash_table_destroy(ht->table, delete_function);
-   free(ht);
+   ralloc_free(ht);
 }
 
+/**
+ * Removes all entries without changing the size of the table.
+ */
 void
-_mesa_hash_table_u64_insert(struct hash_table_u64 *ht, uint64_t key,
-                            void *data)
+_mesa_hash_table_u64_clear(struct hash_table_u64 *ht)
 {
-   if (key == DELETED_KEY_VALUE) {
-      ht->deleted_key_data = data;
-      return;
-   }
+   hash_meta_init(ht->meta, ht->size);
+   ht->entries = 0;
+   ht->deleted_entries = 0;
+}
 
-   if (sizeof(void *) == 8) {
-      _mesa_hash_table_insert(ht->table, (void *)(uintptr_t)key, data);
-   } else {
-      struct hash_key_u64 *_key = CALLOC_STRUCT(hash_key_u64);
+static inline struct hash_entry_u64 *
+hash_table_u64_search(struct hash_table_u64 *ht, uint64_t key)
+{
+   uint32_t hash = key_u64_hash(key);
+   uint8_t tag = hash_probe_tag(hash);
+   uint32_t group_mask = hash_num_groups(ht->size) - 1;
+   uint32_t group = hash & group_mask;
 
-      if (!_key)
-         return;
-      _key->value = key;
+   for (uint32_t i = 1; i <= group_mask + 1; i++) {
+      struct hash_entry_u64 *entries = ht->table + group * HASH_GROUP_SIZE;
+      const uint8_t *meta = ht->meta + group * HASH_GROUP_SIZE;
+      unsigned match = hash_group_match(meta, tag);
 
-      _mesa_hash_table_insert(ht->table, _key, data);
+      while (match) {
+         struct hash_entry_u64 *entry = entries + u_bit_scan(&match);
+
+         if (entry->key == key)
+            return entry;
+      }
+
+      if (hash_group_match_empty(meta))
+         return NULL;
+
+      group = (group + i) & group_mask;
    }
+
+   return NULL;
 }
 
-static struct hash_entry *
-hash_table_u64_search(struct hash_table_u64 *ht, uint64_t key)
+struct hash_entry_u64 *
+_mesa_hash_table_u64_search_entry(struct hash_table_u64 *ht, uint64_t key)
 {
-   if (sizeof(void *) == 8) {
-      return _mesa_hash_table_search(ht->table, (void *)(uintptr_t)key);
-   } else {
-      struct hash_key_u64 _key = { .value = key };
-      return _mesa_hash_table_search(ht->table, &_key);
-   }
+   return hash_table_u64_search(ht, key);
 }
 
 void *
 _mesa_hash_table_u64_search(struct hash_table_u64 *ht, uint64_t key)
 {
-   struct hash_entry *entry;
+   struct hash_entry_u64 *entry = hash_table_u64_search(ht, key);
 
-   if (key == DELETED_KEY_VALUE)
-      return ht->deleted_key_data;
+   return entry ? entry->data : NULL;
+}
 
-   entry = hash_table_u64_search(ht, key);
-   if (!entry)
-      return NULL;
+static void
+hash_table_u64_rehash(struct hash_table_u64 *ht, unsigned new_size_index)
+{
+   struct hash_table_u64 old_ht;
+   struct hash_entry_u64 *table;
 
-   return entry->data;
+   table = hash_table_u64_alloc_table(ht, new_size_index);
+   if (!table)
+      return;
+
+   old_ht = *ht;
+
+   hash_table_u64_set_table(ht, table, new_size_index);
+
+   hash_table_u64_foreach(&old_ht, entry) {
+      uint32_t hash = key_u64_hash(entry->key);
+      uint32_t group_mask = hash_num_groups(ht->size) - 1;
+      uint32_t group = hash & group_mask;
+      unsigned empty;
+
+      for (uint32_t i = 1;
+           !(empty = hash_group_match_empty(ht->meta +
+                                            group * HASH_GROUP_SIZE));
+           i++)
+         group = (group + i) & group_mask;
+
+      uint32_t index = group * HASH_GROUP_SIZE + ffs(empty) - 1;
+      ht->meta[index] = hash_probe_tag(hash);
+      ht->table[index] = *entry;
+      ht->entries++;
+   }
+
+   ralloc_free(old_ht.table);
 }
 
-void
-_mesa_hash_table_u64_remove(struct hash_table_u64 *ht, uint64_t key)
+/**
+ * Inserts the key into the table, replacing the data of an existing entry
+ * with the same key.
+ *
+ * As with the other hash tables, this may rehash the table, so previously
+ * found entries are no longer valid after this function.
+ */
+struct hash_entry_u64 *
+_mesa_hash_table_u64_insert(struct hash_table_u64 *ht, uint64_t key,
+                            void *data)
 {
-   struct hash_entry *entry;
+   uint32_t hash = key_u64_hash(key);
+   uint8_t tag = hash_probe_tag(hash);
+   uint32_t group_mask, group;
+   struct hash_entry_u64 *available_entry = NULL;
 
-   if (key == DELETED_KEY_VALUE) {
-      ht->deleted_key_data = NULL;
-      return;
+   if (ht->entries >= ht->max_entries) {
+      hash_table_u64_rehash(ht, ht->size_index + 1);
+   } else if (ht->deleted_entries + ht->entries >= ht->max_entries) {
+      hash_table_u64_rehash(ht, ht->size_index);
+   }
+
+   group_mask = hash_num_groups(ht->size) - 1;
+   group = hash & group_mask;
+   for (uint32_t i = 1; i <= group_mask + 1; i++) {
+      struct hash_entry_u64 *entries = ht->table + group * HASH_GROUP_SIZE;
+      const uint8_t *meta = ht->meta + group * HASH_GROUP_SIZE;
+      unsigned match = hash_group_match(meta, tag);
+
+      while (match) {
+         struct hash_entry_u64 *entry = entries + u_bit_scan(&match);
+
+         if (entry->key == key) {
+            entry->data = data;
+            return entry;
+         }
+      }
+
+      if (available_entry == NULL) {
+         unsigned available = hash_group_match_available(meta);
+         if (available)
+            available_entry = entries + ffs(available) - 1;
+      }
+
+      if (hash_group_match_empty(meta))
+         break;
+
+      group = (group + i) & group_mask;
+   }
+
+   if (available_entry) {
+      uint32_t index = available_entry - ht->table;
+
+      if (ht->meta[index] == HASH_META_DELETED)
+         ht->deleted_entries--;
+      ht->meta[index] = tag;
+      available_entry->key = key;
+      available_entry->data = data;
+      ht->entries++;
+      return available_entry;
    }
 
-   entry = hash_table_u64_search(ht, key);
+   /* We could hit here if a required resize failed. */
+   return NULL;
+}
+
+/**
+ * Removes the given entry.  This doesn't otherwise modify the table, so
+ * removing entries while iterating over the table is safe.
+ */
+void
+_mesa_hash_table_u64_remove_entry(struct hash_table_u64 *ht,
+                                  struct hash_entry_u64 *entry)
+{
    if (!entry)
       return;
 
-   if (sizeof(void *) == 8) {
-      _mesa_hash_table_remove(ht->table, entry);
-   } else {
-      struct hash_key *_key = (struct hash_key *)entry->key;
+   if (hash_meta_remove(ht->meta, entry - ht->table))
+      ht->deleted_entries++;
+   ht->entries--;
+}
 
-      _mesa_hash_table_remove(ht->table, entry);
-      free(_key);
-   }
+void
+_mesa_hash_table_u64_remove(struct hash_table_u64 *ht, uint64_t key)
+{
+   _mesa_hash_table_u64_remove_entry(ht,
+                                     _mesa_hash_table_u64_search_entry(ht, key));
+}
+
+struct hash_entry_u64 *
+_mesa_hash_table_u64_next_entry(struct hash_table_u64 *ht,
+                                struct hash_entry_u64 *entry)
+{
+   uint32_t i = entry == NULL ? 0 : entry - ht->table + 1;
+
+   i = hash_meta_next_present(ht->meta, ht->size, i);
+
+   return i < ht->size ? ht->table + i : NULL;
 }
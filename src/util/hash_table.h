@@ -46,11 +46,11 @@ struct hash_entry {
 
 struct hash_table {
    struct hash_entry *table;
+   uint8_t *meta;
    uint32_t (*key_hash_function)(const void *key);
    bool (*key_equals_function)(const void *a, const void *b);
    const void *deleted_key;
    uint32_t size;
-   uint32_t rehash;
    uint32_t max_entries;
    uint32_t size_index;
    uint32_t entries;
@@ -146,9 +146,10 @@ _mesa_fnv32_1a_accumulate_block(uint32_t hash, const void *data, size_t size)
    _mesa_fnv32_1a_accumulate_block(hash, &(expr), sizeof(expr))
 
 /**
- * This foreach function is safe against deletion (which just replaces
- * an entry's data with the deleted marker), but not against insertion
- * (which may rehash the table, making entry a dangling pointer).
+ * This foreach function is safe against deletion (which just marks the
+ * entry's metadata byte as deleted, leaving the entry in place), but not
+ * against insertion (which may rehash the table, making entry a dangling
+ * pointer).
  */
 #define hash_table_foreach(ht, entry)                                      \
    for (struct hash_entry *entry = _mesa_hash_table_next_entry(ht, NULL);  \
@@ -167,11 +168,21 @@ hash_table_call_foreach(struct hash_table *ht,
 }
 
 /**
- * Hash table wrapper which supports 64-bit keys.
+ * Hash table with 64-bit keys, stored inline in the entries.
  */
+struct hash_entry_u64 {
+   uint64_t key;
+   void *data;
+};
+
 struct hash_table_u64 {
-   struct hash_table *table;
-   void *deleted_key_data;
+   struct hash_entry_u64 *table;
+   uint8_t *meta;
+   uint32_t size;
+   uint32_t max_entries;
+   uint32_t size_index;
+   uint32_t entries;
+   uint32_t deleted_entries;
 };
 
 struct hash_table_u64 *
@@ -179,18 +190,47 @@ _mesa_hash_table_u64_create(void *mem_ctx);
 
 void
 _mesa_hash_table_u64_destroy(struct hash_table_u64 *ht,
-                             void (*delete_function)(struct hash_entry *entry));
+                             void (*delete_function)(struct hash_entry_u64 *entry));
 
 void
+_mesa_hash_table_u64_clear(struct hash_table_u64 *ht);
+
+static inline uint32_t
+_mesa_hash_table_u64_num_entries(const struct hash_table_u64 *ht)
+{
+   return ht->entries;
+}
+
+struct hash_entry_u64 *
 _mesa_hash_table_u64_insert(struct hash_table_u64 *ht, uint64_t key,
                             void *data);
 
+struct hash_entry_u64 *
+_mesa_hash_table_u64_search_entry(struct hash_table_u64 *ht, uint64_t key);
+
 void *
 _mesa_hash_table_u64_search(struct hash_table_u64 *ht, uint64_t key);
 
+void
+_mesa_hash_table_u64_remove_entry(struct hash_table_u64 *ht,
+                                  struct hash_entry_u64 *entry);
+
 void
 _mesa_hash_table_u64_remove(struct hash_table_u64 *ht, uint64_t key);
 
+struct hash_entry_u64 *
+_mesa_hash_table_u64_next_entry(struct hash_table_u64 *ht,
+                                struct hash_entry_u64 *entry);
+
+/**
+ * Like hash_table_foreach, this is safe against deletion but not against
+ * insertion.
+ */
+#define hash_table_u64_foreach(ht, entry)                                         \
+   for (struct hash_entry_u64 *entry = _mesa_hash_table_u64_next_entry(ht, NULL); \
+        entry != NULL;                                                            \
+        entry = _mesa_hash_table_u64_next_entry(ht, entry))
+
 #ifdef __cplusplus
 } /* extern C */
 #endif
@@ -545,13 +545,16 @@ ralloc_vasprintf_rewrite_tail(char **str, size_t *start, const char *fmt,
  * The allocator uses a fixed-sized buffer with a monotonically increasing
  * offset after each allocation. If the buffer is all used, another buffer
  * is allocated, sharing the same ralloc parent, so all buffers are at
- * the same level in the ralloc hierarchy.
+ * the same level in the ralloc hierarchy. Each new buffer is twice as large
+ * as the previous one (up to MAX_LINEAR_BUFSIZE), so that large users like
+ * the GLSL parser don't end up with thousands of small buffers.
  *
  * The linear parent node is always the first buffer and keeps track of all
  * other buffers.
  */
 
 #define MIN_LINEAR_BUFSIZE 2048
+#define MAX_LINEAR_BUFSIZE (64 * 1024)
 #define SUBALLOC_ALIGNMENT 8
 #define LMAGIC 0x87b9c7d3
 
@@ -641,8 +644,10 @@ linear_alloc_child(void *parent, unsigned size)
    full_size = sizeof(linear_size_chunk) + size;
 
    if (unlikely(latest->offset + full_size > latest->size)) {
-      /* allocate a new node */
-      new_node = create_linear_node(latest->ralloc_parent, size);
+      /* allocate a new node, larger than the previous one */
+      unsigned new_size = MIN2(latest->size * 2, MAX_LINEAR_BUFSIZE);
+      new_node = create_linear_node(latest->ralloc_parent,
+                                    MAX2(size, new_size));
       if (unlikely(!new_node))
          return NULL;
 
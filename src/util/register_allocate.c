@@ -70,12 +70,17 @@
  * this during ra_set_finalize().
  */
 
+#include <inttypes.h>
 #include <stdbool.h>
+#include <stdio.h>
 
+#include "c11/threads.h"
 #include "ralloc.h"
 #include "main/imports.h"
 #include "main/macros.h"
 #include "util/bitset.h"
+#include "util/os_time.h"
+#include "util/u_atomic.h"
 #include "register_allocate.h"
 
 #define NO_REG ~0U
@@ -126,7 +131,6 @@ struct ra_node {
     * List of which nodes this node interferes with.  This should be
     * symmetric with the other node.
     */
-   BITSET_WORD *adjacency;
    unsigned int *adjacency_list;
    unsigned int adjacency_list_size;
    unsigned int adjacency_count;
@@ -155,6 +159,12 @@ struct ra_node {
     * approximate cost of spilling this node.
     */
    float spill_cost;
+
+   /**
+    * The benefit of spilling this node, as computed by
+    * ra_get_spill_benefit(), summed up as the edges are added.
+    */
+   float spill_benefit;
 };
 
 struct ra_graph {
@@ -165,6 +175,12 @@ struct ra_graph {
    struct ra_node *nodes;
    unsigned int count; /**< count of nodes. */
 
+   /**
+    * Which nodes interfere with each other, as the lower triangle of the
+    * adjacency matrix.  See adjacency_bit().
+    */
+   BITSET_WORD *adjacency;
+
    unsigned int *stack;
    unsigned int stack_count;
 
@@ -390,16 +406,37 @@ ra_set_finalize(struct ra_regs *regs, unsigned int **q_values)
    }
 }
 
+/**
+ * Returns the bit of the adjacency matrix for the edge between two nodes.
+ * Only the lower triangle is stored, since the matrix is symmetric.
+ */
+static uint64_t
+adjacency_bit(unsigned int n1, unsigned int n2)
+{
+   if (n1 < n2) {
+      unsigned int tmp = n1;
+      n1 = n2;
+      n2 = tmp;
+   }
+
+   return (uint64_t)n1 * (n1 - 1) / 2 + n2;
+}
+
+static bool
+ra_nodes_interfere(struct ra_graph *g, unsigned int n1, unsigned int n2)
+{
+   return BITSET_TEST(g->adjacency, adjacency_bit(n1, n2));
+}
+
 static void
 ra_add_node_adjacency(struct ra_graph *g, unsigned int n1, unsigned int n2)
 {
-   BITSET_SET(g->nodes[n1].adjacency, n2);
-
    assert(n1 != n2);
 
-   int n1_class = g->nodes[n1].class;
+   struct ra_class *n1_class = g->regs->classes[g->nodes[n1].class];
    int n2_class = g->nodes[n2].class;
-   g->nodes[n1].q_total += g->regs->classes[n1_class]->q[n2_class];
+   g->nodes[n1].q_total += n1_class->q[n2_class];
+   g->nodes[n1].spill_benefit += ((float)n1_class->q[n2_class] / n1_class->p);
 
    if (g->nodes[n1].adjacency_count >=
        g->nodes[n1].adjacency_list_size) {
@@ -426,10 +463,10 @@ ra_alloc_interference_graph(struct ra_regs *regs, unsigned int count)
 
    g->stack = rzalloc_array(g, unsigned int, count);
 
-   for (i = 0; i < count; i++) {
-      int bitset_count = BITSET_WORDS(count);
-      g->nodes[i].adjacency = rzalloc_array(g, BITSET_WORD, bitset_count);
+   g->adjacency = rzalloc_array(g, BITSET_WORD,
+                                BITSET_WORDS(adjacency_bit(count, 0)));
 
+   for (i = 0; i < count; i++) {
       g->nodes[i].adjacency_list_size = 4;
       g->nodes[i].adjacency_list =
          ralloc_array(g, unsigned int, g->nodes[i].adjacency_list_size);
@@ -463,7 +500,8 @@ void
 ra_add_node_interference(struct ra_graph *g,
                          unsigned int n1, unsigned int n2)
 {
-   if (n1 != n2 && !BITSET_TEST(g->nodes[n1].adjacency, n2)) {
+   if (n1 != n2 && !ra_nodes_interfere(g, n1, n2)) {
+      BITSET_SET(g->adjacency, adjacency_bit(n1, n2));
       ra_add_node_adjacency(g, n1, n2);
       ra_add_node_adjacency(g, n2, n1);
    }
@@ -551,23 +589,6 @@ ra_simplify(struct ra_graph *g)
    g->stack_optimistic_start = stack_optimistic_start;
 }
 
-static bool
-ra_any_neighbors_conflict(struct ra_graph *g, unsigned int n, unsigned int r)
-{
-   unsigned int i;
-
-   for (i = 0; i < g->nodes[n].adjacency_count; i++) {
-      unsigned int n2 = g->nodes[n].adjacency_list[i];
-
-      if (!g->nodes[n2].in_stack &&
-          BITSET_TEST(g->regs->regs[r].conflicts, g->nodes[n2].reg)) {
-         return true;
-      }
-   }
-
-   return false;
-}
-
 /* Computes a bitfield of what regs are available for a given register
  * selection.
  *
@@ -603,6 +624,26 @@ ra_compute_available_regs(struct ra_graph *g, unsigned int n, BITSET_WORD *regs)
    return false;
 }
 
+/**
+ * Returns the first register set in regs in [start, end), or end if there
+ * is none.
+ */
+static unsigned int
+ra_find_reg(const BITSET_WORD *regs, unsigned int start, unsigned int end)
+{
+   while (start < end) {
+      unsigned int w = BITSET_BITWORD(start);
+      BITSET_WORD bits = regs[w] & ~(BITSET_BIT(start) - 1);
+
+      if (bits)
+         return MIN2(w * BITSET_WORDBITS + ffs(bits) - 1, end);
+
+      start = (w + 1) * BITSET_WORDBITS;
+   }
+
+   return end;
+}
+
 /**
  * Pops nodes from the stack back into the graph, coloring them with
  * registers as they go.
@@ -613,45 +654,33 @@ ra_compute_available_regs(struct ra_graph *g, unsigned int n, BITSET_WORD *regs)
 static bool
 ra_select(struct ra_graph *g)
 {
-   int start_search_reg = 0;
-   BITSET_WORD *select_regs = NULL;
-
-   if (g->select_reg_callback)
-      select_regs = malloc(BITSET_WORDS(g->regs->count) * sizeof(BITSET_WORD));
+   unsigned int start_search_reg = 0;
+   BITSET_WORD *select_regs =
+      malloc(BITSET_WORDS(g->regs->count) * sizeof(BITSET_WORD));
 
    while (g->stack_count != 0) {
-      unsigned int ri;
-      unsigned int r = -1;
+      unsigned int r;
       int n = g->stack[g->stack_count - 1];
-      struct ra_class *c = g->regs->classes[g->nodes[n].class];
 
       /* set this to false even if we return here so that
        * ra_get_best_spill_node() considers this node later.
        */
       g->nodes[n].in_stack = false;
 
-      if (g->select_reg_callback) {
-         if (!ra_compute_available_regs(g, n, select_regs)) {
-            free(select_regs);
-            return false;
-         }
+      if (!ra_compute_available_regs(g, n, select_regs)) {
+         free(select_regs);
+         return false;
+      }
 
+      if (g->select_reg_callback) {
          r = g->select_reg_callback(g, select_regs, g->select_reg_callback_data);
       } else {
          /* Find the lowest-numbered reg which is not used by a member
-          * of the graph adjacent to us.
+          * of the graph adjacent to us, starting from start_search_reg.
           */
-         for (ri = 0; ri < g->regs->count; ri++) {
-            r = (start_search_reg + ri) % g->regs->count;
-            if (!reg_belongs_to_class(r, c))
-               continue;
-
-            if (!ra_any_neighbors_conflict(g, n, r))
-               break;
-         }
-
-         if (ri >= g->regs->count)
-            return false;
+         r = ra_find_reg(select_regs, start_search_reg, g->regs->count);
+         if (r == g->regs->count)
+            r = ra_find_reg(select_regs, 0, start_search_reg);
       }
 
       g->nodes[n].reg = r;
@@ -668,7 +697,7 @@ ra_select(struct ra_graph *g)
        */
       if (g->regs->round_robin &&
           g->stack_count - 1 <= g->stack_optimistic_start)
-         start_search_reg = r + 1;
+         start_search_reg = (r + 1) % g->regs->count;
    }
 
    free(select_regs);
@@ -676,9 +705,102 @@ ra_select(struct ra_graph *g)
    return true;
 }
 
+/**
+ * Writes the register set and the graph in the text format read by the
+ * register allocation benchmark.
+ *
+ * The register set is written as it is after ra_set_finalize(), with the
+ * conflicts of each register and the q values of the classes, so the dump
+ * is self contained.  Select callbacks can't be dumped, so replaying a dump
+ * uses the default register choice.
+ */
+void
+ra_dump_graph(struct ra_graph *g, FILE *f)
+{
+   struct ra_regs *regs = g->regs;
+   BITSET_WORD tmp;
+   int i;
+
+   fprintf(f, "regs %u %u %d\n", regs->count, regs->class_count,
+           regs->round_robin);
+
+   for (unsigned int r = 0; r < regs->count; r++) {
+      fprintf(f, "r %u", r);
+      BITSET_FOREACH_SET(i, tmp, regs->regs[r].conflicts, regs->count)
+         fprintf(f, " %d", i);
+      fprintf(f, "\n");
+   }
+
+   for (unsigned int c = 0; c < regs->class_count; c++) {
+      fprintf(f, "c %u", c);
+      BITSET_FOREACH_SET(i, tmp, regs->classes[c]->regs, regs->count)
+         fprintf(f, " %d", i);
+      fprintf(f, "\nq %u", c);
+      for (unsigned int c2 = 0; c2 < regs->class_count; c2++)
+         fprintf(f, " %u", regs->classes[c]->q[c2]);
+      fprintf(f, "\n");
+   }
+
+   fprintf(f, "graph %u\n", g->count);
+   for (unsigned int n = 0; n < g->count; n++) {
+      fprintf(f, "n %u %u %d %a\n", n, g->nodes[n].class,
+              g->nodes[n].reg == NO_REG ? -1 : (int)g->nodes[n].reg,
+              g->nodes[n].spill_cost);
+   }
+
+   for (unsigned int n = 0; n < g->count; n++) {
+      for (unsigned int j = 0; j < g->nodes[n].adjacency_count; j++) {
+         unsigned int n2 = g->nodes[n].adjacency_list[j];
+         if (n < n2)
+            fprintf(f, "e %u %u\n", n, n2);
+      }
+   }
+
+   fprintf(f, "end\n");
+}
+
+static once_flag ra_dump_dir_once = ONCE_FLAG_INIT;
+static const char *ra_dump_dir;
+
+static void
+ra_dump_dir_init(void)
+{
+   ra_dump_dir = getenv("MESA_RA_DUMP_DIR");
+}
+
+/**
+ * Dumps the graph to a new file in the directory named by the
+ * MESA_RA_DUMP_DIR environment variable, if it is set.
+ */
+static void
+ra_maybe_dump_graph(struct ra_graph *g)
+{
+   static unsigned int dump_count;
+   const char *dir;
+   char path[1024];
+   FILE *f;
+
+   call_once(&ra_dump_dir_once, ra_dump_dir_init);
+   dir = ra_dump_dir;
+   if (!dir)
+      return;
+
+   snprintf(path, sizeof(path), "%s/ra-%"PRIx64"-%u.txt", dir,
+            (uint64_t)os_time_get_nano(), p_atomic_inc_return(&dump_count));
+
+   f = fopen(path, "w");
+   if (!f)
+      return;
+
+   ra_dump_graph(g, f);
+   fclose(f);
+}
+
 bool
 ra_allocate(struct ra_graph *g)
 {
+   ra_maybe_dump_graph(g);
+
    ra_simplify(g);
    return ra_select(g);
 }
@@ -712,23 +834,14 @@ ra_set_node_reg(struct ra_graph *g, unsigned int n, unsigned int reg)
 static float
 ra_get_spill_benefit(struct ra_graph *g, unsigned int n)
 {
-   unsigned int j;
-   float benefit = 0;
-   int n_class = g->nodes[n].class;
-
    /* Define the benefit of eliminating an interference between n, n2
     * through spilling as q(C, B) / p(C).  This is similar to the
     * "count number of edges" approach of traditional graph coloring,
     * but takes classes into account.
+    *
+    * ra_add_node_adjacency() sums it up as the edges are added.
     */
-   for (j = 0; j < g->nodes[n].adjacency_count; j++) {
-      unsigned int n2 = g->nodes[n].adjacency_list[j];
-      unsigned int n2_class = g->nodes[n2].class;
-      benefit += ((float)g->regs->classes[n_class]->q[n2_class] /
-                  g->regs->classes[n_class]->p);
-   }
-
-   return benefit;
+   return g->nodes[n].spill_benefit;
 }
 
 /**
@@ -36,72 +36,64 @@
 #include <assert.h>
 #include <string.h>
 
+#include "hash_probe.h"
 #include "hash_table.h"
 #include "macros.h"
 #include "ralloc.h"
 #include "set.h"
 
 /*
- * From Knuth -- a good choice for hash/rehash values is p, p-2 where
- * p and p-2 are both prime.  These tables are sized to have an extra 10%
- * free to avoid exponential performance degradation as the hash table fills
+ * The set uses the same metadata probing as the hash table, see
+ * hash_probe.h.
  */
 
-static const uint32_t deleted_key_value;
-static const void *deleted_key = &deleted_key_value;
-
-static const struct {
-   uint32_t max_entries, size, rehash;
-} hash_sizes[] = {
-   { 2,            5,            3            },
-   { 4,            7,            5            },
-   { 8,            13,           11           },
-   { 16,           19,           17           },
-   { 32,           43,           41           },
-   { 64,           73,           71           },
-   { 128,          151,          149          },
-   { 256,          283,          281          },
-   { 512,          571,          569          },
-   { 1024,         1153,         1151         },
-   { 2048,         2269,         2267         },
-   { 4096,         4519,         4517         },
-   { 8192,         9013,         9011         },
-   { 16384,        18043,        18041        },
-   { 32768,        36109,        36107        },
-   { 65536,        72091,        72089        },
-   { 131072,       144409,       144407       },
-   { 262144,       288361,       288359       },
-   { 524288,       576883,       576881       },
-   { 1048576,      1153459,      1153457      },
-   { 2097152,      2307163,      2307161      },
-   { 4194304,      4613893,      4613891      },
-   { 8388608,      9227641,      9227639      },
-   { 16777216,     18455029,     18455027     },
-   { 33554432,     36911011,     36911009     },
-   { 67108864,     73819861,     73819859     },
-   { 134217728,    147639589,    147639587    },
-   { 268435456,    295279081,    295279079    },
-   { 536870912,    590559793,    590559791    },
-   { 1073741824,   1181116273,   1181116271   },
-   { 2147483648ul, 2362232233ul, 2362232231ul }
-};
-
 static int
-entry_is_free(struct set_entry *entry)
+entry_is_present(const struct set *ht, struct set_entry *entry)
 {
-   return entry->key == NULL;
+   return hash_meta_is_present(ht->meta[entry - ht->table]);
 }
 
-static int
-entry_is_deleted(struct set_entry *entry)
+/**
+ * Compares two keys, without the indirect call for sets of pointers.
+ */
+static inline bool
+set_key_equals(const struct set *ht, const void *a, const void *b)
 {
-   return entry->key == deleted_key;
+   if (ht->key_equals_function == _mesa_key_pointer_equal)
+      return a == b;
+
+   return ht->key_equals_function(a, b);
 }
 
-static int
-entry_is_present(struct set_entry *entry)
+/**
+ * Allocates the entries of a set of the given size together with their
+ * metadata, which lives right after the entries.
+ */
+static struct set_entry *
+set_alloc_table(void *mem_ctx, unsigned size_index)
 {
-   return entry->key != NULL && entry->key != deleted_key;
+   uint32_t size;
+
+   if (size_index > HASH_MAX_SIZE_INDEX)
+      return NULL;
+
+   size = 1u << size_index;
+   return ralloc_size(mem_ctx, size * sizeof(struct set_entry) +
+                               hash_meta_size(size));
+}
+
+static void
+set_set_table(struct set *ht, struct set_entry *table, unsigned size_index)
+{
+   ht->table = table;
+   ht->size_index = size_index;
+   ht->size = 1u << size_index;
+   ht->meta = (uint8_t *)(table + ht->size);
+   ht->max_entries = hash_max_entries(ht->size);
+   ht->entries = 0;
+   ht->deleted_entries = 0;
+
+   hash_meta_init(ht->meta, ht->size);
 }
 
 struct set *
@@ -111,26 +103,23 @@ _mesa_set_create(void *mem_ctx,
                                              const void *b))
 {
    struct set *ht;
+   struct set_entry *table;
 
    ht = ralloc(mem_ctx, struct set);
    if (ht == NULL)
       return NULL;
 
-   ht->size_index = 0;
-   ht->size = hash_sizes[ht->size_index].size;
-   ht->rehash = hash_sizes[ht->size_index].rehash;
-   ht->max_entries = hash_sizes[ht->size_index].max_entries;
    ht->key_hash_function = key_hash_function;
    ht->key_equals_function = key_equals_function;
-   ht->table = rzalloc_array(ht, struct set_entry, ht->size);
-   ht->entries = 0;
-   ht->deleted_entries = 0;
 
-   if (ht->table == NULL) {
+   table = set_alloc_table(ht, HASH_MIN_SIZE_INDEX);
+   if (table == NULL) {
       ralloc_free(ht);
       return NULL;
    }
 
+   set_set_table(ht, table, HASH_MIN_SIZE_INDEX);
+
    return ht;
 }
 
@@ -145,13 +134,15 @@ _mesa_set_clone(struct set *set, void *dst_mem_ctx)
 
    memcpy(clone, set, sizeof(struct set));
 
-   clone->table = ralloc_array(clone, struct set_entry, clone->size);
+   clone->table = set_alloc_table(clone, clone->size_index);
    if (clone->table == NULL) {
       ralloc_free(clone);
       return NULL;
    }
+   clone->meta = (uint8_t *)(clone->table + clone->size);
 
-   memcpy(clone->table, set->table, clone->size * sizeof(struct set_entry));
+   memcpy(clone->table, set->table, clone->size * sizeof(struct set_entry) +
+                                    hash_meta_size(clone->size));
 
    return clone;
 }
@@ -189,12 +180,13 @@ _mesa_set_clear(struct set *set, void (*delete_function)(struct set_entry *entry
    if (!set)
       return;
 
-   set_foreach (set, entry) {
-      if (delete_function)
+   if (delete_function) {
+      set_foreach (set, entry) {
          delete_function(entry);
-      entry->key = deleted_key;
+      }
    }
 
+   hash_meta_init(set->meta, set->size);
    set->entries = set->deleted_entries = 0;
 }
 
@@ -206,26 +198,29 @@ _mesa_set_clear(struct set *set, void (*delete_function)(struct set_entry *entry
 static struct set_entry *
 set_search(const struct set *ht, uint32_t hash, const void *key)
 {
-   uint32_t hash_address;
+   uint32_t mixed = hash_probe_mix(hash);
+   uint8_t tag = hash_probe_tag(mixed);
+   uint32_t group_mask = hash_num_groups(ht->size) - 1;
+   uint32_t group = mixed & group_mask;
 
-   hash_address = hash % ht->size;
-   do {
-      uint32_t double_hash;
+   for (uint32_t i = 1; i <= group_mask + 1; i++) {
+      struct set_entry *entries = ht->table + group * HASH_GROUP_SIZE;
+      const uint8_t *meta = ht->meta + group * HASH_GROUP_SIZE;
+      unsigned match = hash_group_match(meta, tag);
 
-      struct set_entry *entry = ht->table + hash_address;
+      while (match) {
+         struct set_entry *entry = entries + u_bit_scan(&match);
 
-      if (entry_is_free(entry)) {
-         return NULL;
-      } else if (entry_is_present(entry) && entry->hash == hash) {
-         if (ht->key_equals_function(key, entry->key)) {
+         if (entry->hash == hash &&
+             set_key_equals(ht, key, entry->key))
             return entry;
-         }
       }
 
-      double_hash = 1 + hash % ht->rehash;
+      if (hash_group_match_empty(meta))
+         return NULL;
 
-      hash_address = (hash_address + double_hash) % ht->size;
-   } while (hash_address != hash % ht->size);
+      group = (group + i) & group_mask;
+   }
 
    return NULL;
 }
@@ -246,8 +241,34 @@ _mesa_set_search_pre_hashed(const struct set *set, uint32_t hash,
    return set_search(set, hash, key);
 }
 
-static struct set_entry *
-set_add(struct set *ht, uint32_t hash, const void *key);
+/**
+ * Adds a key to a set being rehashed, where all the keys are known to be
+ * different and there are no deleted entries.
+ */
+static void
+set_add_rehash(struct set *ht, uint32_t hash, const void *key)
+{
+   uint32_t mixed = hash_probe_mix(hash);
+   uint32_t group_mask = hash_num_groups(ht->size) - 1;
+   uint32_t group = mixed & group_mask;
+
+   for (uint32_t i = 1; ; i++) {
+      unsigned empty = hash_group_match_empty(ht->meta +
+                                              group * HASH_GROUP_SIZE);
+
+      if (empty) {
+         uint32_t index = group * HASH_GROUP_SIZE + ffs(empty) - 1;
+
+         ht->meta[index] = hash_probe_tag(mixed);
+         ht->table[index].hash = hash;
+         ht->table[index].key = key;
+         ht->entries++;
+         return;
+      }
+
+      group = (group + i) & group_mask;
+   }
+}
 
 static void
 set_rehash(struct set *ht, unsigned new_size_index)
@@ -255,26 +276,16 @@ set_rehash(struct set *ht, unsigned new_size_index)
    struct set old_ht;
    struct set_entry *table;
 
-   if (new_size_index >= ARRAY_SIZE(hash_sizes))
-      return;
-
-   table = rzalloc_array(ht, struct set_entry,
-                         hash_sizes[new_size_index].size);
+   table = set_alloc_table(ht, new_size_index);
    if (table == NULL)
       return;
 
    old_ht = *ht;
 
-   ht->table = table;
-   ht->size_index = new_size_index;
-   ht->size = hash_sizes[ht->size_index].size;
-   ht->rehash = hash_sizes[ht->size_index].rehash;
-   ht->max_entries = hash_sizes[ht->size_index].max_entries;
-   ht->entries = 0;
-   ht->deleted_entries = 0;
+   set_set_table(ht, table, new_size_index);
 
    set_foreach(&old_ht, entry) {
-      set_add(ht, entry->hash, entry->key);
+      set_add_rehash(ht, entry->hash, entry->key);
    }
 
    ralloc_free(old_ht.table);
@@ -289,7 +300,9 @@ set_rehash(struct set *ht, unsigned new_size_index)
 static struct set_entry *
 set_add(struct set *ht, uint32_t hash, const void *key)
 {
-   uint32_t hash_address;
+   uint32_t mixed = hash_probe_mix(hash);
+   uint8_t tag = hash_probe_tag(mixed);
+   uint32_t group_mask, group;
    struct set_entry *available_entry = NULL;
 
    if (ht->entries >= ht->max_entries) {
@@ -298,18 +311,12 @@ set_add(struct set *ht, uint32_t hash, const void *key)
       set_rehash(ht, ht->size_index);
    }
 
-   hash_address = hash % ht->size;
-   do {
-      struct set_entry *entry = ht->table + hash_address;
-      uint32_t double_hash;
-
-      if (!entry_is_present(entry)) {
-         /* Stash the first available entry we find */
-         if (available_entry == NULL)
-            available_entry = entry;
-         if (entry_is_free(entry))
-            break;
-      }
+   group_mask = hash_num_groups(ht->size) - 1;
+   group = mixed & group_mask;
+   for (uint32_t i = 1; i <= group_mask + 1; i++) {
+      struct set_entry *entries = ht->table + group * HASH_GROUP_SIZE;
+      const uint8_t *meta = ht->meta + group * HASH_GROUP_SIZE;
+      unsigned match = hash_group_match(meta, tag);
 
       /* Implement replacement when another insert happens
        * with a matching key.  This is a relatively common
@@ -321,21 +328,35 @@ set_add(struct set *ht, uint32_t hash, const void *key)
        * If freeing of old keys is required to avoid memory leaks,
        * perform a search before inserting.
        */
-      if (!entry_is_deleted(entry) &&
-          entry->hash == hash &&
-          ht->key_equals_function(key, entry->key)) {
-         entry->key = key;
-         return entry;
+      while (match) {
+         struct set_entry *entry = entries + u_bit_scan(&match);
+
+         if (entry->hash == hash &&
+             set_key_equals(ht, key, entry->key)) {
+            entry->key = key;
+            return entry;
+         }
+      }
+
+      /* Stash the first available entry we find */
+      if (available_entry == NULL) {
+         unsigned available = hash_group_match_available(meta);
+         if (available)
+            available_entry = entries + ffs(available) - 1;
       }
 
-      double_hash = 1 + hash % ht->rehash;
+      if (hash_group_match_empty(meta))
+         break;
 
-      hash_address = (hash_address + double_hash) % ht->size;
-   } while (hash_address != hash % ht->size);
+      group = (group + i) & group_mask;
+   }
 
    if (available_entry) {
-      if (entry_is_deleted(available_entry))
+      uint32_t index = available_entry - ht->table;
+
+      if (ht->meta[index] == HASH_META_DELETED)
          ht->deleted_entries--;
+      ht->meta[index] = tag;
       available_entry->hash = hash;
       available_entry->key = key;
       ht->entries++;
@@ -375,9 +396,9 @@ _mesa_set_remove(struct set *ht, struct set_entry *entry)
    if (!entry)
       return;
 
-   entry->key = deleted_key;
+   if (hash_meta_remove(ht->meta, entry - ht->table))
+      ht->deleted_entries++;
    ht->entries--;
-   ht->deleted_entries++;
 }
 
 /**
@@ -398,18 +419,11 @@ _mesa_set_remove_key(struct set *set, const void *key)
 struct set_entry *
 _mesa_set_next_entry(const struct set *ht, struct set_entry *entry)
 {
-   if (entry == NULL)
-      entry = ht->table;
-   else
-      entry = entry + 1;
+   uint32_t i = entry == NULL ? 0 : entry - ht->table + 1;
 
-   for (; entry != ht->table + ht->size; entry++) {
-      if (entry_is_present(entry)) {
-         return entry;
-      }
-   }
+   i = hash_meta_next_present(ht->meta, ht->size, i);
 
-   return NULL;
+   return i < ht->size ? ht->table + i : NULL;
 }
 
 struct set_entry *
@@ -423,14 +437,14 @@ _mesa_set_random_entry(struct set *ht,
       return NULL;
 
    for (entry = ht->table + i; entry != ht->table + ht->size; entry++) {
-      if (entry_is_present(entry) &&
+      if (entry_is_present(ht, entry) &&
           (!predicate || predicate(entry))) {
          return entry;
       }
    }
 
    for (entry = ht->table; entry != ht->table + i; entry++) {
-      if (entry_is_present(entry) &&
+      if (entry_is_present(ht, entry) &&
           (!predicate || predicate(entry))) {
          return entry;
       }
@@ -43,10 +43,10 @@ struct set_entry {
 struct set {
    void *mem_ctx;
    struct set_entry *table;
+   uint8_t *meta;
    uint32_t (*key_hash_function)(const void *key);
    bool (*key_equals_function)(const void *a, const void *b);
    uint32_t size;
-   uint32_t rehash;
    uint32_t max_entries;
    uint32_t size_index;
    uint32_t entries;
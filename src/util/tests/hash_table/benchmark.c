@@ -0,0 +1,295 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * Measures the hash table and the set with the kind of keys and table sizes
+ * the compiler uses them with: pointers to heap objects (NIR instructions,
+ * variables) and short strings (GLSL linker names), in tables from a handful
+ * to a hundred thousand entries.
+ *
+ * Usage: benchmark [ops]
+ *
+ * Each measurement runs at least ops operations (1M by default) and reports
+ * the best of a few runs in nanoseconds per operation.
+ */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "hash_table.h"
+#include "os_time.h"
+#include "set.h"
+
+#define NUM_RUNS 3
+
+struct object {
+   char pad[48];
+};
+
+struct keys {
+   const char *name;
+   uint32_t (*hash)(const void *key);
+   bool (*equals)(const void *a, const void *b);
+   unsigned count;
+   /* count keys to store, followed by count keys that are never stored */
+   const void **keys;
+   void *storage;
+};
+
+static volatile uintptr_t sink;
+
+static void
+create_pointer_keys(struct keys *keys, unsigned count)
+{
+   struct object *objects = calloc(2 * count, sizeof(*objects));
+
+   keys->name = "pointer";
+   keys->hash = _mesa_hash_pointer;
+   keys->equals = _mesa_key_pointer_equal;
+   keys->count = count;
+   keys->keys = malloc(2 * count * sizeof(*keys->keys));
+   keys->storage = objects;
+
+   /* Interleave present and missing keys so they share cache lines and
+    * address bits, like objects allocated during one pass would.
+    */
+   for (unsigned i = 0; i < count; i++) {
+      keys->keys[i] = &objects[2 * i];
+      keys->keys[count + i] = &objects[2 * i + 1];
+   }
+}
+
+static void
+create_string_keys(struct keys *keys, unsigned count)
+{
+   char *strings = malloc(2 * count * 32);
+
+   keys->name = "string";
+   keys->hash = _mesa_hash_string;
+   keys->equals = _mesa_key_string_equal;
+   keys->count = count;
+   keys->keys = malloc(2 * count * sizeof(*keys->keys));
+   keys->storage = strings;
+
+   for (unsigned i = 0; i < 2 * count; i++) {
+      char *str = strings + i * 32;
+      snprintf(str, 32, "%s%u", i % 2 ? "gl_out_var_" : "in_var_", i / 2);
+      keys->keys[i % 2 ? count + i / 2 : i / 2] = str;
+   }
+}
+
+static void
+destroy_keys(struct keys *keys)
+{
+   free(keys->keys);
+   free(keys->storage);
+}
+
+static struct hash_table *
+create_filled_table(const struct keys *keys)
+{
+   struct hash_table *ht = _mesa_hash_table_create(NULL, keys->hash,
+                                                   keys->equals);
+
+   for (unsigned i = 0; i < keys->count; i++)
+      _mesa_hash_table_insert(ht, keys->keys[i], NULL);
+
+   return ht;
+}
+
+static unsigned
+ht_insert(const struct keys *keys)
+{
+   struct hash_table *ht = create_filled_table(keys);
+
+   assert(ht->entries == keys->count);
+   _mesa_hash_table_destroy(ht, NULL);
+
+   return keys->count;
+}
+
+static unsigned
+ht_search_hit(const struct keys *keys, struct hash_table *ht)
+{
+   unsigned found = 0;
+
+   for (unsigned i = 0; i < keys->count; i++)
+      found += _mesa_hash_table_search(ht, keys->keys[i]) != NULL;
+
+   assert(found == keys->count);
+   return keys->count;
+}
+
+static unsigned
+ht_search_miss(const struct keys *keys, struct hash_table *ht)
+{
+   unsigned found = 0;
+
+   for (unsigned i = 0; i < keys->count; i++)
+      found += _mesa_hash_table_search(ht, keys->keys[keys->count + i]) != NULL;
+
+   assert(found == 0);
+   return keys->count;
+}
+
+/**
+ * Keeps the table at a steady size while replacing its contents: every step
+ * removes the oldest key, adds a new one and does two lookups, which is how
+ * a pass that updates a table as it walks the shader uses it.
+ *
+ * The table holds the count keys starting at churn_pos, wrapping around the
+ * stored and the missing keys.
+ */
+static unsigned churn_pos;
+
+static unsigned
+ht_churn(const struct keys *keys, struct hash_table *ht)
+{
+   const unsigned num_keys = 2 * keys->count;
+   uintptr_t found = 0;
+
+   for (unsigned i = 0; i < keys->count; i++) {
+      unsigned oldest = churn_pos % num_keys;
+      unsigned newest = (churn_pos + keys->count) % num_keys;
+      unsigned other = (churn_pos * 7 + 3) % num_keys;
+
+      _mesa_hash_table_remove_key(ht, keys->keys[oldest]);
+      _mesa_hash_table_insert(ht, keys->keys[newest], NULL);
+      found += (uintptr_t)_mesa_hash_table_search(ht, keys->keys[newest]);
+      found += (uintptr_t)_mesa_hash_table_search(ht, keys->keys[other]);
+      churn_pos++;
+   }
+
+   assert(ht->entries == keys->count);
+   sink = found;
+   return 4 * keys->count;
+}
+
+static unsigned
+ht_iterate(const struct keys *keys, struct hash_table *ht)
+{
+   unsigned count = 0;
+
+   hash_table_foreach(ht, entry)
+      count++;
+
+   assert(count == ht->entries);
+   return count;
+}
+
+static unsigned
+set_add_search(const struct keys *keys)
+{
+   struct set *set = _mesa_set_create(NULL, keys->hash, keys->equals);
+   unsigned found = 0;
+
+   /* Like nir_instr_set, look every key up before adding it. */
+   for (unsigned i = 0; i < keys->count; i++) {
+      found += _mesa_set_search(set, keys->keys[i]) != NULL;
+      _mesa_set_add(set, keys->keys[i]);
+   }
+
+   for (unsigned i = 0; i < keys->count; i++)
+      found += _mesa_set_search(set, keys->keys[i]) != NULL;
+
+   assert(found == keys->count);
+   _mesa_set_destroy(set, NULL);
+
+   return 3 * keys->count;
+}
+
+static void
+report(const char *test, const struct keys *keys, double ns_per_op)
+{
+   printf("%-16s %-8s %8u %10.2f ns/op\n", test, keys->name, keys->count,
+          ns_per_op);
+}
+
+/* Runs a measurement on a fresh table until it did at least min_ops
+ * operations, and reports the best time out of NUM_RUNS.
+ */
+#define MEASURE(test, keys, min_ops, setup, op, teardown)       \
+   do {                                                         \
+      double best = HUGE_VAL;                                   \
+      for (unsigned run = 0; run < NUM_RUNS; run++) {           \
+         unsigned ops = 0;                                      \
+         setup;                                                 \
+         int64_t start = os_time_get_nano();                    \
+         while (ops < (min_ops))                                \
+            ops += op;                                          \
+         int64_t time = os_time_get_nano() - start;             \
+         teardown;                                              \
+         best = MIN2(best, (double)time / ops);                 \
+      }                                                         \
+      report(test, keys, best);                                 \
+   } while (0)
+
+static void
+run_benchmarks(const struct keys *keys, unsigned min_ops)
+{
+   struct hash_table *ht = NULL;
+
+   MEASURE("insert", keys, min_ops, , ht_insert(keys), );
+   MEASURE("search_hit", keys, min_ops, ht = create_filled_table(keys),
+           ht_search_hit(keys, ht), _mesa_hash_table_destroy(ht, NULL));
+   MEASURE("search_miss", keys, min_ops, ht = create_filled_table(keys),
+           ht_search_miss(keys, ht), _mesa_hash_table_destroy(ht, NULL));
+   MEASURE("churn", keys, min_ops,
+           ht = create_filled_table(keys); churn_pos = 0,
+           ht_churn(keys, ht), _mesa_hash_table_destroy(ht, NULL));
+   MEASURE("iterate", keys, min_ops, ht = create_filled_table(keys),
+           ht_iterate(keys, ht), _mesa_hash_table_destroy(ht, NULL));
+   MEASURE("set_add_search", keys, min_ops, , set_add_search(keys), );
+}
+
+int
+main(int argc, char **argv)
+{
+   static const unsigned sizes[] = { 8, 64, 512, 4096, 32768, 131072 };
+   unsigned min_ops = 1 << 20;
+
+   if (argc > 1)
+      min_ops = strtoul(argv[1], NULL, 0);
+
+   for (unsigned i = 0; i < ARRAY_SIZE(sizes); i++) {
+      struct keys keys;
+
+      create_pointer_keys(&keys, sizes[i]);
+      run_benchmarks(&keys, min_ops);
+      destroy_keys(&keys);
+   }
+
+   for (unsigned i = 0; i < ARRAY_SIZE(sizes); i++) {
+      struct keys keys;
+
+      create_string_keys(&keys, sizes[i]);
+      run_benchmarks(&keys, min_ops);
+      destroy_keys(&keys);
+   }
+
+   return 0;
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#undef NDEBUG
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include "hash_table.h"
+
+static uint64_t
+key_for(unsigned i)
+{
+   /* Small GL-style names first, then keys that only differ in their top
+    * half, like bindless handles.
+    */
+   return i < 1000 ? i : ((uint64_t)i << 32) | 1;
+}
+
+int
+main(int argc, char **argv)
+{
+   struct hash_table_u64 *ht;
+   const unsigned num_keys = 2000;
+   unsigned count;
+
+   (void) argc;
+   (void) argv;
+
+   ht = _mesa_hash_table_u64_create(NULL);
+
+   /* Every value is a valid key, including 0. */
+   for (unsigned i = 0; i < num_keys; i++)
+      _mesa_hash_table_u64_insert(ht, key_for(i), (void *)(uintptr_t)(i + 1));
+   assert(_mesa_hash_table_u64_num_entries(ht) == num_keys);
+
+   for (unsigned i = 0; i < num_keys; i++) {
+      assert(_mesa_hash_table_u64_search(ht, key_for(i)) ==
+             (void *)(uintptr_t)(i + 1));
+   }
+   assert(_mesa_hash_table_u64_search(ht, (uint64_t)1 << 32) == NULL);
+
+   /* Replacement. */
+   _mesa_hash_table_u64_insert(ht, key_for(5), NULL);
+   assert(_mesa_hash_table_u64_num_entries(ht) == num_keys);
+   assert(_mesa_hash_table_u64_search_entry(ht, key_for(5)) != NULL);
+   assert(_mesa_hash_table_u64_search(ht, key_for(5)) == NULL);
+   _mesa_hash_table_u64_insert(ht, key_for(5), (void *)(uintptr_t)6);
+
+   /* Remove every other key. */
+   for (unsigned i = 0; i < num_keys; i += 2)
+      _mesa_hash_table_u64_remove(ht, key_for(i));
+   assert(_mesa_hash_table_u64_num_entries(ht) == num_keys / 2);
+
+   for (unsigned i = 0; i < num_keys; i++) {
+      assert((_mesa_hash_table_u64_search_entry(ht, key_for(i)) != NULL) ==
+             (i % 2 == 1));
+   }
+
+   /* Iteration sees every remaining entry once, and entries can be removed
+    * while iterating.
+    */
+   count = 0;
+   hash_table_u64_foreach(ht, entry) {
+      uint64_t i = entry->key < 1000 ? entry->key : entry->key >> 32;
+
+      assert(i % 2 == 1);
+      assert(entry->data == (void *)(uintptr_t)(i + 1));
+      _mesa_hash_table_u64_remove_entry(ht, entry);
+      count++;
+   }
+   assert(count == num_keys / 2);
+   assert(_mesa_hash_table_u64_num_entries(ht) == 0);
+   assert(_mesa_hash_table_u64_next_entry(ht, NULL) == NULL);
+
+   _mesa_hash_table_u64_destroy(ht, NULL);
+
+   return 0;
+}
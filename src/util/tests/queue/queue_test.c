@@ -0,0 +1,331 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "util/os_time.h"
+#include "util/u_queue.h"
+#include "util/u_thread.h"
+
+#define NUM_PRIORITY_JOBS 4 /* per priority */
+#define MAX_SCALE_THREADS 4
+
+struct test_job {
+   struct util_queue_fence fence;
+   int *counter;
+   int *order;
+   int value;
+   int cleanup_thread;
+};
+
+static struct util_queue_fence gate;
+static struct util_queue_fence gate_started;
+static int num_running;
+
+static void
+count_execute(void *data, int thread_index)
+{
+   struct test_job *job = data;
+
+   p_atomic_inc(job->counter);
+}
+
+static void
+order_execute(void *data, int thread_index)
+{
+   struct test_job *job = data;
+
+   job->order[p_atomic_inc_return(job->counter) - 1] = job->value;
+}
+
+static void
+record_cleanup(void *data, int thread_index)
+{
+   struct test_job *job = data;
+
+   job->cleanup_thread = thread_index;
+}
+
+/* Block the thread until the gate is opened. */
+static void
+gate_execute(void *data, int thread_index)
+{
+   if (p_atomic_inc_return(&num_running) == 1)
+      util_queue_fence_signal(&gate_started);
+   util_queue_fence_wait(&gate);
+}
+
+static void
+close_gate(void)
+{
+   util_queue_fence_init(&gate);
+   util_queue_fence_reset(&gate);
+   util_queue_fence_init(&gate_started);
+   util_queue_fence_reset(&gate_started);
+   num_running = 0;
+}
+
+static void
+test_all_jobs_executed(void)
+{
+   const unsigned num_jobs = 1000;
+   struct util_queue queue;
+   struct test_job *jobs = calloc(num_jobs, sizeof(*jobs));
+   int counter = 0;
+
+   /* A small queue, so that adding jobs has to wait for free slots. */
+   assert(util_queue_init(&queue, "test", 4, 8, 0));
+
+   for (unsigned i = 0; i < num_jobs; i++) {
+      jobs[i].counter = &counter;
+      util_queue_fence_init(&jobs[i].fence);
+      util_queue_add_job(&queue, &jobs[i], &jobs[i].fence, count_execute,
+                         NULL);
+   }
+
+   for (unsigned i = 0; i < num_jobs; i++) {
+      util_queue_fence_wait(&jobs[i].fence);
+      util_queue_fence_destroy(&jobs[i].fence);
+   }
+   assert(counter == num_jobs);
+
+   /* Again, without waiting for the fences. */
+   for (unsigned i = 0; i < num_jobs; i++) {
+      util_queue_fence_init(&jobs[i].fence);
+      util_queue_add_job(&queue, &jobs[i], &jobs[i].fence, count_execute,
+                         NULL);
+   }
+
+   util_queue_finish(&queue);
+   assert(counter == 2 * num_jobs);
+
+   for (unsigned i = 0; i < num_jobs; i++) {
+      assert(util_queue_fence_is_signalled(&jobs[i].fence));
+      util_queue_fence_destroy(&jobs[i].fence);
+   }
+
+   util_queue_destroy(&queue);
+   free(jobs);
+}
+
+static void
+test_priorities(void)
+{
+   static const enum util_queue_priority priorities[] = {
+      UTIL_QUEUE_PRIORITY_BACKGROUND,
+      UTIL_QUEUE_PRIORITY_NORMAL,
+      UTIL_QUEUE_PRIORITY_BLOCKING,
+   };
+   struct util_queue queue;
+   struct util_queue_fence gate_fence;
+   struct test_job jobs[3 * NUM_PRIORITY_JOBS];
+   int order[3 * NUM_PRIORITY_JOBS];
+   int counter = 0;
+
+   assert(util_queue_init(&queue, "test", 32, 1, 0));
+
+   /* Keep the only thread busy while the jobs are added. */
+   close_gate();
+   util_queue_fence_init(&gate_fence);
+   util_queue_add_job(&queue, &gate, &gate_fence, gate_execute, NULL);
+   util_queue_fence_wait(&gate_started);
+
+   for (unsigned i = 0; i < ARRAY_SIZE(jobs); i++) {
+      jobs[i].counter = &counter;
+      jobs[i].order = order;
+      jobs[i].value = i;
+      util_queue_fence_init(&jobs[i].fence);
+      util_queue_add_job_with_priority(&queue, &jobs[i], &jobs[i].fence,
+                                       order_execute, NULL,
+                                       priorities[i / NUM_PRIORITY_JOBS]);
+   }
+
+   util_queue_fence_signal(&gate);
+   util_queue_finish(&queue);
+   assert(counter == ARRAY_SIZE(jobs));
+
+   /* Higher priorities first, in order within the same priority. */
+   for (unsigned i = 0; i < ARRAY_SIZE(jobs); i++) {
+      unsigned priority = 2 - i / NUM_PRIORITY_JOBS;
+      assert(order[i] == priority * NUM_PRIORITY_JOBS + i % NUM_PRIORITY_JOBS);
+   }
+
+   for (unsigned i = 0; i < ARRAY_SIZE(jobs); i++)
+      util_queue_fence_destroy(&jobs[i].fence);
+   util_queue_fence_destroy(&gate_fence);
+   util_queue_destroy(&queue);
+}
+
+static void
+test_drop_job(void)
+{
+   struct util_queue queue;
+   struct util_queue_fence gate_fence;
+   struct test_job job = {0};
+   int counter = 0;
+
+   assert(util_queue_init(&queue, "test", 32, 1, 0));
+
+   close_gate();
+   util_queue_fence_init(&gate_fence);
+   util_queue_add_job(&queue, &gate, &gate_fence, gate_execute, NULL);
+   util_queue_fence_wait(&gate_started);
+
+   job.counter = &counter;
+   job.cleanup_thread = 0;
+   util_queue_fence_init(&job.fence);
+   util_queue_add_job(&queue, &job, &job.fence, count_execute,
+                      record_cleanup);
+   util_queue_drop_job(&queue, &job.fence);
+
+   /* The job was never started. */
+   assert(util_queue_fence_is_signalled(&job.fence));
+   assert(job.cleanup_thread == -1);
+
+   util_queue_fence_signal(&gate);
+   util_queue_finish(&queue);
+   assert(counter == 0);
+
+   util_queue_fence_destroy(&job.fence);
+   util_queue_fence_destroy(&gate_fence);
+   util_queue_destroy(&queue);
+}
+
+static struct util_queue *later_queue;
+static struct util_queue_fence later_fence;
+static struct util_queue_fence finish_started;
+
+/* Once util_queue_finish has started a new generation, add a job that
+ * blocks until the gate is opened.
+ */
+static void
+add_later_execute(void *data, int thread_index)
+{
+   util_queue_fence_wait(&finish_started);
+   util_queue_add_job(later_queue, &gate, &later_fence, gate_execute, NULL);
+}
+
+static int
+finish_thread(void *data)
+{
+   util_queue_finish(data);
+   return 0;
+}
+
+static void
+test_finish_ignores_later_jobs(void)
+{
+   struct util_queue queue;
+   struct util_queue_fence fence;
+   unsigned generation;
+   thrd_t thread;
+
+   assert(util_queue_init(&queue, "test", 32, 2, 0));
+
+   /* The job adds another one while util_queue_finish waits for it, which
+    * util_queue_finish must not wait for. The job only adds it once
+    * util_queue_finish has taken its generation, which is only seen from
+    * another thread while it waits.
+    */
+   close_gate();
+   later_queue = &queue;
+   util_queue_fence_init(&later_fence);
+   util_queue_fence_init(&fence);
+   util_queue_fence_init(&finish_started);
+   util_queue_fence_reset(&finish_started);
+   util_queue_add_job(&queue, &queue, &fence, add_later_execute, NULL);
+
+   generation = p_atomic_read(&queue.generation);
+   thread = u_thread_create(finish_thread, &queue);
+   while (p_atomic_read(&queue.generation) == generation)
+      os_time_sleep(1000);
+   util_queue_fence_signal(&finish_started);
+   thrd_join(thread, NULL);
+
+   assert(util_queue_fence_is_signalled(&fence));
+   assert(!util_queue_fence_is_signalled(&later_fence));
+
+   util_queue_fence_signal(&gate);
+   util_queue_finish(&queue);
+   assert(util_queue_fence_is_signalled(&later_fence));
+
+   util_queue_fence_destroy(&fence);
+   util_queue_fence_destroy(&later_fence);
+   util_queue_fence_destroy(&finish_started);
+   util_queue_destroy(&queue);
+}
+
+static void
+test_scale_threads(void)
+{
+   const unsigned max_threads = MAX_SCALE_THREADS;
+   struct util_queue queue;
+   struct util_queue_fence fences[MAX_SCALE_THREADS];
+
+   assert(util_queue_init(&queue, "test", 32, max_threads,
+                          UTIL_QUEUE_INIT_SCALE_THREADS));
+   assert(queue.num_threads == 1);
+
+   /* Each job blocks its thread, so all of them can only be running at the
+    * same time if the queue created enough threads.
+    */
+   close_gate();
+   for (unsigned i = 0; i < max_threads; i++) {
+      util_queue_fence_init(&fences[i]);
+      util_queue_add_job(&queue, &gate, &fences[i], gate_execute, NULL);
+   }
+
+   int64_t timeout = os_time_get_nano() + 10ll * 1000 * 1000 * 1000;
+   while (p_atomic_read(&num_running) < max_threads &&
+          os_time_get_nano() < timeout)
+      os_time_sleep(1000);
+
+   assert(p_atomic_read(&num_running) == max_threads);
+   assert(queue.num_threads == max_threads);
+
+   util_queue_fence_signal(&gate);
+   util_queue_finish(&queue);
+
+   for (unsigned i = 0; i < max_threads; i++)
+      util_queue_fence_destroy(&fences[i]);
+   util_queue_destroy(&queue);
+}
+
+int
+main(int argc, char **argv)
+{
+   (void) argc;
+   (void) argv;
+
+   test_all_jobs_executed();
+   test_priorities();
+   test_drop_job();
+   test_finish_ignores_later_jobs();
+   test_scale_threads();
+
+   return 0;
+}
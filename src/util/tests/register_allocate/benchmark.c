@@ -0,0 +1,355 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+/**
+ * Replays interference graphs through the register allocator.
+ *
+ * Usage: benchmark [dump...]
+ *
+ * The dumps are the files written by ra_dump_graph(), which drivers do for
+ * every graph they allocate when MESA_RA_DUMP_DIR is set.  Without any, the
+ * benchmark makes up graphs of live ranges of increasing size.
+ *
+ * For each graph, prints whether it could be colored and the best time of a
+ * few runs, not counting building the graph.
+ */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util/os_time.h"
+#include "util/ralloc.h"
+#include "util/register_allocate.h"
+#include "util/u_dynarray.h"
+
+#define NUM_RUNS 3
+
+struct pair {
+   unsigned a, b;
+};
+
+struct graph_desc {
+   unsigned reg_count;
+   unsigned class_count;
+   bool round_robin;
+   struct util_dynarray conflicts;   /* struct pair, reg a conflicts with b */
+   struct util_dynarray class_regs;  /* struct pair, class a has reg b */
+   unsigned **q;
+
+   unsigned node_count;
+   unsigned *node_class;
+   int *node_reg;
+   float *node_spill_cost;
+   struct util_dynarray edges;       /* struct pair */
+};
+
+static void
+desc_init(struct graph_desc *desc, void *mem_ctx)
+{
+   memset(desc, 0, sizeof(*desc));
+   util_dynarray_init(&desc->conflicts, mem_ctx);
+   util_dynarray_init(&desc->class_regs, mem_ctx);
+   util_dynarray_init(&desc->edges, mem_ctx);
+}
+
+static void
+add_pair(struct util_dynarray *pairs, unsigned a, unsigned b)
+{
+   struct pair pair = { a, b };
+   util_dynarray_append(pairs, struct pair, pair);
+}
+
+static struct ra_regs *
+build_regs(const struct graph_desc *desc, void *mem_ctx)
+{
+   struct ra_regs *regs = ra_alloc_reg_set(mem_ctx, desc->reg_count,
+                                           desc->q == NULL);
+
+   for (unsigned c = 0; c < desc->class_count; c++)
+      ra_alloc_reg_class(regs);
+
+   util_dynarray_foreach(&desc->class_regs, struct pair, p)
+      ra_class_add_reg(regs, p->a, p->b);
+
+   util_dynarray_foreach(&desc->conflicts, struct pair, p) {
+      if (p->a != p->b)
+         ra_add_reg_conflict(regs, p->a, p->b);
+   }
+
+   if (desc->round_robin)
+      ra_set_allocate_round_robin(regs);
+
+   ra_set_finalize(regs, desc->q);
+
+   return regs;
+}
+
+static struct ra_graph *
+build_graph(const struct graph_desc *desc, struct ra_regs *regs)
+{
+   struct ra_graph *g = ra_alloc_interference_graph(regs, desc->node_count);
+
+   for (unsigned n = 0; n < desc->node_count; n++) {
+      ra_set_node_class(g, n, desc->node_class[n]);
+      if (desc->node_reg[n] >= 0)
+         ra_set_node_reg(g, n, desc->node_reg[n]);
+      ra_set_node_spill_cost(g, n, desc->node_spill_cost[n]);
+   }
+
+   util_dynarray_foreach(&desc->edges, struct pair, p)
+      ra_add_node_interference(g, p->a, p->b);
+
+   return g;
+}
+
+static void
+run_graph(const char *name, const struct graph_desc *desc)
+{
+   void *mem_ctx = ralloc_context(NULL);
+   struct ra_regs *regs = build_regs(desc, mem_ctx);
+   unsigned num_edges = util_dynarray_num_elements(&desc->edges, struct pair);
+   double best = HUGE_VAL;
+   bool ok = false;
+
+   for (unsigned run = 0; run < NUM_RUNS; run++) {
+      struct ra_graph *g = build_graph(desc, regs);
+      int64_t start = os_time_get_nano();
+
+      ok = ra_allocate(g);
+      best = MIN2(best, (os_time_get_nano() - start) / 1000.0);
+
+      ralloc_free(g);
+   }
+
+   printf("%s: %u regs, %u nodes, %u edges: %s in %.1f us\n", name,
+          desc->reg_count, desc->node_count, num_edges,
+          ok ? "colored" : "spills", best);
+
+   ralloc_free(mem_ctx);
+}
+
+/* Reads a whole line, however long, or returns NULL at the end of file. */
+static char *
+read_line(FILE *f, char **buf, size_t *size)
+{
+   size_t len = 0;
+
+   while (fgets(*buf + len, *size - len, f)) {
+      len += strlen(*buf + len);
+      if (len && (*buf)[len - 1] == '\n')
+         return *buf;
+
+      *size *= 2;
+      *buf = realloc(*buf, *size);
+   }
+
+   return len ? *buf : NULL;
+}
+
+/* Parses the unsigned numbers following the first word of a line. */
+static unsigned
+parse_numbers(char *line, unsigned *numbers, unsigned max)
+{
+   char *p = strchr(line, ' ');
+   unsigned count = 0;
+
+   while (p && count < max) {
+      char *end;
+      long value = strtol(p, &end, 10);
+
+      if (end == p)
+         break;
+      numbers[count++] = value;
+      p = end;
+   }
+
+   return count;
+}
+
+/**
+ * Parses the next graph of a dump into desc, and returns false at the end
+ * of the file.
+ */
+static bool
+parse_graph(FILE *f, struct graph_desc *desc, void *mem_ctx)
+{
+   size_t size = 4096;
+   char *buf = malloc(size);
+   unsigned *numbers = NULL;
+   unsigned max_numbers = 0;
+   char *line;
+   bool found = false;
+
+   desc_init(desc, mem_ctx);
+
+   while ((line = read_line(f, &buf, &size))) {
+      unsigned count;
+
+      if (strlen(line) > max_numbers) {
+         max_numbers = strlen(line);
+         numbers = realloc(numbers, max_numbers * sizeof(*numbers));
+      }
+      count = parse_numbers(line, numbers, max_numbers);
+
+      if (!strncmp(line, "regs ", 5)) {
+         assert(count == 3);
+         desc->reg_count = numbers[0];
+         desc->class_count = numbers[1];
+         desc->round_robin = numbers[2];
+         desc->q = ralloc_array(mem_ctx, unsigned *, desc->class_count);
+         found = true;
+      } else if (!strncmp(line, "r ", 2)) {
+         for (unsigned i = 1; i < count; i++)
+            add_pair(&desc->conflicts, numbers[0], numbers[i]);
+      } else if (!strncmp(line, "c ", 2)) {
+         for (unsigned i = 1; i < count; i++)
+            add_pair(&desc->class_regs, numbers[0], numbers[i]);
+      } else if (!strncmp(line, "q ", 2)) {
+         assert(count == desc->class_count + 1);
+         desc->q[numbers[0]] = ralloc_array(desc->q, unsigned,
+                                            desc->class_count);
+         memcpy(desc->q[numbers[0]], numbers + 1,
+                desc->class_count * sizeof(unsigned));
+      } else if (!strncmp(line, "graph ", 6)) {
+         desc->node_count = numbers[0];
+         desc->node_class = ralloc_array(mem_ctx, unsigned, numbers[0]);
+         desc->node_reg = ralloc_array(mem_ctx, int, numbers[0]);
+         desc->node_spill_cost = ralloc_array(mem_ctx, float, numbers[0]);
+      } else if (!strncmp(line, "n ", 2)) {
+         unsigned n;
+         int reg;
+         float cost;
+
+         if (sscanf(line, "n %u %*u %d %a", &n, &reg, &cost) != 3)
+            break;
+         desc->node_class[n] = numbers[1];
+         desc->node_reg[n] = reg;
+         desc->node_spill_cost[n] = cost;
+      } else if (!strncmp(line, "e ", 2)) {
+         add_pair(&desc->edges, numbers[0], numbers[1]);
+      } else if (!strncmp(line, "end", 3)) {
+         break;
+      }
+   }
+
+   free(numbers);
+   free(buf);
+
+   return found;
+}
+
+/**
+ * Makes up the graph of a long shader: one value is defined per instruction
+ * and lives for a while, a quarter of them are register pairs, and a third
+ * are copied into the next value, ending their live range.  The register
+ * set has 128 registers and the aligned pairs of them.
+ */
+static void
+make_graph(struct graph_desc *desc, void *mem_ctx, unsigned node_count)
+{
+   const unsigned num_base = 128;
+   unsigned *end;
+
+   desc_init(desc, mem_ctx);
+
+   desc->reg_count = num_base + num_base / 2;
+   desc->class_count = 2;
+   for (unsigned r = 0; r < num_base; r++)
+      add_pair(&desc->class_regs, 0, r);
+   for (unsigned i = 0; i < num_base / 2; i++) {
+      unsigned r = num_base + i;
+
+      add_pair(&desc->class_regs, 1, r);
+      add_pair(&desc->conflicts, r, 2 * i);
+      add_pair(&desc->conflicts, r, 2 * i + 1);
+   }
+
+   desc->node_count = node_count;
+   desc->node_class = ralloc_array(mem_ctx, unsigned, node_count);
+   desc->node_reg = ralloc_array(mem_ctx, int, node_count);
+   desc->node_spill_cost = ralloc_array(mem_ctx, float, node_count);
+   end = ralloc_array(mem_ctx, unsigned, node_count);
+
+   srand(node_count);
+   for (unsigned n = 0; n < node_count; n++) {
+      desc->node_class[n] = rand() % 4 ? 0 : 1;
+      desc->node_reg[n] = -1;
+      desc->node_spill_cost[n] = 1.0f + rand() % 16;
+      end[n] = n + 1 + rand() % 120;
+
+      if (n > 0 && rand() % 3 == 0 &&
+          desc->node_class[n] == desc->node_class[n - 1])
+         end[n - 1] = n;
+   }
+
+   for (unsigned n = 0; n < node_count; n++) {
+      for (unsigned n2 = n + 1; n2 < node_count && n2 < end[n]; n2++)
+         add_pair(&desc->edges, n, n2);
+   }
+}
+
+int
+main(int argc, char **argv)
+{
+   if (argc > 1) {
+      for (int i = 1; i < argc; i++) {
+         FILE *f = fopen(argv[i], "r");
+         struct graph_desc desc;
+         void *mem_ctx = ralloc_context(NULL);
+
+         if (!f) {
+            fprintf(stderr, "Failed to open %s\n", argv[i]);
+            return 1;
+         }
+
+         while (parse_graph(f, &desc, mem_ctx)) {
+            run_graph(argv[i], &desc);
+            ralloc_free(mem_ctx);
+            mem_ctx = ralloc_context(NULL);
+         }
+
+         ralloc_free(mem_ctx);
+         fclose(f);
+      }
+   } else {
+      static const unsigned sizes[] = { 500, 2000, 8000, 32000 };
+
+      for (unsigned i = 0; i < ARRAY_SIZE(sizes); i++) {
+         struct graph_desc desc;
+         void *mem_ctx = ralloc_context(NULL);
+         char name[32];
+
+         make_graph(&desc, mem_ctx, sizes[i]);
+         snprintf(name, sizeof(name), "synthetic %u", sizes[i]);
+         run_graph(name, &desc);
+         ralloc_free(mem_ctx);
+      }
+   }
+
+   return 0;
+}
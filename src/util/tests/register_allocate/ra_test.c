@@ -0,0 +1,211 @@
+/*
+ * Copyright © 2018 Intel Corporation
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice (including the next
+ * paragraph) shall be included in all copies or substantial portions of the
+ * Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS
+ * IN THE SOFTWARE.
+ */
+
+#undef NDEBUG
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "util/ralloc.h"
+#include "util/register_allocate.h"
+
+/* NUM_BASE single registers, followed by the aligned pairs of them. */
+#define NUM_BASE 16
+#define NUM_REGS (NUM_BASE + NUM_BASE / 2)
+
+static unsigned class_single, class_pair;
+
+static struct ra_regs *
+create_reg_set(void *mem_ctx)
+{
+   struct ra_regs *regs = ra_alloc_reg_set(mem_ctx, NUM_REGS, true);
+
+   class_single = ra_alloc_reg_class(regs);
+   class_pair = ra_alloc_reg_class(regs);
+
+   for (unsigned r = 0; r < NUM_BASE; r++)
+      ra_class_add_reg(regs, class_single, r);
+
+   for (unsigned i = 0; i < NUM_BASE / 2; i++) {
+      unsigned r = NUM_BASE + i;
+
+      ra_class_add_reg(regs, class_pair, r);
+      ra_add_transitive_reg_conflict(regs, 2 * i, r);
+      ra_add_transitive_reg_conflict(regs, 2 * i + 1, r);
+   }
+
+   ra_set_finalize(regs, NULL);
+
+   return regs;
+}
+
+/* Returns the mask of base registers covered by a register. */
+static unsigned
+reg_mask(unsigned r)
+{
+   if (r < NUM_BASE)
+      return 1u << r;
+   return 3u << (2 * (r - NUM_BASE));
+}
+
+struct interval_graph {
+   unsigned count;
+   unsigned *start, *end, *class, *fixed;
+};
+
+static bool
+intervals_overlap(const struct interval_graph *ig, unsigned i, unsigned j)
+{
+   return ig->start[i] < ig->end[j] && ig->start[j] < ig->end[i];
+}
+
+/**
+ * Creates a graph of live ranges, one defined per instruction, where a
+ * third of the values are copied into the next one, ending their live
+ * range.
+ */
+static void
+create_interval_graph(struct interval_graph *ig, void *mem_ctx,
+                      unsigned count, unsigned max_len)
+{
+   ig->count = count;
+   ig->start = ralloc_array(mem_ctx, unsigned, count);
+   ig->end = ralloc_array(mem_ctx, unsigned, count);
+   ig->class = ralloc_array(mem_ctx, unsigned, count);
+   ig->fixed = ralloc_array(mem_ctx, unsigned, count);
+
+   for (unsigned i = 0; i < count; i++) {
+      ig->start[i] = i;
+      ig->end[i] = i + 1 + rand() % max_len;
+      ig->class[i] = rand() % 4 ? class_single : class_pair;
+      ig->fixed[i] = ~0u;
+
+      if (i > 0 && rand() % 3 == 0 && ig->class[i] == ig->class[i - 1])
+         ig->end[i - 1] = i;
+   }
+
+   /* Like shader inputs, the first few values live in fixed registers. */
+   for (unsigned i = 0; i < 3 && i < count; i++) {
+      if (ig->class[i] == class_single)
+         ig->fixed[i] = i;
+   }
+}
+
+static struct ra_graph *
+build_graph(struct ra_regs *regs, const struct interval_graph *ig)
+{
+   struct ra_graph *g = ra_alloc_interference_graph(regs, ig->count);
+
+   for (unsigned i = 0; i < ig->count; i++) {
+      ra_set_node_class(g, i, ig->class[i]);
+      if (ig->fixed[i] != ~0u)
+         ra_set_node_reg(g, i, ig->fixed[i]);
+      else
+         ra_set_node_spill_cost(g, i, 1.0f + i % 7);
+   }
+
+   for (unsigned i = 0; i < ig->count; i++) {
+      for (unsigned j = i + 1; j < ig->count && ig->start[j] < ig->end[i];
+           j++) {
+         if (intervals_overlap(ig, i, j))
+            ra_add_node_interference(g, i, j);
+      }
+   }
+
+   return g;
+}
+
+/* Checks that every node got a register of its class that doesn't
+ * conflict with any of its neighbors.
+ */
+static void
+check_allocation(struct ra_graph *g, const struct interval_graph *ig)
+{
+   for (unsigned i = 0; i < ig->count; i++) {
+      unsigned r = ra_get_node_reg(g, i);
+
+      if (ig->fixed[i] != ~0u) {
+         assert(r == ig->fixed[i]);
+         continue;
+      }
+
+      if (ig->class[i] == class_single)
+         assert(r < NUM_BASE);
+      else
+         assert(r >= NUM_BASE && r < NUM_REGS);
+
+      for (unsigned j = 0; j < ig->count; j++) {
+         if (j != i && intervals_overlap(ig, i, j))
+            assert(!(reg_mask(r) & reg_mask(ra_get_node_reg(g, j))));
+      }
+   }
+}
+
+static void
+test_interval_graphs(void)
+{
+   void *mem_ctx = ralloc_context(NULL);
+   struct ra_regs *regs = create_reg_set(mem_ctx);
+   unsigned allocated = 0, spilled = 0;
+
+   srand(1);
+
+   for (unsigned iter = 0; iter < 200; iter++) {
+      struct interval_graph ig;
+      struct ra_graph *g;
+
+      create_interval_graph(&ig, mem_ctx, 50 + rand() % 200,
+                            2 + rand() % 16);
+      g = build_graph(regs, &ig);
+
+      if (ra_allocate(g)) {
+         check_allocation(g, &ig);
+         allocated++;
+      } else {
+         int n = ra_get_best_spill_node(g);
+
+         assert(n >= 0 && n < ig.count);
+         assert(ig.fixed[n] == ~0u);
+         spilled++;
+      }
+
+      ralloc_free(g);
+   }
+
+   /* The graphs are meant to cover both cases. */
+   assert(allocated > 0 && spilled > 0);
+
+   ralloc_free(mem_ctx);
+}
+
+int
+main(int argc, char **argv)
+{
+   (void) argc;
+   (void) argv;
+
+   test_interval_graphs();
+
+   return 0;
+}
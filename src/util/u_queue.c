@@ -231,6 +231,77 @@ struct thread_input {
    int thread_index;
 };
 
+static void
+util_queue_ring_push(struct util_queue_ring *ring,
+                     const struct util_queue_job *job)
+{
+   if (ring->num_jobs == ring->size) {
+      /* Make the ring larger, all callers have reserved space already. */
+      unsigned new_size = MAX2(ring->size * 2, 8);
+      struct util_queue_job *jobs =
+         (struct util_queue_job*)calloc(new_size,
+                                        sizeof(struct util_queue_job));
+      assert(jobs);
+
+      for (unsigned i = 0; i < ring->num_jobs; i++)
+         jobs[i] = ring->jobs[(ring->read_idx + i) % ring->size];
+
+      free(ring->jobs);
+      ring->jobs = jobs;
+      ring->size = new_size;
+      ring->read_idx = 0;
+   }
+
+   ring->jobs[(ring->read_idx + ring->num_jobs) % ring->size] = *job;
+   p_atomic_set(&ring->num_jobs, ring->num_jobs + 1);
+}
+
+static void
+util_queue_ring_pop(struct util_queue_ring *ring, struct util_queue_job *job)
+{
+   assert(ring->num_jobs > 0);
+
+   *job = ring->jobs[ring->read_idx];
+   memset(&ring->jobs[ring->read_idx], 0, sizeof(struct util_queue_job));
+   ring->read_idx = (ring->read_idx + 1) % ring->size;
+   p_atomic_set(&ring->num_jobs, ring->num_jobs - 1);
+}
+
+/**
+ * Take the next job with the highest priority. The jobs of the calling
+ * thread are preferred, other threads are robbed only if it has no job of
+ * the same priority.
+ */
+static bool
+util_queue_take_job(struct util_queue *queue, unsigned thread_index,
+                    struct util_queue_job *job)
+{
+   unsigned num_threads = p_atomic_read(&queue->num_threads);
+
+   for (unsigned p = 0; p < UTIL_QUEUE_NUM_PRIORITIES; p++) {
+      for (unsigned i = 0; i < num_threads; i++) {
+         struct util_queue_thread_jobs *jobs =
+            &queue->thread_jobs[(thread_index + i) % num_threads];
+         struct util_queue_ring *ring = &jobs->rings[p];
+
+         /* Don't take the lock of threads which have nothing to steal. */
+         if (p_atomic_read(&ring->num_jobs) == 0)
+            continue;
+
+         mtx_lock(&jobs->lock);
+         if (ring->num_jobs) {
+            util_queue_ring_pop(ring, job);
+            p_atomic_dec(&queue->num_ready);
+            mtx_unlock(&jobs->lock);
+            return true;
+         }
+         mtx_unlock(&jobs->lock);
+      }
+   }
+
+   return false;
+}
+
 static int
 util_queue_thread_func(void *input)
 {
@@ -262,25 +333,28 @@ util_queue_thread_func(void *input)
    while (1) {
       struct util_queue_job job;
 
-      mtx_lock(&queue->lock);
-      assert(queue->num_queued >= 0 && queue->num_queued <= queue->max_jobs);
+      if (p_atomic_read(&queue->kill_threads))
+         break;
+
+      if (!util_queue_take_job(queue, thread_index, &job)) {
+         mtx_lock(&queue->lock);
+         p_atomic_inc(&queue->num_sleeping);
 
-      /* wait if the queue is empty */
-      while (!queue->kill_threads && queue->num_queued == 0)
-         cnd_wait(&queue->has_queued_cond, &queue->lock);
+         /* wait if the queue is empty */
+         while (!queue->kill_threads && p_atomic_read(&queue->num_ready) <= 0)
+            cnd_wait(&queue->has_queued_cond, &queue->lock);
 
-      if (queue->kill_threads) {
+         p_atomic_dec(&queue->num_sleeping);
          mtx_unlock(&queue->lock);
-         break;
+         continue;
       }
 
-      job = queue->jobs[queue->read_idx];
-      memset(&queue->jobs[queue->read_idx], 0, sizeof(struct util_queue_job));
-      queue->read_idx = (queue->read_idx + 1) % queue->max_jobs;
-
-      queue->num_queued--;
-      cnd_signal(&queue->has_space_cond);
-      mtx_unlock(&queue->lock);
+      p_atomic_dec(&queue->num_queued);
+      if (p_atomic_read(&queue->num_space_waiters)) {
+         mtx_lock(&queue->lock);
+         cnd_signal(&queue->has_space_cond);
+         mtx_unlock(&queue->lock);
+      }
 
       if (job.job) {
          job.execute(job.job, thread_index);
@@ -288,23 +362,52 @@ util_queue_thread_func(void *input)
          if (job.cleanup)
             job.cleanup(job.job, thread_index);
       }
-   }
 
-   /* signal remaining jobs before terminating */
-   mtx_lock(&queue->lock);
-   for (unsigned i = queue->read_idx; i != queue->write_idx;
-        i = (i + 1) % queue->max_jobs) {
-      if (queue->jobs[i].job) {
-         util_queue_fence_signal(queue->jobs[i].fence);
-         queue->jobs[i].job = NULL;
+      if (p_atomic_dec_zero(&queue->num_pending[job.generation & 1]) &&
+          p_atomic_read(&queue->num_finish_waiters)) {
+         mtx_lock(&queue->lock);
+         cnd_broadcast(&queue->idle_cond);
+         mtx_unlock(&queue->lock);
       }
    }
-   queue->read_idx = queue->write_idx;
-   queue->num_queued = 0;
-   mtx_unlock(&queue->lock);
+
    return 0;
 }
 
+static bool
+util_queue_create_thread(struct util_queue *queue, unsigned index)
+{
+   struct thread_input *input =
+      (struct thread_input *) malloc(sizeof(struct thread_input));
+   if (!input)
+      return false;
+
+   input->queue = queue;
+   input->thread_index = index;
+
+   queue->threads[index] = u_thread_create(util_queue_thread_func, input);
+
+   if (!queue->threads[index]) {
+      free(input);
+      return false;
+   }
+
+   if (queue->flags & UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY) {
+#if defined(__linux__) && defined(SCHED_IDLE)
+      struct sched_param sched_param = {0};
+
+      /* The nice() function can only set a maximum of 19.
+       * SCHED_IDLE is the same as nice = 20.
+       *
+       * Note that Linux only allows decreasing the priority. The original
+       * priority can't be restored.
+       */
+      pthread_setschedparam(queue->threads[index], SCHED_IDLE, &sched_param);
+#endif
+   }
+   return true;
+}
+
 bool
 util_queue_init(struct util_queue *queue,
                 const char *name,
@@ -343,60 +446,46 @@ util_queue_init(struct util_queue *queue,
    }
 
    queue->flags = flags;
-   queue->num_threads = num_threads;
+   queue->max_threads = num_threads;
    queue->max_jobs = max_jobs;
 
-   queue->jobs = (struct util_queue_job*)
-                 calloc(max_jobs, sizeof(struct util_queue_job));
-   if (!queue->jobs)
+   queue->thread_jobs = (struct util_queue_thread_jobs*)
+                        calloc(num_threads,
+                               sizeof(struct util_queue_thread_jobs));
+   if (!queue->thread_jobs)
       goto fail;
 
+   for (i = 0; i < num_threads; i++)
+      (void) mtx_init(&queue->thread_jobs[i].lock, mtx_plain);
+
    (void) mtx_init(&queue->lock, mtx_plain);
    (void) mtx_init(&queue->finish_lock, mtx_plain);
 
    queue->num_queued = 0;
    cnd_init(&queue->has_queued_cond);
    cnd_init(&queue->has_space_cond);
+   cnd_init(&queue->idle_cond);
 
    queue->threads = (thrd_t*) calloc(num_threads, sizeof(thrd_t));
    if (!queue->threads)
       goto fail;
 
+   if (flags & UTIL_QUEUE_INIT_SCALE_THREADS)
+      num_threads = 1;
+
    /* start threads */
    for (i = 0; i < num_threads; i++) {
-      struct thread_input *input =
-         (struct thread_input *) malloc(sizeof(struct thread_input));
-      input->queue = queue;
-      input->thread_index = i;
-
-      queue->threads[i] = u_thread_create(util_queue_thread_func, input);
-
-      if (!queue->threads[i]) {
-         free(input);
-
+      if (!util_queue_create_thread(queue, i)) {
          if (i == 0) {
             /* no threads created, fail */
             goto fail;
          } else {
             /* at least one thread created, so use it */
-            queue->num_threads = i;
+            queue->flags &= ~UTIL_QUEUE_INIT_SCALE_THREADS;
             break;
          }
       }
-
-      if (flags & UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY) {
-   #if defined(__linux__) && defined(SCHED_IDLE)
-         struct sched_param sched_param = {0};
-
-         /* The nice() function can only set a maximum of 19.
-          * SCHED_IDLE is the same as nice = 20.
-          *
-          * Note that Linux only allows decreasing the priority. The original
-          * priority can't be restored.
-          */
-         pthread_setschedparam(queue->threads[i], SCHED_IDLE, &sched_param);
-   #endif
-      }
+      p_atomic_set(&queue->num_threads, i + 1);
    }
 
    add_to_atexit_list(queue);
@@ -405,11 +494,15 @@ util_queue_init(struct util_queue *queue,
 fail:
    free(queue->threads);
 
-   if (queue->jobs) {
+   if (queue->thread_jobs) {
+      cnd_destroy(&queue->idle_cond);
       cnd_destroy(&queue->has_space_cond);
       cnd_destroy(&queue->has_queued_cond);
+      mtx_destroy(&queue->finish_lock);
       mtx_destroy(&queue->lock);
-      free(queue->jobs);
+      for (i = 0; i < queue->max_threads; i++)
+         mtx_destroy(&queue->thread_jobs[i].lock);
+      free(queue->thread_jobs);
    }
    /* also util_queue_is_initialized can be used to check for success */
    memset(queue, 0, sizeof(*queue));
@@ -423,13 +516,41 @@ util_queue_killall_and_wait(struct util_queue *queue)
 
    /* Signal all threads to terminate. */
    mtx_lock(&queue->lock);
-   queue->kill_threads = 1;
+   if (queue->kill_threads) {
+      /* already done by the atexit handler */
+      mtx_unlock(&queue->lock);
+      return;
+   }
+   p_atomic_set(&queue->kill_threads, 1);
    cnd_broadcast(&queue->has_queued_cond);
+   cnd_broadcast(&queue->has_space_cond);
+   cnd_broadcast(&queue->idle_cond);
    mtx_unlock(&queue->lock);
 
    for (i = 0; i < queue->num_threads; i++)
       thrd_join(queue->threads[i], NULL);
-   queue->num_threads = 0;
+
+   /* signal remaining jobs */
+   for (i = 0; i < queue->num_threads; i++) {
+      struct util_queue_thread_jobs *jobs = &queue->thread_jobs[i];
+
+      mtx_lock(&jobs->lock);
+      for (unsigned p = 0; p < UTIL_QUEUE_NUM_PRIORITIES; p++) {
+         struct util_queue_ring *ring = &jobs->rings[p];
+         struct util_queue_job job;
+
+         while (ring->num_jobs) {
+            util_queue_ring_pop(ring, &job);
+            if (job.job)
+               util_queue_fence_signal(job.fence);
+         }
+      }
+      mtx_unlock(&jobs->lock);
+   }
+   queue->num_queued = 0;
+   queue->num_ready = 0;
+   queue->num_pending[0] = 0;
+   queue->num_pending[1] = 0;
 }
 
 void
@@ -438,26 +559,98 @@ util_queue_destroy(struct util_queue *queue)
    util_queue_killall_and_wait(queue);
    remove_from_atexit_list(queue);
 
+   cnd_destroy(&queue->idle_cond);
    cnd_destroy(&queue->has_space_cond);
    cnd_destroy(&queue->has_queued_cond);
    mtx_destroy(&queue->finish_lock);
    mtx_destroy(&queue->lock);
-   free(queue->jobs);
+
+   for (unsigned i = 0; i < queue->max_threads; i++) {
+      for (unsigned p = 0; p < UTIL_QUEUE_NUM_PRIORITIES; p++)
+         free(queue->thread_jobs[i].rings[p].jobs);
+      mtx_destroy(&queue->thread_jobs[i].lock);
+   }
+   free(queue->thread_jobs);
    free(queue->threads);
 }
 
-void
-util_queue_add_job(struct util_queue *queue,
-                   void *job,
-                   struct util_queue_fence *fence,
-                   util_queue_execute_func execute,
-                   util_queue_execute_func cleanup)
+/**
+ * Reserve a place for a new job in the queue, waiting for a free slot if
+ * the queue is full. Returns false if the queue is being destroyed.
+ */
+static bool
+util_queue_reserve_job(struct util_queue *queue)
 {
-   struct util_queue_job *ptr;
+   if (queue->flags & UTIL_QUEUE_INIT_RESIZE_IF_FULL) {
+      /* The rings are made larger if needed. */
+      p_atomic_inc(&queue->num_queued);
+      return true;
+   }
 
-   mtx_lock(&queue->lock);
-   if (queue->kill_threads) {
+   while (1) {
+      int num_queued = p_atomic_read(&queue->num_queued);
+
+      assert(num_queued <= queue->max_jobs);
+
+      if (num_queued < queue->max_jobs) {
+         if (p_atomic_cmpxchg(&queue->num_queued, num_queued,
+                              num_queued + 1) == num_queued)
+            return true;
+         continue;
+      }
+
+      /* Wait until there is a free slot. */
+      mtx_lock(&queue->lock);
+      p_atomic_inc(&queue->num_space_waiters);
+      while (!queue->kill_threads &&
+             p_atomic_read(&queue->num_queued) >= queue->max_jobs)
+         cnd_wait(&queue->has_space_cond, &queue->lock);
+      p_atomic_dec(&queue->num_space_waiters);
       mtx_unlock(&queue->lock);
+
+      if (p_atomic_read(&queue->kill_threads))
+         return false;
+   }
+}
+
+/**
+ * Create another thread if all the threads are busy.
+ */
+static void
+util_queue_scale_threads(struct util_queue *queue)
+{
+   unsigned num_threads = p_atomic_read(&queue->num_threads);
+
+   if (num_threads >= queue->max_threads ||
+       p_atomic_read(&queue->num_queued) <=
+       p_atomic_read(&queue->num_sleeping))
+      return;
+
+   mtx_lock(&queue->lock);
+   num_threads = queue->num_threads;
+   if (!queue->kill_threads && num_threads < queue->max_threads) {
+      if (util_queue_create_thread(queue, num_threads))
+         p_atomic_set(&queue->num_threads, num_threads + 1);
+      else
+         queue->flags &= ~UTIL_QUEUE_INIT_SCALE_THREADS; /* don't try again */
+   }
+   mtx_unlock(&queue->lock);
+}
+
+void
+util_queue_add_job_with_priority(struct util_queue *queue,
+                                 void *job,
+                                 struct util_queue_fence *fence,
+                                 util_queue_execute_func execute,
+                                 util_queue_execute_func cleanup,
+                                 enum util_queue_priority priority)
+{
+   struct util_queue_job new_job;
+
+   assert(priority < UTIL_QUEUE_NUM_PRIORITIES);
+
+   if (p_atomic_read(&queue->kill_threads) ||
+       !util_queue_reserve_job(queue)) {
       /* well no good option here, but any leaks will be
        * short-lived as things are shutting down..
        */
@@ -466,53 +659,63 @@ util_queue_add_job(struct util_queue *queue,
 
    util_queue_fence_reset(fence);
 
-   assert(queue->num_queued >= 0 && queue->num_queued <= queue->max_jobs);
-
-   if (queue->num_queued == queue->max_jobs) {
-      if (queue->flags & UTIL_QUEUE_INIT_RESIZE_IF_FULL) {
-         /* If the queue is full, make it larger to avoid waiting for a free
-          * slot.
-          */
-         unsigned new_max_jobs = queue->max_jobs + 8;
-         struct util_queue_job *jobs =
-            (struct util_queue_job*)calloc(new_max_jobs,
-                                           sizeof(struct util_queue_job));
-         assert(jobs);
-
-         /* Copy all queued jobs into the new list. */
-         unsigned num_jobs = 0;
-         unsigned i = queue->read_idx;
-
-         do {
-            jobs[num_jobs++] = queue->jobs[i];
-            i = (i + 1) % queue->max_jobs;
-         } while (i != queue->write_idx);
-
-         assert(num_jobs == queue->num_queued);
-
-         free(queue->jobs);
-         queue->jobs = jobs;
-         queue->read_idx = 0;
-         queue->write_idx = num_jobs;
-         queue->max_jobs = new_max_jobs;
-      } else {
-         /* Wait until there is a free slot. */
-         while (queue->num_queued == queue->max_jobs)
-            cnd_wait(&queue->has_space_cond, &queue->lock);
+   new_job.job = job;
+   new_job.fence = fence;
+   new_job.execute = execute;
+   new_job.cleanup = cleanup;
+
+   /* Count the job in the current generation. If util_queue_finish starts
+    * a new one in the meantime, it may or may not have seen the job, so
+    * count it in the new one instead.
+    */
+   while (1) {
+      new_job.generation = p_atomic_read(&queue->generation);
+      p_atomic_inc(&queue->num_pending[new_job.generation & 1]);
+
+      if (p_atomic_read(&queue->generation) == new_job.generation)
+         break;
+
+      if (p_atomic_dec_zero(&queue->num_pending[new_job.generation & 1]) &&
+          p_atomic_read(&queue->num_finish_waiters)) {
+         mtx_lock(&queue->lock);
+         cnd_broadcast(&queue->idle_cond);
+         mtx_unlock(&queue->lock);
       }
    }
 
-   ptr = &queue->jobs[queue->write_idx];
-   assert(ptr->job == NULL);
-   ptr->job = job;
-   ptr->fence = fence;
-   ptr->execute = execute;
-   ptr->cleanup = cleanup;
-   queue->write_idx = (queue->write_idx + 1) % queue->max_jobs;
+   /* Distribute the jobs over the threads, idle threads steal them anyway. */
+   unsigned num_threads = p_atomic_read(&queue->num_threads);
+   struct util_queue_thread_jobs *jobs =
+      &queue->thread_jobs[p_atomic_inc_return(&queue->next_thread) %
+                          num_threads];
 
-   queue->num_queued++;
-   cnd_signal(&queue->has_queued_cond);
-   mtx_unlock(&queue->lock);
+   mtx_lock(&jobs->lock);
+   util_queue_ring_push(&jobs->rings[priority], &new_job);
+   mtx_unlock(&jobs->lock);
+
+   /* Only wake up threads once the job can be taken, so that they don't
+    * spin waiting for it.
+    */
+   p_atomic_inc(&queue->num_ready);
+   if (p_atomic_read(&queue->num_sleeping)) {
+      mtx_lock(&queue->lock);
+      cnd_signal(&queue->has_queued_cond);
+      mtx_unlock(&queue->lock);
+   }
+
+   if (queue->flags & UTIL_QUEUE_INIT_SCALE_THREADS)
+      util_queue_scale_threads(queue);
+}
+
+void
+util_queue_add_job(struct util_queue *queue,
+                   void *job,
+                   struct util_queue_fence *fence,
+                   util_queue_execute_func execute,
+                   util_queue_execute_func cleanup)
+{
+   util_queue_add_job_with_priority(queue, job, fence, execute, cleanup,
+                                    UTIL_QUEUE_PRIORITY_NORMAL);
 }
 
 /**
@@ -533,20 +736,37 @@ util_queue_drop_job(struct util_queue *queue, struct util_queue_fence *fence)
    if (util_queue_fence_is_signalled(fence))
       return;
 
-   mtx_lock(&queue->lock);
-   for (unsigned i = queue->read_idx; i != queue->write_idx;
-        i = (i + 1) % queue->max_jobs) {
-      if (queue->jobs[i].fence == fence) {
-         if (queue->jobs[i].cleanup)
-            queue->jobs[i].cleanup(queue->jobs[i].job, -1);
-
-         /* Just clear it. The threads will treat as a no-op job. */
-         memset(&queue->jobs[i], 0, sizeof(queue->jobs[i]));
-         removed = true;
-         break;
+   unsigned num_threads = p_atomic_read(&queue->num_threads);
+
+   for (unsigned t = 0; t < num_threads && !removed; t++) {
+      struct util_queue_thread_jobs *jobs = &queue->thread_jobs[t];
+
+      mtx_lock(&jobs->lock);
+      for (unsigned p = 0; p < UTIL_QUEUE_NUM_PRIORITIES && !removed; p++) {
+         struct util_queue_ring *ring = &jobs->rings[p];
+
+         for (unsigned i = 0; i < ring->num_jobs; i++) {
+            struct util_queue_job *job =
+               &ring->jobs[(ring->read_idx + i) % ring->size];
+
+            if (job->fence == fence) {
+               if (job->cleanup)
+                  job->cleanup(job->job, -1);
+
+               /* Just clear it. The threads will treat as a no-op job, but
+                * still need its generation.
+                */
+               job->job = NULL;
+               job->fence = NULL;
+               job->execute = NULL;
+               job->cleanup = NULL;
+               removed = true;
+               break;
+            }
+         }
       }
+      mtx_unlock(&jobs->lock);
    }
-   mtx_unlock(&queue->lock);
 
    if (removed)
       util_queue_fence_signal(fence);
@@ -554,51 +774,41 @@ util_queue_drop_job(struct util_queue *queue, struct util_queue_fence *fence)
       util_queue_fence_wait(fence);
 }
 
-static void
-util_queue_finish_execute(void *data, int num_thread)
-{
-   util_barrier *barrier = data;
-   util_barrier_wait(barrier);
-}
-
 /**
  * Wait until all previously added jobs have completed.
+ *
+ * Jobs added by other threads in the meantime aren't waited for, they are
+ * counted in a new generation.
  */
 void
 util_queue_finish(struct util_queue *queue)
 {
-   util_barrier barrier;
-   struct util_queue_fence *fences = malloc(queue->num_threads * sizeof(*fences));
-
-   util_barrier_init(&barrier, queue->num_threads);
-
-   /* If 2 threads were adding jobs for 2 different barries at the same time,
-    * a deadlock would happen, because 1 barrier requires that all threads
-    * wait for it exclusively.
+   /* If 2 threads waited at the same time, the jobs of the second one's new
+    * generation would be counted in the generation the first one waits for.
     */
    mtx_lock(&queue->finish_lock);
 
-   for (unsigned i = 0; i < queue->num_threads; ++i) {
-      util_queue_fence_init(&fences[i]);
-      util_queue_add_job(queue, &barrier, &fences[i], util_queue_finish_execute, NULL);
-   }
+   unsigned generation = p_atomic_read(&queue->generation);
+   int *num_pending = &queue->num_pending[generation & 1];
 
-   for (unsigned i = 0; i < queue->num_threads; ++i) {
-      util_queue_fence_wait(&fences[i]);
-      util_queue_fence_destroy(&fences[i]);
-   }
-   mtx_unlock(&queue->finish_lock);
+   p_atomic_inc(&queue->generation);
 
-   util_barrier_destroy(&barrier);
+   mtx_lock(&queue->lock);
+   p_atomic_inc(&queue->num_finish_waiters);
+   while (!queue->kill_threads && p_atomic_read(num_pending) > 0)
+      cnd_wait(&queue->idle_cond, &queue->lock);
+   p_atomic_dec(&queue->num_finish_waiters);
+   mtx_unlock(&queue->lock);
 
-   free(fences);
+   mtx_unlock(&queue->finish_lock);
 }
 
 int64_t
 util_queue_get_thread_time_nano(struct util_queue *queue, unsigned thread_index)
 {
    /* Allow some flexibility by not raising an error. */
-   if (thread_index >= queue->num_threads)
+   if (thread_index >= p_atomic_read(&queue->num_threads) ||
+       p_atomic_read(&queue->kill_threads))
       return 0;
 
    return u_thread_get_time_nano(queue->threads[thread_index]);
@@ -28,6 +28,12 @@
  *
  * Jobs can be added from any thread. After that, the wait call can be used
  * to wait for completion of the job.
+ *
+ * Every thread of the queue has its own list of jobs for each priority,
+ * and new jobs are distributed over the threads. A thread without jobs
+ * steals jobs from the other threads, so the only lock shared by all the
+ * threads is taken for going to sleep and waking up. Jobs of the same
+ * priority are executed in order if the queue has a single thread.
  */
 
 #ifndef U_QUEUE_H
@@ -49,6 +55,10 @@ extern "C" {
 #define UTIL_QUEUE_INIT_USE_MINIMUM_PRIORITY      (1 << 0)
 #define UTIL_QUEUE_INIT_RESIZE_IF_FULL            (1 << 1)
 #define UTIL_QUEUE_INIT_SET_FULL_THREAD_AFFINITY  (1 << 2)
+/* Start with a single thread, and create more threads (up to the number
+ * passed to util_queue_init) when jobs are waiting for a thread.
+ */
+#define UTIL_QUEUE_INIT_SCALE_THREADS             (1 << 3)
 
 #if defined(__GNUC__) && defined(HAVE_LINUX_FUTEX_H)
 #define UTIL_QUEUE_FENCE_FUTEX
@@ -191,28 +201,73 @@ util_queue_fence_wait_timeout(struct util_queue_fence *fence,
 
 typedef void (*util_queue_execute_func)(void *job, int thread_index);
 
+/* Jobs of a higher priority are started before any job of a lower priority,
+ * regardless of the order they were added in.
+ *
+ * Jobs of the same priority aren't strictly started in the order they were
+ * added in either: they are distributed over the threads and idle threads
+ * steal them from each other, so only the jobs that end up in the same
+ * thread are started in order. Use fences to order dependent jobs.
+ */
+enum util_queue_priority {
+   /* Something is going to wait for the job (e.g. the next draw call). */
+   UTIL_QUEUE_PRIORITY_BLOCKING,
+   /* The default used by util_queue_add_job. */
+   UTIL_QUEUE_PRIORITY_NORMAL,
+   /* Nothing depends on the job (e.g. optimized shader variants). */
+   UTIL_QUEUE_PRIORITY_BACKGROUND,
+   UTIL_QUEUE_NUM_PRIORITIES,
+};
+
 struct util_queue_job {
    void *job;
    struct util_queue_fence *fence;
    util_queue_execute_func execute;
    util_queue_execute_func cleanup;
+   unsigned generation; /* see util_queue::num_pending */
+};
+
+/* Ring buffer of jobs of one priority. */
+struct util_queue_ring {
+   struct util_queue_job *jobs;
+   unsigned size;
+   unsigned read_idx;
+   int num_jobs; /* also read without the lock as a hint */
+};
+
+/* The jobs assigned to one thread. */
+struct util_queue_thread_jobs {
+   mtx_t lock;
+   struct util_queue_ring rings[UTIL_QUEUE_NUM_PRIORITIES];
 };
 
 /* Put this into your context. */
 struct util_queue {
    char name[14]; /* 13 characters = the thread name without the index */
-   mtx_t finish_lock; /* only for util_queue_finish */
-   mtx_t lock;
+   mtx_t lock; /* for sleeping, waking up and creating threads */
+   mtx_t finish_lock; /* only 1 util_queue_finish can wait at a time */
    cnd_t has_queued_cond;
    cnd_t has_space_cond;
+   cnd_t idle_cond;
    thrd_t *threads;
+   struct util_queue_thread_jobs *thread_jobs; /* one per thread */
    unsigned flags;
-   int num_queued;
+   int num_queued; /* jobs not taken by a thread yet, including the jobs
+                      being added */
+   int num_ready; /* jobs that can be taken from the rings */
+   /* Jobs not completed yet, per generation. util_queue_finish starts a new
+    * generation and waits for the jobs of the previous one.
+    */
+   int num_pending[2];
+   unsigned generation;
+   int num_sleeping; /* threads waiting for jobs */
+   int num_space_waiters; /* callers waiting for num_queued < max_jobs */
+   int num_finish_waiters;
    unsigned num_threads;
+   unsigned max_threads;
+   unsigned next_thread; /* where to put the next job */
    int kill_threads;
    int max_jobs;
-   int write_idx, read_idx; /* ring buffer pointers */
-   struct util_queue_job *jobs;
 
    /* for cleanup at exit(), protected by exit_mutex */
    struct list_head head;
@@ -231,6 +286,12 @@ void util_queue_add_job(struct util_queue *queue,
                         struct util_queue_fence *fence,
                         util_queue_execute_func execute,
                         util_queue_execute_func cleanup);
+void util_queue_add_job_with_priority(struct util_queue *queue,
+                                      void *job,
+                                      struct util_queue_fence *fence,
+                                      util_queue_execute_func execute,
+                                      util_queue_execute_func cleanup,
+                                      enum util_queue_priority priority);
 void util_queue_drop_job(struct util_queue *queue,
                          struct util_queue_fence *fence);
 